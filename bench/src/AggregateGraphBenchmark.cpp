@@ -0,0 +1,116 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "AggregateGraphBenchmark.hpp"
+#include <sirikata/space/AggregateJobGraph.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+// One in SLOW_JOB_INTERVAL jobs takes SLOW_JOB_FACTOR times longer
+#define SLOW_JOB_INTERVAL 100
+#define SLOW_JOB_FACTOR 50
+
+namespace Sirikata {
+
+AggregateGraphBenchmark::AggregateGraphBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* objects;
+    OptionValue* fanout;
+    OptionValue* work;
+    Sirikata::InitializeClassOptions ico("AggregateGraphBenchmark",this,
+        objects=new OptionValue("objects","100000",Sirikata::OptionValueType<uint32>(),"Number of objects in the scene"),
+        fanout=new OptionValue("fanout","10",Sirikata::OptionValueType<uint32>(),"Number of children of each aggregate"),
+        work=new OptionValue("work","200",Sirikata::OptionValueType<uint32>(),"Time each aggregate's job takes, in microseconds"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("AggregateGraphBenchmark",this);
+    optionsSet->parse(param);
+
+    mObjects = objects->as<uint32>();
+    mFanout = std::max(fanout->as<uint32>(), (uint32)2);
+    mWork = work->as<uint32>();
+}
+
+String AggregateGraphBenchmark::name() {
+    return "aggregate-graph";
+}
+
+void AggregateGraphBenchmark::runJob(AggregateJobGraph* graph, const Aggregate* agg) {
+    Time until = Timer::now() + Duration::microseconds(agg->work);
+    while(Timer::now() < until && !mForceStop)
+        ;
+    graph->finish(agg->id);
+}
+
+Duration AggregateGraphBenchmark::run(uint32 nthreads) {
+    AggregateJobGraph graph(nthreads, "AggregateGraphBenchmark");
+
+    Time start = Timer::now();
+    // Added top down, the way dirty aggregates are found, so every aggregate
+    // starts out waiting for its children.
+    for(int32 i = mAggregates.size() - 1; i >= 0; i--) {
+        const Aggregate& agg = mAggregates[i];
+        graph.add(
+            agg.id, agg.children, agg.level * 0.001,
+            std::tr1::bind(&AggregateGraphBenchmark::runJob, this, &graph, &agg)
+        );
+    }
+    while(graph.size() > 0 && !mForceStop)
+        Timer::sleep(Duration::milliseconds(1));
+    return Timer::now() - start;
+}
+
+void AggregateGraphBenchmark::start() {
+    mForceStop = false;
+
+    // Build the tree bottom up, grouping mFanout nodes at a time, so
+    // aggregates are stored children first.
+    mAggregates.clear();
+    std::vector<UUID> level_nodes;
+    for(uint32 i = 0; i < mObjects; i++)
+        level_nodes.push_back(UUID::random());
+    uint32 level = 0;
+    while(level_nodes.size() > 1) {
+        std::vector<UUID> parents;
+        for(uint32 i = 0; i < level_nodes.size(); i += mFanout) {
+            Aggregate agg;
+            agg.id = UUID::random();
+            agg.children.assign(level_nodes.begin() + i, level_nodes.begin() + std::min(i + mFanout, (uint32)level_nodes.size()));
+            agg.level = level;
+            agg.work = (mAggregates.size() % SLOW_JOB_INTERVAL == 0) ? mWork * SLOW_JOB_FACTOR : mWork;
+            mAggregates.push_back(agg);
+            parents.push_back(agg.id);
+        }
+        level_nodes.swap(parents);
+        level++;
+    }
+    if (mAggregates.empty()) {
+        notifyFinished();
+        return;
+    }
+
+    uint32 cores = std::max(boost::thread::hardware_concurrency(), 1u);
+    uint32 thread_counts[2] = { 1, cores };
+    for(uint32 i = 0; i < 2 && !mForceStop; i++) {
+        if (i > 0 && thread_counts[i] == thread_counts[0]) break;
+        Duration elapsed = run(thread_counts[i]);
+        if (mForceStop) break;
+        float64 secs = elapsed.toSeconds();
+        SILOG(benchmark,info,
+            mObjects << " objects, " << mAggregates.size() << " aggregates, " << level << " levels, " <<
+            thread_counts[i] << " threads: tree rebuilt in " << elapsed << ", " <<
+            (secs > 0 ? mAggregates.size() / secs : 0) << " aggregates/sec");
+    }
+
+    if (!mForceStop)
+        notifyFinished();
+}
+
+void AggregateGraphBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,63 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_AGGREGATE_GRAPH_BENCHMARK_HPP_
+#define _SIRIKATA_AGGREGATE_GRAPH_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+
+namespace Sirikata {
+
+class AggregateJobGraph;
+
+/** AggregateGraphBenchmark measures how quickly AggregateJobGraph rebuilds a
+ *  whole aggregate tree, as AggregateManager does when a scene is loaded. The
+ *  tree is synthetic, built over a configurable number of objects with a fixed
+ *  fanout, and each aggregate's job just spins for a while, with an
+ *  occasional much slower one standing in for a large simplification. The
+ *  tree is rebuilt with a single thread, like the old aggregation strand, and
+ *  with one thread per core, reporting aggregates/sec and the time for the
+ *  whole tree.
+ */
+class AggregateGraphBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new AggregateGraphBenchmark(finished_cb, _param);
+    }
+
+    AggregateGraphBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    struct Aggregate {
+        UUID id;
+        std::vector<UUID> children;
+        uint32 level;
+        // Spin time for the job, in microseconds
+        uint32 work;
+    };
+
+    // Rebuilds the tree with nthreads threads, returning the elapsed time.
+    Duration run(uint32 nthreads);
+    void runJob(AggregateJobGraph* graph, const Aggregate* agg);
+
+    bool mForceStop;
+
+    uint32 mObjects;
+    uint32 mFanout;
+    uint32 mWork;
+
+    std::vector<Aggregate> mAggregates;
+}; // class AggregateGraphBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_AGGREGATE_GRAPH_BENCHMARK_HPP_
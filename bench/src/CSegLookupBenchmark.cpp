@@ -0,0 +1,138 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "CSegLookupBenchmark.hpp"
+#include <sirikata/space/ServerRegionIndex.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+#define MIN_REGIONS 10
+#define MAX_REGIONS 10000
+
+namespace Sirikata {
+
+namespace {
+
+struct CachedRegion {
+    BoundingBox3f bbox;
+    ServerID server;
+};
+
+uint32 xorshift(uint32* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+float32 randomUnit(uint32* state) {
+    return (xorshift(state) % 65536) / 65536.f;
+}
+
+} // namespace
+
+CSegLookupBenchmark::CSegLookupBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* lookups;
+    Sirikata::InitializeClassOptions ico("CSegLookupBenchmark",this,
+        lookups=new OptionValue("lookups","1000000",Sirikata::OptionValueType<uint32>(),"Number of lookups for each number of regions"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("CSegLookupBenchmark",this);
+    optionsSet->parse(param);
+
+    mLookups = lookups->as<uint32>();
+}
+
+String CSegLookupBenchmark::name() {
+    return "cseg-lookup";
+}
+
+bool CSegLookupBenchmark::run(uint32 nregions, float64* index_ns_out, float64* scan_ns_out) {
+    // Fixed seed so runs are comparable
+    uint32 rng = 0x2545F491;
+
+    // Fill the smallest cubic grid that holds nregions cells of a 1km world
+    uint32 side = 1;
+    while(side * side * side < nregions) side++;
+    float32 cell = 1000.f / side;
+
+    std::vector<CachedRegion> regions;
+    for(uint32 i = 0; i < nregions; i++) {
+        Vector3f cmin(
+            -500.f + (i % side) * cell,
+            -500.f + ((i / side) % side) * cell,
+            -500.f + (i / (side * side)) * cell
+        );
+        CachedRegion region;
+        region.bbox = BoundingBox3f(cmin, cmin + Vector3f(cell, cell, cell));
+        region.server = i + 1;
+        regions.push_back(region);
+    }
+    // Regions are learned in whatever order objects happen to need them
+    for(uint32 i = nregions - 1; i > 0; i--)
+        std::swap(regions[i], regions[xorshift(&rng) % (i + 1)]);
+
+    ServerRegionIndex index;
+    for(uint32 i = 0; i < nregions; i++)
+        index.insert(regions[i].bbox, regions[i].server);
+
+    std::vector<Vector3f> points;
+    for(uint32 i = 0; i < mLookups; i++) {
+        const BoundingBox3f& bbox = regions[xorshift(&rng) % nregions].bbox;
+        points.push_back(bbox.min() + Vector3f(randomUnit(&rng), randomUnit(&rng), randomUnit(&rng)) * cell);
+    }
+
+    // Keep the results so the lookups can't be optimized away, and so the
+    // two methods can be checked against each other
+    std::vector<ServerID> index_results(mLookups), scan_results(mLookups);
+
+    Time index_start = Timer::now();
+    for(uint32 i = 0; i < mLookups; i++)
+        index_results[i] = index.lookup(points[i]);
+    Time index_end = Timer::now();
+
+    for(uint32 i = 0; i < mLookups; i++) {
+        ServerID result = NullServerID;
+        for(uint32 r = 0; r < nregions; r++) {
+            if (regions[r].bbox.contains(points[i])) {
+                result = regions[r].server;
+                break;
+            }
+        }
+        scan_results[i] = result;
+    }
+    Time scan_end = Timer::now();
+
+    *index_ns_out = mLookups > 0 ? (index_end - index_start).toMicroseconds() * 1000.0 / mLookups : 0;
+    *scan_ns_out = mLookups > 0 ? (scan_end - index_end).toMicroseconds() * 1000.0 / mLookups : 0;
+
+    return index_results == scan_results;
+}
+
+void CSegLookupBenchmark::start() {
+    mForceStop = false;
+
+    for(uint32 nregions = MIN_REGIONS; nregions <= MAX_REGIONS && !mForceStop; nregions *= 10) {
+        float64 index_ns, scan_ns;
+        bool matched = run(nregions, &index_ns, &scan_ns);
+        if (mForceStop) break;
+
+        SILOG(benchmark,info,
+            nregions << " regions: " << index_ns << "ns/lookup indexed, " << scan_ns << "ns/lookup scanned");
+        if (!matched)
+            SILOG(benchmark,error,nregions << " regions: indexed and scanned lookups disagree");
+    }
+
+    if (!mForceStop)
+        notifyFinished();
+}
+
+void CSegLookupBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
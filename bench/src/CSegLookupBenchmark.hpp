@@ -0,0 +1,47 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CSEG_LOOKUP_BENCHMARK_HPP_
+#define _SIRIKATA_CSEG_LOOKUP_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** CSegLookupBenchmark measures the cost of a CoordinateSegmentationClient
+ *  lookup that hits its cache, as the number of cached regions grows from 10
+ *  to 10,000. The regions are cells of a grid, inserted in random order, and
+ *  each lookup is for a random point in a random cell. Each size is run
+ *  against the ServerRegionIndex the client uses and against a linear scan of
+ *  the regions, which is how the cache used to work.
+ */
+class CSegLookupBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new CSegLookupBenchmark(finished_cb, _param);
+    }
+
+    CSegLookupBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Runs the benchmark with nregions cached regions, returning the mean
+    // cost of a lookup in nanoseconds with the index and with a linear scan.
+    // Returns false if the two disagreed about any lookup.
+    bool run(uint32 nregions, float64* index_ns_out, float64* scan_ns_out);
+
+    bool mForceStop;
+
+    uint32 mLookups;
+}; // class CSegLookupBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CSEG_LOOKUP_BENCHMARK_HPP_
@@ -0,0 +1,119 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "EventLoopStatsBenchmark.hpp"
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/network/EventLoopStats.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/options/Options.hpp>
+
+namespace Sirikata {
+
+using namespace Sirikata::Network;
+
+namespace {
+void emptyHandler() {
+}
+} // namespace
+
+EventLoopStatsBenchmark::EventLoopStatsBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* handlers;
+    OptionValue* batch;
+    OptionValue* threads;
+    Sirikata::InitializeClassOptions ico("EventLoopStatsBenchmark",this,
+        handlers=new OptionValue("handlers","4000000",Sirikata::OptionValueType<uint32>(),"Number of empty handlers to post in each run"),
+        batch=new OptionValue("batch","100000",Sirikata::OptionValueType<uint32>(),"Number of handlers posted before they're run"),
+        threads=new OptionValue("threads","1",Sirikata::OptionValueType<uint32>(),"Number of threads running the IOService"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("EventLoopStatsBenchmark",this);
+    optionsSet->parse(param);
+
+    mHandlers = handlers->as<uint32>();
+    mBatch = std::max(batch->as<uint32>(), (uint32)1);
+    mThreads = std::max(threads->as<uint32>(), (uint32)1);
+}
+
+String EventLoopStatsBenchmark::name() {
+    return "event-loop-stats";
+}
+
+float64 EventLoopStatsBenchmark::run(bool enabled, bool strand) {
+    IOService* ios = new IOService("EventLoopStatsBenchmark");
+    IOStrand* str = ios->createStrand("EventLoopStatsBenchmark");
+    EventLoopStats::setEnabled(enabled);
+
+    Time start_time = Timer::now();
+    uint32 posted = 0;
+    while(posted < mHandlers && !mForceStop) {
+        uint32 batch_end = std::min(posted + mBatch, mHandlers);
+        for(; posted < batch_end; posted++) {
+            if (strand)
+                str->post(&emptyHandler, "EventLoopStatsBenchmark::emptyHandler");
+            else
+                ios->post(&emptyHandler, "EventLoopStatsBenchmark::emptyHandler");
+        }
+
+        std::vector<Thread*> workers;
+        for(uint32 i = 1; i < mThreads; i++)
+            workers.push_back(new Thread("EventLoopStatsBenchmark Worker", std::tr1::bind(&IOService::runNoReturn, ios)));
+        ios->run();
+        for(uint32 i = 0; i < workers.size(); i++) {
+            workers[i]->join();
+            delete workers[i];
+        }
+        ios->reset();
+    }
+    Duration dur = Timer::now() - start_time;
+
+    if (enabled && !mForceStop) {
+        EventLoopStats::TagStatsList tags;
+        (strand ? str->eventLoopStats() : ios->eventLoopStats()).getStats(tags);
+        if (tags.empty() || tags[0].handled != mHandlers)
+            SILOG(benchmark,error,"Handlers weren't all counted by EventLoopStats");
+        else
+            SILOG(benchmark,info,
+                "  " << tags[0].tag << ": wait p50 " << tags[0].wait.percentile(.5) <<
+                ", p99 " << tags[0].wait.percentile(.99) <<
+                ", run p99 " << tags[0].run.percentile(.99));
+    }
+
+    EventLoopStats::setEnabled(false);
+    delete str;
+    delete ios;
+
+    if (mForceStop) return -1;
+    return dur.toMicroseconds() * 1000 / (float64)mHandlers;
+}
+
+void EventLoopStatsBenchmark::start() {
+    mForceStop = false;
+
+    for(uint32 s = 0; s < 2; s++) {
+        bool strand = (s == 1);
+        float64 off = run(false, strand);
+        if (off < 0) return;
+        float64 on = run(true, strand);
+        if (on < 0) return;
+
+        SILOG(benchmark,info,
+            mHandlers << " handlers " << (strand ? "through an IOStrand" : "on the IOService") <<
+            " with " << mThreads << " threads: " <<
+            off << "ns/handler without stats, " << on << "ns/handler with stats, " <<
+            (on - off) << "ns overhead");
+    }
+
+    notifyFinished();
+}
+
+void EventLoopStatsBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
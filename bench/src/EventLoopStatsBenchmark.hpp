@@ -0,0 +1,45 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_EVENT_LOOP_STATS_BENCHMARK_HPP_
+#define _SIRIKATA_EVENT_LOOP_STATS_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** EventLoopStatsBenchmark measures the overhead of Network::EventLoopStats by
+ *  posting millions of empty handlers to an IOService, directly and through an
+ *  IOStrand, with the stats turned off and on.
+ */
+class EventLoopStatsBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new EventLoopStatsBenchmark(finished_cb, _param);
+    }
+
+    EventLoopStatsBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Posts and runs all the handlers, returning how long it took per handler
+    // or a negative value if it was stopped.
+    float64 run(bool enabled, bool strand);
+
+    bool mForceStop;
+
+    uint32 mHandlers;
+    uint32 mBatch;
+    uint32 mThreads;
+}; // class EventLoopStatsBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_EVENT_LOOP_STATS_BENCHMARK_HPP_
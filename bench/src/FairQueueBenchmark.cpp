@@ -0,0 +1,117 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "FairQueueBenchmark.hpp"
+#include <sirikata/core/queue/FairQueue.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+#define MIN_FLOWS 10
+#define MAX_FLOWS 100000
+
+namespace Sirikata {
+
+namespace {
+
+struct BenchPacket {
+    uint32 bytes;
+
+    uint32 size() const {
+        return bytes;
+    }
+};
+
+typedef Queue<BenchPacket*> BenchPacketQueue;
+typedef FairQueue<BenchPacket, uint32, BenchPacketQueue> BenchFairQueue;
+
+uint32 xorshift(uint32* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+} // namespace
+
+FairQueueBenchmark::FairQueueBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* operations;
+    OptionValue* batchSize;
+    Sirikata::InitializeClassOptions ico("FairQueueBenchmark",this,
+        operations=new OptionValue("operations","2000000",Sirikata::OptionValueType<uint32>(),"Number of packets pushed and popped for each number of flows"),
+        batchSize=new OptionValue("batch-size","1000",Sirikata::OptionValueType<uint32>(),"Number of packets pushed before they're all popped again"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("FairQueueBenchmark",this);
+    optionsSet->parse(param);
+
+    mOperations = operations->as<uint32>();
+    mBatchSize = std::max(batchSize->as<uint32>(), (uint32)1);
+}
+
+String FairQueueBenchmark::name() {
+    return "fair-queue";
+}
+
+void FairQueueBenchmark::run(uint32 nflows, float64* push_ns_out, float64* pop_ns_out) {
+    // Fixed seed so runs are comparable
+    uint32 rng = 0x2545F491;
+
+    BenchFairQueue fq;
+    for(uint32 i = 0; i < nflows; i++)
+        fq.addQueue(new BenchPacketQueue(1 << 30), i, 0.5f + (xorshift(&rng) % 16) * 0.25f);
+
+    // Packets are reused across batches so allocation isn't measured
+    std::vector<BenchPacket> packets(mBatchSize);
+    std::vector<uint32> flows(mBatchSize);
+
+    Duration push_time = Duration::zero();
+    Duration pop_time = Duration::zero();
+    uint64 pushed = 0, popped = 0;
+    for(uint32 done = 0; done < mOperations && !mForceStop; done += mBatchSize) {
+        for(uint32 i = 0; i < mBatchSize; i++) {
+            packets[i].bytes = 64 + (xorshift(&rng) % 1400);
+            flows[i] = xorshift(&rng) % nflows;
+        }
+
+        Time push_start = Timer::now();
+        for(uint32 i = 0; i < mBatchSize; i++)
+            fq.push(flows[i], &packets[i]);
+        Time push_end = Timer::now();
+        while(fq.pop() != NULL)
+            popped++;
+        Time pop_end = Timer::now();
+
+        pushed += mBatchSize;
+        push_time += push_end - push_start;
+        pop_time += pop_end - push_end;
+    }
+
+    *push_ns_out = pushed > 0 ? push_time.toMicroseconds() * 1000.0 / pushed : 0;
+    *pop_ns_out = popped > 0 ? pop_time.toMicroseconds() * 1000.0 / popped : 0;
+}
+
+void FairQueueBenchmark::start() {
+    mForceStop = false;
+
+    for(uint32 nflows = MIN_FLOWS; nflows <= MAX_FLOWS && !mForceStop; nflows *= 10) {
+        float64 push_ns, pop_ns;
+        run(nflows, &push_ns, &pop_ns);
+        if (mForceStop) break;
+
+        SILOG(benchmark,info,
+            nflows << " flows: " << push_ns << "ns/push, " << pop_ns << "ns/pop");
+    }
+
+    if (!mForceStop)
+        notifyFinished();
+}
+
+void FairQueueBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
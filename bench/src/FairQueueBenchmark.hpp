@@ -0,0 +1,45 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_FAIR_QUEUE_BENCHMARK_HPP_
+#define _SIRIKATA_FAIR_QUEUE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** FairQueueBenchmark measures the cost of FairQueue::push and FairQueue::pop
+ *  as the number of flows grows from 10 to 100,000, each flow with a random
+ *  weight. Packets are pushed onto random flows in batches and then all
+ *  popped again, so the set of flows with something queued keeps changing.
+ */
+class FairQueueBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new FairQueueBenchmark(finished_cb, _param);
+    }
+
+    FairQueueBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Runs the benchmark with nflows flows, returning the mean cost of a push
+    // and of a pop in nanoseconds
+    void run(uint32 nflows, float64* push_ns_out, float64* pop_ns_out);
+
+    bool mForceStop;
+
+    uint32 mOperations;
+    uint32 mBatchSize;
+}; // class FairQueueBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_FAIR_QUEUE_BENCHMARK_HPP_
@@ -0,0 +1,218 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ForwarderPipelineBenchmark.hpp"
+#include <sirikata/space/ShardedOSegCache.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrandImpl.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+namespace Sirikata {
+
+ForwarderPipelineBenchmark::ForwarderPipelineBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mCache(NULL),
+          mRemaining(0)
+{
+    OptionValue* maxThreads;
+    OptionValue* objects;
+    OptionValue* servers;
+    OptionValue* messages;
+    OptionValue* batchSize;
+    OptionValue* payloadSize;
+    Sirikata::InitializeClassOptions ico("ForwarderPipelineBenchmark",this,
+        maxThreads=new OptionValue("max-threads","8",Sirikata::OptionValueType<uint32>(),"Largest number of routing threads to test"),
+        objects=new OptionValue("objects","100000",Sirikata::OptionValueType<uint32>(),"Number of destination objects"),
+        servers=new OptionValue("servers","16",Sirikata::OptionValueType<uint32>(),"Number of remote servers objects are spread across"),
+        messages=new OptionValue("messages","1000000",Sirikata::OptionValueType<uint32>(),"Number of messages to route for each thread count"),
+        batchSize=new OptionValue("batch-size","64",Sirikata::OptionValueType<uint32>(),"Maximum messages per routing batch, as forwarder.routing-batch-size"),
+        payloadSize=new OptionValue("payload-size","64",Sirikata::OptionValueType<uint32>(),"Size of each message's payload in bytes"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("ForwarderPipelineBenchmark",this);
+    optionsSet->parse(param);
+
+    mMaxThreads = maxThreads->as<uint32>();
+    mObjects = std::max(objects->as<uint32>(), (uint32)1);
+    mServers = std::max(servers->as<uint32>(), (uint32)1);
+    mMessages = messages->as<uint32>();
+    mBatchSize = std::max(batchSize->as<uint32>(), (uint32)1);
+    mPayloadSize = payloadSize->as<uint32>();
+}
+
+String ForwarderPipelineBenchmark::name() {
+    return "forwarder-pipeline";
+}
+
+void ForwarderPipelineBenchmark::generateMessages(ObjectMessageList* messages_out) {
+    // Every message gets the next sequence number for its destination so the
+    // server queues can check that per-object order was kept.
+    std::vector<uint64> seqnos(mObjects, 0);
+    String payload(mPayloadSize, 'x');
+    uint32 rng = 0x2545F491;
+    for(uint32 i = 0; i < mMessages; i++) {
+        rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+        uint32 src = rng % mObjects;
+        rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+        uint32 dest = rng % mObjects;
+
+        ObjectMessage* msg = createObjectMessage(1, mObjectIDs[src], 1, mObjectIDs[dest], 1, payload);
+        msg->set_unique(seqnos[dest]++);
+        messages_out->push_back(msg);
+    }
+}
+
+void ForwarderPipelineBenchmark::route(ObjectMessage* msg, Outbox* outbox) {
+    OSegEntry dest = mCache->get(msg->dest_object());
+    // Everything is in the cache, servers are numbered from 1
+    (*outbox)[dest.server() - 1].push_back(msg);
+}
+
+void ForwarderPipelineBenchmark::flush(Outbox* outbox) {
+    std::vector<Message*> serialized;
+    for(uint32 idx = 0; idx < outbox->size(); idx++) {
+        ObjectMessageList& routed = (*outbox)[idx];
+        if (routed.empty()) continue;
+
+        ServerID dest_server = idx + 1;
+        serialized.clear();
+        for(uint32 i = 0; i < routed.size(); i++)
+            serialized.push_back(new Message(0, SERVER_PORT_OBJECT_MESSAGE_ROUTING, dest_server, SERVER_PORT_OBJECT_MESSAGE_ROUTING, routed[i]));
+
+        ServerQueue* queue = mServerQueues[idx];
+        {
+            boost::lock_guard<boost::mutex> lck(queue->mutex);
+            for(uint32 i = 0; i < routed.size(); i++) {
+                uint64 seqno = routed[i]->unique();
+                std::tr1::unordered_map<UUID, uint64, UUID::Hasher>::iterator seq_it = queue->lastSeqno.find(routed[i]->dest_object());
+                if (seq_it == queue->lastSeqno.end())
+                    queue->lastSeqno[routed[i]->dest_object()] = seqno;
+                else {
+                    if (seqno <= seq_it->second)
+                        queue->reordered++;
+                    seq_it->second = seqno;
+                }
+                queue->messages.push_back(serialized[i]);
+            }
+        }
+
+        for(uint32 i = 0; i < routed.size(); i++)
+            delete routed[i];
+        routed.clear();
+    }
+}
+
+void ForwarderPipelineBenchmark::handleBatch(uint32 partition, RoutingQueue::Batch& batch) {
+    Outbox* outbox = &mOutboxes[partition];
+    for(uint32 i = 0; i < batch.size(); i++)
+        route(batch[i], outbox);
+    flush(outbox);
+
+    boost::lock_guard<boost::mutex> lck(mDoneMutex);
+    mRemaining -= batch.size();
+    if (mRemaining == 0)
+        mDone.notify_one();
+}
+
+float64 ForwarderPipelineBenchmark::run(uint32 nthreads, const ObjectMessageList& messages) {
+    // Same partitioning as the Forwarder
+    uint32 npartitions = (nthreads > 0) ? 4 * nthreads : 1;
+    mOutboxes.clear();
+    mOutboxes.resize(npartitions, Outbox(mServers));
+
+    RoutingQueue* queue = NULL;
+    if (nthreads > 0) {
+        queue = new RoutingQueue(
+            "ForwarderPipelineBenchmark", nthreads, npartitions, mBatchSize,
+            std::tr1::bind(&ForwarderPipelineBenchmark::handleBatch, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2)
+        );
+        queue->start();
+    }
+
+    Time start = Timer::now();
+    if (queue == NULL) {
+        for(uint32 i = 0; i < messages.size(); i++) {
+            route(messages[i], &mOutboxes[0]);
+            if ((i+1) % mBatchSize == 0 || i+1 == messages.size())
+                flush(&mOutboxes[0]);
+        }
+    }
+    else {
+        mRemaining = messages.size();
+        for(uint32 i = 0; i < messages.size(); i++)
+            queue->push((uint32)UUID::Hasher()(messages[i]->dest_object()), messages[i]);
+
+        boost::unique_lock<boost::mutex> lck(mDoneMutex);
+        while(mRemaining > 0)
+            mDone.wait(lck);
+    }
+    Time end = Timer::now();
+
+    if (queue != NULL) {
+        queue->stop();
+        delete queue;
+    }
+
+    float64 seconds = (end - start).toSeconds();
+    return (seconds > 0) ? messages.size() / seconds : 0;
+}
+
+void ForwarderPipelineBenchmark::start() {
+    mForceStop = false;
+
+    // ShardedOSegCache wants a Context for time and stats reporting, but we
+    // never start it so no stats are reported.
+    Network::IOService* ios = new Network::IOService("ForwarderPipelineBenchmark");
+    Network::IOStrand* strand = ios->createStrand("ForwarderPipelineBenchmark Main");
+    Context* ctx = new Context("ForwarderPipelineBenchmark", ios, strand, NULL, Timer::now());
+
+    mCache = new ShardedOSegCache(ctx, "bench.forwarder.oseg.cache", mObjects, Duration::zero());
+    mObjectIDs.clear();
+    for(uint32 i = 0; i < mObjects; i++) {
+        mObjectIDs.push_back(UUID::random());
+        mCache->insert(mObjectIDs.back(), OSegEntry(1 + (i % mServers), 1.f));
+    }
+
+    for(uint32 nthreads = 0; nthreads <= mMaxThreads && !mForceStop; nthreads = (nthreads == 0 ? 1 : nthreads * 2)) {
+        for(uint32 i = 0; i < mServers; i++) {
+            ServerQueue* queue = new ServerQueue();
+            queue->reordered = 0;
+            mServerQueues.push_back(queue);
+        }
+
+        ObjectMessageList messages;
+        generateMessages(&messages);
+        float64 rate = run(nthreads, messages);
+
+        uint64 reordered = 0;
+        for(uint32 i = 0; i < mServerQueues.size(); i++) {
+            reordered += mServerQueues[i]->reordered;
+            for(std::deque<Message*>::iterator it = mServerQueues[i]->messages.begin(); it != mServerQueues[i]->messages.end(); it++)
+                delete *it;
+            delete mServerQueues[i];
+        }
+        mServerQueues.clear();
+
+        SILOG(benchmark,info,
+            (nthreads == 0 ? String("inline") : boost::lexical_cast<String>(nthreads) + " threads") << ": "
+            << rate << " messages/s, " << reordered << " reordered");
+    }
+
+    delete mCache;
+    mCache = NULL;
+    delete ctx;
+    delete strand;
+    delete ios;
+
+    if (!mForceStop)
+        notifyFinished();
+}
+
+void ForwarderPipelineBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
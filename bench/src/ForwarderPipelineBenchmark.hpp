@@ -0,0 +1,93 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_FORWARDER_PIPELINE_BENCHMARK_HPP_
+#define _SIRIKATA_FORWARDER_PIPELINE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/network/ObjectMessage.hpp>
+#include <sirikata/core/queue/PartitionedStrandQueue.hpp>
+#include <sirikata/space/ServerMessage.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+class OSegCache;
+
+/** ForwarderPipelineBenchmark measures how the space server's object message
+ *  routing scales with forwarder.routing-threads, without any networking.
+ *
+ *  A single thread, standing in for a networking thread, pushes pre-generated
+ *  object messages into a PartitionedStrandQueue keyed by destination object,
+ *  as the Forwarder does. Each batch looks up destinations in a
+ *  ShardedOSegCache, groups messages by destination server in a per-partition
+ *  outbox, and then merges them into per-server queues (standing in for the
+ *  ODPFlowSchedulers), serializing each into a server Message. Per-object
+ *  ordering is checked as messages reach the server queues.
+ *
+ *  The run with 0 threads does all the work on the pushing thread, like
+ *  tryCacheForward, and serves as the baseline.
+ */
+class ForwarderPipelineBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new ForwarderPipelineBenchmark(finished_cb, _param);
+    }
+
+    ForwarderPipelineBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    typedef Sirikata::Protocol::Object::ObjectMessage ObjectMessage;
+    typedef std::vector<ObjectMessage*> ObjectMessageList;
+    typedef PartitionedStrandQueue<ObjectMessage*> RoutingQueue;
+
+    // Stand in for the ODPFlowScheduler for one server
+    struct ServerQueue {
+        boost::mutex mutex;
+        std::deque<Message*> messages;
+        // Last sequence number seen for each object, to check ordering
+        std::tr1::unordered_map<UUID, uint64, UUID::Hasher> lastSeqno;
+        uint64 reordered;
+    };
+
+    // Per-partition outbox, indexed by server
+    typedef std::vector<ObjectMessageList> Outbox;
+
+    void generateMessages(ObjectMessageList* messages_out);
+    float64 run(uint32 nthreads, const ObjectMessageList& messages);
+    void handleBatch(uint32 partition, RoutingQueue::Batch& batch);
+    void route(ObjectMessage* msg, Outbox* outbox);
+    void flush(Outbox* outbox);
+
+    bool mForceStop;
+
+    uint32 mMaxThreads;
+    uint32 mObjects;
+    uint32 mServers;
+    uint32 mMessages;
+    uint32 mBatchSize;
+    uint32 mPayloadSize;
+
+    std::vector<UUID> mObjectIDs;
+    OSegCache* mCache;
+    std::vector<ServerQueue*> mServerQueues;
+    std::vector<Outbox> mOutboxes;
+
+    boost::mutex mDoneMutex;
+    boost::condition_variable mDone;
+    uint32 mRemaining;
+}; // class ForwarderPipelineBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_FORWARDER_PIPELINE_BENCHMARK_HPP_
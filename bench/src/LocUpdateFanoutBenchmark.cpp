@@ -0,0 +1,210 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "LocUpdateFanoutBenchmark.hpp"
+#include <sirikata/core/network/IOServicePool.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/Message.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include "Protocol_Loc.pbj.hpp"
+#include "Protocol_Frame.pbj.hpp"
+
+namespace Sirikata {
+
+LocUpdateFanoutBenchmark::LocUpdateFanoutBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mBuildTasksRemaining(0)
+{
+    OptionValue* maxThreads;
+    OptionValue* minSubscriptions;
+    OptionValue* maxSubscriptions;
+    OptionValue* objectsPerSubscriber;
+    OptionValue* maxPerResult;
+    OptionValue* rounds;
+    Sirikata::InitializeClassOptions ico("LocUpdateFanoutBenchmark",this,
+        maxThreads=new OptionValue("max-threads","8",Sirikata::OptionValueType<uint32>(),"Largest number of worker threads to build updates with"),
+        minSubscriptions=new OptionValue("min-subscriptions","1000",Sirikata::OptionValueType<uint32>(),"Smallest number of subscribers"),
+        maxSubscriptions=new OptionValue("max-subscriptions","100000",Sirikata::OptionValueType<uint32>(),"Largest number of subscribers"),
+        objectsPerSubscriber=new OptionValue("objects-per-subscriber","10",Sirikata::OptionValueType<uint32>(),"Number of pending object updates per subscriber each round"),
+        maxPerResult=new OptionValue("max-per-result","5",Sirikata::OptionValueType<uint32>(),"Maximum number of updates in each message, as loc.max-per-result"),
+        rounds=new OptionValue("rounds","10",Sirikata::OptionValueType<uint32>(),"Number of rounds of updates for each configuration"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("LocUpdateFanoutBenchmark",this);
+    optionsSet->parse(param);
+
+    mMaxThreads = maxThreads->as<uint32>();
+    mMinSubscriptions = minSubscriptions->as<uint32>();
+    mMaxSubscriptions = maxSubscriptions->as<uint32>();
+    mObjectsPerSubscriber = objectsPerSubscriber->as<uint32>();
+    mMaxPerResult = maxPerResult->as<uint32>();
+    mRounds = rounds->as<uint32>();
+}
+
+String LocUpdateFanoutBenchmark::name() {
+    return "loc-update-fanout";
+}
+
+void LocUpdateFanoutBenchmark::buildShard(SubscriberList* shard) {
+    for(SubscriberList::iterator it = shard->begin(); it != shard->end(); it++) {
+        Subscriber* sub = *it;
+
+        Sirikata::Protocol::Loc::BulkLocationUpdate bulk_update;
+        for(uint32 i = 0; i < sub->updates.size(); i++) {
+            const PendingUpdate& pending = sub->updates[i];
+
+            Sirikata::Protocol::Loc::ILocationUpdate update = bulk_update.add_update();
+            update.set_object(pending.object);
+            update.set_seqno(sub->seqno++);
+
+            Sirikata::Protocol::ITimedMotionVector location = update.mutable_location();
+            location.set_t(pending.location.updateTime());
+            location.set_position(pending.location.position());
+            location.set_velocity(pending.location.velocity());
+
+            Sirikata::Protocol::ITimedMotionQuaternion orientation = update.mutable_orientation();
+            orientation.set_t(pending.orientation.updateTime());
+            orientation.set_position(pending.orientation.position());
+            orientation.set_velocity(pending.orientation.velocity());
+
+            if (bulk_update.update_size() > (int32)mMaxPerResult) {
+                sub->messages.push_back(String());
+                serializePBJMessage(&sub->messages.back(), bulk_update);
+                bulk_update = Sirikata::Protocol::Loc::BulkLocationUpdate();
+            }
+        }
+        if (bulk_update.update_size() > 0) {
+            sub->messages.push_back(String());
+            serializePBJMessage(&sub->messages.back(), bulk_update);
+        }
+    }
+}
+
+void LocUpdateFanoutBenchmark::runBuildTask(SubscriberList* shard) {
+    buildShard(shard);
+
+    boost::lock_guard<boost::mutex> lck(mBuildMutex);
+    mBuildTasksRemaining--;
+    if (mBuildTasksRemaining == 0)
+        mBuildDone.notify_one();
+}
+
+void LocUpdateFanoutBenchmark::run(uint32 nsubscriptions, uint32 nthreads, RunResult* result_out) {
+    *result_out = RunResult();
+
+    // Subscribers watch a random selection from a pool of objects, so updates
+    // for the same object show up in many subscribers' messages
+    uint32 nobjects = std::max(nsubscriptions, mObjectsPerSubscriber);
+    std::vector<UUID> objects;
+    for(uint32 i = 0; i < nobjects; i++)
+        objects.push_back(UUID::random());
+
+    Time t = Timer::now();
+    uint32 rng = 0x2545F491;
+    SubscriberList subscribers;
+    for(uint32 s = 0; s < nsubscriptions; s++) {
+        Subscriber* sub = new Subscriber();
+        sub->seqno = 0;
+        for(uint32 i = 0; i < mObjectsPerSubscriber; i++) {
+            rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+            PendingUpdate pending;
+            pending.object = objects[rng % nobjects];
+            pending.location = TimedMotionVector3f(t, MotionVector3f(Vector3f((float)(rng % 1000), (float)(rng % 997), (float)(rng % 991)), Vector3f(1, 0, 0)));
+            pending.orientation = TimedMotionQuaternion(t, MotionQuaternion(Quaternion::identity(), Quaternion::identity()));
+            sub->updates.push_back(pending);
+        }
+        subscribers.push_back(sub);
+    }
+
+    // Same sharding as AlwaysLocationUpdatePolicy
+    uint32 nshards = (nthreads > 1) ? 4 * nthreads : 1;
+    std::vector<SubscriberList> shards(nshards);
+    for(uint32 s = 0; s < nsubscriptions; s++)
+        shards[s % nshards].push_back(subscribers[s]);
+
+    Network::IOServicePool* workers = NULL;
+    if (nthreads > 1) {
+        workers = new Network::IOServicePool("LocUpdateFanoutBenchmark", nthreads);
+        workers->startWork();
+        workers->run();
+    }
+
+    for(uint32 round = 0; round < mRounds && !mForceStop; round++) {
+        Time build_start = Timer::now();
+        if (workers == NULL) {
+            buildShard(&shards[0]);
+        }
+        else {
+            mBuildTasksRemaining = nshards;
+            for(uint32 i = 0; i < nshards; i++) {
+                workers->service()->post(
+                    std::tr1::bind(&LocUpdateFanoutBenchmark::runBuildTask, this, &shards[i]),
+                    "LocUpdateFanoutBenchmark::runBuildTask"
+                );
+            }
+            boost::unique_lock<boost::mutex> lck(mBuildMutex);
+            while(mBuildTasksRemaining > 0)
+                mBuildDone.wait(lck);
+        }
+        Time build_end = Timer::now();
+
+        // The serial part, framing each message as trySend does
+        for(uint32 s = 0; s < nsubscriptions; s++) {
+            Subscriber* sub = subscribers[s];
+            for(uint32 m = 0; m < sub->messages.size(); m++) {
+                Sirikata::Protocol::Frame msg_frame;
+                msg_frame.set_payload(sub->messages[m]);
+                std::string framed = serializePBJMessage(msg_frame);
+                result_out->messages++;
+                result_out->bytes += framed.size();
+            }
+            sub->messages.clear();
+            result_out->updates += sub->updates.size();
+        }
+        Time send_end = Timer::now();
+
+        result_out->buildSeconds += (build_end - build_start).toSeconds();
+        result_out->sendSeconds += (send_end - build_end).toSeconds();
+    }
+
+    if (workers != NULL) {
+        workers->join();
+        delete workers;
+    }
+
+    for(uint32 s = 0; s < nsubscriptions; s++)
+        delete subscribers[s];
+}
+
+void LocUpdateFanoutBenchmark::start() {
+    mForceStop = false;
+
+    for(uint32 nsubs = mMinSubscriptions; nsubs <= mMaxSubscriptions && !mForceStop; nsubs *= 10) {
+        for(uint32 nthreads = 1; nthreads <= mMaxThreads && !mForceStop; nthreads *= 2) {
+            RunResult result;
+            run(nsubs, nthreads, &result);
+            if (mForceStop) break;
+
+            float64 total_seconds = result.buildSeconds + result.sendSeconds;
+            SILOG(benchmark,info,
+                nsubs << " subscriptions, " << nthreads << " threads: "
+                << (total_seconds > 0 ? result.updates / total_seconds : 0) << " updates/s, "
+                << (1000.0 * result.buildSeconds / mRounds) << "ms build, "
+                << (1000.0 * result.sendSeconds / mRounds) << "ms send per round, "
+                << ((float64)result.bytes / std::max(result.messages, (uint64)1)) << " bytes/message");
+        }
+        if (mMinSubscriptions == 0) break;
+    }
+
+    if (!mForceStop)
+        notifyFinished();
+}
+
+void LocUpdateFanoutBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
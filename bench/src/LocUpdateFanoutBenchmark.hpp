@@ -0,0 +1,94 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_LOC_UPDATE_FANOUT_BENCHMARK_HPP_
+#define _SIRIKATA_LOC_UPDATE_FANOUT_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+#include <sirikata/core/util/MotionQuaternion.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+namespace Network {
+class IOServicePool;
+}
+
+/** LocUpdateFanoutBenchmark measures how building location update messages
+ *  scales with the number of worker threads, the way
+ *  AlwaysLocationUpdatePolicy does with loc.service-threads > 1.
+ *
+ *  Every round each subscriber has a number of pending object updates. The
+ *  subscribers are split into 4 shards per thread, and the shards' updates are
+ *  packed into BulkLocationUpdates and serialized on an IOServicePool. The
+ *  calling thread then frames each message, standing in for trySend, which
+ *  stays serial. Each combination of thread count (1, 2, 4, ... max-threads)
+ *  and subscription count (min-subscriptions up to max-subscriptions in steps
+ *  of 10x) is reported separately.
+ */
+class LocUpdateFanoutBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new LocUpdateFanoutBenchmark(finished_cb, _param);
+    }
+
+    LocUpdateFanoutBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    struct PendingUpdate {
+        UUID object;
+        TimedMotionVector3f location;
+        TimedMotionQuaternion orientation;
+    };
+
+    struct Subscriber {
+        uint64 seqno;
+        std::vector<PendingUpdate> updates;
+        std::vector<String> messages;
+    };
+    typedef std::vector<Subscriber*> SubscriberList;
+
+    struct RunResult {
+        RunResult()
+         : updates(0), messages(0), bytes(0), buildSeconds(0), sendSeconds(0)
+        {}
+
+        uint64 updates;
+        uint64 messages;
+        uint64 bytes;
+        float64 buildSeconds;
+        float64 sendSeconds;
+    };
+
+    void run(uint32 nsubscriptions, uint32 nthreads, RunResult* result_out);
+    void buildShard(SubscriberList* shard);
+    void runBuildTask(SubscriberList* shard);
+
+    bool mForceStop;
+
+    uint32 mMaxThreads;
+    uint32 mMinSubscriptions;
+    uint32 mMaxSubscriptions;
+    uint32 mObjectsPerSubscriber;
+    uint32 mMaxPerResult;
+    uint32 mRounds;
+
+    boost::mutex mBuildMutex;
+    boost::condition_variable mBuildDone;
+    uint32 mBuildTasksRemaining;
+}; // class LocUpdateFanoutBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LOC_UPDATE_FANOUT_BENCHMARK_HPP_
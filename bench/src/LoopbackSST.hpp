@@ -0,0 +1,245 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_BENCH_LOOPBACK_SST_HPP_
+#define _SIRIKATA_BENCH_LOOPBACK_SST_HPP_
+
+#include <sirikata/core/network/SSTImpl.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace Sirikata {
+
+/** Endpoint identifier for the in-process loopback SST transport. Just a
+ *  number identifying a "host".
+ */
+class LoopbackEndPoint {
+public:
+    LoopbackEndPoint()
+     : id(0)
+    {}
+    explicit LoopbackEndPoint(uint32 _id)
+     : id(_id)
+    {}
+
+    bool operator<(const LoopbackEndPoint& rhs) const { return id < rhs.id; }
+    bool operator==(const LoopbackEndPoint& rhs) const { return id == rhs.id; }
+    bool operator!=(const LoopbackEndPoint& rhs) const { return id != rhs.id; }
+
+    String toString() const {
+        return "loopback" + boost::lexical_cast<String>(id);
+    }
+
+    uint32 id;
+};
+
+/** Impairments applied to datagrams sent by a loopback SST host. Loss and
+ *  jitter are driven by a PRNG seeded with seed, so a run with the same
+ *  conditions and workload drops and delays the same datagrams every time.
+ */
+struct LoopbackLinkConditions {
+    LoopbackLinkConditions()
+     : lossRate(0),
+       latency(Duration::zero()),
+       jitter(Duration::zero()),
+       seed(1)
+    {}
+
+    // Probability in [0,1] that a datagram is dropped
+    float64 lossRate;
+    // One way delay added to every datagram
+    Duration latency;
+    // Additional uniformly distributed delay in [0, jitter). Datagrams can be
+    // reordered when this is non-zero.
+    Duration jitter;
+    uint32 seed;
+};
+
+namespace SST {
+
+/** An in-process datagram layer for SST, used to benchmark SST without any
+ *  real network or ODP stack underneath. All hosts must share the same
+ *  ConnectionManager, which is how datagrams find their destination. Datagrams
+ *  are copied on send (like a real network would) and delivered
+ *  asynchronously through the Context's main strand, after being subjected to
+ *  the host's LoopbackLinkConditions.
+ */
+template <>
+class BaseDatagramLayer<LoopbackEndPoint>
+{
+  public:
+    typedef LoopbackEndPoint EndPointType;
+    typedef std::tr1::shared_ptr<BaseDatagramLayer<EndPointType> > Ptr;
+    typedef Ptr BaseDatagramLayerPtr;
+
+    typedef std::tr1::function<void(void*, int)> DataCallback;
+
+    static BaseDatagramLayerPtr getDatagramLayer(ConnectionVariables<EndPointType>* sstConnVars,
+                                                 EndPointType endPoint)
+    {
+        return sstConnVars->getDatagramLayer(endPoint);
+    }
+
+    static BaseDatagramLayerPtr createDatagramLayer(
+        ConnectionVariables<EndPointType>* sstConnVars,
+        EndPointType endPoint,
+        const Context* ctx,
+        void* unused)
+    {
+        return createDatagramLayer(sstConnVars, endPoint, ctx, LoopbackLinkConditions());
+    }
+
+    static BaseDatagramLayerPtr createDatagramLayer(
+        ConnectionVariables<EndPointType>* sstConnVars,
+        EndPointType endPoint,
+        const Context* ctx,
+        const LoopbackLinkConditions& conditions)
+    {
+        BaseDatagramLayerPtr datagramLayer = getDatagramLayer(sstConnVars, endPoint);
+        if (datagramLayer) return datagramLayer;
+
+        datagramLayer = BaseDatagramLayerPtr(
+            new BaseDatagramLayer(sstConnVars, ctx, endPoint, conditions)
+        );
+        sstConnVars->addDatagramLayer(endPoint, datagramLayer);
+
+        return datagramLayer;
+    }
+
+    static void stopListening(ConnectionVariables<EndPointType>* sstConnVars, EndPoint<EndPointType>& listeningEndPoint) {
+        EndPointType endPointID = listeningEndPoint.endPoint;
+
+        BaseDatagramLayerPtr bdl = sstConnVars->getDatagramLayer(endPointID);
+        if (!bdl) return;
+        sstConnVars->removeDatagramLayer(endPointID, true);
+        bdl->unlisten(listeningEndPoint);
+    }
+
+    void listenOn(EndPoint<EndPointType>& listeningEndPoint, DataCallback cb) {
+        boost::mutex::scoped_lock lock(mMutex);
+        mListeners[listeningEndPoint] = cb;
+    }
+
+    void listenOn(const EndPoint<EndPointType>& listeningEndPoint) {
+        boost::mutex::scoped_lock lock(mMutex);
+        mListeners[listeningEndPoint] = DataCallback();
+    }
+
+    void unlisten(EndPoint<EndPointType>& ep) {
+        boost::mutex::scoped_lock lock(mMutex);
+        mListeners.erase(ep);
+    }
+
+    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, void* data, int len) {
+        Duration delay = mConditions.latency;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            mDatagramsSent++;
+            mBytesSent += len;
+
+            if (mConditions.lossRate > 0 && nextRandom() < mConditions.lossRate) {
+                mDatagramsDropped++;
+                return;
+            }
+            if (mConditions.jitter > Duration::zero())
+                delay += mConditions.jitter * nextRandom();
+        }
+
+        std::tr1::function<void()> cb =
+            std::tr1::bind(&BaseDatagramLayer::deliver, mSSTConnVars,
+                *src, *dest, std::string((const char*)data, len));
+        if (delay > Duration::zero())
+            mContext->mainStrand->post(delay, cb, "BaseDatagramLayer<LoopbackEndPoint>::deliver");
+        else
+            mContext->mainStrand->post(cb, "BaseDatagramLayer<LoopbackEndPoint>::deliver");
+    }
+
+    const Context* context() {
+        return mContext;
+    }
+
+    uint32 getUnusedPort(const EndPointType& ep) {
+        boost::mutex::scoped_lock lock(mMutex);
+        return mNextPort++;
+    }
+
+    void invalidate() {
+        mSSTConnVars->removeDatagramLayer(mEndpoint, true);
+    }
+
+    uint64 datagramsSent() const { return mDatagramsSent; }
+    uint64 datagramsDropped() const { return mDatagramsDropped; }
+    uint64 bytesSent() const { return mBytesSent; }
+
+  private:
+    BaseDatagramLayer(ConnectionVariables<EndPointType>* sstConnVars, const Context* ctx, const EndPointType& ep,
+        const LoopbackLinkConditions& conditions)
+     : mContext(ctx),
+       mSSTConnVars(sstConnVars),
+       mEndpoint(ep),
+       mNextPort(OBJECT_PORT_SYSTEM_RESERVED_MAX+1),
+       mConditions(conditions),
+       mRandomState(conditions.seed == 0 ? 1 : conditions.seed),
+       mDatagramsSent(0),
+       mDatagramsDropped(0),
+       mBytesSent(0)
+    {
+    }
+
+    // xorshift32, returns a value in [0,1). mMutex must be locked.
+    float64 nextRandom() {
+        mRandomState ^= mRandomState << 13;
+        mRandomState ^= mRandomState >> 17;
+        mRandomState ^= mRandomState << 5;
+        return mRandomState / 4294967296.0;
+    }
+
+    // Find the listener on the destination and hand it the data. Static so a
+    // datagram in flight doesn't keep either end alive.
+    static void deliver(ConnectionVariables<EndPointType>* sstConnVars,
+        EndPoint<EndPointType> src, EndPoint<EndPointType> dest, std::string data)
+    {
+        BaseDatagramLayerPtr dest_layer = sstConnVars->getDatagramLayer(dest.endPoint);
+        if (!dest_layer) return;
+
+        bool found = false;
+        DataCallback cb;
+        {
+            boost::mutex::scoped_lock lock(dest_layer->mMutex);
+            ListenerMap::iterator it = dest_layer->mListeners.find(dest);
+            if (it != dest_layer->mListeners.end()) {
+                found = true;
+                cb = it->second;
+            }
+        }
+        // Nobody listening, drop it like a real network would
+        if (!found) return;
+
+        if (cb)
+            cb((void*)data.data(), data.size());
+        else
+            Connection<EndPointType>::handleReceive(sstConnVars, src, dest, (void*)data.data(), data.size());
+    }
+
+    const Context* mContext;
+    ConnectionVariables<EndPointType>* mSSTConnVars;
+    EndPointType mEndpoint;
+
+    typedef std::map<EndPoint<EndPointType>, DataCallback> ListenerMap;
+    ListenerMap mListeners;
+    uint32 mNextPort;
+    boost::mutex mMutex;
+
+    const LoopbackLinkConditions mConditions;
+    uint32 mRandomState;
+
+    uint64 mDatagramsSent;
+    uint64 mDatagramsDropped;
+    uint64 mBytesSent;
+};
+
+} // namespace SST
+} // namespace Sirikata
+
+#endif //_SIRIKATA_BENCH_LOOPBACK_SST_HPP_
@@ -0,0 +1,171 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "MeshRaytraceBenchmark.hpp"
+#include <sirikata/mesh/Raytrace.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+namespace Sirikata {
+
+using namespace Sirikata::Mesh;
+
+namespace {
+
+uint32 xorshift(uint32* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+float32 randomUnit(uint32* state) {
+    return (xorshift(state) % 65536) / 65536.f;
+}
+
+} // namespace
+
+MeshRaytraceBenchmark::MeshRaytraceBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* tiles;
+    OptionValue* tile_side;
+    OptionValue* rays;
+    OptionValue* batch_size;
+    Sirikata::InitializeClassOptions ico("MeshRaytraceBenchmark",this,
+        tiles=new OptionValue("tiles","16",Sirikata::OptionValueType<uint32>(),"Number of terrain tiles, each a separate instance"),
+        tile_side=new OptionValue("tile-side","180",Sirikata::OptionValueType<uint32>(),"Number of vertices along each side of a tile"),
+        rays=new OptionValue("rays","200000",Sirikata::OptionValueType<uint32>(),"Number of rays to trace"),
+        batch_size=new OptionValue("batch-size","1024",Sirikata::OptionValueType<uint32>(),"Number of rays in each batched trace"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("MeshRaytraceBenchmark",this);
+    optionsSet->parse(param);
+
+    mTiles = tiles->as<uint32>();
+    // Indices are 16 bit
+    mTileSide = std::min(tile_side->as<uint32>(), (uint32)255);
+    mRays = rays->as<uint32>();
+    mBatchSize = std::max(batch_size->as<uint32>(), (uint32)1);
+}
+
+String MeshRaytraceBenchmark::name() {
+    return "mesh-raytrace";
+}
+
+MeshdataPtr MeshRaytraceBenchmark::generate() {
+    // Fixed seed so runs are comparable
+    uint32 rng = 0x2545F491;
+
+    MeshdataPtr mesh(new Meshdata());
+    mesh->globalTransform = Matrix4x4f::identity();
+    uint32 tiles_per_row = 1;
+    while(tiles_per_row * tiles_per_row < mTiles) tiles_per_row++;
+    for(uint32 tile = 0; tile < mTiles; tile++) {
+        SubMeshGeometry geom;
+        for(uint32 y = 0; y < mTileSide; y++) {
+            for(uint32 x = 0; x < mTileSide; x++) {
+                float32 height = randomUnit(&rng) * 0.5f;
+                geom.positions.push_back(Vector3f((float32)x, height, (float32)y));
+                geom.normals.push_back(Vector3f(0, 1, 0));
+            }
+        }
+
+        SubMeshGeometry::Primitive prim;
+        prim.primitiveType = SubMeshGeometry::Primitive::TRIANGLES;
+        prim.materialId = 0;
+        for(uint32 y = 0; y + 1 < mTileSide; y++) {
+            for(uint32 x = 0; x + 1 < mTileSide; x++) {
+                unsigned short v = y * mTileSide + x;
+                prim.indices.push_back(v);
+                prim.indices.push_back(v + mTileSide);
+                prim.indices.push_back(v + 1);
+                prim.indices.push_back(v + 1);
+                prim.indices.push_back(v + mTileSide);
+                prim.indices.push_back(v + mTileSide + 1);
+            }
+        }
+        geom.primitives.push_back(prim);
+        mesh->geometry.push_back(geom);
+
+        NodeIndex node_idx = mesh->nodes.size();
+        Matrix4x4f xform = Matrix4x4f::identity();
+        xform(0,3) = (float32)((tile % tiles_per_row) * (mTileSide - 1));
+        xform(2,3) = (float32)((tile / tiles_per_row) * (mTileSide - 1));
+        mesh->nodes.push_back(Node(xform));
+        mesh->rootNodes.push_back(node_idx);
+
+        GeometryInstance inst;
+        inst.geometryIndex = tile;
+        inst.parentNode = node_idx;
+        mesh->instances.push_back(inst);
+    }
+    return mesh;
+}
+
+void MeshRaytraceBenchmark::start() {
+    mForceStop = false;
+
+    MeshdataPtr mesh = generate();
+    if (mTiles == 0 || mTileSide < 2) {
+        notifyFinished();
+        return;
+    }
+
+    // Rays from above the terrain, pointing down at it from random angles
+    uint32 rng = 0x9E3779B9;
+    float32 extent = (float32)((mTileSide - 1) * (uint32)std::ceil(std::sqrt((float32)mTiles)));
+    std::vector<Vector3f> starts, dirs;
+    for(uint32 i = 0; i < mRays; i++) {
+        starts.push_back(Vector3f(randomUnit(&rng) * extent, 50.f, randomUnit(&rng) * extent));
+        dirs.push_back(Vector3f(randomUnit(&rng) - 0.5f, -1.f, randomUnit(&rng) - 0.5f).normal());
+    }
+    Matrix4x4f xform = Matrix4x4f::identity();
+    uint64 nfaces = (uint64)mTiles * (mTileSide - 1) * (mTileSide - 1) * 2;
+
+    // The first query builds the acceleration structure
+    Time build_start = Timer::now();
+    float32 t;
+    Raytrace(mesh, xform, starts[0], dirs[0], &t, NULL);
+    Duration build_time = Timer::now() - build_start;
+    SILOG(benchmark,info, nfaces << " faces, built in " << build_time);
+    if (mForceStop) return;
+
+    uint32 single_hits = 0;
+    Time single_start = Timer::now();
+    for(uint32 i = 0; i < mRays && !mForceStop; i++) {
+        if (Raytrace(mesh, xform, starts[i], dirs[i], &t, NULL))
+            single_hits++;
+    }
+    Duration single_time = Timer::now() - single_start;
+    if (mForceStop) return;
+
+    uint32 batch_hits = 0;
+    RaytraceResultList results;
+    Time batch_start = Timer::now();
+    for(uint32 i = 0; i < mRays && !mForceStop; i += mBatchSize) {
+        uint32 batch_end = std::min(i + mBatchSize, mRays);
+        std::vector<Vector3f> batch_starts(starts.begin() + i, starts.begin() + batch_end);
+        std::vector<Vector3f> batch_dirs(dirs.begin() + i, dirs.begin() + batch_end);
+        batch_hits += Raytrace(mesh, xform, batch_starts, batch_dirs, &results);
+    }
+    Duration batch_time = Timer::now() - batch_start;
+    if (mForceStop) return;
+
+    float64 single_secs = single_time.toSeconds(), batch_secs = batch_time.toSeconds();
+    SILOG(benchmark,info,
+        mRays << " rays: " << (single_secs > 0 ? mRays / single_secs : 0) << " rays/sec individually (" << single_hits << " hits), " <<
+        (batch_secs > 0 ? mRays / batch_secs : 0) << " rays/sec in batches of " << mBatchSize << " (" << batch_hits << " hits)");
+    if (single_hits != batch_hits)
+        SILOG(benchmark,error,"Individual and batched rays disagree");
+
+    notifyFinished();
+}
+
+void MeshRaytraceBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,46 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_MESH_RAYTRACE_BENCHMARK_HPP_
+#define _SIRIKATA_MESH_RAYTRACE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/mesh/Meshdata.hpp>
+
+namespace Sirikata {
+
+/** MeshRaytraceBenchmark measures Mesh::Raytrace against a large generated
+ *  mesh: a grid of instanced terrain tiles, about the size of a big aggregate.
+ *  It reports the time to build the mesh's acceleration structure on the first
+ *  query, and then rays/sec tracing rays one at a time and in batches.
+ */
+class MeshRaytraceBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new MeshRaytraceBenchmark(finished_cb, _param);
+    }
+
+    MeshRaytraceBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    Mesh::MeshdataPtr generate();
+
+    bool mForceStop;
+
+    uint32 mTiles;
+    uint32 mTileSide;
+    uint32 mRays;
+    uint32 mBatchSize;
+}; // class MeshRaytraceBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_MESH_RAYTRACE_BENCHMARK_HPP_
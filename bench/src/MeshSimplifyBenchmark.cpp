@@ -0,0 +1,235 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "MeshSimplifyBenchmark.hpp"
+#include <sirikata/mesh/MeshSimplifier.hpp>
+#include <sirikata/mesh/ModelsSystemFactory.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <boost/algorithm/string.hpp>
+
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+#include <sys/resource.h>
+#endif
+
+// Generated corpus: GEN_TILES tiles of GEN_SIDE x GEN_SIDE vertices each
+#define GEN_TILES 8
+#define GEN_SIDE 150
+
+namespace Sirikata {
+
+using namespace Sirikata::Mesh;
+
+namespace {
+
+uint32 xorshift(uint32* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Peak resident memory of the whole process in KB, or -1 if it isn't
+// available. This includes the loaded meshes and everything else in the
+// process, not just the simplifier's allocations.
+int64 peakProcessRSSKB() {
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+    return -1;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_MAC
+    // Reported in bytes on OS X
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+uint64 countFaces(MeshdataPtr mesh) {
+    uint64 faces = 0;
+    uint32 geoinst_idx;
+    Matrix4x4f geoinst_pos_xform;
+    Meshdata::GeometryInstanceIterator geoinst_it = mesh->getGeometryInstanceIterator();
+    while( geoinst_it.next(&geoinst_idx, &geoinst_pos_xform) ) {
+        const SubMeshGeometry& geom = mesh->geometry[mesh->instances[geoinst_idx].geometryIndex];
+        for(uint32 i = 0; i < geom.primitives.size(); i++) {
+            if (geom.primitives[i].primitiveType == SubMeshGeometry::Primitive::TRIANGLES)
+                faces += geom.primitives[i].indices.size() / 3;
+        }
+    }
+    return faces;
+}
+
+} // namespace
+
+MeshSimplifyBenchmark::MeshSimplifyBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* corpus;
+    OptionValue* target_faces;
+    OptionValue* threads;
+    OptionValue* iterations;
+    Sirikata::InitializeClassOptions ico("MeshSimplifyBenchmark",this,
+        corpus=new OptionValue("corpus","",Sirikata::OptionValueType<String>(),"Comma separated list of Collada files to simplify. If empty, generated meshes are used."),
+        target_faces=new OptionValue("target-faces","20000",Sirikata::OptionValueType<uint32>(),"Number of faces to simplify each mesh to"),
+        threads=new OptionValue("threads","0",Sirikata::OptionValueType<uint32>(),"Number of threads the simplifier uses, or 0 for one per core"),
+        iterations=new OptionValue("iterations","3",Sirikata::OptionValueType<uint32>(),"Number of times to simplify each mesh"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("MeshSimplifyBenchmark",this);
+    optionsSet->parse(param);
+
+    String corpus_list = corpus->as<String>();
+    if (!corpus_list.empty())
+        boost::split(mCorpus, corpus_list, boost::is_any_of(","));
+    mTargetFaces = target_faces->as<uint32>();
+    mThreads = threads->as<uint32>();
+    mIterations = iterations->as<uint32>();
+
+    if (!mCorpus.empty())
+        mPlugins.loadList("colladamodels");
+}
+
+String MeshSimplifyBenchmark::name() {
+    return "mesh-simplify";
+}
+
+MeshdataPtr MeshSimplifyBenchmark::load(const String& filename) {
+    using namespace Sirikata::Transfer;
+
+    if (!ModelsSystemFactory::getSingleton().hasConstructor("any")) {
+        SILOG(benchmark,error,"No model loaders available to load " << filename);
+        return MeshdataPtr();
+    }
+    ModelsSystem* parser = ModelsSystemFactory::getSingleton().getConstructor("any")("");
+
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL) {
+        SILOG(benchmark,error,"Couldn't open " << filename);
+        delete parser;
+        return MeshdataPtr();
+    }
+    fseek(fp, 0, SEEK_END);
+    int fp_len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    MutableDenseDataPtr filedata(new DenseData(Range(0, fp_len, Transfer::LENGTH, true)));
+    fread(filedata->writableData(), 1, fp_len, fp);
+    fclose(fp);
+
+    URI fileuri(std::string("file://") + filename);
+    Fingerprint hash = Fingerprint::computeDigest(filedata->data(), filedata->size());
+    RemoteFileMetadata metadata(hash, fileuri, filedata->size(), ChunkList(), FileHeaders());
+    VisualPtr vis = parser->load(metadata, hash, filedata);
+    delete parser;
+
+    MeshdataPtr mesh(std::tr1::dynamic_pointer_cast<Meshdata>(vis));
+    if (!mesh)
+        SILOG(benchmark,error,"Couldn't load a mesh from " << filename);
+    return mesh;
+}
+
+MeshdataPtr MeshSimplifyBenchmark::generate() {
+    // Fixed seed so runs are comparable
+    uint32 rng = 0x2545F491;
+
+    MeshdataPtr mesh(new Meshdata());
+    mesh->globalTransform = Matrix4x4f::identity();
+    for(uint32 tile = 0; tile < GEN_TILES; tile++) {
+        SubMeshGeometry geom;
+        for(uint32 y = 0; y < GEN_SIDE; y++) {
+            for(uint32 x = 0; x < GEN_SIDE; x++) {
+                float32 height = (xorshift(&rng) % 1000) / 5000.f;
+                geom.positions.push_back(Vector3f((float32)x, height, (float32)y));
+                geom.normals.push_back(Vector3f(0, 1, 0));
+            }
+        }
+
+        SubMeshGeometry::Primitive prim;
+        prim.primitiveType = SubMeshGeometry::Primitive::TRIANGLES;
+        prim.materialId = 0;
+        for(uint32 y = 0; y + 1 < GEN_SIDE; y++) {
+            for(uint32 x = 0; x + 1 < GEN_SIDE; x++) {
+                unsigned short v = y * GEN_SIDE + x;
+                prim.indices.push_back(v);
+                prim.indices.push_back(v + GEN_SIDE);
+                prim.indices.push_back(v + 1);
+                prim.indices.push_back(v + 1);
+                prim.indices.push_back(v + GEN_SIDE);
+                prim.indices.push_back(v + GEN_SIDE + 1);
+            }
+        }
+        geom.primitives.push_back(prim);
+        mesh->geometry.push_back(geom);
+
+        // Lay the tiles out side by side, each with its own node
+        NodeIndex node_idx = mesh->nodes.size();
+        Matrix4x4f xform = Matrix4x4f::identity();
+        xform(0,3) = (float32)(tile * (GEN_SIDE - 1));
+        mesh->nodes.push_back(Node(xform));
+        mesh->rootNodes.push_back(node_idx);
+
+        GeometryInstance inst;
+        inst.geometryIndex = tile;
+        inst.parentNode = node_idx;
+        mesh->instances.push_back(inst);
+    }
+    return mesh;
+}
+
+uint64 MeshSimplifyBenchmark::run(const String& name, MeshdataPtr mesh) {
+    MeshSimplifier simplifier(mThreads);
+    uint64 input_faces = countFaces(mesh);
+
+    Duration total = Duration::zero();
+    uint64 output_faces = 0;
+    for(uint32 it = 0; it < mIterations && !mForceStop; it++) {
+        // The simplifier works in place, so each run needs a fresh copy
+        MeshdataPtr copy(new Meshdata(*mesh));
+        Time start = Timer::now();
+        simplifier.simplify(copy, mTargetFaces);
+        total += Timer::now() - start;
+        output_faces = countFaces(copy);
+    }
+
+    float64 secs = total.toSeconds();
+    SILOG(benchmark,info,
+        name << ": " << input_faces << " -> " << output_faces << " faces, " <<
+        (secs > 0 ? (input_faces * mIterations) / secs : 0) << " faces/sec");
+    return input_faces;
+}
+
+void MeshSimplifyBenchmark::start() {
+    mForceStop = false;
+
+    Time start = Timer::now();
+    uint64 total_faces = 0;
+    if (mCorpus.empty()) {
+        total_faces += run("generated", generate());
+    }
+    else {
+        for(uint32 i = 0; i < mCorpus.size() && !mForceStop; i++) {
+            MeshdataPtr mesh = load(mCorpus[i]);
+            if (mesh)
+                total_faces += run(mCorpus[i], mesh);
+        }
+    }
+    if (mForceStop) return;
+
+    int64 peak_kb = peakProcessRSSKB();
+    SILOG(benchmark,info,
+        "Simplified " << total_faces << " faces in " << (Timer::now() - start) << ", peak process RSS " <<
+        (peak_kb >= 0 ? boost::lexical_cast<String>(peak_kb) + "KB" : String("unavailable")));
+
+    notifyFinished();
+}
+
+void MeshSimplifyBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
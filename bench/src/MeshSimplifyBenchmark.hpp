@@ -0,0 +1,55 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_MESH_SIMPLIFY_BENCHMARK_HPP_
+#define _SIRIKATA_MESH_SIMPLIFY_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/mesh/Meshdata.hpp>
+#include <sirikata/core/util/PluginManager.hpp>
+
+namespace Sirikata {
+
+/** MeshSimplifyBenchmark measures MeshSimplifier, the way AggregateManager uses
+ *  it, on a corpus of Collada files given as a comma separated list with the
+ *  corpus option. Each mesh is simplified to target-faces faces and the rate
+ *  is reported in input faces per second, along with the peak resident
+ *  memory of the whole process, which includes the loaded corpus and isn't
+ *  specific to the simplifier. Without a corpus, it runs on a set of generated
+ *  terrain tiles instead.
+ */
+class MeshSimplifyBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new MeshSimplifyBenchmark(finished_cb, _param);
+    }
+
+    MeshSimplifyBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    Mesh::MeshdataPtr load(const String& filename);
+    Mesh::MeshdataPtr generate();
+    // Simplifies a copy of mesh, returning the number of input faces.
+    uint64 run(const String& name, Mesh::MeshdataPtr mesh);
+
+    bool mForceStop;
+
+    std::vector<String> mCorpus;
+    uint32 mTargetFaces;
+    uint32 mThreads;
+    uint32 mIterations;
+
+    PluginManager mPlugins;
+}; // class MeshSimplifyBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_MESH_SIMPLIFY_BENCHMARK_HPP_
@@ -0,0 +1,332 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "OSegCacheReplayBenchmark.hpp"
+#include <sirikata/space/ShardedOSegCache.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrandImpl.hpp>
+#include <sirikata/core/trace/Trace.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include "Protocol_OSegTrace.pbj.hpp"
+#include <fstream>
+
+// Synthetic workload parameters
+#define SYNTHETIC_OBJECTS 100000
+#define SYNTHETIC_EVENTS 1000000
+#define SYNTHETIC_ZIPF_EXPONENT 1.0
+#define SYNTHETIC_UPDATE_FRACTION 0.01
+#define SYNTHETIC_SERVERS 16
+
+// Measure latency for one in this many lookups
+#define LATENCY_SAMPLE_INTERVAL 64
+
+namespace Sirikata {
+
+namespace {
+
+/** LRU cache behind a single lock, like CacheLRUOriginal, which is what the
+ *  space server used before ShardedOSegCache. Serves as the baseline.
+ */
+class LockedLRUOSegCache : public OSegCache {
+public:
+    LockedLRUOSegCache(uint32 max_size)
+     : mMaxSize(max_size)
+    {}
+
+    virtual void insert(const UUID& uuid, const OSegEntry& sID) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        EntryMap::iterator it = mEntries.find(uuid);
+        if (it != mEntries.end()) {
+            it->second.entry = sID;
+            mLRU.splice(mLRU.begin(), mLRU, it->second.lru);
+            return;
+        }
+        if (mEntries.size() >= mMaxSize) {
+            mEntries.erase(mLRU.back());
+            mLRU.pop_back();
+        }
+        mLRU.push_front(uuid);
+        Entry& entry = mEntries[uuid];
+        entry.entry = sID;
+        entry.lru = mLRU.begin();
+    }
+
+    virtual OSegEntry get(const UUID& uuid) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        EntryMap::iterator it = mEntries.find(uuid);
+        if (it == mEntries.end()) return OSegEntry::null();
+        mLRU.splice(mLRU.begin(), mLRU, it->second.lru);
+        return it->second.entry;
+    }
+
+    virtual void remove(const UUID& uuid) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        EntryMap::iterator it = mEntries.find(uuid);
+        if (it == mEntries.end()) return;
+        mLRU.erase(it->second.lru);
+        mEntries.erase(it);
+    }
+
+private:
+    typedef std::list<UUID> LRUList;
+    struct Entry {
+        OSegEntry entry;
+        LRUList::iterator lru;
+    };
+    typedef std::tr1::unordered_map<UUID, Entry, UUID::Hasher> EntryMap;
+
+    boost::mutex mMutex;
+    uint32 mMaxSize;
+    EntryMap mEntries;
+    LRUList mLRU;
+};
+
+// Same framing as Trace::writeRecord, see Analysis.cpp
+bool readRecord(std::istream& is, uint16* type_hint_out, std::string* payload_out) {
+    uint32 record_size;
+    is.read( (char*)&record_size, sizeof(record_size) );
+    if (!is) return false;
+
+    is.read( (char*)type_hint_out, sizeof(uint16) );
+    if (!is) return false;
+
+    payload_out->resize(record_size, (char)0);
+    is.read( (char*)&((*payload_out)[0]), record_size );
+    if (!is) return false;
+
+    return true;
+}
+
+} // namespace
+
+OSegCacheReplayBenchmark::OSegCacheReplayBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* trace;
+    OptionValue* maxThreads;
+    OptionValue* cacheSize;
+    OptionValue* shards;
+    OptionValue* eventsPerThread;
+    Sirikata::InitializeClassOptions ico("OSegCacheReplayBenchmark",this,
+        trace=new OptionValue("trace","",Sirikata::OptionValueType<String>(),"Space server trace file to extract OSeg lookups from (blank for a synthetic workload)"),
+        maxThreads=new OptionValue("max-threads","16",Sirikata::OptionValueType<uint32>(),"Largest number of threads to replay with"),
+        cacheSize=new OptionValue("cache-size","10000",Sirikata::OptionValueType<uint32>(),"Maximum number of cache entries"),
+        shards=new OptionValue("shards","16",Sirikata::OptionValueType<uint32>(),"Number of shards for the sharded cache"),
+        eventsPerThread=new OptionValue("events-per-thread","1000000",Sirikata::OptionValueType<uint32>(),"Number of events each thread replays, wrapping around the stream"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("OSegCacheReplayBenchmark",this);
+    optionsSet->parse(param);
+
+    mTraceFile = trace->as<String>();
+    mMaxThreads = maxThreads->as<uint32>();
+    mCacheSize = cacheSize->as<uint32>();
+    mShards = shards->as<uint32>();
+    mEventsPerThread = eventsPerThread->as<uint32>();
+}
+
+String OSegCacheReplayBenchmark::name() {
+    return "oseg-cache-replay";
+}
+
+bool OSegCacheReplayBenchmark::loadTrace(const String& filename) {
+    std::ifstream is(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!is) return false;
+
+    uint16 type_hint;
+    std::string payload;
+    while(readRecord(is, &type_hint, &payload)) {
+        ReplayEvent evt;
+        evt.update = false;
+
+        // The server a lookup resolved to isn't in most records. It doesn't
+        // matter for the cache, so any stable value will do.
+        if (type_hint == ObjectSegmentationCraqLookupRequestAnalysisTag) {
+            Trace::OSeg::CraqRequest rec;
+            if (!rec.ParseFromString(payload)) continue;
+            evt.object = rec.object();
+            evt.server = (uint32)rec.server();
+        }
+        else if (type_hint == ObjectSegmentationProcessedRequestAnalysisTag) {
+            Trace::OSeg::ProcessedRequest rec;
+            if (!rec.ParseFromString(payload)) continue;
+            evt.object = rec.object();
+            evt.server = (uint32)rec.server();
+        }
+        else if (type_hint == OSegCacheResponseTag) {
+            Trace::OSeg::CacheResponse rec;
+            if (!rec.ParseFromString(payload)) continue;
+            evt.object = rec.object();
+            evt.server = (uint32)rec.server();
+        }
+        else if (type_hint == OSegLookupNotOnServerAnalysisTag) {
+            Trace::OSeg::InvalidLookup rec;
+            if (!rec.ParseFromString(payload)) continue;
+            evt.object = rec.object();
+            evt.server = (uint32)rec.server();
+        }
+        else if (type_hint == OSegCumulativeTraceAnalysisTag) {
+            Trace::OSeg::CumulativeResponse rec;
+            if (!rec.ParseFromString(payload)) continue;
+            evt.object = rec.object();
+            evt.server = (uint32)rec.location_server();
+        }
+        else if (type_hint == OSegTrackedSetResultAnalysisTag) {
+            Trace::OSeg::TrackedSetResults rec;
+            if (!rec.ParseFromString(payload)) continue;
+            evt.object = rec.object();
+            evt.server = (uint32)rec.server();
+            evt.update = true;
+        }
+        else {
+            continue;
+        }
+
+        if (evt.server == NullServerID) evt.server = 1;
+        mEvents.push_back(evt);
+    }
+    return true;
+}
+
+void OSegCacheReplayBenchmark::generateSynthetic() {
+    std::vector<UUID> objects;
+    std::vector<float64> cdf;
+    float64 total = 0;
+    for(uint32 i = 0; i < SYNTHETIC_OBJECTS; i++) {
+        objects.push_back(UUID::random());
+        total += 1.0 / pow((float64)(i+1), SYNTHETIC_ZIPF_EXPONENT);
+        cdf.push_back(total);
+    }
+
+    // Fixed seed so runs are comparable
+    uint32 rng = 0x2545F491;
+    for(uint32 i = 0; i < SYNTHETIC_EVENTS; i++) {
+        rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+        float64 r = (rng / 4294967296.0) * total;
+        uint32 idx = std::lower_bound(cdf.begin(), cdf.end(), r) - cdf.begin();
+        if (idx >= SYNTHETIC_OBJECTS) idx = SYNTHETIC_OBJECTS - 1;
+
+        rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+        ReplayEvent evt;
+        evt.object = objects[idx];
+        evt.server = 1 + (rng % SYNTHETIC_SERVERS);
+        evt.update = (rng / 4294967296.0) < SYNTHETIC_UPDATE_FRACTION;
+        mEvents.push_back(evt);
+    }
+}
+
+void OSegCacheReplayBenchmark::replayThread(OSegCache* cache, uint32 offset, ReplayResult* result) {
+    uint32 nevents = mEvents.size();
+    uint32 idx = offset % nevents;
+    for(uint32 i = 0; i < mEventsPerThread && !mForceStop; i++) {
+        const ReplayEvent& evt = mEvents[idx];
+        if (++idx == nevents) idx = 0;
+
+        if (evt.update) {
+            cache->insert(evt.object, OSegEntry(evt.server, 1.f));
+            continue;
+        }
+
+        bool sample = (result->lookups % LATENCY_SAMPLE_INTERVAL) == 0;
+        Time start = sample ? Timer::now() : Time::null();
+        OSegEntry entry = cache->get(evt.object);
+        if (sample) {
+            result->latencySamples++;
+            result->latencyMicroseconds += (Timer::now() - start).toMicroseconds();
+        }
+
+        result->lookups++;
+        if (!entry.isNull())
+            result->hits++;
+        else
+            cache->insert(evt.object, OSegEntry(evt.server, 1.f));
+    }
+}
+
+float64 OSegCacheReplayBenchmark::run(OSegCache* cache, uint32 nthreads, ReplayResult* result_out) {
+    std::vector<ReplayResult> results(nthreads);
+
+    Time start_time = Timer::now();
+    std::vector<Thread*> threads;
+    for(uint32 i = 0; i < nthreads; i++) {
+        // Start each thread at a different point in the stream so they aren't
+        // all asking for the same object at the same time
+        uint32 offset = (uint32)(((uint64)mEvents.size() * i) / nthreads);
+        threads.push_back(new Thread("OSegCache Replay", std::tr1::bind(&OSegCacheReplayBenchmark::replayThread, this, cache, offset, &results[i])));
+    }
+    for(uint32 i = 0; i < nthreads; i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    Time end_time = Timer::now();
+
+    *result_out = ReplayResult();
+    for(uint32 i = 0; i < nthreads; i++) {
+        result_out->lookups += results[i].lookups;
+        result_out->hits += results[i].hits;
+        result_out->latencySamples += results[i].latencySamples;
+        result_out->latencyMicroseconds += results[i].latencyMicroseconds;
+    }
+    return result_out->lookups / (end_time - start_time).toSeconds();
+}
+
+void OSegCacheReplayBenchmark::start() {
+    mForceStop = false;
+
+    mEvents.clear();
+    if (!mTraceFile.empty()) {
+        if (!loadTrace(mTraceFile))
+            SILOG(benchmark,error,"Couldn't read trace " << mTraceFile << ", using a synthetic workload.");
+        else
+            SILOG(benchmark,info,"Loaded " << mEvents.size() << " OSeg events from " << mTraceFile);
+    }
+    if (mEvents.empty())
+        generateSynthetic();
+
+    // ShardedOSegCache wants a Context for time and stats reporting, but we
+    // never start it so no stats are reported.
+    Network::IOService* ios = new Network::IOService("OSegCacheReplayBenchmark");
+    Network::IOStrand* strand = ios->createStrand("OSegCacheReplayBenchmark Main");
+    Context* ctx = new Context("OSegCacheReplayBenchmark", ios, strand, NULL, Timer::now());
+
+    for(uint32 nthreads = 1; nthreads <= mMaxThreads && !mForceStop; nthreads *= 2) {
+        ReplayResult result;
+
+        LockedLRUOSegCache* locked = new LockedLRUOSegCache(mCacheSize);
+        float64 locked_rate = run(locked, nthreads, &result);
+        delete locked;
+        if (mForceStop) break;
+        SILOG(benchmark,info,
+            "locked lru, " << nthreads << " threads: " << locked_rate << " lookups/s, "
+            << (100.0 * result.hits / std::max(result.lookups, (uint64)1)) << "% hits, "
+            << ((float64)result.latencyMicroseconds / std::max(result.latencySamples, (uint64)1)) << "us mean lookup");
+
+        ShardedOSegCache* sharded = new ShardedOSegCache(ctx, "bench.oseg.cache", mCacheSize, Duration::zero(), mShards);
+        float64 sharded_rate = run(sharded, nthreads, &result);
+        ShardedOSegCache::Stats stats = sharded->stats();
+        delete sharded;
+        if (mForceStop) break;
+        SILOG(benchmark,info,
+            "sharded, " << nthreads << " threads: " << sharded_rate << " lookups/s, "
+            << (100.0 * result.hits / std::max(result.lookups, (uint64)1)) << "% hits, "
+            << ((float64)result.latencyMicroseconds / std::max(result.latencySamples, (uint64)1)) << "us mean lookup, "
+            << stats.evictions << " evictions, " << stats.retries << " read retries");
+    }
+
+    delete ctx;
+    delete strand;
+    delete ios;
+
+    if (!mForceStop)
+        notifyFinished();
+}
+
+void OSegCacheReplayBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,81 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_OSEG_CACHE_REPLAY_BENCHMARK_HPP_
+#define _SIRIKATA_OSEG_CACHE_REPLAY_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+
+namespace Sirikata {
+
+class OSegCache;
+
+/** OSegCacheReplayBenchmark replays a stream of OSeg lookups against the
+ *  OSeg caches from several threads at once, as the forwarder's receive
+ *  threads would, and reports lookups/s, hit rate and mean lookup latency
+ *  for a single locked LRU cache and for ShardedOSegCache.
+ *
+ *  The lookup stream is extracted from a space server trace (the OSeg
+ *  lookup, cache response and tracked set records) given with --trace. If no
+ *  trace is given a Zipf distributed synthetic stream is used instead. Misses
+ *  are filled by inserting into the cache, as the OSeg does when a lookup
+ *  completes.
+ */
+class OSegCacheReplayBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new OSegCacheReplayBenchmark(finished_cb, _param);
+    }
+
+    OSegCacheReplayBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    struct ReplayEvent {
+        UUID object;
+        uint32 server;
+        // Updates come from migrations and overwrite the cached entry
+        bool update;
+    };
+    typedef std::vector<ReplayEvent> ReplayEventList;
+
+    struct ReplayResult {
+        ReplayResult()
+         : lookups(0), hits(0), latencySamples(0), latencyMicroseconds(0)
+        {}
+
+        uint64 lookups;
+        uint64 hits;
+        uint64 latencySamples;
+        uint64 latencyMicroseconds;
+    };
+
+    bool loadTrace(const String& filename);
+    void generateSynthetic();
+
+    // Replay the event list from nthreads threads, returns lookups/s
+    float64 run(OSegCache* cache, uint32 nthreads, ReplayResult* result_out);
+    void replayThread(OSegCache* cache, uint32 offset, ReplayResult* result);
+
+    bool mForceStop;
+
+    String mTraceFile;
+    uint32 mMaxThreads;
+    uint32 mCacheSize;
+    uint32 mShards;
+    uint32 mEventsPerThread;
+
+    ReplayEventList mEvents;
+}; // class OSegCacheReplayBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_OSEG_CACHE_REPLAY_BENCHMARK_HPP_
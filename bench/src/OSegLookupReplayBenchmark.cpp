@@ -0,0 +1,310 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "OSegLookupReplayBenchmark.hpp"
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrandImpl.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <boost/lexical_cast.hpp>
+
+// How often new pings are sent
+#define SEND_INTERVAL Duration::milliseconds(1.0)
+
+namespace Sirikata {
+
+namespace {
+
+/** An OSeg backed by a simulated remote store which serves one request at a
+ *  time, taking a fixed time per request plus a time per key, with results
+ *  arriving a round trip later. Results are cached for a while, as the real
+ *  OSegs do.
+ */
+class SimulatedOSeg : public OSegLookupProvider {
+public:
+    SimulatedOSeg(Network::IOService* ios, uint32 nservers, const Duration& request_cost,
+        const Duration& key_cost, const Duration& round_trip, const Duration& cache_lifetime)
+     : mService(ios),
+       mServers(nservers),
+       mRequestCost(request_cost),
+       mKeyCost(key_cost),
+       mRoundTrip(round_trip),
+       mCacheLifetime(cache_lifetime),
+       mBusyUntil(Time::null())
+    {}
+
+    virtual OSegEntry lookup(const UUID& obj_id) {
+        std::vector<UUID> ids(1, obj_id);
+        std::vector<OSegEntry> results;
+        lookupBatch(ids, &results);
+        return results[0];
+    }
+
+    virtual OSegEntry cacheLookup(const UUID& obj_id) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        CacheMap::iterator it = mCache.find(obj_id);
+        if (it == mCache.end() || it->second.second < Timer::now())
+            return OSegEntry::null();
+        return it->second.first;
+    }
+
+    virtual void lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results) {
+        results->assign(obj_ids.size(), OSegEntry::null());
+
+        Time tnow = Timer::now();
+        Time done;
+        {
+            boost::lock_guard<boost::mutex> lck(mMutex);
+            Time start = std::max(tnow, mBusyUntil);
+            mBusyUntil = start + mRequestCost + mKeyCost * (float32)obj_ids.size();
+            done = mBusyUntil + mRoundTrip;
+        }
+        mService->post(
+            done - tnow,
+            std::tr1::bind(&SimulatedOSeg::complete, this, obj_ids),
+            "SimulatedOSeg::complete"
+        );
+    }
+
+private:
+    void complete(std::vector<UUID> obj_ids) {
+        Time expires = Timer::now() + mCacheLifetime;
+        for(uint32 i = 0; i < obj_ids.size(); i++) {
+            OSegEntry entry((uint32)(UUID::Hasher()(obj_ids[i]) % mServers) + 1, 1.f);
+            {
+                boost::lock_guard<boost::mutex> lck(mMutex);
+                mCache[obj_ids[i]] = std::make_pair(entry, expires);
+            }
+            mLookupListener->osegLookupCompleted(obj_ids[i], entry);
+        }
+    }
+
+    Network::IOService* mService;
+    const uint32 mServers;
+    const Duration mRequestCost;
+    const Duration mKeyCost;
+    const Duration mRoundTrip;
+    const Duration mCacheLifetime;
+
+    boost::mutex mMutex;
+    Time mBusyUntil;
+    typedef std::tr1::unordered_map<UUID, std::pair<OSegEntry, Time>, UUID::Hasher> CacheMap;
+    CacheMap mCache;
+};
+
+} // namespace
+
+OSegLookupReplayBenchmark::OSegLookupReplayBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mRNG(0x2545F491),
+          mStrand(NULL),
+          mQueue(NULL),
+          mStartTime(Time::null()),
+          mTotalPings(0)
+{
+    OptionValue* servers;
+    OptionValue* objectsPerServer;
+    OptionValue* pingsPerSecond;
+    OptionValue* pingSize;
+    OptionValue* duration;
+    OptionValue* maxLookups;
+    OptionValue* queueBytes;
+    OptionValue* batchSize;
+    OptionValue* requestCost;
+    OptionValue* keyCost;
+    OptionValue* roundTrip;
+    OptionValue* cacheLifetime;
+    Sirikata::InitializeClassOptions ico("OSegLookupReplayBenchmark",this,
+        servers=new OptionValue("servers","4",Sirikata::OptionValueType<uint32>(),"Number of space servers, one of which is flooded"),
+        objectsPerServer=new OptionValue("num-objects-per-server","1000",Sirikata::OptionValueType<uint32>(),"Number of objects on each server, as in osegflood"),
+        pingsPerSecond=new OptionValue("num-pings-per-second","20000",Sirikata::OptionValueType<float64>(),"Number of pings sent per second, as in osegflood"),
+        pingSize=new OptionValue("ping-size","1024",Sirikata::OptionValueType<uint32>(),"Size of ping payloads, as in osegflood"),
+        duration=new OptionValue("duration","2s",Sirikata::OptionValueType<Duration>(),"How long to send pings for"),
+        maxLookups=new OptionValue("max-lookups","2000",Sirikata::OptionValueType<uint32>(),"Maximum number of outstanding lookups, as oseg_lookup_queue_size"),
+        queueBytes=new OptionValue("queue-bytes","4194304",Sirikata::OptionValueType<uint32>(),"Memory budget for queued messages, as oseg-lookup-queue-bytes"),
+        batchSize=new OptionValue("batch-size","64",Sirikata::OptionValueType<uint32>(),"Lookup batch size to compare against unbatched lookups, as oseg-lookup-batch-size"),
+        requestCost=new OptionValue("request-cost","100us",Sirikata::OptionValueType<Duration>(),"Time the OSeg store spends on each request"),
+        keyCost=new OptionValue("key-cost","5us",Sirikata::OptionValueType<Duration>(),"Time the OSeg store spends on each key in a request"),
+        roundTrip=new OptionValue("round-trip","1ms",Sirikata::OptionValueType<Duration>(),"Round trip time to the OSeg store"),
+        cacheLifetime=new OptionValue("cache-lifetime","100ms",Sirikata::OptionValueType<Duration>(),"How long lookup results stay in the OSeg cache"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("OSegLookupReplayBenchmark",this);
+    optionsSet->parse(param);
+
+    mServers = std::max(servers->as<uint32>(), (uint32)2);
+    mObjectsPerServer = std::max(objectsPerServer->as<uint32>(), (uint32)1);
+    mPingsPerSecond = pingsPerSecond->as<float64>();
+    mPingSize = pingSize->as<uint32>();
+    mDuration = duration->as<Duration>();
+    mMaxLookups = maxLookups->as<uint32>();
+    mQueueBytes = queueBytes->as<uint32>();
+    mBatchSize = std::max(batchSize->as<uint32>(), (uint32)1);
+    mRequestCost = requestCost->as<Duration>();
+    mKeyCost = keyCost->as<Duration>();
+    mRoundTrip = roundTrip->as<Duration>();
+    mCacheLifetime = cacheLifetime->as<Duration>();
+}
+
+String OSegLookupReplayBenchmark::name() {
+    return "oseg-lookup-replay";
+}
+
+void OSegLookupReplayBenchmark::generateFlows() {
+    // As in OSegScenario::generatePairs, every object on the other servers
+    // gets a flow to a random object on the flood server
+    std::vector<UUID> flooded;
+    for(uint32 i = 0; i < mObjectsPerServer; i++)
+        flooded.push_back(UUID::random());
+
+    mFlows.clear();
+    for(uint32 s = 2; s <= mServers; s++) {
+        for(uint32 i = 0; i < mObjectsPerServer; i++) {
+            mRNG ^= mRNG << 13; mRNG ^= mRNG >> 17; mRNG ^= mRNG << 5;
+            Flow flow;
+            flow.source = UUID::random();
+            flow.dest = flooded[mRNG % flooded.size()];
+            flow.sourceServer = s;
+            mFlows.push_back(flow);
+        }
+    }
+    mPayload = String(mPingSize, 'x');
+}
+
+bool OSegLookupReplayBenchmark::finished() const {
+    return mResult.rejected + mResult.fromCache + mResult.fromServer + mResult.dropped == mTotalPings;
+}
+
+void OSegLookupReplayBenchmark::sendPings() {
+    if (mForceStop) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mDone.notify_one();
+        return;
+    }
+
+    // Send whatever we're behind by, like OSegScenario::sendPings
+    Duration since_start = Timer::now() - mStartTime;
+    uint64 due = (uint64)(std::min(since_start, mDuration).toSeconds() * mPingsPerSecond);
+    // Only this strand sends, so mResult.sent can be read without the lock
+    // here, but results may be counted from other threads.
+    while(mResult.sent < due) {
+        mRNG ^= mRNG << 13; mRNG ^= mRNG >> 17; mRNG ^= mRNG << 5;
+        const Flow& flow = mFlows[mRNG % mFlows.size()];
+        ObjectMessage* msg = createObjectMessage(flow.sourceServer, flow.source, 1, flow.dest, 1, mPayload);
+        bool accepted = mQueue->lookup(
+            msg,
+            std::tr1::bind(&OSegLookupReplayBenchmark::handleLookup, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2, std::tr1::placeholders::_3)
+        );
+        if (!accepted) delete msg;
+
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mResult.sent++;
+        if (!accepted) mResult.rejected++;
+    }
+    mResult.peakQueuedBytes = std::max(mResult.peakQueuedBytes, mQueue->queuedBytes());
+
+    if (since_start < mDuration)
+        mStrand->post(SEND_INTERVAL, std::tr1::bind(&OSegLookupReplayBenchmark::sendPings, this), "OSegLookupReplayBenchmark::sendPings");
+
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    if (mResult.sent == mTotalPings && finished())
+        mDone.notify_one();
+}
+
+void OSegLookupReplayBenchmark::handleLookup(ObjectMessage* msg, const OSegEntry& dest, OSegLookupQueue::ResolvedFrom resolved_from) {
+    delete msg;
+
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    switch(resolved_from) {
+      case OSegLookupQueue::ResolvedFromCache: mResult.fromCache++; break;
+      case OSegLookupQueue::ResolvedFromServer: mResult.fromServer++; break;
+      case OSegLookupQueue::Dropped: mResult.dropped++; break;
+    }
+    if (mResult.sent == mTotalPings && finished())
+        mDone.notify_one();
+}
+
+bool OSegLookupReplayBenchmark::run(uint32 batch_size) {
+    // The network strand, where lookups are made and results delivered
+    Network::IOService* ios = new Network::IOService("OSegLookupReplayBenchmark");
+    Network::IOWork* work = new Network::IOWork(ios, "OSegLookupReplayBenchmark");
+    mStrand = ios->createStrand("OSegLookupReplayBenchmark");
+    // And the simulated store
+    Network::IOService* store_ios = new Network::IOService("OSegLookupReplayBenchmark Store");
+    Network::IOWork* store_work = new Network::IOWork(store_ios, "OSegLookupReplayBenchmark Store");
+
+    SimulatedOSeg* oseg = new SimulatedOSeg(store_ios, mServers, mRequestCost, mKeyCost, mRoundTrip, mCacheLifetime);
+    mQueue = new OSegLookupQueue(NULL, mStrand, oseg, mMaxLookups, mQueueBytes, batch_size);
+
+    mResult = RunResult();
+    mTotalPings = (uint64)(mDuration.toSeconds() * mPingsPerSecond);
+
+    Thread* net_thread = new Thread("OSegLookupReplayBenchmark", std::tr1::bind(&Network::IOService::runNoReturn, ios));
+    Thread* store_thread = new Thread("OSegLookupReplayBenchmark Store", std::tr1::bind(&Network::IOService::runNoReturn, store_ios));
+
+    mStartTime = Timer::now();
+    {
+        boost::unique_lock<boost::mutex> lck(mMutex);
+        mStrand->post(std::tr1::bind(&OSegLookupReplayBenchmark::sendPings, this), "OSegLookupReplayBenchmark::sendPings");
+        while(!mForceStop && !(mResult.sent == mTotalPings && finished()))
+            mDone.wait(lck);
+        mResult.elapsed = Timer::now() - mStartTime;
+    }
+
+    delete work;
+    delete store_work;
+    ios->stop();
+    store_ios->stop();
+    net_thread->join();
+    store_thread->join();
+    delete net_thread;
+    delete store_thread;
+
+    if (!mForceStop) {
+        const Trace::LatencyHistogram& latencies = mQueue->latencies();
+        SILOG(benchmark,info,
+            (batch_size == 0 ? String("Unbatched") : ("Batch size " + boost::lexical_cast<String>(batch_size))) << ": " <<
+            mResult.sent << " pings in " << mResult.elapsed << ", " <<
+            mQueue->lookupsIssued() << " lookups in " << mQueue->requestsIssued() << " requests, " <<
+            mResult.fromCache << " resolved from cache, " << mResult.fromServer << " from server, " <<
+            mResult.rejected << " rejected, " << mResult.dropped << " dropped, " <<
+            "peak queued " << mResult.peakQueuedBytes << " bytes");
+        SILOG(benchmark,info,
+            "  Lookup latency: mean " << latencies.mean() <<
+            ", p50 < " << latencies.percentile(.5) <<
+            ", p90 < " << latencies.percentile(.9) <<
+            ", p99 < " << latencies.percentile(.99) <<
+            ", max " << latencies.max());
+    }
+
+    delete mQueue;
+    mQueue = NULL;
+    delete oseg;
+    delete mStrand;
+    mStrand = NULL;
+    delete ios;
+    delete store_ios;
+
+    return !mForceStop;
+}
+
+void OSegLookupReplayBenchmark::start() {
+    mForceStop = false;
+
+    generateFlows();
+
+    if (run(0) && run(mBatchSize))
+        notifyFinished();
+}
+
+void OSegLookupReplayBenchmark::stop() {
+    mForceStop = true;
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    mDone.notify_one();
+}
+
+} // namespace Sirikata
@@ -0,0 +1,109 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_OSEG_LOOKUP_REPLAY_BENCHMARK_HPP_
+#define _SIRIKATA_OSEG_LOOKUP_REPLAY_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/network/ObjectMessage.hpp>
+#include <sirikata/space/OSegLookupQueue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+/** OSegLookupReplayBenchmark replays the traffic the osegflood scenario
+ *  (OSegScenario in simoh) generates against an OSegLookupQueue, as a space
+ *  server's forwarder would see it: objects on every other server sending
+ *  pings at a fixed rate to randomly chosen objects on the flood server.
+ *
+ *  Lookups are resolved by a simulated OSeg which, like CRAQ or Redis, serves
+ *  one request at a time with a fixed cost per request plus a cost per key,
+ *  and caches results for a short time. The traffic is replayed once issuing
+ *  each lookup individually and once with batching, reporting how many
+ *  requests were made, how many messages were dropped, the peak memory used
+ *  by queued messages and lookup latencies.
+ */
+class OSegLookupReplayBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new OSegLookupReplayBenchmark(finished_cb, _param);
+    }
+
+    OSegLookupReplayBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    typedef Sirikata::Protocol::Object::ObjectMessage ObjectMessage;
+
+    struct Flow {
+        UUID source;
+        UUID dest;
+        ServerID sourceServer;
+    };
+
+    struct RunResult {
+        RunResult()
+         : sent(0), rejected(0), fromCache(0), fromServer(0), dropped(0),
+           peakQueuedBytes(0), elapsed(Duration::zero())
+        {}
+
+        uint64 sent;
+        uint64 rejected;
+        uint64 fromCache;
+        uint64 fromServer;
+        uint64 dropped;
+        size_t peakQueuedBytes;
+        Duration elapsed;
+    };
+
+    void generateFlows();
+    // Replay the traffic with the given lookup batch size, 0 for no batching
+    bool run(uint32 batch_size);
+    // Sends the pings that are due, then reschedules itself until they've all
+    // been sent
+    void sendPings();
+    void handleLookup(ObjectMessage* msg, const OSegEntry& dest, OSegLookupQueue::ResolvedFrom resolved_from);
+    // Must hold mMutex
+    bool finished() const;
+
+    bool mForceStop;
+
+    uint32 mServers;
+    uint32 mObjectsPerServer;
+    float64 mPingsPerSecond;
+    uint32 mPingSize;
+    Duration mDuration;
+    uint32 mMaxLookups;
+    uint32 mQueueBytes;
+    uint32 mBatchSize;
+    Duration mRequestCost;
+    Duration mKeyCost;
+    Duration mRoundTrip;
+    Duration mCacheLifetime;
+
+    std::vector<Flow> mFlows;
+    String mPayload;
+    uint32 mRNG;
+
+    // State of the current run
+    Network::IOStrand* mStrand;
+    OSegLookupQueue* mQueue;
+    Time mStartTime;
+    uint64 mTotalPings;
+    RunResult mResult;
+    boost::mutex mMutex;
+    boost::condition_variable mDone;
+}; // class OSegLookupReplayBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_OSEG_LOOKUP_REPLAY_BENCHMARK_HPP_
@@ -0,0 +1,159 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "PackedDiskCacheBenchmark.hpp"
+#include <sirikata/core/transfer/PackedDiskCacheLayer.hpp>
+#include <sirikata/core/transfer/DiskCacheLayer.hpp>
+#include <sirikata/core/transfer/LRUPolicy.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <boost/filesystem.hpp>
+
+namespace Sirikata {
+
+using namespace Sirikata::Transfer;
+
+namespace {
+
+Fingerprint assetId(uint32 i) {
+    return SHA256::computeDigest(&i, sizeof(i));
+}
+
+uint32 xorshift(uint32* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+CacheLayer* createPacked(CachePolicy* policy, const String& dir) {
+    return new PackedDiskCacheLayer(policy, dir, NULL);
+}
+#endif
+
+CacheLayer* createFiles(CachePolicy* policy, const String& dir) {
+    return new DiskCacheLayer(policy, dir, NULL);
+}
+
+} // namespace
+
+PackedDiskCacheBenchmark::PackedDiskCacheBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mDone(false),
+          mHit(false)
+{
+    OptionValue* assets;
+    OptionValue* asset_size;
+    OptionValue* lookups;
+    OptionValue* compare;
+    Sirikata::InitializeClassOptions ico("PackedDiskCacheBenchmark",this,
+        assets=new OptionValue("assets","100000",Sirikata::OptionValueType<uint32>(),"Number of assets to cache"),
+        asset_size=new OptionValue("asset-size","4096",Sirikata::OptionValueType<uint32>(),"Size of each asset in bytes"),
+        lookups=new OptionValue("lookups","100000",Sirikata::OptionValueType<uint32>(),"Number of random hits to time"),
+        compare=new OptionValue("compare","true",Sirikata::OptionValueType<bool>(),"Also run against DiskCacheLayer, which uses a file per asset"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("PackedDiskCacheBenchmark",this);
+    optionsSet->parse(param);
+
+    mAssets = assets->as<uint32>();
+    mAssetSize = std::max(asset_size->as<uint32>(), (uint32)1);
+    mLookups = lookups->as<uint32>();
+    mCompare = compare->as<bool>();
+}
+
+String PackedDiskCacheBenchmark::name() {
+    return "packed-disk-cache";
+}
+
+void PackedDiskCacheBenchmark::gotData(const SparseData* data) {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    mHit = (data != NULL);
+    mDone = true;
+    mCond.notify_one();
+}
+
+bool PackedDiskCacheBenchmark::lookup(CacheLayer* cache, uint32 asset) {
+    {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mDone = false;
+    }
+    cache->getData(assetId(asset), Range(true), std::tr1::bind(&PackedDiskCacheBenchmark::gotData, this, _1));
+    boost::unique_lock<boost::mutex> lck(mMutex);
+    while (!mDone)
+        mCond.wait(lck);
+    return mHit;
+}
+
+bool PackedDiskCacheBenchmark::run(const String& label, const CreateCacheCallback& create_cb) {
+    boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("sirikata-cachebench-%%%%%%%%");
+    // Everything fits, so nothing is evicted
+    cache_usize_type capacity = (cache_usize_type)mAssets * (mAssetSize + 1024);
+
+    {
+        LRUPolicy policy(capacity);
+        std::auto_ptr<CacheLayer> cache(create_cb(&policy, dir.string()));
+        String content(mAssetSize, 'x');
+        for(uint32 i = 0; i < mAssets && !mForceStop; i++) {
+            std::memcpy(&content[0], &i, std::min((uint32)sizeof(i), mAssetSize));
+            cache->addToCache(assetId(i), DenseDataPtr(new DenseData(content)));
+        }
+        // Destroying the layer waits for everything to be written out
+    }
+    if (mForceStop) {
+        boost::filesystem::remove_all(dir);
+        return false;
+    }
+
+    LRUPolicy policy(capacity);
+    Time load_start = Timer::now();
+    std::auto_ptr<CacheLayer> cache(create_cb(&policy, dir.string()));
+    Duration load_time = Timer::now() - load_start;
+
+    uint32 rng = 0x2545F491, hits = 0;
+    Time lookup_start = Timer::now();
+    for(uint32 i = 0; i < mLookups && !mForceStop; i++) {
+        if (lookup(cache.get(), xorshift(&rng) % mAssets))
+            hits++;
+    }
+    Duration lookup_time = Timer::now() - lookup_start;
+
+    cache.reset();
+    boost::filesystem::remove_all(dir);
+    if (mForceStop) return false;
+
+    SILOG(benchmark,info,
+        label << ": " << mAssets << " assets of " << mAssetSize << " bytes, cold start in " << load_time <<
+        ", " << hits << "/" << mLookups << " hits, " <<
+        (mLookups > 0 ? lookup_time.toMicroseconds() / (float64)mLookups : 0) << "us per hit");
+    if (hits != mLookups)
+        SILOG(benchmark,error, label << ": missing assets");
+    return true;
+}
+
+void PackedDiskCacheBenchmark::start() {
+    mForceStop = false;
+
+    if (mAssets == 0) {
+        notifyFinished();
+        return;
+    }
+
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+    if (!run("packed", createPacked)) return;
+#else
+    SILOG(benchmark,error,"PackedDiskCacheLayer isn't supported on this platform");
+#endif
+    if (mCompare && !run("files", createFiles)) return;
+
+    notifyFinished();
+}
+
+void PackedDiskCacheBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
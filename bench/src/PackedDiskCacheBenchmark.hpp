@@ -0,0 +1,60 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_PACKED_DISK_CACHE_BENCHMARK_HPP_
+#define _SIRIKATA_PACKED_DISK_CACHE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/transfer/CacheLayer.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+/** PackedDiskCacheBenchmark fills a fresh PackedDiskCacheLayer with many
+ *  small assets, then measures how long a new one takes to start up from what
+ *  was left on disk (loading the index) and the average latency of hits. The
+ *  same is optionally done with a DiskCacheLayer, which stores a file per
+ *  asset, for comparison.
+ */
+class PackedDiskCacheBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new PackedDiskCacheBenchmark(finished_cb, _param);
+    }
+
+    PackedDiskCacheBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Runs the benchmark against the layers create_cb makes, returning false
+    // if it was stopped
+    typedef std::tr1::function<Transfer::CacheLayer*(Transfer::CachePolicy*, const String&)> CreateCacheCallback;
+    bool run(const String& label, const CreateCacheCallback& create_cb);
+    // Waits for a getData to complete, returning whether it hit
+    bool lookup(Transfer::CacheLayer* cache, uint32 asset);
+    void gotData(const Transfer::SparseData* data);
+
+    bool mForceStop;
+
+    uint32 mAssets;
+    uint32 mAssetSize;
+    uint32 mLookups;
+    bool mCompare;
+
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    bool mDone;
+    bool mHit;
+}; // class PackedDiskCacheBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_PACKED_DISK_CACHE_BENCHMARK_HPP_
@@ -0,0 +1,223 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "SSTThroughputBenchmark.hpp"
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrandImpl.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+#define SST_BENCH_LISTEN_PORT 100
+
+namespace Sirikata {
+
+using std::tr1::placeholders::_1;
+using std::tr1::placeholders::_2;
+
+SSTThroughputBenchmark::SSTThroughputBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mIOService(NULL),
+          mStrand(NULL),
+          mContext(NULL),
+          mConnMgr(NULL)
+{
+}
+
+String SSTThroughputBenchmark::name() {
+    return "sst-throughput";
+}
+
+void SSTThroughputBenchmark::handleConnected(int err, StreamPtr s) {
+    if (err != SST_IMPL_SUCCESS || !s) {
+        SILOG(benchmark,error,"SST loopback connection failed");
+        mIOService->stop();
+        return;
+    }
+    mSendStream = s;
+    mStartTime = Timer::now();
+    sendMore();
+}
+
+void SSTThroughputBenchmark::handleListenStream(int err, StreamPtr s) {
+    if (err != SST_IMPL_SUCCESS || !s) return;
+    mReceiveStream = s;
+    s->registerReadCallback(
+        std::tr1::bind(&SSTThroughputBenchmark::handleRead, this, _1, _2)
+    );
+}
+
+void SSTThroughputBenchmark::handleRead(uint8* data, int size) {
+    uint64 completed_before = mBytesReceived / mMessage.size();
+    mBytesReceived += size;
+    uint64 completed_after = mBytesReceived / mMessage.size();
+
+    Time now = Timer::now();
+    for(uint64 msg = completed_before; msg < completed_after && msg < mMessageSendTimes.size(); msg++)
+        mMessageLatencies.push_back(now - mMessageSendTimes[msg]);
+
+    if (mBytesReceived >= mTotalBytes) {
+        mEndTime = Timer::now();
+        mIOService->stop();
+    }
+}
+
+void SSTThroughputBenchmark::sendMore() {
+    if (mForceStop) {
+        mIOService->stop();
+        return;
+    }
+
+    while(mBytesSent < mTotalBytes) {
+        if (mMessageOffset == 0)
+            mMessageSendTimes.push_back(Timer::now());
+
+        uint32 remaining = mMessage.size() - mMessageOffset;
+        int written = mSendStream->write(&mMessage[mMessageOffset], remaining);
+        if (written <= 0) {
+            // Nothing went out, so the message hasn't started yet
+            if (mMessageOffset == 0)
+                mMessageSendTimes.pop_back();
+            break;
+        }
+
+        mBytesSent += written;
+        mMessageOffset += written;
+        if (mMessageOffset == mMessage.size()) {
+            mMessageOffset = 0;
+            mMessagesSent++;
+        }
+        // Partial write, the queue is full
+        if ((uint32)written < remaining) break;
+    }
+
+    if (mBytesSent < mTotalBytes) {
+        mStrand->post(
+            Duration::milliseconds((int64)1),
+            std::tr1::bind(&SSTThroughputBenchmark::sendMore, this),
+            "SSTThroughputBenchmark::sendMore"
+        );
+    }
+}
+
+void SSTThroughputBenchmark::runWorkload(const String& label, uint32 msg_size, uint64 total_bytes,
+    const String& congestion_control, const LoopbackLinkConditions& link)
+{
+    mMessage.resize(msg_size);
+    for(uint32 i = 0; i < msg_size; i++)
+        mMessage[i] = (uint8)i;
+    mMessageOffset = 0;
+    mMessagesSent = 0;
+    mBytesSent = 0;
+    mBytesReceived = 0;
+    mTotalBytes = total_bytes;
+    mStartTime = Time::null();
+    mEndTime = Time::null();
+    mMessageSendTimes.clear();
+    mMessageSendTimes.reserve(total_bytes / msg_size + 1);
+    mMessageLatencies.clear();
+    mMessageLatencies.reserve(total_bytes / msg_size + 1);
+
+    SST::BufferPool::getSingleton().resetStats();
+
+    mIOService = new Network::IOService("SSTThroughputBenchmark");
+    mStrand = mIOService->createStrand("SSTThroughputBenchmark Main");
+    mContext = new Context("SSTThroughputBenchmark", mIOService, mStrand, NULL, Timer::now());
+    mConnMgr = new ConnectionManagerType();
+    mConnMgr->setCongestionControl(congestion_control);
+
+    // Impair both directions, but don't drop the same datagrams in each
+    LoopbackLinkConditions reverse_link = link;
+    reverse_link.seed = link.seed + 1;
+
+    LoopbackEndPoint sender(1), receiver(2);
+    DatagramLayerType::Ptr sender_layer =
+        mConnMgr->createDatagramLayer(sender, mContext, link);
+    DatagramLayerType::Ptr receiver_layer =
+        mConnMgr->createDatagramLayer(receiver, mContext, reverse_link);
+
+    mConnMgr->listen(
+        std::tr1::bind(&SSTThroughputBenchmark::handleListenStream, this, _1, _2),
+        SST::EndPoint<LoopbackEndPoint>(receiver, SST_BENCH_LISTEN_PORT)
+    );
+    mConnMgr->connectStream(
+        SST::EndPoint<LoopbackEndPoint>(sender, 0),
+        SST::EndPoint<LoopbackEndPoint>(receiver, SST_BENCH_LISTEN_PORT),
+        std::tr1::bind(&SSTThroughputBenchmark::handleConnected, this, _1, _2)
+    );
+
+    mIOService->run();
+
+    if (!mForceStop && mEndTime != Time::null()) {
+        Duration dur = mEndTime - mStartTime;
+        SST::BufferPool::Stats stats = SST::BufferPool::getSingleton().stats();
+        SILOG(benchmark,info,
+            label << ": " << mMessagesSent << " messages of " << msg_size << " bytes in " << dur << ", "
+            << (mBytesReceived / (1024.0*1024.0)) / dur.toSeconds() << " MB/s, "
+            << mMessagesSent / dur.toSeconds() << " messages/s");
+        SILOG(benchmark,info,
+            label << ": " << sender_layer->datagramsSent() << " datagrams, "
+            << sender_layer->datagramsDropped() + receiver_layer->datagramsDropped() << " dropped, "
+            << stats.slabsAllocated << " slabs allocated, "
+            << stats.slabsReused << " slabs reused, "
+            << (float64)stats.bytesCopied / mMessagesSent << " bytes copied into SST buffers per message");
+
+        if (!mMessageLatencies.empty()) {
+            std::sort(mMessageLatencies.begin(), mMessageLatencies.end());
+            uint32 nlat = mMessageLatencies.size();
+            SILOG(benchmark,info,
+                label << ": delivery latency p50 " << mMessageLatencies[nlat / 2]
+                << ", p99 " << mMessageLatencies[std::min(nlat - 1, (nlat * 99) / 100)]
+                << ", max " << mMessageLatencies[nlat - 1]);
+        }
+    }
+
+    mSendStream.reset();
+    mReceiveStream.reset();
+    sender_layer.reset();
+    receiver_layer.reset();
+    delete mConnMgr;
+    mConnMgr = NULL;
+    delete mContext;
+    mContext = NULL;
+    delete mStrand;
+    mStrand = NULL;
+    delete mIOService;
+    mIOService = NULL;
+}
+
+void SSTThroughputBenchmark::start() {
+    mForceStop = false;
+
+    LoopbackLinkConditions clean_link;
+    runWorkload("small messages", 64, 4*1024*1024, "newreno", clean_link);
+    if (mForceStop) return;
+    runWorkload("64KB messages", 65536, 64*1024*1024, "newreno", clean_link);
+    if (mForceStop) return;
+
+    LoopbackLinkConditions lossy_link;
+    lossy_link.latency = Duration::milliseconds((int64)5);
+    lossy_link.jitter = Duration::milliseconds((int64)1);
+    lossy_link.seed = 42;
+    const char* controllers[] = { "newreno", "delay" };
+    const float64 loss_rates[] = { 0.0, 0.01, 0.05 };
+    for(uint32 ci = 0; ci < sizeof(controllers)/sizeof(controllers[0]); ci++) {
+        for(uint32 li = 0; li < sizeof(loss_rates)/sizeof(loss_rates[0]); li++) {
+            lossy_link.lossRate = loss_rates[li];
+            std::ostringstream label;
+            label << controllers[ci] << ", 5ms +/- 1ms, " << (loss_rates[li]*100) << "% loss";
+            runWorkload(label.str(), 1024, 1024*1024, controllers[ci], lossy_link);
+            if (mForceStop) return;
+        }
+    }
+
+    notifyFinished();
+}
+
+void SSTThroughputBenchmark::stop() {
+    mForceStop = true;
+    if (mIOService)
+        mIOService->stop();
+}
+
+} // namespace Sirikata
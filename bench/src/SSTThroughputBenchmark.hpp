@@ -0,0 +1,78 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SST_THROUGHPUT_BENCHMARK_HPP_
+#define _SIRIKATA_SST_THROUGHPUT_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include "LoopbackSST.hpp"
+
+namespace Sirikata {
+
+/** SSTThroughputBenchmark measures raw SST stream throughput (MB/s) between
+ *  two endpoints in the same process, using the loopback datagram layer so
+ *  no real network is involved. It runs a small-message and a 64KB-message
+ *  workload and reports the SST buffer pool's allocation and copy counts for
+ *  each. It then runs each congestion controller over a link with injected
+ *  latency, jitter and loss, reporting throughput and the tail of the message
+ *  delivery latency.
+ */
+class SSTThroughputBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new SSTThroughputBenchmark(finished_cb, _param);
+    }
+
+    SSTThroughputBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    typedef SST::Stream<LoopbackEndPoint> StreamType;
+    typedef StreamType::Ptr StreamPtr;
+    typedef SST::ConnectionManager<LoopbackEndPoint> ConnectionManagerType;
+    typedef SST::BaseDatagramLayer<LoopbackEndPoint> DatagramLayerType;
+
+    // Run one workload, sending total_bytes in messages of msg_size bytes
+    // using the given congestion controller and link.
+    void runWorkload(const String& label, uint32 msg_size, uint64 total_bytes,
+        const String& congestion_control, const LoopbackLinkConditions& link);
+
+    void handleConnected(int err, StreamPtr s);
+    void handleListenStream(int err, StreamPtr s);
+    void handleRead(uint8* data, int size);
+    void sendMore();
+
+    bool mForceStop;
+
+    // Per-workload state
+    Network::IOService* mIOService;
+    Network::IOStrand* mStrand;
+    Context* mContext;
+    ConnectionManagerType* mConnMgr;
+    StreamPtr mSendStream;
+    StreamPtr mReceiveStream;
+
+    std::vector<uint8> mMessage;
+    uint32 mMessageOffset; // Bytes of the current message already written
+    uint64 mMessagesSent;
+    uint64 mBytesSent;
+    uint64 mBytesReceived;
+    uint64 mTotalBytes;
+    Time mStartTime;
+    Time mEndTime;
+    // When each message started being written, and how long each took to be
+    // fully delivered
+    std::vector<Time> mMessageSendTimes;
+    std::vector<Duration> mMessageLatencies;
+}; // class SSTThroughputBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SST_THROUGHPUT_BENCHMARK_HPP_
@@ -52,6 +52,7 @@ SSTBenchmark::SSTBenchmark(const FinishedCallback& finished_cb, const String&par
         : Benchmark(finished_cb),
          mForceStop(false),
          mPingRate(Duration::seconds(0)),
+          mFramingIndex(0),
           mStream(NULL),
           mListener(NULL),
           mStartTime(Time::epoch()),
@@ -68,6 +69,8 @@ SSTBenchmark::SSTBenchmark(const FinishedCallback& finished_cb, const String&par
     OptionValue*listenOptions;
     OptionValue*whichPlugin;
     OptionValue*numPings;
+    OptionValue*framings;
+    OptionValue*zeroCopy;
     mIOService = new Sirikata::Network::IOService("SSTBenchmark");
     mIOStrand = mIOService->createStrand("SSTBenchmark Main");
     Sirikata::InitializeClassOptions ico("SSTBenchmark",this,
@@ -80,6 +83,8 @@ SSTBenchmark::SSTBenchmark(const FinishedCallback& finished_cb, const String&par
                                          streamOptions=new OptionValue("stream-options","--send-buffer-size=32768",Sirikata::OptionValueType<String>(),"options passed to tcpsst"),
                                          whichPlugin=new OptionValue("stream-plugin","tcpsst",Sirikata::OptionValueType<String>(),"which plugin to load for sst functionality"),
                                          numPings=new OptionValue("num-pings","1000",Sirikata::OptionValueType<size_t>(),"How many pings to "),
+                                         framings=new OptionValue("framings","rfc6455,length-delim,base64",Sirikata::OptionValueType<String>(),"comma separated framings to test in turn: rfc6455, length-delim or base64"),
+                                         zeroCopy=new OptionValue("zero-copy","true",Sirikata::OptionValueType<bool>(),"hand ping buffers to the stream rather than having it copy them"),
                                          NULL);
 
     OptionSet* optionsSet = OptionSet::getOptions("SSTBenchmark",this);
@@ -94,15 +99,32 @@ SSTBenchmark::SSTBenchmark(const FinishedCallback& finished_cb, const String&par
     mStreamOptions=streamOptions->as<String>();
     mStreamPlugin=whichPlugin->as<String>();
     mOrdered=ordered->as<bool>();
-    mPingFunction=std::tr1::bind(&SSTBenchmark::pingPoller,this);
     mNumPings=numPings->as<size_t>();
+    mZeroCopy=zeroCopy->as<bool>();
+
+    String framingList=framings->as<String>();
+    String::size_type pos=0;
+    while (pos<=framingList.size()) {
+        String::size_type end=framingList.find(',',pos);
+        if (end==String::npos) end=framingList.size();
+        String framing=framingList.substr(pos,end-pos);
+        if (framing=="rfc6455"||framing=="length-delim"||framing=="base64")
+            mFramings.push_back(framing);
+        else if (!framing.empty())
+            SILOG(benchmark,error,"Unknown framing "<<framing);
+        pos=end+1;
+    }
+    if (mFramings.empty())
+        mFramings.push_back("rfc6455");
 }
 
 String SSTBenchmark::name() {
     return "ping";
 }
 
-void SSTBenchmark::pingPoller(){
+void SSTBenchmark::pingPoller(uint32 framing){
+    // Pollers left over from a previous framing's run just stop
+    if (framing!=mFramingIndex) return;
     if (mPingsReceived<mNumPings&&!mForceStop) {
         Time cur=Time::now(Duration::zero());
         double invPingRate=mPingRate.toSeconds();
@@ -122,17 +144,26 @@ void SSTBenchmark::pingPoller(){
         }
         uint32 ii;
         for(ii = 0; ii < numMorePings; ii++) {
-            Sirikata::Network::Chunk serializedChunk;
+            Sirikata::Network::Chunk* serializedChunk=new Sirikata::Network::Chunk();
             size_t pingNumber=mOutstandingPings.size();
             for (int i=0;i<8;++i) {
                 unsigned char pn=pingNumber%256;
-                serializedChunk.push_back(pn);
+                serializedChunk->push_back(pn);
                 pingNumber/=256;
             }
-            if (mPingSize>serializedChunk.size()) {
-                serializedChunk.resize(mPingSize);
+            if (mPingSize>serializedChunk->size()) {
+                serializedChunk->resize(mPingSize);
             }
-            if (mStream->send(serializedChunk,mOrdered?Sirikata::Network::ReliableOrdered:Sirikata::Network::ReliableUnordered)) {
+            Sirikata::Network::StreamReliability reliability=mOrdered?Sirikata::Network::ReliableOrdered:Sirikata::Network::ReliableUnordered;
+            bool sent;
+            if (mZeroCopy) {
+                sent=mStream->sendOwned(serializedChunk,reliability);
+                if (!sent) delete serializedChunk;
+            }else {
+                sent=mStream->send(*serializedChunk,reliability);
+                delete serializedChunk;
+            }
+            if (sent) {
                 ++mPingsSent;
                 mOutstandingPings.push_back(cur);
                 mPingResponses.push_back(Duration::zero());
@@ -183,18 +214,40 @@ void SSTBenchmark::computePingTime(Sirikata::Network::Chunk&chk, const Sirikata:
             avg+=mPingResponses[i];
         }
         avg/=(double)mPingResponses.size();
+        SILOG(benchmark,info,"Framing: "<<mFramings[mFramingIndex]<<(mZeroCopy?" (zero-copy)":""));
         SILOG(benchmark,info,"Test Time: "<<cur-mStartTime);
         SILOG(benchmark,info,"Ping Average "<<avg);
         SILOG(benchmark,info,"Transfer Rate "<<2*mNumPings*(double)chk.size()/(cur-mStartTime).toSeconds());
-        stop();
+        SILOG(benchmark,info,"Message Rate "<<mPingsReceived/(cur-mStartTime).toSeconds()<<" pings/s");
+        SILOG(benchmark,info,"Bytes Copied Per Message "<<mStream->bytesCopied()/(double)(mPingsSent+mPingsReceived));
+        if (mFramingIndex+1<mFramings.size()) {
+            // Close from here, but only clean up once the stream is done
+            // calling back into us
+            Sirikata::Network::Stream* finished=mStream;
+            mStream=NULL;
+            finished->close();
+            ++mFramingIndex;
+            mIOService->post(std::tr1::bind(&SSTBenchmark::nextFraming,this,finished),"SSTBenchmark Next Framing");
+        }else {
+            stop();
+        }
     }else
     if (mPingRate.toSeconds()==0) {
-        pingPoller();
+        pingPoller(mFramingIndex);
     }
 }
 void SSTBenchmark::bouncePing(Sirikata::Network::Stream* strm, Sirikata::Network::Chunk&chk, const Sirikata::Network::Stream::PauseReceiveCallback& pause){
     if (!mForceStop) {
-        strm->send(chk,mOrdered?Sirikata::Network::ReliableOrdered:Sirikata::Network::ReliableUnordered);
+        Sirikata::Network::StreamReliability reliability=mOrdered?Sirikata::Network::ReliableOrdered:Sirikata::Network::ReliableUnordered;
+        if (mZeroCopy) {
+            // Take over the received buffer and send it straight back out
+            Sirikata::Network::Chunk* echo=new Sirikata::Network::Chunk();
+            echo->swap(chk);
+            if (!strm->sendOwned(echo,reliability))
+                delete echo;
+        }else {
+            strm->send(chk,reliability);
+        }
     }
 }
 void SSTBenchmark::newStream(Sirikata::Network::Stream*newStream, Sirikata::Network::Stream::SetCallbacks&cb) {
@@ -205,19 +258,41 @@ void SSTBenchmark::newStream(Sirikata::Network::Stream*newStream, Sirikata::Netw
     }
 }
 
+void SSTBenchmark::connect() {
+    String options=mStreamOptions;
+    if (mFramings[mFramingIndex]=="length-delim")
+        options+=" --websocket-draft-76=true";
+    else if (mFramings[mFramingIndex]=="base64")
+        options+=" --base64=true";
+    mPingFunction=std::tr1::bind(&SSTBenchmark::pingPoller,this,mFramingIndex);
+    mStream=Sirikata::Network::StreamFactory::getSingleton().getConstructor(mStreamPlugin)(mIOStrand,Sirikata::Network::StreamFactory::getSingleton().getOptionParser(mStreamPlugin)(options));
+    mStream->connect(Sirikata::Network::Address(mHost,mPort),
+                     &Sirikata::Network::Stream::ignoreSubstreamCallback,
+                     std::tr1::bind(&SSTBenchmark::connected,this,std::tr1::placeholders::_1,std::tr1::placeholders::_2),
+        std::tr1::bind(&SSTBenchmark::computePingTime,this,std::tr1::placeholders::_1,std::tr1::placeholders::_2),
+                     &Sirikata::Network::Stream::ignoreReadySendCallback);
+}
+
+void SSTBenchmark::nextFraming(Sirikata::Network::Stream* finished) {
+    delete finished;
+    if (mForceStop) return;
+
+    mPingsAttemptedSent=0;
+    mPingsSent=0;
+    mPingsReceived=0;
+    mOutstandingPings.clear();
+    mPingResponses.clear();
+    connect();
+}
+
 void noop(){}
 void SSTBenchmark::start() {
     static Sirikata::PluginManager pluginManager;
     pluginManager.load(mStreamPlugin);
     mForceStop = false;
     if (!mHost.empty()) {
-        mStream=Sirikata::Network::StreamFactory::getSingleton().getConstructor(mStreamPlugin)(mIOStrand,Sirikata::Network::StreamFactory::getSingleton().getOptionParser(mStreamPlugin)(mStreamOptions));
-        mStream->connect(Sirikata::Network::Address(mHost,mPort),
-                         &Sirikata::Network::Stream::ignoreSubstreamCallback,
-                         std::tr1::bind(&SSTBenchmark::connected,this,std::tr1::placeholders::_1,std::tr1::placeholders::_2),
-            std::tr1::bind(&SSTBenchmark::computePingTime,this,std::tr1::placeholders::_1,std::tr1::placeholders::_2),
-                         &Sirikata::Network::Stream::ignoreReadySendCallback);
-
+        mFramingIndex=0;
+        connect();
     }else {
         mListener=Sirikata::Network::StreamListenerFactory::getSingleton().getConstructor(mStreamPlugin)(mIOStrand,Sirikata::Network::StreamFactory::getSingleton().getOptionParser(mStreamPlugin)(mListenOptions));
         mListener->listen(Sirikata::Network::Address("127.0.0.1",mPort),
@@ -39,8 +39,14 @@
 
 namespace Sirikata {
 
-/** TimerSpeedBenchmark tests the cost of Timer calls, i.e. how many we can call
- *   per second.
+/** SSTBenchmark measures ping round trip times and throughput over a Stream,
+ *  with one process listening and echoing pings back to the other.
+ *
+ *  The connecting side runs the test once for each of the requested framings,
+ *  reporting pings per second and how many bytes the stream copied per message
+ *  sent or received. With zero-copy on, pings are handed to the stream with
+ *  sendOwned() so the payload itself never needs to be copied. Base64 framing
+ *  always encodes the payload into a new buffer, so it serves as the baseline.
  */
 class SSTBenchmark : public Benchmark {
   public:
@@ -59,7 +65,9 @@ class SSTBenchmark : public Benchmark {
 
   private:
     std::tr1::function<void()>mPingFunction;
-    void pingPoller();
+    void pingPoller(uint32 framing);
+    void connect();
+    void nextFraming(Sirikata::Network::Stream* finished);
     void connected(Sirikata::Network::Stream::ConnectionStatus,const std::string&reason);
     void remoteConnected(Sirikata::Network::Stream*strm,Sirikata::Network::Stream::ConnectionStatus,const std::string&reason);
     void computePingTime(Sirikata::Network::Chunk&chk, const Sirikata::Network::Stream::PauseReceiveCallback& pause);
@@ -70,6 +78,7 @@ class SSTBenchmark : public Benchmark {
     bool mForceStop; // Indicates that the benchmark runner wants us to exit ASAP
     bool mOrdered; // Turn ordering of packets in the Stream on. NOTE: Currently
                    // unordered appears to be broken
+    bool mZeroCopy; // Hand ping buffers to the stream instead of having it copy them
     Duration mPingRate; // Inverse of target ping rate - seconds/ping
     size_t mPingSize;
 
@@ -79,6 +88,9 @@ class SSTBenchmark : public Benchmark {
     String mStreamOptions;
     String mListenOptions;
 
+    std::vector<String> mFramings; // Framings to test, in order
+    uint32 mFramingIndex; // Framing currently being tested
+
     String mStreamPlugin;
     String mPort;
     String mHost;
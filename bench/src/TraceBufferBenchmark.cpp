@@ -0,0 +1,132 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "TraceBufferBenchmark.hpp"
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/trace/BatchedBuffer.hpp>
+#include <sirikata/core/trace/PerThreadBatchedBuffer.hpp>
+
+#define RECORDS_PER_THREAD 500000
+#define MAX_THREADS 16
+
+namespace Sirikata {
+
+namespace {
+// BatchedBuffer doesn't drop, so it has no counter
+uint64 droppedRecords(BatchedBuffer* buf) { return 0; }
+uint64 droppedRecords(PerThreadBatchedBuffer* buf) { return buf->dropped(); }
+}
+
+TraceBufferBenchmark::TraceBufferBenchmark(const FinishedCallback& finished_cb)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mWritersDone(false)
+{
+}
+
+String TraceBufferBenchmark::name() {
+    return "trace-buffer";
+}
+
+template<typename Buffer>
+void TraceBufferBenchmark::writerThread(Buffer* buf, uint32 nrecords) {
+    // Mimic Trace::timestampMessage, including the framing added by
+    // Trace::writeRecord
+    uint32 total_size = sizeof(Time) + sizeof(uint64) + sizeof(uint32);
+    uint16 type_hint = 30;
+    Time t = Timer::now();
+    uint32 path = 0;
+
+    for(uint64 uid = 0; uid < nrecords && !mForceStop; uid++) {
+        BatchedBuffer::IOVec data_vec[5] = {
+            BatchedBuffer::IOVec(&total_size, sizeof(total_size)),
+            BatchedBuffer::IOVec(&type_hint, sizeof(type_hint)),
+            BatchedBuffer::IOVec(&t, sizeof(t)),
+            BatchedBuffer::IOVec(&uid, sizeof(uid)),
+            BatchedBuffer::IOVec(&path, sizeof(path))
+        };
+        buf->write(data_vec, 5);
+    }
+}
+
+template<typename Buffer>
+void TraceBufferBenchmark::storageThread(Buffer* buf, FILE* of) {
+    while(!mWritersDone.read()) {
+        buf->store(of);
+        Timer::sleep(Duration::milliseconds(1));
+    }
+    buf->flush();
+    buf->store(of);
+}
+
+template<typename Buffer>
+float64 TraceBufferBenchmark::run(Buffer* buf, uint32 nthreads, uint64* dropped_out) {
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+    FILE* of = fopen("NUL", "wb");
+#else
+    FILE* of = fopen("/dev/null", "wb");
+#endif
+    mWritersDone = false;
+
+    Thread* storage = new Thread("TraceBuffer Storage", std::tr1::bind(&TraceBufferBenchmark::storageThread<Buffer>, this, buf, of));
+
+    Time start_time = Timer::now();
+    std::vector<Thread*> writers;
+    for(uint32 i = 0; i < nthreads; i++)
+        writers.push_back(new Thread("TraceBuffer Writer", std::tr1::bind(&TraceBufferBenchmark::writerThread<Buffer>, this, buf, (uint32)RECORDS_PER_THREAD)));
+    for(uint32 i = 0; i < nthreads; i++) {
+        writers[i]->join();
+        delete writers[i];
+    }
+    Time end_time = Timer::now();
+
+    mWritersDone = true;
+    storage->join();
+    delete storage;
+    fclose(of);
+
+    *dropped_out = droppedRecords(buf);
+    return (end_time - start_time).toSeconds();
+}
+
+void TraceBufferBenchmark::report(const String& buffer_name, uint32 nthreads, float64 seconds, uint64 dropped) {
+    // Dropped records return almost immediately, so counting them towards the
+    // write rate would make a buffer look faster the more it drops
+    uint64 total = (uint64)nthreads * RECORDS_PER_THREAD;
+    uint64 delivered = total - dropped;
+    SILOG(benchmark,info,
+        buffer_name << ", " << nthreads << " threads: "
+        << (delivered / seconds) << " records/s delivered, "
+        << (dropped / seconds) << " records/s dropped ("
+        << (100.0 * dropped / (float64)total) << "%)");
+}
+
+void TraceBufferBenchmark::start() {
+    mForceStop = false;
+
+    for(uint32 nthreads = 1; nthreads <= MAX_THREADS && !mForceStop; nthreads *= 2) {
+        uint64 dropped = 0;
+
+        BatchedBuffer* locked = new BatchedBuffer();
+        float64 locked_seconds = run(locked, nthreads, &dropped);
+        delete locked;
+        if (mForceStop) return;
+        report("locked", nthreads, locked_seconds, dropped);
+
+        PerThreadBatchedBuffer* per_thread = new PerThreadBatchedBuffer();
+        float64 per_thread_seconds = run(per_thread, nthreads, &dropped);
+        delete per_thread;
+        if (mForceStop) return;
+        report("per-thread", nthreads, per_thread_seconds, dropped);
+    }
+
+    notifyFinished();
+}
+
+void TraceBufferBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,53 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_TRACE_BUFFER_BENCHMARK_HPP_
+#define _SIRIKATA_TRACE_BUFFER_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/AtomicTypes.hpp>
+
+namespace Sirikata {
+
+/** TraceBufferBenchmark compares the throughput (records/s) of the shared,
+ *  locked BatchedBuffer with the PerThreadBatchedBuffer as the number of
+ *  threads writing trace records grows from 1 to 16. A separate thread drains
+ *  the buffer to /dev/null, as Trace's storage thread does.
+ */
+class TraceBufferBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new TraceBufferBenchmark(finished_cb);
+    }
+
+    TraceBufferBenchmark(const FinishedCallback& finished_cb);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Runs the benchmark for one buffer type and thread count, returns the
+    // seconds the writers took. Buffer is BatchedBuffer or
+    // PerThreadBatchedBuffer.
+    template<typename Buffer>
+    float64 run(Buffer* buf, uint32 nthreads, uint64* dropped_out);
+    // Logs the rates of records that made it into the buffer and of those
+    // that were dropped
+    void report(const String& buffer_name, uint32 nthreads, float64 seconds, uint64 dropped);
+    template<typename Buffer>
+    void writerThread(Buffer* buf, uint32 nrecords);
+    template<typename Buffer>
+    void storageThread(Buffer* buf, FILE* of);
+
+    bool mForceStop;
+    AtomicValue<bool> mWritersDone;
+}; // class TraceBufferBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_TRACE_BUFFER_BENCHMARK_HPP_
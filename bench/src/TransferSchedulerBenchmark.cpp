@@ -0,0 +1,219 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "TransferSchedulerBenchmark.hpp"
+#include <sirikata/core/transfer/MaxPriorityAggregation.hpp>
+#include <sirikata/core/options/Options.hpp>
+
+namespace Sirikata {
+
+using namespace Sirikata::Transfer;
+
+namespace {
+
+uint32 xorshift(uint32* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+float32 randomPriority(uint32* state, float32 low, float32 high) {
+    return low + (high - low) * (xorshift(state) % 10000) / 10000.f;
+}
+
+// Download from the simulated CDN. The simulation does the work, so executing
+// it doesn't do anything.
+class SimulatedRequest : public TransferRequest {
+public:
+    SimulatedRequest(const String& id, Priority priority, uint64 size)
+     : mID(id), mSize(size)
+    {
+        mPriority = priority;
+        mDeletionRequest = false;
+        mClientID = "benchmark";
+    }
+
+    virtual const std::string& getIdentifier() const { return mID; }
+    virtual String getSource() const { return "http://cdn"; }
+    virtual uint64 getTransferSize() const { return mSize; }
+    virtual void execute(TransferRequestPtr req, ExecuteFinished cb) {}
+    virtual void notifyCaller(TransferRequestPtr me, TransferRequestPtr from) {}
+
+private:
+    String mID;
+    uint64 mSize;
+};
+
+struct Download {
+    TransferScheduler::AggregateRequestPtr agg;
+    Time started;
+    double remaining;
+    bool visible;
+};
+
+} // namespace
+
+TransferSchedulerBenchmark::TransferSchedulerBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* textures;
+    OptionValue* texture_size;
+    OptionValue* meshes;
+    OptionValue* mesh_size;
+    OptionValue* mesh_arrival;
+    OptionValue* mesh_deadline;
+    OptionValue* rtt;
+    OptionValue* link_bandwidth;
+    OptionValue* outstanding;
+    OptionValue* reserved;
+    OptionValue* source_bandwidth;
+    OptionValue* compare;
+    Sirikata::InitializeClassOptions ico("TransferSchedulerBenchmark",this,
+        textures=new OptionValue("textures","400",Sirikata::OptionValueType<uint32>(),"Number of low priority textures queued before the meshes"),
+        texture_size=new OptionValue("texture-size","262144",Sirikata::OptionValueType<uint32>(),"Size of each texture in bytes"),
+        meshes=new OptionValue("meshes","20",Sirikata::OptionValueType<uint32>(),"Number of visible meshes"),
+        mesh_size=new OptionValue("mesh-size","65536",Sirikata::OptionValueType<uint32>(),"Size of each mesh in bytes"),
+        mesh_arrival=new OptionValue("mesh-arrival","20ms",Sirikata::OptionValueType<Duration>(),"When the meshes are requested, after the textures"),
+        mesh_deadline=new OptionValue("mesh-deadline","200ms",Sirikata::OptionValueType<Duration>(),"Deadline for the meshes, after they're requested"),
+        rtt=new OptionValue("rtt","50ms",Sirikata::OptionValueType<Duration>(),"Round trip time to the CDN"),
+        link_bandwidth=new OptionValue("link-bandwidth","8388608",Sirikata::OptionValueType<uint32>(),"Bytes per second of the link to the CDN, shared by all downloads"),
+        outstanding=new OptionValue("outstanding","10",Sirikata::OptionValueType<uint32>(),"Most downloads at once"),
+        reserved=new OptionValue("reserved","3",Sirikata::OptionValueType<uint32>(),"Slots reserved for important downloads"),
+        source_bandwidth=new OptionValue("source-bandwidth","0",Sirikata::OptionValueType<uint32>(),"Bytes per second the scheduler lets the CDN use, or 0 for no limit"),
+        compare=new OptionValue("compare","true",Sirikata::OptionValueType<bool>(),"Also run with plain priority ordering, without reserved slots or deadlines"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("TransferSchedulerBenchmark",this);
+    optionsSet->parse(param);
+
+    mTextures = textures->as<uint32>();
+    mTextureSize = std::max(texture_size->as<uint32>(), (uint32)1);
+    mMeshes = meshes->as<uint32>();
+    mMeshSize = std::max(mesh_size->as<uint32>(), (uint32)1);
+    mMeshArrival = mesh_arrival->as<Duration>();
+    mMeshDeadline = mesh_deadline->as<Duration>();
+    mRTT = rtt->as<Duration>();
+    mLinkBandwidth = std::max(link_bandwidth->as<uint32>(), (uint32)1);
+    mCompare = compare->as<bool>();
+
+    mParams.maxOutstanding = std::max(outstanding->as<uint32>(), (uint32)1);
+    mParams.reservedSlots = reserved->as<uint32>();
+    mParams.sourceBandwidth = source_bandwidth->as<uint32>();
+}
+
+String TransferSchedulerBenchmark::name() {
+    return "transfer-scheduler";
+}
+
+bool TransferSchedulerBenchmark::run(const String& label, const TransferScheduler::Params& params, bool deadlines) {
+    static const Duration STEP = Duration::milliseconds((int64)1);
+
+    TransferScheduler sched(params, new MaxPriorityAggregation());
+    uint32 rand = 12345;
+
+    const Time begin = Time::microseconds((int64)1000000000);
+    for(uint32 i = 0; i < mTextures; i++) {
+        sched.update(TransferRequestPtr(new SimulatedRequest(
+            "texture" + boost::lexical_cast<String>(i),
+            randomPriority(&rand, 0.05f, 0.3f), mTextureSize
+        )));
+    }
+
+    bool meshesRequested = (mMeshes == 0);
+    Time firstMesh = Time::null(), allMeshes = Time::null();
+    uint32 meshesDone = 0;
+    std::vector<Download> downloads;
+    Time now = begin;
+    while(!mForceStop) {
+        if (!meshesRequested && now >= begin + mMeshArrival) {
+            for(uint32 i = 0; i < mMeshes; i++) {
+                TransferRequestPtr req(new SimulatedRequest(
+                    "mesh" + boost::lexical_cast<String>(i),
+                    randomPriority(&rand, 0.8f, 1.f), mMeshSize
+                ));
+                if (deadlines)
+                    req->setDeadline(now + mMeshDeadline);
+                sched.update(req);
+            }
+            meshesRequested = true;
+        }
+        if (meshesRequested && sched.numRequests() == 0)
+            break;
+
+        TransferScheduler::AggregateRequestList started;
+        sched.schedule(now, started);
+        for(uint32 i = 0; i < started.size(); i++) {
+            Download dl;
+            dl.agg = started[i];
+            dl.started = now;
+            dl.remaining = (double)started[i]->getSingleRequest()->getTransferSize();
+            dl.visible = (started[i]->getIdentifier().compare(0, 4, "mesh") == 0);
+            downloads.push_back(dl);
+        }
+
+        // Downloads which are past the round trip share the link evenly
+        uint32 transferring = 0;
+        for(uint32 i = 0; i < downloads.size(); i++)
+            if (now >= downloads[i].started + mRTT) transferring++;
+
+        now += STEP;
+        if (transferring == 0)
+            continue;
+        double share = mLinkBandwidth * STEP.toSeconds() / transferring;
+        for(uint32 i = 0; i < downloads.size(); ) {
+            Download& dl = downloads[i];
+            if (now - STEP < dl.started + mRTT) {
+                i++;
+                continue;
+            }
+            dl.remaining -= share;
+            if (dl.remaining > 0) {
+                i++;
+                continue;
+            }
+
+            std::vector<TransferRequestPtr> clients;
+            sched.finished(dl.agg, clients);
+            if (dl.visible) {
+                if (meshesDone == 0) firstMesh = now;
+                if (++meshesDone == mMeshes) allMeshes = now;
+            }
+            downloads[i] = downloads.back();
+            downloads.pop_back();
+        }
+    }
+    if (mForceStop) return false;
+
+    const Time meshesRequestedAt = begin + mMeshArrival;
+    SILOG(benchmark,info,
+        label << ": first visible mesh after " << (firstMesh - meshesRequestedAt) <<
+        ", all " << mMeshes << " visible meshes after " << (allMeshes - meshesRequestedAt) <<
+        ", everything done after " << (now - begin) <<
+        " (" << sched.stats().startedInReservedSlot << " started in reserved slots, " <<
+        sched.stats().startedForDeadline << " for deadlines, " <<
+        sched.stats().throttled << " times throttled)");
+    return true;
+}
+
+void TransferSchedulerBenchmark::start() {
+    mForceStop = false;
+
+    if (!run("scheduled", mParams, true)) return;
+
+    if (mCompare) {
+        TransferScheduler::Params plain = mParams;
+        plain.reservedSlots = 0;
+        if (!run("priority-only", plain, false)) return;
+    }
+
+    notifyFinished();
+}
+
+void TransferSchedulerBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
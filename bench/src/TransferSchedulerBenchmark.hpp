@@ -0,0 +1,59 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_TRANSFER_SCHEDULER_BENCHMARK_HPP_
+#define _SIRIKATA_TRANSFER_SCHEDULER_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/transfer/TransferScheduler.hpp>
+
+namespace Sirikata {
+
+/** TransferSchedulerBenchmark simulates an object host entering a dense area:
+ *  a backlog of low priority texture downloads has already been queued when
+ *  the meshes the user can see are requested. Downloads are driven through a
+ *  TransferScheduler against a simulated CDN, with a fixed round trip time and
+ *  a link shared evenly by the downloads in progress, in simulated time. It
+ *  reports how long it takes for the first and for all of the visible meshes
+ *  to arrive, with the scheduler's reserved slots and deadlines and, for
+ *  comparison, with plain priority ordering.
+ */
+class TransferSchedulerBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new TransferSchedulerBenchmark(finished_cb, _param);
+    }
+
+    TransferSchedulerBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Simulates the workload with the given parameters. Returns false if it
+    // was stopped.
+    bool run(const String& label, const Transfer::TransferScheduler::Params& params, bool deadlines);
+
+    bool mForceStop;
+
+    uint32 mTextures;
+    uint32 mTextureSize;
+    uint32 mMeshes;
+    uint32 mMeshSize;
+    Duration mMeshArrival;
+    Duration mMeshDeadline;
+    Duration mRTT;
+    uint32 mLinkBandwidth;
+    bool mCompare;
+
+    Transfer::TransferScheduler::Params mParams;
+}; // class TransferSchedulerBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_TRANSFER_SCHEDULER_BENCHMARK_HPP_
@@ -36,6 +36,20 @@
 #include "TimerJitterBenchmark.hpp"
 #include "TimerMonotonicityBenchmark.hpp"
 #include "TCPSSTBenchmark.hpp"
+#include "TraceBufferBenchmark.hpp"
+#include "SSTThroughputBenchmark.hpp"
+#include "OSegCacheReplayBenchmark.hpp"
+#include "LocUpdateFanoutBenchmark.hpp"
+#include "FairQueueBenchmark.hpp"
+#include "ForwarderPipelineBenchmark.hpp"
+#include "CSegLookupBenchmark.hpp"
+#include "MeshSimplifyBenchmark.hpp"
+#include "MeshRaytraceBenchmark.hpp"
+#include "AggregateGraphBenchmark.hpp"
+#include "OSegLookupReplayBenchmark.hpp"
+#include "PackedDiskCacheBenchmark.hpp"
+#include "TransferSchedulerBenchmark.hpp"
+#include "EventLoopStatsBenchmark.hpp"
 
 #include <sirikata/core/util/DynamicLibrary.hpp>
 
@@ -67,6 +81,20 @@ int main(int argc, char** argv) {
     ADD_BENCHMARK(timer-monotonicity, TimerMonotonicityBenchmark::create);
 
     ADD_BENCHMARK(ping, SSTBenchmark::create);
+    ADD_BENCHMARK(trace-buffer, TraceBufferBenchmark::create);
+    ADD_BENCHMARK(sst-throughput, SSTThroughputBenchmark::create);
+    ADD_BENCHMARK(oseg-cache-replay, OSegCacheReplayBenchmark::create);
+    ADD_BENCHMARK(loc-update-fanout, LocUpdateFanoutBenchmark::create);
+    ADD_BENCHMARK(fair-queue, FairQueueBenchmark::create);
+    ADD_BENCHMARK(forwarder-pipeline, ForwarderPipelineBenchmark::create);
+    ADD_BENCHMARK(cseg-lookup, CSegLookupBenchmark::create);
+    ADD_BENCHMARK(mesh-simplify, MeshSimplifyBenchmark::create);
+    ADD_BENCHMARK(mesh-raytrace, MeshRaytraceBenchmark::create);
+    ADD_BENCHMARK(aggregate-graph, AggregateGraphBenchmark::create);
+    ADD_BENCHMARK(oseg-lookup-replay, OSegLookupReplayBenchmark::create);
+    ADD_BENCHMARK(packed-disk-cache, PackedDiskCacheBenchmark::create);
+    ADD_BENCHMARK(transfer-scheduler, TransferSchedulerBenchmark::create);
+    ADD_BENCHMARK(event-loop-stats, EventLoopStatsBenchmark::create);
     BenchmarkRunner runner(factory, Duration::seconds(30.f));
 
 
@@ -224,6 +224,7 @@ DistributedCoordinateSegmentation::DistributedCoordinateSegmentation(CSegContext
 
   int numLLTreesSoFar = 0;
   generateHierarchicalTrees(&mTopLevelRegion, 1, numLLTreesSoFar);
+  rebuildSnapshots();
 
   /* Upper tree servers: start listening for requests! */
   if ((int)ctx->id() <= mUpperTreeCSEGServers) {
@@ -262,7 +263,7 @@ bool DistributedCoordinateSegmentation::handleLookupBBox(const BoundingBox3f& bb
   std::vector<ServerID> serverList;
 
   std::vector<SegmentedRegion*> segmentedRegionsList;
-  mTopLevelRegion.lookupBoundingBox(bbox, segmentedRegionsList);
+  mTopLevelSnapshot.lookupBoundingBox(bbox, segmentedRegionsList);
 
   std::map<ServerID, std::vector<SegmentedRegion*> > otherCSEGServers;
 
@@ -276,18 +277,18 @@ bool DistributedCoordinateSegmentation::handleLookupBBox(const BoundingBox3f& bb
 
       String bbox_hash = sha1_bbox(segRegion->mBoundingBox);
 
-      std::map<String, SegmentedRegion*>::iterator it=  mHigherLevelTrees.find(bbox_hash);
+      std::map<String, SegmentedRegionSnapshot>::iterator it=  mHigherLevelSnapshots.find(bbox_hash);
 
       std::vector<SegmentedRegion*> regionList;
 
-      if (it != mHigherLevelTrees.end()) {
-        (*it).second->lookupBoundingBox(bbox, regionList);
+      if (it != mHigherLevelSnapshots.end()) {
+        (*it).second.lookupBoundingBox(bbox, regionList);
       }
       else {
-        it =  mLowerLevelTrees.find(bbox_hash);
+        it =  mLowerLevelSnapshots.find(bbox_hash);
 
-        if (it != mLowerLevelTrees.end()) {
-          (*it).second->lookupBoundingBox(bbox, regionList);
+        if (it != mLowerLevelSnapshots.end()) {
+          (*it).second.lookupBoundingBox(bbox, regionList);
         }
       }
 
@@ -391,7 +392,7 @@ bool DistributedCoordinateSegmentation::handleLookup(Vector3f pos, boost::shared
   (searchVec.x < region.min().x) ? searchVec.x = region.min().x : (i=0);
   (searchVec.y < region.min().y) ? searchVec.y = region.min().y : (i=0);
 
-  const SegmentedRegion* segRegion = mTopLevelRegion.lookup(searchVec);
+  const SegmentedRegion* segRegion = mTopLevelSnapshot.lookup(searchVec);
   ServerID topLevelIdx = segRegion->mServer;
 
   //std::cout << "Returned remote CSEG: " << topLevelIdx << " for vector " << pos <<"\n";
@@ -400,10 +401,10 @@ bool DistributedCoordinateSegmentation::handleLookup(Vector3f pos, boost::shared
   {
     String bbox_hash = sha1_bbox(segRegion->mBoundingBox);
 
-    std::map<String, SegmentedRegion*>::iterator it=  mHigherLevelTrees.find(bbox_hash);
+    std::map<String, SegmentedRegionSnapshot>::iterator it=  mHigherLevelSnapshots.find(bbox_hash);
 
-    if (it != mHigherLevelTrees.end()) {
-      segRegion = (*it).second->lookup(searchVec);
+    if (it != mHigherLevelSnapshots.end()) {
+      segRegion = (*it).second.lookup(searchVec);
 
       //printf("local lookup returned %d\n", segRegion->mServer);
 
@@ -412,10 +413,10 @@ bool DistributedCoordinateSegmentation::handleLookup(Vector3f pos, boost::shared
       server_bbox = segRegion->mBoundingBox;
     }
     else {
-      it =  mLowerLevelTrees.find(bbox_hash);
+      it =  mLowerLevelSnapshots.find(bbox_hash);
 
-      if (it != mLowerLevelTrees.end()) {
-        segRegion = (*it).second->lookup(searchVec);
+      if (it != mLowerLevelSnapshots.end()) {
+        segRegion = (*it).second.lookup(searchVec);
 
         //printf("local lookup returned %d\n", segRegion->mServer);
 
@@ -452,16 +453,16 @@ void DistributedCoordinateSegmentation::getServerRegionUncached(const ServerID&
 
   BoundingBoxList boundingBoxList;
 
-  for(std::map<String, SegmentedRegion*>::const_iterator it = mHigherLevelTrees.begin();
-      it != mHigherLevelTrees.end(); ++it)
+  for(std::map<String, SegmentedRegionSnapshot>::const_iterator it = mHigherLevelSnapshots.begin();
+      it != mHigherLevelSnapshots.end(); ++it)
   {
-      it->second->serverRegion(server, boundingBoxList);
+      it->second.serverRegion(server, boundingBoxList);
   }
 
-  for(std::map<String, SegmentedRegion*>::const_iterator it = mLowerLevelTrees.begin();
-      it != mLowerLevelTrees.end(); ++it)
+  for(std::map<String, SegmentedRegionSnapshot>::const_iterator it = mLowerLevelSnapshots.begin();
+      it != mLowerLevelSnapshots.end(); ++it)
   {
-      it->second->serverRegion(server, boundingBoxList);
+      it->second.serverRegion(server, boundingBoxList);
   }
 
   callLowerLevelCSEGServersForServerRegions(socket, server, boundingBoxList);
@@ -499,18 +500,18 @@ void DistributedCoordinateSegmentation::handleLoadReport(boost::shared_ptr<tcp::
   Vector3f searchVec = Vector3f( (bbox.min().x+bbox.max().x)/2.0, (bbox.min().y+bbox.max().y)/2,
                                  (bbox.min().z+bbox.max().z)/2.0 );
 
-  SegmentedRegion* segRegion = mTopLevelRegion.lookup(searchVec);
+  SegmentedRegion* segRegion = mTopLevelSnapshot.lookup(searchVec);
   ServerID topLevelIdx = segRegion->mServer;
 
   if (topLevelIdx == mContext->id())
   {
     String bbox_hash = sha1_bbox(segRegion->mBoundingBox);
 
-    std::map<String, SegmentedRegion*>::iterator it=  mHigherLevelTrees.find(bbox_hash);
+    std::map<String, SegmentedRegionSnapshot>::iterator it=  mHigherLevelSnapshots.find(bbox_hash);
 
-    if (it != mHigherLevelTrees.end()) {
+    if (it != mHigherLevelSnapshots.end()) {
 
-      segRegion = (*it).second->lookup(searchVec);
+      segRegion = (*it).second.lookup(searchVec);
 
       // deal with the value for this region's load;
       if (sid == segRegion->mServer && bbox == segRegion->mBoundingBox) {
@@ -520,10 +521,10 @@ void DistributedCoordinateSegmentation::handleLoadReport(boost::shared_ptr<tcp::
       }
     }
     else {
-      it =  mLowerLevelTrees.find(bbox_hash);
+      it =  mLowerLevelSnapshots.find(bbox_hash);
 
-      if (it != mLowerLevelTrees.end()) {
-        segRegion = (*it).second->lookup(searchVec);
+      if (it != mLowerLevelSnapshots.end()) {
+        segRegion = (*it).second.lookup(searchVec);
 
         // deal with the value for this region's load.
         if (sid == segRegion->mServer && bbox == segRegion->mBoundingBox) {
@@ -600,7 +601,26 @@ void DistributedCoordinateSegmentation::poll() {
 void DistributedCoordinateSegmentation::service() {
   boost::unique_lock<boost::shared_mutex> lock(mCSEGReadWriteMutex);
 
-  mLoadBalancer.service();
+  if (mLoadBalancer.service())
+    rebuildSnapshots();
+}
+
+void DistributedCoordinateSegmentation::rebuildSnapshots() {
+  mTopLevelSnapshot.build(&mTopLevelRegion);
+
+  mHigherLevelSnapshots.clear();
+  for (std::map<String, SegmentedRegion*>::iterator it = mHigherLevelTrees.begin();
+       it != mHigherLevelTrees.end(); it++)
+  {
+    mHigherLevelSnapshots[it->first].build(it->second);
+  }
+
+  mLowerLevelSnapshots.clear();
+  for (std::map<String, SegmentedRegion*>::iterator it = mLowerLevelTrees.begin();
+       it != mLowerLevelTrees.end(); it++)
+  {
+    mLowerLevelSnapshots[it->first].build(it->second);
+  }
 }
 
 void DistributedCoordinateSegmentation::notifySpaceServersOfChange(const std::vector<SegmentationInfo> segInfoVector)
@@ -794,12 +814,12 @@ void DistributedCoordinateSegmentation::asyncLLRead(boost::shared_ptr<tcp::socke
     Vector3f vect = csegMessage.ll_lookup_request_message().lookup_vector();
 
     String bbox_hash = sha1_bbox(bbox);
-    std::map<String, SegmentedRegion*>::iterator it=  mLowerLevelTrees.find(bbox_hash);
+    std::map<String, SegmentedRegionSnapshot>::iterator it=  mLowerLevelSnapshots.find(bbox_hash);
 
     ServerID retval = 0;
     BoundingBox3f leaf_bbox;
-    if (it != mLowerLevelTrees.end()) {
-      const SegmentedRegion*segRegion = (*it).second->lookup(vect);
+    if (it != mLowerLevelSnapshots.end()) {
+      const SegmentedRegion*segRegion = (*it).second.lookup(vect);
 
       retval = segRegion->mServer;
       leaf_bbox = segRegion->mBoundingBox;
@@ -818,10 +838,10 @@ void DistributedCoordinateSegmentation::asyncLLRead(boost::shared_ptr<tcp::socke
       boundingBoxList = mLowerTreeServerRegionMap[serverID];
     }
     else {
-      for(std::map<String, SegmentedRegion*>::const_iterator it = mLowerLevelTrees.begin();
-          it != mLowerLevelTrees.end(); ++it)
+      for(std::map<String, SegmentedRegionSnapshot>::const_iterator it = mLowerLevelSnapshots.begin();
+          it != mLowerLevelSnapshots.end(); ++it)
     	{
-          it->second->serverRegion(serverID, boundingBoxList);
+          it->second.serverRegion(serverID, boundingBoxList);
         }
     }
 
@@ -848,14 +868,14 @@ void DistributedCoordinateSegmentation::asyncLLRead(boost::shared_ptr<tcp::socke
     std::cout << "LL Load report\n";
     BoundingBox3f lowerTreeRootBox = csegMessage.ll_load_report_message().lower_root_box();
     String bbox_hash = sha1_bbox(lowerTreeRootBox);
-    std::map<String, SegmentedRegion*>::iterator it=  mLowerLevelTrees.find(bbox_hash);
+    std::map<String, SegmentedRegionSnapshot>::iterator it=  mLowerLevelSnapshots.find(bbox_hash);
 
     BoundingBox3f leafBBox = csegMessage.ll_load_report_message().load_report_message().bbox();
     Vector3f vect( (leafBBox.min().x+leafBBox.max().x)/2.0, (leafBBox.min().y+leafBBox.max().y)/2,
                    (leafBBox.min().z+leafBBox.max().z)/2.0 );
 
-    if (it != mLowerLevelTrees.end()) {
-      SegmentedRegion* segRegion = (*it).second->lookup(vect);
+    if (it != mLowerLevelSnapshots.end()) {
+      SegmentedRegion* segRegion = (*it).second.lookup(vect);
 
       if (segRegion->mServer == csegMessage.ll_load_report_message().load_report_message().server()
           && segRegion->mBoundingBox == leafBBox)
@@ -884,10 +904,10 @@ void DistributedCoordinateSegmentation::asyncLLRead(boost::shared_ptr<tcp::socke
       String bbox_hash = sha1_bbox(candidateBbox);
 
       //do the lookups
-      std::map<String, SegmentedRegion*>::iterator it=  mLowerLevelTrees.find(bbox_hash);
-      if (it != mLowerLevelTrees.end()) {
+      std::map<String, SegmentedRegionSnapshot>::iterator it=  mLowerLevelSnapshots.find(bbox_hash);
+      if (it != mLowerLevelSnapshots.end()) {
         std::vector<SegmentedRegion*> vect;
-        (*it).second->lookupBoundingBox(bbox, vect);
+        (*it).second.lookupBoundingBox(bbox, vect);
 
         for (uint32 j = 0; j < vect.size(); j++) {
           serverList.push_back(vect[j]->mServer);
@@ -139,6 +139,13 @@ private:
     std::map<String, SegmentedRegion*> mHigherLevelTrees;
     std::map<String, SegmentedRegion*> mLowerLevelTrees;
 
+    /* Flattened copies of the trees above, used to answer lookups. Rebuilt by
+       rebuildSnapshots() whenever the trees change, under mCSEGReadWriteMutex. */
+    SegmentedRegionSnapshot mTopLevelSnapshot;
+    std::map<String, SegmentedRegionSnapshot> mHigherLevelSnapshots;
+    std::map<String, SegmentedRegionSnapshot> mLowerLevelSnapshots;
+    void rebuildSnapshots();
+
     int mAvailableCSEGServers;
     int mUpperTreeCSEGServers;
 
@@ -120,7 +120,7 @@ void LoadBalancer::handleSegmentationChange(Sirikata::Protocol::CSeg::ChangeMess
   }
 }
 
-void LoadBalancer::service() {
+bool LoadBalancer::service() {
   boost::mutex::scoped_lock overloadedRegionsListLock(mOverloadedRegionsListMutex);
   boost::mutex::scoped_lock underloadedRegionsListLock(mUnderloadedRegionsListMutex);
 
@@ -202,7 +202,7 @@ void LoadBalancer::service() {
 
       mOverloadedRegionsList.erase(it);
 
-      return; //enough work for this iteration. No further splitting or merging.
+      return true; //enough work for this iteration. No further splitting or merging.
     }
     else {
       //No idle servers are available at this time...
@@ -293,8 +293,10 @@ void LoadBalancer::service() {
     parent->mRightChild = NULL;
 
 
-    break;
+    return true;
   }
+
+  return false;
 }
 
 uint32 LoadBalancer::numAvailableServers() {
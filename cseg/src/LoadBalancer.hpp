@@ -61,7 +61,8 @@ public:
   void reportRegionLoad(SegmentedRegion* region, ServerID sid, uint32 loadValue);
   void handleSegmentationChange(Sirikata::Protocol::CSeg::ChangeMessage segChangeMessage);
 
-  void service();
+  /* Split and merge regions as needed. Returns true if the segmentation changed. */
+  bool service();
 
   uint32 numAvailableServers() ;
 
@@ -0,0 +1,155 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_NETWORK_EVENT_LOOP_STATS_HPP_
+#define _SIRIKATA_CORE_NETWORK_EVENT_LOOP_STATS_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/network/IODefs.hpp>
+#include <sirikata/core/util/Noncopyable.hpp>
+#include <sirikata/core/trace/LatencyHistogram.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+namespace Network {
+
+/** EventLoopStats keeps statistics about the handlers run by an IOService or
+ *  IOStrand, per tag: how many are queued, how long they waited to run and how
+ *  long they took to run. Unlike SIRIKATA_TRACK_EVENT_QUEUES it's cheap enough
+ *  to leave on in production: tags are interned to small ids, cached per
+ *  thread, and each thread records into its own counters and
+ *  LatencyHistograms, so recording a handler takes no locks. The per-thread
+ *  data is only combined when stats are requested.
+ *
+ *  Since the per-thread data is read while other threads are writing to it,
+ *  the results are approximate.
+ *
+ *  Tracking is turned on for all IOServices and IOStrands with setEnabled(),
+ *  which the Context does if the ioservice.stats option is set.
+ */
+class SIRIKATA_EXPORT EventLoopStats :
+        public Noncopyable,
+        public std::tr1::enable_shared_from_this<EventLoopStats>
+{
+public:
+    enum {
+        // Tags beyond this many are all counted as "(other)"
+        MAX_TAGS = 256,
+        // Threads beyond this many share a set of counters protected by a
+        // lock
+        MAX_THREADS = 64
+    };
+
+    struct TagStats {
+        TagStats() : queued(0), handled(0) {}
+
+        String tag;
+        // Waiting to run
+        uint64 queued;
+        // Finished running
+        uint64 handled;
+        // How long handlers waited to run or, for timers, how late they ran
+        Trace::LatencyHistogram wait;
+        // How long handlers took to run
+        Trace::LatencyHistogram run;
+    };
+    typedef std::vector<TagStats> TagStatsList;
+
+    /** A handler wrapped so it's recorded when it runs. Not an IOCallback, so
+     *  it can be posted without another allocation for the std::function.
+     */
+    class TrackedHandler {
+    public:
+        void operator()() {
+            mStats->handle(mTag, mStart, mDelay, mHandler);
+        }
+    private:
+        friend class EventLoopStats;
+        TrackedHandler(const std::tr1::shared_ptr<EventLoopStats>& stats, uint32 tag, uint64 start, uint64 delay, const IOCallback& handler)
+         : mStats(stats), mTag(tag), mStart(start), mDelay(delay), mHandler(handler) {}
+
+        std::tr1::shared_ptr<EventLoopStats> mStats;
+        uint32 mTag;
+        uint64 mStart;
+        uint64 mDelay;
+        IOCallback mHandler;
+    };
+
+    static void setEnabled(bool enabled) { sEnabled = enabled; }
+    static bool enabled() { return sEnabled; }
+
+    EventLoopStats();
+    ~EventLoopStats();
+
+    /** Count handler as queued under tag and wrap it so it's recorded when it
+     *  runs. The wrapped handler keeps this alive, so IOStrands can still be
+     *  destroyed with handlers outstanding.
+     */
+    TrackedHandler wrap(const IOCallback& handler, const char* tag);
+    /** Like wrap, for a handler which should run after waitFor. Its wait is
+     *  how much later than that it runs.
+     */
+    TrackedHandler wrapTimer(const Duration& waitFor, const IOCallback& handler, const char* tag);
+
+    /** Get stats for each tag ever used, combined from all threads, with the
+     *  busiest tags first.
+     */
+    void getStats(TagStatsList& stats_out) const;
+    /** Like getStats, but the handled counts and histograms only cover
+     *  handlers since the last call to getRecentStats, e.g. to report
+     *  periodically.
+     */
+    void getRecentStats(TagStatsList& stats_out);
+
+private:
+    struct TagCounters {
+        TagCounters() : enqueued(0), handled(0) {}
+
+        // Counted by the thread enqueuing. The number queued is the total
+        // enqueued on all threads less the total handled.
+        uint64 enqueued;
+        uint64 handled;
+        Trace::LatencyHistogram wait;
+        Trace::LatencyHistogram run;
+    };
+    // Only the owning thread writes to these, allocating them as it uses
+    // new tags.
+    struct ThreadCounters {
+        ThreadCounters();
+        ~ThreadCounters();
+
+        TagCounters* tags[MAX_TAGS];
+    };
+
+    // Counters for tag_id on the thread with the given index. If locked is
+    // set, which happens for threads beyond MAX_THREADS, mOverflowMutex is
+    // held and must be unlocked once they've been updated.
+    TagCounters* counters(uint32 thread_index, uint32 tag_id, bool* locked);
+
+    // Counts a handler for tag as enqueued, returning the tag's id
+    uint32 enqueued(const char* tag);
+    void handle(uint32 tag_id, uint64 start, uint64 delay, const IOCallback& handler);
+
+    // Combines all threads' counters into stats, indexed by tag id
+    void collect(TagStatsList& by_id) const;
+    // Drops unused tags from by_id and sorts it busiest first
+    static void sortStats(TagStatsList& by_id, TagStatsList& stats_out);
+
+    static bool sEnabled;
+
+    ThreadCounters* mThreads[MAX_THREADS];
+    // For threads beyond MAX_THREADS
+    mutable boost::mutex mOverflowMutex;
+    ThreadCounters mOverflow;
+
+    // Totals as of the last getRecentStats, indexed by tag id
+    boost::mutex mRecentMutex;
+    TagStatsList mLastRecent;
+}; // class EventLoopStats
+typedef std::tr1::shared_ptr<EventLoopStats> EventLoopStatsPtr;
+
+} // namespace Network
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_NETWORK_EVENT_LOOP_STATS_HPP_
@@ -40,8 +40,14 @@
 #include <sirikata/core/trace/WindowedStats.hpp>
 #include <sirikata/core/task/Time.hpp>
 #include <sirikata/core/command/Command.hpp>
+#include <sirikata/core/network/EventLoopStats.hpp>
 
 namespace Sirikata {
+
+namespace Trace {
+class TimeSeries;
+}
+
 namespace Network {
 
 /** IOService provides queuing, processing, and dispatch for
@@ -57,9 +63,6 @@ class SIRIKATA_EXPORT IOService : public Noncopyable {
     InternalIOService* mImpl;
     const String mName;
 
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
-    typedef std::tr1::function<void(const boost::system::error_code& e)> IOCallbackWithError;
-
     // Track all strands that have been allocated. This needs to be
     // thread safe.
     typedef boost::mutex Mutex;
@@ -68,6 +71,13 @@ class SIRIKATA_EXPORT IOService : public Noncopyable {
     typedef std::tr1::unordered_set<IOStrand*> StrandSet;
     StrandSet mStrands;
 
+    // Low overhead stats, used if EventLoopStats is enabled and
+    // SIRIKATA_TRACK_EVENT_QUEUES isn't
+    EventLoopStatsPtr mEventLoopStats;
+
+#ifdef SIRIKATA_TRACK_EVENT_QUEUES
+    typedef std::tr1::function<void(const boost::system::error_code& e)> IOCallbackWithError;
+
     AtomicValue<uint32> mTimersEnqueued;
     AtomicValue<uint32> mEnqueued;
 
@@ -99,11 +109,15 @@ class SIRIKATA_EXPORT IOService : public Noncopyable {
 #ifdef SIRIKATA_TRACK_EVENT_QUEUES
     void decrementTimerCount(const boost::system::error_code&e, const Time& start, const Duration& timer_duration, const IOCallbackWithError& cb, const char* tag, const char* tagStat=NULL);
     void decrementCount(const Time& start, const IOCallback& cb, const char* tag, const char* tagStat=NULL);
+#endif
 
     // Invoked by strands when they are being destroyed so we can
     // track which ones are alive.
     void destroyingStrand(IOStrand* child);
-#endif
+
+    // Run handler after waitFor, without tracking it. Used by IOStrands, which
+    // track their own handlers.
+    void postTimer(const Duration& waitFor, const IOCallback& handler);
 
   protected:
 
@@ -219,10 +233,21 @@ public:
 
     static void reportAllStats();
     static void reportAllStatsFile(const char* filename, bool detailed = false);
+#endif
+
+    /** Get the low overhead stats about the handlers run directly by this
+     *  IOService. Handlers run by its IOStrands are counted by the strands.
+     */
+    const EventLoopStats& eventLoopStats() const { return *mEventLoopStats; }
+
+    /** Report the stats about handlers that ran since the last report, for
+     *  this IOService and its IOStrands, to ts. Keys are of the form
+     *  prefix.<service>[.<strand>].<tag>.<stat>.
+     */
+    void reportEventLoopStats(Trace::TimeSeries* ts, const String& prefix);
 
     // Respond to command to report all stats.
     void fillCommandResultWithStats(Command::Result& res);
-#endif
     void commandReportStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
     static void commandReportAllStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
 };
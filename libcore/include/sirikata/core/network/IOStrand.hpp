@@ -38,6 +38,7 @@
 #include <sirikata/core/util/Noncopyable.hpp>
 #include <sirikata/core/trace/WindowedStats.hpp>
 #include <sirikata/core/task/Time.hpp>
+#include <sirikata/core/network/EventLoopStats.hpp>
 #include <boost/thread.hpp>
 
 namespace Sirikata {
@@ -65,6 +66,10 @@ class SIRIKATA_EXPORT IOStrand : public Noncopyable {
     InternalIOStrand* mImpl;
     const String mName;
 
+    // Low overhead stats, used if EventLoopStats is enabled and
+    // SIRIKATA_TRACK_EVENT_QUEUES isn't
+    EventLoopStatsPtr mEventLoopStats;
+
 #ifdef SIRIKATA_TRACK_EVENT_QUEUES
     // Track all strands that have been allocated. This needs to be
     // thread safe.
@@ -156,6 +161,8 @@ class SIRIKATA_EXPORT IOStrand : public Noncopyable {
     template<typename CallbackType>
     WrappedHandler<CallbackType> wrap(const CallbackType& handler);
 
+    /** Get the low overhead stats about the handlers run on this strand. */
+    const EventLoopStats& eventLoopStats() const { return *mEventLoopStats; }
 
 
 #ifdef SIRIKATA_TRACK_EVENT_QUEUES
@@ -72,12 +72,18 @@ bool parsePBJMessage(PBJMessageType* contents, const WireType& wire, uint32 offs
 #define MESSAGE_ID_SERVER_SHIFT 52
 #define MESSAGE_ID_SERVER_BITS 0xFFF0000000000000LL
 
-namespace {
+/** Get the next message ID, without the server bits, for the calling
+ *  thread. IDs are unique across the process: each thread claims a block of
+ *  IDs at a time from a shared counter, so the only shared atomic operation is
+ *  once per block rather than once per message. IDs from a single thread are
+ *  increasing, but IDs from different threads are interleaved arbitrarily.
+ */
+SIRIKATA_FUNCTION_EXPORT uint64 GenerateUniqueMessageIDSource();
 
-uint64 sIDSource = 0;
+namespace {
 
 uint64 GenerateUniqueID(const ServerID& origin) {
-    uint64 id_src = sIDSource++;
+    uint64 id_src = GenerateUniqueMessageIDSource();
     uint64 message_id_server_bits=MESSAGE_ID_SERVER_BITS;
     uint64 server_int = (uint64)origin;
     uint64 server_shifted = server_int << MESSAGE_ID_SERVER_SHIFT;
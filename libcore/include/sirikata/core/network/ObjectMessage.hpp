@@ -58,6 +58,37 @@ typedef uint32 ObjectMessagePort;
 #define MESSAGE_ID_SERVER_SHIFT 52
 #define MESSAGE_ID_SERVER_BITS 0xFFF0000000000000LL
 
+/** ObjectMessages are allocated and freed for every message that passes through
+ *  a space server. allocateObjectMessage and releaseObjectMessage keep a free
+ *  list of them, with a small cache per thread so the common case doesn't take
+ *  a lock. Messages may be released on a different thread than they were
+ *  allocated on.
+ *
+ *  Messages from allocateObjectMessage aren't cleared: every field must be
+ *  set, as createObjectMessage does, or the message parsed into. Any
+ *  ObjectMessage allocated with new may be released, and releasing is always
+ *  optional -- deleting a pooled message is fine too.
+ */
+SIRIKATA_FUNCTION_EXPORT Sirikata::Protocol::Object::ObjectMessage* allocateObjectMessage();
+SIRIKATA_FUNCTION_EXPORT void releaseObjectMessage(Sirikata::Protocol::Object::ObjectMessage* msg);
+
+struct ObjectMessagePoolStats {
+    ObjectMessagePoolStats()
+     : allocated(0), reused(0), released(0)
+    {}
+
+    // Messages that had to be allocated with new
+    uint64 allocated;
+    // Messages served from the free list instead of being allocated
+    uint64 reused;
+    // Messages returned with releaseObjectMessage
+    uint64 released;
+};
+/** Get totals for the process. Counts for running threads are read without
+ *  synchronization, so they may be slightly behind.
+ */
+SIRIKATA_FUNCTION_EXPORT ObjectMessagePoolStats getObjectMessagePoolStats();
+
 SIRIKATA_FUNCTION_EXPORT Sirikata::Protocol::Object::ObjectMessage* createObjectMessage(ServerID source_server, const SpaceObjectReference& sporef_src, ObjectMessagePort src_port, const UUID& dest, ObjectMessagePort dest_port, const std::string& payload);
 
 SIRIKATA_FUNCTION_EXPORT Sirikata::Protocol::Object::ObjectMessage* createObjectMessage(ServerID source_server, const UUID& src, ObjectMessagePort src_port, const UUID& dest, ObjectMessagePort dest_port, const std::string& payload);
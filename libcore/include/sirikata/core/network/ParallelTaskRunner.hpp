@@ -0,0 +1,78 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_NETWORK_PARALLEL_TASK_RUNNER_HPP_
+#define _SIRIKATA_CORE_NETWORK_PARALLEL_TASK_RUNNER_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/network/IOServicePool.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+namespace Network {
+
+/** ParallelTaskRunner runs a batch of independent tasks across an
+ *  IOServicePool and the calling thread, and returns once all of them have
+ *  finished. The calling thread takes the last task itself instead of just
+ *  waiting, so a pool of N-1 threads gives N-way parallelism.
+ *
+ *  Only one batch may run at a time.
+ */
+class ParallelTaskRunner : Noncopyable {
+public:
+    typedef std::tr1::function<void()> Task;
+    typedef std::vector<Task> TaskList;
+
+    /** \param pool threads to run tasks on, or NULL to run them all on the
+     *         calling thread. The pool must be running while run() is called.
+     */
+    ParallelTaskRunner(IOServicePool* pool)
+     : mPool(pool),
+       mRemaining(0)
+    {}
+
+    void run(const TaskList& tasks) {
+        if (mPool == NULL || tasks.size() < 2) {
+            for(TaskList::const_iterator it = tasks.begin(); it != tasks.end(); it++)
+                (*it)();
+            return;
+        }
+
+        mRemaining = tasks.size();
+        for(uint32 i = 0; i + 1 < tasks.size(); i++) {
+            mPool->service()->post(
+                std::tr1::bind(&ParallelTaskRunner::runTask, this, tasks[i]),
+                "ParallelTaskRunner::runTask"
+            );
+        }
+        runTask(tasks.back());
+
+        boost::unique_lock<boost::mutex> lck(mMutex);
+        while(mRemaining > 0)
+            mDone.wait(lck);
+    }
+
+private:
+    void runTask(const Task& task) {
+        task();
+
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mRemaining--;
+        if (mRemaining == 0)
+            mDone.notify_one();
+    }
+
+    IOServicePool* mPool;
+    boost::mutex mMutex;
+    boost::condition_variable mDone;
+    uint32 mRemaining;
+};
+
+} // namespace Network
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_NETWORK_PARALLEL_TASK_RUNNER_HPP_
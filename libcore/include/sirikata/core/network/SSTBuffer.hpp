@@ -0,0 +1,215 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_NETWORK_SST_BUFFER_HPP_
+#define _SIRIKATA_CORE_NETWORK_SST_BUFFER_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <sirikata/core/util/Singleton.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+namespace SST {
+
+/** A reference counted block of memory which SST payloads are copied into
+ *  once. Many BufferSlices can refer to different parts of the same slab;
+ *  when the last one goes away the slab is returned to the BufferPool.
+ */
+struct BufferSlab {
+    BufferSlab(uint32 cap)
+     : data(new uint8[cap]),
+       capacity(cap),
+       refcount(0)
+    {}
+    ~BufferSlab() {
+        delete[] data;
+    }
+
+    uint8* data;
+    const uint32 capacity;
+    AtomicValue<uint32> refcount;
+};
+
+/** BufferPool recycles BufferSlabs so that steady state SST traffic doesn't
+ *  hit the allocator. Standard sized slabs are kept on a free list, oversized
+ *  ones (for payloads larger than SlabSize) are freed when released. Also
+ *  tracks some statistics used by benchmarks to compare allocation behavior.
+ */
+class SIRIKATA_EXPORT BufferPool : public AutoSingleton<BufferPool> {
+public:
+    static const uint32 SlabSize = 65536;
+
+    BufferPool();
+    ~BufferPool();
+
+    static BufferPool& getSingleton();
+    static void destroy();
+
+    /** Get a slab with at least min_size bytes, preferably from the free list. */
+    BufferSlab* acquire(uint32 min_size);
+    /** Return a slab with no remaining references. */
+    void release(BufferSlab* slab);
+
+    struct Stats {
+        uint64 slabsAllocated; // Slabs allocated with new
+        uint64 slabsReused; // Slabs satisfied from the free list
+        uint64 bytesCopied; // Bytes copied into slabs
+    };
+    Stats stats();
+    void resetStats();
+
+    // Used by BufferAllocator to account for copies
+    void recordCopy(uint32 nbytes) {
+        mBytesCopied += nbytes;
+    }
+
+private:
+    boost::mutex mMutex;
+    std::vector<BufferSlab*> mFree;
+    // Cap on the free list so a burst doesn't pin memory forever
+    const uint32 mMaxFree;
+
+    uint64 mSlabsAllocated;
+    uint64 mSlabsReused;
+    AtomicValue<uint64> mBytesCopied;
+};
+
+/** A view of a range of bytes in a BufferSlab. BufferSlices are cheap to copy
+ *  (just a reference count increment) and slicing a slice doesn't copy any
+ *  data, so payloads can move from Stream to Connection to the retransmit
+ *  queues without being duplicated. The data is immutable once it has been
+ *  copied in.
+ */
+class BufferSlice {
+public:
+    BufferSlice()
+     : mSlab(NULL),
+       mOffset(0),
+       mLength(0)
+    {}
+
+    BufferSlice(const BufferSlice& rhs)
+     : mSlab(rhs.mSlab),
+       mOffset(rhs.mOffset),
+       mLength(rhs.mLength)
+    {
+        ref();
+    }
+
+    ~BufferSlice() {
+        unref();
+    }
+
+    BufferSlice& operator=(const BufferSlice& rhs) {
+        if (mSlab != rhs.mSlab) {
+            unref();
+            mSlab = rhs.mSlab;
+            ref();
+        }
+        mOffset = rhs.mOffset;
+        mLength = rhs.mLength;
+        return *this;
+    }
+
+    const uint8* data() const {
+        return (mSlab == NULL) ? NULL : mSlab->data + mOffset;
+    }
+    uint32 size() const {
+        return mLength;
+    }
+    bool empty() const {
+        return mLength == 0;
+    }
+
+    /** Get a slice covering a subrange of this slice, without copying. */
+    BufferSlice slice(uint32 offset, uint32 len) const {
+        assert(offset + len <= mLength);
+        return BufferSlice(mSlab, mOffset + offset, len);
+    }
+
+private:
+    friend class BufferAllocator;
+
+    // Takes a new reference to the slab
+    BufferSlice(BufferSlab* slab, uint32 off, uint32 len)
+     : mSlab(slab),
+       mOffset(off),
+       mLength(len)
+    {
+        ref();
+    }
+
+    void ref() {
+        if (mSlab != NULL)
+            ++mSlab->refcount;
+    }
+    void unref() {
+        if (mSlab != NULL && --mSlab->refcount == 0)
+            BufferPool::getSingleton().release(mSlab);
+        mSlab = NULL;
+    }
+
+    BufferSlab* mSlab;
+    uint32 mOffset;
+    uint32 mLength;
+};
+
+/** BufferAllocator carves consecutive BufferSlices out of pooled slabs,
+ *  copying data in exactly once. It is *not* thread safe -- each owner (a
+ *  Stream or Connection) has its own and uses it under its own lock.
+ *
+ *  The allocator holds a reference to the slab it's carving from, so owners
+ *  should call release() when they go idle. Otherwise a quiet stream would
+ *  keep a whole slab out of the pool for as long as it's open.
+ */
+class BufferAllocator : Noncopyable {
+public:
+    BufferAllocator()
+     : mCurrent(NULL),
+       mUsed(0)
+    {}
+
+    ~BufferAllocator() {
+        release();
+    }
+
+    /** Copy len bytes into pooled memory and return a slice referring to
+     *  them. Data is never split across slabs.
+     */
+    BufferSlice copy(const void* data, uint32 len) {
+        if (mCurrent == NULL || mCurrent->capacity - mUsed < len) {
+            release();
+            mCurrent = BufferPool::getSingleton().acquire(len);
+            ++mCurrent->refcount;
+            mUsed = 0;
+        }
+
+        if (len > 0)
+            memcpy(mCurrent->data + mUsed, data, len);
+        BufferPool::getSingleton().recordCopy(len);
+        BufferSlice result(mCurrent, mUsed, len);
+        mUsed += len;
+        return result;
+    }
+
+    /** Stop carving from the current slab. It goes back to the BufferPool
+     *  once the slices already handed out are gone, and the next copy starts
+     *  a new one.
+     */
+    void release() {
+        if (mCurrent != NULL && --mCurrent->refcount == 0)
+            BufferPool::getSingleton().release(mCurrent);
+        mCurrent = NULL;
+    }
+
+private:
+    BufferSlab* mCurrent;
+    uint32 mUsed;
+};
+
+} // namespace SST
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_NETWORK_SST_BUFFER_HPP_
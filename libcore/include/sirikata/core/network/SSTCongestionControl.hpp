@@ -0,0 +1,166 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_NETWORK_SST_CONGESTION_CONTROL_HPP_
+#define _SIRIKATA_CORE_NETWORK_SST_CONGESTION_CONTROL_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/Time.hpp>
+
+namespace Sirikata {
+namespace SST {
+
+/** CongestionController decides how many channel segments an SST Connection
+ *  may have in flight. The Connection reports acknowledgements, losses
+ *  inferred from later acknowledgements, and retransmission timeouts; the
+ *  controller adjusts its window in response.
+ *
+ *  The base class also keeps the RTT estimate (smoothed RTT and variance, as
+ *  in RFC 6298) that all controllers share and that determines the
+ *  retransmission timeout.
+ *
+ *  Controllers are not thread safe, the Connection calls them with its
+ *  outstanding segments lock held.
+ */
+class SIRIKATA_EXPORT CongestionController {
+public:
+    /** Initial RTO, used until we have an RTT sample. */
+    static const int64 InitialRTOMicroseconds = 2000000;
+    /** Lower bound on the RTO. */
+    static const int64 MinRTOMicroseconds = 20000;
+    /** Upper bound on the window, in segments. */
+    static const uint32 MaxWindow = 4096;
+
+    /** Create a controller by name, "newreno" or "delay". An empty name uses
+     *  the sst.congestion-control option. Unknown names fall back to NewReno.
+     */
+    static CongestionController* create(const String& type);
+
+    CongestionController();
+    virtual ~CongestionController() {}
+
+    virtual const char* name() const = 0;
+
+    /** Number of segments which may be outstanding. Always at least 1. */
+    virtual uint32 window() const = 0;
+
+    /** A segment was acknowledged after being outstanding for rtt. */
+    void ack(const Duration& rtt);
+    /** One or more segments were lost, as inferred from acknowledgements of
+     *  segments sent after them. Called at most once per window of data.
+     */
+    virtual void loss() = 0;
+    /** The retransmission timer expired with segments outstanding. */
+    virtual void timeout() = 0;
+
+    /** Current retransmission timeout. */
+    Duration rto() const;
+    /** Smoothed RTT, or zero if there hasn't been a sample yet. */
+    Duration smoothedRTT() const;
+    /** Smallest RTT seen, or zero if there hasn't been a sample yet. */
+    Duration minRTT() const;
+
+protected:
+    // Invoked by ack() after the RTT estimate has been updated.
+    virtual void onAck(const Duration& rtt) = 0;
+
+private:
+    bool mHaveRTT;
+    int64 mSmoothedRTT; // us
+    int64 mRTTVariance; // us
+    int64 mMinRTT; // us
+};
+
+/** Loss based AIMD in the style of TCP NewReno: slow start up to ssthresh,
+ *  then one segment per window of acknowledgements. A loss halves the window,
+ *  a timeout restarts slow start from a single segment.
+ */
+class SIRIKATA_EXPORT NewRenoCongestionController : public CongestionController {
+public:
+    NewRenoCongestionController();
+
+    virtual const char* name() const { return "newreno"; }
+    virtual uint32 window() const { return mCwnd; }
+    virtual void loss();
+    virtual void timeout();
+
+    uint32 ssthresh() const { return mSSThresh; }
+
+protected:
+    virtual void onAck(const Duration& rtt);
+
+private:
+    uint32 mCwnd;
+    uint32 mSSThresh;
+    // Acks received since the window last grew during congestion avoidance
+    uint32 mAcked;
+};
+
+/** Delay based control in the style of TCP Vegas. Once per window it
+ *  compares the lowest RTT seen in that window against the lowest RTT seen
+ *  overall to estimate how many segments are sitting in queues, and grows or
+ *  shrinks the window to keep that between Alpha and Beta. This backs off
+ *  before queues overflow, so it keeps latency low on links where loss is
+ *  mostly congestive, but it still reacts to loss and timeouts.
+ */
+class SIRIKATA_EXPORT DelayCongestionController : public CongestionController {
+public:
+    /** Target range for the estimated number of queued segments. */
+    static const uint32 Alpha = 2;
+    static const uint32 Beta = 4;
+
+    DelayCongestionController();
+
+    virtual const char* name() const { return "delay"; }
+    virtual uint32 window() const { return mCwnd; }
+    virtual void loss();
+    virtual void timeout();
+
+protected:
+    virtual void onAck(const Duration& rtt);
+
+private:
+    uint32 mCwnd;
+    uint32 mSSThresh;
+    uint32 mAcked;
+    // Lowest RTT in the current window, us
+    int64 mRoundMinRTT;
+};
+
+
+/** SelectiveAck describes which parts of a Stream's byte sequence the
+ *  receiver has, so the sender can drop those buffers from its retransmit
+ *  map and only resend what is actually missing. It is carried as the payload
+ *  of Stream ACK packets, which is otherwise empty, so peers which don't
+ *  understand it just ignore it.
+ */
+struct SIRIKATA_EXPORT SelectiveAck {
+    /** Limit on the number of ranges sent in a single ACK. */
+    static const uint32 MaxBlocks = 8;
+
+    // [start, end) ranges of stream offsets
+    typedef std::pair<uint64, uint64> Block;
+    typedef std::vector<Block> BlockList;
+
+    SelectiveAck()
+     : cumulative(0)
+    {}
+
+    /** Every byte before cumulative has been received. */
+    uint64 cumulative;
+    /** Ranges received beyond cumulative, in increasing order. */
+    BlockList blocks;
+
+    /** Returns true if [offset, offset+len) has been received. */
+    bool covers(uint64 offset, uint32 len) const;
+
+    void serialize(String* output) const;
+    /** Returns false if data isn't a valid SelectiveAck. */
+    bool parse(const void* data, uint32 len);
+};
+
+} // namespace SST
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_NETWORK_SST_CONGESTION_CONTROL_HPP_
@@ -42,6 +42,8 @@
 
 #include <sirikata/core/network/Message.hpp>
 #include <sirikata/core/network/ObjectMessage.hpp>
+#include <sirikata/core/network/SSTBuffer.hpp>
+#include <sirikata/core/network/SSTCongestionControl.hpp>
 #include "Protocol_SSTHeader.pbj.hpp"
 
 #include <boost/lexical_cast.hpp>
@@ -193,6 +195,11 @@ public:
     StreamReturnCallbackMap  sListeningConnectionsCallbackMap;
     Mutex sStaticMembersLock;
 
+    // Congestion controller for new connections, see
+    // CongestionController::create. Empty uses the sst.congestion-control
+    // option.
+    String mCongestionControl;
+
 };
 
 // This is just a template definition. The real implementation of BaseDatagramLayer
@@ -292,7 +299,8 @@ class SIRIKATA_EXPORT BaseDatagramLayer
 class ChannelSegment {
 public:
 
-  uint8* mBuffer;
+  // Refers to pooled memory, see SSTBuffer.hpp
+  BufferSlice mBuffer;
   uint16 mBufferLength;
   uint64 mChannelSequenceNumber;
   uint64 mAckSequenceNumber;
@@ -300,18 +308,17 @@ public:
   Time mTransmitTime;
   Time mAckTime;
 
-  ChannelSegment( const void* data, int len, uint64 channelSeqNum, uint64 ackSequenceNum) :
-                                               mBufferLength(len),
+  // Number of acks received for segments sent after this one
+  uint16 mTimesSkipped;
+
+  ChannelSegment( const BufferSlice& data, uint64 channelSeqNum, uint64 ackSequenceNum) :
+                                               mBuffer(data),
+                                               mBufferLength(data.size()),
 					      mChannelSequenceNumber(channelSeqNum),
 					      mAckSequenceNumber(ackSequenceNum),
-					      mTransmitTime(Time::null()), mAckTime(Time::null())
+					      mTransmitTime(Time::null()), mAckTime(Time::null()),
+                                              mTimesSkipped(0)
   {
-    mBuffer = new uint8[len];
-    memcpy( mBuffer, (const uint8*) data, len);
-  }
-
-  ~ChannelSegment() {
-    delete [] mBuffer;
   }
 
   void setAckTime(Time& ackTime) {
@@ -372,17 +379,23 @@ private:
   std::deque< std::tr1::shared_ptr<ChannelSegment> > mQueuedSegments;
   std::deque< std::tr1::shared_ptr<ChannelSegment> > mOutstandingSegments;
   boost::mutex mOutstandingSegmentsMutex;
+  // Storage for queued segment data, protected by mQueueMutex
+  BufferAllocator mSegmentAllocator;
 
-  uint16 mCwnd;
+  // Decides how many segments may be outstanding and tracks the RTT, only
+  // used with mOutstandingSegmentsMutex held.
+  std::tr1::shared_ptr<CongestionController> mCongestionController;
   int64 mRTOMicroseconds; // RTO in microseconds
-  bool mFirstRTO;
+  // Losses of segments sent before this aren't reported to the congestion
+  // controller, so we only back off once per window.
+  uint64 mRecoverySequenceNumber;
 
   boost::mutex mQueueMutex;
 
   uint16 MAX_DATAGRAM_SIZE;
   uint16 MAX_PAYLOAD_SIZE;
   uint32 MAX_QUEUED_SEGMENTS;
-  float  CC_ALPHA;
+  uint16 DUPLICATE_ACK_THRESHOLD;
   Time mLastTransmitTime;
 
   std::tr1::weak_ptr<Connection<EndPointType> > mWeakThis;
@@ -403,10 +416,13 @@ private:
       mState(CONNECTION_DISCONNECTED),
       mRemoteChannelID(0), mLocalChannelID(1), mTransmitSequenceNumber(1),
       mLastReceivedSequenceNumber(1),
-      mNumStreams(0), mCwnd(1), mRTOMicroseconds(2000000),
-      mFirstRTO(true),  MAX_DATAGRAM_SIZE(1000), MAX_PAYLOAD_SIZE(1300),
-      MAX_QUEUED_SEGMENTS(3000),
-      CC_ALPHA(0.8), mLastTransmitTime(Time::null()),
+      mNumStreams(0),
+      mCongestionController(CongestionController::create(sstConnVars->mCongestionControl)),
+      mRTOMicroseconds(CongestionController::InitialRTOMicroseconds),
+      mRecoverySequenceNumber(0),
+      MAX_DATAGRAM_SIZE(1000), MAX_PAYLOAD_SIZE(1300),
+      MAX_QUEUED_SEGMENTS(3000), DUPLICATE_ACK_THRESHOLD(3),
+      mLastTransmitTime(Time::null()),
       mNumInitialRetransmissionAttempts(0),
       mInSendingMode(true)
   {
@@ -461,8 +477,6 @@ private:
       mOutstandingSegments.clear();
     }
 
-    // should start from ssthresh, the slow start lower threshold, but starting
-    // from 1 for now. Still need to implement slow start.
     if (mState == CONNECTION_DISCONNECTED) {
       std::tr1::shared_ptr<Connection<EndPointType> > thus (mWeakThis.lock());
       if (thus) {
@@ -490,7 +504,7 @@ private:
     if (mInSendingMode) {
       boost::mutex::scoped_lock lock(mQueueMutex);
 
-      for (int i = 0; (!mQueuedSegments.empty()) && mOutstandingSegments.size() <= mCwnd; i++) {
+      for (int i = 0; (!mQueuedSegments.empty()) && mOutstandingSegments.size() < mCongestionController->window(); i++) {
 	  std::tr1::shared_ptr<ChannelSegment> segment = mQueuedSegments.front();
 
 	  Sirikata::Protocol::SST::SSTChannelHeader sstMsg;
@@ -499,7 +513,7 @@ private:
 	  sstMsg.set_ack_count(1);
 	  sstMsg.set_ack_sequence_number(segment->mAckSequenceNumber);
 
-	  sstMsg.set_payload(segment->mBuffer, segment->mBufferLength);
+	  sstMsg.set_payload(segment->mBuffer.data(), segment->mBufferLength);
 
           /*printf("%s sending packet from data sending loop to %s \n",
                    mLocalEndPoint.endPoint.toString().c_str()
@@ -523,6 +537,11 @@ private:
           }
       }
 
+      // Everything has been sent and acked, so the channel is idle and
+      // shouldn't hold on to a slab
+      if (mQueuedSegments.empty() && mOutstandingSegments.empty())
+        mSegmentAllocator.release();
+
       if (!mInSendingMode || mState == CONNECTION_PENDING_CONNECT) {
         getContext()->mainStrand->post(Duration::microseconds(mRTOMicroseconds*pow(2.0,mNumInitialRetransmissionAttempts)),
             std::tr1::bind(&Connection<EndPointType>::serviceConnectionNoReturn, this, mWeakThis.lock()),
@@ -543,11 +562,8 @@ private:
       }
 
       if (mOutstandingSegments.size() > 0) {
-        mCwnd /= 2;
-
-        if (mCwnd < 1) {
-          mCwnd = 1;
-        }
+        mCongestionController->timeout();
+        mRecoverySequenceNumber = mTransmitSequenceNumber;
 
         mOutstandingSegments.clear();
       }
@@ -732,13 +748,6 @@ private:
 
     assert(length <= MAX_PAYLOAD_SIZE);
 
-    Sirikata::Protocol::SST::SSTStreamHeader* stream_msg =
-                       new Sirikata::Protocol::SST::SSTStreamHeader();
-
-    std::string str = std::string( (char*)data, length);
-
-    bool parsed = parsePBJMessage(stream_msg, str);
-
     uint64 transmitSequenceNumber =  mTransmitSequenceNumber;
 
     if ( isAck ) {
@@ -755,7 +764,7 @@ private:
     else {
       if (mQueuedSegments.size() < MAX_QUEUED_SEGMENTS) {
         mQueuedSegments.push_back( std::tr1::shared_ptr<ChannelSegment>(
-                                   new ChannelSegment(data, length, mTransmitSequenceNumber, mLastReceivedSequenceNumber) ) );
+                                   new ChannelSegment(mSegmentAllocator.copy(data, length), mTransmitSequenceNumber, mLastReceivedSequenceNumber) ) );
 
         if (mInSendingMode) {
           getContext()->mainStrand->post(Duration::milliseconds(1.0),
@@ -768,8 +777,6 @@ private:
 
     mTransmitSequenceNumber++;
 
-    delete stream_msg;
-
     return transmitSequenceNumber;
   }
 
@@ -809,46 +816,54 @@ private:
   void markAcknowledgedPacket(uint64 receivedAckNum) {
     boost::mutex::scoped_lock lock(mOutstandingSegmentsMutex);
 
+    std::deque< std::tr1::shared_ptr<ChannelSegment> >::iterator acked_it = mOutstandingSegments.begin();
+    for (; acked_it != mOutstandingSegments.end(); acked_it++) {
+        if (*acked_it && (*acked_it)->mChannelSequenceNumber == receivedAckNum)
+            break;
+    }
+    if (acked_it == mOutstandingSegments.end())
+        return;
+
+    std::tr1::shared_ptr<ChannelSegment> segment = *acked_it;
+    segment->mAckTime = Timer::now();
+    mCongestionController->ack(segment->mAckTime - segment->mTransmitTime);
+    mRTOMicroseconds = mCongestionController->rto().toMicroseconds();
+
+    // Segments sent before this one which have now been skipped over
+    // DUPLICATE_ACK_THRESHOLD times are presumed lost. The channel doesn't
+    // retransmit (Streams do that themselves), we just need to stop counting
+    // them as in flight and tell the congestion controller.
+    bool lost = false;
+    std::deque< std::tr1::shared_ptr<ChannelSegment> > remaining;
     for (std::deque< std::tr1::shared_ptr<ChannelSegment> >::iterator it = mOutstandingSegments.begin();
          it != mOutstandingSegments.end(); it++)
     {
-        std::tr1::shared_ptr<ChannelSegment> segment = *it;
+        if (it == acked_it || !(*it)) continue;
 
-        if (!segment) {
-          mOutstandingSegments.erase(it);
-          it = mOutstandingSegments.begin();
-          continue;
+        if ((*it)->mChannelSequenceNumber < receivedAckNum &&
+            ++(*it)->mTimesSkipped >= DUPLICATE_ACK_THRESHOLD)
+        {
+            if ((*it)->mChannelSequenceNumber >= mRecoverySequenceNumber)
+                lost = true;
+            continue;
         }
+        remaining.push_back(*it);
+    }
+    mOutstandingSegments.swap(remaining);
 
-        if (segment->mChannelSequenceNumber == receivedAckNum) {
-          segment->mAckTime = Timer::now();
-
-          if (mFirstRTO ) {
-	         mRTOMicroseconds = ((segment->mAckTime - segment->mTransmitTime).toMicroseconds()) ;
-	         mFirstRTO = false;
-          }
-          else {
-            mRTOMicroseconds = CC_ALPHA * mRTOMicroseconds +
-              (1.0-CC_ALPHA) * (segment->mAckTime - segment->mTransmitTime).toMicroseconds();
-          }
-
-          mInSendingMode = true;
-
-          std::tr1::shared_ptr<Connection<EndPointType> > conn = mWeakThis.lock();
-          if (conn) {
-            getContext()->mainStrand->post(
-                std::tr1::bind(&Connection<EndPointType>::serviceConnectionNoReturn, this, conn),
-                "Connection<EndPointType>::serviceConnectionNoReturn"
-            );
-          }
+    if (lost) {
+        mCongestionController->loss();
+        mRecoverySequenceNumber = mTransmitSequenceNumber;
+    }
 
-          if (rand() % mCwnd == 0)  {
-            mCwnd += 1;
-          }
+    mInSendingMode = true;
 
-          mOutstandingSegments.erase(it);
-          break;
-        }
+    std::tr1::shared_ptr<Connection<EndPointType> > conn = mWeakThis.lock();
+    if (conn) {
+      getContext()->mainStrand->post(
+          std::tr1::bind(&Connection<EndPointType>::serviceConnectionNoReturn, this, conn),
+          "Connection<EndPointType>::serviceConnectionNoReturn"
+      );
     }
   }
 
@@ -1427,28 +1442,21 @@ private:
 class StreamBuffer{
 public:
 
-  uint8* mBuffer;
+  // Refers to pooled memory, possibly shared with other StreamBuffers that
+  // were split from the same write(). See SSTBuffer.hpp.
+  BufferSlice mBuffer;
   uint32 mBufferLength;
   uint64 mOffset;
 
   Time mTransmitTime;
   Time mAckTime;
 
-  StreamBuffer(const uint8* data, uint32 len, uint64 offset) :
+  StreamBuffer(const BufferSlice& data, uint64 offset) :
+    mBuffer(data),
+    mBufferLength(data.size()),
+    mOffset(offset),
     mTransmitTime(Time::null()), mAckTime(Time::null())
   {
-    mBuffer = new uint8[len+1];
-
-    if (len > 0) {
-      memcpy(mBuffer,data,len);
-    }
-
-    mBufferLength = len;
-    mOffset = offset;
-  }
-
-  ~StreamBuffer() {
-      delete []mBuffer;
   }
 };
 
@@ -1579,7 +1587,7 @@ public:
       if (mCurrentQueueLength+len > MAX_QUEUE_LENGTH) {
 	return 0;
       }
-      mQueuedBuffers.push_back( std::tr1::shared_ptr<StreamBuffer>(new StreamBuffer(data, len, mNumBytesSent)) );
+      mQueuedBuffers.push_back( std::tr1::shared_ptr<StreamBuffer>(new StreamBuffer(mBufferAllocator.copy(data, len), mNumBytesSent)) );
       mCurrentQueueLength += len;
       mNumBytesSent += len;
 
@@ -1594,17 +1602,31 @@ public:
       return len;
     }
     else {
-      int currOffset = 0;
-      while (currOffset < len) {
-	int buffLen = (len-currOffset > MAX_PAYLOAD_SIZE) ?
+      // Figure out how much we can accept, copy it into pooled memory once,
+      // and then split it into packet sized slices of that copy.
+      int acceptLen = 0;
+      while (acceptLen < len) {
+	int buffLen = (len-acceptLen > MAX_PAYLOAD_SIZE) ?
 	              MAX_PAYLOAD_SIZE :
-	              (len-currOffset);
+	              (len-acceptLen);
 
-	if (mCurrentQueueLength + buffLen > MAX_QUEUE_LENGTH) {
+	if (mCurrentQueueLength + acceptLen + buffLen > MAX_QUEUE_LENGTH) {
 	  break;
 	}
+	acceptLen += buffLen;
+      }
+
+      BufferSlice accepted;
+      if (acceptLen > 0)
+        accepted = mBufferAllocator.copy(data, acceptLen);
+
+      int currOffset = 0;
+      while (currOffset < acceptLen) {
+	int buffLen = (acceptLen-currOffset > MAX_PAYLOAD_SIZE) ?
+	              MAX_PAYLOAD_SIZE :
+	              (acceptLen-currOffset);
 
-	mQueuedBuffers.push_back( std::tr1::shared_ptr<StreamBuffer>(new StreamBuffer(data+currOffset, buffLen, mNumBytesSent)) );
+	mQueuedBuffers.push_back( std::tr1::shared_ptr<StreamBuffer>(new StreamBuffer(accepted.slice(currOffset, buffLen), mNumBytesSent)) );
 	currOffset += buffLen;
 	mCurrentQueueLength += buffLen;
 	mNumBytesSent += buffLen;
@@ -2078,7 +2100,7 @@ private:
 	    break;
 	  }
 
-	  uint64 channelID = sendDataPacket(buffer->mBuffer,
+	  uint64 channelID = sendDataPacket(buffer->mBuffer.data(),
 					    buffer->mBufferLength,
 					    buffer->mOffset
 					    );
@@ -2265,26 +2287,23 @@ private:
     boost::mutex::scoped_lock lock(mQueueMutex);
 
     bool acked_msgs = false;
+    // Transmit time of the most recently sent buffer this ack tells us has
+    // arrived, used to detect losses below.
+    Time latestDelivered = Time::null();
     if (mChannelToBufferMap.find(offset) != mChannelToBufferMap.end()) {
       uint64 dataOffset = mChannelToBufferMap[offset]->mOffset;
       mNumOutstandingBytes -= mChannelToBufferMap[offset]->mBufferLength;
 
       mChannelToBufferMap[offset]->mAckTime = curTime;
+      latestDelivered = mChannelToBufferMap[offset]->mTransmitTime;
 
       updateRTO(mChannelToBufferMap[offset]->mTransmitTime, mChannelToBufferMap[offset]->mAckTime);
 
-      if ( (int) (pow(2.0, streamMsg->window()) - mNumOutstandingBytes) > 0 ) {
-        assert( pow(2.0, streamMsg->window()) - mNumOutstandingBytes > 0);
-        mTransmitWindowSize = pow(2.0, streamMsg->window()) - mNumOutstandingBytes;
-      }
-      else {
-        mTransmitWindowSize = 0;
-      }
-
       //printf("REMOVED ack packet at offset %d\n", (int)mChannelToBufferMap[offset]->mOffset);
 
       acked_msgs = true;
       mChannelToBufferMap.erase(offset);
+      mChannelToStreamOffsetMap.erase(offset);
 
       std::vector <uint64> channelOffsets;
       for(std::map<uint64, std::tr1::shared_ptr<StreamBuffer> >::iterator it = mChannelToBufferMap.begin();
@@ -2321,6 +2340,34 @@ private:
       }
     }
 
+    // Newer peers describe everything they've received in the ACK payload,
+    // which lets us clear buffers whose own ACKs were lost and find the holes
+    // that actually need to be resent.
+    if (streamMsg->type() == streamMsg->ACK && len > 0) {
+      SelectiveAck sack;
+      if (sack.parse(buffer, len)) {
+        if (applySelectiveAck(sack, &latestDelivered))
+          acked_msgs = true;
+      }
+    }
+
+    if (latestDelivered != Time::null() && detectLostBuffers(latestDelivered))
+      acked_msgs = true;
+
+    // Nothing queued or in flight, so an idle stream doesn't pin a slab
+    if (acked_msgs && mQueuedBuffers.empty() && mChannelToBufferMap.empty())
+      mBufferAllocator.release();
+
+    if (acked_msgs) {
+      if ( (int) (pow(2.0, streamMsg->window()) - mNumOutstandingBytes) > 0 ) {
+        assert( pow(2.0, streamMsg->window()) - mNumOutstandingBytes > 0);
+        mTransmitWindowSize = pow(2.0, streamMsg->window()) - mNumOutstandingBytes;
+      }
+      else {
+        mTransmitWindowSize = 0;
+      }
+    }
+
     // If we acked messages, we've cleared space in the transmit
     // buffer (the receiver cleared something out of its receive
     // buffer). We can send more data, so schedule servicing if we
@@ -2368,6 +2415,64 @@ private:
 
   }
 
+  /* Removes every buffer covered by sack from the retransmit map. Returns
+     true if any were removed. mQueueMutex must be locked. */
+  bool applySelectiveAck(const SelectiveAck& sack, Time* latestDelivered) {
+    std::vector<uint64> ackedChannels;
+    for(std::map<uint64, std::tr1::shared_ptr<StreamBuffer> >::iterator it = mChannelToBufferMap.begin();
+        it != mChannelToBufferMap.end(); ++it)
+    {
+      if (!sack.covers(it->second->mOffset, it->second->mBufferLength))
+        continue;
+
+      ackedChannels.push_back(it->first);
+      mNumOutstandingBytes -= std::min(mNumOutstandingBytes, it->second->mBufferLength);
+      if (it->second->mTransmitTime > *latestDelivered)
+        *latestDelivered = it->second->mTransmitTime;
+    }
+
+    for (uint32 i = 0; i < ackedChannels.size(); i++) {
+      mChannelToBufferMap.erase(ackedChannels[i]);
+      mChannelToStreamOffsetMap.erase(ackedChannels[i]);
+    }
+
+    return !ackedChannels.empty();
+  }
+
+  /* Any buffer sent noticeably earlier than one which has been delivered was
+     most likely lost, so queue it to be resent right away instead of waiting
+     for the retransmission timer. Only these buffers are resent; everything
+     else stays in flight. Returns true if anything was requeued.
+     mQueueMutex must be locked. */
+  bool detectLostBuffers(const Time& latestDelivered) {
+    // Allow for some reordering in the network
+    Duration reorderWindow = Duration::microseconds(mStreamRTOMicroseconds / 4);
+
+    std::vector<uint64> lostChannels;
+    for(std::map<uint64, std::tr1::shared_ptr<StreamBuffer> >::iterator it = mChannelToBufferMap.begin();
+        it != mChannelToBufferMap.end(); ++it)
+    {
+      if (it->second->mTransmitTime + reorderWindow < latestDelivered)
+        lostChannels.push_back(it->first);
+    }
+    if (lostChannels.empty())
+      return false;
+
+    // Channel IDs increase with send order, so walking backwards and pushing
+    // to the front keeps the lost buffers in the order they were sent.
+    for (int32 i = lostChannels.size() - 1; i >= 0; i--) {
+      std::tr1::shared_ptr<StreamBuffer> buffer = mChannelToBufferMap[lostChannels[i]];
+      mChannelToBufferMap.erase(lostChannels[i]);
+      mChannelToStreamOffsetMap.erase(lostChannels[i]);
+
+      mQueuedBuffers.push_front(buffer);
+      mCurrentQueueLength += buffer->mBufferLength;
+      mNumOutstandingBytes -= std::min(mNumOutstandingBytes, buffer->mBufferLength);
+    }
+
+    return true;
+  }
+
   void sendInitPacket(void* data, uint32 len) {
     Sirikata::Protocol::SST::SSTStreamHeader sstMsg;
     sstMsg.set_lsid( mLSID );
@@ -2400,6 +2505,36 @@ private:
 
   }
 
+  /* Describes the data we've received. mReceiveBufferMutex must be
+     locked. */
+  SelectiveAck buildSelectiveAck() {
+    SelectiveAck sack;
+    sack.cumulative = mNextByteExpected;
+    if (mReceiveBitmap == NULL)
+      return sack;
+
+    // Runs of received bytes in the receive window, nearest first since
+    // those are the holes the sender should fill first.
+    const uint8* recv_bmap = mReceiveBitmap;
+    uint32 i = 0;
+    while (i < MAX_RECEIVE_WINDOW && sack.blocks.size() < SelectiveAck::MaxBlocks) {
+      const uint8* start = (const uint8*)memchr(recv_bmap + i, 1, MAX_RECEIVE_WINDOW - i);
+      if (start == NULL) break;
+
+      uint32 block_start = start - recv_bmap;
+      uint32 block_end = block_start;
+      while (block_end < MAX_RECEIVE_WINDOW && recv_bmap[block_end] == 1)
+        block_end++;
+
+      sack.blocks.push_back(
+          SelectiveAck::Block(mNextByteExpected + block_start, mNextByteExpected + block_end)
+      );
+      i = block_end;
+    }
+
+    return sack;
+  }
+
   void sendAckPacket() {
     Sirikata::Protocol::SST::SSTStreamHeader sstMsg;
     sstMsg.set_lsid( mLSID );
@@ -2408,6 +2543,11 @@ private:
     sstMsg.set_window( log((double)mReceiveWindowSize)/log(2.0)  );
     sstMsg.set_src_port(mLocalPort);
     sstMsg.set_dest_port(mRemotePort);
+
+    String sack_data;
+    buildSelectiveAck().serialize(&sack_data);
+    sstMsg.set_payload(sack_data.data(), sack_data.size());
+
     std::string buffer = serializePBJMessage(sstMsg);
 
     //printf("Sending Ack packet with window %d\n", (int)sstMsg.window());
@@ -2485,6 +2625,8 @@ private:
   uint32 MAX_RECEIVE_WINDOW;
 
   boost::mutex mQueueMutex;
+  // Storage for queued buffer data, protected by mQueueMutex
+  BufferAllocator mBufferAllocator;
 
   bool mFirstRTO;
   int64 mStreamRTOMicroseconds;
@@ -2584,6 +2726,13 @@ public:
     return mSSTConnVars.getDatagramLayer(endPoint);
   }
 
+  /** Set the congestion controller used by connections created after this
+   *  call, e.g. "newreno" or "delay". See CongestionController::create.
+   */
+  void setCongestionControl(const String& type) {
+    mSSTConnVars.mCongestionControl = type;
+  }
+
   bool listen(StreamReturnCallbackFunction cb, EndPoint <EndPointType> listeningEndPoint) {
     return Stream<EndPointType>::listen(&mSSTConnVars, cb, listeningEndPoint);
   }
@@ -267,6 +267,20 @@ public:
      *           insufficient queue space
      */
     virtual bool send(const Chunk&data, StreamReliability reliability)=0;
+    /** Enqueue a message to be sent, handing its storage over to the stream so
+     *  implementations that can frame it separately don't need to copy it.
+     *  \param data the message to send. If the send succeeds the stream owns
+     *         and will delete it, otherwise it still belongs to the caller.
+     *  \param reliability the reliability and ordering to send the message with
+     *  \returns true if the message was accepted, false if the send failed due to a lost connection or
+     *           insufficient queue space
+     */
+    virtual bool sendOwned(Chunk* data, StreamReliability reliability) {
+        bool sent = send(*data, reliability);
+        if (sent)
+            delete data;
+        return sent;
+    }
 
     /** Determine if a message of the specified size could be enqueued to be sent.
      *  \returns true if a message of the specified size could be successfully enqueued
@@ -305,6 +319,13 @@ public:
         return Duration::zero();
     }
 
+    /** Get the number of bytes of message data the underlying connection has
+     *  copied while framing sent messages and delivering received ones.
+     */
+    virtual uint64 bytesCopied() const {
+        return 0;
+    }
+
 };
 } // namespace Network
 } // namespace Sirikata
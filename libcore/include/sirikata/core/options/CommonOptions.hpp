@@ -53,6 +53,19 @@
 #define OPT_CDN_DOWNLOAD_URI_PREFIX     "cdn.download.prefix"
 #define OPT_CDN_UPLOAD_URI_PREFIX   "cdn.upload.prefix"
 #define OPT_CDN_UPLOAD_STATUS_URI_PREFIX   "cdn.upload.status.prefix"
+#define OPT_CDN_CACHE_POLICY     "cdn.cache.policy"
+#define OPT_CDN_CACHE_ADMISSION  "cdn.cache.admission"
+#define OPT_CDN_DISK_CACHE       "cdn.cache.disk"
+
+#define OPT_TRANSFER_OUTSTANDING         "transfer.outstanding"
+#define OPT_TRANSFER_RESERVED            "transfer.reserved"
+#define OPT_TRANSFER_DEADLINE_HORIZON    "transfer.deadline-horizon"
+#define OPT_TRANSFER_SOURCE_BANDWIDTH    "transfer.source-bandwidth"
+#define OPT_TRANSFER_DISPATCH_THREADS    "transfer.dispatch-threads"
+#define OPT_TRANSFER_MESH_DEADLINE       "transfer.mesh-deadline"
+
+#define OPT_IOSERVICE_STATS            "ioservice.stats"
+#define OPT_IOSERVICE_STATS_PERIOD     "ioservice.stats-period"
 
 #define OPT_TRACE_TIMESERIES           "trace.timeseries"
 #define OPT_TRACE_TIMESERIES_OPTIONS   "trace.timeseries-options"
@@ -60,6 +73,8 @@
 #define OPT_COMMAND_COMMANDER           "command.commander"
 #define OPT_COMMAND_COMMANDER_OPTIONS   "command.commander-options"
 
+#define OPT_SST_CONGESTION_CONTROL      "sst.congestion-control"
+
 namespace Sirikata {
 
 /// Report version information to the log
@@ -40,8 +40,14 @@ namespace Sirikata {
 
 /** Fair Queue with one input queue of Messages per Key, backed by a TQueue. Each
  *  input queue can be assigned a weight and selection happens according to FairQueuing.
+ *
+ *  Queues are found by key in a hash table and the queues with messages
+ *  waiting are kept in a binary heap ordered by the virtual finish time of
+ *  their front message, so push, pop and front are O(log n) in the number of
+ *  queues. Queues with equal finish times are serviced in the order they got
+ *  those finish times.
  */
-template <class Message,class Key,class TQueue> class FairQueue {
+template <class Message,class Key,class TQueue,class KeyHasher = std::tr1::hash<Key> > class FairQueue {
 private:
     typedef TQueue MessageQueue;
 
@@ -55,6 +61,9 @@ private:
            nextFinishMessage(NULL),
            nextFinishStartTime(Time::null()),
            nextFinishTime(Time::null()),
+           finishOrder(0),
+           heapIndex(-1),
+           inTimeIndex(false),
            enabled(true)
         {
         }
@@ -67,6 +76,9 @@ private:
            nextFinishMessage(NULL),
            nextFinishStartTime(Time::null()),
            nextFinishTime(Time::null()),
+           finishOrder(0),
+           heapIndex(-1),
+           inTimeIndex(false),
            enabled(true)
         {}
 
@@ -81,18 +93,19 @@ private:
         Message* nextFinishMessage; // Need to verify this matches when we pop it off
         Time nextFinishStartTime; // The time the next message to finish started at, used to recompute if front() changed
         Time nextFinishTime;
+        uint64 finishOrder; // Breaks ties between equal nextFinishTimes
+        int32 heapIndex; // Position in mQueuesByTime, or -1 if not in it
+        bool inTimeIndex; // Has a next message, whether or not it's enabled
         bool enabled;
     };
 
-    typedef std::map<Key, QueueInfo*> QueueInfoByKey; // NOTE: this could be unordered, but must be unique associative container
-    typedef std::multimap<Time, QueueInfo*> QueueInfoByFinishTime; // NOTE: this must be ordered multiple associative container
+    typedef std::tr1::unordered_map<Key, QueueInfo*, KeyHasher> QueueInfoByKey;
+    // Binary min-heap of enabled queues with a next message, by finish time
+    typedef std::vector<QueueInfo*> QueueInfoByFinishTime;
 
     typedef typename QueueInfoByKey::iterator ByKeyIterator;
     typedef typename QueueInfoByKey::const_iterator ConstByKeyIterator;
 
-    typedef typename QueueInfoByFinishTime::iterator ByTimeIterator;
-    typedef typename QueueInfoByFinishTime::const_iterator ConstByTimeIterator;
-
     typedef std::set<Key> KeySet;
     typedef std::set<QueueInfo*> QueueInfoSet;
 public:
@@ -103,6 +116,8 @@ public:
       mCurrentVirtualTime(Time::null()),
       mQueuesByKey(),
       mQueuesByTime(),
+      mNumDisabledWaiting(0),
+      mNextFinishOrder(0),
       mFrontQueue(NULL)
     {
         warn_count = 0;
@@ -137,10 +152,8 @@ public:
             // based on the current virtual time is pretty much always
             // better than waiting the default maximum amount of time
             // for the current head packet to pass through.
-            if (old_weight == 0.0) {
-                removeFromTimeIndex(qi);
+            if (old_weight == 0.0)
                 computeNextFinishTime(qi);
-            }
         }
     }
 
@@ -184,7 +197,13 @@ public:
         if (it == mQueuesByKey.end())
             return;
         QueueInfo* qi = it->second;
-        qi->enabled = true;
+        if (!qi->enabled) {
+            qi->enabled = true;
+            if (qi->inTimeIndex) {
+                mNumDisabledWaiting--;
+                heapInsert(qi);
+            }
+        }
         // Enabling a queue *might* affect the choice of the front queue if
         //  a. another queue is currently selected as the front
         //  b. the enabled queue is non-empty
@@ -200,7 +219,13 @@ public:
         ByKeyIterator it = mQueuesByKey.find(key);
         assert(it != mQueuesByKey.end());
         QueueInfo* qi = it->second;
-        qi->enabled = false;
+        if (qi->enabled) {
+            qi->enabled = false;
+            if (qi->inTimeIndex) {
+                heapRemove(qi);
+                mNumDisabledWaiting++;
+            }
+        }
 
         // Disabling a queue will only affect the choice of front queue if the
         // one disabled *was* the front queue.
@@ -249,7 +274,6 @@ public:
 
         // We just need to (re)compute the next finish time.
         QueueInfo* queue_info = qi_it->second;
-        removeFromTimeIndex(queue_info);
         computeNextFinishTime(queue_info);
 
         // Reevaluate front queue
@@ -311,9 +335,8 @@ public:
             assert(popped_val == mFrontQueue->nextFinishMessage);
             assert(popped_val == result);
 
-            // Remove from queue time list
-            removeFromTimeIndex(mFrontQueue);
-            // Update finish time and add back to time index if necessary
+            // Update finish time, which moves the queue within the time
+            // index or removes it if there's nothing left
             computeNextFinishTime(mFrontQueue, vftime);
 
             // Unmark the queue as being in front
@@ -324,10 +347,10 @@ public:
     }
 
     bool empty() const {
-        // Queues won't be in mQueuesByTime unless they have something in them
-        // This allows us to efficiently answer false if we know we have pending
-        // items
-        return mQueuesByTime.empty();
+        // Queues won't be in the time index unless they have something in
+        // them. This allows us to efficiently answer false if we know we have
+        // pending items
+        return mQueuesByTime.empty() && mNumDisabledWaiting == 0;
     }
 
     // Returns the total amount of space that can be allocated for the destination
@@ -400,51 +423,41 @@ protected:
     void nextMessage(Message** result_out, Time* vftime_out, QueueInfo** min_queue_info_out) {
         *result_out = NULL;
 
-        // If there's nothing in the queue, there is no next message
+        // Disabled queues aren't in the heap, so the top is always the next
+        // message, if there is one
         if (mQueuesByTime.empty())
             return;
 
-        // Loop through until we find one that has data and can be handled.
-        bool advance = true; // Indicates whether the loop needs to advance, set to false when an unexpected front has already advanced to the next item in order to remove the current item
-        for(ByTimeIterator it = mQueuesByTime.begin(); it != mQueuesByTime.end(); advance ? it++ : it) {
-            QueueInfo* min_queue_info = it->second;
-
-            advance = true;
-
-            // First, check if this queue is even enabled
-            if (!min_queue_info->enabled)
-                continue;
+        QueueInfo* min_queue_info = mQueuesByTime.front();
+        assert(min_queue_info->enabled);
 
-            // These just assert that this queue is just sane.
-            assert(min_queue_info->nextFinishMessage != NULL);
-            assert(min_queue_info->nextFinishMessage == min_queue_info->messageQueue->front());
+        // These just assert that this queue is just sane.
+        assert(min_queue_info->nextFinishMessage != NULL);
+        assert(min_queue_info->nextFinishMessage == min_queue_info->messageQueue->front());
 
-            *min_queue_info_out = min_queue_info;
-            *vftime_out = min_queue_info->nextFinishTime;
-            *result_out = min_queue_info->nextFinishMessage;
-            break;
-        }
+        *min_queue_info_out = min_queue_info;
+        *vftime_out = min_queue_info->nextFinishTime;
+        *result_out = min_queue_info->nextFinishMessage;
     }
 
-    // Finds and removes this queue from the time index (mQueuesByTime).
+    // Removes this queue from the time index, if it's in it.
     void removeFromTimeIndex(QueueInfo* qi) {
-        std::pair<ByTimeIterator, ByTimeIterator> eq_range = mQueuesByTime.equal_range(qi->nextFinishTime);
-        ByTimeIterator start_q = eq_range.first;
-        ByTimeIterator end_q = eq_range.second;
-
-        for(ByTimeIterator it = start_q; it != end_q; it++) {
-            if (it->second == qi) {
-                mQueuesByTime.erase(it);
-                return;
-            }
-        }
+        if (!qi->inTimeIndex) return;
+        qi->inTimeIndex = false;
+
+        if (qi->enabled)
+            heapRemove(qi);
+        else
+            mNumDisabledWaiting--;
     }
 
-    // Computes the next finish time for this queue and, if it has one, inserts it into the time index
-    ByTimeIterator computeNextFinishTime(QueueInfo* qi, const Time& last_finish_time) {
+    // Computes the next finish time for this queue and updates its place in
+    // the time index, adding or removing it as necessary.
+    void computeNextFinishTime(QueueInfo* qi, const Time& last_finish_time) {
         if ( qi->messageQueue->empty() ) {
+            removeFromTimeIndex(qi);
             qi->nextFinishMessage = NULL;
-            return mQueuesByTime.end();
+            return;
         }
 
         // If we don't restrict to strict queues, front() may return NULL even though the queue is not empty.
@@ -452,23 +465,100 @@ protected:
         // canSend predicate.
         Message* front_msg = qi->messageQueue->front();
         if ( front_msg == NULL ) {
+            removeFromTimeIndex(qi);
             qi->nextFinishMessage = NULL;
-            return mQueuesByTime.end();
+            return;
         }
 
         qi->nextFinishMessage = front_msg;
         qi->nextFinishTime = finishTime( front_msg->size(), qi, last_finish_time);
         qi->nextFinishStartTime = last_finish_time;
-
-        ByTimeIterator new_it = mQueuesByTime.insert( typename QueueInfoByFinishTime::value_type(qi->nextFinishTime, qi) );
-
-        return new_it;
+        qi->finishOrder = mNextFinishOrder++;
+
+        if (!qi->inTimeIndex) {
+            qi->inTimeIndex = true;
+            if (qi->enabled)
+                heapInsert(qi);
+            else
+                mNumDisabledWaiting++;
+        }
+        else if (qi->enabled) {
+            heapUpdate(qi);
+        }
     }
 
     void computeNextFinishTime(QueueInfo* qi) {
         computeNextFinishTime(qi, mCurrentVirtualTime);
     }
 
+    // Heap ordering, earliest finish time first
+    static bool finishesBefore(const QueueInfo* lhs, const QueueInfo* rhs) {
+        if (lhs->nextFinishTime != rhs->nextFinishTime)
+            return lhs->nextFinishTime < rhs->nextFinishTime;
+        return lhs->finishOrder < rhs->finishOrder;
+    }
+
+    void heapSet(uint32 idx, QueueInfo* qi) {
+        mQueuesByTime[idx] = qi;
+        qi->heapIndex = (int32)idx;
+    }
+
+    void heapSiftUp(uint32 idx) {
+        QueueInfo* qi = mQueuesByTime[idx];
+        while(idx > 0) {
+            uint32 parent = (idx - 1) / 2;
+            if (!finishesBefore(qi, mQueuesByTime[parent]))
+                break;
+            heapSet(idx, mQueuesByTime[parent]);
+            idx = parent;
+        }
+        heapSet(idx, qi);
+    }
+
+    void heapSiftDown(uint32 idx) {
+        QueueInfo* qi = mQueuesByTime[idx];
+        uint32 count = (uint32)mQueuesByTime.size();
+        while(true) {
+            uint32 child = 2 * idx + 1;
+            if (child >= count)
+                break;
+            if (child + 1 < count && finishesBefore(mQueuesByTime[child+1], mQueuesByTime[child]))
+                child++;
+            if (!finishesBefore(mQueuesByTime[child], qi))
+                break;
+            heapSet(idx, mQueuesByTime[child]);
+            idx = child;
+        }
+        heapSet(idx, qi);
+    }
+
+    void heapInsert(QueueInfo* qi) {
+        assert(qi->heapIndex == -1);
+        mQueuesByTime.push_back(qi);
+        heapSiftUp((uint32)mQueuesByTime.size() - 1);
+    }
+
+    void heapRemove(QueueInfo* qi) {
+        assert(qi->heapIndex >= 0);
+        uint32 idx = (uint32)qi->heapIndex;
+        QueueInfo* last = mQueuesByTime.back();
+        mQueuesByTime.pop_back();
+        qi->heapIndex = -1;
+        if (last == qi)
+            return;
+        // Fill the hole with the last entry, which could need to move either
+        // way from there
+        heapSet(idx, last);
+        heapUpdate(last);
+    }
+
+    // Restore heap order after qi's finish time changed
+    void heapUpdate(QueueInfo* qi) {
+        assert(qi->heapIndex >= 0);
+        heapSiftUp((uint32)qi->heapIndex);
+        heapSiftDown((uint32)qi->heapIndex);
+    }
+
     /** Finish time for a packet that was inserted into a non-empty queue, i.e. based on the previous packet's
      *  finish time. */
     Time finishTime(uint32 size, QueueInfo* qi, const Time& last_finish_time) const {
@@ -494,9 +584,11 @@ protected:
 
     uint32 mRate;
     Time mCurrentVirtualTime;
-    // FIXME if I could get the templates to work, using multi_index_container instead of 2 containers would be preferable
     QueueInfoByKey mQueuesByKey;
     QueueInfoByFinishTime mQueuesByTime;
+    // Disabled queues with a next message, which aren't in mQueuesByTime
+    uint32 mNumDisabledWaiting;
+    uint64 mNextFinishOrder;
     QueueInfo* mFrontQueue; // Queue holding the front item
 }; // class FairQueue
 
@@ -0,0 +1,169 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_QUEUE_PARTITIONED_STRAND_QUEUE_HPP_
+#define _SIRIKATA_CORE_QUEUE_PARTITIONED_STRAND_QUEUE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/network/IOServicePool.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace Sirikata {
+
+/** PartitionedStrandQueue spreads work items across a set of strands running
+ *  on their own IOServicePool. Each item is pushed with a partition key (e.g. a
+ *  hash of the destination object) and always lands on the same strand, so
+ *  items sharing a key are handled in the order they were pushed while items
+ *  with different keys are handled in parallel.
+ *
+ *  push() is thread safe. Items are handed to the handler in batches of up to
+ *  maxBatch, on the partition's strand, so the handler can amortize per-batch
+ *  work (locks, notifications) and keep per-partition state without locking.
+ */
+template<typename Item>
+class PartitionedStrandQueue {
+public:
+    typedef std::vector<Item> Batch;
+    typedef std::tr1::function<void(uint32 partition, Batch& items)> BatchHandler;
+
+    /** Create a queue.
+     *  \param name name of the thread pool, used for thread names
+     *  \param nthreads number of threads to run partitions on
+     *  \param npartitions number of partitions (strands). More partitions
+     *         than threads balances load better when a few keys are hot.
+     *  \param max_batch maximum number of items passed to a single
+     *         handler invocation
+     *  \param handler invoked on the partition's strand for each batch
+     */
+    PartitionedStrandQueue(const String& name, uint32 nthreads, uint32 npartitions, uint32 max_batch, const BatchHandler& handler)
+     : mPool(new Network::IOServicePool(name, nthreads)),
+       mMaxBatch(std::max(max_batch, (uint32)1)),
+       mHandler(handler)
+    {
+        npartitions = std::max(npartitions, (uint32)1);
+        for(uint32 i = 0; i < npartitions; i++) {
+            Partition* part = new Partition();
+            part->strand = mPool->service()->createStrand(name + "." + boost::lexical_cast<String>(i));
+            part->scheduled = false;
+            mPartitions.push_back(part);
+        }
+    }
+
+    ~PartitionedStrandQueue() {
+        for(uint32 i = 0; i < mPartitions.size(); i++) {
+            delete mPartitions[i]->strand;
+            delete mPartitions[i];
+        }
+        delete mPool;
+    }
+
+    void start() {
+        mPool->startWork();
+        mPool->run();
+    }
+
+    /** Stop the threads, waiting for them to exit. Items that haven't been
+     *  handled yet remain queued, see drain().
+     */
+    void stop() {
+        mPool->join();
+    }
+
+    uint32 numPartitions() const {
+        return mPartitions.size();
+    }
+
+    uint32 partition(uint32 key) const {
+        return key % mPartitions.size();
+    }
+
+    /** Queue an item for the partition selected by key. Thread safe. */
+    void push(uint32 key, const Item& item) {
+        uint32 idx = partition(key);
+        Partition* part = mPartitions[idx];
+        bool schedule;
+        {
+            boost::lock_guard<boost::mutex> lck(part->mutex);
+            part->items.push_back(item);
+            schedule = !part->scheduled;
+            part->scheduled = true;
+        }
+        if (schedule)
+            schedulePartition(idx);
+    }
+
+    /** Run a callback on a partition's strand, serialized with its batches. */
+    void post(uint32 partition, const Network::IOCallback& cb, const char* tag = NULL) {
+        mPartitions[partition]->strand->post(cb, tag);
+    }
+
+    /** Remove all items that haven't been handled. Only safe once stop() has
+     *  returned.
+     */
+    void drain(Batch* items_out) {
+        for(uint32 i = 0; i < mPartitions.size(); i++) {
+            Partition* part = mPartitions[i];
+            boost::lock_guard<boost::mutex> lck(part->mutex);
+            items_out->insert(items_out->end(), part->items.begin(), part->items.end());
+            part->items.clear();
+            part->scheduled = false;
+        }
+    }
+
+private:
+    struct Partition {
+        Network::IOStrand* strand;
+        boost::mutex mutex;
+        std::deque<Item> items; // Protected by mutex
+        bool scheduled; // Protected by mutex, whether process is posted
+        Batch batch; // Only used on strand
+    };
+
+    void schedulePartition(uint32 idx) {
+        mPartitions[idx]->strand->post(
+            std::tr1::bind(&PartitionedStrandQueue::process, this, idx),
+            "PartitionedStrandQueue::process"
+        );
+    }
+
+    void process(uint32 idx) {
+        Partition* part = mPartitions[idx];
+
+        part->batch.clear();
+        {
+            boost::lock_guard<boost::mutex> lck(part->mutex);
+            while(!part->items.empty() && part->batch.size() < mMaxBatch) {
+                part->batch.push_back(part->items.front());
+                part->items.pop_front();
+            }
+        }
+
+        if (!part->batch.empty())
+            mHandler(idx, part->batch);
+
+        // Reschedule rather than looping so other partitions sharing the
+        // thread get a turn.
+        bool more;
+        {
+            boost::lock_guard<boost::mutex> lck(part->mutex);
+            more = !part->items.empty();
+            part->scheduled = more;
+        }
+        if (more)
+            schedulePartition(idx);
+    }
+
+    Network::IOServicePool* mPool;
+    std::vector<Partition*> mPartitions;
+    const uint32 mMaxBatch;
+    BatchHandler mHandler;
+}; // class PartitionedStrandQueue
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_QUEUE_PARTITIONED_STRAND_QUEUE_HPP_
@@ -0,0 +1,93 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_QUEUE_SPSC_QUEUE_HPP_
+#define _SIRIKATA_CORE_QUEUE_SPSC_QUEUE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+
+namespace Sirikata {
+
+/** A fixed capacity, lock-free ring buffer for exactly one producer thread and
+ *  exactly one consumer thread. push() may only be called by the producer and
+ *  pop() only by the consumer; neither ever blocks, push() fails when the ring
+ *  is full and pop() fails when it is empty. T should be cheap to copy --
+ *  normally it is a pointer.
+ */
+template <typename T>
+class SPSCQueue : Noncopyable {
+public:
+    explicit SPSCQueue(uint32 capacity)
+     : mSize(capacity+1),
+       mItems(new T[capacity+1]),
+       mHead(0),
+       mTail(0)
+    {
+    }
+
+    ~SPSCQueue() {
+        delete[] mItems;
+    }
+
+    uint32 capacity() const {
+        return mSize - 1;
+    }
+
+    /** Push an item. Producer only.
+     *  \returns false if the queue was full and the item was not added.
+     */
+    bool push(const T& value) {
+        uint32 tail = mTail;
+        uint32 next = increment(tail);
+        if (next == mHead)
+            return false;
+        mItems[tail] = value;
+        // The item must be visible before the consumer can see the new tail.
+        memory_barrier();
+        mTail = next;
+        return true;
+    }
+
+    /** Pop an item. Consumer only.
+     *  \returns false if the queue was empty and value was not modified.
+     */
+    bool pop(T& value) {
+        uint32 head = mHead;
+        if (head == mTail)
+            return false;
+        memory_barrier();
+        value = mItems[head];
+        // Finish reading the slot before handing it back to the producer.
+        memory_barrier();
+        mHead = increment(head);
+        return true;
+    }
+
+    /** Check if the queue is empty. Only a hint when called from the producer
+     *  since the consumer may be popping concurrently.
+     */
+    bool probablyEmpty() const {
+        return mHead == mTail;
+    }
+
+private:
+    uint32 increment(uint32 idx) const {
+        return (idx + 1 == mSize) ? 0 : idx + 1;
+    }
+
+    const uint32 mSize;
+    T* mItems;
+    // Head and tail are written by different threads, keep them on separate
+    // cache lines.
+    char mPad0[64];
+    volatile uint32 mHead;
+    char mPad1[64];
+    volatile uint32 mTail;
+    char mPad2[64];
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_QUEUE_SPSC_QUEUE_HPP_
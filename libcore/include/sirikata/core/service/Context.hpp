@@ -41,6 +41,7 @@
 #include "TimeProfiler.hpp"
 #include "Service.hpp"
 #include "Signal.hpp"
+#include "Poller.hpp"
 #include <sirikata/core/trace/TimeSeries.hpp>
 
 #define FORCE_MONOTONIC_CLOCK 1
@@ -191,6 +192,9 @@ protected:
     // Signal handling
     void handleSignal(Signal::Type stype);
 
+    // Report IOService stats to the TimeSeries
+    void reportEventLoopStats();
+
     Trace::Trace* mTrace;
     Command::Commander* mCommander;
 
@@ -208,6 +212,9 @@ protected:
 
     Signal::HandlerID mSignalHandler;
 
+    // Only created if IOService stats are enabled and there's a TimeSeries
+    Poller* mEventLoopStatsPoller;
+
     ExecutionThreads mExecutionThreadsType;
     typedef std::vector<Thread*> ThreadList;
     ThreadList mWorkerThreads;
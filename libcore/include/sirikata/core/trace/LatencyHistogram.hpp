@@ -0,0 +1,147 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRACE_LATENCY_HISTOGRAM_HPP_
+#define _SIRIKATA_CORE_TRACE_LATENCY_HISTOGRAM_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/Time.hpp>
+#include <limits>
+
+namespace Sirikata {
+namespace Trace {
+
+/** Histogram of latencies in microseconds with a fixed set of buckets, in the
+ *  style of HdrHistogram: each power of two is split into SUB_BUCKETS linear
+ *  buckets, so latencies from 1us to a couple of minutes are kept to within
+ *  25%. Adding a sample is a few shifts and increments and histograms can be
+ *  combined by adding up their buckets, so they can be kept per thread and
+ *  merged when they're read.
+ */
+class LatencyHistogram {
+public:
+    enum {
+        SUB_BUCKET_BITS = 2,
+        SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        // Latencies of 2^MAX_BITS us (about 2 minutes) or more all go in the
+        // last bucket
+        MAX_BITS = 27,
+        NUM_BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS
+    };
+
+    LatencyHistogram()
+     : mCount(0),
+       mTotal(0),
+       mMax(0)
+    {
+        for(uint32 i = 0; i < NUM_BUCKETS; i++)
+            mBuckets[i] = 0;
+    }
+
+    void add(uint64 us) {
+        mBuckets[bucketFor(us)]++;
+        mCount++;
+        mTotal += us;
+        if (us > mMax) mMax = us;
+    }
+    void add(const Duration& latency) {
+        int64 us = latency.toMicro();
+        add(us > 0 ? (uint64)us : 0);
+    }
+
+    /** Add other's samples to this one. */
+    void merge(const LatencyHistogram& other) {
+        for(uint32 i = 0; i < NUM_BUCKETS; i++)
+            mBuckets[i] += other.mBuckets[i];
+        mCount += other.mCount;
+        mTotal += other.mTotal;
+        if (other.mMax > mMax) mMax = other.mMax;
+    }
+
+    /** Remove the samples in earlier, which must have been a copy of this
+     *  histogram taken before the most recent samples were added, leaving
+     *  only the most recent samples. The exact maximum of those isn't known,
+     *  so it's replaced by the upper end of the highest bucket left (or the
+     *  lower end of the last one, which has no upper end).
+     */
+    void subtract(const LatencyHistogram& earlier) {
+        mMax = 0;
+        for(uint32 i = 0; i < NUM_BUCKETS; i++) {
+            mBuckets[i] = (mBuckets[i] > earlier.mBuckets[i] ? mBuckets[i] - earlier.mBuckets[i] : 0);
+            if (mBuckets[i] > 0)
+                mMax = (i == NUM_BUCKETS - 1 ? bucketLower(i) : bucketUpper(i));
+        }
+        mCount = (mCount > earlier.mCount ? mCount - earlier.mCount : 0);
+        mTotal = (mTotal > earlier.mTotal ? mTotal - earlier.mTotal : 0);
+    }
+
+    uint64 count() const { return mCount; }
+    uint64 bucket(uint32 i) const { return mBuckets[i]; }
+
+    Duration mean() const {
+        if (mCount == 0) return Duration::zero();
+        return Duration::microseconds((int64)(mTotal / mCount));
+    }
+    Duration max() const {
+        return Duration::microseconds((int64)mMax);
+    }
+    /** Get an upper bound on the given percentile (0-1), i.e. the upper end of
+     *  the bucket it falls in.
+     */
+    Duration percentile(float64 p) const {
+        uint64 target = (uint64)(p * mCount + 0.5);
+        if (target == 0) target = 1;
+        uint64 cumulative = 0;
+        for(uint32 i = 0; i < NUM_BUCKETS; i++) {
+            cumulative += mBuckets[i];
+            if (cumulative >= target)
+                return Duration::microseconds((int64)std::min(bucketUpper(i), mMax));
+        }
+        return max();
+    }
+
+    static uint32 bucketFor(uint64 us) {
+        if (us < SUB_BUCKETS)
+            return (uint32)us;
+        uint32 msb = highestBit(us);
+        if (msb >= MAX_BITS)
+            return NUM_BUCKETS - 1;
+        return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+            (uint32)((us >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    }
+    /** Smallest latency counted in bucket i. */
+    static uint64 bucketLower(uint32 i) {
+        if (i < SUB_BUCKETS)
+            return i;
+        uint32 major = i / SUB_BUCKETS, sub = i % SUB_BUCKETS;
+        return (uint64)(SUB_BUCKETS + sub) << (major - 1);
+    }
+    /** Largest latency counted in bucket i. */
+    static uint64 bucketUpper(uint32 i) {
+        if (i == NUM_BUCKETS - 1)
+            return std::numeric_limits<uint64>::max();
+        return bucketLower(i + 1) - 1;
+    }
+
+private:
+    static uint32 highestBit(uint64 v) {
+#if defined(__GNUC__)
+        return 63 - __builtin_clzll(v);
+#else
+        uint32 result = 0;
+        while (v >>= 1) result++;
+        return result;
+#endif
+    }
+
+    uint64 mBuckets[NUM_BUCKETS];
+    uint64 mCount;
+    uint64 mTotal;
+    uint64 mMax;
+}; // class LatencyHistogram
+
+} // namespace Trace
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_TRACE_LATENCY_HISTOGRAM_HPP_
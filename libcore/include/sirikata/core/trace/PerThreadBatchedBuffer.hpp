@@ -0,0 +1,101 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRACE_PER_THREAD_BATCHED_BUFFER_HPP_
+#define _SIRIKATA_CORE_TRACE_PER_THREAD_BATCHED_BUFFER_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <sirikata/core/trace/BatchedBuffer.hpp>
+#include <sirikata/core/queue/SPSCQueue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace Sirikata {
+
+/** PerThreadBatchedBuffer is a drop in replacement for BatchedBuffer which
+ *  avoids a shared lock on the write path. Each writing thread gets its own
+ *  set of pre-allocated batches which it fills and hands to the (single)
+ *  storing thread through a lock-free SPSC ring; the storing thread hands
+ *  empty batches back through a second ring.
+ *
+ *  Unlike BatchedBuffer, a record written with a single call to write() is
+ *  never split across batches, so the output file remains a valid sequence of
+ *  records even though batches from different threads are interleaved.
+ *  Records are ordered per thread, not globally.
+ *
+ *  If a thread produces data faster than it is stored it will run out of
+ *  empty batches. Rather than blocking or allocating, the record is dropped
+ *  and counted -- see dropped().
+ */
+class SIRIKATA_EXPORT PerThreadBatchedBuffer : Noncopyable {
+public:
+    typedef BatchedBuffer::IOVec IOVec;
+
+    /** Create a buffer which allocates batches_per_thread batches (64KB each)
+     *  to each thread that writes to it.
+     */
+    PerThreadBatchedBuffer(uint32 batches_per_thread = 16);
+    ~PerThreadBatchedBuffer();
+
+    /** Write a single record made up of the given pieces. Safe to call from
+     *  any number of threads concurrently.
+     */
+    void write(const IOVec* iov, uint32 iovcnt);
+
+    /** Make partially filled batches from all threads available to
+     *  store(). This can only be called once writers have stopped, e.g. during
+     *  shutdown.
+     */
+    void flush();
+
+    /** Write all completed batches to the file. Only one thread may call
+     *  store() at a time.
+     */
+    void store(FILE* os);
+
+    bool empty();
+
+    /** Total number of records dropped because a writer ran out of batches or
+     *  a record was too large to fit in a single batch.
+     */
+    uint64 dropped();
+
+private:
+    typedef Batch<uint8> ByteBatch;
+
+    // The per-thread state. Only the owning thread touches filling and pushes
+    // to full/pops from free; only the storing thread pops from full and pushes
+    // to free.
+    struct ThreadBuffer {
+        ThreadBuffer(uint32 nbatches);
+        ~ThreadBuffer();
+
+        ByteBatch* filling;
+        SPSCQueue<ByteBatch*> full;
+        SPSCQueue<ByteBatch*> free;
+        AtomicValue<uint64> dropped;
+    };
+    typedef std::vector<ThreadBuffer*> ThreadBufferList;
+
+    ThreadBuffer* getThreadBuffer();
+    // thread_specific_ptr cleanup, the buffers are owned by mThreadBuffers
+    static void noopCleanup(ThreadBuffer* tb) {}
+
+    void storeBatch(FILE* os, ThreadBuffer* owner, ByteBatch* bb);
+
+    const uint32 mBatchesPerThread;
+    boost::thread_specific_ptr<ThreadBuffer> mLocalBuffer;
+
+    // Protects registration of new threads and the flushed list
+    boost::mutex mMutex;
+    ThreadBufferList mThreadBuffers;
+    // Partial batches published by flush(), with the buffer they belong to
+    typedef std::deque< std::pair<ThreadBuffer*, ByteBatch*> > FlushedBatchList;
+    FlushedBatchList mFlushed;
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_TRACE_PER_THREAD_BATCHED_BUFFER_HPP_
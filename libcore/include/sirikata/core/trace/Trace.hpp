@@ -38,6 +38,7 @@
 #include <sirikata/core/util/AtomicTypes.hpp>
 #include <sirikata/core/network/ObjectMessage.hpp>
 #include <sirikata/core/trace/BatchedBuffer.hpp>
+#include <sirikata/core/trace/PerThreadBatchedBuffer.hpp>
 
 namespace Sirikata {
 namespace Trace {
@@ -55,6 +56,8 @@ struct Drops {
         DROPPED_AT_SPACE_ENQUEUED,
         DROPPED_CSFQ_OVERFLOW,
         DROPPED_CSFQ_PROBABILISTIC,
+        TRACE_RECORDS_DROPPED,
+        DROPPED_AT_OSEG_LOOKUP_QUEUE,
         NUM_DROPS
     };
     uint64 d[NUM_DROPS];
@@ -216,7 +219,14 @@ private:
     // Thread which flushes data to disk periodically
     void storageThread(const String& filename);
 
+    // Helpers which dispatch to whichever buffer is in use
+    bool dataEmpty();
+    void storeData(FILE* of);
+
+    // Only one of these is used. If mThreadData is non-NULL, records go to
+    // per-thread buffers, otherwise they go to the shared, locked buffer.
     BatchedBuffer data;
+    PerThreadBatchedBuffer* mThreadData;
     bool mShuttingDown;
 
     Thread* mStorageThread;
@@ -224,6 +234,9 @@ private:
 
     // OptionValues that turn tracing on/off
     static OptionValue* mLogMessage;
+    // OptionValues that select and configure the buffer implementation
+    static OptionValue* mBufferType;
+    static OptionValue* mBufferBatchesPerThread;
 }; // class Trace
 
 } // namespace Trace
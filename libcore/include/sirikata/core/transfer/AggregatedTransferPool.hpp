@@ -100,6 +100,7 @@ public:
         // we'll definitely need to recompute the
         setRequestClientID(it->second.aggregateRequest);
         setRequestPriority(it->second.aggregateRequest, mAggregationAlgorithm->aggregate(it->second.inputRequests));
+        it->second.aggregateRequest->setDeadline(earliestDeadline(it->second.inputRequests));
 
         mDeltaQueue.push(it->second.aggregateRequest);
     }
@@ -157,6 +158,7 @@ public:
         else {
             // Otherwise, update priority
             setRequestPriority(it->second.aggregateRequest, mAggregationAlgorithm->aggregate(it->second.inputRequests));
+            it->second.aggregateRequest->setDeadline(earliestDeadline(it->second.inputRequests));
             mDeltaQueue.push(it->second.aggregateRequest);
         }
 
@@ -180,6 +182,18 @@ private:
         return retval;
     }
 
+    // The aggregate has to be done by the earliest time any of the input
+    // requests need it by
+    static Time earliestDeadline(const std::vector<TransferRequestPtr>& reqs) {
+        Time result = Time::null();
+        for(std::vector<TransferRequestPtr>::const_iterator it = reqs.begin(); it != reqs.end(); it++) {
+            const Time& deadline = (*it)->getDeadline();
+            if (deadline != Time::null() && (result == Time::null() || deadline < result))
+                result = deadline;
+        }
+        return result;
+    }
+
 
     // Handle metadata callback, sending data to callbacks
     void handleMetadata(const String input_identifier, MetadataRequestPtr req, RemoteFileMetadataPtr response) {
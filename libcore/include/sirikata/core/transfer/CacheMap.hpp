@@ -38,6 +38,7 @@
 #include "CacheLayer.hpp"
 #include <boost/thread.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <sirikata/core/util/Platform.hpp>
 
 namespace Sirikata {
 namespace Transfer {
@@ -45,6 +46,19 @@ namespace Transfer {
 /**
  * Handles locking, and also stores a map that can be used
  * both by the CachePolicy, and by the CacheLayer.
+ *
+ * The map is split into shards by Fingerprint, each with its own lock, so
+ * lookups of different entries don't contend with each other. Iterators only
+ * ever lock the shard holding the entry they are positioned on, moving the
+ * lock as they move between entries. Calls to the CachePolicy are serialized
+ * by a separate lock which is only held for the duration of each call.
+ *
+ * Since every cache hit marks its entry as used, taking the policy lock for
+ * each one would serialize hits again. Instead read_iterator::use() queues the
+ * use in the entry's shard, and queued uses are passed on to the policy in
+ * batches, whenever the policy lock is free, before an entry in the shard is
+ * erased, and before choosing entries to evict. The policy may see uses a
+ * little late, but never for an entry that has already been destroyed.
  */
 class CacheMap : Noncopyable {
 public:
@@ -53,52 +67,157 @@ public:
 	class read_iterator;
 	class write_iterator;
 
+	static const uint32 DEFAULT_SHARDS = 16;
+
 private:
 	typedef CachePolicy::Data *PolicyData;
 	typedef std::pair<CacheData, std::pair<PolicyData, cache_usize_type> > MapEntry;
-	typedef std::map<Fingerprint, MapEntry> MapClass;
+	typedef std::tr1::unordered_map<Fingerprint, MapEntry, Fingerprint::Hasher> MapClass;
 
-	MapClass mMap;
-	boost::shared_mutex mMapLock;
+	// Uses are passed on once this many are queued, if the policy isn't busy,
+	// and always once there are MAX_PENDING_USES.
+	static const uint32 PENDING_USE_BATCH = 32;
+	static const uint32 MAX_PENDING_USES = 256;
+
+	struct PendingUse {
+		Fingerprint id;
+		PolicyData data;
+		cache_usize_type size;
+	};
+
+	struct Shard {
+		MapClass mMap;
+		boost::shared_mutex mLock;
+		// Readers only hold mLock shared, so queueing uses needs its own lock.
+		boost::mutex mPendingLock;
+		std::vector<PendingUse> mPendingUses;
+	};
+	std::vector<Shard*> mShards;
 
 	CacheLayer *mOwner;
 	CachePolicy *mPolicy;
+	boost::mutex mPolicyLock;
+
+	// Must be called with both mPendingLock and mPolicyLock held
+	void applyPendingUses(Shard *shard) {
+		for (std::vector<PendingUse>::iterator iter = shard->mPendingUses.begin();
+				iter != shard->mPendingUses.end(); ++iter) {
+			mPolicy->use(iter->id, iter->data, iter->size);
+		}
+		shard->mPendingUses.clear();
+	}
+
+	void queueUse(Shard *shard, const Fingerprint &id, PolicyData data, cache_usize_type size) {
+		boost::lock_guard<boost::mutex> pendingLock(shard->mPendingLock);
+		PendingUse use;
+		use.id = id;
+		use.data = data;
+		use.size = size;
+		shard->mPendingUses.push_back(use);
+		if (shard->mPendingUses.size() >= MAX_PENDING_USES) {
+			boost::lock_guard<boost::mutex> policyLock(mPolicyLock);
+			applyPendingUses(shard);
+		} else if (shard->mPendingUses.size() >= PENDING_USE_BATCH) {
+			boost::unique_lock<boost::mutex> policyLock(mPolicyLock, boost::try_to_lock);
+			if (policyLock.owns_lock()) {
+				applyPendingUses(shard);
+			}
+		}
+	}
+
+	// Must be called before any of the shard's entries are destroyed. Queued
+	// uses are always for entries still in the map, since erasing one needs
+	// the shard locked exclusively and calls this first.
+	void flushPendingUses(Shard *shard) {
+		boost::lock_guard<boost::mutex> pendingLock(shard->mPendingLock);
+		if (shard->mPendingUses.empty()) {
+			return;
+		}
+		boost::lock_guard<boost::mutex> policyLock(mPolicyLock);
+		applyPendingUses(shard);
+	}
 
 	inline void destroyCacheLayerEntry(const Fingerprint &id, const CacheData &data, cache_usize_type size) {
 		mOwner->destroyCacheEntry(id, data, size);
 	}
 
+	inline uint32 shardIndex(const Fingerprint &id) const {
+		// Fingerprint::Hasher uses the first bytes, which also pick the
+		// buckets within the shard, so use a different one here.
+		return id.rawData()[sizeof(size_t)] % mShards.size();
+	}
+
 public:
-	CacheMap(CacheLayer *owner, CachePolicy *policy) :
+	CacheMap(CacheLayer *owner, CachePolicy *policy, uint32 numShards = DEFAULT_SHARDS) :
 		mOwner(owner), mPolicy(policy) {
+		mShards.resize(std::max(numShards, (uint32)1));
+		for (uint32 i = 0; i < mShards.size(); ++i) {
+			mShards[i] = new Shard();
+		}
 	}
     void setOwner(CacheLayer *owner) {//if you can't afford to initialize in initializer list
         mOwner=owner;
     }
 
 	~CacheMap() {
-		write_iterator clearIterator(*this);
-		clearIterator.eraseAll();
+		{
+			write_iterator clearIterator(*this);
+			clearIterator.eraseAll();
+		}
+		for (uint32 i = 0; i < mShards.size(); ++i) {
+			delete mShards[i];
+		}
 	}
 
 	/**
-	 * Allocates the requested number of bytes, and erases the
-	 * appropriate set of entries using CachePolicy::allocateSpace().
+	 * Allocates the requested number of bytes for id, and erases the
+	 * appropriate set of entries using CachePolicy::nextItem(). If
+	 * id isn't already in the map, the policy must also admit it.
 	 *
+	 * @param id        The Fingerprint space is being allocated for.
 	 * @param required  The space required for the new entry.
-         * @param writer    Write iterator used to process deletions.
+         * @param writer    Write iterator used to process deletions. It
+         *                  is left at an unspecified position.
 	 * @returns         if the allocation was successful,
 	 *                  or false if the entry is not to be cached.
 	 */
-	inline bool alloc(cache_usize_type required, write_iterator &writer) {
-		bool cachable = mPolicy->cachable(required);
-		if (!cachable) {
-			return false;
+	inline bool alloc(const Fingerprint &id, cache_usize_type required, write_iterator &writer) {
+		bool exists = writer.find(id);
+		for (uint32 i = 0; i < mShards.size(); ++i) {
+			flushPendingUses(mShards[i]);
 		}
-		Fingerprint toDelete;
-		while (mPolicy->nextItem(required, toDelete)) {
-			writer.find(toDelete);
-			writer.erase();
+		{
+			boost::lock_guard<boost::mutex> lock(mPolicyLock);
+			if (!mPolicy->cachable(required)) {
+				return false;
+			}
+			if (!exists && !mPolicy->admit(id, required)) {
+				return false;
+			}
+		}
+		Fingerprint toDelete, lastMissing;
+		bool missing = false;
+		while (true) {
+			{
+				boost::lock_guard<boost::mutex> lock(mPolicyLock);
+				if (!mPolicy->nextItem(required, toDelete)) {
+					break;
+				}
+			}
+			if (writer.find(toDelete)) {
+				writer.erase();
+				missing = false;
+			} else {
+				// Another thread erased it first, so the policy will pick
+				// something else next time. If it doesn't, the policy and
+				// map disagree, and we'd never make progress.
+				if (missing && lastMissing == toDelete) {
+					SILOG(transfer,error,"[CacheMap] Policy chose missing entry " << toDelete << " to evict");
+					return false;
+				}
+				missing = true;
+				lastMissing = toDelete;
+			}
 		}
 		return true;
 	}
@@ -106,37 +225,57 @@ public:
 	/**
 	 * A read-only iterator.  Not const because the LRU use-count
 	 * is allowed to be updated, even though the CacheLayer cannot
-	 * be changed.  A read_iterator locks the map using a
-	 * boost::shared_lock.  This means that any number of read_iterator
-	 * objects are allowed access at the same time, except when
-	 * a write_iterator is in use.
+	 * be changed.  A read_iterator locks the shard it is positioned
+	 * on using a boost::shared_lock.  This means that any number of
+	 * read_iterator objects are allowed access at the same time, except
+	 * when a write_iterator is positioned in the same shard.
 	 */
 	class read_iterator {
 		CacheMap *mCachemap;
 		boost::shared_lock<boost::shared_mutex> mLock;
 
-		MapClass *mMap;
+		Shard *mShard;
+		uint32 mShardIndex;
 		MapClass::iterator mIter;
 
+		void moveTo(uint32 index) {
+			if (mShard == mCachemap->mShards[index]) {
+				return;
+			}
+			// Never hold two shard locks at once, or two iterators
+			// moving in opposite directions could deadlock.
+			if (mLock.owns_lock()) {
+				mLock.unlock();
+			}
+			mShardIndex = index;
+			mShard = mCachemap->mShards[index];
+			boost::shared_lock<boost::shared_mutex> newLock(mShard->mLock);
+			mLock.swap(newLock);
+		}
+
 	public:
-		/// Construct from a CacheMap (contains a scoped read lock)
+		/// Construct from a CacheMap (locks shards as they are visited)
 		read_iterator(CacheMap &m)
-			: mCachemap(&m), mLock(m.mMapLock),
-			mMap(&m.mMap), mIter(m.mMap.end()) {
+			: mCachemap(&m), mShard(NULL), mShardIndex(0) {
 		}
 
 		/// @returns   if this iterator can be dereferenced.
 		inline operator bool () const{
-			return (mIter != mMap->end());
+			return (mShard != NULL && mIter != mShard->mMap.end());
 		}
 
 		inline bool iterate () {
-			if (mIter == mMap->end()) {
-				mIter = mMap->begin();
-			} else {
+			if (mShard == NULL) {
+				moveTo(0);
+				mIter = mShard->mMap.begin();
+			} else if (mIter != mShard->mMap.end()) {
 				++mIter;
 			}
-			return (mIter != mMap->end());
+			while (mIter == mShard->mMap.end() && mShardIndex + 1 < mCachemap->mShards.size()) {
+				moveTo(mShardIndex + 1);
+				mIter = mShard->mMap.begin();
+			}
+			return (bool)*this;
 		}
 
 		/** Moves this iterator to id.
@@ -144,7 +283,8 @@ public:
 		 * @returns   if the find was successful.
 		 */
 		inline bool find(const Fingerprint &id) {
-			mIter = mMap->find(id);
+			moveTo(mCachemap->shardIndex(id));
+			mIter = mShard->mMap.find(id);
 			return (bool)*this;
 		}
 
@@ -168,37 +308,49 @@ public:
 			return (*mIter).second.second.first;
 		}
 
-		/// Sets the use bit in the corresponding cache policy.
+		/// Sets the use bit in the corresponding cache policy, which may
+		/// happen after a short delay.
 		inline void use() {
-			mCachemap->mPolicy->use(getId(), getPolicyInfo(), getSize());
+			mCachemap->queueUse(mShard, getId(), getPolicyInfo(), getSize());
 		}
 	};
 
 	/**
 	 * A read-write iterator.  Also contains insert() and erase()
 	 * functions which also interact with the appropriate CachePolicy.
-	 * The write_iterator aassumes exclusive ownership of the map.
-	 * Since creating two write_iterators at once causes deadlock,
-	 * make sure to call the alloc() function that takes a write_iterator
-	 * argument if you already own one.
+	 * The write_iterator assumes exclusive ownership of the shard it
+	 * is positioned on, and only ever holds one shard's lock, so any
+	 * number of them may exist at once, even in the same thread, as
+	 * long as they are positioned in different shards.
 	 */
 	class write_iterator : Noncopyable {
 		CacheMap *mCachemap;
 		boost::unique_lock<boost::shared_mutex> mLock;
 
-		MapClass *mMap;
+		Shard *mShard;
 		MapClass::iterator mIter;
 
+		void moveTo(uint32 index) {
+			if (mShard == mCachemap->mShards[index]) {
+				return;
+			}
+			if (mLock.owns_lock()) {
+				mLock.unlock();
+			}
+			mShard = mCachemap->mShards[index];
+			boost::unique_lock<boost::shared_mutex> newLock(mShard->mLock);
+			mLock.swap(newLock);
+		}
+
 	public:
-		/// Construct from a CacheMap (contains a scoped write lock)
+		/// Construct from a CacheMap (locks shards as they are visited)
 		write_iterator(CacheMap &m)
-			: mCachemap(&m), mLock(m.mMapLock),
-			mMap(&m.mMap), mIter(m.mMap.end()) {
+			: mCachemap(&m), mShard(NULL) {
 		}
 
 		/// @returns   if this iterator can be dereferenced.
 		inline operator bool () const{
-			return (mIter != mMap->end());
+			return (mShard != NULL && mIter != mShard->mMap.end());
 		}
 
 		/** Moves this iterator to id.
@@ -206,7 +358,8 @@ public:
 		 * @returns   if the find was successful.
 		 */
 		bool find(const Fingerprint &id) {
-			mIter = mMap->find(id);
+			moveTo(mCachemap->shardIndex(id));
+			mIter = mShard->mMap.find(id);
 			return (bool)*this;
 		}
 
@@ -232,6 +385,7 @@ public:
 
 		/// Sets the use bit in the corresponding cache policy.
 		inline void use() {
+			boost::lock_guard<boost::mutex> lock(mCachemap->mPolicyLock);
 			mCachemap->mPolicy->use(getId(), getPolicyInfo(), getSize());
 		}
 
@@ -244,6 +398,7 @@ public:
 		inline void update(cache_usize_type newSize) {
 			cache_usize_type oldSize = getSize();
 			(*mIter).second.second.second = newSize;
+			boost::lock_guard<boost::mutex> lock(mCachemap->mPolicyLock);
 			mCachemap->mPolicy->useAndUpdate(getId(),
 					getPolicyInfo(), oldSize, newSize);
 		}
@@ -252,25 +407,37 @@ public:
 		 * Erases the current iterator.  Note that this iterator is
 		 * invalidated at the point you erase it.
 		 *
-s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
+		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 */
 		void erase() {
-			mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+			mCachemap->flushPendingUses(mShard);
+			{
+				boost::lock_guard<boost::mutex> lock(mCachemap->mPolicyLock);
+				mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+			}
 			mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
-			mMap->erase(mIter);
-			mIter = mMap->end();
+			mShard->mMap.erase(mIter);
+			mIter = mShard->mMap.end();
 		}
 
 		/** Iterates through the whole map, destroy()ing everything.  Note that the
 		 * write_iterator contains no iterate() method because it is generally not safe.
 		 */
 		void eraseAll() {
-			for (mIter = mMap->begin(); mIter != mMap->end(); ++mIter) {
-				mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
-				mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
+			for (uint32 i = 0; i < mCachemap->mShards.size(); ++i) {
+				moveTo(i);
+				mCachemap->flushPendingUses(mShard);
+				MapClass &map = mShard->mMap;
+				for (mIter = map.begin(); mIter != map.end(); ++mIter) {
+					{
+						boost::lock_guard<boost::mutex> lock(mCachemap->mPolicyLock);
+						mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+					}
+					mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
+				}
+				map.clear();
+				mIter = map.end();
 			}
-			mMap->clear();
-			mIter = mMap->end();
 		}
 
 		/**
@@ -286,12 +453,14 @@ s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 * @returns       If this element was actually inserted.
 		 */
 		bool insert(const Fingerprint &id, cache_usize_type size) {
+			moveTo(mCachemap->shardIndex(id));
 			std::pair<MapClass::iterator, bool> ins=
-				mMap->insert(MapClass::value_type(id,
+				mShard->mMap.insert(MapClass::value_type(id,
 						MapEntry(CacheData(), std::pair<PolicyData, cache_usize_type>(PolicyData(), size))));
 			mIter = ins.first;
 
 			if (ins.second) {
+				boost::lock_guard<boost::mutex> lock(mCachemap->mPolicyLock);
 				(*mIter).second.second.first = mCachemap->mPolicy->create(id, size);
 			}
 			return ins.second;
@@ -35,6 +35,7 @@
 #define SIRIKATA_CachePolicy_HPP__
 
 #include <sirikata/core/transfer/Defs.hpp>
+#include <sirikata/core/transfer/Range.hpp>
 
 namespace Sirikata {
 namespace Transfer {
@@ -45,7 +46,13 @@ static const cache_usize_type mebibyte = 0x100000,        megabyte = 1000000;
 static const cache_usize_type kibibyte = 0x400,           kilobyte = 1000;
 static const cache_usize_type byte     = 1;
 
-/// Critical to the functioning of CacheLayer--makes decisions which pieces of data to keep and which to throw out.
+/**
+ * Critical to the functioning of CacheLayer--makes decisions which pieces of data to keep and which to throw out.
+ *
+ * Policies don't need to be thread safe: CacheMap serializes all calls to its
+ * policy. Since those calls are made while holding locks on the map, they
+ * should all take constant time.
+ */
 class CachePolicy {
 
 protected:
@@ -143,6 +150,28 @@ public:
 		return true;
 	}
 
+	/**
+	 *  Decides whether a new entry should be cached at all, once it is known
+	 *  to be cachable. Policies which track how popular entries are can use
+	 *  this to refuse entries less likely to be used again than the ones
+	 *  they would replace.
+	 *
+	 *  @param id             the Fingerprint of the new entry
+	 *  @param requiredSpace  the amount of space the new entry needs
+	 *  @returns              whether space should be made for the entry
+	 */
+	virtual bool admit(const Fingerprint &id, cache_usize_type requiredSpace) {
+		return true;
+	}
+
+	/**
+	 *  Chooses the next entry to evict to make room for a new one. The entry
+	 *  isn't removed until destroy() is called for it.
+	 *
+	 *  @param requiredSpace  the amount of space needed
+	 *  @param myprint        set to the entry to evict
+	 *  @returns              false if enough space is already free
+	 */
 	virtual bool nextItem(cache_usize_type requiredSpace, Fingerprint &myprint) = 0;
 };
 
@@ -0,0 +1,100 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRANSFER_CLOCK_PRO_POLICY_HPP_
+#define _SIRIKATA_CORE_TRANSFER_CLOCK_PRO_POLICY_HPP_
+
+#include "CachePolicy.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * CLOCK-Pro (Jiang, Chen and Zhang, USENIX 2005), measured in bytes rather than
+ * pages. Entries are hot or cold; a cold entry which is used again shortly
+ * after being added (during its "test period") becomes hot, and only cold
+ * entries are evicted. Entries evicted during their test period are remembered
+ * as non-resident ghosts so that being requested again soon afterwards still
+ * counts, and the amount of the cache given to cold entries adapts to how often
+ * that happens.
+ *
+ * Like CLOCK, use() only sets a reference bit, so hits are cheap. The clock
+ * hands do the rest of the work when making space, amortized constant time per
+ * eviction.
+ */
+class SIRIKATA_EXPORT ClockProPolicy : public CachePolicy {
+public:
+	ClockProPolicy(cache_usize_type allocatedSpace, float maxSizePct=0.5);
+	virtual ~ClockProPolicy();
+
+	virtual void use(const Fingerprint &id, Data* data, cache_usize_type size);
+	virtual void useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize);
+	virtual void destroy(const Fingerprint &id, Data* data, cache_usize_type size);
+	virtual Data* create(const Fingerprint &id, cache_usize_type size);
+	virtual bool nextItem(cache_usize_type requiredSpace, Fingerprint &myprint);
+
+private:
+	enum State {
+		HOT,
+		COLD,
+		GHOST // Non-resident cold entry, still in its test period
+	};
+
+	struct ClockEntry {
+		Fingerprint id;
+		cache_usize_type size;
+		State state;
+		bool referenced;
+		bool testing;
+	};
+	typedef std::list<ClockEntry> Clock;
+
+	struct ClockData : public Data {
+		Clock::iterator mIter;
+
+		ClockData(const Clock::iterator &copyIter)
+			: mIter(copyIter) {
+		}
+	};
+
+	typedef std::tr1::unordered_map<Fingerprint, Clock::iterator, Fingerprint::Hasher> GhostMap;
+
+	Clock::iterator next(Clock::iterator it);
+	// Insert a new entry at the head of the clock, the last place each hand
+	// will reach
+	Clock::iterator insert(const ClockEntry &entry);
+	// Remove an entry from the clock, moving any hands pointing at it along
+	void erase(Clock::iterator it);
+	void removeGhost(Clock::iterator it);
+
+	// Run the hot hand until the hot entries fit in their share of the cache
+	void balanceHot();
+	void runHandHot();
+	// Run the test hand until the ghosts fit in the cache's size
+	void trimGhosts();
+	void runHandTest();
+
+	void growColdTarget(cache_usize_type size);
+	void shrinkColdTarget(cache_usize_type size);
+
+	Clock mClock;
+	Clock::iterator mHandHot;
+	Clock::iterator mHandCold;
+	Clock::iterator mHandTest;
+
+	GhostMap mGhosts;
+
+	cache_usize_type mHotSize;
+	cache_usize_type mColdSize;
+	cache_usize_type mGhostSize;
+	// Amount of the cache cold entries should get, adapted as ghosts are hit
+	// or expire
+	cache_usize_type mColdTarget;
+	cache_usize_type mMinColdTarget;
+};
+
+}
+}
+
+#endif //_SIRIKATA_CORE_TRANSFER_CLOCK_PRO_POLICY_HPP_
@@ -46,9 +46,9 @@
 #ifdef check
 #undef check
 #endif
-#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
-#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
 #include <sirikata/core/network/IOServicePool.hpp>
 #include <sirikata/core/network/IOWork.hpp>
 #include <sirikata/core/network/Asio.hpp>
@@ -153,6 +153,8 @@ public:
      *
      * Note that getContentLength might not be a valid value. If there was no
      * content length header in the response, getContentLength is undefined.
+     * For compressed responses it is the decompressed length once the
+     * response is complete.
      */
     class HttpResponse {
     protected:
@@ -162,10 +164,6 @@ public:
         LAST_HEADER_CB mLastCallback;
         bool mHeaderComplete;
         bool mMessageComplete;
-        http_parser_settings mHttpSettings;
-        http_parser mHttpParser;
-        bool mGzip;
-        std::stringstream mCompressedStream;
         //
 
         Headers mHeaders;
@@ -175,7 +173,7 @@ public:
 
         HttpResponse()
             : mLastCallback(NONE), mHeaderComplete(false), mMessageComplete(false),
-              mGzip(false), mContentLength(0), mStatusCode(0) {}
+              mContentLength(0), mStatusCode(0) {}
     public:
         inline std::tr1::shared_ptr<DenseData> getData() { return mData; }
         inline const Headers& getHeaders() { return mHeaders; }
@@ -212,6 +210,48 @@ public:
                 const boost::system::error_code& boost_error
             )> HttpCallback;
 
+    /*
+     * Callback for pieces of a response body as they arrive, already
+     * decompressed, so the body can be processed before all of it has
+     * arrived. Pieces are delivered in order, before the HttpCallback for the
+     * same response, and data is only valid during the call. The whole body is
+     * still available from the response passed to the HttpCallback. Bodies of
+     * redirects which are being followed aren't delivered.
+     */
+    typedef std::tr1::function<void(
+                std::tr1::shared_ptr<HttpResponse> response,
+                const unsigned char* data,
+                size_t length
+            )> HttpBodyCallback;
+
+    /*
+     * Counts of how connections have been used, for checking that keep-alive
+     * and pipelining are effective.
+     */
+    struct Stats {
+        Stats()
+         : connectionsOpened(0), requestsSent(0), requestsReusingConnection(0),
+           requestsPipelined(0), requestsRetried(0), staleConnections(0),
+           bodyBytesReceived(0), bodyBytesDecoded(0) {}
+
+        // New connections made
+        uint64 connectionsOpened;
+        // Requests written to a connection, including retries
+        uint64 requestsSent;
+        // Requests sent on a connection which had already been used
+        uint64 requestsReusingConnection;
+        // Requests sent while others were still waiting for their responses
+        uint64 requestsPipelined;
+        // Requests sent again after their connection failed
+        uint64 requestsRetried;
+        // Kept-alive connections the server had closed by the time they were
+        // reused
+        uint64 staleConnections;
+        // Response body bytes as received, and after decompression
+        uint64 bodyBytesReceived;
+        uint64 bodyBytesDecoded;
+    };
+
     static HttpManager& getSingleton();
     static void destroy();
 
@@ -226,9 +266,11 @@ public:
     /** Makes an HTTP request and calls cb when finished. This is the lowest
      *  level version exposed publicly, taking a raw HTTP request, which you
      *  should ensure is properly formatted. Usually you should use the
-     *  convenience wrappers that format the request for you.
+     *  convenience wrappers that format the request for you. If body_cb is
+     *  set, it is passed the body as it arrives.
      */
-    void makeRequest(Sirikata::Network::Address addr, HTTP_METHOD method, std::string req, bool allow_redirects, HttpCallback cb);
+    void makeRequest(Sirikata::Network::Address addr, HTTP_METHOD method, std::string req, bool allow_redirects, HttpCallback cb,
+        HttpBodyCallback body_cb = HttpBodyCallback());
 
     /** Formats and makes an HTTP request and calls cb when finished. This
      *  version is a utility for the more specific request types (i.e. head()
@@ -246,13 +288,20 @@ public:
      *         probably include headers to specify it's format
      *  \param allow_redirects if true, redirects will be followed, triggering a
      *         new requests
+     *  \param body_cb if set, invoked with pieces of the response body as they
+     *         arrive
+     *
+     *  Unless headers specify otherwise, gzip and deflate compressed responses
+     *  are accepted, except for range requests, since the range would apply
+     *  to the compressed data.
      */
     void makeRequest(
         Sirikata::Network::Address addr, HTTP_METHOD method, const String& path,
         HttpCallback cb,
         const Headers& headers = Headers(), const QueryParameters& query_params = QueryParameters(),
         const String& body = "",
-        bool allow_redirects = true
+        bool allow_redirects = true,
+        HttpBodyCallback body_cb = HttpBodyCallback()
     );
 
     static String formatURLEncodedDictionary(const StringDictionary& query_params);
@@ -268,7 +317,7 @@ public:
     void get(
         Sirikata::Network::Address addr, const String& path,
         HttpCallback cb, const Headers& headers = Headers(), const QueryParameters& query_params = QueryParameters(),
-        bool allow_redirects = true
+        bool allow_redirects = true, HttpBodyCallback body_cb = HttpBodyCallback()
     );
 
     /** Perform an HTTP POST using the specified content type and message
@@ -298,6 +347,8 @@ public:
         bool allow_redirects = true
     );
 
+    Stats getStats();
+
 protected:
     /*
      * Protect constructor and destructor so can't make an instance of this class
@@ -320,6 +371,7 @@ private:
     typedef Sirikata::Network::IOServicePool IOServicePool;
     typedef Sirikata::Network::TCPResolver TCPResolver;
     typedef Sirikata::Network::TCPSocket TCPSocket;
+    typedef Sirikata::Network::InternalIOStrand InternalIOStrand;
     typedef Sirikata::Network::IOWork IOWork;
     typedef Sirikata::Network::IOCallback IOCallback;
     typedef boost::asio::ip::tcp::endpoint TCPEndPoint;
@@ -330,15 +382,20 @@ private:
         const Sirikata::Network::Address addr;
         const std::string req;
         const HttpCallback cb;
+        const HttpBodyCallback body_cb;
         const HTTP_METHOD method;
         const bool allow_redirects;
-        HttpRequest(Sirikata::Network::Address _addr, std::string _req, HTTP_METHOD meth, bool _allow_redirects, HttpCallback _cb)
-         : addr(_addr), req(_req), cb(_cb), method(meth), allow_redirects(_allow_redirects),
-           mNumTries(0), mLastCallback(NONE), mHeaderComplete(false) {}
+        HttpRequest(Sirikata::Network::Address _addr, std::string _req, HTTP_METHOD meth, bool _allow_redirects, HttpCallback _cb,
+            HttpBodyCallback _body_cb)
+         : addr(_addr), req(_req), cb(_cb), body_cb(_body_cb), method(meth), allow_redirects(_allow_redirects),
+           mNumTries(0), mBodyDelivered(false), mLastCallback(NONE), mHeaderComplete(false) {}
 
         friend class HttpManager;
     protected:
         uint32 mNumTries;
+        // Part of the body was passed to body_cb, so the request can't be
+        // retried without the consumer seeing it twice
+        bool mBodyDelivered;
         http_parser_settings mHttpSettings;
         http_parser mHttpParser;
         std::string mTempHeaderField;
@@ -348,6 +405,8 @@ private:
         Headers mHeaders;
     };
 
+    typedef std::tr1::shared_ptr<HttpRequest> HttpRequestPtr;
+
     //Holds a queue of requests to be made
     typedef std::list<std::tr1::shared_ptr<HttpRequest> > RequestQueueType;
     RequestQueueType mRequestQueue;
@@ -357,7 +416,82 @@ private:
     //TODO: should get these from settings
     static const uint32 MAX_CONNECTIONS_PER_ENDPOINT = 2;
     static const uint32 MAX_TOTAL_CONNECTIONS = 10;
+    //Requests waiting for responses on one connection before no more are sent on it
+    static const uint32 MAX_PIPELINE_DEPTH = 4;
     static const uint32 SOCKET_BUFFER_SIZE = 10240;
+    //Bodies are only preallocated up to this size, in case Content-Length is bogus
+    static const uint32 MAX_PREALLOCATED_BODY_SIZE = 64 * 1024 * 1024;
+
+    enum CONTENT_ENCODING {
+        IDENTITY,
+        GZIP,
+        DEFLATE
+    };
+
+    class HttpConnection;
+
+    //Receives decompressed body data
+    struct BodySink {
+        typedef char char_type;
+        typedef boost::iostreams::sink_tag category;
+
+        BodySink(HttpConnection* _conn) : conn(_conn) {}
+        std::streamsize write(const char* s, std::streamsize n);
+
+        HttpConnection* conn;
+    };
+
+    /*
+     * A connection to a server. Requests are written as soon as they're
+     * assigned to it, so several may be waiting for responses at once, which
+     * arrive in the order the requests were sent.
+     *
+     * The service pool runs several threads, so every handler for the
+     * connection, and anything else that touches its socket, runs in its
+     * strand. Writes and reads are never started on the socket concurrently,
+     * and closing it can't race with either.
+     */
+    class HttpConnection {
+    public:
+        const Sirikata::Network::Address addr;
+        const std::tr1::shared_ptr<TCPSocket> socket;
+        InternalIOStrand strand;
+        HttpConnection(const Sirikata::Network::Address& _addr, std::tr1::shared_ptr<TCPSocket> _socket, Sirikata::Network::IOService* service)
+         : addr(_addr), socket(_socket), strand(service),
+           mUnwritten(0), mConnected(false), mClosing(false), mClosed(false), mWriting(false), mReading(false),
+           mResponsesReceived(0), mReadBuffer(SOCKET_BUFFER_SIZE),
+           mEncoding(IDENTITY), mDecodeFailed(false), mDeliverBody(false) {}
+
+        friend class HttpManager;
+    protected:
+        //Lock this to access anything up to mResponsesReceived
+        boost::mutex mLock;
+        //Requests assigned to this connection, in the order their responses
+        //will arrive. The last mUnwritten haven't been written yet.
+        std::deque<HttpRequestPtr> mInFlight;
+        uint32 mUnwritten;
+        bool mConnected;
+        //The server is closing the connection, so no more requests are sent on it
+        bool mClosing;
+        bool mClosed;
+        bool mWriting;
+        bool mReading;
+        uint32 mResponsesReceived;
+
+        //Only used in the strand, while handling reads or closing
+        http_parser mHttpParser;
+        std::vector<unsigned char> mReadBuffer;
+        HttpRequestPtr mCurrentRequest;
+        std::tr1::shared_ptr<HttpResponse> mCurrentResponse;
+        CONTENT_ENCODING mEncoding;
+        std::tr1::shared_ptr<boost::iostreams::filtering_ostream> mDecoder;
+        bool mDecodeFailed;
+        //Whether the body goes to mCurrentRequest's body_cb
+        bool mDeliverBody;
+        //Responses finished during the current read, handled after parsing it
+        std::vector<std::pair<HttpRequestPtr, std::tr1::shared_ptr<HttpResponse> > > mCompleted;
+    };
+    typedef std::tr1::shared_ptr<HttpConnection> HttpConnectionPtr;
 
     //Keeps track of the total number of connections currently open
     uint32 mNumTotalConnections;
@@ -368,40 +502,61 @@ private:
     //Lock this to access mNumTotalConnections or mNumConnsPerAddr
     boost::mutex mNumConnsLock;
 
-    //Holds connections that are open but not being used
-    typedef std::map<Sirikata::Network::Address,
-        std::queue<std::tr1::shared_ptr<TCPSocket> > > RecycleBinType;
-    RecycleBinType mRecycleBin;
-    //Lock this to access mRecycleBin
-    boost::mutex mRecycleBinLock;
+    //Holds connections that are open, whether or not they're being used
+    typedef std::map<Sirikata::Network::Address, std::vector<HttpConnectionPtr> > ConnectionMap;
+    ConnectionMap mConnections;
+    //Lock this to access mConnections. Can be acquired while holding
+    //mRequestQueueLock, and before an HttpConnection's lock
+    boost::mutex mConnectionsLock;
+
+    Stats mStats;
+    //Lock this to access mStats
+    boost::mutex mStatsLock;
 
     IOServicePool* mServicePool;
     TCPResolver* mResolver;
 
     http_parser_settings EMPTY_PARSER_SETTINGS;
+    http_parser_settings mResponseParserSettings;
 
     void processQueue();
+    //Assigns req to an open connection, preferring idle ones, and pipelining
+    //it behind other requests if allowed. Returns the connection, if any.
+    HttpConnectionPtr assign_to_open_connection(HttpRequestPtr req);
+    static bool can_pipeline(const HttpRequestPtr& req);
 
     void add_req(std::tr1::shared_ptr<HttpRequest> req);
     void decrement_connection(const Sirikata::Network::Address& addr);
-    void write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req);
-
-    void handle_resolve(std::tr1::shared_ptr<HttpRequest> req, const boost::system::error_code& err,
+    //These and the handlers below must run in conn's strand
+    void write_requests(HttpConnectionPtr conn);
+    void read_response(HttpConnectionPtr conn);
+    //Closes conn and retries or fails the requests still waiting on it
+    void close_connection(HttpConnectionPtr conn, ERR_TYPE error, const boost::system::error_code& boost_error);
+    //Runs the callback for, or follows a redirect in, a complete response. A
+    //NULL response means its body couldn't be decompressed.
+    void finish_response(HttpRequestPtr req, std::tr1::shared_ptr<HttpResponse> resp);
+
+    void handle_resolve(HttpConnectionPtr conn, const boost::system::error_code& err,
             TCPResolver::iterator endpoint_iterator);
-    void handle_connect(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
+    void handle_connect(HttpConnectionPtr conn,
             const boost::system::error_code& err, TCPResolver::iterator endpoint_iterator);
-    void handle_write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
+    void handle_write_request(HttpConnectionPtr conn,
             const boost::system::error_code& err, std::tr1::shared_ptr<boost::asio::streambuf> request_stream);
-    void handle_read(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-            std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf, std::tr1::shared_ptr<HttpResponse> respPtr,
+    void handle_read(HttpConnectionPtr conn,
             const boost::system::error_code& err, std::size_t bytes_transferred);
 
+    static int on_message_begin(http_parser *_);
     static int on_header_field(http_parser *_, const char *at, size_t len);
     static int on_header_value(http_parser *_, const char *at, size_t len);
     static int on_headers_complete(http_parser *_);
     static int on_body(http_parser *_, const char *at, size_t len);
     static int on_message_complete(http_parser *_);
 
+    //Passes decoded body data to the response and the body callback
+    static void deliver_body(HttpConnection* conn, const char* data, size_t len);
+    //Finishes decoding the current response's body
+    static void finish_body(HttpConnection* conn);
+
     static int on_request_header_field(http_parser *_, const char *at, size_t len);
     static int on_request_header_value(http_parser *_, const char *at, size_t len);
     static int on_request_headers_complete(http_parser *_);
@@ -415,7 +570,7 @@ private:
       , F_SKIPBODY = 1 << 5
       };
 
-    static void print_flags(std::tr1::shared_ptr<HttpResponse> resp);
+    static void print_flags(const http_parser& parser);
 
 public:
 
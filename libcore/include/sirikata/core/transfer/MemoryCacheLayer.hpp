@@ -55,14 +55,13 @@ protected:
 	virtual void populateCache(const Fingerprint &fileId, const DenseDataPtr &respondData) {
 		{
 			MemoryMap::write_iterator writer(mData);
-			if (mData.alloc(respondData->length(), writer)) {
+			if (mData.alloc(fileId, respondData->length(), writer)) {
 				bool newentry = writer.insert(fileId, respondData->length());
 				if (newentry) {
 					SILOG(transfer,detailed,fileId << " created " << *respondData);
 					CacheData *cdata = new CacheData;
 					*writer = cdata;
 					cdata->mSparse.addValidData(respondData);
-					writer.use();
 				} else {
 					CacheData *cdata = static_cast<CacheData*>(*writer);
 					cdata->mSparse.addValidData(respondData);
@@ -121,6 +120,7 @@ public:
 				if (sparseData.contains(requestedRange)) {
 					haveData = true;
 					foundData = sparseData;
+					iter.use();
 				}
 			}
 		}
@@ -0,0 +1,155 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRANSFER_PACKED_DISK_CACHE_LAYER_HPP_
+#define _SIRIKATA_CORE_TRANSFER_PACKED_DISK_CACHE_LAYER_HPP_
+
+#include <sirikata/core/transfer/CacheLayer.hpp>
+#include <sirikata/core/transfer/CacheMap.hpp>
+#include <sirikata/core/queue/ThreadSafeQueue.hpp>
+#include <sirikata/core/util/Thread.hpp>
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * A disk cache which stores data in a few large, append-only pack files
+ * rather than a file per entry. Each range written to the cache is appended
+ * to the current pack as a record, with a header identifying it, so the packs
+ * can be scanned to recover anything written after the index was last saved.
+ * The index of where everything is stored is saved in a single file, so
+ * starting up only needs to read that and scan the end of the packs.
+ *
+ * Packs are memory mapped, and hits are answered immediately with DenseData
+ * viewing the mapped data rather than copies of it. Evicting an entry just
+ * leaves a hole in its pack; packs which become mostly holes are compacted in
+ * the background by copying what's left into the current pack and deleting
+ * them. Until then the packs may use more space than the CachePolicy allows.
+ *
+ * Writes and compaction are done by a worker thread. Only supported on
+ * platforms with mmap.
+ */
+class SIRIKATA_EXPORT PackedDiskCacheLayer : public CacheLayer {
+public:
+	static const uint64 DEFAULT_PACK_SIZE = 64*1024*1024;
+
+	/// Where one range of an entry is stored.
+	struct Extent {
+		Extent(const Range &r, uint32 p, uint64 o)
+			: range(r), pack(p), offset(o) {
+		}
+		Range range;
+		uint32 pack;
+		// Offset of the record holding the data in the pack
+		uint64 offset;
+	};
+
+	struct CacheData : public CacheEntry {
+		std::vector<Extent> mExtents;
+		RangeList mRanges; // union of the extents' ranges
+		bool contains(const Range &range) const {
+			return range.isContainedBy(mRanges);
+		}
+	};
+
+	/**
+	 * @param policy    decides what to evict
+	 * @param prefix    directory to store packs in, relative to the temp
+	 *                  directory if not absolute
+	 * @param tryNext   the next layer to try on misses
+	 * @param packSize  size packs are filled to before starting a new one
+	 */
+	PackedDiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext, uint64 packSize = DEFAULT_PACK_SIZE);
+	virtual ~PackedDiskCacheLayer();
+
+	virtual void purgeFromCache(const Fingerprint &fileId);
+
+	virtual void getData(const Fingerprint &fileId,
+			const Range &requestedRange,
+			const TransferCallback&callback);
+
+	/// Blocks until everything queued so far has been written and the index
+	/// has been saved.
+	void sync();
+
+	/// Blocks until packs which are mostly holes have been compacted.
+	void compact();
+
+	/// @returns the total size of the pack files.
+	uint64 diskUsage();
+
+protected:
+	virtual void populateCache(const Fingerprint& fileId, const DenseDataPtr &data);
+	virtual void destroyCacheEntry(const Fingerprint &fileId, CacheEntry *cacheLayerData, cache_usize_type releaseSize);
+
+private:
+	struct Pack;
+	typedef std::map<uint32, Pack*> PackMap;
+
+	struct DiskRequest {
+		enum Operation {OPWRITE, OPCOMPACT, OPSYNC, OPEXIT} op;
+
+		DiskRequest(Operation op)
+			: op(op), done(false) {}
+
+		Fingerprint fileId;
+		DenseDataPtr data;
+		// For requests the caller waits for
+		bool done;
+	};
+	typedef std::tr1::shared_ptr<DiskRequest> DiskRequestPtr;
+
+	void workerThread();
+	// Waits for the worker to handle req
+	void runAndWait(const DiskRequestPtr &req);
+
+	// Loads the index and scans anything the index doesn't cover. Called from
+	// the constructor, before the worker starts.
+	void load();
+	bool loadIndex(std::map<uint32, uint64> &indexed, std::vector<std::pair<Fingerprint, Extent> > &extents);
+	void scanPack(Pack *pack, uint64 from, std::vector<std::pair<Fingerprint, Extent> > &extents);
+	// Called by the worker.
+	void saveIndex();
+
+	Pack *openPack(uint32 id, bool create);
+	void closePack(Pack *pack, bool remove);
+	// Appends a record to the current pack, creating a new one if it is full.
+	// Called by the worker.
+	bool append(const Fingerprint &fileId, const Range &range, const unsigned char *data, Extent *result);
+	void writeData(const Fingerprint &fileId, const DenseDataPtr &data);
+	// Must be called with the entry's shard locked
+	void addExtent(CacheData *entry, const Extent &extent);
+	void compactPacks();
+	void compactPack(uint32 packId);
+
+	std::string packPath(uint32 id) const;
+
+	ThreadSafeQueue<DiskRequestPtr> mRequestQueue; // must be initialized before the thread.
+	Thread *mWorkerThread;
+
+	CacheMap mFiles;
+
+	std::string mPrefix; // directory name with trailing slash.
+	const uint64 mPackSize;
+
+	// Guards the pack map and the packs' live byte counts. Can be acquired
+	// while holding a lock on mFiles, but not the other way around.
+	boost::mutex mPacksLock;
+	PackMap mPacks;
+	// The pack being appended to. Only used by the worker.
+	Pack *mCurrentPack;
+	uint32 mNextPackId;
+	// Records written since the index was last saved. Only used by the worker.
+	uint32 mUnindexedRecords;
+	bool mCompactionQueued;
+
+	boost::mutex mDoneLock;
+	boost::condition_variable mDoneCV;
+	bool mCleaningUp; // entries are being freed, but their data kept on disk
+};
+
+}
+}
+
+#endif //_SIRIKATA_CORE_TRANSFER_PACKED_DISK_CACHE_LAYER_HPP_
@@ -85,6 +85,11 @@ public:
     }
 
     void updatePriority(float64 priority);
+    /** Sets a deadline for the download, which is applied to each request it
+     *  makes so they're started ahead of higher priority ones as it
+     *  approaches. Must be called before start().
+     */
+    void setDeadline(const Time& deadline);
     void cancel();
 
     inline const String& getIdentifier() const {
@@ -118,6 +123,7 @@ protected:
     TransferRequestPtr mCurrentRequest;
     SparseData mMergeData;
     double mPriority;
+    Time mDeadline;
     DownloadCallback cb;
     const String mID;
 };
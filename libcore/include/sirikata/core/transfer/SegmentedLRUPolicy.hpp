@@ -0,0 +1,138 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRANSFER_SEGMENTED_LRU_POLICY_HPP_
+#define _SIRIKATA_CORE_TRANSFER_SEGMENTED_LRU_POLICY_HPP_
+
+#include "CachePolicy.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * Segmented LRU. New entries start out in a probationary segment and are
+ * promoted to a protected segment when they are used again, so a burst of
+ * entries which are only used once can't flush out the ones used repeatedly.
+ * The protected segment is limited to a fraction of the cache, with the least
+ * recently used protected entries demoted back to probation when it overflows.
+ * Entries are evicted from probation first. All operations are constant time,
+ * apart from demotions, which are amortized over the promotions causing them.
+ */
+class SegmentedLRUPolicy : public CachePolicy {
+
+	struct SLRUData;
+	typedef std::list<std::pair<Fingerprint, SLRUData*> > SLRUList;
+
+	struct SLRUData : public Data {
+		SLRUList::iterator mIter;
+		cache_usize_type mSize;
+		bool mProtected;
+
+		SLRUData(const SLRUList::iterator &copyIter, cache_usize_type size)
+			: mIter(copyIter), mSize(size), mProtected(false) {
+		}
+	};
+
+	SLRUList mProbation;
+	SLRUList mProtected;
+	cache_usize_type mProtectedSize;
+	cache_usize_type mMaxProtectedSize;
+
+	void demoteOverflow() {
+		// Always leave the most recently promoted entry protected
+		while (mProtectedSize > mMaxProtectedSize && mProtected.size() > 1) {
+			SLRUData *demoted = mProtected.front().second;
+			mProbation.splice(mProbation.end(), mProtected, demoted->mIter);
+			demoted->mProtected = false;
+			mProtectedSize -= demoted->mSize;
+		}
+	}
+
+public:
+	/**
+	 * @param allocatedSpace  total size of the cache
+	 * @param maxSizePct      largest fraction of the cache a single entry may use
+	 * @param protectedPct    fraction of the cache the protected segment may use
+	 */
+	SegmentedLRUPolicy(cache_usize_type allocatedSpace, float maxSizePct=0.5, float protectedPct=0.8)
+		: CachePolicy(allocatedSpace, maxSizePct),
+		  mProtectedSize(0),
+		  mMaxProtectedSize((cache_usize_type)(allocatedSpace * protectedPct)) {
+	}
+
+	virtual void use(const Fingerprint &id, Data* data, cache_usize_type size) {
+		SLRUData *slrudata = static_cast<SLRUData*>(data);
+
+		if (slrudata->mProtected) {
+			mProtected.splice(mProtected.end(), mProtected, slrudata->mIter);
+			return;
+		}
+		mProtected.splice(mProtected.end(), mProbation, slrudata->mIter);
+		slrudata->mProtected = true;
+		mProtectedSize += slrudata->mSize;
+		demoteOverflow();
+	}
+
+	virtual void useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize) {
+		SLRUData *slrudata = static_cast<SLRUData*>(data);
+
+		if (slrudata->mProtected) {
+			mProtectedSize += newsize;
+			mProtectedSize -= oldsize;
+		}
+		slrudata->mSize = newsize;
+		use(id, data, newsize);
+		CachePolicy::updateSpace(oldsize, newsize);
+	}
+
+	virtual void destroy(const Fingerprint &id, Data* data, cache_usize_type size) {
+		SLRUData *slrudata = static_cast<SLRUData*>(data);
+
+		CachePolicy::updateSpace(size, 0);
+
+		SILOG(transfer,detailed,"[SegmentedLRUPolicy] Freeing " << id << " (" << size << " bytes); " << mFreeSpace << " free");
+		if (slrudata->mProtected) {
+			mProtectedSize -= slrudata->mSize;
+			mProtected.erase(slrudata->mIter);
+		} else {
+			mProbation.erase(slrudata->mIter);
+		}
+		delete slrudata;
+	}
+
+	virtual Data* create(const Fingerprint &id, cache_usize_type size) {
+		CachePolicy::updateSpace(0, size);
+
+		mProbation.push_back(SLRUList::value_type(id, NULL));
+		SLRUList::iterator newIter = mProbation.end();
+		--newIter;
+
+		SLRUData *slrudata = new SLRUData(newIter, size);
+		newIter->second = slrudata;
+		return slrudata;
+	}
+
+	virtual bool nextItem(
+			cache_usize_type requiredSpace,
+			Fingerprint &myprint)
+	{
+		if (mFreeSpace >= (cache_ssize_type)requiredSpace) {
+			return false;
+		}
+		if (!mProbation.empty()) {
+			myprint = mProbation.front().first;
+			return true;
+		}
+		if (!mProtected.empty()) {
+			myprint = mProtected.front().first;
+			return true;
+		}
+		return false;
+	}
+};
+
+}
+}
+
+#endif //_SIRIKATA_CORE_TRANSFER_SEGMENTED_LRU_POLICY_HPP_
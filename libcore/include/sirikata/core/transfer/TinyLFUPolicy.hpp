@@ -0,0 +1,67 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRANSFER_TINY_LFU_POLICY_HPP_
+#define _SIRIKATA_CORE_TRANSFER_TINY_LFU_POLICY_HPP_
+
+#include "CachePolicy.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * TinyLFU admission (Einziger and Friedman, 2014) in front of another policy,
+ * which still decides what to evict. Recent requests are counted in a small
+ * count-min sketch, and a new entry is only admitted if it has been requested
+ * more often than the entry the wrapped policy would evict to make room for
+ * it. Counts are halved periodically so the sketch follows changes in
+ * popularity. Until the cache is full everything is admitted.
+ *
+ * The wrapped policy is owned by, and must only be used through, this one.
+ */
+class SIRIKATA_EXPORT TinyLFUPolicy : public CachePolicy {
+public:
+	/**
+	 * @param inner            policy choosing which entries to evict
+	 * @param expectedEntries  roughly how many entries the cache will hold,
+	 *                         used to size the sketch
+	 */
+	TinyLFUPolicy(CachePolicy *inner, uint32 expectedEntries);
+	virtual ~TinyLFUPolicy();
+
+	virtual void use(const Fingerprint &id, Data* data, cache_usize_type size);
+	virtual void useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize);
+	virtual void destroy(const Fingerprint &id, Data* data, cache_usize_type size);
+	virtual Data* create(const Fingerprint &id, cache_usize_type size);
+	virtual bool cachable(cache_usize_type requiredSpace);
+	virtual bool admit(const Fingerprint &id, cache_usize_type requiredSpace);
+	virtual bool nextItem(cache_usize_type requiredSpace, Fingerprint &myprint);
+
+	/// Estimate of how often id has been requested recently.
+	uint32 frequency(const Fingerprint &id) const;
+
+private:
+	enum {
+		SKETCH_DEPTH = 4,
+		MAX_COUNT = 15
+	};
+
+	uint32 index(const Fingerprint &id, uint32 row) const;
+	void record(const Fingerprint &id);
+	void age();
+
+	CachePolicy *mInner;
+
+	std::vector<uint8> mSketch[SKETCH_DEPTH];
+	uint32 mSketchMask;
+	// Requests recorded since the counts were last halved, and how many there
+	// can be before they are halved again
+	uint32 mSamples;
+	uint32 mSampleSize;
+};
+
+}
+}
+
+#endif //_SIRIKATA_CORE_TRANSFER_TINY_LFU_POLICY_HPP_
@@ -40,43 +40,76 @@ namespace Sirikata {
 namespace Transfer {
 
 
-/// Represents a single block of data, and also knows the range of the file it came from.
+/** Represents a single block of data, and also knows the range of the file it came from.
+ * The data is usually owned by the DenseData, but it can also be a view of memory
+ * owned by something else, e.g. a memory mapped file, which is kept alive as long
+ * as the DenseData is. Views are copied the first time they are modified.
+ */
 class DenseData : Noncopyable, public Range {
 	std::vector<unsigned char> mData;
 
+	// If set, the data is here rather than in mData, owned by mStorage.
+	const unsigned char *mView;
+	std::tr1::shared_ptr<void> mStorage;
+
+	void copyView() {
+		if (mView) {
+			mData.assign(mView, mView + (size_t)length());
+			mView = NULL;
+			mStorage.reset();
+		}
+	}
+
     // All too easy to mix up string constructors (binarydata,length) with (string,startbyte)
 	DenseData(const char *str, size_t len) : Range(false) {}
 	DenseData(const unsigned char *str, size_t len) : Range(false) {}
 
 public:
 	DenseData(const Range &range)
-			:Range(range) {
+			:Range(range), mView(NULL) {
 		if (range.length()) {
 			mData.resize((std::vector<unsigned char>::size_type)range.length());
 		}
 	}
 
 	DenseData(const std::string &str, Range::base_type start=0, bool wholeFile=true)
-			:Range(start, str.length(), LENGTH, wholeFile) {
+			:Range(start, str.length(), LENGTH, wholeFile), mView(NULL) {
 		setLength(str.length(), wholeFile);
 		std::copy(str.begin(), str.end(), writableData());
 	}
 
 	DenseData(const Range& range, const char* str)
-        : Range(range), mData(str, str+range.length()) {
+        : Range(range), mData(str, str+range.length()), mView(NULL) {
 	    if(range.length() == 0)
 	        throw std::invalid_argument("Tried to create DenseData with length of 0");
 	}
 
 	DenseData(const Range& range, const std::vector<unsigned char>& data)
-        : Range(range), mData(data) {
+        : Range(range), mData(data), mView(NULL) {
 	    if(range.length() != data.size()) {
 	        throw std::invalid_argument("Tried to create DenseData with vector length not equal to Range");
 	    }
 	}
 
+	/**
+	 * Creates a view of range.length() bytes at data, which stay valid as long as
+	 * storage is held.
+	 */
+	DenseData(const Range& range, const unsigned char* data, const std::tr1::shared_ptr<void>& storage)
+        : Range(range), mView(data), mStorage(storage) {
+	    if(range.length() == 0)
+	        throw std::invalid_argument("Tried to create DenseData with length of 0");
+	}
+
+	/// @returns whether the data is a view of memory owned by something else.
+	inline bool isView() const {
+		return mView != NULL;
+	}
+
 	/// equals dataAt(startbyte()).
 	inline const unsigned char *data() const {
+		if (mView)
+			return mView;
 	    if(mData.size() == 0)
 	        throw std::length_error("Tried to get a const pointer to DenseData with 0 length");
 		return &(mData[0]);
@@ -92,6 +125,7 @@ public:
 
 	/// Returns a non-const data, starting at startbyte().
 	inline unsigned char *writableData() {
+		copyView();
 	    if(mData.size() == 0)
 	        throw std::length_error("Tried to get a writable pointer to DenseData with 0 length");
 		return &(mData[0]);
@@ -104,6 +138,8 @@ public:
 	inline const unsigned char *dataAt(base_type offset) const {
 		if (offset > endbyte() || offset < startbyte())
 		    return NULL;
+		if (mView)
+			return mView + (size_t)(offset-startbyte());
 		return &(mData[(std::vector<unsigned char>::size_type)(offset-startbyte())]);
 	}
 
@@ -113,17 +149,23 @@ public:
 
 	/// Sets the length of the range, as well as allocates more space in the data vector.
 	inline void setLength(size_t len, bool is_npos) {
+		copyView();
 		Range::setLength(len, is_npos);
 		mData.resize(len);
 	}
 
+	/// Allocates space for the data to grow to len bytes without reallocating.
+	inline void reserve(size_t len) {
+		copyView();
+		mData.reserve(len);
+	}
+
 	//Appends len bytes from data to internal data vector and adds to length of range
 	inline void append(const char* data, size_t len, bool is_npos) {
 	    if(len <= 0) return;
-	    size_t prev_end = length();
-	    Range::setLength(prev_end + len, is_npos);
-	    mData.resize(prev_end + len, 0);
-	    std::copy(data, data+len, writableData() + prev_end);
+	    copyView();
+	    Range::setLength(length() + len, is_npos);
+	    mData.insert(mData.end(), (const unsigned char*)data, (const unsigned char*)data + len);
 	}
 
 	// Appends the entire contents of data to internal data vector and adds to length of Range
@@ -140,6 +182,7 @@ public:
 	       return;
 	   }
 
+	   copyView();
 	   Range::setLength(length() + (end-begin), is_npos);
 	   mData.insert(mData.end(), begin, end);
 	}
@@ -35,13 +35,7 @@
 #define SIRIKATA_TransferMediator_HPP__
 
 #include <sirikata/core/transfer/TransferPool.hpp>
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/identity.hpp>
-#include <boost/multi_index/member.hpp>
-#include <boost/multi_index/mem_fun.hpp>
-#include <boost/multi_index/hashed_index.hpp>
-#include <boost/lambda/lambda.hpp>
+#include <sirikata/core/transfer/TransferScheduler.hpp>
 #include <sirikata/core/network/IOService.hpp>
 #include <sirikata/core/network/Asio.hpp>
 #include <sirikata/core/util/Thread.hpp>
@@ -52,85 +46,32 @@
 namespace Sirikata {
 namespace Transfer {
 
-using namespace boost::multi_index;
-
 /*
- * Mediates requests for name lookups and chunk downloads
+ * Mediates requests for name lookups and chunk downloads. Requests from all the
+ * clients' pools are aggregated, a TransferScheduler decides when to start
+ * them, and a few dispatch threads start them.
  */
 class SIRIKATA_EXPORT TransferMediator
     : public AutoSingleton<TransferMediator> {
 
-    /*
-     * Used to aggregate requests from different clients. If multiple clients request
-     * the same file, this object keeps track of the original separate requests so that
-     * each client's callback can be called when the request finishes. It also uses the
-     * PriorityAggregation interface to aggregate multiple client priorities into a single
-     * aggregated priority.
-     */
-	class AggregateRequest {
-	public:
-	    //Stores the aggregated priority
-		Priority mPriority;
-            // Whether we've started processing this request.
-            bool mExecuting;
-	private:
-		//Maps each client's string ID to the original TransferRequest object
-		std::map<std::string, std::tr1::shared_ptr<TransferRequest> > mTransferReqs;
-
-		//Aggregated request unique identifier
-		const std::string mIdentifier;
-
-		//Updates the aggregated priority from each client's priority when needed
-		void updateAggregatePriority();
-
-	public:
-		//Returns a map from each client ID to their original TransferRequest object
-		const std::map<std::string, std::tr1::shared_ptr<TransferRequest> > & getTransferRequests() const;
-
-		//Since there is overlap between requests here, this returns a single TransferRequest from the list of clients
-		std::tr1::shared_ptr<TransferRequest> getSingleRequest();
-
-		//Adds an additional client's request
-		void setClientPriority(std::tr1::shared_ptr<TransferRequest> req);
-
-        //Removes a client request from this aggregate request
-        void removeClient(std::string clientID);
+	typedef TransferScheduler::AggregateRequest AggregateRequest;
+	typedef TransferScheduler::AggregateRequestPtr AggregateRequestPtr;
 
-		//Returns a unique identifier for this aggregated request
-		const std::string& getIdentifier() const;
-
-		//Returns the aggregated priority value
-		Priority getPriority() const;
-
-		//Pass in the first client's request
-		AggregateRequest(std::tr1::shared_ptr<TransferRequest> req);
-	};
-
-	//lock this to access mAggregatedList
+	//lock this to access mScheduler
 	boost::mutex mAggMutex;
-
-	//tags used to index AggregateList (see boost::multi_index)
-	struct tagID{};
-	struct tagPriority{};
-
-	/*
-	 * This multi_index_container allows the efficient retrieval of an AggregateRequest
-	 * either by its identifier or sorted by its priority
-	 */
-	typedef multi_index_container<
-		std::tr1::shared_ptr<AggregateRequest>,
-		indexed_by<
-			hashed_unique<tag<tagID>, const_mem_fun<AggregateRequest,const std::string &,&AggregateRequest::getIdentifier> >,
-			ordered_non_unique<tag<tagPriority>,
-			member<AggregateRequest,Priority,&AggregateRequest::mPriority>,
-			std::greater<Priority> >
-		>
-	> AggregateList;
-	AggregateList mAggregateList;
-
-	//access iterators for AggregateList for convenience (see boost::multi_index)
-	typedef AggregateList::index<tagID>::type AggregateListByID;
-	typedef AggregateList::index<tagPriority>::type AggregateListByPriority;
+	//Decides which requests to start
+	TransferScheduler* mScheduler;
+	//Signalled when requests are added, change or finish, so the mediator
+	//thread reschedules
+	boost::condition_variable mScheduleCV;
+	bool mScheduleNeeded;
+
+	//Requests picked to start, and the threads which start them. Starting a
+	//request can involve synchronous work, like cache lookups, so it isn't
+	//done on the mediator thread or with mAggMutex held.
+	typedef std::pair<AggregateRequestPtr, TransferRequestPtr> Dispatch;
+	ThreadSafeQueue<Dispatch> mDispatchQueue;
+	std::vector<Thread*> mDispatchThreads;
 
 	/*
 	 * Used to process the queue of requests coming from a single client.
@@ -182,23 +123,21 @@ class SIRIKATA_EXPORT TransferMediator
 
 	//Set to true to signal shutdown
 	bool mCleanup;
-	//Number of outstanding requests
-	uint32 mNumOutstanding;
 
 	//TransferMediator's worker thread
 	Thread* mThread;
 
-    // Algorithm used to aggregate priorities of requests
-    PriorityAggregationAlgorithm* mAggregationAlgorithm;
-
     //Main thread that handles the input pools
     void mediatorThread();
 
+    //Starts the requests picked by the scheduler
+    void dispatchThread();
+
     //Callback for when an executed request finishes
-    void execute_finished(std::tr1::shared_ptr<TransferRequest> req, std::string id);
+    void execute_finished(std::tr1::shared_ptr<TransferRequest> req, AggregateRequestPtr agg);
 
-    //Check our internal queue to see what request to process next
-    void checkQueue();
+    //Passes a request from a pool on to the scheduler
+    void updateRequest(std::tr1::shared_ptr<TransferRequest> req);
 
     void registerPool(TransferPoolPtr pool);
 
@@ -11,6 +11,7 @@
 #include "RemoteFileMetadata.hpp"
 #include "URI.hpp"
 #include <sirikata/core/transfer/OAuthParams.hpp>
+#include <sirikata/core/util/Time.hpp>
 
 namespace Sirikata {
 namespace Transfer {
@@ -32,11 +33,36 @@ public:
 		return mPriority;
 	}
 
+	//Return the time the request should be finished by, or Time::null() if
+	//it doesn't have a deadline
+	inline const Time& getDeadline() const {
+		return mDeadline;
+	}
+
+	//Sets a deadline, which gets the request started ahead of higher
+	//priority ones as the deadline approaches. Must be set before the request
+	//is added to a pool.
+	inline void setDeadline(const Time& deadline) {
+		mDeadline = deadline;
+	}
+
 	//Returns true if this request is for deletion
 	inline bool isDeletionRequest() const {
 	    return mDeletionRequest;
 	}
 
+	/// Identifies where the data is transferred from, e.g. the host it is
+	/// downloaded from, so the bandwidth used per source can be limited.
+	/// Empty if the request shouldn't be limited.
+	virtual String getSource() const {
+		return String();
+	}
+
+	/// Number of bytes the request is expected to transfer, or 0 if unknown.
+	virtual uint64 getTransferSize() const {
+		return 0;
+	}
+
 	/// Get an identifier for the data referred to by this
 	/// TransferRequest. The identifier is not unique for each
 	/// TransferRequest. Instead, it identifies the asset data: if two
@@ -73,6 +99,7 @@ protected:
     }
 
 	Priority mPriority;
+	Time mDeadline;
 	std::string mClientID;
 	bool mDeletionRequest;
 
@@ -107,6 +134,8 @@ public:
 
     void execute(std::tr1::shared_ptr<TransferRequest> req, ExecuteFinished cb);
 
+    virtual String getSource() const;
+
     inline void notifyCaller(TransferRequestPtr me, TransferRequestPtr from) {
         std::tr1::shared_ptr<MetadataRequest> meC =
             std::tr1::static_pointer_cast<MetadataRequest, TransferRequest>(me);
@@ -184,6 +213,9 @@ public:
 
     void execute_finished(std::tr1::shared_ptr<const DenseData> response, ExecuteFinished cb);
 
+    virtual String getSource() const;
+    virtual uint64 getTransferSize() const;
+
     void notifyCaller(TransferRequestPtr me, TransferRequestPtr from);
     void notifyCaller(TransferRequestPtr me, TransferRequestPtr from, DenseDataPtr data);
 
@@ -229,6 +261,9 @@ public:
 
     void execute_finished(std::tr1::shared_ptr<const DenseData> response, ExecuteFinished cb);
 
+    virtual String getSource() const;
+    virtual uint64 getTransferSize() const;
+
     void notifyCaller(TransferRequestPtr me, TransferRequestPtr from);
     void notifyCaller(TransferRequestPtr me, TransferRequestPtr from, DenseDataPtr data);
 
@@ -0,0 +1,239 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRANSFER_TRANSFER_SCHEDULER_HPP_
+#define _SIRIKATA_CORE_TRANSFER_TRANSFER_SCHEDULER_HPP_
+
+#include <sirikata/core/transfer/TransferPool.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/mem_fun.hpp>
+#include <boost/multi_index/composite_key.hpp>
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * Decides which of the requests aggregated by the TransferMediator to start,
+ * and when. Requests are started in two classes:
+ *  - Requests with a deadline are started earliest deadline first once the
+ *    deadline is within the deadline horizon, ahead of everything else.
+ *  - Everything else is started in order of priority.
+ * Requests which aren't more important than anything already executing can
+ * only use some of the slots for executing requests. The rest are reserved,
+ * so that when something important comes along it doesn't have to wait
+ * behind a backlog of less important transfers which got started first.
+ * Since this is decided by the priorities of what is currently executing,
+ * changing the priority of an executing request changes which slots are
+ * available.
+ *
+ * The bandwidth used by each source can also be limited, with a token bucket
+ * per source charged with each request's expected size when it is started.
+ *
+ * When all of the clients of an executing request remove it, the request is
+ * cancelled and its result is dropped. The fetch itself can't be interrupted,
+ * so it still holds its slot until it finishes.
+ *
+ * Not thread safe, the TransferMediator serializes access to it.
+ */
+class SIRIKATA_EXPORT TransferScheduler {
+public:
+	struct Params {
+		Params();
+
+		// Most requests executing at once
+		uint32 maxOutstanding;
+		// Slots only used by requests which are due or are more important
+		// than everything already executing
+		uint32 reservedSlots;
+		// How far ahead of their deadlines requests are started ahead of
+		// higher priority ones
+		Duration deadlineHorizon;
+		// Bytes per second allowed for each source, or 0 for no limit
+		uint64 sourceBandwidth;
+		// Bytes each source can use in a burst after being idle
+		uint64 sourceBurst;
+	};
+
+	/*
+	 * Used to aggregate requests from different clients. If multiple clients request
+	 * the same file, this object keeps track of the original separate requests so that
+	 * each client's callback can be called when the request finishes. It also uses the
+	 * PriorityAggregation interface to aggregate multiple client priorities into a single
+	 * aggregated priority.
+	 */
+	class AggregateRequest {
+	public:
+		//Stores the aggregated priority
+		Priority mPriority;
+		//Earliest of the clients' deadlines, or Time::null()
+		Time mDeadline;
+		// Whether we've started processing this request.
+		bool mExecuting;
+		// Set if all the clients went away while it was executing
+		bool mCancelled;
+
+		//Returns a map from each client ID to their original TransferRequest object
+		const std::map<std::string, TransferRequestPtr> & getTransferRequests() const;
+
+		//Since there is overlap between requests here, this returns a single TransferRequest from the list of clients
+		TransferRequestPtr getSingleRequest();
+
+		//Adds an additional client's request
+		void setClientPriority(TransferRequestPtr req);
+
+		//Removes a client request from this aggregate request
+		void removeClient(const std::string& clientID);
+
+		//Returns a unique identifier for this aggregated request
+		const std::string& getIdentifier() const;
+
+		//Returns the aggregated priority value
+		Priority getPriority() const;
+
+		//Deadline to order by, which puts requests without one last
+		Time deadlineKey() const;
+
+		//Pass in the first client's request
+		AggregateRequest(TransferRequestPtr req, const PriorityAggregationAlgorithm* aggregation);
+
+	private:
+		//Maps each client's string ID to the original TransferRequest object
+		std::map<std::string, TransferRequestPtr> mTransferReqs;
+
+		//Aggregated request unique identifier
+		const std::string mIdentifier;
+
+		const PriorityAggregationAlgorithm* mAggregationAlgorithm;
+
+		//Updates the aggregated priority and deadline from each client's
+		void updateAggregate();
+	};
+	typedef std::tr1::shared_ptr<AggregateRequest> AggregateRequestPtr;
+	typedef std::vector<AggregateRequestPtr> AggregateRequestList;
+
+	/// Counts of scheduling decisions, for tuning
+	struct Stats {
+		Stats()
+		 : started(0), startedForDeadline(0), startedInReservedSlot(0),
+		   cancelled(0), throttled(0) {}
+
+		uint64 started;
+		// Started ahead of higher priority requests because they were due
+		uint64 startedForDeadline;
+		// Started in a slot kept for important requests
+		uint64 startedInReservedSlot;
+		// Executing requests all of whose clients went away
+		uint64 cancelled;
+		// Times a request was passed over because its source was over budget
+		uint64 throttled;
+	};
+
+	/**
+	 * @param aggregation how multiple clients' priorities for the same data
+	 *                    are combined. Owned by the scheduler.
+	 */
+	TransferScheduler(const Params& params, PriorityAggregationAlgorithm* aggregation);
+	~TransferScheduler();
+
+	/// Adds, reprioritizes or removes (if it is a deletion request) a
+	/// client's request, as received from its pool.
+	void update(TransferRequestPtr req);
+
+	/// Picks the requests to start at time now and marks them as executing.
+	/// They're appended to toStart.
+	void schedule(const Time& now, AggregateRequestList& toStart);
+
+	/// Called when an executing request finishes. Fills clients with the
+	/// clients to notify and removes the request. Returns false if the
+	/// request was cancelled, in which case there's nobody to notify.
+	bool finished(const AggregateRequestPtr& agg, std::vector<TransferRequestPtr>& clients);
+
+	/// Returns the next time schedule() could start something it can't start
+	/// yet, because a deadline comes within the horizon or a source gets more
+	/// bandwidth, or Time::null() if nothing will change until requests are
+	/// added or finish.
+	Time nextWakeup(const Time& now);
+
+	/// Fills requests with all requests, in the order they would be started
+	/// by priority.
+	void getRequests(AggregateRequestList& requests) const;
+
+	uint32 numOutstanding() const {
+		return mNumOutstanding;
+	}
+	uint32 numRequests() const {
+		return mAggregateList.size();
+	}
+	const Stats& stats() const {
+		return mStats;
+	}
+
+private:
+	//tags used to index AggregateList (see boost::multi_index)
+	struct tagID{};
+	struct tagPriority{};
+	struct tagDeadline{};
+
+	/*
+	 * This multi_index_container allows the efficient retrieval of an
+	 * AggregateRequest by its identifier, sorted by its priority or sorted by
+	 * its deadline. The sorted indices put requests which haven't been
+	 * started first.
+	 */
+	typedef boost::multi_index::multi_index_container<
+		AggregateRequestPtr,
+		boost::multi_index::indexed_by<
+			boost::multi_index::hashed_unique<boost::multi_index::tag<tagID>,
+				boost::multi_index::const_mem_fun<AggregateRequest,const std::string &,&AggregateRequest::getIdentifier> >,
+			boost::multi_index::ordered_non_unique<boost::multi_index::tag<tagPriority>,
+				boost::multi_index::composite_key<AggregateRequestPtr,
+					boost::multi_index::member<AggregateRequest,bool,&AggregateRequest::mExecuting>,
+					boost::multi_index::member<AggregateRequest,Priority,&AggregateRequest::mPriority> >,
+				boost::multi_index::composite_key_compare<std::less<bool>, std::greater<Priority> > >,
+			boost::multi_index::ordered_non_unique<boost::multi_index::tag<tagDeadline>,
+				boost::multi_index::composite_key<AggregateRequestPtr,
+					boost::multi_index::member<AggregateRequest,bool,&AggregateRequest::mExecuting>,
+					boost::multi_index::const_mem_fun<AggregateRequest,Time,&AggregateRequest::deadlineKey> > >
+		>
+	> AggregateList;
+
+	//access iterators for AggregateList for convenience (see boost::multi_index)
+	typedef AggregateList::index<tagID>::type AggregateListByID;
+	typedef AggregateList::index<tagPriority>::type AggregateListByPriority;
+	typedef AggregateList::index<tagDeadline>::type AggregateListByDeadline;
+
+	// Token bucket for one source
+	struct SourceBudget {
+		double tokens;
+		Time lastRefill;
+	};
+	typedef std::map<String, SourceBudget> SourceBudgetMap;
+
+	// Returns false if req's source is over its budget, otherwise charges it
+	// for the request.
+	bool chargeSource(const TransferRequestPtr& req, const Time& now);
+	void start(AggregateRequestPtr agg, AggregateRequestList& toStart);
+	// Returns true and sets lowest to the lowest priority of the executing
+	// requests if there are any
+	bool lowestExecutingPriority(Priority* lowest) const;
+
+	const Params mParams;
+	PriorityAggregationAlgorithm* mAggregationAlgorithm;
+
+	AggregateList mAggregateList;
+	//Number of outstanding requests
+	uint32 mNumOutstanding;
+
+	SourceBudgetMap mSourceBudgets;
+
+	Stats mStats;
+};
+
+}
+}
+
+#endif //_SIRIKATA_CORE_TRANSFER_TRANSFER_SCHEDULER_HPP_
@@ -201,6 +201,22 @@ inline bool compare_and_swap(volatile Node*volatile *target, volatile Node *comp
 #endif
 }
 
+/** Full memory barrier. Use this to order a plain store of data before the
+ *  store of an index/flag that publishes it to another thread (and the
+ *  matching loads on the other side).
+ */
+inline void memory_barrier() {
+#ifdef _WIN32
+    MemoryBarrier();
+#else
+#ifdef __APPLE__
+    OSMemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+#endif
+}
+
 #ifdef _WIN32
 #pragma warning( pop )
 #endif
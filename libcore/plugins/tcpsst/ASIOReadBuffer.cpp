@@ -185,6 +185,26 @@ static signed char URLSAFEDECODABET [] = {
         39,40,41,42,43,44,45,46,47,48,49,50,51,     // Letters 'n' through 'z'
         -9,-9,-9,-9,-9                                 // Decimal 123 - 127
 };
+// Decodes the URL safe base64 written by ASIOSocketWrapper::toBase64ZeroDelim
+static bool decodeBase64(const uint8* source, size_t size, Chunk& destination) {
+    destination.resize((size+3)/4*3);
+    int outBuffPosn=0;
+    signed char quad[4];
+    int quadPosn=0;
+    for (size_t i=0;i<size;++i) {
+        signed char decoded = (source[i]<sizeof(URLSAFEDECODABET)) ? URLSAFEDECODABET[source[i]] : -9;
+        if (decoded==WHITE_SPACE_ENC) continue;
+        if (decoded<EQUALS_SIGN_ENC) return false;
+        quad[quadPosn++]=decoded;
+        if (quadPosn==4) {
+            outBuffPosn+=decode4to3(quad,destination,outBuffPosn);
+            quadPosn=0;
+            if (decoded==EQUALS_SIGN_ENC) break;
+        }
+    }
+    destination.resize(outBuffPosn);
+    return quadPosn==0;
+}
 static Stream::StreamID parseId(Chunk&newChunk,int&outBuffPosn) {
     Stream::StreamID id;
     unsigned int headerLength=outBuffPosn;
@@ -286,12 +306,73 @@ void ASIOReadBuffer::processPartialChunk(uint8* dataBuffer, uint32 packetLength,
         std::memcpy(&*currentChunk.begin() + mChunkBufferPos, dataBuffer + numHeaderBytesFromThisPacket, bufferReceived);
     }
 }
+bool ASIOReadBuffer::translateBase64Frame(const MultiplexedSocketPtr &thus, unsigned int &currentFixedBufferPos, bool *readBufferFull) {
+    uint8 *start=mBuffer+currentFixedBufferPos;
+    uint8 *end=mBuffer+mFixedBufferPos;
+    uint8 *delim=std::find(start,end,(uint8)0xff);
+    if (delim==end) {
+        // Small partial frames are moved to the front of the buffer to be
+        // completed there. Only ones filling the whole buffer are set aside.
+        if (mPartialFrame.empty()&&(currentFixedBufferPos!=0||mFixedBufferPos<sBufferLength))
+            return false;
+        mPartialFrame.insert(mPartialFrame.end(),start,end);
+        thus->recordBytesCopied(end-start);
+        currentFixedBufferPos=mFixedBufferPos;
+        return false;
+    }
+
+    // The rest of a set aside frame is only appended for this attempt, so a
+    // pause can drop it again and leave everything as it was
+    size_t partialSize=mPartialFrame.size();
+    const uint8 *frame=start;
+    size_t frameSize=delim-start;
+    if (partialSize) {
+        mPartialFrame.insert(mPartialFrame.end(),start,delim);
+        frame=&mPartialFrame[0];
+        frameSize=mPartialFrame.size();
+    }
+
+    Stream::StreamID id;
+    unsigned int idLength=(frameSize?frameSize-1:0);
+    if (frameSize==0||frame[0]!=0x00||!id.unserializeFromHex(frame+1,idLength)||
+        !decodeBase64(frame+1+idLength,frameSize-1-idLength,mNewChunk)) {
+        SILOG(tcpsst,warning,"Dropping malformed base64 frame of "<<frameSize<<" bytes");
+        mNewChunk.resize(0);
+        mPartialFrame.resize(0);
+        currentFixedBufferPos+=(delim-start)+1;
+        return true;
+    }
+
+    mFirstFrame=mLastFrame=true;
+    *(int*)mDataMask=0;
+    mNewChunkID=id;
+    ReceivedResponse process_resp = processFullChunk(
+        thus,mWhichBuffer,mNewChunkID,mNewChunk,
+        std::tr1::bind(ASIOReadBufferUtil::_pause_receive_callback__status_full, &mReadStatus, PAUSED_FIXED_BUFFER, readBufferFull)
+    );
+    if (process_resp != StreamNotPaused) {
+        // Decoded again from scratch when the stream is resumed
+        mPartialFrame.resize(partialSize);
+        return false;
+    }
+    // Counted only once it's delivered, since a paused frame is decoded
+    // again when the stream resumes
+    thus->recordBytesCopied(frameSize);
+    mPartialFrame.resize(0);
+    currentFixedBufferPos+=(delim-start)+1;
+    return true;
+}
 void ASIOReadBuffer::translateFixedBuffer(const MultiplexedSocketPtr &thus) {
     bool readBufferFull=false;
     unsigned int currentFixedBufferPos=0;
     VariableLength packetLength;
     bool delimitedPacket=false;
     while (mFixedBufferPos!=currentFixedBufferPos) {
+        if (mStreamType == TCPStream::BASE64_ZERODELIM) {
+            if (translateBase64Frame(thus,currentFixedBufferPos,&readBufferFull))
+                continue;
+            break;
+        }
         unsigned int length;
         unsigned int packetHeaderLength;
         if (mStreamType == TCPStream::RFC_6455) {
@@ -361,13 +442,15 @@ void ASIOReadBuffer::translateFixedBuffer(const MultiplexedSocketPtr &thus) {
         // Now we have the packet length and the header length. Process the data.
         {
             if (mFixedBufferPos-currentFixedBufferPos<length) {
-                if (mFixedBufferPos-currentFixedBufferPos+packetHeaderLength<sLowWaterMark) {
+                if (length+packetHeaderLength<=sLowWaterMark ||
+                    mFixedBufferPos-currentFixedBufferPos<(unsigned int)Stream::StreamID::MAX_SERIALIZED_LENGTH) {
                     currentFixedBufferPos -= packetHeaderLength;
                     break;//go directly to memmov code and move remnants to beginning of buffer to read a large portion at a time
                 }else {
                     mFixedBufferPos-=currentFixedBufferPos;
                     assert(!mFirstFrame || mNewChunk.size()==0);
                     processPartialChunk(mBuffer+currentFixedBufferPos,length,mFixedBufferPos,mNewChunk);
+                    thus->recordBytesCopied(mFixedBufferPos);
                     mChunkBufferPos += mFixedBufferPos;
                     mFixedBufferPos = 0;
                     readIntoChunk(thus);
@@ -387,6 +470,9 @@ void ASIOReadBuffer::translateFixedBuffer(const MultiplexedSocketPtr &thus) {
                     std::tr1::bind(ASIOReadBufferUtil::_pause_receive_callback__status_full, &mReadStatus, PAUSED_FIXED_BUFFER, &readBufferFull)
                 );
                 if (process_resp == StreamNotPaused) {
+                    // Counted only once it's delivered, since a paused packet
+                    // is copied out again when the stream resumes
+                    thus->recordBytesCopied(bufferReceived);
                     currentFixedBufferPos += length;
                 } else { // Paused, most work already handled by callback
                     // Let's forget everything that happened in this loop iteration.
@@ -443,6 +529,7 @@ void ASIOReadBuffer::translateFixedBuffer(const MultiplexedSocketPtr &thus) {
     }
     if (currentFixedBufferPos!=0&&mFixedBufferPos!=currentFixedBufferPos) {//move partial bytes to beginning
         std::memmove(mBuffer,mBuffer+currentFixedBufferPos,mFixedBufferPos-currentFixedBufferPos);
+        thus->recordBytesCopied(mFixedBufferPos-currentFixedBufferPos);
     }
     mFixedBufferPos-=currentFixedBufferPos;
     if (!readBufferFull) {
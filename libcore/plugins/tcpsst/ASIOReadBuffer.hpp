@@ -51,11 +51,11 @@ public:
         ///since async_receive should return as soon as data is available.  Therefore we use a relatively large
         ///buffer to avoid too much overhead from IO operations.
         sBufferLength=64*1024,
-        ///The low water mark is the point at which reads are shifted from the fixed sized buffer into a preallocated
-        ///chunk.  Since the chunk is preallocated, this has to be greater than the longest possible header length.
-        ///It also must be less than sBufferLength.  Since this is only really necessary to handle large packets and
-        ///avoid extra copying (of the available packet info from end of buffer to front of buffer, then over into the
-        ///real packet), we set this to be as large as possible, sBufferLength.
+        ///The low water mark is the packet size above which reads are shifted from the fixed sized buffer into a
+        ///preallocated chunk.  Packets larger than this are moved into their own chunk as soon as their StreamID has
+        ///arrived and the rest is read directly into the chunk, rather than first filling the fixed buffer and copying
+        ///it all out.  Smaller packets are always completed in the fixed buffer so several can be read at once.
+        ///It must not be more than sBufferLength, otherwise a packet could never be completed.
         sLowWaterMark=sBufferLength
     };
 private:
@@ -84,6 +84,8 @@ private:
     unsigned int mWhichBuffer;
     ///A new chunk being read directly into--usually this member is only used to hold a large packet of information, otherwise the fixed length buffer is used
     Chunk mNewChunk;
+    ///The start of a base64 frame too large for the fixed buffer, held until its terminating 0xff arrives
+    Chunk mPartialFrame;
     Chunk *mCachedRejectedChunk;
     ///The StreamID of a new, partially examined new chunk
     Stream::StreamID mNewChunkID;
@@ -150,6 +152,13 @@ private:
      */
     void translateFixedBuffer(const MultiplexedSocketPtr &thus);
 
+    /**
+     * Handles the base64 frame at currentFixedBufferPos for translateFixedBuffer. Frames are a 0x00, the StreamID in hex,
+     * the base64 encoded payload and a terminating 0xff, so their length isn't known until the end arrives.
+     * \returns true if a frame was consumed and the next one may be examined, false if more data is needed or the stream was paused
+     */
+    bool translateBase64Frame(const MultiplexedSocketPtr &thus, unsigned int &currentFixedBufferPos, bool *readBufferFull);
+
     /**
      * The ASIO callback when ASIO was reading into a singleChunk
      * The function reacts to errors by calling processErrors or a missing MultiplexedSocket by deleting this
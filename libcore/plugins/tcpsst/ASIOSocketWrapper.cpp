@@ -224,8 +224,8 @@ void ASIOSocketWrapper::sendManyDequeItems(const std::tr1::weak_ptr<MultiplexedS
                 finishedSendingChunk(*i);
                 size_t cursize=i->size();
                 total_size+=cursize;
-                if (cursize) {
-                    BufferPrint(this,".sec",&*i->chunk->begin(),cursize);
+                if (i->chunk->size()) {
+                    BufferPrint(this,".sec",&*i->chunk->begin(),i->chunk->size());
                     TCPSSTLOG(this,"snd",&*i->begin(),i->size,error);
                 }
                 delete i->chunk;
@@ -243,13 +243,23 @@ void ASIOSocketWrapper::sendToWire(const MultiplexedSocketPtr&parentMultiSocket,
     //sending a single chunk is a straightforward call directly to asio
     mToSend.resize(0);
     mToSend.push_back(toSend);
-    BufferPrint(this,".buw",&*toSend.chunk->begin(),toSend.size());
+    BufferPrint(this,".buw",&*toSend.chunk->begin(),toSend.chunk->size());
     mOutstandingDataParent=parentMultiSocket;//keep parent alive until send finishes
 
-    boost::asio::async_write(*mSocket,
-                             boost::asio::buffer(&*toSend.chunk->begin(),toSend.size()),
-                             boost::asio::transfer_at_least(toSend.size()),
-                             mSendManyDequeItems);
+    if (toSend.header.empty()) {
+        boost::asio::async_write(*mSocket,
+                                 boost::asio::buffer(&*toSend.chunk->begin(),toSend.size()),
+                                 boost::asio::transfer_at_least(toSend.size()),
+                                 mSendManyDequeItems);
+    }else {
+        //the header buffer must point at the copy in mToSend, which outlives the write
+        std::vector<boost::asio::const_buffer> bufs;
+        mToSend.front().gather(&bufs);
+        boost::asio::async_write(*mSocket,
+                                 bufs,
+                                 boost::asio::transfer_at_least(toSend.size()),
+                                 mSendManyDequeItems);
+    }
 }
 void ASIOSocketWrapper::bindFunctions(const MultiplexedSocketPtr&parent) {
     mStrand = parent->getStrand();
@@ -265,16 +275,16 @@ void ASIOSocketWrapper::bindFunctions(const MultiplexedSocketPtr&parent) {
         );
 }
 void ASIOSocketWrapper::sendToWire(const MultiplexedSocketPtr&parentMultiSocket, std::deque<TimestampedChunk>&input_toSend){
-    std::vector<boost::asio::mutable_buffer> bufs;
+    std::vector<boost::asio::const_buffer> bufs;
     size_t total_size=0;
     for (std::deque<TimestampedChunk>::const_iterator i=input_toSend.begin(),ie=input_toSend.end();i!=ie;++i) {
-        size_t cursize=i->chunk->size();
-        bufs.push_back(boost::asio::buffer(&*i->chunk->begin(),cursize));
-        total_size+=cursize;
-        if( cursize) {
-            BufferPrint(this,".buw",&*i->chunk->begin(),cursize);
+        i->gather(&bufs);
+        total_size+=i->size();
+        if(i->chunk->size()) {
+            BufferPrint(this,".buw",&*i->chunk->begin(),i->chunk->size());
         }
     }
+    //swapping the deques leaves the elements (and their inline headers) in place
     mToSend.swap(input_toSend);
     mOutstandingDataParent=parentMultiSocket;//keep parent alive until send finishes
     boost::asio::async_write(*mSocket,
@@ -367,15 +377,18 @@ bool ASIOSocketWrapper::canSend(size_t dataSize) const{
     return mSendQueue.getResourceMonitor().filledSize()+dataSize<=(size_t)mSendQueue.getResourceMonitor().maxSize();
 }
 bool ASIOSocketWrapper::rawSend(const MultiplexedSocketPtr&parentMultiSocket, Chunk * chunk, bool force) {
+    return rawSend(parentMultiSocket,FrameHeader(),chunk,force);
+}
+bool ASIOSocketWrapper::rawSend(const MultiplexedSocketPtr&parentMultiSocket, const FrameHeader& header, Chunk * chunk, bool force) {
     bool retval=true;
     TCPSSTLOG(this,"raw",&*chunk->begin(),chunk->size(),false);
     uint32 current_status=++mSendingStatus;
     if (current_status==1) {//we are teh chosen thread
         mSendingStatus+=(ASYNCHRONOUS_SEND_FLAG-1);//committed to be the sender thread
-        sendToWire(parentMultiSocket, chunk);
+        sendToWire(parentMultiSocket, TimestampedChunk(header,chunk));
     }else {//if someone else is possibly sending a packet
         //push the packet on the queue
-        retval=mSendQueue.push(chunk, force);
+        retval=mSendQueue.push(TimestampedChunk(header,chunk), force);
         current_status=--mSendingStatus;
         if (retval) {
             //the packet is out of our hands now...
@@ -34,6 +34,7 @@
 #include <sirikata/core/util/Time.hpp>
 #include <sirikata/core/util/EWA.hpp>
 #include <sirikata/core/network/IOStrand.hpp>
+#include "FrameHeader.hpp"
 
 #define SEND_LATENCY_EWA_ALPHA .10f
 
@@ -64,15 +65,29 @@ class ASIOSocketWrapper {
          : chunk(_c), time(Time::local())
         {}
 
+        TimestampedChunk(const FrameHeader& _h, Chunk* _c)
+         : chunk(_c), header(_h), time(Time::local())
+        {}
+
         uint32 size() const {
-            return chunk->size();
+            return header.size + chunk->size();
         }
 
         Duration sinceCreation() const {
             return Time::local() - time;
         }
 
+        /// Appends the buffers to put on the wire for this chunk
+        void gather(std::vector<boost::asio::const_buffer>* bufs) const {
+            if (!header.empty())
+                bufs->push_back(boost::asio::buffer(header.bytes,header.size));
+            if (!chunk->empty())
+                bufs->push_back(boost::asio::buffer(&*chunk->begin(),chunk->size()));
+        }
+
         Chunk* chunk;
+        ///framing written out ahead of chunk, empty if chunk is already framed
+        FrameHeader header;
         Time time;
     };
 
@@ -214,6 +229,13 @@ public:
      *              policy indicates no more space is available.
      */
     bool rawSend(const MultiplexedSocketPtr&parentMultiSocket, Chunk * chunk, bool force);
+    /**
+     * Sends a payload preceded by separately serialized framing. Both are
+     * written with a single gather write, so the payload is never copied.
+     * \param header the length and streamID framing for payload
+     * \param payload the packet data, owned by this class if the send succeeds
+     */
+    bool rawSend(const MultiplexedSocketPtr&parentMultiSocket, const FrameHeader& header, Chunk * payload, bool force);
     bool canSend(size_t dataSize)const;
     static Chunk*constructControlPacket(const MultiplexedSocketPtr&parentMultiSocket, TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid);
     /**
@@ -0,0 +1,40 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_TCPSST_FRAME_HEADER_HPP_
+#define _SIRIKATA_TCPSST_FRAME_HEADER_HPP_
+
+#include <sirikata/core/network/Stream.hpp>
+
+namespace Sirikata {
+namespace Network {
+
+/** The framing bytes (packet length followed by the StreamID) that precede a
+ *  packet's payload on the wire. They are kept inline with the queued packet
+ *  and written out with the payload in a single gather write, so the payload
+ *  never has to be copied into a larger buffer just to make room for them.
+ *  An empty header means the Chunk already contains its framing.
+ */
+struct FrameHeader {
+    enum {
+        ///RFC 6455 headers are at most 10 bytes, VariableLength lengths fewer
+        MAX_SIZE=10+Stream::StreamID::MAX_SERIALIZED_LENGTH
+    };
+
+    FrameHeader()
+     : size(0)
+    {}
+
+    bool empty() const {
+        return size==0;
+    }
+
+    uint8 bytes[MAX_SIZE];
+    uint8 size;
+};
+
+} // namespace Network
+} // namespace Sirikata
+
+#endif //_SIRIKATA_TCPSST_FRAME_HEADER_HPP_
@@ -162,9 +162,9 @@ bool MultiplexedSocket::sendBytesNow(const MultiplexedSocketPtr& thus,const RawR
     if (data.originStream==Stream::StreamID()) {
         unsigned int socket_size=(unsigned int)thus->mSockets.size();
         for(unsigned int i=1;i<socket_size;++i) {
-            thus->mSockets[i].rawSend(thus,new Chunk(*data.data),true);
+            thus->mSockets[i].rawSend(thus,data.header,new Chunk(*data.data),true);
         }
-        thus->mSockets[0].rawSend(thus,data.data,true);
+        thus->mSockets[0].rawSend(thus,data.header,data.data,true);
         return true;
     }else {
         size_t whichStream=hasher(data.originStream)%thus->mSockets.size();
@@ -172,7 +172,7 @@ bool MultiplexedSocket::sendBytesNow(const MultiplexedSocketPtr& thus,const RawR
             whichStream=thus->leastBusyStream(whichStream);
         }
         if (data.unreliable==false||rand()/(float)RAND_MAX>thus->dropChance(data.data,whichStream)) {
-            return thus->mSockets[whichStream].rawSend(thus,data.data,force);
+            return thus->mSockets[whichStream].rawSend(thus,data.header,data.data,force);
         }else {
             return true;
         }
@@ -266,7 +266,8 @@ MultiplexedSocket::MultiplexedSocket(IOStrand*io, const Stream::SubstreamCallbac
  : SerializationCheck(),
    mIO(io),
    mNewSubstreamCallback(substreamCallback),
-  mHighestStreamID(getFirstStreamID(true).read())
+  mHighestStreamID(getFirstStreamID(true).read()),
+  mBytesCopied(0)
 {
     mStreamType = streamType;
     mNewRequests=NULL;
@@ -276,7 +277,8 @@ MultiplexedSocket::MultiplexedSocket(IOStrand*io,const UUID&uuid,const Stream::S
  :SerializationCheck(),
   mIO(io),
      mNewSubstreamCallback(substreamCallback),
-    mHighestStreamID(getFirstStreamID(false).read()) {
+    mHighestStreamID(getFirstStreamID(false).read()),
+    mBytesCopied(0) {
     mStreamType = streamType;
     mNewRequests=NULL;
     mSocketConnectionPhase=PRECONNECTION;
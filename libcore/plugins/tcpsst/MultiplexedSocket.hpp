@@ -37,6 +37,7 @@
 #include <boost/thread.hpp>
 #include "TCPSSTDecls.hpp"
 #include "TCPStream.hpp"
+#include "FrameHeader.hpp"
 
 namespace Sirikata {
 namespace Network {
@@ -52,10 +53,12 @@ public:
         bool unordered;
         bool unreliable;
         Stream::StreamID originStream;
+        ///framing sent ahead of data, empty if data is already framed
+        FrameHeader header;
         Chunk * data;
 
         uint32 size() const {
-            return data->size();
+            return header.size + data->size();
         }
     };
     enum SocketConnectionPhase{
@@ -106,6 +109,8 @@ private:
 #define ThreadSafeStack ThreadSafeQueue //FIXME this can be way more efficient
     ///The highest streamID that has been used for making new streams on this side
     AtomicValue<uint32> mHighestStreamID;
+    ///Bytes of packet data copied while framing outgoing and parsing incoming packets
+    AtomicValue<uint64> mBytesCopied;
     ///actually free stream IDs that will not be sent out until recalimed by this side
     ThreadSafeStack<Stream::StreamID>mFreeStreamIDs;
 #undef ThreadSafeStack
@@ -313,6 +318,13 @@ public:
     // -- Statistics
     Duration averageSendLatency() const;
     Duration averageReceiveLatency() const;
+    ///Record bytes that had to be copied to frame or deliver packets. Thread safe.
+    void recordBytesCopied(size_t bytes) {
+        mBytesCopied+=(uint64)bytes;
+    }
+    uint64 bytesCopied() const {
+        return mBytesCopied.read();
+    }
 };
 
 } // namespace Network
@@ -70,6 +70,13 @@ Duration TCPStream::averageReceiveLatency() const {
     return mSocket->averageReceiveLatency();
 }
 
+uint64 TCPStream::bytesCopied() const {
+    MultiplexedSocketPtr socket_copy = mSocket;
+    if (socket_copy.get() == NULL)
+        return 0;
+    return socket_copy->bytesCopied();
+}
+
 void TCPStream::readyRead() {
     MultiplexedSocketPtr socket_copy = mSocket;
     if (socket_copy.get() == NULL) {
@@ -124,43 +131,82 @@ bool TCPStream::send(const Chunk&data, StreamReliability reliability) {
 bool TCPStream::send(MemoryReference firstChunk, StreamReliability reliability) {
     return send(firstChunk,MemoryReference::null(),reliability);
 }
-bool TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, StreamReliability reliability) {
-    MultiplexedSocket::RawRequest toBeSent;
-    // only allow 3 of the four possibilities because unreliable ordered is tricky and usually useless
-    switch(reliability) {
-      case Unreliable:
-        toBeSent.unordered=true;
-        toBeSent.unreliable=true;
-        break;
-      case ReliableOrdered:
-        toBeSent.unordered=false;
-        toBeSent.unreliable=false;
-        break;
-      case ReliableUnordered:
-        toBeSent.unordered=true;
-        toBeSent.unreliable=false;
-        break;
+bool TCPStream::serializeFrameHeader(size_t payloadSize, FrameHeader* header) const {
+    // Base64 rewrites the payload and test fragmentation splits it, so
+    // neither can put it on the wire as is
+    if (mStreamType==BASE64_ZERODELIM || (mStreamType==RFC_6455 && sFragmentPackets))
+        return false;
+
+    uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
+    unsigned int streamIdLength=mID.serialize(serializedStreamId,StreamID::MAX_SERIALIZED_LENGTH);
+    assert(streamIdLength<=StreamID::MAX_SERIALIZED_LENGTH);
+    size_t totalSize=payloadSize+streamIdLength;
+    uint8 *packetHeader=header->bytes;
+    unsigned int packetHeaderLength;
+    if (mStreamType==RFC_6455) {
+        packetHeaderLength = 2;
+        packetHeader[0] = 0x80 | 0x02 ; // Flags = FIN/Unfragmented, Opcode = 2: binary data
+        if (totalSize <= 125) {
+          packetHeader[1] = totalSize;
+        } else if (totalSize <= 65535) {
+          packetHeader[1] = 126;
+          packetHeader[2] = (totalSize >> 8);
+          packetHeader[3] = (totalSize & 0xff);
+          packetHeaderLength += 2;
+        } else {
+          // why do they jump from 16-bit to 64-bit
+          packetHeader[1] = 127;
+          packetHeader[2] = 0;
+          packetHeader[3] = 0;
+          packetHeader[4] = 0;
+          packetHeader[5] = 0;
+          packetHeader[6] = (totalSize >> 24);
+          packetHeader[7] = ((totalSize >> 16) & 0xff);
+          packetHeader[8] = ((totalSize >> 8) & 0xff);
+          packetHeader[9] = (totalSize & 0xff);
+          packetHeaderLength += 8;
+        }
+    } else { // LENGTH_DELIM
+        VariableLength packetLength=VariableLength(totalSize);
+        packetHeaderLength=packetLength.serialize(packetHeader,VariableLength::MAX_SERIALIZED_LENGTH);
     }
-    toBeSent.originStream=getID();
-    ///this function should never return something larger than the  MAX_SERIALIZED_LEGNTH
-    switch (mStreamType) {
-      case BASE64_ZERODELIM: {
+    std::memcpy(packetHeader+packetHeaderLength,serializedStreamId,streamIdLength);
+    header->size=packetHeaderLength+streamIdLength;
+    return true;
+}
+bool TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, StreamReliability reliability) {
+    FrameHeader header;
+    Chunk *data;
+    if (serializeFrameHeader(firstChunk.size()+secondChunk.size(),&header)) {
+        // The framing is written from its own buffer, so the payload is
+        // copied exactly once
+        data=new Chunk(firstChunk.size()+secondChunk.size());
+        if (firstChunk.size()) {
+            std::memcpy(&(*data)[0],
+                        firstChunk.data(),
+                        firstChunk.size());
+        }
+        if (secondChunk.size()) {
+            std::memcpy(&(*data)[firstChunk.size()],
+                        secondChunk.data(),
+                        secondChunk.size());
+        }
+    }else if (mStreamType==BASE64_ZERODELIM) {
         uint8 serializedStreamId[StreamID::MAX_HEX_SERIALIZED_LENGTH];
         unsigned int streamIdLength=StreamID::MAX_HEX_SERIALIZED_LENGTH;
-        unsigned int successLengthNeeded=toBeSent.originStream.serializeToHex(serializedStreamId,streamIdLength);
+        unsigned int successLengthNeeded=mID.serializeToHex(serializedStreamId,streamIdLength);
         assert(successLengthNeeded<=streamIdLength);
 
 
         MemoryReference streamIdBytes(serializedStreamId,successLengthNeeded);
-        toBeSent.data = ASIOSocketWrapper::toBase64ZeroDelim(firstChunk,
-                                                             secondChunk,
-                                                             MemoryReference(NULL,0),
-                                                             &streamIdBytes);
-      } break;
-      case RFC_6455: if (sFragmentPackets) {///this is just testing code to fragment send packets
+        data = ASIOSocketWrapper::toBase64ZeroDelim(firstChunk,
+                                                    secondChunk,
+                                                    MemoryReference(NULL,0),
+                                                    &streamIdBytes);
+    }else {///this is just testing code to fragment send packets
         uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
         unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
-        unsigned int successLengthNeeded=toBeSent.originStream.serialize(serializedStreamId,streamIdLength);
+        unsigned int successLengthNeeded=mID.serialize(serializedStreamId,streamIdLength);
         assert(successLengthNeeded<=streamIdLength);
         streamIdLength=successLengthNeeded;
         size_t totalSize=firstChunk.size()+secondChunk.size();
@@ -170,7 +216,7 @@ bool TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, St
             numFragments=totalSize;
         //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
         //packetHeaderLength = the length of the length component of the packet
-        toBeSent.data=new Chunk(0);
+        data=new Chunk(0);
         std::vector<uint8> consolidatedBuffer(totalSize);
         std::copy(serializedStreamId,serializedStreamId+streamIdLength,consolidatedBuffer.begin());
         std::copy((const uint8*)firstChunk.begin(),(const uint8*)firstChunk.end(),consolidatedBuffer.begin()+streamIdLength);
@@ -207,93 +253,52 @@ bool TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, St
                 packetHeader[9] = (frag_size & 0xff);
                 packetHeaderLength += 8;
             }
-            toBeSent.data->resize(offset+frag_size+packetHeaderLength);
-            uint8 *outputBuffer=&(*toBeSent.data)[offset];
-            std::copy(packetHeader,packetHeader+packetHeaderLength,toBeSent.data->begin()+offset);
-            std::copy(consolidatedBuffer.begin()+bytes_copied,consolidatedBuffer.begin()+bytes_copied+frag_size,toBeSent.data->begin()+offset+packetHeaderLength);
+            data->resize(offset+frag_size+packetHeaderLength);
+            uint8 *outputBuffer=&(*data)[offset];
+            std::copy(packetHeader,packetHeader+packetHeaderLength,data->begin()+offset);
+            std::copy(consolidatedBuffer.begin()+bytes_copied,consolidatedBuffer.begin()+bytes_copied+frag_size,data->begin()+offset+packetHeaderLength);
             bytes_copied+=frag_size;
-            offset=toBeSent.data->size();
-        }
-        } else {
-        uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
-        unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
-        unsigned int successLengthNeeded=toBeSent.originStream.serialize(serializedStreamId,streamIdLength);
-        assert(successLengthNeeded<=streamIdLength);
-        streamIdLength=successLengthNeeded;
-        size_t totalSize=firstChunk.size()+secondChunk.size();
-        totalSize+=streamIdLength;
-        uint8 packetHeader[12];
-        unsigned int packetHeaderLength = 2;
-        packetHeader[0] = 0x80 | 0x02 ; // Flags = FIN/Unfragmented, Opcode = 2: binary data
-        if (totalSize <= 125) {
-          packetHeader[1] = totalSize;
-        } else if (totalSize <= 65535) {
-          packetHeader[1] = 126;
-          packetHeader[2] = (totalSize >> 8);
-          packetHeader[3] = (totalSize & 0xff);
-          packetHeaderLength += 2;
-        } else {
-          // why do they jump from 16-bit to 64-bit
-          packetHeader[1] = 127;
-          packetHeader[2] = 0;
-          packetHeader[3] = 0;
-          packetHeader[4] = 0;
-          packetHeader[5] = 0;
-          packetHeader[6] = (totalSize >> 24);
-          packetHeader[7] = ((totalSize >> 16) & 0xff);
-          packetHeader[8] = ((totalSize >> 8) & 0xff);
-          packetHeader[9] = (totalSize & 0xff);
-          packetHeaderLength += 8;
-        }
-        //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
-        //packetHeaderLength = the length of the length component of the packet
-        toBeSent.data=new Chunk(totalSize+packetHeaderLength);
-
-        uint8 *outputBuffer=&(*toBeSent.data)[0];
-        std::memcpy(outputBuffer,packetHeader,packetHeaderLength);
-        std::memcpy(outputBuffer+packetHeaderLength,serializedStreamId,streamIdLength);
-        if (firstChunk.size()) {
-            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength],
-                        firstChunk.data(),
-                        firstChunk.size());
-        }
-        if (secondChunk.size()) {
-            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength+firstChunk.size()],
-                        secondChunk.data(),
-                        secondChunk.size());
-        }
-      } break;
-      case LENGTH_DELIM:
-      default: {
-        uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
-        unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
-        unsigned int successLengthNeeded=toBeSent.originStream.serialize(serializedStreamId,streamIdLength);
-        assert(successLengthNeeded<=streamIdLength);
-        streamIdLength=successLengthNeeded;
-        size_t totalSize=firstChunk.size()+secondChunk.size();
-        totalSize+=streamIdLength;
-        VariableLength packetLength=VariableLength(totalSize);
-        uint8 packetLengthSerialized[VariableLength::MAX_SERIALIZED_LENGTH];
-        unsigned int packetHeaderLength=packetLength.serialize(packetLengthSerialized,VariableLength::MAX_SERIALIZED_LENGTH);
-        //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
-        //packetHeaderLength = the length of the length component of the packet
-        toBeSent.data=new Chunk(totalSize+packetHeaderLength);
-
-        uint8 *outputBuffer=&(*toBeSent.data)[0];
-        std::memcpy(outputBuffer,packetLengthSerialized,packetHeaderLength);
-        std::memcpy(outputBuffer+packetHeaderLength,serializedStreamId,streamIdLength);
-        if (firstChunk.size()) {
-            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength],
-                        firstChunk.data(),
-                        firstChunk.size());
+            offset=data->size();
         }
-        if (secondChunk.size()) {
-            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength+firstChunk.size()],
-                        secondChunk.data(),
-                        secondChunk.size());
-        }
-      } break;
     }
+    bool didsend=sendFramed(header,data,reliability,data->size());
+    if (!didsend) {
+        //if the data was not sent, its our job to clean it up
+        delete data;
+    }
+    return didsend;
+}
+bool TCPStream::sendOwned(Chunk* data, StreamReliability reliability) {
+    FrameHeader header;
+    if (!serializeFrameHeader(data->size(),&header)) {
+        bool didsend=send(*data,reliability);
+        if (didsend)
+            delete data;
+        return didsend;
+    }
+    return sendFramed(header,data,reliability,0);
+}
+bool TCPStream::sendFramed(const FrameHeader& header, Chunk* data, StreamReliability reliability, size_t bytesCopied) {
+    MultiplexedSocket::RawRequest toBeSent;
+    // only allow 3 of the four possibilities because unreliable ordered is tricky and usually useless
+    switch(reliability) {
+      case Unreliable:
+        toBeSent.unordered=true;
+        toBeSent.unreliable=true;
+        break;
+      case ReliableOrdered:
+        toBeSent.unordered=false;
+        toBeSent.unreliable=false;
+        break;
+      case ReliableUnordered:
+        toBeSent.unordered=true;
+        toBeSent.unreliable=false;
+        break;
+    }
+    toBeSent.originStream=getID();
+    toBeSent.header=header;
+    toBeSent.data=data;
+
     bool didsend=false;
     //indicate to other would-be TCPStream::close()ers that we are sending and they will have to wait until we give up control to actually ack the close and shut down the stream
     unsigned int sendStatus=++(*mSendStatus);
@@ -301,14 +306,15 @@ bool TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, St
         MultiplexedSocketPtr socket_copy = mSocket;
         if (socket_copy.get() == NULL)
             didsend = false;
-        else
+        else {
             didsend=MultiplexedSocket::sendBytes(socket_copy,toBeSent,mSendBufferSize);
+            if (didsend)
+                socket_copy->recordBytesCopied(bytesCopied);
+        }
     }
     //relinquish control to a potential closer
     --(*mSendStatus);
     if (!didsend) {
-        //if the data was not sent, its our job to clean it up
-        delete toBeSent.data;
         if ((mSendStatus->read()&(3*SendStatusClosing))!=0) {///max of 3 entities can close the stream at once (FIXME: should implement |= on atomic ints), but as of now at most the recv thread the sender responsible and a user close() is all that is allowed at once...so 3 is fine)
             SILOG(tcpsst,debug,"printing to closed stream id "<<getID().read());
         }
@@ -373,7 +379,10 @@ TCPStream::TCPStream(IOStrand* io,OptionSet*options):mSendStatus(new AtomicValue
     mKernelSendBufferSize=kernelSendBufferSize->as<unsigned int>();
     mKernelReceiveBufferSize=kernelReceiveBufferSize->as<unsigned int>();
     mNoDelay=noDelay->as<bool>();
-    mStreamType=oldLengthDelim->as<bool>() ? TCPStream::LENGTH_DELIM : TCPStream::RFC_6455;
+    if (base64->as<bool>())
+        mStreamType=TCPStream::BASE64_ZERODELIM;
+    else
+        mStreamType=oldLengthDelim->as<bool>() ? TCPStream::LENGTH_DELIM : TCPStream::RFC_6455;
 }
 
 TCPStream::TCPStream(IOStrand* io,unsigned char numSimultSockets,unsigned int sendBufferSize,bool noDelay, StreamType streamType, unsigned int kernelSendBufferSize,unsigned int kernelReceiveBufferSize):mSendStatus(new AtomicValue<int>(0)) {
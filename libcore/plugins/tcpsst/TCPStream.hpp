@@ -35,6 +35,7 @@
 #include <sirikata/core/network/Stream.hpp>
 #include <sirikata/core/util/AtomicTypes.hpp>
 #include "TCPSSTDecls.hpp"
+#include "FrameHeader.hpp"
 
 namespace Sirikata {
 namespace Network {
@@ -139,6 +140,14 @@ private:
 
     ///Constructor which leaves socket in a disconnection state, prepared for a connect() or a clone() called internally from factory
     TCPStream(IOStrand*,unsigned char mNumSimultaneousSockets, unsigned int mSendBufferSize, bool noDelay, StreamType streamType, unsigned int kernelSendBufferSize, unsigned int kernelReceiveBufferSize);
+    /**
+     * Fills in the length and StreamID framing for a payload of the given size.
+     * Returns false if the stream type can't send payloads unmodified after a
+     * separate header, in which case the payload must be framed in place.
+     */
+    bool serializeFrameHeader(size_t payloadSize, FrameHeader* header) const;
+    ///Queues a framed packet, taking ownership of data only if it returns true
+    bool sendFramed(const FrameHeader& header, Chunk* data, StreamReliability reliability, size_t bytesCopied);
 
 
 public:
@@ -184,6 +193,9 @@ public:
     ///Implementation of send interface
     WARN_UNUSED
     virtual bool send(const Chunk&data,StreamReliability);
+    ///Implementation of send interface which writes data out in place, without copying it
+    WARN_UNUSED
+    virtual bool sendOwned(Chunk* data,StreamReliability);
     virtual bool canSend(size_t dataSize)const;
     ///Implementation of connect interface
     virtual void connect(
@@ -215,6 +227,7 @@ public:
 
     virtual Duration averageSendLatency() const;
     virtual Duration averageReceiveLatency() const;
+    virtual uint64 bytesCopied() const;
 };
 
 } // namespace Network
@@ -0,0 +1,287 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/network/EventLoopStats.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/thread/locks.hpp>
+#include <cstring>
+
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+namespace Sirikata {
+namespace Network {
+
+namespace {
+
+// Timer::now() goes through the local time conversion, which is far too slow
+// to call a few times per handler. Only differences are needed, so use the
+// cheapest monotonic clock available.
+uint64 nowMicroseconds() {
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+    static LARGE_INTEGER freq = { 0 };
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint64)(now.QuadPart / (freq.QuadPart / 1000000.0));
+#elif defined(CLOCK_MONOTONIC)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+typedef boost::mutex Mutex;
+typedef boost::lock_guard<Mutex> LockGuard;
+
+// Protects the interned tags and thread indices
+Mutex gMutex;
+// Tag 0 is "(other)", for tags beyond MAX_TAGS
+std::vector<String> gTagNames;
+typedef std::tr1::unordered_map<String, uint32> TagIDMap;
+TagIDMap gTagIDs;
+// Thread indices are reused after threads exit, lowest first so threads stay
+// within MAX_THREADS if possible
+std::set<uint32> gFreeThreadIndices;
+uint32 gNextThreadIndex = 0;
+
+// Most tags are string literals, so they're cached by pointer and only need
+// to be interned once per thread. Tags built at runtime can reuse the same
+// buffer for different strings, so the name is kept to check hits against.
+struct CachedTag {
+    uint32 id;
+    String name;
+};
+
+struct ThreadState {
+    uint32 index;
+    typedef std::tr1::unordered_map<const char*, CachedTag> TagCache;
+    TagCache tags;
+};
+
+void releaseThreadState(ThreadState* ts) {
+    {
+        LockGuard lock(gMutex);
+        gFreeThreadIndices.insert(ts->index);
+    }
+    delete ts;
+}
+
+boost::thread_specific_ptr<ThreadState> gThreadState(releaseThreadState);
+
+ThreadState* threadState() {
+    ThreadState* ts = gThreadState.get();
+    if (ts == NULL) {
+        ts = new ThreadState();
+        {
+            LockGuard lock(gMutex);
+            if (gFreeThreadIndices.empty()) {
+                ts->index = gNextThreadIndex++;
+            }
+            else {
+                ts->index = *gFreeThreadIndices.begin();
+                gFreeThreadIndices.erase(gFreeThreadIndices.begin());
+            }
+        }
+        gThreadState.reset(ts);
+    }
+    return ts;
+}
+
+uint32 internTag(ThreadState* ts, const char* tag) {
+    const char* name_str = (tag == NULL ? "(NULL)" : tag);
+    ThreadState::TagCache::iterator it = ts->tags.find(tag);
+    if (it != ts->tags.end() && std::strcmp(it->second.name.c_str(), name_str) == 0)
+        return it->second.id;
+
+    String name(name_str);
+    uint32 id = 0;
+    {
+        LockGuard lock(gMutex);
+        if (gTagNames.empty())
+            gTagNames.push_back("(other)");
+        TagIDMap::iterator id_it = gTagIDs.find(name);
+        if (id_it != gTagIDs.end()) {
+            id = id_it->second;
+        }
+        else if (gTagNames.size() < EventLoopStats::MAX_TAGS) {
+            id = gTagNames.size();
+            gTagNames.push_back(name);
+            gTagIDs[name] = id;
+        }
+    }
+    // Tags built at runtime can each have their own buffer, so don't let
+    // them grow the cache forever
+    if (ts->tags.size() >= 4 * EventLoopStats::MAX_TAGS)
+        ts->tags.clear();
+    CachedTag& cached = ts->tags[tag];
+    cached.id = id;
+    cached.name = name;
+    return id;
+}
+
+bool busiestFirst(const EventLoopStats::TagStats& lhs, const EventLoopStats::TagStats& rhs) {
+    if (lhs.handled != rhs.handled)
+        return lhs.handled > rhs.handled;
+    return lhs.queued > rhs.queued;
+}
+
+} // namespace
+
+bool EventLoopStats::sEnabled = false;
+
+EventLoopStats::ThreadCounters::ThreadCounters() {
+    for(uint32 i = 0; i < MAX_TAGS; i++)
+        tags[i] = NULL;
+}
+
+EventLoopStats::ThreadCounters::~ThreadCounters() {
+    for(uint32 i = 0; i < MAX_TAGS; i++)
+        delete tags[i];
+}
+
+EventLoopStats::EventLoopStats() {
+    for(uint32 i = 0; i < MAX_THREADS; i++)
+        mThreads[i] = NULL;
+}
+
+EventLoopStats::~EventLoopStats() {
+    for(uint32 i = 0; i < MAX_THREADS; i++)
+        delete mThreads[i];
+}
+
+EventLoopStats::TagCounters* EventLoopStats::counters(uint32 thread_index, uint32 tag_id, bool* locked) {
+    ThreadCounters* tc = NULL;
+    if (thread_index < MAX_THREADS) {
+        tc = mThreads[thread_index];
+        if (tc == NULL) {
+            tc = new ThreadCounters();
+            // Make sure readers never see the pointer before what it
+            // points to
+            memory_barrier();
+            mThreads[thread_index] = tc;
+        }
+        *locked = false;
+    }
+    else {
+        mOverflowMutex.lock();
+        tc = &mOverflow;
+        *locked = true;
+    }
+
+    TagCounters* result = tc->tags[tag_id];
+    if (result == NULL) {
+        result = new TagCounters();
+        memory_barrier();
+        tc->tags[tag_id] = result;
+    }
+    return result;
+}
+
+uint32 EventLoopStats::enqueued(const char* tag) {
+    ThreadState* ts = threadState();
+    uint32 tag_id = internTag(ts, tag);
+    bool locked;
+    counters(ts->index, tag_id, &locked)->enqueued++;
+    if (locked) mOverflowMutex.unlock();
+    return tag_id;
+}
+
+EventLoopStats::TrackedHandler EventLoopStats::wrap(const IOCallback& handler, const char* tag) {
+    uint32 tag_id = enqueued(tag);
+    return TrackedHandler(shared_from_this(), tag_id, nowMicroseconds(), 0, handler);
+}
+
+EventLoopStats::TrackedHandler EventLoopStats::wrapTimer(const Duration& waitFor, const IOCallback& handler, const char* tag) {
+    uint32 tag_id = enqueued(tag);
+    uint64 delay = std::max(waitFor.toMicro(), (int64)0);
+    return TrackedHandler(shared_from_this(), tag_id, nowMicroseconds(), delay, handler);
+}
+
+void EventLoopStats::handle(uint32 tag_id, uint64 start, uint64 delay, const IOCallback& handler) {
+    uint64 begin = nowMicroseconds();
+    handler();
+    uint64 end = nowMicroseconds();
+
+    uint64 waited = begin - start;
+    bool locked;
+    TagCounters* tc = counters(threadState()->index, tag_id, &locked);
+    tc->handled++;
+    tc->wait.add(waited > delay ? waited - delay : 0);
+    tc->run.add(end - begin);
+    if (locked) mOverflowMutex.unlock();
+}
+
+void EventLoopStats::collect(TagStatsList& by_id) const {
+    {
+        LockGuard lock(gMutex);
+        by_id.resize(gTagNames.size());
+        for(uint32 i = 0; i < gTagNames.size(); i++)
+            by_id[i].tag = gTagNames[i];
+    }
+
+    // Enqueued and handled may be counted on different threads, so totals
+    // are kept until all threads have been added up
+    std::vector<uint64> enqueued(by_id.size(), 0);
+    LockGuard lock(mOverflowMutex);
+    for(uint32 t = 0; t <= MAX_THREADS; t++) {
+        const ThreadCounters* tc = (t < MAX_THREADS ? mThreads[t] : &mOverflow);
+        if (tc == NULL) continue;
+        memory_barrier();
+        for(uint32 i = 0; i < by_id.size(); i++) {
+            const TagCounters* counters = tc->tags[i];
+            if (counters == NULL) continue;
+            enqueued[i] += counters->enqueued;
+            by_id[i].handled += counters->handled;
+            by_id[i].wait.merge(counters->wait);
+            by_id[i].run.merge(counters->run);
+        }
+    }
+    for(uint32 i = 0; i < by_id.size(); i++)
+        by_id[i].queued = (enqueued[i] > by_id[i].handled ? enqueued[i] - by_id[i].handled : 0);
+}
+
+void EventLoopStats::sortStats(TagStatsList& by_id, TagStatsList& stats_out) {
+    for(uint32 i = 0; i < by_id.size(); i++) {
+        if (by_id[i].handled == 0 && by_id[i].queued == 0) continue;
+        stats_out.push_back(by_id[i]);
+    }
+    std::sort(stats_out.begin(), stats_out.end(), busiestFirst);
+}
+
+void EventLoopStats::getStats(TagStatsList& stats_out) const {
+    TagStatsList by_id;
+    collect(by_id);
+    sortStats(by_id, stats_out);
+}
+
+void EventLoopStats::getRecentStats(TagStatsList& stats_out) {
+    TagStatsList by_id;
+    collect(by_id);
+
+    TagStatsList recent(by_id);
+    {
+        LockGuard lock(mRecentMutex);
+        for(uint32 i = 0; i < mLastRecent.size() && i < recent.size(); i++) {
+            const TagStats& last = mLastRecent[i];
+            recent[i].handled = (recent[i].handled > last.handled ? recent[i].handled - last.handled : 0);
+            recent[i].wait.subtract(last.wait);
+            recent[i].run.subtract(last.run);
+        }
+        mLastRecent.swap(by_id);
+    }
+    sortStats(recent, stats_out);
+}
+
+} // namespace Network
+} // namespace Sirikata
@@ -39,6 +39,7 @@
 #include <boost/lexical_cast.hpp>
 #include <sirikata/core/util/Timer.hpp>
 #include <sirikata/core/command/Commander.hpp>
+#include <sirikata/core/trace/TimeSeries.hpp>
 
 namespace Sirikata {
 namespace Network {
@@ -54,7 +55,6 @@ typedef std::tr1::shared_ptr<deadline_timer> deadline_timer_ptr;
 typedef boost::posix_time::microseconds posix_microseconds;
 using std::tr1::placeholders::_1;
 
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
 namespace {
 typedef boost::mutex AllIOServicesMutex;
 typedef boost::lock_guard<AllIOServicesMutex> AllIOServicesLockGuard;
@@ -62,11 +62,11 @@ AllIOServicesMutex gAllIOServicesMutex;
 typedef std::tr1::unordered_set<IOService*> AllIOServicesSet;
 AllIOServicesSet gAllIOServices;
 } // namespace
-#endif
 
 
 IOService::IOService(const String& name)
- : mName(name)
+ : mName(name),
+   mEventLoopStats(new EventLoopStats())
 #ifdef SIRIKATA_TRACK_EVENT_QUEUES
    ,
    mTimersEnqueued(0),
@@ -78,30 +78,30 @@ IOService::IOService(const String& name)
 {
     mImpl = new boost::asio::io_service(1);
 
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
     AllIOServicesLockGuard lock(gAllIOServicesMutex);
     gAllIOServices.insert(this);
-#endif
 }
 
 IOService::~IOService(){
     delete mImpl;
 
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
     AllIOServicesLockGuard lock(gAllIOServicesMutex);
     gAllIOServices.erase(this);
-#endif
 }
 
 IOStrand* IOService::createStrand(const String& name) {
     IOStrand* res = new IOStrand(*this, name);
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
     LockGuard lock(mMutex);
     mStrands.insert(res);
-#endif
     return res;
 }
 
+void IOService::destroyingStrand(IOStrand* child) {
+    LockGuard lock(mMutex);
+    assert(mStrands.find(child) != mStrands.end());
+    mStrands.erase(child);
+}
+
 uint32 IOService::pollOne() {
     return (uint32) mImpl->poll_one();
 }
@@ -145,7 +145,10 @@ void IOService::dispatch(
         std::tr1::bind(&IOService::decrementCount, this, Timer::now(), handler, tag,tagStat)
     );
 #else
-    mImpl->dispatch(handler);
+    if (EventLoopStats::enabled())
+        mImpl->dispatch(mEventLoopStats->wrap(handler, tag));
+    else
+        mImpl->dispatch(handler);
 #endif
 }
 
@@ -164,7 +167,10 @@ void IOService::post(
         std::tr1::bind(&IOService::decrementCount, this, Timer::now(), handler, tag,tagStat)
     );
 #else
-    mImpl->post(handler);
+    if (EventLoopStats::enabled())
+        mImpl->post(mEventLoopStats->wrap(handler, tag));
+    else
+        mImpl->post(handler);
 #endif
 }
 
@@ -178,16 +184,9 @@ void handle_deadline_timer(const boost::system::error_code&e, const deadline_tim
 } // namespace
 
 void IOService::post(const Duration& waitFor, const IOCallback& handler, const char* tag, const char* tagStat) {
-#if BOOST_VERSION==103900
-    static bool warnOnce=true;
-    if (warnOnce) {
-        warnOnce=false;
-        SILOG(core,error,"Using buggy version of boost (1.39.0), leaking deadline_timer to avoid crash");
-    }
-#endif
+#ifdef SIRIKATA_TRACK_EVENT_QUEUES
     deadline_timer_ptr timer(new deadline_timer(*mImpl, posix_microseconds(waitFor.toMicroseconds())));
 
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
     mTimersEnqueued++;
     {
         LockGuard lock(mMutex);
@@ -202,10 +201,25 @@ void IOService::post(const Duration& waitFor, const IOCallback& handler, const c
         )
     );
 #else
-    timer->async_wait(std::tr1::bind(&handle_deadline_timer, _1, timer, handler));
+    if (EventLoopStats::enabled())
+        postTimer(waitFor, mEventLoopStats->wrapTimer(waitFor, handler, tag));
+    else
+        postTimer(waitFor, handler);
 #endif
 }
 
+void IOService::postTimer(const Duration& waitFor, const IOCallback& handler) {
+#if BOOST_VERSION==103900
+    static bool warnOnce=true;
+    if (warnOnce) {
+        warnOnce=false;
+        SILOG(core,error,"Using buggy version of boost (1.39.0), leaking deadline_timer to avoid crash");
+    }
+#endif
+    deadline_timer_ptr timer(new deadline_timer(*mImpl, posix_microseconds(waitFor.toMicroseconds())));
+    timer->async_wait(std::tr1::bind(&handle_deadline_timer, _1, timer, handler));
+}
+
 
 
 #ifdef SIRIKATA_TRACK_EVENT_QUEUES
@@ -261,12 +275,6 @@ void IOService::decrementCount(const Time& start, const IOCallback& cb, const ch
 }
 
 
-void IOService::destroyingStrand(IOStrand* child) {
-    LockGuard lock(mMutex);
-    assert(mStrands.find(child) != mStrands.end());
-    mStrands.erase(child);
-}
-
 namespace {
 // The original data
 typedef std::tr1::unordered_map<const char*, uint32> TagCountMap;
@@ -411,20 +419,100 @@ void IOService::fillCommandResultWithStats(Command::Result& res) {
     }
 
 }
+
+#else
+
+namespace {
+
+void fillEventLoopStats(const EventLoopStats& stats, Command::Result& res_out, const String& path) {
+    EventLoopStats::TagStatsList tags;
+    stats.getStats(tags);
+
+    res_out.put(path, Command::Array());
+    Command::Array& items = res_out.getArray(path);
+    for(EventLoopStats::TagStatsList::iterator it = tags.begin(); it != tags.end(); it++) {
+        items.push_back(Command::Object());
+        Command::Result& item = items.back();
+        item.put("tag", it->tag);
+        item.put("queued", it->queued);
+        item.put("handled", it->handled);
+        // Latencies in microseconds
+        item.put("wait.mean", it->wait.mean().toMicro());
+        item.put("wait.p50", it->wait.percentile(.5).toMicro());
+        item.put("wait.p99", it->wait.percentile(.99).toMicro());
+        item.put("wait.max", it->wait.max().toMicro());
+        item.put("run.mean", it->run.mean().toMicro());
+        item.put("run.p50", it->run.percentile(.5).toMicro());
+        item.put("run.p99", it->run.percentile(.99).toMicro());
+        item.put("run.max", it->run.max().toMicro());
+    }
+}
+
+} // namespace
+
+void IOService::fillCommandResultWithStats(Command::Result& res) {
+    LockGuard lock(mMutex);
+
+    res.put("name", name());
+    res.put("enabled", EventLoopStats::enabled());
+    fillEventLoopStats(*mEventLoopStats, res, "handlers");
+
+    res.put("strands", Command::Array());
+    Command::Array& strands = res.getArray("strands");
+    for(StrandSet::const_iterator it = mStrands.begin(); it != mStrands.end(); it++) {
+        strands.push_back(Command::Object());
+        strands.back().put("name", (*it)->name());
+        fillEventLoopStats((*it)->eventLoopStats(), strands.back(), "handlers");
+    }
+}
+
 #endif
 
+namespace {
+
+// TimeSeries keys are split on '.', so names and tags can't contain them
+String timeSeriesKey(const String& name) {
+    String key = name;
+    for(String::iterator it = key.begin(); it != key.end(); it++) {
+        if (!isalnum((unsigned char)*it) && *it != '-')
+            *it = '_';
+    }
+    return key;
+}
+
+void reportTagStats(EventLoopStats& stats, Trace::TimeSeries* ts, const String& prefix) {
+    EventLoopStats::TagStatsList tags;
+    stats.getRecentStats(tags);
+    for(EventLoopStats::TagStatsList::iterator it = tags.begin(); it != tags.end(); it++) {
+        String tag_prefix = prefix + "." + timeSeriesKey(it->tag);
+        ts->report(tag_prefix + ".queued", it->queued);
+        ts->report(tag_prefix + ".handled", it->handled);
+        if (it->handled == 0) continue;
+        ts->report(tag_prefix + ".wait_p99_us", it->wait.percentile(.99).toMicro());
+        ts->report(tag_prefix + ".run_p99_us", it->run.percentile(.99).toMicro());
+    }
+}
+
+} // namespace
+
+void IOService::reportEventLoopStats(Trace::TimeSeries* ts, const String& prefix) {
+    LockGuard lock(mMutex);
+
+    String service_prefix = prefix + "." + timeSeriesKey(name());
+    reportTagStats(*mEventLoopStats, ts, service_prefix);
+    for(StrandSet::const_iterator it = mStrands.begin(); it != mStrands.end(); it++)
+        reportTagStats(*(*it)->mEventLoopStats, ts, service_prefix + "." + timeSeriesKey((*it)->name()));
+}
+
 void IOService::commandReportStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
     AllIOServicesLockGuard lock(gAllIOServicesMutex);
 
     Command::Result result = Command::EmptyResult();
     fillCommandResultWithStats(result);
     cmdr->result(cmdid, result);
-#endif
 }
 
 void IOService::commandReportAllStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
     AllIOServicesLockGuard lock(gAllIOServicesMutex);
 
     Command::Result result = Command::EmptyResult();
@@ -437,7 +525,6 @@ void IOService::commandReportAllStats(const Command::Command& cmd, Command::Comm
         (*it)->fillCommandResultWithStats(services.back());
     }
     cmdr->result(cmdid, result);
-#endif
 }
 
 
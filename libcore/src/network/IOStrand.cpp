@@ -41,7 +41,8 @@ namespace Network {
 
 IOStrand::IOStrand(IOService& io, const String& name)
  : mService(io),
-   mName(name)
+   mName(name),
+   mEventLoopStats(new EventLoopStats())
 #ifdef SIRIKATA_TRACK_EVENT_QUEUES
    ,
    mTimersEnqueued(0),
@@ -54,9 +55,7 @@ IOStrand::IOStrand(IOService& io, const String& name)
 }
 
 IOStrand::~IOStrand() {
-#ifdef SIRIKATA_TRACK_EVENT_QUEUES
     mService.destroyingStrand(this);
-#endif
     delete mImpl;
 }
 
@@ -80,7 +79,11 @@ void IOStrand::dispatch(const IOCallback& handler, const char* tag) {
         "(IOStrands)",tag
     );
 #else
-    mService.dispatch( mImpl->wrap( handler ) );
+    // The service doesn't need to track these too
+    if (EventLoopStats::enabled())
+        mService.mImpl->dispatch( mImpl->wrap( mEventLoopStats->wrap(handler, tag) ) );
+    else
+        mService.dispatch( mImpl->wrap( handler ) );
 #endif
 }
 
@@ -100,7 +103,10 @@ void IOStrand::post(const IOCallback& handler, const char* tag) {
         "(IOStrands)", tag
     );
 #else
-    mService.post( mImpl->wrap( handler ) );
+    if (EventLoopStats::enabled())
+        mService.mImpl->post( mImpl->wrap( mEventLoopStats->wrap(handler, tag) ) );
+    else
+        mService.post( mImpl->wrap( handler ) );
 #endif
 }
 
@@ -121,7 +127,10 @@ void IOStrand::post(const Duration& waitFor, const IOCallback& handler, const ch
         "(IOStrands)",tag
     );
 #else
-    mService.post(waitFor, mImpl->wrap( handler ) );
+    if (EventLoopStats::enabled())
+        mService.postTimer(waitFor, mImpl->wrap( mEventLoopStats->wrapTimer(waitFor, handler, tag) ) );
+    else
+        mService.post(waitFor, mImpl->wrap( handler ) );
 #endif
 }
 
@@ -0,0 +1,44 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/network/Message.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+// Number of IDs a thread claims from the shared counter at a time
+#define MESSAGE_ID_BLOCK_SIZE 1024
+
+// Index of the next unclaimed block
+AtomicValue<uint64> sNextMessageIDBlock(0);
+
+struct ThreadMessageIDs {
+    uint64 next;
+    uint64 end;
+};
+boost::thread_specific_ptr<ThreadMessageIDs> sThreadMessageIDs;
+
+} // namespace
+
+uint64 GenerateUniqueMessageIDSource() {
+    ThreadMessageIDs* ids = sThreadMessageIDs.get();
+    if (ids == NULL) {
+        ids = new ThreadMessageIDs();
+        ids->next = ids->end = 0;
+        sThreadMessageIDs.reset(ids);
+    }
+
+    if (ids->next == ids->end) {
+        uint64 block = sNextMessageIDBlock++;
+        ids->next = block * MESSAGE_ID_BLOCK_SIZE;
+        ids->end = ids->next + MESSAGE_ID_BLOCK_SIZE;
+    }
+    return ids->next++;
+}
+
+} // namespace Sirikata
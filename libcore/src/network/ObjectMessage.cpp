@@ -32,9 +32,153 @@
 
 #include <sirikata/core/network/ObjectMessage.hpp>
 #include <sirikata/core/util/SpaceObjectReference.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
 
 namespace Sirikata {
 
+namespace {
+
+// Most messages a thread keeps for itself
+#define OBJECT_MESSAGE_THREAD_CACHE_SIZE 256
+// Number of messages moved between a thread's cache and the shared depot at
+// once
+#define OBJECT_MESSAGE_TRANSFER_BATCH_SIZE 128
+// Most batches held in the shared depot. Beyond this released messages are
+// just deleted.
+#define OBJECT_MESSAGE_MAX_DEPOT_BATCHES 64
+
+typedef Sirikata::Protocol::Object::ObjectMessage PooledObjectMessage;
+typedef std::vector<PooledObjectMessage*> ObjectMessageList;
+
+struct ObjectMessageThreadCache {
+    ObjectMessageList free;
+    ObjectMessagePoolStats stats;
+};
+typedef std::vector<ObjectMessageThreadCache*> ObjectMessageThreadCacheList;
+
+// Protects everything below. Threads only take it when their cache is empty or
+// full, when they start using the pool and when they exit.
+boost::mutex sObjectMessageDepotMutex;
+std::vector<ObjectMessageList*> sObjectMessageDepot;
+ObjectMessageThreadCacheList sObjectMessageThreadCaches;
+ObjectMessagePoolStats sObjectMessageExitedStats;
+
+void deleteObjectMessages(ObjectMessageList* msgs) {
+    for(uint32 i = 0; i < msgs->size(); i++)
+        delete (*msgs)[i];
+    delete msgs;
+}
+
+// Gives a batch to the depot, or deletes it if the depot is full
+void depositObjectMessages(ObjectMessageList* batch) {
+    {
+        boost::lock_guard<boost::mutex> lck(sObjectMessageDepotMutex);
+        if (sObjectMessageDepot.size() < OBJECT_MESSAGE_MAX_DEPOT_BATCHES) {
+            sObjectMessageDepot.push_back(batch);
+            return;
+        }
+    }
+    deleteObjectMessages(batch);
+}
+
+void cleanupObjectMessageThreadCache(ObjectMessageThreadCache* tc) {
+    while(!tc->free.empty()) {
+        uint32 nmove = std::min((uint32)tc->free.size(), (uint32)OBJECT_MESSAGE_TRANSFER_BATCH_SIZE);
+        depositObjectMessages(new ObjectMessageList(tc->free.end() - nmove, tc->free.end()));
+        tc->free.resize(tc->free.size() - nmove);
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lck(sObjectMessageDepotMutex);
+        sObjectMessageExitedStats.allocated += tc->stats.allocated;
+        sObjectMessageExitedStats.reused += tc->stats.reused;
+        sObjectMessageExitedStats.released += tc->stats.released;
+        sObjectMessageThreadCaches.erase(
+            std::find(sObjectMessageThreadCaches.begin(), sObjectMessageThreadCaches.end(), tc)
+        );
+    }
+    delete tc;
+}
+
+// Must be declared after the depot so it's destroyed, cleaning up the main
+// thread's cache, before the depot is.
+boost::thread_specific_ptr<ObjectMessageThreadCache> sObjectMessageThreadCache(&cleanupObjectMessageThreadCache);
+
+ObjectMessageThreadCache* getObjectMessageThreadCache() {
+    ObjectMessageThreadCache* tc = sObjectMessageThreadCache.get();
+    if (tc != NULL) return tc;
+
+    tc = new ObjectMessageThreadCache();
+    tc->free.reserve(OBJECT_MESSAGE_THREAD_CACHE_SIZE);
+    {
+        boost::lock_guard<boost::mutex> lck(sObjectMessageDepotMutex);
+        sObjectMessageThreadCaches.push_back(tc);
+    }
+    sObjectMessageThreadCache.reset(tc);
+    return tc;
+}
+
+} // namespace
+
+PooledObjectMessage* allocateObjectMessage() {
+    ObjectMessageThreadCache* tc = getObjectMessageThreadCache();
+
+    if (tc->free.empty()) {
+        ObjectMessageList* batch = NULL;
+        {
+            boost::lock_guard<boost::mutex> lck(sObjectMessageDepotMutex);
+            if (!sObjectMessageDepot.empty()) {
+                batch = sObjectMessageDepot.back();
+                sObjectMessageDepot.pop_back();
+            }
+        }
+        if (batch != NULL) {
+            tc->free.swap(*batch);
+            delete batch;
+        }
+    }
+
+    if (!tc->free.empty()) {
+        PooledObjectMessage* msg = tc->free.back();
+        tc->free.pop_back();
+        tc->stats.reused++;
+        return msg;
+    }
+
+    tc->stats.allocated++;
+    return new PooledObjectMessage();
+}
+
+void releaseObjectMessage(PooledObjectMessage* msg) {
+    if (msg == NULL) return;
+
+    ObjectMessageThreadCache* tc = getObjectMessageThreadCache();
+    tc->stats.released++;
+
+    if (tc->free.size() >= OBJECT_MESSAGE_THREAD_CACHE_SIZE) {
+        // Hand the least recently released ones to the depot, keeping the
+        // ones most likely to still be in this CPU's cache.
+        ObjectMessageList::iterator split = tc->free.begin() + OBJECT_MESSAGE_TRANSFER_BATCH_SIZE;
+        ObjectMessageList* batch = new ObjectMessageList(tc->free.begin(), split);
+        tc->free.erase(tc->free.begin(), split);
+        depositObjectMessages(batch);
+    }
+    tc->free.push_back(msg);
+}
+
+ObjectMessagePoolStats getObjectMessagePoolStats() {
+    boost::lock_guard<boost::mutex> lck(sObjectMessageDepotMutex);
+    ObjectMessagePoolStats result = sObjectMessageExitedStats;
+    for(ObjectMessageThreadCacheList::iterator it = sObjectMessageThreadCaches.begin(); it != sObjectMessageThreadCaches.end(); it++) {
+        result.allocated += (*it)->stats.allocated;
+        result.reused += (*it)->stats.reused;
+        result.released += (*it)->stats.released;
+    }
+    return result;
+}
+
 void createObjectHostMessage(ObjectHostID source_server, const SpaceObjectReference& sporef_src, ObjectMessagePort src_port, const UUID& dest, ObjectMessagePort dest_port, const std::string& payload, ObjectMessage* result) {
     if (result == NULL) return;
 
@@ -47,7 +191,7 @@ void createObjectHostMessage(ObjectHostID source_server, const SpaceObjectRefere
 }
 
 Sirikata::Protocol::Object::ObjectMessage* createObjectMessage(ServerID source_server, const SpaceObjectReference& sporef_src, ObjectMessagePort src_port, const UUID& dest, ObjectMessagePort dest_port, const std::string& payload) {
-    Sirikata::Protocol::Object::ObjectMessage* result = new Sirikata::Protocol::Object::ObjectMessage();
+    Sirikata::Protocol::Object::ObjectMessage* result = allocateObjectMessage();
 
     result->set_source_object(sporef_src.object().getAsUUID());
     result->set_source_port(src_port);
@@ -73,7 +217,7 @@ void createObjectHostMessage(ObjectHostID source_server, const UUID& src, Object
 
 
 Sirikata::Protocol::Object::ObjectMessage* createObjectMessage(ServerID source_server, const UUID& src, ObjectMessagePort src_port, const UUID& dest, ObjectMessagePort dest_port, const std::string& payload) {
-    Sirikata::Protocol::Object::ObjectMessage* result = new Sirikata::Protocol::Object::ObjectMessage();
+    Sirikata::Protocol::Object::ObjectMessage* result = allocateObjectMessage();
 
     result->set_source_object(src);
     result->set_source_port(src_port);
@@ -0,0 +1,80 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/network/SSTBuffer.hpp>
+#include <boost/thread/locks.hpp>
+
+AUTO_SINGLETON_INSTANCE(Sirikata::SST::BufferPool);
+
+namespace Sirikata {
+namespace SST {
+
+const uint32 BufferPool::SlabSize;
+
+BufferPool& BufferPool::getSingleton() {
+    return AutoSingleton<BufferPool>::getSingleton();
+}
+
+void BufferPool::destroy() {
+    AutoSingleton<BufferPool>::destroy();
+}
+
+BufferPool::BufferPool()
+ : mMaxFree(1024),
+   mSlabsAllocated(0),
+   mSlabsReused(0),
+   mBytesCopied(0)
+{
+}
+
+BufferPool::~BufferPool() {
+    for(std::vector<BufferSlab*>::iterator it = mFree.begin(); it != mFree.end(); it++)
+        delete *it;
+    mFree.clear();
+}
+
+BufferSlab* BufferPool::acquire(uint32 min_size) {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+
+    if (min_size <= SlabSize && !mFree.empty()) {
+        BufferSlab* slab = mFree.back();
+        mFree.pop_back();
+        mSlabsReused++;
+        return slab;
+    }
+
+    mSlabsAllocated++;
+    return new BufferSlab(std::max(min_size, SlabSize));
+}
+
+void BufferPool::release(BufferSlab* slab) {
+    assert(slab->refcount.read() == 0);
+
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    if (slab->capacity != SlabSize || mFree.size() >= mMaxFree) {
+        delete slab;
+        return;
+    }
+    mFree.push_back(slab);
+}
+
+BufferPool::Stats BufferPool::stats() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    Stats result;
+    result.slabsAllocated = mSlabsAllocated;
+    result.slabsReused = mSlabsReused;
+    result.bytesCopied = mBytesCopied.read();
+    return result;
+}
+
+void BufferPool::resetStats() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    mSlabsAllocated = 0;
+    mSlabsReused = 0;
+    mBytesCopied = 0;
+}
+
+} // namespace SST
+} // namespace Sirikata
@@ -0,0 +1,246 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/network/SSTCongestionControl.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
+
+namespace Sirikata {
+namespace SST {
+
+const int64 CongestionController::InitialRTOMicroseconds;
+const int64 CongestionController::MinRTOMicroseconds;
+const uint32 CongestionController::MaxWindow;
+const uint32 DelayCongestionController::Alpha;
+const uint32 DelayCongestionController::Beta;
+const uint32 SelectiveAck::MaxBlocks;
+
+namespace {
+String defaultCongestionControl() {
+    // Some tools use SST without ever initializing options
+    OptionValue* opt = GetOption(OPT_SST_CONGESTION_CONTROL);
+    if (opt == NULL || opt->get()->empty())
+        return "newreno";
+    return opt->as<String>();
+}
+}
+
+CongestionController* CongestionController::create(const String& _type) {
+    String type = _type.empty() ? defaultCongestionControl() : _type;
+
+    if (type == "delay")
+        return new DelayCongestionController();
+    if (type != "newreno")
+        SILOG(sst,error,"Unknown SST congestion control " << type << ", using newreno.");
+    return new NewRenoCongestionController();
+}
+
+CongestionController::CongestionController()
+ : mHaveRTT(false),
+   mSmoothedRTT(0),
+   mRTTVariance(0),
+   mMinRTT(0)
+{
+}
+
+void CongestionController::ack(const Duration& rtt) {
+    int64 sample = rtt.toMicroseconds();
+    if (sample < 0) sample = 0;
+
+    if (!mHaveRTT) {
+        mSmoothedRTT = sample;
+        mRTTVariance = sample / 2;
+        mMinRTT = sample;
+        mHaveRTT = true;
+    }
+    else {
+        // RFC 6298, alpha = 1/8, beta = 1/4
+        int64 err = sample - mSmoothedRTT;
+        mRTTVariance += ((err < 0 ? -err : err) - mRTTVariance) / 4;
+        mSmoothedRTT += err / 8;
+        if (sample < mMinRTT) mMinRTT = sample;
+    }
+
+    onAck(rtt);
+}
+
+Duration CongestionController::rto() const {
+    if (!mHaveRTT)
+        return Duration::microseconds(InitialRTOMicroseconds);
+    int64 rto = mSmoothedRTT + 4 * mRTTVariance;
+    if (rto < MinRTOMicroseconds) rto = MinRTOMicroseconds;
+    return Duration::microseconds(rto);
+}
+
+Duration CongestionController::smoothedRTT() const {
+    return Duration::microseconds(mSmoothedRTT);
+}
+
+Duration CongestionController::minRTT() const {
+    return Duration::microseconds(mMinRTT);
+}
+
+
+
+NewRenoCongestionController::NewRenoCongestionController()
+ : mCwnd(2),
+   mSSThresh(MaxWindow),
+   mAcked(0)
+{
+}
+
+void NewRenoCongestionController::onAck(const Duration& rtt) {
+    if (mCwnd >= MaxWindow) return;
+
+    if (mCwnd < mSSThresh) {
+        mCwnd++;
+        return;
+    }
+
+    mAcked++;
+    if (mAcked >= mCwnd) {
+        mCwnd++;
+        mAcked = 0;
+    }
+}
+
+void NewRenoCongestionController::loss() {
+    mSSThresh = std::max(mCwnd / 2, (uint32)2);
+    mCwnd = mSSThresh;
+    mAcked = 0;
+}
+
+void NewRenoCongestionController::timeout() {
+    mSSThresh = std::max(mCwnd / 2, (uint32)2);
+    mCwnd = 1;
+    mAcked = 0;
+}
+
+
+
+DelayCongestionController::DelayCongestionController()
+ : mCwnd(2),
+   mSSThresh(MaxWindow),
+   mAcked(0),
+   mRoundMinRTT(-1)
+{
+}
+
+void DelayCongestionController::onAck(const Duration& rtt) {
+    int64 sample = rtt.toMicroseconds();
+    if (mRoundMinRTT < 0 || sample < mRoundMinRTT)
+        mRoundMinRTT = sample;
+
+    mAcked++;
+    if (mAcked < mCwnd) return;
+
+    // End of a round, estimate the number of segments queued in the network:
+    // the difference between what we'd expect to get through at the base RTT
+    // and what actually got through.
+    int64 base = minRTT().toMicroseconds();
+    uint32 queued = 0;
+    if (mRoundMinRTT > 0)
+        queued = (uint32)((mCwnd * (mRoundMinRTT - base)) / mRoundMinRTT);
+
+    if (mCwnd < mSSThresh) {
+        // Slow start until queues start to form
+        if (queued > 1)
+            mSSThresh = mCwnd;
+        else
+            mCwnd = std::min(mCwnd * 2, MaxWindow);
+    }
+    else if (queued < Alpha) {
+        mCwnd = std::min(mCwnd + 1, MaxWindow);
+    }
+    else if (queued > Beta && mCwnd > 2) {
+        mCwnd--;
+    }
+
+    mAcked = 0;
+    mRoundMinRTT = -1;
+}
+
+void DelayCongestionController::loss() {
+    // Loss isn't our primary signal, so back off less than NewReno
+    mCwnd = std::max((mCwnd * 3) / 4, (uint32)2);
+    mSSThresh = mCwnd;
+    mAcked = 0;
+    mRoundMinRTT = -1;
+}
+
+void DelayCongestionController::timeout() {
+    mSSThresh = std::max(mCwnd / 2, (uint32)2);
+    mCwnd = 1;
+    mAcked = 0;
+    mRoundMinRTT = -1;
+}
+
+
+
+bool SelectiveAck::covers(uint64 offset, uint32 len) const {
+    uint64 end = offset + len;
+    if (end <= cumulative) return true;
+
+    for(BlockList::const_iterator it = blocks.begin(); it != blocks.end(); it++) {
+        if (it->first <= offset && end <= it->second)
+            return true;
+        if (it->first > offset)
+            break;
+    }
+    return false;
+}
+
+namespace {
+// Tag so we can tell a SelectiveAck from other ACK payloads
+const uint8 SelectiveAckTag = 0x53;
+
+void appendUInt64(String* output, uint64 val) {
+    for(int i = 7; i >= 0; i--)
+        output->push_back((char)((val >> (i*8)) & 0xFF));
+}
+
+uint64 readUInt64(const uint8* data) {
+    uint64 val = 0;
+    for(int i = 0; i < 8; i++)
+        val = (val << 8) | data[i];
+    return val;
+}
+}
+
+void SelectiveAck::serialize(String* output) const {
+    uint32 nblocks = std::min((uint32)blocks.size(), MaxBlocks);
+
+    output->reserve(output->size() + 2 + 8 + nblocks*16);
+    output->push_back((char)SelectiveAckTag);
+    appendUInt64(output, cumulative);
+    output->push_back((char)nblocks);
+    for(uint32 i = 0; i < nblocks; i++) {
+        appendUInt64(output, blocks[i].first);
+        appendUInt64(output, blocks[i].second);
+    }
+}
+
+bool SelectiveAck::parse(const void* _data, uint32 len) {
+    const uint8* data = (const uint8*)_data;
+    if (len < 10 || data[0] != SelectiveAckTag)
+        return false;
+
+    uint32 nblocks = data[9];
+    if (nblocks > MaxBlocks || len != 10 + nblocks*16)
+        return false;
+
+    cumulative = readUInt64(data + 1);
+    blocks.clear();
+    for(uint32 i = 0; i < nblocks; i++) {
+        const uint8* block_data = data + 10 + i*16;
+        Block block(readUInt64(block_data), readUInt64(block_data + 8));
+        if (block.second <= block.first)
+            return false;
+        blocks.push_back(block);
+    }
+    return true;
+}
+
+} // namespace SST
+} // namespace Sirikata
@@ -95,12 +95,27 @@ void InitOptions() {
         .addOption(new OptionValue(OPT_CDN_DOWNLOAD_URI_PREFIX, "/download", Sirikata::OptionValueType<String>(), "URI prefix for CDN HTTP downloads."))
         .addOption(new OptionValue(OPT_CDN_UPLOAD_URI_PREFIX, "/api/upload", Sirikata::OptionValueType<String>(), "URI prefix for CDN HTTP uploads."))
         .addOption(new OptionValue(OPT_CDN_UPLOAD_STATUS_URI_PREFIX, "/upload/processing", Sirikata::OptionValueType<String>(), "URI prefix for CDN HTTP upload status checks."))
+        .addOption(new OptionValue(OPT_CDN_CACHE_POLICY, "lru", Sirikata::OptionValueType<String>(), "Eviction policy for the downloaded data caches: lru, slru (segmented LRU) or clock-pro"))
+        .addOption(new OptionValue(OPT_CDN_CACHE_ADMISSION, "none", Sirikata::OptionValueType<String>(), "Admission policy for the downloaded data caches: none (cache everything) or tinylfu (only cache data requested more often than what it would replace)"))
+        .addOption(new OptionValue(OPT_CDN_DISK_CACHE, "files", Sirikata::OptionValueType<String>(), "How downloaded data is stored on disk: files (one per entry) or packed (a few large memory mapped pack files with an index, not supported on Windows)"))
+
+        .addOption(new OptionValue(OPT_TRANSFER_OUTSTANDING, "10", Sirikata::OptionValueType<uint32>(), "Most transfers the TransferMediator runs at once"))
+        .addOption(new OptionValue(OPT_TRANSFER_RESERVED, "3", Sirikata::OptionValueType<uint32>(), "How many of the transfer slots are kept for transfers which are due or more important than everything already running"))
+        .addOption(new OptionValue(OPT_TRANSFER_DEADLINE_HORIZON, "250ms", Sirikata::OptionValueType<Duration>(), "How long before their deadlines transfers are started ahead of higher priority ones"))
+        .addOption(new OptionValue(OPT_TRANSFER_SOURCE_BANDWIDTH, "0", Sirikata::OptionValueType<uint32>(), "Bytes per second of transfers started from each source (e.g. CDN host), or 0 for no limit"))
+        .addOption(new OptionValue(OPT_TRANSFER_DISPATCH_THREADS, "2", Sirikata::OptionValueType<uint32>(), "Threads the TransferMediator starts transfers on"))
+        .addOption(new OptionValue(OPT_TRANSFER_MESH_DEADLINE, "200ms", Sirikata::OptionValueType<Duration>(), "Deadline for downloading a mesh the renderer needs, after it's requested, or 0 for none. Their textures are downloaded by priority alone."))
+
+        .addOption(new OptionValue(OPT_IOSERVICE_STATS, "false", Sirikata::OptionValueType<bool>(), "Keep low overhead per-tag statistics about the event handlers run by IOServices and IOStrands"))
+        .addOption(new OptionValue(OPT_IOSERVICE_STATS_PERIOD, "10s", Sirikata::OptionValueType<Duration>(), "How often the IOService statistics are reported to the TimeSeries service"))
 
         .addOption(new OptionValue(OPT_TRACE_TIMESERIES, "null", Sirikata::OptionValueType<String>(), "Service to report TimeSeries data to."))
         .addOption(new OptionValue(OPT_TRACE_TIMESERIES_OPTIONS, "", Sirikata::OptionValueType<String>(), "Options for TimeSeries reporting service."))
 
         .addOption(new OptionValue(OPT_COMMAND_COMMANDER, "", Sirikata::OptionValueType<String>(), "Commander service to start"))
         .addOption(new OptionValue(OPT_COMMAND_COMMANDER_OPTIONS, "", Sirikata::OptionValueType<String>(), "Options for the Commander service"))
+
+        .addOption(new OptionValue(OPT_SST_CONGESTION_CONTROL, "newreno", Sirikata::OptionValueType<String>(), "Congestion control for SST connections: newreno (loss based AIMD) or delay (Vegas style, delay based)"))
       ;
 }
 
@@ -37,6 +37,7 @@
 #include <boost/lexical_cast.hpp>
 #include <sirikata/core/service/Breakpad.hpp>
 #include <sirikata/core/command/Commander.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
 
 namespace Sirikata {
 
@@ -55,13 +56,15 @@ Context::Context(const String& name_, Network::IOService* ios, Network::IOStrand
    mKillThread(),
    mKillService(NULL),
    mKillTimer(),
-   mStopRequested(false)
+   mStopRequested(false),
+   mEventLoopStatsPoller(NULL)
 {
   Breakpad::init();
   profiler = new TimeProfiler(this, name);
 }
 
 Context::~Context() {
+    delete mEventLoopStatsPoller;
     delete profiler;
 }
 
@@ -70,6 +73,21 @@ void Context::start() {
         std::tr1::bind(&Context::handleSignal, this, std::tr1::placeholders::_1)
     );
 
+    // Tests can run Contexts without parsing options
+    OptionValue* stats_opt = GetOption(OPT_IOSERVICE_STATS);
+    if (!stats_opt->get()->empty() && stats_opt->as<bool>()) {
+        Network::EventLoopStats::setEnabled(true);
+        if (timeSeries != NULL && mEventLoopStatsPoller == NULL) {
+            mEventLoopStatsPoller = new Poller(
+                mainStrand,
+                std::tr1::bind(&Context::reportEventLoopStats, this),
+                "Context::reportEventLoopStats",
+                GetOptionValue<Duration>(OPT_IOSERVICE_STATS_PERIOD)
+            );
+            mEventLoopStatsPoller->start();
+        }
+    }
+
     if (mSimDuration == Duration::zero())
         return;
 
@@ -136,12 +154,18 @@ void Context::shutdown() {
 void Context::stop() {
     if (!mStopRequested.read()) {
         mStopRequested = true;
+        if (mEventLoopStatsPoller != NULL)
+            mEventLoopStatsPoller->stop();
         mFinishedTimer.reset();
         startForceQuitTimer();
     }
 }
 
 
+void Context::reportEventLoopStats() {
+    ioService->reportEventLoopStats(timeSeries, name + ".ioservice");
+}
+
 void Context::handleSignal(Signal::Type stype) {
     // Try to keep this minimal. Post the shutdown process rather than
     // actually running it here. This makes the extent of the signal
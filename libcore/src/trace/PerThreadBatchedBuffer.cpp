@@ -0,0 +1,162 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/trace/PerThreadBatchedBuffer.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace Sirikata {
+
+PerThreadBatchedBuffer::ThreadBuffer::ThreadBuffer(uint32 nbatches)
+ : filling(NULL),
+   full(nbatches),
+   free(nbatches),
+   dropped(0)
+{
+    for(uint32 i = 0; i < nbatches; i++)
+        free.push(new ByteBatch());
+}
+
+PerThreadBatchedBuffer::ThreadBuffer::~ThreadBuffer() {
+    delete filling;
+    ByteBatch* bb = NULL;
+    while(full.pop(bb))
+        delete bb;
+    // This is the only place we pop from free outside the owning thread, but
+    // by now nobody is writing anymore.
+    while(free.pop(bb))
+        delete bb;
+}
+
+
+PerThreadBatchedBuffer::PerThreadBatchedBuffer(uint32 batches_per_thread)
+ : mBatchesPerThread(batches_per_thread < 2 ? 2 : batches_per_thread),
+   mLocalBuffer(&PerThreadBatchedBuffer::noopCleanup)
+{
+}
+
+PerThreadBatchedBuffer::~PerThreadBatchedBuffer() {
+    mLocalBuffer.reset();
+    for(FlushedBatchList::iterator it = mFlushed.begin(); it != mFlushed.end(); it++)
+        delete it->second;
+    mFlushed.clear();
+    for(ThreadBufferList::iterator it = mThreadBuffers.begin(); it != mThreadBuffers.end(); it++)
+        delete *it;
+    mThreadBuffers.clear();
+}
+
+PerThreadBatchedBuffer::ThreadBuffer* PerThreadBatchedBuffer::getThreadBuffer() {
+    ThreadBuffer* tb = mLocalBuffer.get();
+    if (tb != NULL) return tb;
+
+    tb = new ThreadBuffer(mBatchesPerThread);
+    {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mThreadBuffers.push_back(tb);
+    }
+    mLocalBuffer.reset(tb);
+    return tb;
+}
+
+void PerThreadBatchedBuffer::write(const IOVec* iov, uint32 iovcnt) {
+    ThreadBuffer* tb = getThreadBuffer();
+
+    uint32 total_size = 0;
+    for(uint32 i = 0; i < iovcnt; i++)
+        total_size += iov[i].len;
+
+    if (total_size > ByteBatch::max_size) {
+        tb->dropped++;
+        return;
+    }
+
+    // Records never straddle batches, so if this one doesn't fit, publish the
+    // current batch and start a new one.
+    if (tb->filling != NULL && tb->filling->avail() < total_size) {
+        // full has room for every batch we own, so this can't fail
+        tb->full.push(tb->filling);
+        tb->filling = NULL;
+    }
+    if (tb->filling == NULL) {
+        if (!tb->free.pop(tb->filling)) {
+            // The storage thread has fallen behind. Drop instead of blocking
+            // the caller.
+            tb->filling = NULL;
+            tb->dropped++;
+            return;
+        }
+    }
+
+    ByteBatch* bb = tb->filling;
+    for(uint32 i = 0; i < iovcnt; i++) {
+        memcpy(&bb->items[bb->size], iov[i].base, iov[i].len);
+        bb->size += iov[i].len;
+    }
+
+    if (bb->full()) {
+        tb->full.push(bb);
+        tb->filling = NULL;
+    }
+}
+
+void PerThreadBatchedBuffer::flush() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+
+    for(ThreadBufferList::iterator it = mThreadBuffers.begin(); it != mThreadBuffers.end(); it++) {
+        ThreadBuffer* tb = *it;
+        if (tb->filling == NULL) continue;
+        mFlushed.push_back(std::make_pair(tb, tb->filling));
+        tb->filling = NULL;
+    }
+}
+
+void PerThreadBatchedBuffer::storeBatch(FILE* os, ThreadBuffer* owner, ByteBatch* bb) {
+    fwrite((void*)&(bb->items[0]), 1, bb->size, os);
+    bb->size = 0;
+    owner->free.push(bb);
+}
+
+void PerThreadBatchedBuffer::store(FILE* os) {
+    ThreadBufferList buffers;
+    FlushedBatchList flushed;
+    {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        buffers = mThreadBuffers;
+        flushed.swap(mFlushed);
+    }
+
+    for(ThreadBufferList::iterator it = buffers.begin(); it != buffers.end(); it++) {
+        ThreadBuffer* tb = *it;
+        ByteBatch* bb = NULL;
+        while(tb->full.pop(bb))
+            storeBatch(os, tb, bb);
+    }
+
+    // Flushed batches were taken after anything already in the full rings, so
+    // they come last to maintain per-thread ordering.
+    for(FlushedBatchList::iterator it = flushed.begin(); it != flushed.end(); it++)
+        storeBatch(os, it->first, it->second);
+}
+
+bool PerThreadBatchedBuffer::empty() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+
+    if (!mFlushed.empty()) return false;
+    for(ThreadBufferList::iterator it = mThreadBuffers.begin(); it != mThreadBuffers.end(); it++) {
+        if (!(*it)->full.probablyEmpty())
+            return false;
+    }
+    return true;
+}
+
+uint64 PerThreadBatchedBuffer::dropped() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+
+    uint64 total = 0;
+    for(ThreadBufferList::iterator it = mThreadBuffers.begin(); it != mThreadBuffers.end(); it++)
+        total += (*it)->dropped.read();
+    return total;
+}
+
+} // namespace Sirikata
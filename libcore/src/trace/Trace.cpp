@@ -48,23 +48,39 @@ namespace Sirikata {
 namespace Trace {
 
 OptionValue* Trace::mLogMessage;
+OptionValue* Trace::mBufferType = NULL;
+OptionValue* Trace::mBufferBatchesPerThread = NULL;
 
 #define TRACE_MESSAGE_NAME                  "trace-message"
+#define TRACE_BUFFER_NAME                   "trace-buffer"
+#define TRACE_BUFFER_BATCHES_NAME           "trace-buffer-batches"
 
 void Trace::InitOptions() {
     mLogMessage = new OptionValue(TRACE_MESSAGE_NAME,"false",Sirikata::OptionValueType<bool>(),"Log object trace data");
+    mBufferType = new OptionValue(TRACE_BUFFER_NAME,"locked",Sirikata::OptionValueType<String>(),"Trace buffer implementation: locked (single shared buffer) or per-thread (lock-free per-thread buffers, may drop records under load)");
+    mBufferBatchesPerThread = new OptionValue(TRACE_BUFFER_BATCHES_NAME,"16",Sirikata::OptionValueType<uint32>(),"Number of 64KB batches preallocated for each thread writing to a per-thread trace buffer");
 
     InitializeClassOptions::module(SIRIKATA_OPTIONS_MODULE)
         .addOption(mLogMessage)
+        .addOption(mBufferType)
+        .addOption(mBufferBatchesPerThread)
         ;
 }
 
 
 Trace::Trace(const String& filename)
- : mShuttingDown(false),
+ : mThreadData(NULL),
+   mShuttingDown(false),
    mStorageThread(NULL),
    mFinishStorage(false)
 {
+    // Options may not have been initialized, e.g. in tools which only need a
+    // Trace to construct a Context.
+    if (mBufferType != NULL && mBufferType->as<String>() == "per-thread")
+        mThreadData = new PerThreadBatchedBuffer(mBufferBatchesPerThread->as<uint32>());
+    else if (mBufferType != NULL && mBufferType->as<String>() != "locked")
+        SILOG(trace, error, "Unknown trace buffer type " << mBufferType->as<String>() << ", using locked buffer.");
+
     mStorageThread = new Thread( "Trace Storage", std::tr1::bind(&Trace::storageThread, this, filename) );
 }
 
@@ -73,7 +89,10 @@ void Trace::prepareShutdown() {
 }
 
 void Trace::shutdown() {
-    data.flush();
+    if (mThreadData)
+        mThreadData->flush();
+    else
+        data.flush();
     mFinishStorage = true;
     mStorageThread->join();
     delete mStorageThread;
@@ -85,19 +104,22 @@ void Trace::storageThread(const String& filename) {
     while( !mFinishStorage.read() ) {
         // Open the file in the loop so we never open the file if we never dump
         // any trace data
-        if (of == NULL && !data.empty())
+        if (of == NULL && !dataEmpty())
             of = fopen(filename.c_str(), "wb");
 
-        if (!data.empty()) {
-            data.store(of);
+        if (!dataEmpty()) {
+            storeData(of);
             fflush(of);
         }
 
         Timer::sleep(Duration::seconds(1));
     }
 
+    if (of == NULL && !dataEmpty())
+        of = fopen(filename.c_str(), "wb");
+
     if (of != NULL) {
-        data.store(of);
+        storeData(of);
         fflush(of);
 #if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
         FlushFileBuffers((HANDLE) _get_osfhandle(_fileno(of)));
@@ -108,6 +130,25 @@ void Trace::storageThread(const String& filename) {
     }
 }
 
+bool Trace::dataEmpty() {
+    if (mThreadData)
+        return mThreadData->empty();
+    return data.empty();
+}
+
+void Trace::storeData(FILE* of) {
+    if (mThreadData) {
+        mThreadData->store(of);
+        uint64 ndropped = mThreadData->dropped();
+        if (ndropped > 0) {
+            drops.n[Drops::TRACE_RECORDS_DROPPED] = "TRACE_RECORDS_DROPPED";
+            drops.d[Drops::TRACE_RECORDS_DROPPED] = ndropped;
+        }
+        return;
+    }
+    data.store(of);
+}
+
 void Trace::writeRecord(uint16 type_hint, BatchedBuffer::IOVec* data_orig, uint32 iovcnt) {
     assert(iovcnt < 30);
 
@@ -123,7 +164,10 @@ void Trace::writeRecord(uint16 type_hint, BatchedBuffer::IOVec* data_orig, uint3
     for(uint32 i = 0; i < iovcnt; i++)
         data_vec[i+2] = data_orig[i];
 
-    data.write(data_vec, iovcnt+2);
+    if (mThreadData)
+        mThreadData->write(data_vec, iovcnt+2);
+    else
+        data.write(data_vec, iovcnt+2);
 }
 
 
@@ -138,6 +182,7 @@ void Drops::output() {
 
 Trace::~Trace() {
     drops.output();
+    delete mThreadData;
 }
 
 
@@ -0,0 +1,253 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/transfer/ClockProPolicy.hpp>
+
+namespace Sirikata {
+namespace Transfer {
+
+ClockProPolicy::ClockProPolicy(cache_usize_type allocatedSpace, float maxSizePct)
+ : CachePolicy(allocatedSpace, maxSizePct),
+   mHandHot(mClock.end()),
+   mHandCold(mClock.end()),
+   mHandTest(mClock.end()),
+   mHotSize(0),
+   mColdSize(0),
+   mGhostSize(0),
+   mColdTarget(allocatedSpace / 100),
+   mMinColdTarget(allocatedSpace / 100)
+{
+}
+
+ClockProPolicy::~ClockProPolicy() {
+}
+
+ClockProPolicy::Clock::iterator ClockProPolicy::next(Clock::iterator it) {
+    ++it;
+    if (it == mClock.end())
+        it = mClock.begin();
+    return it;
+}
+
+ClockProPolicy::Clock::iterator ClockProPolicy::insert(const ClockEntry& entry) {
+    if (mClock.empty()) {
+        mClock.push_back(entry);
+        mHandHot = mHandCold = mHandTest = mClock.begin();
+        return mHandHot;
+    }
+    // The hot hand trails the others, so just behind it is the last place any
+    // of them will get to.
+    return mClock.insert(mHandHot, entry);
+}
+
+void ClockProPolicy::erase(Clock::iterator it) {
+    Clock::iterator after = next(it);
+    if (after == it) {
+        mClock.erase(it);
+        mHandHot = mHandCold = mHandTest = mClock.end();
+        return;
+    }
+    if (mHandHot == it) mHandHot = after;
+    if (mHandCold == it) mHandCold = after;
+    if (mHandTest == it) mHandTest = after;
+    mClock.erase(it);
+}
+
+void ClockProPolicy::removeGhost(Clock::iterator it) {
+    mGhostSize -= it->size;
+    mGhosts.erase(it->id);
+    erase(it);
+}
+
+void ClockProPolicy::growColdTarget(cache_usize_type size) {
+    mColdTarget = std::min(mColdTarget + size, mTotalSize - mMinColdTarget);
+}
+
+void ClockProPolicy::shrinkColdTarget(cache_usize_type size) {
+    if (mColdTarget < mMinColdTarget + size)
+        mColdTarget = mMinColdTarget;
+    else
+        mColdTarget -= size;
+}
+
+void ClockProPolicy::balanceHot() {
+    while (mHotSize > mTotalSize - mColdTarget)
+        runHandHot();
+}
+
+void ClockProPolicy::runHandHot() {
+    ClockEntry& entry = *mHandHot;
+    switch(entry.state) {
+      case HOT:
+        if (entry.referenced) {
+            entry.referenced = false;
+        }
+        else {
+            entry.state = COLD;
+            entry.testing = false;
+            mHotSize -= entry.size;
+            mColdSize += entry.size;
+        }
+        mHandHot = next(mHandHot);
+        break;
+      case COLD:
+        // Passing the hot hand ends the test period
+        entry.testing = false;
+        mHandHot = next(mHandHot);
+        break;
+      case GHOST:
+        // The test period ended without it being requested again, so cold
+        // entries are getting more space than they need.
+        shrinkColdTarget(entry.size);
+        removeGhost(mHandHot);
+        break;
+    }
+}
+
+void ClockProPolicy::trimGhosts() {
+    while (mGhostSize > mTotalSize)
+        runHandTest();
+}
+
+void ClockProPolicy::runHandTest() {
+    ClockEntry& entry = *mHandTest;
+    switch(entry.state) {
+      case HOT:
+        mHandTest = next(mHandTest);
+        break;
+      case COLD:
+        entry.testing = false;
+        mHandTest = next(mHandTest);
+        break;
+      case GHOST:
+        shrinkColdTarget(entry.size);
+        removeGhost(mHandTest);
+        break;
+    }
+}
+
+void ClockProPolicy::use(const Fingerprint &id, Data* data, cache_usize_type size) {
+    ClockData* clockdata = static_cast<ClockData*>(data);
+    clockdata->mIter->referenced = true;
+}
+
+void ClockProPolicy::useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize) {
+    ClockData* clockdata = static_cast<ClockData*>(data);
+    ClockEntry& entry = *clockdata->mIter;
+
+    if (entry.state == HOT)
+        mHotSize = mHotSize - entry.size + newsize;
+    else
+        mColdSize = mColdSize - entry.size + newsize;
+    entry.size = newsize;
+    entry.referenced = true;
+
+    CachePolicy::updateSpace(oldsize, newsize);
+}
+
+void ClockProPolicy::destroy(const Fingerprint &id, Data* data, cache_usize_type size) {
+    ClockData* clockdata = static_cast<ClockData*>(data);
+    Clock::iterator it = clockdata->mIter;
+    delete clockdata;
+
+    CachePolicy::updateSpace(size, 0);
+    SILOG(transfer,detailed,"[ClockProPolicy] Freeing " << id << " (" << size << " bytes); " << mFreeSpace << " free");
+
+    if (it->state == HOT) {
+        mHotSize -= it->size;
+        erase(it);
+        return;
+    }
+
+    mColdSize -= it->size;
+    if (!it->testing) {
+        erase(it);
+        return;
+    }
+
+    // Still in its test period, so remember it in case it's requested again
+    it->state = GHOST;
+    it->referenced = false;
+    mGhostSize += it->size;
+    mGhosts[it->id] = it;
+    if (mHandCold == it)
+        mHandCold = next(it);
+    trimGhosts();
+}
+
+CachePolicy::Data* ClockProPolicy::create(const Fingerprint &id, cache_usize_type size) {
+    CachePolicy::updateSpace(0, size);
+
+    ClockEntry entry;
+    entry.id = id;
+    entry.size = size;
+    entry.referenced = false;
+
+    GhostMap::iterator ghost = mGhosts.find(id);
+    if (ghost == mGhosts.end()) {
+        entry.state = COLD;
+        entry.testing = true;
+        mColdSize += size;
+        return new ClockData(insert(entry));
+    }
+
+    // Requested again during its test period, which it would have survived
+    // if cold entries had a bit more space.
+    growColdTarget(ghost->second->size);
+    removeGhost(ghost->second);
+
+    entry.state = HOT;
+    entry.testing = false;
+    mHotSize += size;
+    ClockData* clockdata = new ClockData(insert(entry));
+    balanceHot();
+    return clockdata;
+}
+
+bool ClockProPolicy::nextItem(cache_usize_type requiredSpace, Fingerprint &myprint) {
+    if (mFreeSpace >= (cache_ssize_type)requiredSpace)
+        return false;
+    if (mHotSize + mColdSize == 0)
+        return false;
+
+    while(true) {
+        // Only cold entries are evicted, so if everything is hot some need to
+        // be demoted.
+        if (mColdSize == 0) {
+            runHandHot();
+            continue;
+        }
+
+        ClockEntry& entry = *mHandCold;
+        if (entry.state != COLD) {
+            mHandCold = next(mHandCold);
+            continue;
+        }
+        if (!entry.referenced) {
+            // Left in place, destroy() moves the hand past it
+            myprint = entry.id;
+            return true;
+        }
+
+        entry.referenced = false;
+        if (entry.testing) {
+            // Used during its test period, so it becomes hot
+            entry.state = HOT;
+            entry.testing = false;
+            mColdSize -= entry.size;
+            mHotSize += entry.size;
+            mHandCold = next(mHandCold);
+            balanceHot();
+        }
+        else {
+            // Give it another test period
+            entry.testing = true;
+            mHandCold = next(mHandCold);
+        }
+    }
+}
+
+}
+}
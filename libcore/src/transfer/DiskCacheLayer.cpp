@@ -219,7 +219,7 @@ void DiskCacheLayer::workerThread() {
 					}
 					newFile = false;
 				}
-				if (!mFiles.alloc(req->data->length(), writer)) {
+				if (!mFiles.alloc(req->fileId, req->data->length(), writer)) {
 					continue;
 				}
 			}
@@ -251,7 +251,6 @@ void DiskCacheLayer::workerThread() {
 
 				if (writer.insert(req->fileId, diskUsage)) {
 					*writer = new CacheData;
-					writer.use();
 				} else {
 					writer.update(diskUsage);
 				}
@@ -435,7 +434,7 @@ void DiskCacheLayer::unserialize() {
                                 continue;
                         }
 
-                        if (!mFiles.alloc(totalLength, writer)) {
+                        if (!mFiles.alloc(fprint, totalLength, writer)) {
                             // We couldn't allocate space for this file, get rid
                             // of it. Probably means we somehow ended up
                             // violating space requirements (e.g. if the setting
@@ -448,7 +447,6 @@ void DiskCacheLayer::unserialize() {
 
 			if (writer.insert(fprint, totalLength)) {
                             *writer = cdata;
-                            writer.use();
                         }
 		}
 		closedir(mydir);
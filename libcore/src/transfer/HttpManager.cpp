@@ -65,6 +65,14 @@ HttpManager::HttpManager()
     EMPTY_PARSER_SETTINGS.on_headers_complete = 0;
     EMPTY_PARSER_SETTINGS.on_message_complete = 0;
 
+    mResponseParserSettings = EMPTY_PARSER_SETTINGS;
+    mResponseParserSettings.on_message_begin = &HttpManager::on_message_begin;
+    mResponseParserSettings.on_header_field = &HttpManager::on_header_field;
+    mResponseParserSettings.on_header_value = &HttpManager::on_header_value;
+    mResponseParserSettings.on_body = &HttpManager::on_body;
+    mResponseParserSettings.on_headers_complete = &HttpManager::on_headers_complete;
+    mResponseParserSettings.on_message_complete = &HttpManager::on_message_complete;
+
     //Making a single thread IOService to handle requests
     mServicePool = new IOServicePool("HttpManager", 2);
 
@@ -87,9 +95,21 @@ HttpManager::~HttpManager() {
     //Stop the IOService and make sure its thread exist
     mServicePool->join();
 
+    //Idle connections' sockets have to go before the service they use
+    mConnections.clear();
+
     //Delete dummy worker and service pool
     mServicePool->stopWork();
     delete mServicePool;
+
+    SILOG(transfer, detailed, "HttpManager sent " << mStats.requestsSent << " requests on "
+        << mStats.connectionsOpened << " connections, " << mStats.requestsReusingConnection << " reusing a connection and "
+        << mStats.requestsPipelined << " pipelined");
+}
+
+HttpManager::Stats HttpManager::getStats() {
+    boost::lock_guard<boost::mutex> lockStats(mStatsLock);
+    return mStats;
 }
 
 void HttpManager::postCallback(IOCallback cb, const char* tag) {
@@ -109,9 +129,10 @@ String HttpManager::methodAsString(HTTP_METHOD m) {
     }
 }
 
-void HttpManager::makeRequest(Sirikata::Network::Address addr, HTTP_METHOD method, std::string req, bool allow_redirects, HttpCallback cb) {
+void HttpManager::makeRequest(Sirikata::Network::Address addr, HTTP_METHOD method, std::string req, bool allow_redirects, HttpCallback cb,
+    HttpBodyCallback body_cb) {
 
-    std::tr1::shared_ptr<HttpRequest> r(new HttpRequest(addr, req, method, allow_redirects, cb));
+    std::tr1::shared_ptr<HttpRequest> r(new HttpRequest(addr, req, method, allow_redirects, cb, body_cb));
 
     //Initialize http parser settings callbacks
     r->mHttpSettings = EMPTY_PARSER_SETTINGS;
@@ -148,7 +169,8 @@ void HttpManager::makeRequest(
     HttpCallback cb,
     const Headers& headers, const QueryParameters& query_params,
     const String& body,
-    bool allow_redirects)
+    bool allow_redirects,
+    HttpBodyCallback body_cb)
 {
     std::ostringstream request_stream;
 
@@ -162,6 +184,10 @@ void HttpManager::makeRequest(
         request_stream << it->first << ": " << it->second << "\r\n";
     if (headers.find("Accept") == headers.end())
         request_stream << "Accept: */*\r\n";
+    // A range of a compressed response is a range of the compressed data,
+    // which can't be decompressed on its own
+    if (headers.find("Accept-Encoding") == headers.end() && headers.find("Range") == headers.end())
+        request_stream << "Accept-Encoding: gzip, deflate\r\n";
 
     // Required blank line
     request_stream << "\r\n";
@@ -173,7 +199,7 @@ void HttpManager::makeRequest(
     // FIXME This is actually kind of round-about as we are formatting and then
     // reparsing the request by going through the other makeRequest call. We
     // could dispatch this ourselves and not waste the time reparsing.
-    makeRequest(addr, method, request_stream.str(), allow_redirects, cb);
+    makeRequest(addr, method, request_stream.str(), allow_redirects, cb, body_cb);
 }
 
 void HttpManager::formatURLEncodedDictionary(std::ostream& os, const StringDictionary& query_params) {
@@ -223,9 +249,10 @@ void HttpManager::head(
 
 void HttpManager::get(
     Sirikata::Network::Address addr, const String& path,
-    HttpCallback cb, const Headers& headers, const QueryParameters& query_params, bool allow_redirects)
+    HttpCallback cb, const Headers& headers, const QueryParameters& query_params, bool allow_redirects,
+    HttpBodyCallback body_cb)
 {
-    makeRequest(addr, GET, path, cb, headers, query_params, "", allow_redirects);
+    makeRequest(addr, GET, path, cb, headers, query_params, "", allow_redirects, body_cb);
 }
 
 void HttpManager::post(
@@ -303,72 +330,128 @@ void HttpManager::postMultipartForm(
 
 
 
+bool HttpManager::can_pipeline(const HttpRequestPtr& req) {
+    //Only idempotent requests are pipelined, since they may need to be
+    //retried if the connection closes before they're answered
+    return req->method != POST;
+}
+
+HttpManager::HttpConnectionPtr HttpManager::assign_to_open_connection(HttpRequestPtr req) {
+    HttpConnectionPtr chosen;
+    bool reused = false, pipelined = false;
+
+    boost::unique_lock<boost::mutex> lockConns(mConnectionsLock); {
+        ConnectionMap::iterator findConns = mConnections.find(req->addr);
+        if (findConns == mConnections.end()) {
+            return chosen;
+        }
+
+        //Use an idle connection if there is one, otherwise the one with the
+        //fewest requests waiting, if any will take another
+        std::size_t chosenDepth = 0;
+        for (std::vector<HttpConnectionPtr>::iterator it = findConns->second.begin(); it != findConns->second.end(); it++) {
+            HttpConnectionPtr conn = *it;
+            boost::lock_guard<boost::mutex> lockConn(conn->mLock);
+            if (conn->mClosing) {
+                continue;
+            }
+            std::size_t depth = conn->mInFlight.size();
+            if (depth == 0) {
+                chosen = conn;
+                break;
+            }
+            //Only pipeline once the server has shown it keeps connections
+            //open, and never behind a request that can't be pipelined
+            if (!can_pipeline(req) || conn->mResponsesReceived == 0 ||
+                    !can_pipeline(conn->mInFlight.back()) || depth >= MAX_PIPELINE_DEPTH) {
+                continue;
+            }
+            if (!chosen || depth < chosenDepth) {
+                chosen = conn;
+                chosenDepth = depth;
+            }
+        }
+
+        if (chosen) {
+            boost::lock_guard<boost::mutex> lockConn(chosen->mLock);
+            if (chosen->mClosing) {
+                chosen.reset();
+            } else {
+                reused = (chosen->mResponsesReceived > 0 || !chosen->mInFlight.empty());
+                pipelined = !chosen->mInFlight.empty();
+                chosen->mInFlight.push_back(req);
+                chosen->mUnwritten++;
+            }
+        }
+    }
+    lockConns.unlock();
+
+    if (chosen) {
+        boost::lock_guard<boost::mutex> lockStats(mStatsLock);
+        if (reused) mStats.requestsReusingConnection++;
+        if (pipelined) mStats.requestsPipelined++;
+    }
+    return chosen;
+}
+
 void HttpManager::processQueue() {
     SILOG(transfer, insane, "processQueue called, mNumTotalConnections = "
-            << mNumTotalConnections << " and recycle bin size = " << mRecycleBin.size()
-            << " and size of hosts = " << mNumConnsPerAddr.size()
+            << mNumTotalConnections << " and size of hosts = " << mNumConnsPerAddr.size()
             << " and request queue size = " << mRequestQueue.size());
 
+    std::vector<HttpConnectionPtr> toWrite;
+
     boost::unique_lock<boost::mutex> lockQueue(mRequestQueueLock);
     boost::unique_lock<boost::mutex> lockNumConns(mNumConnsLock, boost::defer_lock);
 
     for (RequestQueueType::iterator req = mRequestQueue.begin(); req != mRequestQueue.end(); ) {
 
-        std::tr1::shared_ptr<TCPSocket> sock;
-
-        //First check the recycle bin to see if there's a connection already open we can use
-        boost::unique_lock<boost::mutex> lockRB(mRecycleBinLock); {
-            RecycleBinType::iterator findRec = mRecycleBin.find((*req)->addr);
-            if (findRec != mRecycleBin.end()) {
-                sock = findRec->second.front();
-                findRec->second.pop();
-                if (findRec->second.size() == 0) {
-                    mRecycleBin.erase(findRec);
-                }
-            }
+        //First see if there's a connection already open we can use
+        HttpConnectionPtr conn = assign_to_open_connection(*req);
+        if (conn) {
+            toWrite.push_back(conn);
+            req = mRequestQueue.erase(req);
+            continue;
         }
-        lockRB.unlock();
 
-        if (sock) {
-            //SILOG(transfer, debug, "Reusing a connection for " << (*req)->addr.toString());
-            write_request(sock, *req);
-            req = mRequestQueue.erase(req);
-        } else {
+        lockNumConns.lock(); {
+            //If not, let's see if we can open a new connection
+            NumConnsType::iterator findNumC = mNumConnsPerAddr.find((*req)->addr);
+            if (mNumTotalConnections < MAX_TOTAL_CONNECTIONS &&
+                    (findNumC == mNumConnsPerAddr.end() || findNumC->second < MAX_CONNECTIONS_PER_ENDPOINT)) {
 
-            lockNumConns.lock(); {
-                //If nothing in the recycle bin, let's see if we can open a new connection
-                if (mNumTotalConnections < MAX_TOTAL_CONNECTIONS) {
-                    NumConnsType::iterator findNumC = mNumConnsPerAddr.find((*req)->addr);
-                    if (mNumTotalConnections < MAX_TOTAL_CONNECTIONS &&
-                            (findNumC == mNumConnsPerAddr.end() || findNumC->second < MAX_CONNECTIONS_PER_ENDPOINT)) {
-
-                        //We are safe to open a new connection, but increase counts first
-                        mNumTotalConnections++;
-                        if (findNumC == mNumConnsPerAddr.end()) {
-                           mNumConnsPerAddr[(*req)->addr] = 1;
-                        } else {
-                            mNumConnsPerAddr[(*req)->addr] = findNumC->second + 1;
-                        }
-
-                        //SILOG(transfer, debug, "Creating a new connection for " << (*req)->addr.toString());
-                        TCPResolver::query query((*req)->addr.getHostName(), (*req)->addr.getService(), Network::TCPResolver::query::all_matching);
-                        mResolver->async_resolve(query, boost::bind(&HttpManager::handle_resolve, this, *req,
-                                                boost::asio::placeholders::error, boost::asio::placeholders::iterator));
-
-                        req = mRequestQueue.erase(req);
-                    } else {
-                        //No available recycled connections, can't open a new one, so do nothing
-                        req++;
-                    }
+                //We are safe to open a new connection, but increase counts first
+                mNumTotalConnections++;
+                if (findNumC == mNumConnsPerAddr.end()) {
+                   mNumConnsPerAddr[(*req)->addr] = 1;
                 } else {
-                    //No available recycled connections, can't open a new one, so do nothing
-                    req++;
+                    mNumConnsPerAddr[(*req)->addr] = findNumC->second + 1;
                 }
-            } lockNumConns.unlock();
-        }
+
+                //SILOG(transfer, debug, "Creating a new connection for " << (*req)->addr.toString());
+                std::tr1::shared_ptr<TCPSocket> socket(new TCPSocket(*(mServicePool->service())));
+                conn = HttpConnectionPtr(new HttpConnection((*req)->addr, socket, mServicePool->service()));
+                conn->mInFlight.push_back(*req);
+                conn->mUnwritten = 1;
+
+                TCPResolver::query query((*req)->addr.getHostName(), (*req)->addr.getService(), Network::TCPResolver::query::all_matching);
+                mResolver->async_resolve(query, conn->strand.wrap(boost::bind(&HttpManager::handle_resolve, this, conn,
+                                        boost::asio::placeholders::error, boost::asio::placeholders::iterator)));
+
+                req = mRequestQueue.erase(req);
+            } else {
+                //No available connections, can't open a new one, so do nothing
+                req++;
+            }
+        } lockNumConns.unlock();
     }
 
     lockQueue.unlock();
+
+    //Writes have to be started from the connections' strands
+    for (std::vector<HttpConnectionPtr>::iterator it = toWrite.begin(); it != toWrite.end(); it++) {
+        (*it)->strand.dispatch(boost::bind(&HttpManager::write_requests, this, *it));
+    }
 }
 
 void HttpManager::decrement_connection(const Sirikata::Network::Address& addr) {
@@ -393,232 +476,332 @@ void HttpManager::add_req(std::tr1::shared_ptr<HttpRequest> req) {
     lockQueue.unlock();
 }
 
-void HttpManager::handle_resolve(std::tr1::shared_ptr<HttpRequest> req, const boost::system::error_code& err,
+void HttpManager::close_connection(HttpConnectionPtr conn, ERR_TYPE error, const boost::system::error_code& boost_error) {
+    //Stop anyone else from using the connection
+    boost::unique_lock<boost::mutex> lockConns(mConnectionsLock); {
+        ConnectionMap::iterator findConns = mConnections.find(conn->addr);
+        if (findConns != mConnections.end()) {
+            std::vector<HttpConnectionPtr>& conns = findConns->second;
+            conns.erase(std::remove(conns.begin(), conns.end(), conn), conns.end());
+            if (conns.empty()) {
+                mConnections.erase(findConns);
+            }
+        }
+    }
+    lockConns.unlock();
+
+    std::deque<HttpRequestPtr> waiting;
+    bool served;
+    {
+        boost::lock_guard<boost::mutex> lockConn(conn->mLock);
+        //Both the read and write handlers may notice the connection failing
+        if (conn->mClosed) {
+            return;
+        }
+        conn->mClosed = true;
+        conn->mClosing = true;
+        waiting.swap(conn->mInFlight);
+        conn->mUnwritten = 0;
+        served = (conn->mResponsesReceived > 0);
+    }
+    //This runs in conn's strand, so no read or write handler can be using the
+    //socket or the parsing state while they're torn down
+    conn->socket->close();
+    decrement_connection(conn->addr);
+
+    //Whatever was being received when the connection failed. Nothing else
+    //can have been received yet.
+    HttpRequestPtr current = conn->mCurrentRequest;
+    conn->mCurrentRequest.reset();
+    conn->mCurrentResponse.reset();
+    conn->mDecoder.reset();
+
+    uint32 retried = 0;
+    bool stale = false;
+    for (std::deque<HttpRequestPtr>::iterator it = waiting.begin(); it != waiting.end(); it++) {
+        HttpRequestPtr req = *it;
+        if (error == RESPONSE_PARSING_FAILED && (req == current || (!current && it == waiting.begin()))) {
+            req->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, boost_error);
+            continue;
+        }
+        if (req->mBodyDelivered) {
+            //The consumer has already seen part of the body
+            req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost_error);
+            continue;
+        }
+
+        //Requests the server closed the connection before starting to answer,
+        //after answering others on it, don't count as failures. That's just
+        //a kept-alive connection timing out or the server limiting how many
+        //requests it serves per connection.
+        if (error == SUCCESS || (served && req != current)) {
+            if (error != SUCCESS) stale = true;
+        } else {
+            req->mNumTries++;
+            if (req->mNumTries > 10) {
+                //This means this connection has gotten an error over 10 times. Let's stop trying
+                //TODO: this should probably be configurable
+                req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost_error);
+                continue;
+            }
+        }
+        add_req(req);
+        retried++;
+    }
+
+    if (retried > 0 || stale) {
+        boost::lock_guard<boost::mutex> lockStats(mStatsLock);
+        mStats.requestsRetried += retried;
+        if (stale) mStats.staleConnections++;
+    }
+
+    processQueue();
+}
+
+void HttpManager::handle_resolve(HttpConnectionPtr conn, const boost::system::error_code& err,
         TCPResolver::iterator endpoint_iterator) {
     if (!err) {
         TCPEndPoint endpoint = *endpoint_iterator;
-        std::tr1::shared_ptr<TCPSocket> socket(new TCPSocket(*(mServicePool->service())));
-        socket->async_connect(endpoint, boost::bind(
-                &HttpManager::handle_connect, this, socket, req,
-                boost::asio::placeholders::error, ++endpoint_iterator));
+        conn->socket->async_connect(endpoint, conn->strand.wrap(boost::bind(
+                &HttpManager::handle_connect, this, conn,
+                boost::asio::placeholders::error, ++endpoint_iterator)));
     } else {
         SILOG(transfer, error, "Failed to resolve hostname. Error = " << err.message());
-        decrement_connection(req->addr);
+        close_connection(conn, BOOST_ERROR, boost::asio::error::host_not_found);
+    }
+}
 
-        req->mNumTries++;
-        if (req->mNumTries > 10) {
-            //This means this connection has gotten an error over 10 times. Let's stop trying
-            //TODO: this should probably be configurable
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::host_not_found);
-        } else {
-            add_req(req);
+void HttpManager::write_requests(HttpConnectionPtr conn) {
+    //Everything assigned since the last write goes out together
+    std::tr1::shared_ptr<boost::asio::streambuf> request_ptr(new boost::asio::streambuf());
+    uint32 count;
+    {
+        boost::lock_guard<boost::mutex> lockConn(conn->mLock);
+        if (!conn->mConnected || conn->mClosing || conn->mWriting || conn->mUnwritten == 0) {
+            return;
         }
+        std::ostream request_stream(request_ptr.get());
+        for (std::size_t i = conn->mInFlight.size() - conn->mUnwritten; i < conn->mInFlight.size(); i++) {
+            request_stream << conn->mInFlight[i]->req;
+        }
+        count = conn->mUnwritten;
+        conn->mUnwritten = 0;
+        conn->mWriting = true;
+    }
 
-        add_req(req);
-        processQueue();
+    {
+        boost::lock_guard<boost::mutex> lockStats(mStatsLock);
+        mStats.requestsSent += count;
     }
-}
 
-void HttpManager::write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req) {
-    std::tr1::shared_ptr<boost::asio::streambuf> request_ptr(new boost::asio::streambuf());
-    std::ostream request_stream(request_ptr.get());
-    request_stream << req->req;
-    boost::asio::async_write(*socket, *request_ptr, boost::bind(
-            &HttpManager::handle_write_request, this, socket, req,
-            boost::asio::placeholders::error, request_ptr));
+    boost::asio::async_write(*(conn->socket), *request_ptr, conn->strand.wrap(boost::bind(
+            &HttpManager::handle_write_request, this, conn,
+            boost::asio::placeholders::error, request_ptr)));
 }
 
-void HttpManager::handle_connect(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
+void HttpManager::handle_connect(HttpConnectionPtr conn,
         const boost::system::error_code& err, TCPResolver::iterator endpoint_iterator) {
     if (!err) {
-        write_request(socket, req);
+        {
+            boost::lock_guard<boost::mutex> lockStats(mStatsLock);
+            mStats.connectionsOpened++;
+        }
+
+        http_parser_init(&(conn->mHttpParser), HTTP_RESPONSE);
+        /*
+         * http-parser library uses this void * parameter to callbacks for user-defined data
+         * Store a pointer to the HttpConnection object so we can access it during static callbacks
+         */
+        conn->mHttpParser.data = static_cast<void *>(conn.get());
+
+        {
+            boost::lock_guard<boost::mutex> lockConn(conn->mLock);
+            conn->mConnected = true;
+        }
+        //Make it available for other requests
+        {
+            boost::lock_guard<boost::mutex> lockConns(mConnectionsLock);
+            mConnections[conn->addr].push_back(conn);
+        }
+        write_requests(conn);
     } else if (endpoint_iterator != TCPResolver::iterator()) {
-        socket->close();
+        conn->socket->close();
         TCPEndPoint endpoint = *endpoint_iterator;
-        socket->async_connect(endpoint, boost::bind(
-                &HttpManager::handle_connect, this, socket, req,
-                boost::asio::placeholders::error, ++endpoint_iterator));
+        conn->socket->async_connect(endpoint, conn->strand.wrap(boost::bind(
+                &HttpManager::handle_connect, this, conn,
+                boost::asio::placeholders::error, ++endpoint_iterator)));
     } else {
         SILOG(transfer, error, "Failed to connect. Error = " << err.message());
-        decrement_connection(req->addr);
-
-        req->mNumTries++;
-        if (req->mNumTries > 10) {
-            //This means this connection has gotten an error over 10 times. Let's stop trying
-            //TODO: this should probably be configurable
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::host_unreachable);
-        } else {
-            add_req(req);
-        }
-
-        processQueue();
+        close_connection(conn, BOOST_ERROR, boost::asio::error::host_unreachable);
     }
 }
 
-void HttpManager::handle_write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
+void HttpManager::handle_write_request(HttpConnectionPtr conn,
         const boost::system::error_code& err, std::tr1::shared_ptr<boost::asio::streambuf> request_stream) {
-
     if (err) {
-        socket->close();
         SILOG(transfer, error, "Failed to write. Error = " << err.message());
-        decrement_connection(req->addr);
-        add_req(req);
-        processQueue();
+        close_connection(conn, BOOST_ERROR, err);
         return;
     }
 
-    //Create a new response object
-    std::tr1::shared_ptr<HttpResponse> respPtr(new HttpResponse());
-
-    //Initiate an empty DenseData
-    std::tr1::shared_ptr<DenseData> emptyData(new DenseData(Range(true)));
-    respPtr->mData = emptyData;
-
-    //Initialize http parser settings callbacks
-    respPtr->mHttpSettings = EMPTY_PARSER_SETTINGS;
-    respPtr->mHttpSettings.on_header_field = &HttpManager::on_header_field;
-    respPtr->mHttpSettings.on_header_value = &HttpManager::on_header_value;
-    respPtr->mHttpSettings.on_body = &HttpManager::on_body;
-    respPtr->mHttpSettings.on_headers_complete = &HttpManager::on_headers_complete;
-    respPtr->mHttpSettings.on_message_complete = &HttpManager::on_message_complete;
-
-    //Initialize the parser for parsing a response
-    http_parser_init(&(respPtr->mHttpParser), HTTP_RESPONSE);
-
-    /*
-     * http-parser library uses this void * parameter to callbacks for user-defined data
-     * Store a pointer to the HttpResponse object so we can access it during static callbacks
-     */
-    respPtr->mHttpParser.data = static_cast<void *>(respPtr.get());
+    bool startReading = false;
+    {
+        boost::lock_guard<boost::mutex> lockConn(conn->mLock);
+        conn->mWriting = false;
+        if (!conn->mReading && !conn->mInFlight.empty()) {
+            conn->mReading = true;
+            startReading = true;
+        }
+    }
+    if (startReading) {
+        read_response(conn);
+    }
 
-    //Create a buffer for receiving from socket
-    std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf(new std::vector<unsigned char>(SOCKET_BUFFER_SIZE));
+    //More requests may have been assigned while writing
+    write_requests(conn);
+}
 
-    //Read some data
-    socket->async_read_some(boost::asio::buffer(*vecbuf), boost::bind(
-            &HttpManager::handle_read, this, socket, req, vecbuf, respPtr,
+void HttpManager::read_response(HttpConnectionPtr conn) {
+    conn->socket->async_read_some(boost::asio::buffer(conn->mReadBuffer), conn->strand.wrap(boost::bind(
+            &HttpManager::handle_read, this, conn,
             boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+            boost::asio::placeholders::bytes_transferred)));
 }
 
-void HttpManager::handle_read(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-        std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf, std::tr1::shared_ptr<HttpResponse> respPtr,
+void HttpManager::handle_read(HttpConnectionPtr conn,
         const boost::system::error_code& err, std::size_t bytes_transferred) {
 
     SILOG(transfer, insane, "handle_read triggered with bytes_transferred = " << bytes_transferred << " EOF? "
             << (err == boost::asio::error::eof ? "Y" : "N"));
 
     if ((err || bytes_transferred == 0) && err != boost::asio::error::eof) {
-        SILOG(transfer, error, "Failed to write. Error = " << err.message());
-        socket->close();
-        decrement_connection(req->addr);
-        add_req(req);
-        processQueue();
+        SILOG(transfer, error, "Failed to read. Error = " << err.message());
+        close_connection(conn, BOOST_ERROR, err);
         return;
     }
 
-    //Parse the data we just got back from the socket
-    size_t nparsed = http_parser_execute(&(respPtr->mHttpParser), &(respPtr->mHttpSettings),
-            (const char *)(&((*vecbuf)[0])), bytes_transferred);
-
+    //Parse the data we just got back from the socket. Any responses it
+    //completes are collected in mCompleted.
     boost::system::error_code ec;
-    if (nparsed != bytes_transferred) {
+    size_t nparsed = http_parser_execute(&(conn->mHttpParser), &mResponseParserSettings,
+            (const char *)(&(conn->mReadBuffer[0])), bytes_transferred);
+    bool parseFailed = (nparsed != bytes_transferred);
+    if (parseFailed) {
         SILOG(transfer, warning, "Failed to parse http response. nparsed=" << nparsed << " while bytes_transferred=" << bytes_transferred);
-        req->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, ec);
-        socket->close();
-        decrement_connection(req->addr);
-        processQueue();
-        return;
-    }
-
-    if (err == boost::asio::error::eof && bytes_transferred != 0) {
-        //Pass 0 as fourth parameter to parser to tell it that we got EOF
-        size_t nparsed = http_parser_execute(&(respPtr->mHttpParser), &(respPtr->mHttpSettings),
-                (const char *)(&((*vecbuf)[0])), 0);
+    } else if (err == boost::asio::error::eof) {
+        //Pass 0 as fourth parameter to parser to tell it that we got EOF,
+        //which completes a response whose length is given by closing
+        nparsed = http_parser_execute(&(conn->mHttpParser), &mResponseParserSettings,
+                (const char *)(&(conn->mReadBuffer[0])), 0);
         if (nparsed != 0) {
             SILOG(transfer, warning, "Failed to parse http response when giving EOF. nparsed=" << nparsed);
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, ec);
-            socket->close();
-            decrement_connection(req->addr);
-            processQueue();
-            return;
+            parseFailed = true;
         }
-
     }
 
-    if ((req->method == HEAD && respPtr->mHeaderComplete) ||
-        ((req->method == GET || req->method == POST) && respPtr->mMessageComplete)) {
-        //We're done
+    std::vector<std::pair<HttpRequestPtr, std::tr1::shared_ptr<HttpResponse> > > completed;
+    completed.swap(conn->mCompleted);
+    for (std::size_t i = 0; i < completed.size(); i++) {
+        finish_response(completed[i].first, completed[i].second);
+    }
 
-        //If we didn't get any body data, erase the DenseData pointer
-        if (respPtr->mData->length() == 0) {
-            respPtr->mData.reset();
-        }
+    if (parseFailed) {
+        close_connection(conn, RESPONSE_PARSING_FAILED, ec);
+        return;
+    }
+    if (err == boost::asio::error::eof) {
+        //Anything still waiting on this connection has to be retried
+        close_connection(conn, BOOST_ERROR, err);
+        return;
+    }
 
-        SILOG(transfer, detailed, "Finished http transfer with content length of " << respPtr->getContentLength());
-        Headers::const_iterator findLocation;
-        findLocation = respPtr->mHeaders.find("Location");
-        if (respPtr->getStatusCode() == 301 && findLocation != respPtr->mHeaders.end() && req->allow_redirects) {
-            SILOG(transfer, detailed, "Got a 301 redirect reply and location = " << findLocation->second);
-            std::ostringstream request_stream;
-            std::string request_method = methodAsString(req->method);
-            URL newURI(findLocation->second.c_str());
-            request_stream << request_method << " " << newURI.fullpath() << " HTTP/1.1\r\n";
-            Headers::const_iterator it;
-            for (it = req->mHeaders.begin(); it != req->mHeaders.end(); it++) {
-            	if (it->first == "Host") {
-            		request_stream << "Host: " << newURI.host() << "\r\n";
-            	} else {
-            		request_stream << it->first << ": " << it->second << "\r\n";
-            	}
-            }
-            request_stream << "\r\n";
-            Network::Address newaddr(newURI.host(), newURI.proto());
-            makeRequest(newaddr, req->method, request_stream.str(), req->allow_redirects, req->cb);
-        } else {
-            req->cb(respPtr, SUCCESS, ec);
+    bool closing, keepReading;
+    {
+        boost::lock_guard<boost::mutex> lockConn(conn->mLock);
+        closing = conn->mClosing;
+        keepReading = !closing && !conn->mInFlight.empty();
+        if (!keepReading) {
+            conn->mReading = false;
         }
+    }
 
-        //If this is Connection: Close or we reached EOF, then close connection, otherwise recycle
-        if ((respPtr->mHttpParser.flags & F_CONNECTION_CLOSE) || err == boost::asio::error::eof) {
-            socket->close();
-            decrement_connection(req->addr);
-        } else {
-            boost::unique_lock<boost::mutex> lockRB(mRecycleBinLock);
-            mRecycleBin[req->addr].push(socket);
-            lockRB.unlock();
-        }
+    if (closing) {
+        //The server said it's closing the connection. Anything pipelined
+        //behind the last response gets sent again elsewhere.
+        close_connection(conn, SUCCESS, ec);
+        return;
+    }
+    if (keepReading) {
+        read_response(conn);
+    }
+    if (!completed.empty()) {
+        //Responses finishing may have made room for more requests
         processQueue();
+    }
+}
 
-    } else if(err == boost::asio::error::eof || bytes_transferred == 0) {
-        SILOG(transfer, warning, "EOF was true or bytes_transferred==0 and the parser wasn't finished, so connection is broken");
-        socket->close();
-        decrement_connection(req->addr);
+void HttpManager::finish_response(HttpRequestPtr req, std::tr1::shared_ptr<HttpResponse> respPtr) {
+    boost::system::error_code ec;
+    if (!respPtr) {
+        SILOG(transfer, warning, "Failed to decompress http response");
+        req->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, ec);
+        return;
+    }
 
-        req->mNumTries++;
-        if (req->mNumTries > 10) {
-            //This means this connection has gotten an error over 10 times. Let's stop trying
-            //TODO: this should probably be configurable
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::eof);
-        } else {
-            add_req(req);
+    SILOG(transfer, detailed, "Finished http transfer with content length of " << respPtr->getContentLength());
+    Headers::const_iterator findLocation;
+    findLocation = respPtr->mHeaders.find("Location");
+    if (respPtr->getStatusCode() == 301 && findLocation != respPtr->mHeaders.end() && req->allow_redirects) {
+        SILOG(transfer, detailed, "Got a 301 redirect reply and location = " << findLocation->second);
+        std::ostringstream request_stream;
+        std::string request_method = methodAsString(req->method);
+        URL newURI(findLocation->second.c_str());
+        request_stream << request_method << " " << newURI.fullpath() << " HTTP/1.1\r\n";
+        Headers::const_iterator it;
+        for (it = req->mHeaders.begin(); it != req->mHeaders.end(); it++) {
+        	if (it->first == "Host") {
+        		request_stream << "Host: " << newURI.host() << "\r\n";
+        	} else {
+        		request_stream << it->first << ": " << it->second << "\r\n";
+        	}
         }
-
-        processQueue();
-        return;
+        request_stream << "\r\n";
+        Network::Address newaddr(newURI.host(), newURI.proto());
+        makeRequest(newaddr, req->method, request_stream.str(), req->allow_redirects, req->cb, req->body_cb);
     } else {
-        //Read some more data
-        socket->async_read_some(boost::asio::buffer(*vecbuf), boost::bind(
-                &HttpManager::handle_read, this, socket, req, vecbuf, respPtr,
-                boost::asio::placeholders::error,
-                boost::asio::placeholders::bytes_transferred));
+        req->cb(respPtr, SUCCESS, ec);
     }
+}
 
+int HttpManager::on_message_begin(http_parser* _) {
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
+
+    //Responses arrive in the order requests were sent
+    {
+        boost::lock_guard<boost::mutex> lockConn(conn->mLock);
+        if (conn->mInFlight.empty()) {
+            SILOG(transfer, warning, "Got an http response without a request");
+            return 1;
+        }
+        conn->mCurrentRequest = conn->mInFlight.front();
+    }
+
+    std::tr1::shared_ptr<HttpResponse> respPtr(new HttpResponse());
+    //Initiate an empty DenseData
+    respPtr->mData = std::tr1::shared_ptr<DenseData>(new DenseData(Range(true)));
+    conn->mCurrentResponse = respPtr;
+    conn->mEncoding = IDENTITY;
+    conn->mDecoder.reset();
+    conn->mDecodeFailed = false;
+    conn->mDeliverBody = false;
+    return 0;
 }
 
 int HttpManager::on_headers_complete(http_parser* _) {
     //SILOG(transfer, debug, "headers complete. content length = " << _->content_length);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
+    HttpResponse* curResponse = conn->mCurrentResponse.get();
+    HttpRequest* curRequest = conn->mCurrentRequest.get();
     curResponse->mContentLength = _->content_length;
     curResponse->mStatusCode = _->status_code;
 
@@ -627,18 +810,35 @@ int HttpManager::on_headers_complete(http_parser* _) {
         curResponse->mHeaders[curResponse->mTempHeaderField] = curResponse->mTempHeaderValue;
     }
 
-    //Check if Content-Encoding = gzip
+    //Check if the body is compressed
     Headers::const_iterator it = curResponse->mHeaders.find("Content-Encoding");
-    if(it != curResponse->mHeaders.end() && it->second == "gzip") {
-        curResponse->mGzip = true;
+    if (it != curResponse->mHeaders.end()) {
+        if (it->second == "gzip" || it->second == "x-gzip") {
+            conn->mEncoding = GZIP;
+        } else if (it->second == "deflate") {
+            conn->mEncoding = DEFLATE;
+        }
     }
 
+    //Allocate space for the whole body up front, rather than growing it as
+    //it arrives
+    if (conn->mEncoding == IDENTITY && _->content_length > 0) {
+        curResponse->mData->reserve((size_t)std::min((int64)_->content_length, (int64)MAX_PREALLOCATED_BODY_SIZE));
+    }
+
+    //Bodies of redirects we're going to follow aren't interesting
+    conn->mDeliverBody = curRequest->body_cb &&
+        !(curResponse->mStatusCode == 301 && curRequest->allow_redirects &&
+            curResponse->mHeaders.find("Location") != curResponse->mHeaders.end());
+
     curResponse->mHeaderComplete = true;
-    return 0;
+
+    //Responses to HEAD have headers describing a body, but no body
+    return (curRequest->method == HEAD ? 1 : 0);
 }
 
 int HttpManager::on_header_field(http_parser* _, const char* at, size_t len) {
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpResponse* curResponse = static_cast<HttpConnection*>(_->data)->mCurrentResponse.get();
 
     //See http-parser documentation for why this is necessary
     switch (curResponse->mLastCallback) {
@@ -662,7 +862,7 @@ int HttpManager::on_header_field(http_parser* _, const char* at, size_t len) {
 
 int HttpManager::on_header_value(http_parser* _, const char* at, size_t len) {
     //SILOG(transfer, debug, "on_header_value called");
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpResponse* curResponse = static_cast<HttpConnection*>(_->data)->mCurrentResponse.get();
 
     //See http-parser documentation for why this is necessary
     switch(curResponse->mLastCallback) {
@@ -744,42 +944,114 @@ int HttpManager::on_request_header_value(http_parser* _, const char* at, size_t
     return 0;
 }
 
+std::streamsize HttpManager::BodySink::write(const char* s, std::streamsize n) {
+    HttpManager::deliver_body(conn, s, (size_t)n);
+    return n;
+}
+
+void HttpManager::deliver_body(HttpConnection* conn, const char* data, size_t len) {
+    conn->mCurrentResponse->mData->append(data, len, true);
+    if (conn->mDeliverBody) {
+        conn->mCurrentRequest->mBodyDelivered = true;
+        conn->mCurrentRequest->body_cb(conn->mCurrentResponse, (const unsigned char*)data, len);
+    }
+}
+
 int HttpManager::on_body(http_parser* _, const char* at, size_t len) {
     //SILOG(transfer, debug, "on_body called with length = " << len);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
-
-    if(curResponse->mGzip) {
-        //Gzip encoding, so pass this buffer through a decoder
-        curResponse->mCompressedStream.write(at, len);
-    } else {
-        //Raw encoding, so append the bytes in current body pointer directly to the DenseData pointer in our response
-        curResponse->mData->append(at, len, true);
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
+    std::size_t decoded = len;
+
+    if (conn->mEncoding == IDENTITY) {
+        //Raw encoding, so the bytes in current body pointer are the data
+        deliver_body(conn, at, len);
+    } else if (!conn->mDecodeFailed) {
+        //Compressed, so pass this buffer through a decoder, which passes on
+        //the data as it's decompressed
+        if (!conn->mDecoder) {
+            conn->mDecoder = std::tr1::shared_ptr<boost::iostreams::filtering_ostream>(new boost::iostreams::filtering_ostream());
+            if (conn->mEncoding == GZIP) {
+                conn->mDecoder->push(boost::iostreams::gzip_decompressor());
+            } else {
+                //deflate is supposed to be zlib format, but some servers send
+                //raw deflate data. A zlib header says it uses deflate in
+                //the low bits of the first byte.
+                boost::iostreams::zlib_params params;
+                params.noheader = ((at[0] & 0x0f) != 8);
+                conn->mDecoder->push(boost::iostreams::zlib_decompressor(params));
+            }
+            conn->mDecoder->push(BodySink(conn));
+        }
+        std::size_t before = conn->mCurrentResponse->mData->length();
+        conn->mDecoder->write(at, len);
+        conn->mDecoder->flush();
+        if (!*(conn->mDecoder)) {
+            conn->mDecodeFailed = true;
+        }
+        decoded = conn->mCurrentResponse->mData->length() - before;
     }
 
+    boost::lock_guard<boost::mutex> lockStats(HttpManager::getSingleton().mStatsLock);
+    HttpManager::getSingleton().mStats.bodyBytesReceived += len;
+    HttpManager::getSingleton().mStats.bodyBytesDecoded += decoded;
     return 0;
 }
 
+void HttpManager::finish_body(HttpConnection* conn) {
+    if (!conn->mDecoder) {
+        return;
+    }
+    //Closing the decoder flushes out the end of the data
+    std::size_t before = conn->mCurrentResponse->mData->length();
+    try {
+        conn->mDecoder->reset();
+    } catch (std::exception& e) {
+        conn->mDecodeFailed = true;
+    }
+    conn->mDecoder.reset();
+    conn->mCurrentResponse->mContentLength = conn->mCurrentResponse->mData->length();
+
+    boost::lock_guard<boost::mutex> lockStats(HttpManager::getSingleton().mStatsLock);
+    HttpManager::getSingleton().mStats.bodyBytesDecoded += conn->mCurrentResponse->mData->length() - before;
+}
+
 int HttpManager::on_message_complete(http_parser* _) {
     //SILOG(transfer, debug, "message complete. content length = " << _->content_length);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
+    std::tr1::shared_ptr<HttpResponse> curResponse = conn->mCurrentResponse;
 
-    if(curResponse->mGzip) {
-        std::stringstream decompressed;
-        boost::iostreams::filtering_streambuf<boost::iostreams::input> out;
-        out.push(boost::iostreams::gzip_decompressor());
-        out.push(curResponse->mCompressedStream);
-        boost::iostreams::copy(out, decompressed);
-        curResponse->mCompressedStream.str("");
-        curResponse->mData->append(decompressed.str().c_str(), decompressed.str().length(), true);
-        curResponse->mContentLength = decompressed.str().length();
-    }
+    finish_body(conn);
+    bool decodeFailed = conn->mDecodeFailed;
 
+    //If we didn't get any body data, erase the DenseData pointer
+    if (curResponse->mData->length() == 0) {
+        curResponse->mData.reset();
+    }
     curResponse->mMessageComplete = true;
+
+    {
+        boost::lock_guard<boost::mutex> lockConn(conn->mLock);
+        conn->mInFlight.pop_front();
+        conn->mResponsesReceived++;
+        //If this is Connection: Close, then no more responses will come on
+        //this connection
+        if (!http_should_keep_alive(_)) {
+            conn->mClosing = true;
+        }
+    }
+
+    if (decodeFailed) {
+        //Pass on the failure without a response
+        curResponse.reset();
+    }
+    conn->mCompleted.push_back(std::make_pair(conn->mCurrentRequest, curResponse));
+    conn->mCurrentRequest.reset();
+    conn->mCurrentResponse.reset();
     return 0;
 }
 
-void HttpManager::print_flags(std::tr1::shared_ptr<HttpResponse> resp) {
-    char flags = resp->mHttpParser.flags;
+void HttpManager::print_flags(const http_parser& parser) {
+    char flags = parser.flags;
     SILOG(transfer, detailed, "Flags are: "
             << (flags & F_CHUNKED ? "F_CHUNKED " : "")
             << (flags & F_CONNECTION_KEEP_ALIVE ? "F_CONNECTION_KEEP_ALIVE " : "")
@@ -787,8 +1059,6 @@ void HttpManager::print_flags(std::tr1::shared_ptr<HttpResponse> resp) {
             << (flags & F_TRAILING ? "F_TRAILING " : "")
             << (flags & F_UPGRADE ? "F_UPGRADE " : "")
             << (flags & F_SKIPBODY ? "F_SKIPBODY " : "")
-            << (resp->mMessageComplete ? "MESSAGE_COMPLETE " : "")
-            << (resp->mHeaderComplete ? "HEADER_COMPLETE " : "")
             );
 }
 
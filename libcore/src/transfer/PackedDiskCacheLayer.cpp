@@ -0,0 +1,737 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/transfer/PackedDiskCacheLayer.hpp>
+#include <sirikata/core/util/Paths.hpp>
+
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+
+#include <boost/filesystem.hpp>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+
+#define PACKCACHE_LOG(lvl,msg) SILOG(transfer, lvl, "[PackedDiskCacheLayer] " << msg)
+
+namespace Sirikata {
+namespace Transfer {
+
+namespace {
+
+const char *INDEX_FILE = "index";
+const char *PACK_PREFIX = "pack-";
+const char *PACK_SUFFIX = ".dat";
+
+// Records are a header followed by the data:
+//   magic (4 bytes), flags (4), fingerprint (32), start byte (8), length (8)
+// Everything is in native byte order, since the cache is local to the machine.
+const uint32 RECORD_MAGIC = 0x53504b31; // "SPK1"
+const uint32 RECORD_TO_END_OF_FILE = 1;
+const size_t RECORD_HEADER_SIZE = 4 + 4 + SHA256::static_size + 8 + 8;
+
+// The index is:
+//   magic (4 bytes), number of packs (4), then for each pack its id (4) and
+//   the number of bytes of it the index covers (8),
+//   number of extents (8), then for each one a record header, less the magic,
+//   followed by its pack (4) and offset (8)
+const uint32 INDEX_MAGIC = 0x53494431; // "SID1"
+
+// Save the index after this many records have been written, so a crash
+// doesn't leave too much to scan at startup.
+const uint32 INDEX_INTERVAL = 4096;
+
+inline uint64 recordSize(const Range &range) {
+    return RECORD_HEADER_SIZE + range.length();
+}
+
+template<typename T>
+void put(std::string &out, const T &val) {
+    out.append((const char*)&val, sizeof(T));
+}
+
+template<typename T>
+bool get(const unsigned char *&in, const unsigned char *end, T *val) {
+    if (in + sizeof(T) > end) {
+        return false;
+    }
+    memcpy(val, in, sizeof(T));
+    in += sizeof(T);
+    return true;
+}
+
+void putRecordFields(std::string &out, const Fingerprint &fileId, const Range &range) {
+    put(out, (uint32)(range.goesToEndOfFile() ? RECORD_TO_END_OF_FILE : 0));
+    out.append((const char*)fileId.rawData().data(), SHA256::static_size);
+    put(out, (uint64)range.startbyte());
+    put(out, (uint64)range.length());
+}
+
+bool getRecordFields(const unsigned char *&in, const unsigned char *end, Fingerprint *fileId, Range *range) {
+    uint32 flags;
+    uint64 start, length;
+    if (!get(in, end, &flags) || in + SHA256::static_size > end) {
+        return false;
+    }
+    *fileId = SHA256::convertFromBinary(in);
+    in += SHA256::static_size;
+    if (!get(in, end, &start) || !get(in, end, &length)) {
+        return false;
+    }
+    *range = Range(start, length, LENGTH, (flags & RECORD_TO_END_OF_FILE) != 0);
+    return true;
+}
+
+struct MappedRegion {
+    MappedRegion(void *a, size_t l)
+        : addr(a), len(l) {
+    }
+    ~MappedRegion() {
+        munmap(addr, len);
+    }
+    void *addr;
+    size_t len;
+};
+
+} // namespace
+
+struct PackedDiskCacheLayer::Pack {
+    uint32 id;
+    int fd;
+    // Bytes of records in the pack
+    uint64 size;
+    // Bytes of records still referenced by entries
+    uint64 liveBytes;
+    uint64 mappedSize;
+    // The whole pack, including space it can still be appended to, is mapped.
+    // DenseData views hold on to the mapping, so it outlives the pack if
+    // necessary.
+    std::tr1::shared_ptr<void> mapping;
+    const unsigned char *base;
+};
+
+PackedDiskCacheLayer::PackedDiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext, uint64 packSize)
+ : CacheLayer(tryNext),
+   mWorkerThread(NULL),
+   mFiles(NULL, policy),
+   mPrefix(),
+   mPackSize(packSize),
+   mCurrentPack(NULL),
+   mNextPackId(0),
+   mUnindexedRecords(0),
+   mCompactionQueued(false),
+   mCleaningUp(false)
+{
+    // If absolute, use directly. Otherwise, append to temp directory
+    mPrefix = Path::Get(Path::DIR_TEMP, prefix);
+    if (mPrefix[mPrefix.size()-1] != '/')
+        mPrefix += '/';
+
+    mFiles.setOwner(this);
+    try {
+        boost::filesystem::create_directories(mPrefix);
+    } catch (...) {
+        PACKCACHE_LOG(error, "Couldn't create cache directory " << mPrefix);
+    }
+    load();
+    mWorkerThread = new Thread("PackedDiskCacheLayer", std::tr1::bind(&PackedDiskCacheLayer::workerThread, this));
+}
+
+PackedDiskCacheLayer::~PackedDiskCacheLayer() {
+    // The worker saves the index on the way out
+    runAndWait(DiskRequestPtr(new DiskRequest(DiskRequest::OPEXIT)));
+    mWorkerThread->join();
+    delete mWorkerThread;
+
+    // mFiles frees the entries after this, but their data stays on disk
+    mCleaningUp = true;
+    for (PackMap::iterator iter = mPacks.begin(); iter != mPacks.end(); ++iter) {
+        closePack(iter->second, false);
+    }
+    mPacks.clear();
+}
+
+std::string PackedDiskCacheLayer::packPath(uint32 id) const {
+    std::ostringstream os;
+    os << mPrefix << PACK_PREFIX << id << PACK_SUFFIX;
+    return os.str();
+}
+
+PackedDiskCacheLayer::Pack *PackedDiskCacheLayer::openPack(uint32 id, bool create) {
+    std::string path = packPath(id);
+    int fd = open(path.c_str(), O_RDWR | (create ? O_CREAT|O_TRUNC : 0), 0666);
+    if (fd < 0) {
+        PACKCACHE_LOG(error, "Failed to open " << path << "; reason: " << errno);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        PACKCACHE_LOG(error, "Failed to stat " << path << "; reason: " << errno);
+        close(fd);
+        return NULL;
+    }
+
+    uint64 mappedSize = std::max(mPackSize, (uint64)st.st_size);
+    void *addr = mmap(NULL, (size_t)mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        PACKCACHE_LOG(error, "Failed to map " << path << "; reason: " << errno);
+        close(fd);
+        return NULL;
+    }
+
+    Pack *pack = new Pack();
+    pack->id = id;
+    pack->fd = fd;
+    pack->size = st.st_size;
+    pack->liveBytes = 0;
+    pack->mappedSize = mappedSize;
+    pack->mapping = std::tr1::shared_ptr<MappedRegion>(new MappedRegion(addr, (size_t)mappedSize));
+    pack->base = (const unsigned char*)addr;
+    return pack;
+}
+
+void PackedDiskCacheLayer::closePack(Pack *pack, bool remove) {
+    close(pack->fd);
+    if (remove) {
+        unlink(packPath(pack->id).c_str());
+    }
+    delete pack;
+}
+
+void PackedDiskCacheLayer::load() {
+    std::map<uint32, uint64> indexed;
+    std::vector<std::pair<Fingerprint, Extent> > extents;
+    if (!loadIndex(indexed, extents)) {
+        indexed.clear();
+        extents.clear();
+    }
+
+    // Only the packs are listed, so there are just a few files to look at
+    std::set<uint32> packIds;
+    DIR *dir = opendir(mPrefix.c_str());
+    if (dir) {
+        dirent *entry;
+        size_t prefixLen = strlen(PACK_PREFIX), suffixLen = strlen(PACK_SUFFIX);
+        while ((entry = readdir(dir)) != NULL) {
+            std::string name(entry->d_name);
+            if (name.size() <= prefixLen + suffixLen ||
+                name.compare(0, prefixLen, PACK_PREFIX) != 0 ||
+                name.compare(name.size() - suffixLen, suffixLen, PACK_SUFFIX) != 0) {
+                continue;
+            }
+            std::string idStr = name.substr(prefixLen, name.size() - prefixLen - suffixLen);
+            char *endp = NULL;
+            unsigned long id = strtoul(idStr.c_str(), &endp, 10);
+            if (endp && *endp == '\0') {
+                packIds.insert((uint32)id);
+            }
+        }
+        closedir(dir);
+    }
+
+    // Open the packs, scanning whatever the index doesn't cover. If a pack is
+    // shorter than the index says, the index can't be trusted for it.
+    std::set<uint32> untrusted;
+    for (std::set<uint32>::iterator iter = packIds.begin(); iter != packIds.end(); ++iter) {
+        Pack *pack = openPack(*iter, false);
+        if (pack == NULL) {
+            untrusted.insert(*iter);
+            continue;
+        }
+        mPacks[pack->id] = pack;
+        mNextPackId = std::max(mNextPackId, pack->id + 1);
+
+        uint64 from = 0;
+        std::map<uint32, uint64>::iterator indexIt = indexed.find(pack->id);
+        if (indexIt != indexed.end()) {
+            if (indexIt->second <= pack->size) {
+                from = indexIt->second;
+            } else {
+                untrusted.insert(pack->id);
+            }
+        }
+        scanPack(pack, from, extents);
+    }
+
+    uint32 loaded = 0;
+    for (std::vector<std::pair<Fingerprint, Extent> >::iterator iter = extents.begin(); iter != extents.end(); ++iter) {
+        const Fingerprint &fileId = iter->first;
+        const Extent &extent = iter->second;
+        // Extents from the index for packs which changed were found again by
+        // scanning them.
+        if (mPacks.find(extent.pack) == mPacks.end() ||
+            (untrusted.count(extent.pack) && indexed.count(extent.pack) && extent.offset < indexed[extent.pack])) {
+            continue;
+        }
+
+        uint64 size = recordSize(extent.range);
+        CacheMap::write_iterator writer(mFiles);
+        if (writer.find(fileId) && static_cast<CacheData*>(*writer)->contains(extent.range)) {
+            continue;
+        }
+        if (!mFiles.alloc(fileId, size, writer)) {
+            continue;
+        }
+        if (writer.insert(fileId, size)) {
+            *writer = new CacheData;
+        } else {
+            writer.update(writer.getSize() + size);
+        }
+        addExtent(static_cast<CacheData*>(*writer), extent);
+        loaded++;
+    }
+    PACKCACHE_LOG(detailed, "Loaded " << loaded << " extents from " << mPacks.size() << " packs");
+
+    // Keep appending to the newest pack, and clean up any left mostly empty
+    // by evictions in earlier runs.
+    if (!mPacks.empty()) {
+        Pack *newest = mPacks.rbegin()->second;
+        if (newest->size < mPackSize) {
+            mCurrentPack = newest;
+        }
+    }
+    for (PackMap::iterator iter = mPacks.begin(); iter != mPacks.end(); ++iter) {
+        Pack *pack = iter->second;
+        if (pack != mCurrentPack && pack->liveBytes * 2 < pack->size) {
+            mCompactionQueued = true;
+            mRequestQueue.push(DiskRequestPtr(new DiskRequest(DiskRequest::OPCOMPACT)));
+            break;
+        }
+    }
+}
+
+bool PackedDiskCacheLayer::loadIndex(std::map<uint32, uint64> &indexed, std::vector<std::pair<Fingerprint, Extent> > &extents) {
+    std::string path = mPrefix + INDEX_FILE;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    std::vector<unsigned char> buf;
+    unsigned char chunk[65536];
+    size_t nread;
+    while ((nread = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        buf.insert(buf.end(), chunk, chunk + nread);
+    }
+    fclose(fp);
+    if (buf.empty()) {
+        return false;
+    }
+
+    const unsigned char *in = &buf[0], *end = &buf[0] + buf.size();
+    uint32 magic, npacks;
+    if (!get(in, end, &magic) || magic != INDEX_MAGIC || !get(in, end, &npacks)) {
+        PACKCACHE_LOG(error, "Ignoring invalid index " << path);
+        return false;
+    }
+    for (uint32 i = 0; i < npacks; i++) {
+        uint32 id;
+        uint64 size;
+        if (!get(in, end, &id) || !get(in, end, &size)) {
+            PACKCACHE_LOG(error, "Ignoring truncated index " << path);
+            return false;
+        }
+        indexed[id] = size;
+    }
+    uint64 nextents;
+    if (!get(in, end, &nextents)) {
+        PACKCACHE_LOG(error, "Ignoring truncated index " << path);
+        return false;
+    }
+    extents.reserve((size_t)std::min(nextents, (uint64)buf.size()));
+    for (uint64 i = 0; i < nextents; i++) {
+        Fingerprint fileId;
+        Range range(false);
+        uint32 pack;
+        uint64 offset;
+        if (!getRecordFields(in, end, &fileId, &range) || !get(in, end, &pack) || !get(in, end, &offset)) {
+            PACKCACHE_LOG(error, "Ignoring truncated index " << path);
+            return false;
+        }
+        extents.push_back(std::make_pair(fileId, Extent(range, pack, offset)));
+    }
+    return true;
+}
+
+void PackedDiskCacheLayer::scanPack(Pack *pack, uint64 from, std::vector<std::pair<Fingerprint, Extent> > &extents) {
+    uint64 pos = from;
+    while (pos + RECORD_HEADER_SIZE <= pack->size) {
+        const unsigned char *in = pack->base + pos, *end = in + RECORD_HEADER_SIZE;
+        uint32 magic;
+        Fingerprint fileId;
+        Range range(false);
+        if (!get(in, end, &magic) || magic != RECORD_MAGIC ||
+            !getRecordFields(in, end, &fileId, &range) ||
+            range.length() == 0 ||
+            pos + recordSize(range) > pack->size) {
+            break;
+        }
+        extents.push_back(std::make_pair(fileId, Extent(range, pack->id, pos)));
+        pos += recordSize(range);
+    }
+    if (pos < pack->size) {
+        // Most likely a write which was cut short
+        PACKCACHE_LOG(error, "Discarding " << (pack->size - pos) << " invalid bytes at the end of " << packPath(pack->id));
+        if (ftruncate(pack->fd, pos) == 0) {
+            pack->size = pos;
+        }
+    }
+}
+
+void PackedDiskCacheLayer::saveIndex() {
+    std::string out;
+    put(out, INDEX_MAGIC);
+    {
+        boost::lock_guard<boost::mutex> lock(mPacksLock);
+        put(out, (uint32)mPacks.size());
+        for (PackMap::iterator iter = mPacks.begin(); iter != mPacks.end(); ++iter) {
+            put(out, iter->first);
+            put(out, iter->second->size);
+        }
+    }
+
+    std::string entries;
+    uint64 nextents = 0;
+    {
+        CacheMap::read_iterator iter(mFiles);
+        while (iter.iterate()) {
+            const CacheData *entry = static_cast<const CacheData*>(*iter);
+            for (std::vector<Extent>::const_iterator ext = entry->mExtents.begin(); ext != entry->mExtents.end(); ++ext) {
+                putRecordFields(entries, iter.getId(), ext->range);
+                put(entries, ext->pack);
+                put(entries, ext->offset);
+                nextents++;
+            }
+        }
+    }
+    put(out, nextents);
+    out.append(entries);
+
+    std::string path = mPrefix + INDEX_FILE;
+    std::string tempPath = path + ".temp";
+    FILE *fp = fopen(tempPath.c_str(), "wb");
+    if (fp == NULL) {
+        PACKCACHE_LOG(error, "Failed to open " << tempPath << "; reason: " << errno);
+        return;
+    }
+    bool ok = (fwrite(out.data(), 1, out.size(), fp) == out.size());
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+        PACKCACHE_LOG(error, "Failed to write " << path << "; reason: " << errno);
+        unlink(tempPath.c_str());
+        return;
+    }
+    mUnindexedRecords = 0;
+}
+
+bool PackedDiskCacheLayer::append(const Fingerprint &fileId, const Range &range, const unsigned char *data, Extent *result) {
+    uint64 size = recordSize(range);
+    if (mCurrentPack == NULL || mCurrentPack->size + size > mCurrentPack->mappedSize) {
+        Pack *pack = openPack(mNextPackId++, true);
+        if (pack == NULL) {
+            return false;
+        }
+        if (pack->mappedSize < size) {
+            // Bigger than a whole pack, so it gets one to itself
+            closePack(pack, true);
+            PACKCACHE_LOG(error, "Not caching " << fileId << ", " << size << " bytes is bigger than a pack");
+            return false;
+        }
+        boost::lock_guard<boost::mutex> lock(mPacksLock);
+        mPacks[pack->id] = pack;
+        mCurrentPack = pack;
+    }
+
+    Pack *pack = mCurrentPack;
+    std::string header;
+    put(header, RECORD_MAGIC);
+    putRecordFields(header, fileId, range);
+    if (pwrite(pack->fd, header.data(), header.size(), (off_t)pack->size) != (ssize_t)header.size() ||
+        pwrite(pack->fd, data, (size_t)range.length(), (off_t)(pack->size + header.size())) != (ssize_t)range.length()) {
+        PACKCACHE_LOG(error, "Failed to write to " << packPath(pack->id) << "; reason: " << errno);
+        if (ftruncate(pack->fd, (off_t)pack->size) != 0) {
+            // Leave the garbage, it'll be discarded when the pack is next
+            // loaded, but don't append after it.
+            boost::lock_guard<boost::mutex> lock(mPacksLock);
+            mCurrentPack = NULL;
+        }
+        return false;
+    }
+
+    *result = Extent(range, pack->id, pack->size);
+    boost::lock_guard<boost::mutex> lock(mPacksLock);
+    pack->size += size;
+    return true;
+}
+
+void PackedDiskCacheLayer::addExtent(CacheData *entry, const Extent &extent) {
+    entry->mExtents.push_back(extent);
+    extent.range.addToList(extent.range, entry->mRanges);
+
+    boost::lock_guard<boost::mutex> lock(mPacksLock);
+    PackMap::iterator pack = mPacks.find(extent.pack);
+    if (pack != mPacks.end()) {
+        pack->second->liveBytes += recordSize(extent.range);
+    }
+}
+
+void PackedDiskCacheLayer::writeData(const Fingerprint &fileId, const DenseDataPtr &data) {
+    if (data->length() == 0) {
+        return;
+    }
+    uint64 size = recordSize(*data);
+    {
+        CacheMap::write_iterator writer(mFiles);
+        if (writer.find(fileId) && static_cast<CacheData*>(*writer)->contains(*data)) {
+            // this range is already stored.
+            return;
+        }
+        if (!mFiles.alloc(fileId, size, writer)) {
+            return;
+        }
+    }
+
+    Extent extent(*data, 0, 0);
+    if (!append(fileId, *data, data->data(), &extent)) {
+        return;
+    }
+
+    {
+        CacheMap::write_iterator writer(mFiles);
+        if (writer.insert(fileId, size)) {
+            *writer = new CacheData;
+            addExtent(static_cast<CacheData*>(*writer), extent);
+        } else if (!static_cast<CacheData*>(*writer)->contains(*data)) {
+            addExtent(static_cast<CacheData*>(*writer), extent);
+            writer.update(writer.getSize() + size);
+        }
+        // Otherwise someone else stored it first, and this copy is a hole
+        // which will be compacted away.
+    }
+
+    if (++mUnindexedRecords >= INDEX_INTERVAL) {
+        saveIndex();
+    }
+}
+
+void PackedDiskCacheLayer::compactPacks() {
+    std::vector<uint32> candidates;
+    {
+        boost::lock_guard<boost::mutex> lock(mPacksLock);
+        mCompactionQueued = false;
+        for (PackMap::iterator iter = mPacks.begin(); iter != mPacks.end(); ++iter) {
+            Pack *pack = iter->second;
+            if (pack != mCurrentPack && pack->liveBytes * 2 < pack->size) {
+                candidates.push_back(pack->id);
+            }
+        }
+    }
+    for (std::vector<uint32>::iterator iter = candidates.begin(); iter != candidates.end(); ++iter) {
+        compactPack(*iter);
+    }
+    if (!candidates.empty()) {
+        saveIndex();
+    }
+}
+
+void PackedDiskCacheLayer::compactPack(uint32 packId) {
+    Pack *old;
+    {
+        boost::lock_guard<boost::mutex> lock(mPacksLock);
+        old = mPacks[packId];
+    }
+    uint64 oldLive = old->liveBytes;
+
+    // Find the entries with data in the pack
+    std::vector<Fingerprint> ids;
+    {
+        CacheMap::read_iterator iter(mFiles);
+        while (iter.iterate()) {
+            const CacheData *entry = static_cast<const CacheData*>(*iter);
+            for (std::vector<Extent>::const_iterator ext = entry->mExtents.begin(); ext != entry->mExtents.end(); ++ext) {
+                if (ext->pack == packId) {
+                    ids.push_back(iter.getId());
+                    break;
+                }
+            }
+        }
+    }
+
+    // And move their data to the current pack
+    for (std::vector<Fingerprint>::iterator id = ids.begin(); id != ids.end(); ++id) {
+        CacheMap::write_iterator writer(mFiles);
+        if (!writer.find(*id)) {
+            continue;
+        }
+        CacheData *entry = static_cast<CacheData*>(*writer);
+        for (std::vector<Extent>::iterator ext = entry->mExtents.begin(); ext != entry->mExtents.end(); ++ext) {
+            if (ext->pack != packId) {
+                continue;
+            }
+            Extent moved(ext->range, 0, 0);
+            if (!append(*id, ext->range, old->base + ext->offset + RECORD_HEADER_SIZE, &moved)) {
+                PACKCACHE_LOG(error, "Failed to compact " << packPath(packId));
+                return;
+            }
+            uint64 size = recordSize(ext->range);
+            boost::lock_guard<boost::mutex> lock(mPacksLock);
+            old->liveBytes -= size;
+            mPacks[moved.pack]->liveBytes += size;
+            ext->pack = moved.pack;
+            ext->offset = moved.offset;
+        }
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(mPacksLock);
+        mPacks.erase(packId);
+    }
+    PACKCACHE_LOG(detailed, "Compacted " << packPath(packId) << ", moved " << oldLive << " of " << old->size << " bytes");
+    closePack(old, true);
+}
+
+void PackedDiskCacheLayer::runAndWait(const DiskRequestPtr &req) {
+    boost::unique_lock<boost::mutex> lock(mDoneLock);
+    mRequestQueue.push(req);
+    while (!req->done) {
+        mDoneCV.wait(lock);
+    }
+}
+
+void PackedDiskCacheLayer::workerThread() {
+    while (true) {
+        DiskRequestPtr req;
+        mRequestQueue.blockingPop(req);
+
+        bool exit = false;
+        switch (req->op) {
+          case DiskRequest::OPWRITE:
+            writeData(req->fileId, req->data);
+            break;
+          case DiskRequest::OPCOMPACT:
+            compactPacks();
+            break;
+          case DiskRequest::OPSYNC:
+            saveIndex();
+            break;
+          case DiskRequest::OPEXIT:
+            saveIndex();
+            exit = true;
+            break;
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mDoneLock);
+            req->done = true;
+            mDoneCV.notify_all();
+        }
+        if (exit) {
+            break;
+        }
+    }
+}
+
+void PackedDiskCacheLayer::sync() {
+    runAndWait(DiskRequestPtr(new DiskRequest(DiskRequest::OPSYNC)));
+}
+
+void PackedDiskCacheLayer::compact() {
+    runAndWait(DiskRequestPtr(new DiskRequest(DiskRequest::OPCOMPACT)));
+}
+
+uint64 PackedDiskCacheLayer::diskUsage() {
+    boost::lock_guard<boost::mutex> lock(mPacksLock);
+    uint64 total = 0;
+    for (PackMap::iterator iter = mPacks.begin(); iter != mPacks.end(); ++iter) {
+        total += iter->second->size;
+    }
+    return total;
+}
+
+void PackedDiskCacheLayer::populateCache(const Fingerprint& fileId, const DenseDataPtr &data) {
+    DiskRequestPtr req(new DiskRequest(DiskRequest::OPWRITE));
+    req->fileId = fileId;
+    req->data = data;
+    mRequestQueue.push(req);
+
+    CacheLayer::populateParentCaches(fileId, data);
+}
+
+void PackedDiskCacheLayer::destroyCacheEntry(const Fingerprint &fileId, CacheEntry *cacheLayerData, cache_usize_type releaseSize) {
+    CacheData *entry = static_cast<CacheData*>(cacheLayerData);
+    if (!mCleaningUp) {
+        // The data is left as a hole in its pack until the pack is compacted
+        boost::lock_guard<boost::mutex> lock(mPacksLock);
+        for (std::vector<Extent>::iterator ext = entry->mExtents.begin(); ext != entry->mExtents.end(); ++ext) {
+            PackMap::iterator iter = mPacks.find(ext->pack);
+            if (iter == mPacks.end()) {
+                continue;
+            }
+            Pack *pack = iter->second;
+            pack->liveBytes -= recordSize(ext->range);
+            if (pack != mCurrentPack && pack->liveBytes * 2 < pack->size && !mCompactionQueued) {
+                mCompactionQueued = true;
+                mRequestQueue.push(DiskRequestPtr(new DiskRequest(DiskRequest::OPCOMPACT)));
+            }
+        }
+    }
+    delete entry;
+}
+
+void PackedDiskCacheLayer::purgeFromCache(const Fingerprint &fileId) {
+    {
+        CacheMap::write_iterator iter(mFiles);
+        if (iter.find(fileId)) {
+            iter.erase();
+        }
+    }
+    CacheLayer::purgeFromCache(fileId);
+}
+
+void PackedDiskCacheLayer::getData(const Fingerprint &fileId, const Range &requestedRange, const TransferCallback&callback) {
+    bool haveData = false;
+    SparseData foundData;
+    {
+        CacheMap::read_iterator iter(mFiles);
+        if (iter.find(fileId)) {
+            const CacheData *entry = static_cast<const CacheData*>(*iter);
+            if (entry->contains(requestedRange)) {
+                haveData = true;
+                iter.use();
+
+                boost::lock_guard<boost::mutex> lock(mPacksLock);
+                for (std::vector<Extent>::const_iterator ext = entry->mExtents.begin(); ext != entry->mExtents.end(); ++ext) {
+                    PackMap::iterator pack = mPacks.find(ext->pack);
+                    if (pack == mPacks.end()) {
+                        haveData = false;
+                        break;
+                    }
+                    DenseDataPtr view(new DenseData(ext->range,
+                            pack->second->base + ext->offset + RECORD_HEADER_SIZE,
+                            pack->second->mapping));
+                    foundData.addValidData(view);
+                }
+            }
+        }
+    }
+    if (haveData) {
+        for (DenseDataList::iterator iter = foundData.DenseDataList::begin();
+                iter != foundData.DenseDataList::end();
+                ++iter) {
+            CacheLayer::populateParentCaches(fileId, iter.getPtr());
+        }
+        callback(&foundData);
+    } else {
+        CacheLayer::getData(fileId, requestedRange, callback);
+    }
+}
+
+}
+}
+
+#endif
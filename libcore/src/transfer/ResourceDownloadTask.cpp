@@ -50,14 +50,14 @@ ResourceDownloadTaskPtr ResourceDownloadTask::construct(const Chunk& chunk, Tran
 
 ResourceDownloadTask::ResourceDownloadTask(const Transfer::URI &uri, TransferPoolPtr transfer_pool, double priority, DownloadCallback cb)
  : mURI(uri), mChunk(), mTransferPool(transfer_pool),
-   mPriority(priority), cb(cb), mID(uri.toString())
+   mPriority(priority), mDeadline(Time::null()), cb(cb), mID(uri.toString())
 {
   mStarted = false;
 }
 
 ResourceDownloadTask::ResourceDownloadTask(const Chunk& chunk, TransferPoolPtr transfer_pool, double priority, DownloadCallback cb)
  : mURI(), mChunk(chunk), mTransferPool(transfer_pool),
-   mPriority(priority), cb(cb), mID(chunk.toString())
+   mPriority(priority), mDeadline(Time::null()), cb(cb), mID(chunk.toString())
 {
   mStarted = false;
 }
@@ -73,6 +73,11 @@ void ResourceDownloadTask::updatePriority(float64 priority) {
         mTransferPool->updatePriority(mCurrentRequest, priority);
 }
 
+void ResourceDownloadTask::setDeadline(const Time& deadline) {
+    assert(!mStarted);
+    mDeadline = deadline;
+}
+
 void ResourceDownloadTask::cancel() {
     // Delete request and ensure we won't perform the callback even if it's in
     // the process of finishing
@@ -134,6 +139,7 @@ void ResourceDownloadTask::metadataFinished(MetadataRequestPtr request,
     mCurrentRequest = TransferRequestPtr(new Transfer::ChunkRequest(mURI, *response,
             response->getChunkList().front(), mPriority,
             std::tr1::bind(&ResourceDownloadTask::chunkFinishedWeak, getWeakPtr(), _1, _2)));
+    mCurrentRequest->setDeadline(mDeadline);
 
     mTransferPool->addRequest(mCurrentRequest);
   }
@@ -160,6 +166,7 @@ void ResourceDownloadTask::start()
             new MetadataRequest(mURI, mPriority,
                 std::tr1::bind(&ResourceDownloadTask::metadataFinishedWeak, getWeakPtr(), _1, _2)));
     }
+    mCurrentRequest->setDeadline(mDeadline);
 
     mTransferPool->addRequest(mCurrentRequest);
 }
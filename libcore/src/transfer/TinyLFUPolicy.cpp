@@ -0,0 +1,119 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/transfer/TinyLFUPolicy.hpp>
+
+namespace Sirikata {
+namespace Transfer {
+
+// The space accounting is all done by the wrapped policy, so this one's is left
+// unused.
+TinyLFUPolicy::TinyLFUPolicy(CachePolicy *inner, uint32 expectedEntries)
+ : CachePolicy(0, 0),
+   mInner(inner),
+   mSamples(0)
+{
+    uint32 width = 64;
+    while (width < expectedEntries && width < (1u << 24))
+        width <<= 1;
+    for(uint32 row = 0; row < SKETCH_DEPTH; row++)
+        mSketch[row].resize(width, 0);
+    mSketchMask = width - 1;
+    mSampleSize = width * 10;
+}
+
+TinyLFUPolicy::~TinyLFUPolicy() {
+    delete mInner;
+}
+
+uint32 TinyLFUPolicy::index(const Fingerprint &id, uint32 row) const {
+    // Fingerprints are already uniformly distributed, so each row just uses
+    // different bytes of it. The first few bytes are used by hash tables, so
+    // start after those.
+    const Fingerprint::Digest &digest = id.rawData();
+    uint32 offset = 12 + row * 4;
+    uint32 val =
+        ((uint32)digest[offset] << 24) |
+        ((uint32)digest[offset+1] << 16) |
+        ((uint32)digest[offset+2] << 8) |
+        ((uint32)digest[offset+3]);
+    return val & mSketchMask;
+}
+
+uint32 TinyLFUPolicy::frequency(const Fingerprint &id) const {
+    uint32 result = MAX_COUNT;
+    for(uint32 row = 0; row < SKETCH_DEPTH; row++)
+        result = std::min(result, (uint32)mSketch[row][index(id, row)]);
+    return result;
+}
+
+void TinyLFUPolicy::record(const Fingerprint &id) {
+    // Conservative update: only the smallest counters need to grow for the
+    // estimate to grow, which keeps the others from drifting upwards.
+    uint32 current = frequency(id);
+    if (current < MAX_COUNT) {
+        for(uint32 row = 0; row < SKETCH_DEPTH; row++) {
+            uint8 &counter = mSketch[row][index(id, row)];
+            if (counter == current)
+                counter++;
+        }
+    }
+
+    if (++mSamples >= mSampleSize)
+        age();
+}
+
+void TinyLFUPolicy::age() {
+    for(uint32 row = 0; row < SKETCH_DEPTH; row++) {
+        std::vector<uint8> &counters = mSketch[row];
+        for(uint32 i = 0; i < counters.size(); i++)
+            counters[i] >>= 1;
+    }
+    mSamples /= 2;
+}
+
+void TinyLFUPolicy::use(const Fingerprint &id, Data* data, cache_usize_type size) {
+    record(id);
+    mInner->use(id, data, size);
+}
+
+void TinyLFUPolicy::useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize) {
+    record(id);
+    mInner->useAndUpdate(id, data, oldsize, newsize);
+}
+
+void TinyLFUPolicy::destroy(const Fingerprint &id, Data* data, cache_usize_type size) {
+    mInner->destroy(id, data, size);
+}
+
+CachePolicy::Data* TinyLFUPolicy::create(const Fingerprint &id, cache_usize_type size) {
+    // The request was already recorded when it was admitted
+    return mInner->create(id, size);
+}
+
+bool TinyLFUPolicy::cachable(cache_usize_type requiredSpace) {
+    return mInner->cachable(requiredSpace);
+}
+
+bool TinyLFUPolicy::admit(const Fingerprint &id, cache_usize_type requiredSpace) {
+    record(id);
+    if (!mInner->admit(id, requiredSpace))
+        return false;
+
+    Fingerprint victim;
+    if (!mInner->nextItem(requiredSpace, victim))
+        return true;
+    bool admitted = frequency(id) > frequency(victim);
+    if (!admitted)
+        SILOG(transfer,insane,"[TinyLFUPolicy] Not admitting " << id << " in place of more popular " << victim);
+    return admitted;
+}
+
+bool TinyLFUPolicy::nextItem(cache_usize_type requiredSpace, Fingerprint &myprint) {
+    return mInner->nextItem(requiredSpace, myprint);
+}
+
+}
+}
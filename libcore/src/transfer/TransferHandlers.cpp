@@ -1,4 +1,9 @@
 #include <sirikata/core/transfer/TransferHandlers.hpp>
+#include <sirikata/core/transfer/SegmentedLRUPolicy.hpp>
+#include <sirikata/core/transfer/ClockProPolicy.hpp>
+#include <sirikata/core/transfer/TinyLFUPolicy.hpp>
+#include <sirikata/core/transfer/PackedDiskCacheLayer.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
 
 AUTO_SINGLETON_INSTANCE(Sirikata::Transfer::SharedChunkCache);
 
@@ -14,13 +19,49 @@ void SharedChunkCache::destroy() {
 const unsigned int SharedChunkCache::DISK_LRU_CACHE_SIZE = 1024 * 1024 * 1024; //1GB
 const unsigned int SharedChunkCache::MEMORY_LRU_CACHE_SIZE = 1024 * 1024 * 50; //50MB
 
+namespace {
+// Only used to size the TinyLFU sketch, so it just needs to be about right
+const unsigned int TYPICAL_CHUNK_SIZE = 1024 * 64;
+
+CachePolicy* createCachePolicy(cache_usize_type size) {
+    String policy_type = GetOptionValue<String>(OPT_CDN_CACHE_POLICY);
+    CachePolicy* policy = NULL;
+    if (policy_type == "slru")
+        policy = new SegmentedLRUPolicy(size);
+    else if (policy_type == "clock-pro")
+        policy = new ClockProPolicy(size);
+    else {
+        if (policy_type != "lru")
+            SILOG(transfer,error,"Unknown cache policy " << policy_type << ", using LRU");
+        policy = new LRUPolicy(size);
+    }
+
+    String admission_type = GetOptionValue<String>(OPT_CDN_CACHE_ADMISSION);
+    if (admission_type == "tinylfu")
+        policy = new TinyLFUPolicy(policy, size / TYPICAL_CHUNK_SIZE);
+    else if (admission_type != "none")
+        SILOG(transfer,error,"Unknown cache admission policy " << admission_type << ", admitting everything");
+
+    return policy;
+}
+}
+
 SharedChunkCache::SharedChunkCache() {
-    //Use LRU for eviction
-    mDiskCachePolicy = new LRUPolicy(DISK_LRU_CACHE_SIZE);
-    mMemoryCachePolicy = new LRUPolicy(MEMORY_LRU_CACHE_SIZE);
+    mDiskCachePolicy = createCachePolicy(DISK_LRU_CACHE_SIZE);
+    mMemoryCachePolicy = createCachePolicy(MEMORY_LRU_CACHE_SIZE);
 
     //Make a disk cache as the bottom cache layer
-    CacheLayer* diskCache = new DiskCacheLayer(mDiskCachePolicy, "HttpChunkHandlerCache", NULL);
+    CacheLayer* diskCache = NULL;
+    String disk_type = GetOptionValue<String>(OPT_CDN_DISK_CACHE);
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+    if (disk_type == "packed")
+        diskCache = new PackedDiskCacheLayer(mDiskCachePolicy, "HttpChunkHandlerPackCache", NULL);
+#endif
+    if (diskCache == NULL) {
+        if (disk_type != "files")
+            SILOG(transfer,error,"Unsupported disk cache " << disk_type << ", using files");
+        diskCache = new DiskCacheLayer(mDiskCachePolicy, "HttpChunkHandlerCache", NULL);
+    }
     mCacheLayers.push_back(diskCache);
 
     //Make a mem cache on top of the disk cache
@@ -38,7 +79,7 @@ SharedChunkCache::~SharedChunkCache() {
     }
     mCacheLayers.clear();
 
-    //And delete LRU cache policies
+    //And delete cache policies
     delete mDiskCachePolicy;
     delete mMemoryCachePolicy;
 }
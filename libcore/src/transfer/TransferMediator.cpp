@@ -3,6 +3,7 @@
 #include <sirikata/core/transfer/TransferMediator.hpp>
 #include <sirikata/core/transfer/MaxPriorityAggregation.hpp>
 #include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
 #include <stdio.h>
 
 using namespace std;
@@ -29,28 +30,54 @@ void TransferMediator::destroy() {
 
 TransferMediator::TransferMediator() {
     mCleanup = false;
-    mNumOutstanding = 0;
-    mAggregationAlgorithm = new MaxPriorityAggregation();
+    mScheduleNeeded = false;
+
+    TransferScheduler::Params params;
+    params.maxOutstanding = std::max(GetOptionValue<uint32>(OPT_TRANSFER_OUTSTANDING), (uint32)1);
+    params.reservedSlots = GetOptionValue<uint32>(OPT_TRANSFER_RESERVED);
+    params.deadlineHorizon = GetOptionValue<Duration>(OPT_TRANSFER_DEADLINE_HORIZON);
+    params.sourceBandwidth = GetOptionValue<uint32>(OPT_TRANSFER_SOURCE_BANDWIDTH);
+    mScheduler = new TransferScheduler(params, new MaxPriorityAggregation());
+
+    uint32 nthreads = std::max(GetOptionValue<uint32>(OPT_TRANSFER_DISPATCH_THREADS), (uint32)1);
+    for(uint32 i = 0; i < nthreads; i++)
+        mDispatchThreads.push_back(new Thread("TransferMediator Dispatch", std::tr1::bind(&TransferMediator::dispatchThread, this)));
+
     mThread = new Thread("TransferMediator", std::tr1::bind(&TransferMediator::mediatorThread, this));
 }
 
 TransferMediator::~TransferMediator() {
-    delete mAggregationAlgorithm;
+    delete mScheduler;
 }
 
 void TransferMediator::mediatorThread() {
     while(!mCleanup) {
-        checkQueue();
-
-        /**
-           Ewen and I weren't able to identify why the below call caused a
-           deadlock on the shared space hosted on sns30 (could not reproduce on
-           other machines).  With the below line, in gdb, with bulletphysics on,
-           and servermap-options set to port 6880, we'd get 4 calls to
-           checkQueue, followed by no follow up calls.  Not sure what to say.
-         */
-        //boost::this_thread::sleep(boost::posix_time::milliseconds(5));
-        Timer::sleep(Duration::milliseconds(5));
+        TransferScheduler::AggregateRequestList toStart;
+        std::vector<TransferRequestPtr> reqs;
+        {
+            boost::unique_lock<boost::mutex> lock(mAggMutex);
+            mScheduleNeeded = false;
+            Time now = Timer::now();
+            mScheduler->schedule(now, toStart);
+            for(uint32 i = 0; i < toStart.size(); i++)
+                reqs.push_back(toStart[i]->getSingleRequest());
+
+            // Wait until something changes, or until the scheduler can start
+            // something it couldn't yet. The wait is bounded so shutdown is
+            // noticed.
+            if (toStart.empty() && !mScheduleNeeded && !mCleanup) {
+                Duration wait = Duration::milliseconds((int64)100);
+                Time wakeup = mScheduler->nextWakeup(now);
+                if (wakeup != Time::null())
+                    wait = std::max(std::min(wait, wakeup - now), Duration::milliseconds((int64)1));
+                mScheduleCV.timed_wait(lock, boost::posix_time::microseconds(wait.toMicro()));
+            }
+        }
+
+        for(uint32 i = 0; i < toStart.size(); i++) {
+            SILOG(transfer, detailed, "Starting " << toStart[i]->getIdentifier() << " with priority " << toStart[i]->getPriority());
+            mDispatchQueue.push(Dispatch(toStart[i], reqs[i]));
+        }
     }
     for(PoolType::iterator pool = mPools.begin(); pool != mPools.end(); pool++) {
         pool->second->cleanup();
@@ -59,6 +86,30 @@ void TransferMediator::mediatorThread() {
     for(PoolType::iterator pool = mPools.begin(); pool != mPools.end(); pool++) {
         pool->second->getThread()->join();
     }
+
+    for(uint32 i = 0; i < mDispatchThreads.size(); i++)
+        mDispatchQueue.push(Dispatch());
+    for(uint32 i = 0; i < mDispatchThreads.size(); i++) {
+        mDispatchThreads[i]->join();
+        delete mDispatchThreads[i];
+    }
+    mDispatchThreads.clear();
+}
+
+void TransferMediator::dispatchThread() {
+    while(true) {
+        Dispatch next;
+        mDispatchQueue.blockingPop(next);
+        if (!next.first)
+            break;
+
+        TransferRequestPtr req = next.second;
+        req->execute(
+            req,
+            std::tr1::bind(&TransferMediator::execute_finished, this,
+                req, next.first)
+        );
+    }
 }
 
 void TransferMediator::registerPool(TransferPoolPtr pool) {
@@ -75,128 +126,39 @@ void TransferMediator::registerPool(TransferPoolPtr pool) {
 }
 
 void TransferMediator::cleanup() {
-    mCleanup = true;
+    {
+        boost::unique_lock<boost::mutex> lock(mAggMutex);
+        mCleanup = true;
+        mScheduleCV.notify_one();
+    }
     mThread->join();
 }
 
-void TransferMediator::execute_finished(std::tr1::shared_ptr<TransferRequest> req, std::string id) {
-    boost::unique_lock<boost::mutex> lock(mAggMutex, boost::defer_lock_t());
-    lock.lock();
-
-    AggregateListByID& idIndex = mAggregateList.get<tagID>();
-    AggregateListByID::iterator findID = idIndex.find(id);
-    if(findID == idIndex.end()) {
-        //This can happen now if a request was canceled but it was already outstanding
-        mNumOutstanding--;
-        lock.unlock();
-        checkQueue();
-        return;
+void TransferMediator::execute_finished(std::tr1::shared_ptr<TransferRequest> req, AggregateRequestPtr agg) {
+    std::vector<TransferRequestPtr> clients;
+    {
+        boost::unique_lock<boost::mutex> lock(mAggMutex);
+        //This fails if a request was canceled but it was already outstanding
+        if (!mScheduler->finished(agg, clients))
+            SILOG(transfer, detailed, "Dropping result of cancelled request " << agg->getIdentifier());
+        mScheduleNeeded = true;
+        mScheduleCV.notify_one();
     }
 
-    const std::map<std::string, std::tr1::shared_ptr<TransferRequest> >&
-        allReqs = (*findID)->getTransferRequests();
-
-    for(std::map<std::string, std::tr1::shared_ptr<TransferRequest> >::const_iterator
-            it = allReqs.begin(); it != allReqs.end(); it++) {
+    for(std::vector<TransferRequestPtr>::iterator it = clients.begin(); it != clients.end(); it++) {
         SILOG(transfer, detailed, "Notifying a caller that TransferRequest is complete");
-        it->second->notifyCaller(it->second, req);
+        (*it)->notifyCaller(*it, req);
     }
-
-    mAggregateList.erase(findID);
-
-    mNumOutstanding--;
-    lock.unlock();
     SILOG(transfer, detailed, "done transfer mediator execute_finished");
-    checkQueue();
-}
-
-void TransferMediator::checkQueue() {
-    boost::unique_lock<boost::mutex> lock(mAggMutex, boost::defer_lock_t());
-
-    lock.lock();
-
-    AggregateListByPriority & priorityIndex = mAggregateList.get<tagPriority>();
-    AggregateListByPriority::iterator findTop = priorityIndex.begin();
-
-    if(findTop != priorityIndex.end()) {
-        std::string topId = (*findTop)->getIdentifier();
-        SILOG(transfer, detailed, priorityIndex.size() << " length agg list, top priority "
-                << (*findTop)->getPriority() << " id " << topId);
-    }
-
-    // While we have free slots and there are items left, scan for items that
-    // haven't been started yet that we can process.
-    while(findTop != priorityIndex.end() && mNumOutstanding < 10) {
-        if (!(*findTop)->mExecuting) {
-            mNumOutstanding++;
-            (*findTop)->mExecuting = true;
-            std::tr1::shared_ptr<TransferRequest> req = (*findTop)->getSingleRequest();
-            req->execute(
-                req,
-                std::tr1::bind(&TransferMediator::execute_finished, this,
-                    req, (*findTop)->getIdentifier())
-            );
-        }
-        findTop++;
-    }
-
-    lock.unlock();
-}
-
-
-/*
- * TransferMediator::AggregateRequest definitions
- */
-
-void TransferMediator::AggregateRequest::updateAggregatePriority() {
-    Priority newPriority = TransferMediator::getSingleton().mAggregationAlgorithm->aggregate(mTransferReqs);
-    mPriority = newPriority;
-}
-
-const std::map<std::string, std::tr1::shared_ptr<TransferRequest> >& TransferMediator::AggregateRequest::getTransferRequests() const {
-    return mTransferReqs;
-}
-
-std::tr1::shared_ptr<TransferRequest> TransferMediator::AggregateRequest::getSingleRequest() {
-    std::map<std::string, std::tr1::shared_ptr<TransferRequest> >::iterator it = mTransferReqs.begin();
-    return it->second;
 }
 
-void TransferMediator::AggregateRequest::setClientPriority(std::tr1::shared_ptr<TransferRequest> req) {
-    const std::string& clientID = req->getClientID();
-    std::map<std::string, std::tr1::shared_ptr<TransferRequest> >::iterator findClient = mTransferReqs.find(clientID);
-    if(findClient == mTransferReqs.end()) {
-        mTransferReqs[clientID] = req;
-        updateAggregatePriority();
-    } else if(findClient->second->getPriority() != req->getPriority()) {
-        findClient->second = req;
-        updateAggregatePriority();
-    } else {
-        findClient->second = req;
-    }
-}
-
-void TransferMediator::AggregateRequest::removeClient(std::string clientID) {
-    std::map<std::string, std::tr1::shared_ptr<TransferRequest> >::iterator findClient = mTransferReqs.find(clientID);
-    if(findClient != mTransferReqs.end()) {
-        mTransferReqs.erase(findClient);
-    }
-}
-
-const std::string& TransferMediator::AggregateRequest::getIdentifier() const {
-    return mIdentifier;
-}
-
-Priority TransferMediator::AggregateRequest::getPriority() const {
-    return mPriority;
+void TransferMediator::updateRequest(std::tr1::shared_ptr<TransferRequest> req) {
+    boost::unique_lock<boost::mutex> lock(mAggMutex);
+    mScheduler->update(req);
+    mScheduleNeeded = true;
+    mScheduleCV.notify_one();
 }
 
-TransferMediator::AggregateRequest::AggregateRequest(std::tr1::shared_ptr<TransferRequest> req)
- : mIdentifier(req->getIdentifier()),
-   mExecuting(false)
-{
-    setClientPriority(req);
-}
 
 /*
  * TransferMediator::PoolWorker definitions
@@ -227,62 +189,7 @@ void TransferMediator::PoolWorker::run() {
         }
         //SILOG(transfer, debug, "worker got one!");
 
-        boost::unique_lock<boost::mutex> lock(TransferMediator::getSingleton().mAggMutex);
-        AggregateListByID& idIndex = TransferMediator::getSingleton().mAggregateList.get<tagID>();
-        AggregateListByID::iterator findID = idIndex.find(req->getIdentifier());
-
-        //Check if this request already exists
-        if(findID != idIndex.end()) {
-            //Check if this request is for deleting
-            if(req->isDeletionRequest()) {
-                const std::map<std::string, std::tr1::shared_ptr<TransferRequest> >&
-                    allReqs = (*findID)->getTransferRequests();
-
-                std::map<std::string,
-                    std::tr1::shared_ptr<TransferRequest> >::const_iterator findClient =
-                    allReqs.find(req->getClientID());
-
-                /* If the client isn't in the aggregated request, it must have already
-                 * been deleted, or the deletion request is invalid
-                 */
-                if(findClient == allReqs.end()) {
-                    continue;
-                }
-
-                if(allReqs.size() > 1) {
-                    /* If there are more than one, we need to just delete the single client
-                     * from the aggregate request
-                     */
-                    (*findID)->removeClient(req->getClientID());
-                } else {
-                    // If only one in the list, we can erase the entire request
-                    TransferMediator::getSingleton().mAggregateList.erase(findID);
-                }
-            } else {
-                //store original aggregated priority for later
-                Priority oldAggPriority = (*findID)->getPriority();
-
-                //Update the priority of this client
-                (*findID)->setClientPriority(req);
-
-                //And check if it's changed, we need to update the index
-                Priority newAggPriority = (*findID)->getPriority();
-                if(oldAggPriority != newAggPriority) {
-                    //Convert the iterator to the priority one and update
-                    AggregateListByPriority::iterator byPriority =
-                            TransferMediator::getSingleton().mAggregateList.project<tagPriority>(findID);
-                    AggregateListByPriority & priorityIndex =
-                            TransferMediator::getSingleton().mAggregateList.get<tagPriority>();
-                    priorityIndex.modify_key(byPriority, boost::lambda::_1=newAggPriority);
-                }
-            }
-        } else {
-            //Make a new one and insert it
-            //SILOG(transfer, debug, "worker id " << mTransferPool->getClientID() << " adding url " << req->getIdentifier());
-            std::tr1::shared_ptr<AggregateRequest> newAggReq(new AggregateRequest(req));
-            TransferMediator::getSingleton().mAggregateList.insert(newAggReq);
-        }
-
+        TransferMediator::getSingleton().updateRequest(req);
     }
 }
 
@@ -301,11 +208,13 @@ void TransferMediator::commandListRequests(const Command::Command& cmd, Command:
     Command::Array& requests_ary = result.getArray("requests");
 
     boost::unique_lock<boost::mutex> lock(mAggMutex);
-    AggregateListByPriority& priorityIndex = mAggregateList.get<tagPriority>();
-    for(AggregateListByPriority::iterator req_it = priorityIndex.begin(); req_it != priorityIndex.end(); req_it++) {
+    TransferScheduler::AggregateRequestList requests;
+    mScheduler->getRequests(requests);
+    for(TransferScheduler::AggregateRequestList::iterator req_it = requests.begin(); req_it != requests.end(); req_it++) {
         requests_ary.push_back(Command::Object());
         requests_ary.back().put("id", (*req_it)->getIdentifier());
         requests_ary.back().put("priority", (*req_it)->getPriority());
+        requests_ary.back().put("executing", (*req_it)->mExecuting);
     }
 
     cmdr->result(cmdid, result);
@@ -7,10 +7,30 @@
 #include <sirikata/core/transfer/FileTransferHandler.hpp>
 #include <sirikata/core/transfer/HttpTransferHandler.hpp>
 #include <sirikata/core/transfer/DataTransferHandler.hpp>
+#include <sirikata/core/transfer/URL.hpp>
 
 namespace Sirikata {
 namespace Transfer {
 
+namespace {
+// Requests are limited per scheme and host. Local data isn't limited.
+String sourceOf(const URI& uri) {
+    if (uri.scheme() == "data" || uri.scheme() == "file")
+        return String();
+    return uri.scheme() + "://" + URL(uri).hostname();
+}
+
+uint64 rangeSize(const Range& range, uint64 fileSize) {
+    if (range.goesToEndOfFile())
+        return fileSize > (uint64)range.startbyte() ? fileSize - range.startbyte() : 0;
+    return range.length();
+}
+}
+
+String MetadataRequest::getSource() const {
+    return sourceOf(mURI);
+}
+
 void MetadataRequest::execute(std::tr1::shared_ptr<TransferRequest> req, ExecuteFinished cb) {
     std::tr1::shared_ptr<MetadataRequest> casted =
       std::tr1::static_pointer_cast<MetadataRequest, TransferRequest>(req);
@@ -57,6 +77,14 @@ void ChunkRequest::execute(std::tr1::shared_ptr<TransferRequest> req, ExecuteFin
     }
 }
 
+String ChunkRequest::getSource() const {
+    return sourceOf(mMetadata->getURI());
+}
+
+uint64 ChunkRequest::getTransferSize() const {
+    return rangeSize(mChunk->getRange(), mMetadata->getSize());
+}
+
 void ChunkRequest::execute_finished(std::tr1::shared_ptr<const DenseData> response, ExecuteFinished cb) {
     SILOG(transfer, detailed, "execute_finished in ChunkRequest called");
     mDenseData = response;
@@ -109,6 +137,15 @@ void DirectChunkRequest::execute(std::tr1::shared_ptr<TransferRequest> req, Exec
             std::tr1::bind(&DirectChunkRequest::execute_finished, this, _1, cb));
 }
 
+String DirectChunkRequest::getSource() const {
+    // Always fetched from the CDN
+    return "meerkat://";
+}
+
+uint64 DirectChunkRequest::getTransferSize() const {
+    return rangeSize(mChunk->getRange(), 0);
+}
+
 void DirectChunkRequest::execute_finished(std::tr1::shared_ptr<const DenseData> response, ExecuteFinished cb) {
     SILOG(transfer, detailed, "execute_finished in DirectChunkRequest called");
     mDenseData = response;
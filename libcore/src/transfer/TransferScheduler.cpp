@@ -0,0 +1,337 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/transfer/TransferScheduler.hpp>
+#include <boost/tuple/tuple.hpp>
+
+namespace Sirikata {
+namespace Transfer {
+
+namespace {
+
+// Applies a client's update to an AggregateRequest, through modify() so the
+// indices keep up with its priority and deadline.
+struct UpdateClient {
+    UpdateClient(TransferRequestPtr r) : req(r) {}
+    void operator()(TransferScheduler::AggregateRequestPtr& agg) const {
+        agg->setClientPriority(req);
+    }
+    TransferRequestPtr req;
+};
+
+struct RemoveClient {
+    RemoveClient(const std::string& id) : clientID(id) {}
+    void operator()(TransferScheduler::AggregateRequestPtr& agg) const {
+        agg->removeClient(clientID);
+    }
+    std::string clientID;
+};
+
+struct MarkExecuting {
+    void operator()(TransferScheduler::AggregateRequestPtr& agg) const {
+        agg->mExecuting = true;
+    }
+};
+
+}
+
+TransferScheduler::Params::Params()
+ : maxOutstanding(10),
+   reservedSlots(3),
+   deadlineHorizon(Duration::milliseconds(250)),
+   sourceBandwidth(0),
+   sourceBurst(0)
+{
+}
+
+TransferScheduler::TransferScheduler(const Params& params, PriorityAggregationAlgorithm* aggregation)
+ : mParams(params),
+   mAggregationAlgorithm(aggregation),
+   mNumOutstanding(0)
+{
+}
+
+TransferScheduler::~TransferScheduler() {
+    delete mAggregationAlgorithm;
+}
+
+void TransferScheduler::update(TransferRequestPtr req) {
+    AggregateListByID& idIndex = mAggregateList.get<tagID>();
+    AggregateListByID::iterator findID = idIndex.find(req->getIdentifier());
+
+    if(findID == idIndex.end()) {
+        // Deleting something which already finished
+        if(req->isDeletionRequest())
+            return;
+        //Make a new one and insert it
+        mAggregateList.insert(AggregateRequestPtr(new AggregateRequest(req, mAggregationAlgorithm)));
+        return;
+    }
+
+    if(!req->isDeletionRequest()) {
+        //Update the priority of this client, which may reorder it
+        idIndex.modify(findID, UpdateClient(req));
+        return;
+    }
+
+    const std::map<std::string, TransferRequestPtr>& allReqs = (*findID)->getTransferRequests();
+    /* If the client isn't in the aggregated request, it must have already
+     * been deleted, or the deletion request is invalid
+     */
+    if(allReqs.find(req->getClientID()) == allReqs.end())
+        return;
+
+    if(allReqs.size() > 1) {
+        /* If there are more than one, we need to just delete the single client
+         * from the aggregate request
+         */
+        idIndex.modify(findID, RemoveClient(req->getClientID()));
+        return;
+    }
+
+    // If only one in the list, we can erase the entire request. If it's
+    // already executing nobody wants the result any more, but the fetch can't
+    // be interrupted, so it keeps its slot until it finishes.
+    if((*findID)->mExecuting) {
+        (*findID)->mCancelled = true;
+        mStats.cancelled++;
+        SILOG(transfer, detailed, "[TransferScheduler] Cancelled executing request " << req->getIdentifier());
+    }
+    idIndex.erase(findID);
+}
+
+bool TransferScheduler::chargeSource(const TransferRequestPtr& req, const Time& now) {
+    if (mParams.sourceBandwidth == 0)
+        return true;
+    String source = req->getSource();
+    if (source.empty())
+        return true;
+
+    double burst = (double)std::max(mParams.sourceBurst, mParams.sourceBandwidth);
+    SourceBudgetMap::iterator it = mSourceBudgets.find(source);
+    if (it == mSourceBudgets.end()) {
+        SourceBudget budget;
+        budget.tokens = burst;
+        budget.lastRefill = now;
+        it = mSourceBudgets.insert(SourceBudgetMap::value_type(source, budget)).first;
+    }
+    else if (now > it->second.lastRefill) {
+        it->second.tokens = std::min(burst,
+            it->second.tokens + (now - it->second.lastRefill).toSeconds() * mParams.sourceBandwidth);
+        it->second.lastRefill = now;
+    }
+
+    // Requests can take the budget negative, which then has to be paid back
+    // before the source can start anything else. That way requests bigger
+    // than the burst size still get started.
+    if (it->second.tokens <= 0) {
+        mStats.throttled++;
+        return false;
+    }
+    it->second.tokens -= req->getTransferSize();
+    return true;
+}
+
+void TransferScheduler::start(AggregateRequestPtr agg, AggregateRequestList& toStart) {
+    mAggregateList.get<tagID>().modify(mAggregateList.get<tagID>().find(agg->getIdentifier()), MarkExecuting());
+    mNumOutstanding++;
+    mStats.started++;
+    toStart.push_back(agg);
+}
+
+bool TransferScheduler::lowestExecutingPriority(Priority* lowest) const {
+    // Executing requests are at the end of the priority index, lowest last
+    const AggregateListByPriority& priorityIndex = mAggregateList.get<tagPriority>();
+    if (priorityIndex.empty() || !(*priorityIndex.rbegin())->mExecuting)
+        return false;
+    *lowest = (*priorityIndex.rbegin())->getPriority();
+    return true;
+}
+
+void TransferScheduler::schedule(const Time& now, AggregateRequestList& toStart) {
+    uint32 reserved = std::min(mParams.reservedSlots, mParams.maxOutstanding - 1);
+    uint32 regularSlots = mParams.maxOutstanding - reserved;
+
+    // Requests which are due go first, earliest deadline first
+    Time horizon = now + mParams.deadlineHorizon;
+    AggregateListByDeadline& deadlineIndex = mAggregateList.get<tagDeadline>();
+    AggregateListByDeadline::iterator due = deadlineIndex.begin();
+    while(due != deadlineIndex.end() && mNumOutstanding < mParams.maxOutstanding) {
+        AggregateRequestPtr agg = *due;
+        if (agg->mExecuting || agg->mDeadline == Time::null() || agg->mDeadline > horizon)
+            break;
+        // Starting it moves it in the index
+        due++;
+        if (!chargeSource(agg->getSingleRequest(), now))
+            continue;
+        if (mNumOutstanding >= regularSlots)
+            mStats.startedInReservedSlot++;
+        mStats.startedForDeadline++;
+        start(agg, toStart);
+    }
+
+    // Then everything else by priority. Only requests more important than
+    // everything executing can use the reserved slots.
+    Priority lowest = 0;
+    bool anyExecuting = lowestExecutingPriority(&lowest);
+    AggregateListByPriority& priorityIndex = mAggregateList.get<tagPriority>();
+    AggregateListByPriority::iterator next = priorityIndex.begin();
+    while(next != priorityIndex.end() && mNumOutstanding < mParams.maxOutstanding) {
+        AggregateRequestPtr agg = *next;
+        if (agg->mExecuting)
+            break;
+        bool important = anyExecuting && agg->getPriority() > lowest;
+        // Everything after this is lower priority, so can't be important
+        // either
+        if (mNumOutstanding >= regularSlots && !important)
+            break;
+        next++;
+        if (!chargeSource(agg->getSingleRequest(), now))
+            continue;
+        if (mNumOutstanding >= regularSlots)
+            mStats.startedInReservedSlot++;
+        start(agg, toStart);
+        if (!anyExecuting || agg->getPriority() < lowest) {
+            lowest = agg->getPriority();
+            anyExecuting = true;
+        }
+    }
+}
+
+bool TransferScheduler::finished(const AggregateRequestPtr& agg, std::vector<TransferRequestPtr>& clients) {
+    if (agg->mCancelled) {
+        mNumOutstanding--;
+        return false;
+    }
+
+    AggregateListByID& idIndex = mAggregateList.get<tagID>();
+    AggregateListByID::iterator findID = idIndex.find(agg->getIdentifier());
+    if (findID == idIndex.end() || *findID != agg)
+        return false;
+
+    const std::map<std::string, TransferRequestPtr>& allReqs = agg->getTransferRequests();
+    for(std::map<std::string, TransferRequestPtr>::const_iterator it = allReqs.begin(); it != allReqs.end(); it++)
+        clients.push_back(it->second);
+
+    idIndex.erase(findID);
+    mNumOutstanding--;
+    return true;
+}
+
+Time TransferScheduler::nextWakeup(const Time& now) {
+    Time result = Time::null();
+
+    // When the next deadline comes within the horizon
+    AggregateListByDeadline& deadlineIndex = mAggregateList.get<tagDeadline>();
+    if (!deadlineIndex.empty()) {
+        const AggregateRequestPtr& first = *deadlineIndex.begin();
+        if (!first->mExecuting && first->mDeadline != Time::null())
+            result = first->mDeadline - mParams.deadlineHorizon;
+    }
+
+    // When sources which are out of budget can start something again. Only
+    // worth waking up for if something is waiting.
+    if (mParams.sourceBandwidth != 0 && mNumOutstanding < mAggregateList.size()) {
+        for(SourceBudgetMap::iterator it = mSourceBudgets.begin(); it != mSourceBudgets.end(); ) {
+            if (it->second.tokens > 0) {
+                // Sources which have recovered are the same as ones never
+                // used, so they can be dropped
+                double recovered = it->second.tokens + (now - it->second.lastRefill).toSeconds() * mParams.sourceBandwidth;
+                if (recovered >= std::max(mParams.sourceBurst, mParams.sourceBandwidth))
+                    mSourceBudgets.erase(it++);
+                else
+                    it++;
+                continue;
+            }
+            Time refilled = it->second.lastRefill +
+                Duration::seconds((-it->second.tokens + 1) / (double)mParams.sourceBandwidth);
+            if (result == Time::null() || refilled < result)
+                result = refilled;
+            it++;
+        }
+    }
+
+    return result;
+}
+
+void TransferScheduler::getRequests(AggregateRequestList& requests) const {
+    const AggregateListByPriority& priorityIndex = mAggregateList.get<tagPriority>();
+    requests.insert(requests.end(), priorityIndex.begin(), priorityIndex.end());
+}
+
+
+/*
+ * TransferScheduler::AggregateRequest definitions
+ */
+
+void TransferScheduler::AggregateRequest::updateAggregate() {
+    mPriority = mAggregationAlgorithm->aggregate(mTransferReqs);
+
+    mDeadline = Time::null();
+    for(std::map<std::string, TransferRequestPtr>::iterator it = mTransferReqs.begin(); it != mTransferReqs.end(); it++) {
+        const Time& deadline = it->second->getDeadline();
+        if (deadline != Time::null() && (mDeadline == Time::null() || deadline < mDeadline))
+            mDeadline = deadline;
+    }
+}
+
+const std::map<std::string, TransferRequestPtr>& TransferScheduler::AggregateRequest::getTransferRequests() const {
+    return mTransferReqs;
+}
+
+TransferRequestPtr TransferScheduler::AggregateRequest::getSingleRequest() {
+    std::map<std::string, TransferRequestPtr>::iterator it = mTransferReqs.begin();
+    return it->second;
+}
+
+void TransferScheduler::AggregateRequest::setClientPriority(TransferRequestPtr req) {
+    const std::string& clientID = req->getClientID();
+    std::map<std::string, TransferRequestPtr>::iterator findClient = mTransferReqs.find(clientID);
+    if(findClient == mTransferReqs.end()) {
+        mTransferReqs[clientID] = req;
+        updateAggregate();
+    } else if(findClient->second->getPriority() != req->getPriority() ||
+        findClient->second->getDeadline() != req->getDeadline()) {
+        findClient->second = req;
+        updateAggregate();
+    } else {
+        findClient->second = req;
+    }
+}
+
+void TransferScheduler::AggregateRequest::removeClient(const std::string& clientID) {
+    std::map<std::string, TransferRequestPtr>::iterator findClient = mTransferReqs.find(clientID);
+    if(findClient != mTransferReqs.end()) {
+        mTransferReqs.erase(findClient);
+        updateAggregate();
+    }
+}
+
+const std::string& TransferScheduler::AggregateRequest::getIdentifier() const {
+    return mIdentifier;
+}
+
+Priority TransferScheduler::AggregateRequest::getPriority() const {
+    return mPriority;
+}
+
+Time TransferScheduler::AggregateRequest::deadlineKey() const {
+    if (mDeadline == Time::null())
+        return Time::microseconds(std::numeric_limits<int64>::max());
+    return mDeadline;
+}
+
+TransferScheduler::AggregateRequest::AggregateRequest(TransferRequestPtr req, const PriorityAggregationAlgorithm* aggregation)
+ : mPriority(0),
+   mExecuting(false),
+   mCancelled(false),
+   mIdentifier(req->getIdentifier()),
+   mAggregationAlgorithm(aggregation)
+{
+    setClientPriority(req);
+}
+
+}
+}
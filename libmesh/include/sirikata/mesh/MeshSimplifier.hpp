@@ -43,42 +43,24 @@
 namespace Sirikata {
 namespace Mesh {
 
+/** Simplifies meshes by repeatedly collapsing the edge whose removal
+ *  introduces the least error, as measured by quadric error metrics, until the
+ *  target number of faces is reached. Faces are counted once per instance of
+ *  their geometry, and edges are collapsed in order of cost across all the
+ *  geometry in the mesh.
+ *
+ *  Each SubMeshGeometry is prepared (and written back out after
+ *  simplification) independently, so that work is split across threads.
+ */
 class SIRIKATA_MESH_EXPORT MeshSimplifier {
-private:
-
-  double invert(Matrix4x4f& inv, const Matrix4x4f& orig);
-
-  typedef struct QSlimStruct {
-    double mCost;
-    int mGeomIdx, mIdx1, mIdx2;
-
-
-    Vector3f mReplacementVector;
-
-    QSlimStruct() {
-      mCost = 1e-15;
-    }
-
-    QSlimStruct(float cost, int i, int idx1, int idx2, Vector3f v) {
-      mCost = cost;
-      mGeomIdx = i;
-      mIdx1 = idx1;
-      mIdx2 = idx2;
-      mReplacementVector = v;
-    }
-
-    bool operator < (const QSlimStruct& qs) const {
-      return mCost > qs.mCost;
-    }
-
-  } QSlimStruct;
-
-
 public:
+  /** \param nthreads number of threads to use, or 0 for one per core */
+  MeshSimplifier(uint32 nthreads = 0);
 
   void simplify(Mesh::MeshdataPtr agg_mesh, int32 numFacesLeft);
 
-
+private:
+  uint32 mNumThreads;
 };
 
 }
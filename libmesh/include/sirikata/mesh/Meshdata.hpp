@@ -55,6 +55,9 @@ struct Meshdata;
 typedef std::tr1::shared_ptr<Meshdata> MeshdataPtr;
 typedef std::tr1::weak_ptr<Meshdata> MeshdataWPtr;
 
+// Acceleration structure for Raytrace, see Raytrace.hpp
+struct RaytraceAccelerator;
+
 /** Represents a skinned animation. A skinned animation is directly associated
  *  with a SubMeshGeometry.
  */
@@ -311,6 +314,7 @@ struct SIRIKATA_MESH_EXPORT Meshdata : public Visual {
     static String sType;
 
   public:
+    Meshdata();
     virtual ~Meshdata();
 
     virtual const String& type() const;
@@ -342,6 +346,18 @@ struct SIRIKATA_MESH_EXPORT Meshdata : public Visual {
     // Joints are tracked as indices of the nodes they are associated with.
     NodeIndexList joints;
 
+    // Incremented by markModified. Data derived from the mesh and cached with
+    // it, like raytraceAccelerator, records the generation it was built from.
+    uint64 generation;
+    // Code which changes the geometry, instances or nodes of a mesh that may
+    // already have been used, e.g. raytraced, must call this afterwards so
+    // cached data derived from it is rebuilt.
+    void markModified() { generation++; }
+
+    // Built on demand by Raytrace and rebuilt when generation
+    // changes. Should only be accessed by the Raytrace functions.
+    std::tr1::shared_ptr<RaytraceAccelerator> raytraceAccelerator;
+
     // Be careful using these methods. Since there are no "parent" links for
     // instance nodes (and even if there were, there could be more than one),
     // these methods cannot correctly compute the transform when instance_nodes
@@ -53,11 +53,44 @@ namespace Mesh {
  *  and ray_dir
  *  \param hit_out the point of collision, if one was found
  *  \returns true if a collision was found, false otherwise
+ *
+ *  Raytracing a Meshdata builds a bounding volume hierarchy for it on first
+ *  use, which is kept with the Meshdata and reused until
+ *  Meshdata::markModified is called.
  */
 SIRIKATA_MESH_FUNCTION_EXPORT bool Raytrace(VisualPtr vis, const Matrix4x4f& vis_xform, const Vector3f& ray_start, const Vector3f& ray_dir, float32* t_out, Vector3f* hit_out);
 SIRIKATA_MESH_FUNCTION_EXPORT bool RaytraceType(MeshdataPtr vis, const Matrix4x4f& vis_xform, const Vector3f& ray_start, const Vector3f& ray_dir, float32* t_out, Vector3f* hit_out);
 SIRIKATA_MESH_FUNCTION_EXPORT bool RaytraceType(BillboardPtr vis, const Matrix4x4f& vis_xform, const Vector3f& ray_start, const Vector3f& ray_dir, float32* t_out, Vector3f* hit_out);
 
+/** Result of tracing one ray with the batched version of Raytrace. */
+struct RaytraceResult {
+    RaytraceResult() : hit(false), t(0) {}
+
+    // Whether the ray hit the mesh. t and point are only valid if it did.
+    bool hit;
+    // The parametric value for the collision
+    float32 t;
+    // The point of collision
+    Vector3f point;
+};
+typedef std::vector<RaytraceResult> RaytraceResultList;
+
+/** Traces a set of rays, as if Raytrace was called for each one. This is
+ *  cheaper than tracing them individually since per-mesh setup is only done
+ *  once.
+ *
+ *  \param vis the mesh to test the rays against
+ *  \parma vis_xform transformation to apply to the mesh
+ *  \param ray_starts the starting positions of the rays to trace
+ *  \param ray_dirs the directions of the rays to trace, must be the same
+ *  length as ray_starts
+ *  \param results_out the result for each ray
+ *  \returns the number of rays that hit the mesh
+ */
+SIRIKATA_MESH_FUNCTION_EXPORT uint32 Raytrace(VisualPtr vis, const Matrix4x4f& vis_xform, const std::vector<Vector3f>& ray_starts, const std::vector<Vector3f>& ray_dirs, RaytraceResultList* results_out);
+SIRIKATA_MESH_FUNCTION_EXPORT uint32 RaytraceType(MeshdataPtr vis, const Matrix4x4f& vis_xform, const std::vector<Vector3f>& ray_starts, const std::vector<Vector3f>& ray_dirs, RaytraceResultList* results_out);
+SIRIKATA_MESH_FUNCTION_EXPORT uint32 RaytraceType(BillboardPtr vis, const Matrix4x4f& vis_xform, const std::vector<Vector3f>& ray_starts, const std::vector<Vector3f>& ray_dirs, RaytraceResultList* results_out);
+
 } // namespace Mesh
 } // namespace Sirikata
 
@@ -32,15 +32,16 @@
 
 #include <sirikata/mesh/MeshSimplifier.hpp>
 
-#include <boost/functional/hash.hpp>
-
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
 #include <sirikata/core/util/Timer.hpp>
-#ifdef _WIN32
-#include <float.h>
-#else
 #include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMPLIFIER_USE_SSE2 1
 #endif
-#include <math.h>
 
 #define SIMPLIFY_LOG(lvl, msg) SILOG(simplify, lvl, msg)
 
@@ -50,798 +51,644 @@ namespace Mesh {
 
 #define SIMPLIFIER_INVALID_VECTOR Vector3f(-1000000,-1000000,-1000000)
 
-class IndexedFaceContainer {
-public:
-
-  bool valid;
-  uint32 idx1;
-  uint32 idx2;
-  uint32 idx3;
+namespace {
 
-  IndexedFaceContainer(uint32 i, uint32 j, uint32 k) :
-    valid(true), idx1(i), idx2(j), idx3(k)
-  {
-  }
+const uint32 NoVertex = (uint32)-1;
 
-};
+/** A symmetric 4x4 quadric error matrix, storing only the upper triangle:
+ *  a00 a01 a02 a03 a11 a12 a13 a22 a23 a33.
+ */
+struct Quadric {
+  float64 q[10];
 
-class FaceContainer {
-public:
-  Vector3f v1;
-  Vector3f v2;
-  Vector3f v3;
-
-  FaceContainer(Vector3f& v1, Vector3f& v2, Vector3f& v3) {
-    this->v1 = v1;
-    this->v2 = v2;
-    this->v3 = v3;
+  void zero() {
+    for (int i = 0; i < 10; i++) q[i] = 0;
   }
 
-  FaceContainer() {
+  // Add w * p p^T for the plane p = (a, b, c, d)
+  void addPlane(float64 a, float64 b, float64 c, float64 d, float64 w) {
+#ifdef SIMPLIFIER_USE_SSE2
+    __m128d wa = _mm_set1_pd(w*a), wb = _mm_set1_pd(w*b), wd = _mm_set1_pd(w*d);
+    __m128d ab = _mm_set_pd(b, a), cd = _mm_set_pd(d, c), bc = _mm_set_pd(c, b);
+    _mm_storeu_pd(q+0, _mm_add_pd(_mm_loadu_pd(q+0), _mm_mul_pd(wa, ab)));
+    _mm_storeu_pd(q+2, _mm_add_pd(_mm_loadu_pd(q+2), _mm_mul_pd(wa, cd)));
+    _mm_storeu_pd(q+4, _mm_add_pd(_mm_loadu_pd(q+4), _mm_mul_pd(wb, bc)));
+    _mm_storeu_pd(q+6, _mm_add_pd(_mm_loadu_pd(q+6), _mm_mul_pd(_mm_set_pd(w*c, w*b), _mm_set_pd(c, d))));
+    _mm_storeu_pd(q+8, _mm_add_pd(_mm_loadu_pd(q+8), _mm_mul_pd(wd, _mm_set_pd(d, c))));
+#else
+    q[0] += w*a*a; q[1] += w*a*b; q[2] += w*a*c; q[3] += w*a*d;
+    q[4] += w*b*b; q[5] += w*b*c; q[6] += w*b*d;
+    q[7] += w*c*c; q[8] += w*c*d;
+    q[9] += w*d*d;
+#endif
   }
 
-  size_t hash() const {
-      size_t seed = 0;
-
-      size_t pos1Hash = v1.hash();
-      size_t pos2Hash = v2.hash();
-      size_t pos3Hash = v3.hash();
-
-      std::vector<size_t> facevecs;      
-      facevecs.push_back(pos1Hash);facevecs.push_back(pos2Hash);facevecs.push_back(pos3Hash);
-      sort(facevecs.begin(), facevecs.end());      
-
-      seed = 0;
-      boost::hash_combine(seed, facevecs[0]);
-      boost::hash_combine(seed, facevecs[1]);
-      boost::hash_combine(seed, facevecs[2]);
-
-      return seed;
+  void add(const Quadric& other) {
+#ifdef SIMPLIFIER_USE_SSE2
+    for (int i = 0; i < 10; i += 2)
+      _mm_storeu_pd(q+i, _mm_add_pd(_mm_loadu_pd(q+i), _mm_loadu_pd(other.q+i)));
+#else
+    for (int i = 0; i < 10; i++) q[i] += other.q[i];
+#endif
   }
 
-  bool operator==(const FaceContainer&other)const {
-    if (v1+v2+v3 != other.v1+other.v2+other.v3) return false;
-
-    //There is a more elegant way to do this, but this is
-    //easier to code and faster.
-    if (v1 == other.v1) {
-       if ((v2==other.v2 && v3==other.v3) ||
-           (v2==other.v3 && v3==other.v2))
-          return true;
-    }
-
-    if (v1 == other.v2) {
-      if ((v2==other.v1 && v3==other.v3) ||
-          (v2==other.v3 && v3==other.v1))
-        return true;
-    }
+  // v^T Q v for v = (x, y, z, 1)
+  float64 evaluate(const Vector3f& v) const {
+    float64 x = v.x, y = v.y, z = v.z;
+    return x*x*q[0] + 2*x*y*q[1] + 2*x*z*q[2] + 2*x*q[3]
+      + y*y*q[4] + 2*y*z*q[5] + 2*y*q[6]
+      + z*z*q[7] + 2*z*q[8]
+      + q[9];
+  }
+};
 
-    if (v1 == other.v3) {
-     if ((v2==other.v1 && v3==other.v2) ||
-         (v2==other.v2 && v3==other.v1))
-       return true;
+/** Everything we track for one SubMeshGeometry while simplifying it. Vertices
+ *  are identified by their index in the geometry's positions. Collapsing a
+ *  vertex into another merges their sets in a union-find structure, and the
+ *  faces around a vertex are those around any vertex in its set, which are
+ *  found by walking a ring of the set's members through the (CSR) lists of
+ *  faces around each original vertex.
+ */
+struct GeometryData {
+  std::vector<Matrix4x4f> transforms;
+
+  // Set if preprocessing changed the geometry, i.e. it needs to be rewritten
+  // even if nothing is collapsed
+  bool changed;
+
+  // Unique, non-degenerate triangles, 3 vertex indices each
+  std::vector<uint32> faces;
+  std::vector<uint8> faceValid;
+
+  // Faces around each vertex. Entries for vertex v are in
+  // vertexFaces[vertexFaceStart[v], vertexFaceStart[v] + vertexFaceCount[v]);
+  // faces are removed from the lists as they're found to be invalid.
+  std::vector<uint32> vertexFaceStart;
+  std::vector<uint32> vertexFaceCount;
+  std::vector<uint32> vertexFaces;
+
+  std::vector<uint32> parent;
+  std::vector<uint32> nextMember;
+
+  std::vector<Quadric> quadrics;
+
+  // Best collapse for each vertex: bestNeighbor is the other end of the edge,
+  // and bestKeep is the one that survives the collapse.
+  std::vector<float64> bestCost;
+  std::vector<uint32> bestNeighbor;
+  std::vector<uint32> bestKeep;
+
+  GeometryData() : changed(false) {}
+
+  uint32 find(uint32 v) {
+    uint32 root = v;
+    while (parent[root] != root) root = parent[root];
+    while (parent[v] != root) {
+      uint32 next = parent[v];
+      parent[v] = root;
+      v = next;
     }
-
-    return false;
+    return root;
   }
-
-  class Hasher{
-  public:
-        size_t operator() (const FaceContainer& g) const {
-            return g.hash();
-        }
-  };
-
 };
 
-
-class GeomContainer {
+/** Binary min-heap of vertex ids that supports changing and removing
+ *  arbitrary entries. Ties are broken by id so results are deterministic.
+ */
+class IndexedHeap {
 public:
-  uint32 geomIdx;
-  uint32 vertexIdx;
-
-  GeomContainer(int g, int v) {
-    geomIdx = g;
-    vertexIdx = v;
+  IndexedHeap(uint32 nids)
+   : mKeys(nids, 0),
+     mPositions(nids, NoVertex)
+  {}
+
+  bool empty() const { return mHeap.empty(); }
+  uint32 top() const { return mHeap[0]; }
+
+  void set(uint32 id, float64 key) {
+    mKeys[id] = key;
+    if (mPositions[id] == NoVertex) {
+      mPositions[id] = mHeap.size();
+      mHeap.push_back(id);
+      siftUp(mPositions[id]);
+    }
+    else {
+      siftUp(mPositions[id]);
+      siftDown(mPositions[id]);
+    }
   }
 
-  GeomContainer() {
-    geomIdx = vertexIdx = 0;
+  void remove(uint32 id) {
+    uint32 pos = mPositions[id];
+    if (pos == NoVertex) return;
+    mPositions[id] = NoVertex;
+    uint32 last = mHeap.back();
+    mHeap.pop_back();
+    if (pos == mHeap.size()) return;
+    mHeap[pos] = last;
+    mPositions[last] = pos;
+    siftUp(pos);
+    siftDown(mPositions[last]);
   }
 
-  size_t hash() const {
-      size_t seed = 0;
-      boost::hash_combine(seed, geomIdx);
-      boost::hash_combine(seed, vertexIdx);
+private:
+  bool less(uint32 a, uint32 b) const {
+    return mKeys[a] < mKeys[b] || (mKeys[a] == mKeys[b] && a < b);
+  }
 
-      return seed;
+  void place(uint32 pos, uint32 id) {
+    mHeap[pos] = id;
+    mPositions[id] = pos;
   }
 
-  bool operator==(const GeomContainer&other)const {
-        return geomIdx==other.geomIdx && vertexIdx==other.vertexIdx;
+  void siftUp(uint32 pos) {
+    uint32 id = mHeap[pos];
+    while (pos > 0) {
+      uint32 parent = (pos - 1) / 2;
+      if (!less(id, mHeap[parent])) break;
+      place(pos, mHeap[parent]);
+      pos = parent;
+    }
+    place(pos, id);
   }
 
-  class Hasher{
-  public:
-        size_t operator() (const GeomContainer& g) const {
-            return g.hash();
-        }
-  };
+  void siftDown(uint32 pos) {
+    uint32 id = mHeap[pos];
+    uint32 size = mHeap.size();
+    while (true) {
+      uint32 child = 2 * pos + 1;
+      if (child >= size) break;
+      if (child + 1 < size && less(mHeap[child + 1], mHeap[child])) child++;
+      if (!less(mHeap[child], id)) break;
+      place(pos, mHeap[child]);
+      pos = child;
+    }
+    place(pos, id);
+  }
 
+  std::vector<float64> mKeys;
+  std::vector<uint32> mPositions;
+  std::vector<uint32> mHeap;
 };
 
-class GeomPairContainer {
-public:
-  uint32 mGeomIdx;
-  uint32 mVertexIdx1;
-  uint32 mVertexIdx2;
-
-  float64 mCost;
-  Vector3f mReplacementVector;
-
-  void init(uint32 g, uint32 v1, uint32 v2) {
-    mGeomIdx = g;
-    mVertexIdx1 = v1;
-    mVertexIdx2 = v2;
-
-    if (mVertexIdx1 > mVertexIdx2) {
-      uint32 temp = mVertexIdx1;
-      mVertexIdx1 = mVertexIdx2;
-      mVertexIdx2 = temp;
-    }
-
-    mCost = 0;
+void parallelForWorker(AtomicValue<uint32>* next, uint32 count, const std::tr1::function<void(uint32)>& f) {
+  while (true) {
+    uint32 i = (*next)++;
+    if (i >= count) break;
+    f(i);
   }
+}
 
-  GeomPairContainer(uint32 g, uint32 v1, uint32 v2) {
-    init(g,v1,v2);
+// Runs f(0)...f(count-1) on up to nthreads threads, including this one.
+void parallelFor(uint32 count, uint32 nthreads, const std::tr1::function<void(uint32)>& f) {
+  AtomicValue<uint32> next(0);
+  std::vector<Thread*> threads;
+  for (uint32 t = 1; t < nthreads && t < count; t++)
+    threads.push_back(new Thread("MeshSimplifier", std::tr1::bind(&parallelForWorker, &next, count, f)));
+  parallelForWorker(&next, count, f);
+  for (uint32 t = 0; t < threads.size(); t++) {
+    threads[t]->join();
+    delete threads[t];
   }
+}
 
-  GeomPairContainer(uint32 g, uint32 v1, uint32 v2, float64 cost)  {
-    init(g,v1,v2);
-    mCost = cost;
+/** Makes every index refer to the first vertex with the same position,
+ *  removes duplicate faces, and builds the face lists and quadrics. */
+void prepareGeometry(SubMeshGeometry& curGeometry, GeometryData& data) {
+  uint32 nverts = curGeometry.positions.size();
+
+  std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher> firstPositionMap;
+  std::vector<uint8> deleted(nverts, 0);
+  for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
+    std::vector<unsigned short>& indices = curGeometry.primitives[j].indices;
+    for (uint32 k = 0; k < indices.size(); k++) {
+      unsigned short idx = indices[k];
+      std::pair<std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher>::iterator, bool> inserted =
+        firstPositionMap.insert(std::make_pair(curGeometry.positions[idx], (uint32)idx));
+      if (!inserted.second && inserted.first->second != idx) {
+        indices[k] = inserted.first->second;
+        deleted[idx] = 1;
+      }
+    }
   }
-
-  GeomPairContainer() {
-    mGeomIdx = mVertexIdx1 = mVertexIdx2 = 0;
-    mCost = 0;
+  for (uint32 j = 0; j < nverts; j++) {
+    if (deleted[j]) {
+      curGeometry.positions[j] = SIMPLIFIER_INVALID_VECTOR;
+      data.changed = true;
+    }
   }
 
-  size_t hash() const {
-      size_t seed = 0;
-      boost::hash_combine(seed, mGeomIdx);
-      boost::hash_combine(seed, mVertexIdx1);
-      boost::hash_combine(seed, mVertexIdx2);
+  // Faces, skipping degenerate and duplicate ones
+  std::tr1::unordered_set<uint64> uniqueFaces;
+  for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
+    std::vector<unsigned short>& indices = curGeometry.primitives[j].indices;
+    for (uint32 k = 0; k+2 < indices.size(); k+=3) {
+      uint32 idx = indices[k], idx2 = indices[k+1], idx3 = indices[k+2];
+      if (idx == idx2 || idx == idx3 || idx2 == idx3)
+        continue;
+
+      uint32 sorted[3] = { idx, idx2, idx3 };
+      std::sort(sorted, sorted + 3);
+      uint64 key = ((uint64)sorted[0] << 32) | ((uint64)sorted[1] << 16) | (uint64)sorted[2];
+      if (!uniqueFaces.insert(key).second) {
+        indices[k] = indices[k+1] = indices[k+2] = USHRT_MAX;
+        data.changed = true;
+        continue;
+      }
 
-      return seed;
+      data.faces.push_back(idx);
+      data.faces.push_back(idx2);
+      data.faces.push_back(idx3);
+    }
   }
-
-  bool operator==(const GeomPairContainer&other)const {
-    return mGeomIdx==other.mGeomIdx && mVertexIdx1==other.mVertexIdx1 && mVertexIdx2==other.mVertexIdx2;
+  uint32 nfaces = data.faces.size() / 3;
+  data.faceValid.assign(nfaces, 1);
+
+  // Face lists, in CSR form
+  data.vertexFaceStart.assign(nverts + 1, 0);
+  for (uint32 f = 0; f < data.faces.size(); f++)
+    data.vertexFaceStart[data.faces[f] + 1]++;
+  for (uint32 v = 0; v < nverts; v++)
+    data.vertexFaceStart[v + 1] += data.vertexFaceStart[v];
+  data.vertexFaceCount.assign(nverts, 0);
+  data.vertexFaces.resize(data.faces.size());
+  for (uint32 f = 0; f < data.faces.size(); f++) {
+    uint32 v = data.faces[f];
+    data.vertexFaces[data.vertexFaceStart[v] + data.vertexFaceCount[v]++] = f / 3;
   }
 
-  bool operator<(const GeomPairContainer&other) const {
-
-    if (*this == other) return false;
-
-    if (mCost == other.mCost) {
-      if (mGeomIdx == other.mGeomIdx) {
-        if (mVertexIdx1 == other.mVertexIdx1) {
-          assert(mVertexIdx2 != other.mVertexIdx2);
-          return mVertexIdx2 < other.mVertexIdx2;
-        }
-
-        return mVertexIdx1 < other.mVertexIdx1;
+  data.parent.resize(nverts);
+  data.nextMember.resize(nverts);
+  for (uint32 v = 0; v < nverts; v++)
+    data.parent[v] = data.nextMember[v] = v;
+
+  // Quadrics, accumulated over every instance. Each face's plane is computed
+  // in world space, where the error is measured, and then transformed back
+  // into the geometry's space: if p is the world space plane and T the
+  // instance transform, the local quadric is T^T p p^T T = (T^T p)(T^T p)^T.
+  data.quadrics.resize(nverts);
+  for (uint32 v = 0; v < nverts; v++)
+    data.quadrics[v].zero();
+  for (uint32 f = 0; f < nfaces; f++) {
+    const Vector3f& p1 = curGeometry.positions[data.faces[3*f]];
+    const Vector3f& p2 = curGeometry.positions[data.faces[3*f+1]];
+    const Vector3f& p3 = curGeometry.positions[data.faces[3*f+2]];
+
+    Quadric faceQ;
+    faceQ.zero();
+    for (uint32 t = 0; t < data.transforms.size(); t++) {
+      const Matrix4x4f& T = data.transforms[t];
+      Vector3d w[3];
+      const Vector3f* p[3] = { &p1, &p2, &p3 };
+      for (int c = 0; c < 3; c++) {
+        for (int row = 0; row < 3; row++)
+          w[c][row] = (float64)T(row,0)*p[c]->x + (float64)T(row,1)*p[c]->y + (float64)T(row,2)*p[c]->z + T(row,3);
       }
 
-      return mGeomIdx < other.mGeomIdx;
-    }
+      Vector3d normal = (w[1] - w[0]).cross(w[2] - w[0]);
+      float64 len = normal.length();
+      if (!(len > 0)) continue;
+      normal /= len;
+      float64 world_plane[4] = { normal.x, normal.y, normal.z, -normal.dot(w[0]) };
+      float64 plane[4];
+      for (int col = 0; col < 4; col++)
+        plane[col] = T(0,col)*world_plane[0] + T(1,col)*world_plane[1] + T(2,col)*world_plane[2] + T(3,col)*world_plane[3];
 
-    return mCost < other.mCost;
+      faceQ.addPlane(plane[0], plane[1], plane[2], plane[3], len * 0.5);
+    }
+    for (int c = 0; c < 3; c++)
+      data.quadrics[data.faces[3*f+c]].add(faceQ);
   }
 
-  class Hasher{
-  public:
-        size_t operator() (const GeomPairContainer& g) const {
-            return g.hash();
-        }
-  };
-
-};
-bool custom_isnan (double data) {
-#ifdef _WIN32
-    return _isnan(data);
-#else
-    return std::isnan(data);
-#endif
+  data.bestCost.assign(nverts, std::numeric_limits<float64>::infinity());
+  data.bestNeighbor.assign(nverts, NoVertex);
+  data.bestKeep.assign(nverts, NoVertex);
 }
 
-void computeCosts(Mesh::MeshdataPtr agg_mesh,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<Vector3f, Matrix4x4d, Vector3f::Hasher> >& submeshPositionQs,
-                  std::set<GeomPairContainer>& vertexPairs,
-                  std::tr1::unordered_map<GeomPairContainer, float64, GeomPairContainer::Hasher>& pairPriorities,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> > >& submeshNeighborVertices,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::vector<uint32> > >& vertexToFacesMap
-                 )
-{  
-  for (uint32 i = 0;  i < agg_mesh->geometry.size(); i++) {
-
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-    std::tr1::unordered_map<Vector3f, Matrix4x4d, Vector3f::Hasher>& positionQs = submeshPositionQs[i];
-    std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> >& neighborVertices = submeshNeighborVertices[i];
-    std::tr1::unordered_map<uint32, std::vector<uint32> >& submeshVertexToFacesMap = vertexToFacesMap[i];
-
-    for (uint32 j = 0; j < curGeometry.positions.size(); j++) {
-      
-      if (neighborVertices.find(j) == neighborVertices.end()) continue;
-
-      bool j_edgeVertex = (submeshVertexToFacesMap[j].size() == 1);
-
-      const Vector3f& position = curGeometry.positions[j];
-
-      Matrix4x4d Q = positionQs[position];      
-
-      std::tr1::unordered_set<uint32>& neighbors = neighborVertices[j];
-
-      for (std::tr1::unordered_set<uint32>::iterator neighbor_it = neighbors.begin(); neighbor_it != neighbors.end(); neighbor_it++) {
-        uint32 neighbor = *neighbor_it;
-
-        bool neighbor_edgeVertex = (submeshVertexToFacesMap[neighbor].size() == 1);
-
-        float64 cost = 0;
-        if (false/*j_edgeVertex || neighbor_edgeVertex*/) {
-          cost = 1e15;
-        }
-        else {
-          const Vector3f& neighborPosition = curGeometry.positions[neighbor];
-          Matrix4x4d Q = positionQs[position] + positionQs[neighborPosition];
-          Vector4d vbar4f (neighborPosition.x, neighborPosition.y, neighborPosition.z, 1);
-          cost = (cost < 0.0) ? -cost : cost;          
-        }
-
-        GeomPairContainer gpc(i, j, neighbor);
-
-        //Insert this cost as the cost of the edge if the edge hasnt been inserted 
-        //before or if this cost is less than the previously computed cost.
-        if (pairPriorities[gpc] == -1 || (pairPriorities[gpc] != -1 && cost < pairPriorities[gpc]) ) { 
-          gpc.mCost = pairPriorities[gpc];
-          vertexPairs.erase(gpc);
-          
-          gpc.mCost = cost;
-          pairPriorities[gpc] = gpc.mCost;
-          vertexPairs.insert(gpc);
-        }
+/** Calls f for each valid face around the set rooted at v, removing any
+ *  invalid faces encountered from the face lists and any members without
+ *  faces from the ring. */
+template<typename Func>
+void forEachFace(GeometryData& data, uint32 v, Func& f) {
+  uint32 prev = NoVertex;
+  uint32 m = v;
+  do {
+    uint32 start = data.vertexFaceStart[m];
+    uint32& count = data.vertexFaceCount[m];
+    for (uint32 i = 0; i < count; ) {
+      uint32 face = data.vertexFaces[start + i];
+      if (!data.faceValid[face]) {
+        data.vertexFaces[start + i] = data.vertexFaces[start + count - 1];
+        count--;
+        continue;
       }
+      f(face);
+      i++;
     }
-  }
+
+    uint32 next = data.nextMember[m];
+    if (count == 0 && m != v && prev != NoVertex) {
+      data.nextMember[prev] = next;
+      data.nextMember[m] = m;
+    }
+    else {
+      prev = m;
+    }
+    m = next;
+  } while (m != v);
 }
 
-inline uint32  findMappedVertex(std::tr1::unordered_map<int, int>& vertexMapping, uint32 idx) {
-  uint32 startIdx = idx;
+struct BestCollapseFinder {
+  GeometryData& data;
+  const std::vector<Vector3f>& positions;
+  uint32 v;
 
-  int countIter = 0;
-  while (vertexMapping.find(idx) != vertexMapping.end()) {
-    countIter++;
-    if ((int)idx == vertexMapping[idx]) {
-      break;
-    }
-    idx = vertexMapping[idx];
+  BestCollapseFinder(GeometryData& d, const std::vector<Vector3f>& p, uint32 vert)
+   : data(d), positions(p), v(vert)
+  {
+    data.bestCost[v] = std::numeric_limits<float64>::infinity();
+    data.bestNeighbor[v] = NoVertex;
+    data.bestKeep[v] = NoVertex;
   }
 
-  if (countIter > 1) {
-    vertexMapping[startIdx] = idx;
+  void operator()(uint32 face) {
+    for (int c = 0; c < 3; c++) {
+      uint32 n = data.find(data.faces[3*face+c]);
+      if (n == v) continue;
+
+      Quadric Q = data.quadrics[v];
+      Q.add(data.quadrics[n]);
+      // Collapse onto whichever end introduces less error
+      float64 cost_v = std::fabs(Q.evaluate(positions[v]));
+      float64 cost_n = std::fabs(Q.evaluate(positions[n]));
+      float64 cost = std::min(cost_v, cost_n);
+      if (cost < data.bestCost[v]) {
+        data.bestCost[v] = cost;
+        data.bestNeighbor[v] = n;
+        data.bestKeep[v] = (cost_v <= cost_n) ? v : n;
+      }
+    }
   }
+};
 
-  return idx;
+void computeBestCollapse(GeometryData& data, const std::vector<Vector3f>& positions, uint32 v) {
+  BestCollapseFinder finder(data, positions, v);
+  forEachFace(data, v, finder);
 }
 
-void computeCosts(Mesh::MeshdataPtr agg_mesh, uint32 geomIdx, uint32 sourcePositionIdx, uint32 targetPositionIdx,
-                  std::tr1::unordered_map<int, int>& vertexMapping,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<Vector3f, Matrix4x4d, Vector3f::Hasher> >& submeshPositionQs,
-                  std::set<GeomPairContainer>& vertexPairs,
-                  std::tr1::unordered_map<GeomPairContainer, float64, GeomPairContainer::Hasher>& pairPriorities,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> > >& submeshNeighborVertices,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::vector<uint32> > >& vertexToFacesMap)
-{
-  SubMeshGeometry& curGeometry = agg_mesh->geometry[geomIdx];
-  std::tr1::unordered_map<Vector3f, Matrix4x4d, Vector3f::Hasher>& positionQs = submeshPositionQs[geomIdx];
-  std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> >& neighborVertices = submeshNeighborVertices[geomIdx];
-  std::tr1::unordered_map<uint32, std::vector<uint32> >& submeshVertexToFacesMap = vertexToFacesMap[geomIdx];
-
-  targetPositionIdx = findMappedVertex(vertexMapping, targetPositionIdx);
+struct NeighborCollector {
+  GeometryData& data;
+  uint32 v;
+  std::vector<uint32> neighbors;
 
-  const Vector3f& position = curGeometry.positions[targetPositionIdx];
+  NeighborCollector(GeometryData& d, uint32 vert) : data(d), v(vert) {}
 
-  std::tr1::unordered_set<uint32>& neighbors = neighborVertices[targetPositionIdx];
-
-  bool is_edgeVertex = (submeshVertexToFacesMap[geomIdx].size() == 1);
-
-  for (std::tr1::unordered_set<uint32>::iterator neighbor_it = neighbors.begin(); neighbor_it != neighbors.end(); neighbor_it++) {   
-    uint32 neighborIdx = *neighbor_it;    
-
-    neighborIdx = findMappedVertex(vertexMapping, neighborIdx);
-
-    if (neighborIdx == targetPositionIdx) continue;
-
-    uint32 idx1 = targetPositionIdx;
-    uint32 idx2 = neighborIdx;
-
-    bool neighbor_edgeVertex = (submeshVertexToFacesMap[neighborIdx].size() == 1);
-
-    float64 cost = 0;    
-    
-    const Vector3f& neighborPosition = curGeometry.positions[neighborIdx];
-
-    Matrix4x4d Q = positionQs[position] + positionQs[neighborPosition];    
-    
-    Vector4d vbar4f (neighborPosition.x, neighborPosition.y, neighborPosition.z, 1);
-    float64 cost1 = (vbar4f.dot(  Q * vbar4f )) ;
-    cost1 = (cost1 < 0.0) ? -cost1 : cost1;
-
-    vbar4f = Vector4d (position.x, position.y, position.z, 1);
-    float64 cost2 = (vbar4f.dot(  Q * vbar4f )) ;
-    cost2 = (cost2 < 0.0) ? -cost2 : cost2;
-
-    //Use the lower cost to determine the order of the pair (the second
-    //vertex in the pair will be the target vertex for the edge collapse).
-    cost = (cost1 < cost2) ? cost1 : cost2;    
-    if (cost == cost2) {
-      //If the second cost is lower, 
-      //switch neighborIdx and targetPositionIdx
-      uint32 tempIdx = idx1;
-      idx1 = idx2;
-      idx2 = tempIdx;
-    }
-      
-    if (cost == 0) {                
-      /*Deal properly with the case where all faces adjacent to a vertex are coplanar.
-        While this face may have coplanar vertices in this instance, these vertices
-        might connect with other faces in other instances. */
+  void operator()(uint32 face) {
+    for (int c = 0; c < 3; c++) {
+      uint32 n = data.find(data.faces[3*face+c]);
+      if (n != v) neighbors.push_back(n);
     }
-
-    //Remove the previous vertex pair that existed before one vertex collapsed.
-    GeomPairContainer gpc(geomIdx, sourcePositionIdx, neighborIdx);
-    gpc.mCost = pairPriorities[gpc];
-    vertexPairs.erase(gpc);
-    
-    //Insert this vertex pair with the new cost.
-    gpc = GeomPairContainer(geomIdx, idx1, idx2);
-    gpc.mCost = pairPriorities[gpc];
-    vertexPairs.erase(gpc);                 
-    
-    gpc.mCost = cost;    
-    pairPriorities[gpc] = gpc.mCost;
-    vertexPairs.insert(gpc);    
   }
-}
-
-void MeshSimplifier::simplify(Mesh::MeshdataPtr agg_mesh, int32 numFacesLeft) {
-  std::tr1::unordered_map<uint32, uint32> submeshInstanceCount;
-
-  int countFaces = 0;
-  uint32 geoinst_idx;
-  Matrix4x4f geoinst_pos_xform;
-  Meshdata::GeometryInstanceIterator geoinst_it = agg_mesh->getGeometryInstanceIterator();
-
-  std::set<GeomPairContainer> vertexPairs;
-  std::tr1::unordered_map<GeomPairContainer, float64, GeomPairContainer::Hasher> pairPriorities;
-
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<Vector3f, Matrix4x4d, Vector3f::Hasher> > submeshPositionQs;
-
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> > > submeshNeighborVertices;
-
-  bool meshChangedDuringPreprocess = false;
-
-  /* Make every index in prims specification point to the earliest occurrence of the corresponding position vector */
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-
-    std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher> firstPositionMap;
-
-    std::tr1::unordered_set<uint32> deletedIndices;
-    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
-      SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
-
-      for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
-        unsigned short idx = primitive.indices[k];
-        unsigned short idx2 = primitive.indices[k+1];
-        unsigned short idx3 = primitive.indices[k+2];
+};
 
-        Vector3f& pos1 = curGeometry.positions[idx];
-        Vector3f& pos2 = curGeometry.positions[idx2];
-        Vector3f& pos3 = curGeometry.positions[idx3];
+struct DegenerateFaceRemover {
+  GeometryData& data;
+  uint32 removed;
 
-        if (firstPositionMap.find(pos1) == firstPositionMap.end()) {
-          firstPositionMap[pos1] = idx;
-        }
-        else {
-          if (idx != firstPositionMap[pos1]) {
-            primitive.indices[k] = firstPositionMap[pos1];
-            deletedIndices.insert(idx);
-          }
-        }
+  DegenerateFaceRemover(GeometryData& d) : data(d), removed(0) {}
 
-        if (firstPositionMap.find(pos2) == firstPositionMap.end()) {
-          firstPositionMap[pos2] = idx2;
-        }
-        else {
-           if (idx2 != firstPositionMap[pos2]) {
-             primitive.indices[k+1] = firstPositionMap[pos2];
-             deletedIndices.insert(idx2);
-           }
-        }
-
-        if (firstPositionMap.find(pos3) == firstPositionMap.end()) {
-          firstPositionMap[pos3] = idx3;
-        }
-        else {
-          if (idx3 != firstPositionMap[pos3]) {
-            primitive.indices[k+2] = firstPositionMap[pos3];
-            deletedIndices.insert(idx3);
-          }
-        }
-      }
+  void operator()(uint32 face) {
+    uint32 a = data.find(data.faces[3*face]);
+    uint32 b = data.find(data.faces[3*face+1]);
+    uint32 c = data.find(data.faces[3*face+2]);
+    if (a == b || b == c || a == c) {
+      data.faceValid[face] = 0;
+      removed++;
     }
+  }
+};
 
-    for (std::tr1::unordered_set<uint32>::iterator it = deletedIndices.begin();
-          it != deletedIndices.end(); it++)
-    {
-      curGeometry.positions[*it] = SIMPLIFIER_INVALID_VECTOR;
-    }
-		
-    if (deletedIndices.size() > 0) {
-	meshChangedDuringPreprocess = true;
+/** Removes collapsed and unused vertices and rewrites the primitives to use
+ *  the remaining ones. */
+void finishGeometry(SubMeshGeometry& curGeometry, GeometryData& data) {
+  std::vector<uint32> oldToNewMap(curGeometry.positions.size(), NoVertex);
+
+  // Only vertices of the remaining triangles are kept
+  std::vector<uint8> used(curGeometry.positions.size(), 0);
+  for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
+    const SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
+    if (primitive.primitiveType != SubMeshGeometry::Primitive::TRIANGLES)
+      continue;
+    for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
+      if (primitive.indices[k] == USHRT_MAX)
+        continue;
+      uint32 v1 = data.find(primitive.indices[k]), v2 = data.find(primitive.indices[k+1]), v3 = data.find(primitive.indices[k+2]);
+      if (v1 != v2 && v2 != v3 && v1 != v3)
+        used[v1] = used[v2] = used[v3] = 1;
     }
   }
 
-  std::tr1::unordered_map<uint32, std::vector<IndexedFaceContainer> > geomFacesList;
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::vector<uint32> > > vertexToFacesMap;
-
-  /* Identify the non-unique faces in the geometry. Insert the vertex pairs */
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-
-    std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> >& neighborVertices = submeshNeighborVertices[i];
-    std::tr1::unordered_map<uint32, std::vector<uint32> >& geomsVertexToFacesMap = vertexToFacesMap[i];
-    std::vector<IndexedFaceContainer>& facesList = geomFacesList[i];
-
-    std::tr1::unordered_map<Vector3f, Matrix4x4d, Vector3f::Hasher>& positionQs = submeshPositionQs[i];
-
-    std::tr1::unordered_set<FaceContainer, FaceContainer::Hasher> duplicateFaces;
-    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
-        SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
-
-        for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
-          unsigned short idx = primitive.indices[k];
-          unsigned short idx2 = primitive.indices[k+1];
-          unsigned short idx3 = primitive.indices[k+2];
-
-          if (idx == idx2 || idx == idx3 || idx2 == idx3)
-            continue;
+  std::vector<Sirikata::Vector3f> positions;
+  std::vector<Sirikata::Vector3f> normals;
+  std::vector<SubMeshGeometry::TextureSet>texUVs;
 
-          Vector3f& pos1 = curGeometry.positions[idx];
-          Vector3f& pos2 = curGeometry.positions[idx2];
-          Vector3f& pos3 = curGeometry.positions[idx3];
-
-          FaceContainer origface(pos1, pos2, pos3);
-
-          if (duplicateFaces.find(origface) != duplicateFaces.end()) {
-            primitive.indices[k] = USHRT_MAX;
-            primitive.indices[k+1] = USHRT_MAX;
-            primitive.indices[k+2] = USHRT_MAX;
-
-            continue;
-          }
-
-          GeomPairContainer gpc1(i, idx, idx2, -1);
-          GeomPairContainer gpc2(i, idx2, idx3, -1);
-          GeomPairContainer gpc3(i, idx, idx3, -1);
-
-          neighborVertices[idx].insert(idx2);
-          neighborVertices[idx].insert(idx3);
-          neighborVertices[idx2].insert(idx);
-          neighborVertices[idx2].insert(idx3);
-          neighborVertices[idx3].insert(idx);
-          neighborVertices[idx3].insert(idx2);
+  for (uint32 j = 0; j < curGeometry.texUVs.size(); j++) {
+    SubMeshGeometry::TextureSet ts;
+    ts.stride = curGeometry.texUVs[j].stride;
+    texUVs.push_back(ts);
+  }
 
-          
-          vertexPairs.insert(gpc1);
-          pairPriorities[gpc1] = -1;
+  std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher> vector3fSet;
 
-          vertexPairs.insert(gpc2);
-          pairPriorities[gpc2] = -1;
+  for (uint32 j = 0 ; j < curGeometry.positions.size() ; j++) {
+    if (!used[j] || curGeometry.positions[j] == SIMPLIFIER_INVALID_VECTOR)
+      continue;
 
-          vertexPairs.insert(gpc3);
-          pairPriorities[gpc3] = -1;
+    std::pair<std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher>::iterator, bool> inserted =
+      vector3fSet.insert(std::make_pair(curGeometry.positions[j], (uint32)positions.size()));
+    oldToNewMap[j] = inserted.first->second;
+    if (!inserted.second)
+      continue;
 
-          duplicateFaces.insert(origface);
+    positions.push_back(curGeometry.positions[j]);
 
-          IndexedFaceContainer ifc(idx, idx2, idx3);
-          uint32 faceIndex = facesList.size();
-          facesList.push_back(ifc);
+    if (j < curGeometry.normals.size())
+      normals.push_back(curGeometry.normals[j]);
 
-          geomsVertexToFacesMap[idx].push_back(faceIndex);
-          geomsVertexToFacesMap[idx2].push_back(faceIndex);
-          geomsVertexToFacesMap[idx3].push_back(faceIndex);
+    for (uint32 k = 0; k < curGeometry.texUVs.size(); k++) {
+      unsigned int stride = curGeometry.texUVs[k].stride;
+      if (stride*j < curGeometry.texUVs[k].uvs.size()) {
+        uint32 idx = stride * j;
+        while ( idx < stride*j+stride){
+          texUVs[k].uvs.push_back(curGeometry.texUVs[k].uvs[idx]);
+          idx++;
         }
-    }
-  }
-
-
-  //Find the list of instances associated with each submesh
-  countFaces = 0;
-  
-  while( geoinst_it.next(&geoinst_idx, &geoinst_pos_xform) ) {
-    const GeometryInstance& geomInstance = agg_mesh->instances[geoinst_idx];
-    Matrix4x4f geoinst_pos_xform_transpose = geoinst_pos_xform.transpose();
-    Matrix4x4d transform;
-    for (int row=0; row<4; row++) {
-      for (int col=0; col<4; col++) {
-        transform(row,col) = geoinst_pos_xform(row,col);        
       }
     }
-    
-
-    int geomIdx = geomInstance.geometryIndex;
-    submeshInstanceCount[geomIdx]++;
+  }
 
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[geomIdx];
-    std::tr1::unordered_map<Vector3f, Matrix4x4d, Vector3f::Hasher>& positionQs = submeshPositionQs[geomIdx];
+  curGeometry.positions.swap(positions);
+  curGeometry.normals.swap(normals);
+  curGeometry.texUVs.swap(texUVs);
 
-    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
-      SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
+  for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
+    SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
+    std::vector<unsigned short> indices;
 
+    if (primitive.primitiveType == SubMeshGeometry::Primitive::TRIANGLES) {
       for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
         unsigned short idx = primitive.indices[k];
         unsigned short idx2 = primitive.indices[k+1];
         unsigned short idx3 = primitive.indices[k+2];
 
-        if (idx == USHRT_MAX && idx2 == USHRT_MAX && idx3 == USHRT_MAX) {
+        if (idx == USHRT_MAX && idx2 == USHRT_MAX && idx3 == USHRT_MAX)
           continue;
-        }
 
-        if (idx == idx2 || idx == idx3 || idx2 == idx3) continue;
-
-        Vector3d orig_pos1 (curGeometry.positions[idx].x, curGeometry.positions[idx].y,
-                           curGeometry.positions[idx].z);
-        Vector3d orig_pos2 (curGeometry.positions[idx2].x, curGeometry.positions[idx2].y,
-                            curGeometry.positions[idx2].z);
-        Vector3d orig_pos3 (curGeometry.positions[idx3].x, curGeometry.positions[idx3].y,
-                            curGeometry.positions[idx3].z);                
-
-        Vector3d pos1 = transform * orig_pos1;
-        Vector3d pos2 = transform * orig_pos2;
-        Vector3d pos3 = transform * orig_pos3;
-        
-    
-        Vector3d normal = (pos2 - pos1).cross(pos3-pos1);
-        normal = normal.normal();
-        float64 A = normal[0];
-        float64 B = normal[1];
-        float64 C = normal[2];
-        float64 D = -(normal.dot(pos1));
-
-        Matrix4x4d Qmat ( Vector4d(A*A, A*B, A*C, A*D),
-                          Vector4d(A*B, B*B, B*C, B*D),
-                          Vector4d(A*C, B*C, C*C, C*D),
-                          Vector4d(A*D, B*D, C*D, D*D), Matrix4x4d::ROWS() );         
-        
-        Qmat = transform.transpose() * Qmat * transform;
-
-        float64 face_area = (pos1-pos2).cross(pos1-pos3).length() * 0.5;
-        Qmat *= face_area;
-
-        positionQs[curGeometry.positions[idx]] += Qmat;
-        positionQs[curGeometry.positions[idx2]] += Qmat;
-        positionQs[curGeometry.positions[idx3]] += Qmat;        
-
-        countFaces++;
+        uint32 v1 = data.find(idx), v2 = data.find(idx2), v3 = data.find(idx3);
+        if (v1 != v2 && v2 != v3 && v1 != v3) {
+          indices.push_back(oldToNewMap[v1]);
+          indices.push_back(oldToNewMap[v2]);
+          indices.push_back(oldToNewMap[v3]);
+        }
       }
     }
-  }
 
-  SIMPLIFY_LOG(detailed, "countFaces = " << countFaces);
-  SIMPLIFY_LOG(detailed, "numFacesLeft = " << numFacesLeft);
-  if (numFacesLeft < countFaces) {
-      SIMPLIFY_LOG(detailed, "numFacesLeft < countFaces: Simplification needed");
-      computeCosts(agg_mesh, submeshPositionQs, vertexPairs, pairPriorities, submeshNeighborVertices, vertexToFacesMap);
-  }
-  else if (!meshChangedDuringPreprocess) {
-    return;
+    primitive.indices.swap(indices);
   }
+}
 
-  std::tr1::unordered_map<int, std::tr1::unordered_map<int,int>  > vertexMapping1;
-
-  //Do the actual edge collapses.
-  while (countFaces > numFacesLeft && vertexPairs.size() > 0) {
-
-    GeomPairContainer top = *(vertexPairs.begin());
-
-    int i = top.mGeomIdx;
-    
-    uint32 targetIdx = top.mVertexIdx1;
-    uint32 sourceIdx = top.mVertexIdx2;
-
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-    std::tr1::unordered_map<int, int>& vertexMapping = vertexMapping1[i];
-
-    targetIdx = findMappedVertex(vertexMapping, targetIdx);
-    sourceIdx = findMappedVertex(vertexMapping, sourceIdx);
-
-    Vector3f& pos1 = curGeometry.positions[targetIdx];
-    Vector3f& pos2 = curGeometry.positions[sourceIdx];
-
-    //Collapse vertex at sourceIdx into targetIdx.
-    if (targetIdx != sourceIdx && pos1 != pos2) {
-      vertexMapping[sourceIdx] = targetIdx;
-      
-      // FIXME: Can add a boundary edge check here by checking if countfaces reduced by 1 or more than 1.
-      // If 1, its a boundary edge.
-
-      std::tr1::unordered_map<uint32, std::vector<uint32> >& geomsVertexToFacesMap = vertexToFacesMap[i];
-      std::vector<uint32>& ifcVector = geomsVertexToFacesMap[sourceIdx];
-      std::vector<IndexedFaceContainer>& facesList = geomFacesList[i];
-
-      //count how many faces get invalidated and degenerate because of this edge collapse.
-      for (uint32 ifcVectorIdx = 0; ifcVectorIdx < ifcVector.size(); ifcVectorIdx++) {
-        uint32 faceIndex = ifcVector[ifcVectorIdx];
-        IndexedFaceContainer& ifc = facesList[faceIndex];
-
-        if (!ifc.valid) continue;
+// Runs one of the per-geometry steps for a single geometry, for parallelFor
+struct GeometryTask {
+  typedef void(*Step)(SubMeshGeometry&, GeometryData&);
+  Step step;
+  SubMeshGeometryList* geometry;
+  std::vector<GeometryData>* data;
 
-        unsigned short vidx = ifc.idx1;
-        unsigned short vidx2 = ifc.idx2;
-        unsigned short vidx3 = ifc.idx3;
+  GeometryTask(Step s, SubMeshGeometryList& g, std::vector<GeometryData>& d)
+   : step(s), geometry(&g), data(&d)
+  {}
 
-        vidx = findMappedVertex(vertexMapping, vidx);
-        vidx2 = findMappedVertex(vertexMapping, vidx2);
-        vidx3 = findMappedVertex(vertexMapping, vidx3);
+  void operator()(uint32 i) const {
+    step((*geometry)[i], (*data)[i]);
+  }
+};
 
-        if (vidx == vidx2 || vidx2 == vidx3 || vidx == vidx3) {
-          //degenerate face; invalidate it.
-          countFaces -= submeshInstanceCount[i];
-          ifc.valid = false;
-        }
-        else {
-          //add this face to the neighbors of the target vertex.
-          geomsVertexToFacesMap[targetIdx].push_back(faceIndex);
-        }
-      }
-      //done invalidating degenerate faces.
-
-      //Now update the neighbors of the target vertex and its quadric matrix.
-      std::tr1::unordered_set<uint32>& neighborVertices2 =  submeshNeighborVertices[i][sourceIdx];
-      std::tr1::unordered_set<uint32>& neighborVertices1 =  submeshNeighborVertices[i][targetIdx];
-      std::tr1::unordered_map<Vector3f, Matrix4x4d, Vector3f::Hasher>& positionQs = submeshPositionQs[i];
-      for (std::tr1::unordered_set<uint32>::iterator neighbor_it = neighborVertices2.begin();
-           neighbor_it != neighborVertices2.end(); neighbor_it++)
-      {
-        uint32 neighborIdx = *neighbor_it;
-
-        if (neighborIdx != targetIdx) {
-          neighborVertices1.insert(neighborIdx);
-        }
-      }
+} // namespace
 
-      positionQs[ pos1 ] += positionQs[pos2];
+MeshSimplifier::MeshSimplifier(uint32 nthreads)
+ : mNumThreads(nthreads)
+{
+  if (mNumThreads == 0)
+    mNumThreads = std::max(boost::thread::hardware_concurrency(), 1u);
+}
 
-      //Finally recompute the costs of the neighbors.
-      computeCosts(agg_mesh, i, sourceIdx, targetIdx, vertexMapping,
-                   submeshPositionQs, vertexPairs, pairPriorities, submeshNeighborVertices,
-                   vertexToFacesMap);
-    }
+void MeshSimplifier::simplify(Mesh::MeshdataPtr agg_mesh, int32 numFacesLeft) {
+  uint32 ngeoms = agg_mesh->geometry.size();
+  std::vector<GeometryData> geomData(ngeoms);
 
-    vertexPairs.erase(top);
-    pairPriorities.erase(top);
+  // Find the instances of each geometry
+  uint32 geoinst_idx;
+  Matrix4x4f geoinst_pos_xform;
+  Meshdata::GeometryInstanceIterator geoinst_it = agg_mesh->getGeometryInstanceIterator();
+  while( geoinst_it.next(&geoinst_idx, &geoinst_pos_xform) ) {
+    const GeometryInstance& geomInstance = agg_mesh->instances[geoinst_idx];
+    geomData[geomInstance.geometryIndex].transforms.push_back(geoinst_pos_xform);
   }
 
+  parallelFor(ngeoms, mNumThreads, GeometryTask(&prepareGeometry, agg_mesh->geometry, geomData));
 
-  //remove unused vertices; get new mapping from previous vertex indices to new vertex indices in vertexMapping2;
-  std::tr1::unordered_map<int, std::tr1::unordered_map<int,int> > vertexMapping2;
-
-  //Remove vertices no longer used in the simplified mesh.
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-    std::tr1::unordered_map<int, int>& vertexMapping = vertexMapping1[i];
-    std::tr1::unordered_map<int, int>& oldToNewMap = vertexMapping2[i];
-
-    std::vector<Sirikata::Vector3f> positions;
-    std::vector<Sirikata::Vector3f> normals;
-    std::vector<SubMeshGeometry::TextureSet>texUVs;
+  int64 countFaces = 0;
+  bool meshChangedDuringPreprocess = false;
+  std::vector<uint32> geomBase(ngeoms + 1, 0);
+  for (uint32 i = 0; i < ngeoms; i++) {
+    countFaces += (int64)(geomData[i].faces.size() / 3) * geomData[i].transforms.size();
+    meshChangedDuringPreprocess = meshChangedDuringPreprocess || geomData[i].changed;
+    geomBase[i + 1] = geomBase[i] + agg_mesh->geometry[i].positions.size();
+  }
 
-    for (uint32 j = 0; j < curGeometry.texUVs.size(); j++) {
-      SubMeshGeometry::TextureSet ts;
-      ts.stride = curGeometry.texUVs[j].stride;
-      texUVs.push_back(ts);
+  SIMPLIFY_LOG(detailed, "countFaces = " << countFaces);
+  SIMPLIFY_LOG(detailed, "numFacesLeft = " << numFacesLeft);
+  if (numFacesLeft < countFaces) {
+    SIMPLIFY_LOG(detailed, "numFacesLeft < countFaces: Simplification needed");
+
+    // Find each vertex's cheapest collapse. Geometry without any instances
+    // doesn't contribute any faces, so there's no point simplifying it.
+    for (uint32 i = 0; i < ngeoms; i++) {
+      GeometryData& data = geomData[i];
+      if (data.transforms.empty()) continue;
+      const std::vector<Vector3f>& positions = agg_mesh->geometry[i].positions;
+      for (uint32 v = 0; v < positions.size(); v++) {
+        if (data.vertexFaceCount[v] > 0)
+          computeBestCollapse(data, positions, v);
+      }
     }
 
-    std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher> vector3fSet;
-
-    for (uint32 j = 0 ; j < curGeometry.positions.size() ; j++) {
-      if (vertexMapping.find(j) == vertexMapping.end()) {
-
-        if (curGeometry.positions[j] == SIMPLIFIER_INVALID_VECTOR) {
-          continue;
-        }
-
-        if (vector3fSet.find(curGeometry.positions[j]) != vector3fSet.end()) {
-          oldToNewMap[j] = vector3fSet[ curGeometry.positions[j] ];
-          continue;
-        }
-
-        oldToNewMap[j] = positions.size();
-
-        vector3fSet[ curGeometry.positions[j] ] = positions.size();
-
-        positions.push_back(curGeometry.positions[j]);
-
-        if (j < curGeometry.normals.size())
-          normals.push_back(curGeometry.normals[j]);
-
-        for (uint32 k = 0; k < curGeometry.texUVs.size(); k++) {
-          unsigned int stride = curGeometry.texUVs[k].stride;
-          if (stride*j < curGeometry.texUVs[k].uvs.size()) {
-            uint32 idx = stride * j;
-            while ( idx < stride*j+stride){
-              texUVs[k].uvs.push_back(curGeometry.texUVs[k].uvs[idx]);
-              idx++;
-            }
-          }
-        }
+    // Then collapse edges in order of cost across all the geometry
+    IndexedHeap heap(geomBase[ngeoms]);
+    for (uint32 i = 0; i < ngeoms; i++) {
+      GeometryData& data = geomData[i];
+      for (uint32 v = 0; v < data.bestNeighbor.size(); v++) {
+        if (data.bestNeighbor[v] != NoVertex)
+          heap.set(geomBase[i] + v, data.bestCost[v]);
       }
     }
 
-    curGeometry.positions = positions;
-    curGeometry.normals = normals;
-    curGeometry.texUVs = texUVs;
-  }
-
-  //Now adjust the primitives to point to the new indexes of the submesh geometry vertices.
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::vector<unsigned short> > > newIndices;
-
-  //First create new indices from all the non-degenerate faces.
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-
-    std::tr1::unordered_map<int, int>& vertexMapping = vertexMapping1[i];
-    std::tr1::unordered_map<int, int>& oldToNewMap = vertexMapping2[i];
-
-    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
-      if (curGeometry.primitives[j].primitiveType != SubMeshGeometry::Primitive::TRIANGLES) continue;
-
-      std::vector<unsigned short>& indices = newIndices[i][j];
-
-      for (uint32 k = 0; k+2 < curGeometry.primitives[j].indices.size(); k+=3) {
-
-        unsigned short idx = curGeometry.primitives[j].indices[k];
-        unsigned short idx2 = curGeometry.primitives[j].indices[k+1];
-        unsigned short idx3 = curGeometry.primitives[j].indices[k+2];
-
-        if (idx == USHRT_MAX && idx2 == USHRT_MAX && idx3 == USHRT_MAX) {
-          continue;
-        }
-
-        idx = findMappedVertex(vertexMapping, idx);
-        idx2 = findMappedVertex(vertexMapping, idx2);
-        idx3 = findMappedVertex(vertexMapping, idx3);
+    while (countFaces > numFacesLeft && !heap.empty()) {
+      uint32 id = heap.top();
+      uint32 i = (std::upper_bound(geomBase.begin(), geomBase.end(), id) - geomBase.begin()) - 1;
+      GeometryData& data = geomData[i];
+      const std::vector<Vector3f>& positions = agg_mesh->geometry[i].positions;
+      uint32 v = id - geomBase[i];
+
+      // An earlier collapse may have removed the neighbor without touching
+      // this vertex, so just find its next best collapse.
+      if (data.parent[data.bestNeighbor[v]] != data.bestNeighbor[v]) {
+        computeBestCollapse(data, positions, v);
+        if (data.bestNeighbor[v] != NoVertex)
+          heap.set(id, data.bestCost[v]);
+        else
+          heap.remove(id);
+        continue;
+      }
 
-        if (idx != idx2 && idx2 != idx3 && idx != idx3) {
-          indices.push_back(oldToNewMap[idx]);
-          indices.push_back(oldToNewMap[idx2]);
-          indices.push_back(oldToNewMap[idx3]);
-        }
+      uint32 targetIdx = data.bestKeep[v];
+      uint32 sourceIdx = (targetIdx == v) ? data.bestNeighbor[v] : v;
+
+      // Collapse sourceIdx into targetIdx
+      data.parent[sourceIdx] = targetIdx;
+      data.quadrics[targetIdx].add(data.quadrics[sourceIdx]);
+      heap.remove(geomBase[i] + sourceIdx);
+
+      // Faces that had both vertices are now degenerate. The rest join
+      // targetIdx's faces when the member rings are merged.
+      DegenerateFaceRemover remover(data);
+      forEachFace(data, sourceIdx, remover);
+      countFaces -= (int64)remover.removed * data.transforms.size();
+      std::swap(data.nextMember[sourceIdx], data.nextMember[targetIdx]);
+
+      // Finally recompute the costs of the target and its neighbors, the only
+      // ones involving the changed quadric.
+      NeighborCollector collector(data, targetIdx);
+      forEachFace(data, targetIdx, collector);
+      std::sort(collector.neighbors.begin(), collector.neighbors.end());
+      collector.neighbors.erase(std::unique(collector.neighbors.begin(), collector.neighbors.end()), collector.neighbors.end());
+      collector.neighbors.push_back(targetIdx);
+      for (uint32 n = 0; n < collector.neighbors.size(); n++) {
+        uint32 vert = collector.neighbors[n];
+        computeBestCollapse(data, positions, vert);
+        if (data.bestNeighbor[vert] != NoVertex)
+          heap.set(geomBase[i] + vert, data.bestCost[vert]);
+        else
+          heap.remove(geomBase[i] + vert);
       }
     }
   }
-
-  //Now set the new indices.
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-
-    for (uint32 j = 0 ; j < curGeometry.primitives.size() ; j++) {
-      curGeometry.primitives[j].indices = newIndices[i][j];
-    }
+  else if (!meshChangedDuringPreprocess) {
+    return;
   }
+
+  parallelFor(ngeoms, mNumThreads, GeometryTask(&finishGeometry, agg_mesh->geometry, geomData));
+  agg_mesh->markModified();
 }
 
 }
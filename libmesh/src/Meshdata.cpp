@@ -216,6 +216,11 @@ bool MaterialEffectInfo::operator!=(const MaterialEffectInfo& rhs) const {
 
 String Meshdata::sType("Meshdata");
 
+Meshdata::Meshdata()
+ : generation(0)
+{
+}
+
 Meshdata::~Meshdata() {
 }
 
@@ -33,6 +33,13 @@
 #include <sirikata/mesh/Platform.hpp>
 #include <sirikata/mesh/Bounds.hpp>
 #include <sirikata/mesh/Raytrace.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SIRIKATA_RAYTRACE_USE_SSE 1
+#endif
 
 namespace Sirikata {
 namespace Mesh {
@@ -308,94 +315,491 @@ bool SIRIKATA_MESH_FUNCTION_EXPORT Raytrace(VisualPtr vis, const Matrix4x4f& vis
     return false;
 }
 
-bool SIRIKATA_MESH_FUNCTION_EXPORT RaytraceType(MeshdataPtr mesh, const Matrix4x4f& vis_xform, const Vector3f& ray_start, const Vector3f& ray_dir, float32* t_out, Vector3f* hit_out) {
-    bool found_hit = false;
+namespace {
 
-    bool have_hit = false;
-    float32 t = 1000000.0;
+// Hits further away than this are ignored
+#define RAYTRACE_MAX_T 1000000.f
+
+// Triangles per BVH leaf. Each leaf's triangles are tested together as one
+// packet.
+#define TRIANGLES_PER_LEAF 4
+// Instances per leaf of the BVH over instances.
+#define INSTANCES_PER_LEAF 2
+
+#define BVH_MAX_DEPTH 64
+
+struct BVHNode {
+    float32 bmin[3];
+    float32 bmax[3];
+    // For leaves, the first item in the leaf and the number of items. For
+    // interior nodes count is 0 and first is the index of the second child;
+    // the first child immediately follows the node.
+    uint32 first;
+    uint32 count;
+
+    bool leaf() const { return count > 0; }
+};
+typedef std::vector<BVHNode> BVHNodeList;
+
+// Up to TRIANGLES_PER_LEAF triangles, stored as structures of arrays so they
+// can be tested against a ray together. Each triangle is stored as a vertex and
+// its two edges. Unused slots are filled with degenerate triangles, which
+// can't be hit.
+struct TrianglePacket {
+    float32 v0[3][TRIANGLES_PER_LEAF];
+    float32 e1[3][TRIANGLES_PER_LEAF];
+    float32 e2[3][TRIANGLES_PER_LEAF];
+};
+typedef std::vector<TrianglePacket> TrianglePacketList;
+
+struct BuildItem {
+    BoundingBox3f3f bounds;
+    Vector3f centroid;
+    uint32 index;
+};
+typedef std::vector<BuildItem> BuildItemList;
+
+struct CentroidLess {
+    CentroidLess(int ax) : axis(ax) {}
+    bool operator()(const BuildItem& lhs, const BuildItem& rhs) const {
+        return lhs.centroid[axis] < rhs.centroid[axis];
+    }
+    int axis;
+};
+
+void setNodeBounds(BVHNode& node, const BoundingBox3f3f& bounds) {
+    Vector3f bmin = bounds.min(), bmax = bounds.max();
+    for(int i = 0; i < 3; i++) {
+        node.bmin[i] = bmin[i];
+        node.bmax[i] = bmax[i];
+    }
+}
 
-    // For each instanced geometry
-    Meshdata::GeometryInstanceIterator geoIter = mesh->getGeometryInstanceIterator();
-    uint32 indexInstance; Matrix4x4f transformInstance;
-    while(geoIter.next(&indexInstance, &transformInstance)) {
-        GeometryInstance& geoInst = mesh->instances[indexInstance];
-        const SubMeshGeometry& geo = mesh->geometry[ geoInst.geometryIndex ];
-
-        // We would transform all vertex data up front, but if we only have line
-        // or point data there's no point. Do it on demand, but transform
-        // everything at once when we know we need it.
-        // FIXME its probably better to invert transformInstance and transform
-        // the ray instead of the triangles.
-        std::vector<Vector3f> pos;
-
-        // Check each primitive in this geometry
-        for(uint32 pi = 0; pi < geo.primitives.size(); pi++) {
-            const SubMeshGeometry::Primitive& prim = geo.primitives[pi];
-            if (prim.primitiveType == SubMeshGeometry::Primitive::LINES ||
-                prim.primitiveType == SubMeshGeometry::Primitive::POINTS ||
-                prim.primitiveType == SubMeshGeometry::Primitive::LINESTRIPS)
-                continue;
-
-            // Transform all the positions on demand the first time we encounter
-            // a real need for them.
-            if (pos.empty()) {
-                pos.resize(geo.positions.size());
-                for(uint32 i = 0; i < geo.positions.size(); i++)
-                    pos[i] = vis_xform * transformInstance * geo.positions[i];
+// Builds a BVH over items[begin, end), splitting at the median of the
+// centroids along their longest axis. On return items is sorted so each
+// leaf refers to a contiguous range of it.
+void buildBVH(BuildItemList& items, uint32 begin, uint32 end, uint32 leaf_size, uint32 depth, BVHNodeList* nodes) {
+    uint32 node_idx = nodes->size();
+    nodes->push_back(BVHNode());
+
+    BoundingBox3f3f bounds = items[begin].bounds;
+    BoundingBox3f3f centroid_bounds(items[begin].centroid, items[begin].centroid);
+    for(uint32 i = begin+1; i < end; i++) {
+        bounds.mergeIn(items[i].bounds);
+        centroid_bounds.mergeIn(items[i].centroid);
+    }
+    setNodeBounds((*nodes)[node_idx], bounds);
+
+    if (end - begin <= leaf_size || depth >= BVH_MAX_DEPTH - 1) {
+        (*nodes)[node_idx].first = begin;
+        (*nodes)[node_idx].count = end - begin;
+        return;
+    }
+
+    Vector3f across = centroid_bounds.across();
+    int axis = 0;
+    if (across[1] > across[axis]) axis = 1;
+    if (across[2] > across[axis]) axis = 2;
+
+    uint32 mid = begin + (end - begin) / 2;
+    std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, CentroidLess(axis));
+
+    buildBVH(items, begin, mid, leaf_size, depth+1, nodes);
+    (*nodes)[node_idx].first = nodes->size();
+    (*nodes)[node_idx].count = 0;
+    buildBVH(items, mid, end, leaf_size, depth+1, nodes);
+}
+
+// A ray in some coordinate space, with its inverted direction for box tests.
+struct Ray {
+    Ray(const Vector3f& o, const Vector3f& d)
+     : origin(o), dir(d)
+    {
+        for(int i = 0; i < 3; i++)
+            invDir[i] = 1.f / dir[i];
+    }
+
+    Vector3f origin;
+    Vector3f dir;
+    float32 invDir[3];
+};
+
+// Returns whether the ray enters the box before t_max, setting t_enter to
+// where it enters.
+bool rayHitsBox(const Ray& ray, const BVHNode& node, float32 t_max, float32* t_enter) {
+    float32 tmin = 0, tmax = t_max;
+    for(int i = 0; i < 3; i++) {
+        float32 t1 = (node.bmin[i] - ray.origin[i]) * ray.invDir[i];
+        float32 t2 = (node.bmax[i] - ray.origin[i]) * ray.invDir[i];
+        // Rays parallel to a slab produce NaNs when they start on one of its
+        // planes; the comparisons below ignore them.
+        if (t1 > t2) std::swap(t1, t2);
+        if (t1 > tmin) tmin = t1;
+        if (t2 < tmax) tmax = t2;
+        if (tmin > tmax) return false;
+    }
+    *t_enter = tmin;
+    return true;
+}
+
+// Tests a ray against each triangle in the packet with Moller-Trumbore,
+// updating t_out if any are hit before it. Both sides of triangles are hit.
+bool rayHitsPacket(const Ray& ray, const TrianglePacket& packet, float32* t_out) {
+#ifdef SIRIKATA_RAYTRACE_USE_SSE
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+    __m128 dx = _mm_set1_ps(ray.dir.x), dy = _mm_set1_ps(ray.dir.y), dz = _mm_set1_ps(ray.dir.z);
+    __m128 e1x = _mm_loadu_ps(packet.e1[0]), e1y = _mm_loadu_ps(packet.e1[1]), e1z = _mm_loadu_ps(packet.e1[2]);
+    __m128 e2x = _mm_loadu_ps(packet.e2[0]), e2y = _mm_loadu_ps(packet.e2[1]), e2z = _mm_loadu_ps(packet.e2[2]);
+
+    // p = dir x e2, det = e1 . p
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 valid = _mm_cmpneq_ps(det, zero);
+    __m128 inv_det = _mm_div_ps(one, det);
+
+    // s = origin - v0, u = (s . p) / det
+    __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(packet.v0[0]));
+    __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(packet.v0[1]));
+    __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(packet.v0[2]));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+
+    // q = s x e1, v = (dir . q) / det, t = (e2 . q) / det
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(*t_out)));
+
+    int mask = _mm_movemask_ps(valid);
+    if (mask == 0) return false;
+
+    float32 ts[TRIANGLES_PER_LEAF];
+    _mm_storeu_ps(ts, t);
+    for(int i = 0; i < TRIANGLES_PER_LEAF; i++) {
+        if ((mask & (1 << i)) && ts[i] <= *t_out)
+            *t_out = ts[i];
+    }
+    return true;
+#else
+    bool hit = false;
+    for(int i = 0; i < TRIANGLES_PER_LEAF; i++) {
+        Vector3f e1(packet.e1[0][i], packet.e1[1][i], packet.e1[2][i]);
+        Vector3f e2(packet.e2[0][i], packet.e2[1][i], packet.e2[2][i]);
+        Vector3f p = ray.dir.cross(e2);
+        float32 det = e1.dot(p);
+        if (det == 0) continue;
+        float32 inv_det = 1.f / det;
+
+        Vector3f s = ray.origin - Vector3f(packet.v0[0][i], packet.v0[1][i], packet.v0[2][i]);
+        float32 u = s.dot(p) * inv_det;
+        if (u < 0 || u > 1) continue;
+        Vector3f q = s.cross(e1);
+        float32 v = ray.dir.dot(q) * inv_det;
+        if (v < 0 || u + v > 1) continue;
+        float32 t = e2.dot(q) * inv_det;
+        if (t < 0 || t > *t_out) continue;
+
+        *t_out = t;
+        hit = true;
+    }
+    return hit;
+#endif
+}
+
+// Finds the closest hit in the BVH, calling hit_leaf(ray, leaf, t_out) to test
+// the items in each leaf the ray reaches.
+template<typename LeafTest>
+bool traceBVH(const BVHNodeList& nodes, const Ray& ray, LeafTest& hit_leaf, float32* t_out) {
+    if (nodes.empty()) return false;
+
+    bool hit = false;
+    uint32 stack[BVH_MAX_DEPTH];
+    uint32 stack_size = 0;
+    stack[stack_size++] = 0;
+    while(stack_size > 0) {
+        const BVHNode& node = nodes[stack[--stack_size]];
+        float32 t_enter;
+        if (!rayHitsBox(ray, node, *t_out, &t_enter))
+            continue;
+
+        if (node.leaf()) {
+            if (hit_leaf(ray, node, t_out))
+                hit = true;
+            continue;
+        }
+
+        // Visit the nearer child first, so hits there can cull the other
+        uint32 left = &node - &nodes[0] + 1, right = node.first;
+        float32 t_left, t_right;
+        bool hits_left = rayHitsBox(ray, nodes[left], *t_out, &t_left);
+        bool hits_right = rayHitsBox(ray, nodes[right], *t_out, &t_right);
+        if (hits_left && hits_right) {
+            if (t_left < t_right) std::swap(left, right);
+            stack[stack_size++] = left;
+            stack[stack_size++] = right;
+        }
+        else if (hits_left) {
+            stack[stack_size++] = left;
+        }
+        else if (hits_right) {
+            stack[stack_size++] = right;
+        }
+    }
+    return hit;
+}
+
+Vector3f transformPoint(const Matrix4x4f& xform, const Vector3f& p) {
+    return Vector3f(
+        xform(0,0)*p.x + xform(0,1)*p.y + xform(0,2)*p.z + xform(0,3),
+        xform(1,0)*p.x + xform(1,1)*p.y + xform(1,2)*p.z + xform(1,3),
+        xform(2,0)*p.x + xform(2,1)*p.y + xform(2,2)*p.z + xform(2,3)
+    );
+}
+
+Vector3f transformDirection(const Matrix4x4f& xform, const Vector3f& d) {
+    return Vector3f(
+        xform(0,0)*d.x + xform(0,1)*d.y + xform(0,2)*d.z,
+        xform(1,0)*d.x + xform(1,1)*d.y + xform(1,2)*d.z,
+        xform(2,0)*d.x + xform(2,1)*d.y + xform(2,2)*d.z
+    );
+}
+
+} // namespace
+
+/** Everything needed to raytrace a Meshdata without touching its triangles
+ *  individually: a BVH over the triangles of each instanced SubMeshGeometry
+ *  in its own coordinate space, and a BVH over the instances in mesh space.
+ *  Rays are transformed into each instance's space rather than transforming
+ *  the geometry. Since the transforms are affine, the parametric value of a
+ *  hit is the same in every space.
+ */
+struct RaytraceAccelerator {
+    struct Geometry {
+        BVHNodeList nodes;
+        TrianglePacketList packets;
+    };
+    typedef std::vector<Geometry> GeometryList;
+
+    struct Instance {
+        uint32 geometry;
+        // Inverse of the instance's transform
+        Matrix4x4f toInstance;
+    };
+    typedef std::vector<Instance> InstanceList;
+
+    // Meshdata::generation of the mesh when this was built
+    uint64 generation;
+
+    GeometryList geometry;
+    InstanceList instances;
+    BVHNodeList instanceNodes;
+
+    void buildGeometry(const SubMeshGeometry& geo, Geometry* out);
+
+    // Tests a ray, in mesh space, against the instances in an instanceNodes
+    // leaf
+    bool operator()(const Ray& ray, const BVHNode& leaf, float32* t_out);
+};
+
+// Tests a ray, in instance space, against the triangle packet in a leaf
+struct PacketLeafTest {
+    PacketLeafTest(const TrianglePacketList& p) : packets(p) {}
+    bool operator()(const Ray& ray, const BVHNode& leaf, float32* t_out) {
+        return rayHitsPacket(ray, packets[leaf.first], t_out);
+    }
+    const TrianglePacketList& packets;
+};
+
+bool RaytraceAccelerator::operator()(const Ray& ray, const BVHNode& leaf, float32* t_out) {
+    bool hit = false;
+    for(uint32 i = leaf.first; i < leaf.first + leaf.count; i++) {
+        const Instance& inst = instances[i];
+        Ray inst_ray(transformPoint(inst.toInstance, ray.origin), transformDirection(inst.toInstance, ray.dir));
+        PacketLeafTest leaf_test(geometry[inst.geometry].packets);
+        if (traceBVH(geometry[inst.geometry].nodes, inst_ray, leaf_test, t_out))
+            hit = true;
+    }
+    return hit;
+}
+
+void RaytraceAccelerator::buildGeometry(const SubMeshGeometry& geo, Geometry* out) {
+    // Collect triangles from all the triangle-based primitives
+    std::vector<uint32> tris;
+    for(uint32 pi = 0; pi < geo.primitives.size(); pi++) {
+        const SubMeshGeometry::Primitive& prim = geo.primitives[pi];
+        switch(prim.primitiveType) {
+          case SubMeshGeometry::Primitive::TRIANGLES:
+            for(uint32 ii = 0; ii+2 < prim.indices.size(); ii+=3) {
+                tris.push_back(prim.indices[ii]);
+                tris.push_back(prim.indices[ii+1]);
+                tris.push_back(prim.indices[ii+2]);
+            }
+            break;
+          case SubMeshGeometry::Primitive::TRISTRIPS:
+            for(uint32 ii = 0; ii+2 < prim.indices.size(); ii++) {
+                uint32 i1 = (ii % 2 == 0) ? ii : ii+1;
+                uint32 i2 = (ii % 2 == 0) ? ii+1 : ii;
+                tris.push_back(prim.indices[i1]);
+                tris.push_back(prim.indices[i2]);
+                tris.push_back(prim.indices[ii+2]);
+            }
+            break;
+          case SubMeshGeometry::Primitive::TRIFANS:
+            for(uint32 ii = 1; ii+1 < prim.indices.size(); ii++) {
+                tris.push_back(prim.indices[0]);
+                tris.push_back(prim.indices[ii]);
+                tris.push_back(prim.indices[ii+1]);
             }
+            break;
+          case SubMeshGeometry::Primitive::LINES:
+          case SubMeshGeometry::Primitive::POINTS:
+          case SubMeshGeometry::Primitive::LINESTRIPS:
+            break;
+        }
+    }
 
-            // Now we actually perform checks against transformed
-            // triangles. Each of these will just generate a list of triangle
-            // and defer to a helper to check for intersection and update the
-            // state.
-            switch(prim.primitiveType) {
-              case SubMeshGeometry::Primitive::TRIANGLES:
-                for(uint32 ii = 0; ii < prim.indices.size()/3; ii++) {
-                    have_hit = have_hit ||
-                        RaytraceTriangle(
-                            pos[prim.indices[3*ii]],
-                            pos[prim.indices[3*ii+1]],
-                            pos[prim.indices[3*ii+2]],
-                            ray_start, ray_dir,
-                            &t
-                        );
-                }
-                break;
-              case SubMeshGeometry::Primitive::TRISTRIPS:
-                for(uint32 ii = 0; ii < prim.indices.size()-2; ii++) {
-                    uint32 i1 = (ii % 2 == 0) ? ii : ii+1;
-                    uint32 i2 = (ii % 2 == 0) ? ii+1 : ii;
-                    uint32 i3 = ii+2;
-                    have_hit = have_hit ||
-                        RaytraceTriangle(
-                            pos[prim.indices[i1]],
-                            pos[prim.indices[i2]],
-                            pos[prim.indices[i3]],
-                            ray_start, ray_dir,
-                            &t
-                        );
-                }
-                break;
-              case SubMeshGeometry::Primitive::TRIFANS:
-                for(uint32 ii = 1; ii < prim.indices.size()-1; ii++) {
-                    have_hit = have_hit ||
-                        RaytraceTriangle(
-                            pos[prim.indices[0]],
-                            pos[prim.indices[ii]],
-                            pos[prim.indices[ii+1]],
-                            ray_start, ray_dir,
-                            &t
-                        );
-                }
-                break;
-              case SubMeshGeometry::Primitive::LINES:
-              case SubMeshGeometry::Primitive::POINTS:
-              case SubMeshGeometry::Primitive::LINESTRIPS:
-                assert(false && "Shouldn't reach these cases since they were handled earlier.");
-                break;
+    BuildItemList items;
+    for(uint32 i = 0; i+2 < tris.size(); i+=3) {
+        if (tris[i] >= geo.positions.size() || tris[i+1] >= geo.positions.size() || tris[i+2] >= geo.positions.size())
+            continue;
+        const Vector3f& v1 = geo.positions[tris[i]];
+        const Vector3f& v2 = geo.positions[tris[i+1]];
+        const Vector3f& v3 = geo.positions[tris[i+2]];
+        BuildItem item;
+        item.bounds = BoundingBox3f3f(v1, v1);
+        item.bounds.mergeIn(v2);
+        item.bounds.mergeIn(v3);
+        item.centroid = (v1 + v2 + v3) / 3.f;
+        item.index = i;
+        items.push_back(item);
+    }
+    if (items.empty()) return;
+
+    buildBVH(items, 0, items.size(), TRIANGLES_PER_LEAF, 0, &out->nodes);
+
+    // Replace each leaf's range of triangles with a packet holding them
+    for(uint32 ni = 0; ni < out->nodes.size(); ni++) {
+        BVHNode& node = out->nodes[ni];
+        if (!node.leaf()) continue;
+
+        TrianglePacket packet;
+        memset(&packet, 0, sizeof(packet));
+        for(uint32 k = 0; k < node.count && k < TRIANGLES_PER_LEAF; k++) {
+            uint32 i = items[node.first + k].index;
+            const Vector3f& v1 = geo.positions[tris[i]];
+            Vector3f e1 = geo.positions[tris[i+1]] - v1;
+            Vector3f e2 = geo.positions[tris[i+2]] - v1;
+            for(int c = 0; c < 3; c++) {
+                packet.v0[c][k] = v1[c];
+                packet.e1[c][k] = e1[c];
+                packet.e2[c][k] = e2[c];
             }
         }
+        node.first = out->packets.size();
+        out->packets.push_back(packet);
     }
+}
+
+namespace {
+
+boost::mutex gAcceleratorMutex;
+
+std::tr1::shared_ptr<RaytraceAccelerator> buildAccelerator(const Meshdata& mesh, uint64 generation) {
+    std::tr1::shared_ptr<RaytraceAccelerator> accel(new RaytraceAccelerator());
+    accel->generation = generation;
+    accel->geometry.resize(mesh.geometry.size());
+
+    std::vector<bool> built(mesh.geometry.size(), false);
+    BuildItemList items;
+    Meshdata::GeometryInstanceIterator geoIter = mesh.getGeometryInstanceIterator();
+    uint32 indexInstance; Matrix4x4f transformInstance;
+    while(geoIter.next(&indexInstance, &transformInstance)) {
+        uint32 gi = mesh.instances[indexInstance].geometryIndex;
+        if (!built[gi]) {
+            accel->buildGeometry(mesh.geometry[gi], &accel->geometry[gi]);
+            built[gi] = true;
+        }
+        const BVHNodeList& geo_nodes = accel->geometry[gi].nodes;
+        if (geo_nodes.empty()) continue;
+
+        // Instances with singular transforms are flat, so they can't be hit
+        RaytraceAccelerator::Instance inst;
+        inst.geometry = gi;
+        if (transformInstance.invert(inst.toInstance) == 0) continue;
+
+        BuildItem item;
+        const BVHNode& root = geo_nodes[0];
+        for(int corner = 0; corner < 8; corner++) {
+            Vector3f p = transformPoint(transformInstance, Vector3f(
+                    (corner & 1) ? root.bmax[0] : root.bmin[0],
+                    (corner & 2) ? root.bmax[1] : root.bmin[1],
+                    (corner & 4) ? root.bmax[2] : root.bmin[2]
+                ));
+            if (corner == 0) item.bounds = BoundingBox3f3f(p, p);
+            else item.bounds.mergeIn(p);
+        }
+        item.centroid = item.bounds.center();
+        item.index = accel->instances.size();
+        items.push_back(item);
+        accel->instances.push_back(inst);
+    }
+    if (items.empty()) return accel;
+
+    buildBVH(items, 0, items.size(), INSTANCES_PER_LEAF, 0, &accel->instanceNodes);
+    // Reorder instances so each leaf covers a contiguous range
+    RaytraceAccelerator::InstanceList ordered;
+    for(uint32 i = 0; i < items.size(); i++)
+        ordered.push_back(accel->instances[items[i].index]);
+    accel->instances.swap(ordered);
+
+    return accel;
+}
+
+std::tr1::shared_ptr<RaytraceAccelerator> getAccelerator(MeshdataPtr mesh) {
+    std::tr1::shared_ptr<RaytraceAccelerator> accel;
+    uint64 generation;
+    {
+        boost::lock_guard<boost::mutex> lck(gAcceleratorMutex);
+        accel = mesh->raytraceAccelerator;
+        generation = mesh->generation;
+    }
+    if (accel && accel->generation == generation)
+        return accel;
+
+    // Built without the lock held. If multiple threads end up doing this at
+    // the same time, they'll build identical structures and the last wins.
+    accel = buildAccelerator(*mesh, generation);
+    {
+        boost::lock_guard<boost::mutex> lck(gAcceleratorMutex);
+        mesh->raytraceAccelerator = accel;
+    }
+    return accel;
+}
+
+bool traceAccelerator(RaytraceAccelerator& accel, const Matrix4x4f& to_mesh, const Vector3f& ray_start, const Vector3f& ray_dir, float32* t_out) {
+    Ray ray(transformPoint(to_mesh, ray_start), transformDirection(to_mesh, ray_dir));
+    *t_out = RAYTRACE_MAX_T;
+    return traceBVH(accel.instanceNodes, ray, accel, t_out);
+}
+
+} // namespace
+
+bool SIRIKATA_MESH_FUNCTION_EXPORT RaytraceType(MeshdataPtr mesh, const Matrix4x4f& vis_xform, const Vector3f& ray_start, const Vector3f& ray_dir, float32* t_out, Vector3f* hit_out) {
+    // A singular transform flattens the mesh, so it can't be hit
+    Matrix4x4f to_mesh;
+    if (vis_xform.invert(to_mesh) == 0) return false;
+
+    std::tr1::shared_ptr<RaytraceAccelerator> accel = getAccelerator(mesh);
+    float32 t;
+    bool have_hit = traceAccelerator(*accel, to_mesh, ray_start, ray_dir, &t);
 
     // Provide output
     if (have_hit) {
@@ -405,6 +809,50 @@ bool SIRIKATA_MESH_FUNCTION_EXPORT RaytraceType(MeshdataPtr mesh, const Matrix4x
     return have_hit;
 }
 
+uint32 SIRIKATA_MESH_FUNCTION_EXPORT Raytrace(VisualPtr vis, const Matrix4x4f& vis_xform, const std::vector<Vector3f>& ray_starts, const std::vector<Vector3f>& ray_dirs, RaytraceResultList* results_out) {
+    MeshdataPtr md(std::tr1::dynamic_pointer_cast<Meshdata>(vis));
+    if (md) return RaytraceType(md, vis_xform, ray_starts, ray_dirs, results_out);
+
+    BillboardPtr bboard(std::tr1::dynamic_pointer_cast<Billboard>(vis));
+    if (bboard) return RaytraceType(bboard, vis_xform, ray_starts, ray_dirs, results_out);
+
+    results_out->assign(ray_starts.size(), RaytraceResult());
+    return 0;
+}
+
+uint32 SIRIKATA_MESH_FUNCTION_EXPORT RaytraceType(MeshdataPtr mesh, const Matrix4x4f& vis_xform, const std::vector<Vector3f>& ray_starts, const std::vector<Vector3f>& ray_dirs, RaytraceResultList* results_out) {
+    assert(ray_starts.size() == ray_dirs.size());
+    results_out->assign(ray_starts.size(), RaytraceResult());
+
+    Matrix4x4f to_mesh;
+    if (vis_xform.invert(to_mesh) == 0) return 0;
+
+    std::tr1::shared_ptr<RaytraceAccelerator> accel = getAccelerator(mesh);
+    uint32 nhits = 0;
+    for(uint32 i = 0; i < ray_starts.size(); i++) {
+        RaytraceResult& result = (*results_out)[i];
+        result.hit = traceAccelerator(*accel, to_mesh, ray_starts[i], ray_dirs[i], &result.t);
+        if (result.hit) {
+            result.point = ray_starts[i] + ray_dirs[i] * result.t;
+            nhits++;
+        }
+    }
+    return nhits;
+}
+
+uint32 SIRIKATA_MESH_FUNCTION_EXPORT RaytraceType(BillboardPtr bboard, const Matrix4x4f& vis_xform, const std::vector<Vector3f>& ray_starts, const std::vector<Vector3f>& ray_dirs, RaytraceResultList* results_out) {
+    assert(ray_starts.size() == ray_dirs.size());
+    results_out->assign(ray_starts.size(), RaytraceResult());
+
+    uint32 nhits = 0;
+    for(uint32 i = 0; i < ray_starts.size(); i++) {
+        RaytraceResult& result = (*results_out)[i];
+        result.hit = RaytraceType(bboard, vis_xform, ray_starts[i], ray_dirs[i], &result.t, &result.point);
+        if (result.hit) nhits++;
+    }
+    return nhits;
+}
+
 bool SIRIKATA_MESH_FUNCTION_EXPORT RaytraceType(BillboardPtr bboard, const Matrix4x4f& vis_xform, const Vector3f& ray_start, const Vector3f& ray_dir, float32* t_out, Vector3f* hit_out) {
     bool found_hit = false;
 
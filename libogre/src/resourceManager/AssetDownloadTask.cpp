@@ -36,6 +36,8 @@
 #include <sirikata/mesh/Meshdata.hpp>
 #include <sirikata/mesh/Billboard.hpp>
 #include <sirikata/core/transfer/URL.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
+#include <sirikata/core/util/Timer.hpp>
 
 using namespace std::tr1::placeholders;
 using namespace Sirikata::Transfer;
@@ -117,6 +119,11 @@ void AssetDownloadTask::downloadAssetFile() {
         mPriority,
         std::tr1::bind(&AssetDownloadTask::weakAssetFileDownloaded, getWeakPtr(), _1, _2, _3)
     );
+    // Nothing can be shown until the mesh itself arrives, so it gets a
+    // deadline to keep it from waiting behind a backlog of other downloads
+    Duration deadline = GetOptionValue<Duration>(OPT_TRANSFER_MESH_DEADLINE);
+    if (deadline > Duration::zero())
+        dl->setDeadline(Timer::now() + deadline);
     mActiveDownloads[dl->getIdentifier()] = dl;
     dl->start();
 }
@@ -0,0 +1,750 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "LogStorage.hpp"
+#include <sirikata/oh/ObjectHostContext.hpp>
+#include <cstring>
+
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Sirikata {
+namespace OH {
+
+/** Log Format
+ *  ----------
+ *
+ *  The log starts with an 8 byte magic string, followed by records. Each
+ *  record is
+ *
+ *    uint32 payload size
+ *    uint32 FNV-1a hash of the payload
+ *    payload
+ *
+ *  and each payload is a sequence of entries, one per key modified by the
+ *  transaction:
+ *
+ *    uint8 type (EntryWrite or EntryErase)
+ *    16 bytes bucket UUID
+ *    uint32 key length, key
+ *    uint32 value length, value (only for EntryWrite)
+ *
+ *  All integers are little endian. Compacted logs have the same format, with
+ *  one record per bucket holding all its keys.
+ */
+
+namespace {
+
+const char LogMagic[8] = { 'S', 'K', 'L', 'O', 'G', 0, 0, 1 };
+const uint32 RecordHeaderSize = 8;
+
+enum EntryType {
+    EntryWrite = 1,
+    EntryErase = 2
+};
+
+// Fixed size of an entry, excluding key and value data
+const uint32 EntryOverhead = 1 + UUID::static_size + 4 + 4;
+
+void appendUInt32(String* out, uint32 v) {
+    char bytes[4] = { (char)(v & 0xFF), (char)((v >> 8) & 0xFF), (char)((v >> 16) & 0xFF), (char)((v >> 24) & 0xFF) };
+    out->append(bytes, 4);
+}
+
+uint32 readUInt32(const char* data) {
+    const uint8* bytes = (const uint8*)data;
+    return (uint32)bytes[0] | ((uint32)bytes[1] << 8) | ((uint32)bytes[2] << 16) | ((uint32)bytes[3] << 24);
+}
+
+uint32 checksum(const char* data, uint32 size) {
+    uint32 hash = 2166136261u;
+    for(uint32 i = 0; i < size; i++) {
+        hash ^= (uint8)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint64 entrySize(const String& key, const String& value) {
+    return EntryOverhead + key.size() + value.size();
+}
+
+struct ReplayEntry {
+    uint8 type;
+    UUID bucket;
+    String key;
+    String value;
+};
+
+} // namespace
+
+LogStorage::LogStorage(ObjectHostContext* ctx, const String& logpath, bool sync, float32 compact_ratio, uint64 compact_min_size)
+ : mContext(ctx),
+   mLogFilename(logpath),
+   mSync(sync),
+   mCompactRatio(compact_ratio),
+   mCompactMinSize(compact_min_size),
+   mIOService(NULL),
+   mWork(NULL),
+   mThread(NULL),
+   mLiveBytes(0),
+   mFlushPosted(false),
+   mLog(NULL),
+   mLogSize(0),
+   mLogDirty(false)
+{
+}
+
+LogStorage::~LogStorage()
+{
+}
+
+void LogStorage::start() {
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        bool bad_tail = false;
+        if (replay(&bad_tail)) {
+            // A bad tail has to be removed before we can append anything, and
+            // compacting is the portable way to truncate the file.
+            if (bad_tail || shouldCompact()) {
+                if (!compact(lock) && bad_tail) {
+                    SILOG(log-storage, error, "Couldn't remove corrupted tail from " << mLogFilename << ", changes will not be saved");
+                    if (mLog != NULL) {
+                        std::fclose(mLog);
+                        mLog = NULL;
+                    }
+                }
+            }
+            else {
+                openLog();
+            }
+        }
+    }
+
+    mIOService = new Network::IOService("LogStorage");
+    mWork = new Network::IOWork(*mIOService, "LogStorage IO Thread");
+    mThread = new Sirikata::Thread("LogStorage IO", std::tr1::bind(&Network::IOService::runNoReturn, mIOService));
+}
+
+void LogStorage::stop() {
+    // Let the IO thread finish writing anything outstanding
+    delete mWork;
+    mWork = NULL;
+    mThread->join();
+    delete mThread;
+    mThread = NULL;
+    delete mIOService;
+    mIOService = NULL;
+
+    // Anything committed since the last flush was posted
+    flush();
+
+    if (mLog != NULL) {
+        std::fclose(mLog);
+        mLog = NULL;
+    }
+
+    // Clean up data from any outstanding pending transactions
+    for(BucketTransactions::iterator it = mTransactions.begin(); it != mTransactions.end(); it++)
+        delete it->second;
+    mTransactions.clear();
+}
+
+LogStorage::Transaction* LogStorage::getTransaction(const Bucket& bucket, bool* is_new) {
+    BucketTransactions::iterator it = mTransactions.find(bucket);
+    if (it != mTransactions.end())
+        return it->second;
+
+    if (is_new != NULL) *is_new = true;
+    Transaction* trans = new Transaction();
+    mTransactions[bucket] = trans;
+    return trans;
+}
+
+void LogStorage::leaseBucket(const Bucket& bucket) {
+    // Single process access, no leases required
+}
+
+void LogStorage::releaseBucket(const Bucket& bucket) {
+}
+
+void LogStorage::beginTransaction(const Bucket& bucket) {
+    getTransaction(bucket);
+}
+
+void LogStorage::addAction(const Bucket& bucket, Action::Type type, const Key& key, const Key& key_end, const String& value, const CommitCallback& cb) {
+    bool is_new = false;
+    Transaction* trans = getTransaction(bucket, &is_new);
+    trans->push_back(Action());
+    Action& action = trans->back();
+    action.type = type;
+    action.key = key;
+    action.keyEnd = key_end;
+    action.value = value;
+
+    // Run commit if this is a one-off transaction
+    if (is_new)
+        commitTransaction(bucket, cb);
+}
+
+bool LogStorage::erase(const Bucket& bucket, const Key& key, const CommitCallback& cb, const String& timestamp) {
+    addAction(bucket, Action::Erase, key, "", "", cb);
+    return true;
+}
+
+bool LogStorage::write(const Bucket& bucket, const Key& key, const String& value, const CommitCallback& cb, const String& timestamp) {
+    addAction(bucket, Action::Write, key, "", value, cb);
+    return true;
+}
+
+bool LogStorage::read(const Bucket& bucket, const Key& key, const CommitCallback& cb, const String& timestamp) {
+    addAction(bucket, Action::Read, key, "", "", cb);
+    return true;
+}
+
+bool LogStorage::compare(const Bucket& bucket, const Key& key, const String& value, const CommitCallback& cb, const String& timestamp) {
+    addAction(bucket, Action::Compare, key, "", value, cb);
+    return true;
+}
+
+bool LogStorage::rangeRead(const Bucket& bucket, const Key& start, const Key& finish, const CommitCallback& cb, const String& timestamp) {
+    addAction(bucket, Action::ReadRange, start, finish, "", cb);
+    return true;
+}
+
+bool LogStorage::rangeErase(const Bucket& bucket, const Key& start, const Key& finish, const CommitCallback& cb, const String& timestamp) {
+    addAction(bucket, Action::EraseRange, start, finish, "", cb);
+    return true;
+}
+
+bool LogStorage::count(const Bucket& bucket, const Key& start, const Key& finish, const CountCallback& cb, const String& timestamp) {
+    int32 count = 0;
+    if (!(finish < start)) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        Data::const_iterator bucket_it = mData.find(bucket);
+        if (bucket_it != mData.end()) {
+            const BucketData& bucket_data = bucket_it->second;
+            count = (int32)std::distance(bucket_data.lower_bound(start), bucket_data.upper_bound(finish));
+        }
+    }
+
+    if (cb) {
+        mContext->mainStrand->post(
+            std::tr1::bind(cb, SUCCESS, count),
+            "LogStorage completeCount"
+        );
+    }
+    return true;
+}
+
+void LogStorage::commitTransaction(const Bucket& bucket, const CommitCallback& cb, const String& timestamp) {
+    Transaction* trans = getTransaction(bucket);
+    mTransactions.erase(bucket);
+
+    // Short cut for empty transactions
+    if (trans->empty()) {
+        delete trans;
+        ReadSet* rs = NULL;
+        if (cb) cb(SUCCESS, rs);
+        return;
+    }
+
+    ReadSet* rs = new ReadSet;
+    Changes changes;
+    UndoLog undo;
+
+    boost::unique_lock<boost::mutex> lock(mMutex);
+
+    Data::const_iterator bucket_it = mData.find(bucket);
+    Result result = executeTransaction(
+        (bucket_it != mData.end() ? &bucket_it->second : NULL),
+        *trans, rs, &changes
+    );
+    if (result == SUCCESS && !changes.empty())
+        applyChanges(bucket, changes, &undo);
+    // changes refers to values in the transaction, so this has to wait until
+    // they've been applied
+    delete trans;
+
+    if (rs->empty() || result != SUCCESS) {
+        delete rs;
+        rs = NULL;
+    }
+
+    // Successful commits that modified data have to wait for their record to
+    // be written. Others don't, but if there are other commits waiting they
+    // queue up behind them so callbacks still occur in commit order. Before
+    // start() and after stop() there's no IO thread to wait for.
+    bool logged = (result == SUCCESS && !changes.empty());
+    if (mIOService != NULL && (logged || !mPendingCommits.empty())) {
+        mPendingCommits.push_back(PendingCommit());
+        PendingCommit& pending = mPendingCommits.back();
+        pending.cb = cb;
+        pending.rs = rs;
+        pending.result = result;
+        pending.logged = logged;
+        pending.undo.swap(undo);
+        postFlush();
+        return;
+    }
+    lock.unlock();
+
+    if (cb) {
+        mContext->mainStrand->post(
+            std::tr1::bind(cb, result, rs),
+            "LogStorage completeCommit"
+        );
+    }
+    else {
+        delete rs;
+    }
+}
+
+const String* LogStorage::lookup(const BucketData* bucket_data, const Changes& changes, const Key& key) {
+    Changes::const_iterator change_it = changes.find(key);
+    if (change_it != changes.end())
+        return change_it->second;
+
+    if (bucket_data == NULL) return NULL;
+    BucketData::const_iterator it = bucket_data->find(key);
+    if (it == bucket_data->end()) return NULL;
+    return &(it->second);
+}
+
+Storage::Result LogStorage::executeTransaction(const BucketData* bucket_data, const Transaction& trans, ReadSet* rs, Changes* changes) {
+    for(Transaction::const_iterator it = trans.begin(); it != trans.end(); it++) {
+        const Action& action = *it;
+        switch(action.type) {
+          case Action::Read:
+              {
+                  const String* value = lookup(bucket_data, *changes, action.key);
+                  if (value == NULL) return TRANSACTION_ERROR;
+                  (*rs)[action.key] = *value;
+              }
+              break;
+          case Action::Compare:
+              {
+                  const String* value = lookup(bucket_data, *changes, action.key);
+                  if (value == NULL || *value != action.value) return TRANSACTION_ERROR;
+              }
+              break;
+          case Action::ReadRange:
+              {
+                  if (action.keyEnd < action.key) return TRANSACTION_ERROR;
+                  // Merge the stored values with this transaction's changes
+                  ReadSet range;
+                  if (bucket_data != NULL) {
+                      BucketData::const_iterator end = bucket_data->upper_bound(action.keyEnd);
+                      for(BucketData::const_iterator data_it = bucket_data->lower_bound(action.key); data_it != end; data_it++)
+                          range[data_it->first] = data_it->second;
+                  }
+                  Changes::const_iterator end = changes->upper_bound(action.keyEnd);
+                  for(Changes::const_iterator change_it = changes->lower_bound(action.key); change_it != end; change_it++) {
+                      if (change_it->second == NULL)
+                          range.erase(change_it->first);
+                      else
+                          range[change_it->first] = *(change_it->second);
+                  }
+                  // Like a missing key in a normal read, an empty range is an
+                  // error
+                  if (range.empty()) return TRANSACTION_ERROR;
+                  for(ReadSet::iterator range_it = range.begin(); range_it != range.end(); range_it++)
+                      (*rs)[range_it->first].swap(range_it->second);
+              }
+              break;
+          case Action::Write:
+            (*changes)[action.key] = &action.value;
+            break;
+          case Action::Erase:
+            // Erasing missing keys is allowed
+            (*changes)[action.key] = NULL;
+            break;
+          case Action::EraseRange:
+              {
+                  if (action.keyEnd < action.key) break;
+                  if (bucket_data != NULL) {
+                      BucketData::const_iterator end = bucket_data->upper_bound(action.keyEnd);
+                      for(BucketData::const_iterator data_it = bucket_data->lower_bound(action.key); data_it != end; data_it++)
+                          (*changes)[data_it->first] = NULL;
+                  }
+                  Changes::iterator end = changes->upper_bound(action.keyEnd);
+                  for(Changes::iterator change_it = changes->lower_bound(action.key); change_it != end; change_it++)
+                      change_it->second = NULL;
+              }
+              break;
+        }
+    }
+    return SUCCESS;
+}
+
+void LogStorage::applyChanges(const Bucket& bucket, const Changes& changes, UndoLog* undo) {
+    BucketData& bucket_data = mData[bucket];
+
+    String payload;
+    for(Changes::const_iterator it = changes.begin(); it != changes.end(); it++) {
+        BucketData::iterator data_it = bucket_data.find(it->first);
+        if (data_it != bucket_data.end() || it->second != NULL) {
+            undo->push_back(UndoEntry());
+            UndoEntry& entry = undo->back();
+            entry.bucket = bucket;
+            entry.key = it->first;
+            entry.existed = (data_it != bucket_data.end());
+            if (entry.existed)
+                entry.value = data_it->second;
+        }
+
+        if (data_it != bucket_data.end()) {
+            mLiveBytes -= entrySize(data_it->first, data_it->second);
+            if (it->second == NULL)
+                bucket_data.erase(data_it);
+            else
+                data_it->second = *(it->second);
+        }
+        else if (it->second != NULL) {
+            bucket_data[it->first] = *(it->second);
+        }
+        else {
+            // Erasing a key that doesn't exist doesn't need to be recorded
+            continue;
+        }
+        if (it->second != NULL)
+            mLiveBytes += entrySize(it->first, *(it->second));
+
+        serializeEntry(&payload, (it->second == NULL ? EntryErase : EntryWrite), bucket, it->first, it->second);
+    }
+    if (bucket_data.empty())
+        mData.erase(bucket);
+
+    if (!payload.empty())
+        appendRecord(&mPendingLog, payload);
+}
+
+void LogStorage::undoChanges(const UndoLog& undo) {
+    // Newest first, so a key changed more than once ends up with the value it
+    // had before any of them
+    for(UndoLog::const_reverse_iterator it = undo.rbegin(); it != undo.rend(); it++) {
+        BucketData& bucket_data = mData[it->bucket];
+        BucketData::iterator data_it = bucket_data.find(it->key);
+        if (data_it != bucket_data.end()) {
+            mLiveBytes -= entrySize(data_it->first, data_it->second);
+            bucket_data.erase(data_it);
+        }
+        if (it->existed) {
+            mLiveBytes += entrySize(it->key, it->value);
+            bucket_data[it->key] = it->value;
+        }
+        if (bucket_data.empty())
+            mData.erase(it->bucket);
+    }
+}
+
+void LogStorage::serializeEntry(String* out, uint8 type, const Bucket& bucket, const Key& key, const String* value) {
+    out->push_back((char)type);
+    out->append((const char*)bucket.getArray().data(), UUID::static_size);
+    appendUInt32(out, key.size());
+    out->append(key);
+    if (type == EntryWrite) {
+        appendUInt32(out, value->size());
+        out->append(*value);
+    }
+}
+
+void LogStorage::appendRecord(String* out, const String& payload) {
+    appendUInt32(out, payload.size());
+    appendUInt32(out, checksum(payload.data(), payload.size()));
+    out->append(payload);
+}
+
+bool LogStorage::replayRecord(const char* payload, uint32 size) {
+    // Parse everything before applying anything so a bad record has no effect
+    std::vector<ReplayEntry> entries;
+
+    uint32 offset = 0;
+    while(offset < size) {
+        if (size - offset < 1 + UUID::static_size + 4) return false;
+        entries.push_back(ReplayEntry());
+        ReplayEntry& entry = entries.back();
+        entry.type = (uint8)payload[offset];
+        offset++;
+        entry.bucket = Bucket((const UUID::byte*)payload + offset, UUID::static_size);
+        offset += UUID::static_size;
+
+        uint32 key_size = readUInt32(payload + offset);
+        offset += 4;
+        if (size - offset < key_size) return false;
+        entry.key.assign(payload + offset, key_size);
+        offset += key_size;
+
+        if (entry.type == EntryWrite) {
+            if (size - offset < 4) return false;
+            uint32 value_size = readUInt32(payload + offset);
+            offset += 4;
+            if (size - offset < value_size) return false;
+            entry.value.assign(payload + offset, value_size);
+            offset += value_size;
+        }
+        else if (entry.type != EntryErase) {
+            return false;
+        }
+    }
+
+    for(uint32 i = 0; i < entries.size(); i++) {
+        ReplayEntry& entry = entries[i];
+        Data::iterator bucket_it = mData.find(entry.bucket);
+        if (entry.type == EntryErase && bucket_it == mData.end())
+            continue;
+        BucketData& bucket_data = (bucket_it != mData.end() ? bucket_it->second : mData[entry.bucket]);
+
+        BucketData::iterator data_it = bucket_data.find(entry.key);
+        if (data_it != bucket_data.end()) {
+            mLiveBytes -= entrySize(data_it->first, data_it->second);
+            bucket_data.erase(data_it);
+        }
+        if (entry.type == EntryWrite) {
+            mLiveBytes += entrySize(entry.key, entry.value);
+            bucket_data[entry.key].swap(entry.value);
+        }
+        if (bucket_data.empty())
+            mData.erase(entry.bucket);
+    }
+    return true;
+}
+
+bool LogStorage::replay(bool* bad_tail) {
+    *bad_tail = false;
+    mLogSize = 0;
+
+    std::FILE* log = std::fopen(mLogFilename.c_str(), "rb");
+    // No log yet, nothing to replay
+    if (log == NULL) return true;
+
+    String contents;
+    char buf[64*1024];
+    size_t nread;
+    while((nread = std::fread(buf, 1, sizeof(buf), log)) > 0)
+        contents.append(buf, nread);
+    std::fclose(log);
+
+    if (contents.empty()) return true;
+
+    if (contents.size() < sizeof(LogMagic) || memcmp(contents.data(), LogMagic, sizeof(LogMagic)) != 0) {
+        SILOG(log-storage, error, mLogFilename << " isn't a storage log, changes will not be saved");
+        return false;
+    }
+
+    uint64 offset = sizeof(LogMagic);
+    uint32 nrecords = 0;
+    while(offset < contents.size()) {
+        if (contents.size() - offset < RecordHeaderSize) break;
+        uint32 size = readUInt32(contents.data() + offset);
+        uint32 hash = readUInt32(contents.data() + offset + 4);
+        if (contents.size() - offset - RecordHeaderSize < size) break;
+
+        const char* payload = contents.data() + offset + RecordHeaderSize;
+        if (checksum(payload, size) != hash) break;
+        if (!replayRecord(payload, size)) break;
+
+        offset += RecordHeaderSize + size;
+        nrecords++;
+    }
+
+    mLogSize = offset;
+    if (offset != contents.size()) {
+        SILOG(log-storage, warn, "Discarding " << (contents.size() - offset) << " bytes of incomplete or corrupted records at the end of " << mLogFilename);
+        *bad_tail = true;
+    }
+    SILOG(log-storage, detailed, "Replayed " << nrecords << " records from " << mLogFilename);
+    return true;
+}
+
+bool LogStorage::openLog() {
+    mLog = std::fopen(mLogFilename.c_str(), "ab");
+    if (mLog == NULL) {
+        SILOG(log-storage, error, "Couldn't open " << mLogFilename << ", changes will not be saved");
+        return false;
+    }
+
+    if (mLogSize == 0) {
+        std::fwrite(LogMagic, 1, sizeof(LogMagic), mLog);
+        mLogSize = sizeof(LogMagic);
+    }
+    return true;
+}
+
+bool LogStorage::syncLog() {
+    if (std::fflush(mLog) != 0) return false;
+    if (!mSync) return true;
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+    return (FlushFileBuffers((HANDLE) _get_osfhandle(_fileno(mLog))) != 0);
+#else
+    return (fsync(fileno(mLog)) == 0);
+#endif
+}
+
+void LogStorage::postFlush() {
+    // Must hold mMutex. Once a flush is posted, anything else committed
+    // before it runs will be picked up by it too.
+    if (mFlushPosted) return;
+    mFlushPosted = true;
+    mIOService->post(
+        std::tr1::bind(&LogStorage::flush, this),
+        "LogStorage::flush"
+    );
+}
+
+bool LogStorage::shouldCompact() const {
+    return mLogSize > mCompactMinSize &&
+        mLogSize > (uint64)(mCompactRatio * mLiveBytes);
+}
+
+void LogStorage::flush() {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mFlushPosted = false;
+
+    // The commits stay in mPendingCommits until they complete so that any
+    // committed while we write queue up behind them.
+    uint32 ncommits = mPendingCommits.size();
+    String records;
+    records.swap(mPendingLog);
+
+    // The compacted log is built from the current data, which already
+    // includes these records
+    bool written = false;
+    if (mLog != NULL && (mLogDirty || shouldCompact())) {
+        written = compact(lock);
+        if (written) mLogDirty = false;
+    }
+    if (lock.owns_lock())
+        lock.unlock();
+
+    if (!written && !records.empty()) {
+        if (mLog == NULL) {
+            SILOG(log-storage, error, "No log to write " << records.size() << " bytes of changes to");
+        }
+        else if (mLogDirty) {
+            SILOG(log-storage, error, "Couldn't rewrite " << mLogFilename << " after an earlier write error");
+        }
+        else if (std::fwrite(records.data(), 1, records.size(), mLog) != records.size() || !syncLog()) {
+            SILOG(log-storage, error, "Error writing to " << mLogFilename);
+            // Part of the records may have made it out, so the size is just
+            // an estimate until the log is rewritten
+            mLogSize += records.size();
+            mLogDirty = true;
+        }
+        else {
+            mLogSize += records.size();
+            written = true;
+        }
+    }
+    else {
+        written = true;
+    }
+
+    lock.lock();
+    if (!written) {
+        rollBackPending();
+        ncommits = mPendingCommits.size();
+    }
+    PendingCommitList commits(mPendingCommits.begin(), mPendingCommits.begin() + ncommits);
+    mPendingCommits.erase(mPendingCommits.begin(), mPendingCommits.begin() + ncommits);
+    // Posting while holding the lock keeps these ahead of any commits that
+    // complete immediately after it's released
+    completeCommits(commits);
+}
+
+void LogStorage::rollBackPending() {
+    for(uint32 i = mPendingCommits.size(); i > 0; i--) {
+        PendingCommit& commit = mPendingCommits[i-1];
+        undoChanges(commit.undo);
+        commit.result = TRANSACTION_ERROR;
+    }
+    // Includes records for commits made while this flush was writing
+    mPendingLog.clear();
+}
+
+bool LogStorage::compact(boost::unique_lock<boost::mutex>& lock) {
+    String snapshot(LogMagic, sizeof(LogMagic));
+    for(Data::const_iterator bucket_it = mData.begin(); bucket_it != mData.end(); bucket_it++) {
+        String payload;
+        const BucketData& bucket_data = bucket_it->second;
+        for(BucketData::const_iterator it = bucket_data.begin(); it != bucket_data.end(); it++)
+            serializeEntry(&payload, EntryWrite, bucket_it->first, it->first, &(it->second));
+        appendRecord(&snapshot, payload);
+    }
+    uint64 old_size = mLogSize;
+    lock.unlock();
+
+    String compact_filename = mLogFilename + ".compact";
+    std::FILE* compacted = std::fopen(compact_filename.c_str(), "wb");
+    if (compacted == NULL) {
+        SILOG(log-storage, error, "Couldn't create " << compact_filename << " to compact the log");
+        return false;
+    }
+    // Small snapshots sit in the stdio buffer until the flush, so that is
+    // where most write errors show up
+    bool success = (std::fwrite(snapshot.data(), 1, snapshot.size(), compacted) == snapshot.size());
+    success = (std::fflush(compacted) == 0) && success;
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+    success = (FlushFileBuffers((HANDLE) _get_osfhandle(_fileno(compacted))) != 0) && success;
+#else
+    success = (fsync(fileno(compacted)) == 0) && success;
+#endif
+    success = (std::fclose(compacted) == 0) && success;
+    if (!success) {
+        SILOG(log-storage, error, "Error writing " << compact_filename);
+        std::remove(compact_filename.c_str());
+        return false;
+    }
+
+    if (mLog != NULL) {
+        std::fclose(mLog);
+        mLog = NULL;
+    }
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+    // rename won't replace an existing file on Windows
+    std::remove(mLogFilename.c_str());
+#endif
+    if (std::rename(compact_filename.c_str(), mLogFilename.c_str()) != 0) {
+        SILOG(log-storage, error, "Couldn't replace " << mLogFilename << " with compacted log");
+        // The old log is still intact, keep appending to it
+        openLog();
+        return false;
+    }
+
+    SILOG(log-storage, detailed, "Compacted " << mLogFilename << " from " << old_size << " to " << snapshot.size() << " bytes");
+    mLogSize = snapshot.size();
+    // The snapshot is durable now, so even if the log can't be reopened the
+    // commits it covers succeeded. Later ones will fail without a log.
+    openLog();
+    return true;
+}
+
+void LogStorage::completeCommits(PendingCommitList& commits) {
+    for(uint32 i = 0; i < commits.size(); i++) {
+        PendingCommit& commit = commits[i];
+        Result result = commit.result;
+        if (result != SUCCESS && commit.rs != NULL) {
+            delete commit.rs;
+            commit.rs = NULL;
+        }
+
+        if (commit.cb) {
+            mContext->mainStrand->post(
+                std::tr1::bind(commit.cb, result, commit.rs),
+                "LogStorage completeCommit"
+            );
+        }
+        else {
+            delete commit.rs;
+        }
+    }
+}
+
+} //end namespace OH
+} //end namespace Sirikata
@@ -0,0 +1,202 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_OH_STORAGE_LOG_HPP_
+#define _SIRIKATA_OH_STORAGE_LOG_HPP_
+
+#include <sirikata/oh/Storage.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstdio>
+
+namespace Sirikata {
+namespace OH {
+
+/** LogStorage is an embedded, single process Storage implementation. All data
+ *  is kept in memory and every committed transaction is appended to a log file
+ *  as a single checksummed record, which is replayed when the storage starts.
+ *  A torn or corrupted record at the end of the log (e.g. from a crash in the
+ *  middle of a write) is discarded along with everything after it, so each
+ *  transaction is recovered either completely or not at all.
+ *
+ *  Transactions are applied to the in-memory data immediately when they are
+ *  committed, but their callbacks are only invoked once their records have
+ *  been written (and, if enabled, synced) by a dedicated IO thread. Records
+ *  from all transactions committed while the IO thread is busy are written
+ *  and synced together, so the cost of a sync is shared by all of them.
+ *
+ *  Since overwritten and erased values are never removed from the log, the
+ *  IO thread periodically compacts it by writing the current data to a new
+ *  file and replacing the log with it.
+ *
+ *  Only a single process should use a log file at a time, so leases are not
+ *  needed and leaseBucket and releaseBucket do nothing.
+ */
+class LogStorage : public Storage
+{
+public:
+    /** Create a LogStorage.
+     *  \param ctx the ObjectHostContext
+     *  \param logpath path of the log file
+     *  \param sync if true, the log is synced to disk before commits complete
+     *  \param compact_ratio compact when the log is this many times larger
+     *         than the data it holds
+     *  \param compact_min_size never compact logs smaller than this many bytes
+     */
+    LogStorage(ObjectHostContext* ctx, const String& logpath, bool sync = true,
+        float32 compact_ratio = 2.f, uint64 compact_min_size = 1024*1024);
+    ~LogStorage();
+
+    virtual void start();
+    virtual void stop();
+
+    virtual void leaseBucket(const Bucket& bucket);
+    virtual void releaseBucket(const Bucket& bucket);
+
+    virtual void beginTransaction(const Bucket& bucket);
+
+    virtual void commitTransaction(const Bucket& bucket, const CommitCallback& cb = 0, const String& timestamp="current");
+    virtual bool erase(const Bucket& bucket, const Key& key, const CommitCallback& cb = 0, const String& timestamp="current");
+    virtual bool write(const Bucket& bucket, const Key& key, const String& value, const CommitCallback& cb = 0, const String& timestamp="current");
+    virtual bool read(const Bucket& bucket, const Key& key, const CommitCallback& cb = 0, const String& timestamp="current");
+    virtual bool compare(const Bucket& bucket, const Key& key, const String& value, const CommitCallback& cb = 0, const String& timestamp="current");
+    virtual bool rangeRead(const Bucket& bucket, const Key& start, const Key& finish, const CommitCallback& cb = 0, const String& timestamp="current");
+    virtual bool rangeErase(const Bucket& bucket, const Key& start, const Key& finish, const CommitCallback& cb = 0, const String& timestamp="current");
+    virtual bool count(const Bucket& bucket, const Key& start, const Key& finish, const CountCallback& cb = 0, const String& timestamp="current");
+
+private:
+    // Individual operations queued up in a transaction. Ranges are inclusive
+    // at both ends.
+    struct Action {
+        enum Type {
+            Read,
+            ReadRange,
+            Compare,
+            Write,
+            Erase,
+            EraseRange
+        };
+
+        Type type;
+        Key key;
+        Key keyEnd; // Only relevant for *Range
+        String value; // Only relevant for Write and Compare
+    };
+    typedef std::vector<Action> Transaction;
+    typedef std::tr1::unordered_map<Bucket, Transaction*, Bucket::Hasher> BucketTransactions;
+
+    // The data, sorted by key within each bucket so ranges are cheap.
+    typedef std::map<Key, String> BucketData;
+    typedef std::tr1::unordered_map<Bucket, BucketData, Bucket::Hasher> Data;
+
+    // Changes made by a transaction that hasn't been applied yet. Erased keys
+    // map to NULL.
+    typedef std::map<Key, const String*> Changes;
+
+    // What a key held before a commit changed it, so the change can be
+    // undone if its record can't be written
+    struct UndoEntry {
+        Bucket bucket;
+        Key key;
+        bool existed;
+        String value;
+    };
+    typedef std::vector<UndoEntry> UndoLog;
+
+    // A commit that has been applied but isn't durable yet, or one that is
+    // waiting behind such commits so callbacks stay in order.
+    struct PendingCommit {
+        CommitCallback cb;
+        ReadSet* rs;
+        Result result;
+        // Whether the commit modified data, i.e. depends on the log write
+        bool logged;
+        UndoLog undo;
+    };
+    typedef std::vector<PendingCommit> PendingCommitList;
+
+    Transaction* getTransaction(const Bucket& bucket, bool* is_new = NULL);
+    // Add an action to the bucket's transaction, committing it immediately if
+    // it's a single operation transaction.
+    void addAction(const Bucket& bucket, Action::Type type, const Key& key, const Key& key_end, const String& value, const CommitCallback& cb);
+
+    // Runs the transaction against the current data, filling in rs and
+    // changes. Nothing is modified, so a failed transaction can just be
+    // discarded.
+    Result executeTransaction(const BucketData* bucket_data, const Transaction& trans, ReadSet* rs, Changes* changes);
+    // Looks up a key in the data as modified by changes, returning NULL if it
+    // doesn't exist.
+    static const String* lookup(const BucketData* bucket_data, const Changes& changes, const Key& key);
+    // Applies changes to the in-memory data and appends a record for them to
+    // mPendingLog, saving what they replaced to undo. Must hold mMutex.
+    void applyChanges(const Bucket& bucket, const Changes& changes, UndoLog* undo);
+    // Restores the values saved by applyChanges. Must hold mMutex.
+    void undoChanges(const UndoLog& undo);
+
+    // Log records
+    static void serializeEntry(String* out, uint8 type, const Bucket& bucket, const Key& key, const String* value);
+    static void appendRecord(String* out, const String& payload);
+    bool replayRecord(const char* payload, uint32 size);
+    // Reads the log, rebuilding the data. Returns false if the file isn't a
+    // log and must be left alone. bad_tail is set if there was a corrupted or
+    // incomplete record which needs to be removed by compacting.
+    bool replay(bool* bad_tail);
+    bool openLog();
+    // Flushes the log and, if mSync is set, syncs it to disk. Returns false
+    // on failure.
+    bool syncLog();
+
+    // IO thread
+    void postFlush();
+    void flush();
+    bool shouldCompact() const;
+    // Writes the data to a new log, then replaces the current log with it.
+    // Must hold mMutex to serialize the data, but releases it while writing.
+    // Returns true once the new log has replaced the old one.
+    bool compact(boost::unique_lock<boost::mutex>& lock);
+    // Undoes every commit that isn't durable yet, newest first, and marks
+    // them all as failed, since later ones may have read the earlier ones'
+    // changes. Must hold mMutex.
+    void rollBackPending();
+    // Posts callbacks for commits
+    void completeCommits(PendingCommitList& commits);
+
+    ObjectHostContext* mContext;
+    BucketTransactions mTransactions;
+
+    const String mLogFilename;
+    const bool mSync;
+    const float32 mCompactRatio;
+    const uint64 mCompactMinSize;
+
+    Network::IOService* mIOService;
+    Network::IOWork* mWork;
+    Thread* mThread;
+
+    // Protects the data and pending commits.
+    boost::mutex mMutex;
+    Data mData;
+    // Bytes of live data, i.e. what a compacted log would hold
+    uint64 mLiveBytes;
+    // Records that still need to be written and their commits
+    String mPendingLog;
+    PendingCommitList mPendingCommits;
+    bool mFlushPosted;
+
+    // The log file is only touched by the IO thread, or before it starts and
+    // after it stops.
+    std::FILE* mLog;
+    uint64 mLogSize;
+    // Set when a write fails part way, so the log may end with a record for
+    // changes that were rolled back. It has to be rewritten by compacting
+    // before anything else is appended.
+    bool mLogDirty;
+};
+
+}//end namespace OH
+}//end namespace Sirikata
+
+#endif //_SIRIKATA_OH_STORAGE_LOG_HPP_
@@ -0,0 +1,68 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/oh/Platform.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include "LogStorage.hpp"
+
+static int logstore_plugin_refcount = 0;
+
+namespace Sirikata {
+
+static void InitPluginOptions() {
+    Sirikata::InitializeClassOptions ico("logstorage",NULL,
+        new Sirikata::OptionValue("db", "storage.log", Sirikata::OptionValueType<String>(), "Log file to store data to."),
+        new Sirikata::OptionValue("sync", "true", Sirikata::OptionValueType<bool>(), "If true, commits only complete once the log has been synced to disk."),
+        new Sirikata::OptionValue("compact-ratio", "2", Sirikata::OptionValueType<float32>(), "Compact the log when it is this many times larger than the data it holds."),
+        new Sirikata::OptionValue("compact-min-size", "1048576", Sirikata::OptionValueType<uint32>(), "Never compact logs smaller than this many bytes."),
+        NULL);
+}
+
+static OH::Storage* createLogStorage(ObjectHostContext* ctx, const String& args) {
+    OptionSet* optionsSet = OptionSet::getOptions("logstorage",NULL);
+    optionsSet->parse(args);
+
+    String db = optionsSet->referenceOption("db")->as<String>();
+    bool sync = optionsSet->referenceOption("sync")->as<bool>();
+    float32 compact_ratio = optionsSet->referenceOption("compact-ratio")->as<float32>();
+    uint32 compact_min_size = optionsSet->referenceOption("compact-min-size")->as<uint32>();
+
+    return new OH::LogStorage(ctx, db, sync, compact_ratio, compact_min_size);
+}
+
+} // namespace Sirikata
+
+SIRIKATA_PLUGIN_EXPORT_C void init() {
+    using namespace Sirikata;
+    if (logstore_plugin_refcount==0) {
+        InitPluginOptions();
+        OH::StorageFactory::getSingleton()
+            .registerConstructor("log",
+                                 std::tr1::bind(&createLogStorage, std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    }
+    logstore_plugin_refcount++;
+}
+
+SIRIKATA_PLUGIN_EXPORT_C int increfcount() {
+    return ++logstore_plugin_refcount;
+}
+SIRIKATA_PLUGIN_EXPORT_C int decrefcount() {
+    assert(logstore_plugin_refcount>0);
+    return --logstore_plugin_refcount;
+}
+
+SIRIKATA_PLUGIN_EXPORT_C void destroy() {
+    using namespace Sirikata;
+    if (logstore_plugin_refcount==0) {
+        OH::StorageFactory::getSingleton().unregisterConstructor("log");
+    }
+}
+
+SIRIKATA_PLUGIN_EXPORT_C const char* name() {
+    return "oh-logstore";
+}
+
+SIRIKATA_PLUGIN_EXPORT_C int refcount() {
+    return logstore_plugin_refcount;
+}
@@ -44,6 +44,10 @@ static void InitPluginOptions() {
     Sirikata::InitializeClassOptions ico("sqlitestorage",NULL,
         new Sirikata::OptionValue("db", "storage.db", Sirikata::OptionValueType<String>(), "Database file to store data to."),
         new Sirikata::OptionValue("lease-duration", "30s", Sirikata::OptionValueType<Duration>(), "Duration to register leases for. Longer times require less overhead, but also mean longer delays if an object or object host dies without cleaning up."),
+        new Sirikata::OptionValue("max-coalesced-transactions", "64", Sirikata::OptionValueType<uint32>(), "Maximum number of queued transactions to commit together as a single SQLite transaction."),
+        new Sirikata::OptionValue("statement-cache", "true", Sirikata::OptionValueType<bool>(), "If true, prepared statements are reused instead of being prepared for every operation."),
+        new Sirikata::OptionValue("journal-mode", "", Sirikata::OptionValueType<String>(), "SQLite journal_mode to use, e.g. wal. Uses SQLite's default if empty."),
+        new Sirikata::OptionValue("synchronous", "", Sirikata::OptionValueType<String>(), "SQLite synchronous setting to use, e.g. normal. Uses SQLite's default if empty."),
         NULL);
 
     Sirikata::InitializeClassOptions icop("sqlitepersistedset",NULL,
@@ -61,8 +65,12 @@ static OH::Storage* createSQLiteStorage(ObjectHostContext* ctx, const String& ar
 
     String db = optionsSet->referenceOption("db")->as<String>();
     Duration lease_duration = optionsSet->referenceOption("lease-duration")->as<Duration>();
+    uint32 max_coalesced = optionsSet->referenceOption("max-coalesced-transactions")->as<uint32>();
+    bool cache_statements = optionsSet->referenceOption("statement-cache")->as<bool>();
+    String journal_mode = optionsSet->referenceOption("journal-mode")->as<String>();
+    String synchronous = optionsSet->referenceOption("synchronous")->as<String>();
 
-    return new OH::SQLiteStorage(ctx, db, lease_duration);
+    return new OH::SQLiteStorage(ctx, db, lease_duration, max_coalesced, cache_statements, journal_mode, synchronous);
 }
 
 static OH::PersistedObjectSet* createSQLitePersistedObjectSet(ObjectHostContext* ctx, const String& args) {
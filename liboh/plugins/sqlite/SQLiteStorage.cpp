@@ -37,6 +37,8 @@
 #define TABLE_NAME "persistence"
 #define LEASE_KEY "_____lease_____"
 
+#include <cstring>
+
 namespace Sirikata {
 namespace OH {
 
@@ -56,8 +58,33 @@ namespace OH {
  *  is sufficient because as soon as we read the data, we have a
  *  reader lock and the transaction won't complete if someone else
  *  tried to write to it.
+ *
+ *  Every statement binds the object and key as parameters, so there
+ *  is only a fixed set of SQL statements. Unless disabled, each one
+ *  is prepared the first time it's used and then reset and reused,
+ *  avoiding reparsing the SQL for every operation. Queued
+ *  transactions are also grouped into a single SQLite transaction,
+ *  so one fsync on commit covers many of them.
  */
 
+namespace {
+// SQL for each SQLiteStorage::Statement, in the same order.
+const char* StatementSQL[] = {
+    "SELECT value FROM \"" TABLE_NAME "\" WHERE object == ? AND key == ?",
+    "SELECT key, value FROM \"" TABLE_NAME "\" WHERE object == ? AND key BETWEEN ? AND ?",
+    "INSERT OR REPLACE INTO \"" TABLE_NAME "\" (object, key, value) VALUES(?, ?, ?)",
+    "DELETE FROM \"" TABLE_NAME "\" WHERE object = ? AND key = ?",
+    "DELETE FROM \"" TABLE_NAME "\" WHERE object = ? AND key BETWEEN ? AND ?",
+    "SELECT COUNT(*) FROM \"" TABLE_NAME "\" WHERE object = ? AND key BETWEEN ? AND ?",
+    "BEGIN DEFERRED TRANSACTION",
+    "COMMIT TRANSACTION",
+    "ROLLBACK TRANSACTION",
+    "SAVEPOINT coalesced",
+    "RELEASE SAVEPOINT coalesced",
+    "ROLLBACK TRANSACTION TO SAVEPOINT coalesced"
+};
+} // namespace
+
 
 SQLiteStorage::StorageAction::StorageAction()
  : type(Error),
@@ -87,7 +114,11 @@ SQLiteStorage::StorageAction& SQLiteStorage::StorageAction::operator=(const Stor
     return *this;
 }
 
-Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Bucket& bucket, ReadSet* rs) {
+Storage::Result SQLiteStorage::StorageAction::execute(SQLiteStorage* storage, const Bucket& bucket, ReadSet* rs) {
+    sqlite3* db = storage->mDB->db();
+    // All parameters are bound with SQLITE_STATIC since they outlive the
+    // statement's use: it's always reset before we return.
+    String object = bucket.rawHexData();
     Result result = SUCCESS;
     switch(type) {
         // Read and Compare are identical except that read stores the value and
@@ -95,20 +126,16 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
       case Read:
       case Compare:
           {
-              String value_query = "SELECT value FROM ";
-              value_query += "\"" TABLE_NAME "\"";
-              value_query += " WHERE object == \'" + bucket.rawHexData() + "\' AND key == ?";
               int rc;
-              char* remain;
-              sqlite3_stmt* value_query_stmt;
               bool newStep = true;
               bool locked = false;
-              rc = sqlite3_prepare_v2(db->db(), value_query.c_str(), -1, &value_query_stmt, (const char**)&remain);
-              bool success = true;
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value query statement");
-              if (rc==SQLITE_OK) {
-                  rc = sqlite3_bind_text(value_query_stmt, 1, key.c_str(), (int)key.size(), SQLITE_TRANSIENT);
-                  success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value query statement");
+              sqlite3_stmt* value_query_stmt = storage->getStatement(ReadStatement);
+              bool success = (value_query_stmt != NULL);
+              if (value_query_stmt != NULL) {
+                  rc = sqlite3_bind_text(value_query_stmt, 1, object.c_str(), (int)object.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding object to value query statement");
+                  rc = sqlite3_bind_text(value_query_stmt, 2, key.c_str(), (int)key.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding key name to value query statement");
                   if (rc==SQLITE_OK) {
                       int step_rc = sqlite3_step(value_query_stmt);
                       while(step_rc == SQLITE_ROW) {
@@ -121,25 +148,25 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
                           }
                           else if (type == Compare) {
                               assert(value != NULL);
-                              String db_val(
-                                  (const char*)sqlite3_column_text(value_query_stmt, 0),
-                                  sqlite3_column_bytes(value_query_stmt, 0)
-                              );
-                              success = success && (db_val == *value);
+                              const void* db_val = sqlite3_column_blob(value_query_stmt, 0);
+                              int nbytes = sqlite3_column_bytes(value_query_stmt, 0);
+                              success = success &&
+                                  (nbytes == (int)value->size()) &&
+                                  (nbytes == 0 || memcmp(db_val, value->data(), nbytes) == 0);
                           }
                           step_rc = sqlite3_step(value_query_stmt);
                       }
                       if (step_rc != SQLITE_DONE) {
                           // reset the statement so it'll clean up properly
                           rc = sqlite3_reset(value_query_stmt);
-                          success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
+                          success = success && !SQLite::check_sql_error(db, rc, NULL, "Error finalizing value query statement");
                           if (rc==SQLITE_LOCKED||rc==SQLITE_BUSY)
                               locked = true;
                       }
                   }
+                  rc = storage->releaseStatement(ReadStatement, value_query_stmt);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error finalizing value query statement");
               }
-              rc = sqlite3_finalize(value_query_stmt);
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
 
               if (newStep) { // no rows were found, key is missing
                   success = false;
@@ -151,21 +178,16 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
         break;
       case ReadRange:
           {
-              String value_query = "SELECT key, value FROM ";
-              value_query += "\"" TABLE_NAME "\"";
-              value_query += " WHERE object == \'" + bucket.rawHexData() + "\' AND key BETWEEN ? AND ?";
-
               int rc;
-              char* remain;
-              sqlite3_stmt* value_query_stmt;
-              rc = sqlite3_prepare_v2(db->db(), value_query.c_str(), -1, &value_query_stmt, (const char**)&remain);
-              bool success = true;
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value query statement");
-              if (rc==SQLITE_OK){
-                  rc = sqlite3_bind_text(value_query_stmt, 1, key.c_str(), (int)key.size(), SQLITE_TRANSIENT);
-                  success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error binding start key to value query statement");
-                  rc = sqlite3_bind_text(value_query_stmt, 2, keyEnd.c_str(), (int)keyEnd.size(), SQLITE_TRANSIENT);
-                  success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error binding finish key to value query statement");
+              sqlite3_stmt* value_query_stmt = storage->getStatement(ReadRangeStatement);
+              bool success = (value_query_stmt != NULL);
+              if (value_query_stmt != NULL) {
+                  rc = sqlite3_bind_text(value_query_stmt, 1, object.c_str(), (int)object.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding object to value query statement");
+                  rc = sqlite3_bind_text(value_query_stmt, 2, key.c_str(), (int)key.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding start key to value query statement");
+                  rc = sqlite3_bind_text(value_query_stmt, 3, keyEnd.c_str(), (int)keyEnd.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding finish key to value query statement");
                   if (rc==SQLITE_OK) {
                       int step_rc = sqlite3_step(value_query_stmt);
                       int nread = 0;
@@ -175,11 +197,11 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
                               (const char*)sqlite3_column_text(value_query_stmt, 0),
                               sqlite3_column_bytes(value_query_stmt, 0)
                           );
-                          String value(
+                          String& value = (*rs)[key];
+                          value.assign(
                               (const char*)sqlite3_column_text(value_query_stmt, 1),
                               sqlite3_column_bytes(value_query_stmt, 1)
                           );
-                          (*rs)[key] = value;
                           step_rc = sqlite3_step(value_query_stmt);
                       }
                       if (nread == 0)
@@ -187,12 +209,12 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
                       if (step_rc != SQLITE_DONE) {
                           // reset the statement so it'll clean up properly
                           rc = sqlite3_reset(value_query_stmt);
-                          success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
+                          success = success && !SQLite::check_sql_error(db, rc, NULL, "Error finalizing value query statement");
                       }
                   }
+                  rc = storage->releaseStatement(ReadRangeStatement, value_query_stmt);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error finalizing value query statement");
               }
-              rc = sqlite3_finalize(value_query_stmt);
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
               if (!success)
                   result = TRANSACTION_ERROR;
           }
@@ -203,55 +225,44 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
               // Erase and write use different statements, but the rest is the
               // same since it just needs to execute and check for success.
               int rc;
-              char* remain;
-
-              String value_insert;
-              if (type == Write) {
-                  value_insert = "INSERT OR REPLACE INTO ";
-                  value_insert += "\"" TABLE_NAME "\"";
-                  value_insert += " (object, key, value) VALUES(\'" + bucket.rawHexData() + "\', ?, ?)";
-              }
-              else if (type == Erase) {
-                  value_insert = "DELETE FROM ";
-                  value_insert += "\"" TABLE_NAME "\"";
-                  value_insert += " WHERE object = \'" + bucket.rawHexData() + "\' AND key = ?";
-              }
+              Statement which = (type == Write) ? WriteStatement : EraseStatement;
+
+              sqlite3_stmt* value_insert_stmt = storage->getStatement(which);
+              bool success = (value_insert_stmt != NULL);
+              if (value_insert_stmt != NULL) {
+                  rc = sqlite3_bind_text(value_insert_stmt, 1, object.c_str(), (int)object.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding object to value insert statement");
+                  rc = sqlite3_bind_text(value_insert_stmt, 2, key.c_str(), (int)key.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding key name to value insert statement");
+                  if (rc==SQLITE_OK) {
+                      if (type == Write) {
+                          assert(value != NULL);
+                          rc = sqlite3_bind_blob(value_insert_stmt, 3, value->data(), (int)value->size(), SQLITE_STATIC);
+                          success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding value to value insert statement");
+                      }
+                  }
 
-              sqlite3_stmt* value_insert_stmt;
-              rc = sqlite3_prepare_v2(db->db(), value_insert.c_str(), -1, &value_insert_stmt, (const char**)&remain);
-              bool success = true;
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value insert statement");
-
-              rc = sqlite3_bind_text(value_insert_stmt, 1, key.c_str(), (int)key.size(), SQLITE_TRANSIENT);
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value insert statement");
-              if (rc==SQLITE_OK) {
-                  if (type == Write) {
-                      assert(value != NULL);
-                      rc = sqlite3_bind_blob(value_insert_stmt, 2, value->c_str(), (int)value->size(), SQLITE_TRANSIENT);
-                      success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error binding value to value insert statement");
+                  int step_rc = sqlite3_step(value_insert_stmt);
+                  if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE) {
+                      sqlite3_reset(value_insert_stmt); // allow this to be cleaned up
+                      success = false;
+                  }
+                  else {
+                      // Check the number of changes that the statement actually
+                      // made. This is update, insertion, or deletion. This should
+                      // just be 1 since we expect exactly one change on a
+                      // write. On an erase, we ignore missing keys, but
+                      // we should see either 0 or 1 ops.
+                      int changes = sqlite3_changes(db);
+                      if (type == Write)
+                          success = success && (changes == 1);
+                      else if (type == Erase)
+                          success = success && (changes == 0 || changes == 1);
                   }
-              }
 
-              int step_rc = sqlite3_step(value_insert_stmt);
-              if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE) {
-                  sqlite3_reset(value_insert_stmt); // allow this to be cleaned up
-                  success = false;
+                  rc = storage->releaseStatement(which, value_insert_stmt);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error finalizing value insert statement");
               }
-              else {
-                  // Check the number of changes that the statement actually
-                  // made. This is update, insertion, or deletion. This should
-                  // just be 1 since we expect exactly one change on a
-                  // write. On an erase, we ignore missing keys, but
-                  // we should see either 0 or 1 ops.
-                  int changes = sqlite3_changes(db->db());
-                  if (type == Write)
-                      success = success && (changes == 1);
-                  else if (type == Erase)
-                      success = success && (changes == 0 || changes == 1);
-              }
-
-              rc = sqlite3_finalize(value_insert_stmt);
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value insert statement");
 
               if (!success)
                   result = TRANSACTION_ERROR;
@@ -259,28 +270,24 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
         break;
       case EraseRange:
           {
-              String value_delete = "DELETE FROM ";
-              value_delete += "\"" TABLE_NAME "\"";
-              value_delete += " WHERE object = \'" + bucket.rawHexData() + "\' AND key BETWEEN ? AND ?";
-
               int rc;
-              char* remain;
-              sqlite3_stmt* value_delete_stmt;
-              rc = sqlite3_prepare_v2(db->db(), value_delete.c_str(), -1, &value_delete_stmt, (const char**)&remain);
-              bool success = true;
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value delete statement");
-
-              rc = sqlite3_bind_text(value_delete_stmt, 1, key.c_str(), (int)key.size(), SQLITE_TRANSIENT);
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error binding start key to value delete statement");
-              rc = sqlite3_bind_text(value_delete_stmt, 2, keyEnd.c_str(), (int)keyEnd.size(), SQLITE_TRANSIENT);
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error binding finish key to value delete statement");
-
-              int step_rc = sqlite3_step(value_delete_stmt);
-              if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE)
-                  sqlite3_reset(value_delete_stmt); // allow this to be cleaned up
-
-              rc = sqlite3_finalize(value_delete_stmt);
-              success = success && !SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value delete statement");
+              sqlite3_stmt* value_delete_stmt = storage->getStatement(EraseRangeStatement);
+              bool success = (value_delete_stmt != NULL);
+              if (value_delete_stmt != NULL) {
+                  rc = sqlite3_bind_text(value_delete_stmt, 1, object.c_str(), (int)object.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding object to value delete statement");
+                  rc = sqlite3_bind_text(value_delete_stmt, 2, key.c_str(), (int)key.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding start key to value delete statement");
+                  rc = sqlite3_bind_text(value_delete_stmt, 3, keyEnd.c_str(), (int)keyEnd.size(), SQLITE_STATIC);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error binding finish key to value delete statement");
+
+                  int step_rc = sqlite3_step(value_delete_stmt);
+                  if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE)
+                      sqlite3_reset(value_delete_stmt); // allow this to be cleaned up
+
+                  rc = storage->releaseStatement(EraseRangeStatement, value_delete_stmt);
+                  success = success && !SQLite::check_sql_error(db, rc, NULL, "Error finalizing value delete statement");
+              }
 
               if (!success)
                   result = TRANSACTION_ERROR;
@@ -293,10 +300,15 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
     return result;
 }
 
-SQLiteStorage::SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const Duration& lease_duration)
+SQLiteStorage::SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const Duration& lease_duration,
+    uint32 max_coalesced_transactions, bool cache_statements,
+    const String& journal_mode, const String& synchronous)
  : mContext(ctx),
    mDBFilename(dbpath),
    mDB(),
+   mCacheStatements(cache_statements),
+   mJournalMode(journal_mode),
+   mSynchronous(synchronous),
    mIOService(NULL),
    mWork(NULL),
    mThread(NULL),
@@ -306,9 +318,11 @@ SQLiteStorage::SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const
    mSQLClientID(UUID::random().rawHexData()),
    mLeaseDuration(lease_duration),
    mTransactionQueue(std::tr1::bind(&SQLiteStorage::postProcessTransactions, this)),
-   mMaxCoalescedTransactions(5),
+   mMaxCoalescedTransactions(std::max(max_coalesced_transactions, (uint32)1)),
    mRenewTimer()
 {
+    for(int i = 0; i < NumStatements; i++)
+        mStatements[i] = NULL;
 }
 
 SQLiteStorage::~SQLiteStorage()
@@ -353,63 +367,96 @@ void SQLiteStorage::initDB() {
     SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing table create statement");
 
     mDB = db;
+
+    setPragma("journal_mode", mJournalMode);
+    setPragma("synchronous", mSynchronous);
 }
 
-bool SQLiteStorage::sqlBeginTransaction() {
-    String begin = "BEGIN DEFERRED TRANSACTION";
+void SQLiteStorage::setPragma(const String& pragma, const String& value) {
+    if (value.empty()) return;
+
+    // journal_mode returns a row, which sqlite3_exec just ignores
+    String sql = "PRAGMA " + pragma + " = " + value;
+    char* errmsg = NULL;
+    int rc = sqlite3_exec(mDB->db(), sql.c_str(), NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK) {
+        SILOG(sqlite-storage, error, "Failed to set " << pragma << " to " << value << ": " << (errmsg ? errmsg : ""));
+    }
+    sqlite3_free(errmsg);
+}
+
+sqlite3_stmt* SQLiteStorage::getStatement(Statement which) {
+    if (mStatements[which] != NULL) {
+        sqlite3_stmt* stmt = mStatements[which];
+        mStatements[which] = NULL;
+        return stmt;
+    }
 
     int rc;
     char* remain;
-    sqlite3_stmt* begin_stmt;
-    bool success = true;
+    sqlite3_stmt* stmt = NULL;
+    rc = sqlite3_prepare_v2(mDB->db(), StatementSQL[which], -1, &stmt, (const char**)&remain);
+    if (SQLite::check_sql_error(mDB->db(), rc, NULL, "Error preparing statement")) {
+        if (stmt != NULL) sqlite3_finalize(stmt);
+        return NULL;
+    }
+    return stmt;
+}
 
-    rc = sqlite3_prepare_v2(mDB->db(), begin.c_str(), -1, &begin_stmt, (const char**)&remain);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error preparing begin transaction statement");
+int SQLiteStorage::releaseStatement(Statement which, sqlite3_stmt* stmt) {
+    if (!mCacheStatements || mStatements[which] != NULL)
+        return sqlite3_finalize(stmt);
 
-    rc = sqlite3_step(begin_stmt);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error executing begin statement");
-    rc = sqlite3_finalize(begin_stmt);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error finalizing begin statement");
+    int rc = sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    mStatements[which] = stmt;
+    return rc;
+}
 
-    return success;
+void SQLiteStorage::finalizeStatements() {
+    for(int i = 0; i < NumStatements; i++) {
+        if (mStatements[i] != NULL) {
+            sqlite3_finalize(mStatements[i]);
+            mStatements[i] = NULL;
+        }
+    }
 }
 
-bool SQLiteStorage::sqlRollback() {
-    String rollback = "ROLLBACK TRANSACTION";
+bool SQLiteStorage::sqlExecute(Statement which, const char* description) {
+    sqlite3_stmt* stmt = getStatement(which);
+    if (stmt == NULL) return false;
 
-    int rc;
-    char* remain;
-    sqlite3_stmt* rollback_stmt;
     bool success = true;
+    int rc = sqlite3_step(stmt);
+    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, String("Error executing ") + description + " statement");
+    rc = releaseStatement(which, stmt);
+    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, String("Error finalizing ") + description + " statement");
 
-    rc = sqlite3_prepare_v2(mDB->db(), rollback.c_str(), -1, &rollback_stmt, (const char**)&remain);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error preparing rollback transaction statement");
+    return success;
+}
 
-    rc = sqlite3_step(rollback_stmt);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error executing rollback statement");
-    rc = sqlite3_finalize(rollback_stmt);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error finalizing rollback statement");
+bool SQLiteStorage::sqlBeginTransaction() {
+    return sqlExecute(BeginStatement, "begin");
+}
 
-    return success;
+bool SQLiteStorage::sqlRollback() {
+    return sqlExecute(RollbackStatement, "rollback");
 }
 
 bool SQLiteStorage::sqlCommit() {
-    String commit = "COMMIT TRANSACTION";
-
-    int rc;
-    char* remain;
-    sqlite3_stmt* commit_stmt;
-    bool success = true;
+    return sqlExecute(CommitStatement, "commit");
+}
 
-    rc = sqlite3_prepare_v2(mDB->db(), commit.c_str(), -1, &commit_stmt, (const char**)&remain);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error preparing commit transaction statement");
+bool SQLiteStorage::sqlSavepoint() {
+    return sqlExecute(SavepointStatement, "savepoint");
+}
 
-    rc = sqlite3_step(commit_stmt);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error executing commit statement");
-    rc = sqlite3_finalize(commit_stmt);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error finalizing commit statement");
+bool SQLiteStorage::sqlReleaseSavepoint() {
+    return sqlExecute(ReleaseSavepointStatement, "release savepoint");
+}
 
-    return success;
+bool SQLiteStorage::sqlRollbackToSavepoint() {
+    return sqlExecute(RollbackToSavepointStatement, "rollback to savepoint");
 }
 
 void SQLiteStorage::stop() {
@@ -423,6 +470,8 @@ void SQLiteStorage::stop() {
     mWork = NULL;
     mThread->join();
     mRenewTimer.reset();
+    // The IO thread is gone, so it's safe to clean up its statements
+    finalizeStatements();
     delete mThread;
     mThread = NULL;
     delete mIOService;
@@ -499,70 +548,95 @@ void SQLiteStorage::processTransactions() {
 
     while(!mTransactionQueue.empty()) {
 
-        // Try to execute up to the maximum number of coalesced transactions so
-        // long as we don't encounter a failure for some reason.
+        // Execute up to the maximum number of coalesced transactions in one
+        // SQL transaction. Each runs inside its own savepoint, so one that
+        // fails (e.g. a compare that doesn't match) is rolled back on its own
+        // and the rest of the group still commits together.
         std::vector<TransactionData> transactions;
+        std::vector<Result> results;
         std::vector<ReadSet*> read_sets;
-
-        Result result = SUCCESS;
-        if (!sqlBeginTransaction())
-            result = LOCK_ERROR;
-        for(uint32 i = 0;
-            (result == SUCCESS) && !mTransactionQueue.empty() && i < mMaxCoalescedTransactions;
-            i++)
-        {
+        // Leases only need to be checked once per bucket in the group
+        BucketSet leased;
+        // Leases newly acquired by the group, which need renewing if it commits
+        BucketSet acquired;
+
+        // Only failures of the SQL transaction itself, rather than of one of
+        // the transactions in it, abandon the group
+        bool group_ok = sqlBeginTransaction();
+        while(group_ok && !mTransactionQueue.empty() && transactions.size() < mMaxCoalescedTransactions) {
             TransactionData data;
             bool popped = mTransactionQueue.pop(data);
             assert(popped);
             transactions.push_back(data);
 
+            if (!sqlSavepoint()) {
+                group_ok = false;
+                break;
+            }
+
+            bool had_lease = (leased.find(data.bucket) != leased.end());
             ReadSet* cur_result = NULL;
-            result = executeCommit(data.bucket, data.trans, data.cb, &cur_result);
+            Result result = executeCommit(data.bucket, data.trans, data.cb, &cur_result, &acquired, &leased);
             if (result == SUCCESS) {
-                read_sets.push_back(cur_result);
+                group_ok = sqlReleaseSavepoint();
+            }
+            else {
+                // Undo just this transaction. If it acquired the lease, that
+                // was undone too, so it has to be checked again.
+                if (!had_lease) {
+                    leased.erase(data.bucket);
+                    acquired.erase(data.bucket);
+                }
+                group_ok = sqlRollbackToSavepoint() && sqlReleaseSavepoint();
             }
+            results.push_back(result);
+            read_sets.push_back(cur_result);
         }
 
-        // If we succeeded so far, try to commit and move on
-        if (result == SUCCESS) {
-            if (!sqlCommit())
-                result = LOCK_ERROR;
-        }
-        // If still successful, cleanup, post callbacks, and move on to next
-        // round
-        if (result == SUCCESS) {
+        if (group_ok)
+            group_ok = sqlCommit();
+
+        // Cleanup, post callbacks, and move on to the next round
+        if (group_ok) {
+            scheduleRenewals(acquired);
             for(uint32 i = 0; i < transactions.size(); i++) {
                 delete transactions[i].trans;
                 if (transactions[i].cb) {
                     mContext->mainStrand->post(
-                        std::tr1::bind(transactions[i].cb, SUCCESS, read_sets[i]),
+                        std::tr1::bind(transactions[i].cb, results[i], read_sets[i]),
                         "SQLiteStorage completeCommit"
                     );
                 }
+                else if (read_sets[i] != NULL) {
+                    delete read_sets[i];
+                }
             }
             continue;
         }
 
-        // We'll only get here if we, for some reason, failed to process all of
-        // these. Rollback, clean up results we had gotten, and work back
-        // through them one at a time.
+        // We'll only get here if the SQL transaction itself failed, e.g.
+        // because the database was locked. Rollback, clean up results we had
+        // gotten, and work back through them one at a time.
         sqlRollback();
         for(uint32 i = 0; i < read_sets.size(); i++)
             if (read_sets[i] != NULL) delete read_sets[i];
         read_sets.clear();
 
         for(uint32 i = 0; i < transactions.size(); i++) {
-            result = SUCCESS;
+            Result result = SUCCESS;
             if (!sqlBeginTransaction())
                 result = LOCK_ERROR;
 
             ReadSet* rs = NULL;
+            BucketSet single_acquired;
             TransactionData& data = transactions[i];
-            result = executeCommit(data.bucket, data.trans, data.cb, &rs);
+            result = executeCommit(data.bucket, data.trans, data.cb, &rs, &single_acquired);
 
             if (result == SUCCESS) {
                 if (!sqlCommit())
                     result = LOCK_ERROR;
+                else
+                    scheduleRenewals(single_acquired);
             }
 
             // Either way, we need to clean up the transaction
@@ -590,15 +664,20 @@ void SQLiteStorage::processTransactions() {
 
 // Executes a commit. Runs in a separate thread, so the transaction is
 // passed in directly
-Storage::Result SQLiteStorage::executeCommit(const Bucket& bucket, Transaction* trans, CommitCallback cb, ReadSet** read_set_out) {
+Storage::Result SQLiteStorage::executeCommit(const Bucket& bucket, Transaction* trans, CommitCallback cb, ReadSet** read_set_out, BucketSet* acquired, BucketSet* leased) {
     ReadSet* rs = new ReadSet;
 
     // All these operations check the current result first, so if anything
     // fails, including acquiring the lease, we'll just fall through, cleanup,
     // and return the error.
-    Result result = acquireLease(bucket);
+    Result result = SUCCESS;
+    if (leased == NULL || leased->find(bucket) == leased->end()) {
+        result = acquireLease(bucket, acquired);
+        if (result == SUCCESS && leased != NULL)
+            leased->insert(bucket);
+    }
     for (Transaction::iterator it = trans->begin(); (result == SUCCESS) && it != trans->end(); it++) {
-        result = (*it).execute(mDB, bucket, rs);
+        result = (*it).execute(this, bucket, rs);
     }
 
     if (rs->empty() || (result != SUCCESS)) {
@@ -627,7 +706,7 @@ void SQLiteStorage::parseLeaseString(const String& ls, String* client_out, Time*
     *expiration_out = Time( boost::lexical_cast<uint64>( ls.substr(split_pos+1) ) );
 }
 
-Storage::Result SQLiteStorage::acquireLease(const Bucket& bucket) {
+Storage::Result SQLiteStorage::acquireLease(const Bucket& bucket, BucketSet* acquired) {
     // This happens within the context of a commit (the first one against this
     // bucket), so we should already be in a transaction.
 
@@ -642,7 +721,7 @@ Storage::Result SQLiteStorage::acquireLease(const Bucket& bucket) {
         StorageAction sa;
         sa.type = StorageAction::Read;
         sa.key = LEASE_KEY;
-        result = sa.execute(mDB, bucket, &lease_rs);
+        result = sa.execute(this, bucket, &lease_rs);
     }
 
     // Decide the next course of action based on whether the lease key
@@ -684,19 +763,16 @@ Storage::Result SQLiteStorage::acquireLease(const Bucket& bucket) {
         sa.key = LEASE_KEY;
         sa.value = new String(getLeaseString());
         ReadSet no_rs;
-        result = sa.execute(mDB, bucket, &no_rs);
+        result = sa.execute(this, bucket, &no_rs);
 
         // If we succeeded here, we got the lease, otherwise we failed
         // and need to give up.
         if (result != SUCCESS)
             return LOCK_ERROR;
 
-        // We now have a new lease, setup renewal process. There's no guarantee
-        // we'll get back to this in time, but we'll make a best effort by
-        // renewing after half the time has expired.
-        mRenewTimes.push( BucketRenewTimeout(bucket, Timer::now() + (mLeaseDuration/2)) );
-        if (mRenewTimes.size() == 1)
-            mRenewTimer->wait(mLeaseDuration/2);
+        // We now have a new lease, but it only sticks if the enclosing
+        // transaction commits, so renewal is set up by the caller after that.
+        acquired->insert(bucket);
     }
 
     // And finally, if we got here then we either had or acquired the
@@ -704,6 +780,19 @@ Storage::Result SQLiteStorage::acquireLease(const Bucket& bucket) {
     return SUCCESS;
 }
 
+void SQLiteStorage::scheduleRenewals(const BucketSet& acquired) {
+    if (acquired.empty()) return;
+
+    // There's no guarantee we'll get back to these in time, but we'll make a
+    // best effort by renewing after half the time has expired.
+    bool was_idle = mRenewTimes.empty();
+    Time renew_time = Timer::now() + (mLeaseDuration/2);
+    for(BucketSet::const_iterator it = acquired.begin(); it != acquired.end(); it++)
+        mRenewTimes.push( BucketRenewTimeout(*it, renew_time) );
+    if (was_idle)
+        mRenewTimer->wait(mLeaseDuration/2);
+}
+
 void SQLiteStorage::renewLease(const Bucket& bucket) {
     // Basic idea here is to lookup the lease to verify we still own it, then
     // update it. We need to wrap this in a SQLite transaction ourselves since
@@ -719,7 +808,7 @@ void SQLiteStorage::renewLease(const Bucket& bucket) {
         StorageAction sa;
         sa.type = StorageAction::Read;
         sa.key = LEASE_KEY;
-        result = sa.execute(mDB, bucket, &lease_rs);
+        result = sa.execute(this, bucket, &lease_rs);
     }
 
     // Nothing in there? releaseLease was called and removed it (or something
@@ -748,7 +837,7 @@ void SQLiteStorage::renewLease(const Bucket& bucket) {
         sa.key = LEASE_KEY;
         sa.value = new String(getLeaseString());
         ReadSet no_rs;
-        result = sa.execute(mDB, bucket, &no_rs);
+        result = sa.execute(this, bucket, &no_rs);
     }
 
     // If we failed to write the new key, give up. This really shouldn't happen.
@@ -784,7 +873,7 @@ void SQLiteStorage::releaseLease(const Bucket& bucket) {
         StorageAction sa;
         sa.type = StorageAction::Read;
         sa.key = LEASE_KEY;
-        result = sa.execute(mDB, bucket, &lease_rs);
+        result = sa.execute(this, bucket, &lease_rs);
     }
 
     // Nothing in there? Nothing to do, although it might indicate a problem
@@ -818,7 +907,7 @@ void SQLiteStorage::releaseLease(const Bucket& bucket) {
         sa.type = StorageAction::Erase;
         sa.key = LEASE_KEY;
         ReadSet no_rs;
-        result = sa.execute(mDB, bucket, &no_rs);
+        result = sa.execute(this, bucket, &no_rs);
     }
 
     if (result != SUCCESS) {
@@ -950,43 +1039,39 @@ bool SQLiteStorage::rangeErase(const Bucket& bucket, const Key& start, const Key
 
 bool SQLiteStorage::count(const Bucket& bucket, const Key& start, const Key& finish, const CountCallback& cb, const String& timestamp) {
     // FIXME doesn't fit into transactions...
-    String value_count = "SELECT COUNT(*) FROM ";
-    value_count += "\"" TABLE_NAME "\"";
-    value_count += " WHERE object = \'" + bucket.rawHexData() + "\' AND key BETWEEN ? AND ?";
-
     mIOService->post(
-        std::tr1::bind(&SQLiteStorage::executeCount, this, value_count, start, finish, cb),
+        std::tr1::bind(&SQLiteStorage::executeCount, this, bucket, start, finish, cb),
         "SQLiteStorage::executeCount"
     );
     return true;
 }
 
-void SQLiteStorage::executeCount(const String value_count, const Key& start, const Key& finish, CountCallback cb)
+void SQLiteStorage::executeCount(const Bucket& bucket, const Key& start, const Key& finish, CountCallback cb)
 {
     bool success = true;
     int32 count = 0;
 
-	int rc;
-    char* remain;
-    sqlite3_stmt* value_count_stmt;
-    rc = sqlite3_prepare_v2(mDB->db(), value_count.c_str(), -1, &value_count_stmt, (const char**)&remain);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error preparing value count statement");
-
-    if (rc==SQLITE_OK) {
-    	rc = sqlite3_bind_text(value_count_stmt, 1, start.c_str(), (int)start.size(), SQLITE_TRANSIENT);
-    	success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error binding start key to value count statement");
-    	rc = sqlite3_bind_text(value_count_stmt, 2, finish.c_str(), (int)finish.size(), SQLITE_TRANSIENT);
-    	success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error binding finish key to value count statement");
-    	if (rc==SQLITE_OK) {
-    		int step_rc = sqlite3_step(value_count_stmt);
-    		count = sqlite3_column_int(value_count_stmt, 0);
-    		if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE && step_rc != SQLITE_ROW)
-    			sqlite3_reset(value_count_stmt); // allow this to be cleaned up
-    	}
-
-    }
-    rc = sqlite3_finalize(value_count_stmt);
-    success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error finalizing value delete statement");
+    int rc;
+    String object = bucket.rawHexData();
+    sqlite3_stmt* value_count_stmt = getStatement(CountStatement);
+    success = (value_count_stmt != NULL);
+
+    if (value_count_stmt != NULL) {
+        rc = sqlite3_bind_text(value_count_stmt, 1, object.c_str(), (int)object.size(), SQLITE_STATIC);
+        success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error binding object to value count statement");
+        rc = sqlite3_bind_text(value_count_stmt, 2, start.c_str(), (int)start.size(), SQLITE_STATIC);
+        success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error binding start key to value count statement");
+        rc = sqlite3_bind_text(value_count_stmt, 3, finish.c_str(), (int)finish.size(), SQLITE_STATIC);
+        success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error binding finish key to value count statement");
+        if (rc==SQLITE_OK) {
+            int step_rc = sqlite3_step(value_count_stmt);
+            count = sqlite3_column_int(value_count_stmt, 0);
+            if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE && step_rc != SQLITE_ROW)
+                sqlite3_reset(value_count_stmt); // allow this to be cleaned up
+        }
+        rc = releaseStatement(CountStatement, value_count_stmt);
+        success = success && !SQLite::check_sql_error(mDB->db(), rc, NULL, "Error finalizing value count statement");
+    }
 
     if (cb) {
         Result result = (success ? SUCCESS : TRANSACTION_ERROR);
@@ -45,7 +45,23 @@ class FileStorageEvent;
 class SQLiteStorage : public Storage
 {
 public:
-    SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const Duration& lease_duration);
+    /** Create a SQLiteStorage.
+     *  \param ctx the ObjectHostContext
+     *  \param dbpath path of the database file
+     *  \param lease_duration how long bucket leases are held for
+     *  \param max_coalesced_transactions maximum number of queued
+     *         transactions, possibly for different buckets, to commit together
+     *         in a single SQLite transaction
+     *  \param cache_statements if true, prepared statements are kept and
+     *         reused instead of being prepared for every operation
+     *  \param journal_mode if not empty, the SQLite journal_mode to use,
+     *         e.g. "wal"
+     *  \param synchronous if not empty, the SQLite synchronous setting to
+     *         use, e.g. "normal"
+     */
+    SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const Duration& lease_duration,
+        uint32 max_coalesced_transactions = 64, bool cache_statements = true,
+        const String& journal_mode = "", const String& synchronous = "");
     ~SQLiteStorage();
 
     virtual void start();
@@ -87,7 +103,7 @@ private:
         StorageAction& operator=(const StorageAction& rhs);
 
         // Executes this action. Assumes the owning SQLiteStorage has setup the transaction.
-        Result execute(SQLiteDBPtr db, const Bucket& bucket, ReadSet* rs);
+        Result execute(SQLiteStorage* storage, const Bucket& bucket, ReadSet* rs);
 
         // Bucket is implicit, passed into execute
         Type type;
@@ -98,6 +114,25 @@ private:
 
     typedef std::vector<StorageAction> Transaction;
     typedef std::tr1::unordered_map<Bucket, Transaction*, Bucket::Hasher> BucketTransactions;
+    typedef std::tr1::unordered_set<Bucket, Bucket::Hasher> BucketSet;
+
+    // Every SQL statement we run. Buckets and keys are always bound as
+    // parameters so each of these only needs to be prepared once.
+    enum Statement {
+        ReadStatement,
+        ReadRangeStatement,
+        WriteStatement,
+        EraseStatement,
+        EraseRangeStatement,
+        CountStatement,
+        BeginStatement,
+        CommitStatement,
+        RollbackStatement,
+        SavepointStatement,
+        ReleaseSavepointStatement,
+        RollbackToSavepointStatement,
+        NumStatements
+    };
 
     // We keep a queue of transactions and trigger handlers, which can process
     // more than one at a time, on the storage IOService
@@ -134,14 +169,35 @@ private:
     // Tries to execute a commit *assuming it is within a SQL
     // transaction*. Returns whether it was successful, allowing for
     // rollback/retrying.
-    Result executeCommit(const Bucket& bucket, Transaction* trans, CommitCallback cb, ReadSet** read_set_out);
+    // Buckets whose leases it newly acquires are added to acquired, and
+    // should only be scheduled for renewal once the SQL transaction commits.
+    // If leased is non-NULL, it holds the buckets whose leases were already
+    // checked in the current SQL transaction, so they can be skipped.
+    Result executeCommit(const Bucket& bucket, Transaction* trans, CommitCallback cb, ReadSet** read_set_out, BucketSet* acquired, BucketSet* leased = NULL);
+
+    void executeCount(const Bucket& bucket, const Key& start, const Key& finish, CountCallback cb);
 
-    void executeCount(const String value_count, const Key& start, const Key& finish, CountCallback cb);
+    // Get a statement ready to have its parameters bound, or NULL if it
+    // couldn't be prepared. Every statement retrieved must be returned with
+    // releaseStatement, which resets (or finalizes) it and returns the result
+    // of doing so. Only used on the storage thread.
+    sqlite3_stmt* getStatement(Statement which);
+    int releaseStatement(Statement which, sqlite3_stmt* stmt);
+    void finalizeStatements();
+
+    // Set a pragma, e.g. journal_mode, if value is non-empty.
+    void setPragma(const String& pragma, const String& value);
 
     // A few helper methods that wrap sql operations.
     bool sqlBeginTransaction();
     bool sqlCommit();
     bool sqlRollback();
+    // Savepoints around each transaction in a group, so a failing one can be
+    // undone without losing the rest of the group.
+    bool sqlSavepoint();
+    bool sqlReleaseSavepoint();
+    bool sqlRollbackToSavepoint();
+    bool sqlExecute(Statement which, const char* description);
 
 
     // Helpers for leases:
@@ -154,8 +210,12 @@ private:
 
     // Acquire a lease (or update if it's already valid) for the given
     // bucket. This is part of a transaction -- the first part to
-    // ensure the transaction is valid
-    Result acquireLease(const Bucket& bucket);
+    // ensure the transaction is valid. If a new lease is written, the bucket
+    // is added to acquired.
+    Result acquireLease(const Bucket& bucket, BucketSet* acquired);
+    // Start renewing newly acquired leases. Only call this once the SQL
+    // transaction that acquired them has committed.
+    void scheduleRenewals(const BucketSet& acquired);
     // Renew a lease that we already have. Verifies we still hold the
     // lease, then renews it. This is an entire transaction.
     void renewLease(const Bucket& bucket);
@@ -170,6 +230,11 @@ private:
     String mDBFilename;
     SQLiteDBPtr mDB;
 
+    const bool mCacheStatements;
+    sqlite3_stmt* mStatements[NumStatements];
+    const String mJournalMode;
+    const String mSynchronous;
+
     // FIXME because we don't have proper multithreaded support in cppoh, we
     // need to allocate our own thread dedicated to IO
     Network::IOService* mIOService;
@@ -185,7 +250,7 @@ private:
     // Maximum transactions to combine into a single transaction in the
     // underlying database. TODO(ewencp) this should probably be dynamic, should
     // increase/decrease based on success/failure and avoid latency getting too
-    // hight. Right now we just have a reasonable, but small, number.
+    // high.
     uint32 mMaxCoalescedTransactions;
 
     struct BucketRenewTimeout {
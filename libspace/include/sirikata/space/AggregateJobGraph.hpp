@@ -0,0 +1,139 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_AGGREGATE_JOB_GRAPH_HPP_
+#define _SIRIKATA_SPACE_AGGREGATE_JOB_GRAPH_HPP_
+
+#include <sirikata/space/Platform.hpp>
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <boost/thread/mutex.hpp>
+#include <queue>
+#include <set>
+
+namespace Sirikata {
+
+/** AggregateJobGraph runs one job per aggregate on a pool of threads, where
+ *  an aggregate's job may depend on the jobs of its children, i.e. it only
+ *  runs once all the outstanding jobs it depends on have finished. Jobs that
+ *  are ready run in order of priority, highest first, on whichever pool thread
+ *  is free, so a single slow job only holds up the jobs that depend on it.
+ *
+ *  A job is outstanding from when it is added until finish() or cancel() is
+ *  called for it, which may be long after the job function returns, e.g. once
+ *  an asynchronous upload completes. Adding a job for an aggregate that
+ *  already has one outstanding replaces it rather than running both: a
+ *  waiting job just takes on the new function, priority and dependencies,
+ *  and a running job is run again after it finishes, before anything that
+ *  depends on it is released.
+ */
+class SIRIKATA_SPACE_EXPORT AggregateJobGraph {
+public:
+    typedef std::tr1::function<void()> Job;
+
+    /** Create a job graph.
+     *  \param nthreads number of threads to run jobs on, or 0 for one per core
+     *  \param name name used for the threads
+     */
+    AggregateJobGraph(uint32 nthreads, const String& name);
+    ~AggregateJobGraph();
+
+    uint32 numThreads() const { return mThreads.size(); }
+
+    /** Add a job for id which won't run until the outstanding jobs for each
+     *  of deps have finished. Dependencies without outstanding jobs are
+     *  ignored, as are ones that would create a cycle.
+     */
+    void add(const UUID& id, const std::vector<UUID>& deps, float64 priority, const Job& job);
+
+    /** Mark the job for id as finished, releasing the jobs that depend on it.
+     *  Does nothing if id has no outstanding job.
+     */
+    void finish(const UUID& id);
+    /** Drop the job for id without running it, if it hasn't started yet, and
+     *  release the jobs that depend on it. Does nothing if it's running.
+     */
+    void cancel(const UUID& id);
+    /** Run the job for id, which must be running, again after a delay, e.g.
+     *  because something it needed wasn't available yet.
+     */
+    void retry(const UUID& id, const Duration& delay);
+
+    // Number of outstanding jobs
+    uint32 size();
+    // Number of jobs that have finished
+    uint64 finishedCount();
+
+private:
+    struct Node {
+        Node() : priority(0), waitingOn(0), state(Waiting), rerun(false), generation(0), readyOrder(0) {}
+
+        enum State {
+            // Waiting for dependencies
+            Waiting,
+            // In the ready queue
+            Ready,
+            // Handed to a thread, until finish/retry
+            Running,
+            // Waiting to be retried
+            Delayed
+        };
+
+        Job job;
+        float64 priority;
+        // Outstanding jobs this one is waiting for, and the number of them
+        // that haven't finished
+        std::set<UUID> deps;
+        uint32 waitingOn;
+        // Jobs waiting for this one
+        std::vector<UUID> dependents;
+        State state;
+        // Replaced while running, so run again when finished
+        bool rerun;
+        // Distinguishes retries so stale ones can be ignored
+        uint32 generation;
+        // Order of the current ready queue entry, so entries replaced by
+        // re-prioritizing can be ignored
+        uint64 readyOrder;
+    };
+    typedef std::tr1::unordered_map<UUID, Node, UUID::Hasher> NodeMap;
+
+    struct ReadyEntry {
+        float64 priority;
+        uint64 order;
+        UUID id;
+        bool operator<(const ReadyEntry& rhs) const {
+            // Higher priority first, then first come first served
+            if (priority != rhs.priority) return priority < rhs.priority;
+            return order > rhs.order;
+        }
+    };
+
+    void threadMain();
+
+    // All of these must hold mMutex
+    bool dependsOn(const UUID& id, const UUID& target, uint32 depth);
+    void queueReady(const UUID& id, Node& node);
+    void makeReady(const UUID& id, Node& node);
+    void release(const UUID& id);
+
+    void runNext();
+    void handleRetry(UUID id, uint32 generation);
+
+    Network::IOService* mService;
+    Network::IOWork* mWork;
+    std::vector<Thread*> mThreads;
+
+    boost::mutex mMutex;
+    NodeMap mNodes;
+    std::priority_queue<ReadyEntry> mReady;
+    uint64 mReadyOrder;
+    uint64 mFinished;
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SPACE_AGGREGATE_JOB_GRAPH_HPP_
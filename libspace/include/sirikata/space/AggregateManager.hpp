@@ -42,6 +42,8 @@
 #include <sirikata/core/transfer/TransferMediator.hpp>
 
 #include <sirikata/space/LocationService.hpp>
+#include <sirikata/space/AggregateJobGraph.hpp>
+#include <sirikata/space/AggregateMeshCache.hpp>
 
 
 #include <sirikata/mesh/Meshdata.hpp>
@@ -50,6 +52,7 @@
 #include <sirikata/mesh/Filter.hpp>
 
 #include <sirikata/core/transfer/HttpManager.hpp>
+#include <sirikata/core/command/Commander.hpp>
 
 namespace Sirikata {
 
@@ -105,6 +108,8 @@ private:
     // Time at which we should try to refresh the TTL, should be set
     // a bit less than the actual timeout.
     Time refreshTTL;
+    // Key of the current mesh in the AggregateMeshCache
+    String cacheKey;
 
   } AggregateObject;
   typedef std::tr1::shared_ptr<AggregateObject> AggregateObjectPtr;
@@ -116,7 +121,16 @@ private:
   AggregateObjectsMap mAggregateObjects;
   Time mAggregateGenerationStartTime;    
   std::tr1::unordered_map<UUID, AggregateObjectPtr, UUID::Hasher> mDirtyAggregateObjects;
-  std::map<float, std::deque<AggregateObjectPtr > > mObjectsByPriority;
+
+  // Aggregate mesh generation jobs, each depending on the jobs of its
+  // children. A job is finished once its mesh is uploaded (or it gives up).
+  AggregateJobGraph* mJobGraph;
+  // Start of the current round of generation, i.e. since the job graph was
+  // last empty, and the number of jobs finished before it began. Protected by
+  // mJobRoundMutex since jobs finish on the job graph's threads.
+  boost::mutex mJobRoundMutex;
+  Time mJobRoundStartTime;
+  uint64 mJobRoundStartCount;
 
   //Variables related to downloading and in-memory caching meshes
   boost::mutex mMeshStoreMutex;
@@ -124,18 +138,22 @@ private:
   std::tr1::shared_ptr<Transfer::TransferPool> mTransferPool;
   Transfer::TransferMediator *mTransferMediator;
 
+  // Meshes that have already been generated, so they can be reused if an
+  // aggregate ends up with the same children again.
+  AggregateMeshCache* mMeshCache;
+
   //CDN upload-related variables
   Transfer::OAuthParamsPtr mOAuth;
   const String mCDNUsername;
   Duration mModelTTL;
   Poller* mCDNKeepAlivePoller;
 
-  //CDN upload threads' variables
+  //CDN upload threads' variables. The threads share one IOService, so each
+  //upload goes to whichever thread is free.
   enum{NUM_UPLOAD_THREADS = 3};
   Thread* mUploadThreads[NUM_UPLOAD_THREADS];
-  Network::IOService* mUploadServices[NUM_UPLOAD_THREADS];
-  Network::IOStrand* mUploadStrands[NUM_UPLOAD_THREADS];
-  Network::IOWork* mUploadWorks[NUM_UPLOAD_THREADS];
+  Network::IOService* mUploadService;
+  Network::IOWork* mUploadWork;
   void uploadThreadMain(uint8 i);
   
 
@@ -153,15 +171,24 @@ private:
   void updateChildrenTreeLevel(const UUID& uuid, uint16 treeLevel);
   void addDirtyAggregates(UUID uuid);
   void generateMeshesFromQueue(Time postTime);
-  void generateAggregateMeshAsyncIgnoreErrors(const UUID uuid, Time postTime, bool generateSiblings = true);
-  enum{GEN_SUCCESS=1, CHILDREN_NOT_YET_GEN=2, OTHER_GEN_FAILURE=3}; 
+  // Periodic regeneration requested by generateAggregateMesh, skipped if the
+  // aggregate was generated again after postTime
+  void regenerateAggregateMesh(AggregateObjectPtr aggObject, Time postTime);
+  enum{GEN_SUCCESS=1, CHILDREN_NOT_YET_GEN=2, OTHER_GEN_FAILURE=3, GEN_NOT_FOUND=4};
   uint32 generateAggregateMeshAsync(const UUID uuid, Time postTime, bool generateSiblings = true);
+  // Job for mJobGraph, runs generateAggregateMeshAsync and retries it if the
+  // aggregate isn't ready yet.
+  void runAggregateJob(const UUID uuid);
+  // Adds or replaces the job for aggObject, depending on its children's jobs
+  void addAggregateJob(AggregateObjectPtr aggObject);
+  void finishAggregateJob(const UUID& uuid);
   void aggregationThreadMain();
 
 
   //Functions related to uploading aggregates
   void uploadAggregateMesh(Mesh::MeshdataPtr agg_mesh, AggregateObjectPtr aggObject,
-                           std::tr1::unordered_map<String, String> textureSet, uint32 retryAttempt);
+                           std::tr1::unordered_map<String, String> textureSet, const String& cacheKey,
+                           uint32 retryAttempt);
   // Helper that handles the upload callback and sets flags to let the request
   // from the aggregation thread to continue
   void handleUploadFinished(Transfer::UploadRequestPtr request, const Transfer::URI& path, AtomicValue<bool>* finished_out, Transfer::URI* generated_uri_out);  
@@ -179,11 +206,24 @@ private:
   // removed.
   bool cleanUpChild(const UUID& parent_uuid, const UUID& child_id);
   void removeStaleLeaves();
+
+  // Commands
+  void commandCacheStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
   
 
 public:
 
-  AggregateManager(LocationService* loc, Transfer::OAuthParamsPtr oauth, const String& username);
+  /** Create an AggregateManager.
+   *  \param loc the LocationService to get aggregates and their children from
+   *  \param oauth OAuth parameters for uploading to the CDN, or NULL to upload
+   *         to the old web server instead
+   *  \param username CDN username to upload as
+   *  \param cache_path file to keep the cache of generated meshes in, or empty
+   *         to only keep it in memory
+   *  \param cache_size maximum total size of the meshes in the cache, in bytes
+   */
+  AggregateManager(LocationService* loc, Transfer::OAuthParamsPtr oauth, const String& username,
+                   const String& cache_path = "", uint64 cache_size = 256*1024*1024);
 
   ~AggregateManager();
 
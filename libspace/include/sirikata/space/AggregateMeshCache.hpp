@@ -0,0 +1,134 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_AGGREGATE_MESH_CACHE_HPP_
+#define _SIRIKATA_SPACE_AGGREGATE_MESH_CACHE_HPP_
+
+#include <sirikata/space/Platform.hpp>
+#include <sirikata/core/util/Sha256.hpp>
+#include <sirikata/core/util/Time.hpp>
+#include <boost/thread/mutex.hpp>
+#include <fstream>
+#include <list>
+
+namespace Sirikata {
+
+/** AggregateMeshCache remembers the meshes AggregateManager has already
+ *  generated and uploaded, keyed by the content they were generated from, so
+ *  an aggregate whose children return to a set of meshes and transforms it
+ *  had before (e.g. objects moving back and forth across an aggregate
+ *  boundary) can reuse the uploaded mesh instead of merging, simplifying and
+ *  uploading it again.
+ *
+ *  Entries are evicted in least recently used order once the total size of
+ *  the meshes they refer to exceeds the capacity. Uploads to the CDN are
+ *  ephemeral, so entries can also expire, and are dropped once they do.
+ *
+ *  If a path is given, the cache is kept in a log file which is appended to
+ *  as entries change and replayed when the cache is created, so it survives
+ *  restarts. All methods are thread safe.
+ */
+class SIRIKATA_SPACE_EXPORT AggregateMeshCache {
+public:
+    struct Entry {
+        Entry() : expires(Time::null()), size(0) {}
+
+        // URI of the uploaded mesh
+        String uri;
+        // Base name of the asset on the CDN for keep-alives, or empty
+        String cdnBaseName;
+        // Time the uploaded mesh expires, or Time::null() if it never does
+        Time expires;
+        // Size of the mesh in bytes
+        uint64 size;
+    };
+
+    /** Builds a key from everything an aggregate's mesh is generated from.
+     *  Floating point values are quantized so tiny changes, e.g. from
+     *  numerical noise in location updates, still produce the same key.
+     */
+    class SIRIKATA_SPACE_EXPORT KeyBuilder {
+    public:
+        KeyBuilder();
+
+        void addChild(const String& mesh, const Vector3f& offset, const Quaternion& orient, float32 radius);
+        void setSimplificationTarget(uint32 nfaces);
+
+        String key();
+    private:
+        void addQuantized(float32 val, float32 quantum);
+
+        SHA256Context mContext;
+        uint32 mChildren;
+    };
+
+    /** Create a cache.
+     *  \param path the log file to keep the cache in, or empty to keep it in
+     *         memory only
+     *  \param capacity the maximum total size of the entries' meshes
+     */
+    AggregateMeshCache(const String& path, uint64 capacity);
+    ~AggregateMeshCache();
+
+    /** Look up key, filling in entry and marking it as recently used if it is
+     *  found and hasn't expired. Counts as a hit if it is found.
+     */
+    bool lookup(const String& key, Entry* entry);
+    /** Records a miss, i.e. that a mesh had to be generated because it wasn't
+     *  in the cache. Misses aren't counted by lookup() since a mesh may be
+     *  looked up several times before it can be generated.
+     */
+    void miss();
+
+    void insert(const String& key, const Entry& entry);
+    // Updates the expiration time of the entry for key, if there is one.
+    void refresh(const String& key, const Time& expires);
+    void remove(const String& key);
+
+    uint64 hits() const;
+    uint64 misses() const;
+    uint32 numEntries() const;
+    uint64 size() const;
+    uint64 capacity() const { return mCapacity; }
+
+private:
+    typedef std::list<String> LRUList;
+    struct CacheEntry {
+        Entry entry;
+        LRUList::iterator lruIt;
+    };
+    typedef std::tr1::unordered_map<String, CacheEntry> EntryMap;
+
+    // All the following must hold mMutex
+    void insertEntry(const String& key, const Entry& entry);
+    void eraseEntry(EntryMap::iterator it);
+    void evict();
+
+    // Log file
+    void replay();
+    // Writes all entries to a new log and replaces the current one with it.
+    void compact();
+    void appendInsert(const String& key, const Entry& entry);
+    void appendRemove(const String& key);
+    void appendRecord(const String& record);
+
+    const String mPath;
+    const uint64 mCapacity;
+
+    mutable boost::mutex mMutex;
+    EntryMap mEntries;
+    // Most recently used at the front
+    LRUList mLRU;
+    uint64 mSize;
+    uint64 mHits;
+    uint64 mMisses;
+
+    std::ofstream mLog;
+    // Records in the log, used to decide when to compact it
+    uint64 mLogRecords;
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SPACE_AGGREGATE_MESH_CACHE_HPP_
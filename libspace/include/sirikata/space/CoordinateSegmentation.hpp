@@ -56,10 +56,21 @@ public:
         virtual void updatedSegmentation(CoordinateSegmentation* cseg, const std::vector<SegmentationInfo>& new_segmentation) = 0;
     }; // class Listener
 
+    typedef std::tr1::function<void(ServerID)> LookupCallback;
+
     CoordinateSegmentation(SpaceContext* ctx);
     virtual ~CoordinateSegmentation();
 
     virtual ServerID lookup(const Vector3f& pos) = 0;
+    /** Look up the server for pos without blocking the caller on the
+     *  network. If the answer is already known, cb may be invoked before this
+     *  returns; otherwise it's invoked later from an implementation defined
+     *  thread, so wrap it in a strand if it needs to run somewhere specific.
+     *  The default implementation just calls lookup().
+     */
+    virtual void asyncLookup(const Vector3f& pos, const LookupCallback& cb) {
+        cb(lookup(pos));
+    }
     virtual BoundingBoxList serverRegion(const ServerID& server)  = 0;
     virtual BoundingBox3f region()  = 0;
     virtual uint32 numServers()  = 0;
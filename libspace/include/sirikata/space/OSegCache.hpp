@@ -40,13 +40,18 @@
 namespace Sirikata
 {
 
+  /** Cache of OSeg lookup results. Implementations must be thread safe,
+   *  lookups may come from the forwarder's receive threads as well as the
+   *  OSeg strand. get() returns by value so the result can't be changed out
+   *  from under the caller by a concurrent insert or eviction.
+   */
   class OSegCache
   {
     public:
       virtual ~OSegCache() {}
 
       virtual void insert(const UUID& uuid, const OSegEntry& sID) = 0;
-      virtual const OSegEntry& get(const UUID& uuid)              = 0;
+      virtual OSegEntry get(const UUID& uuid)                     = 0;
       virtual void remove(const UUID& uuid)                       = 0;
   };
 
@@ -0,0 +1,213 @@
+/*  Sirikata
+ *  OSegLookupQueue.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _OSEG_LOOKUP_QUEUE_HPP_
+#define _OSEG_LOOKUP_QUEUE_HPP_
+
+#include <sirikata/space/Platform.hpp>
+#include <sirikata/space/ServerMessage.hpp>
+#include <sirikata/space/ObjectSegmentation.hpp>
+#include <sirikata/core/command/Commander.hpp>
+#include <sirikata/core/trace/LatencyHistogram.hpp>
+#include <deque>
+
+namespace Sirikata {
+
+/** OSegLookupQueue manages outstanding OSeg lookups.  Lookups are submitted
+ *  and either accepted and we commit to finishing them or rejected immediately.
+ *  New lookups are rejected once there are too many unique objects being
+ *  looked up or the OSeg reports too much pushback.
+ *
+ *  Messages for objects which are already being looked up are coalesced onto
+ *  the outstanding lookup. With a batch size set, lookups for new objects are
+ *  also coalesced: they're collected until the network strand is free (or
+ *  the batch fills up) and then issued to the OSeg together, so a lookup
+ *  storm results in a few multi-key requests instead of one request per
+ *  object.
+ *
+ *  With a memory budget set, the total size of queued messages is bounded by
+ *  dropping the oldest queued messages, which are handed back to their
+ *  callbacks marked as Dropped.
+ */
+class SIRIKATA_SPACE_EXPORT OSegLookupQueue : public OSegLookupListener {
+public:
+    enum ResolvedFrom {
+        ResolvedFromCache,
+        ResolvedFromServer,
+        // Dropped to keep the queue within its memory budget. The OSegEntry is
+        // null and the callback should just discard the message.
+        Dropped
+    };
+
+    /** Callback type for lookups, taking the message the lookup was performed on, the
+     *  ServerID the OSeg returned, and an enum indicating how the lookup was resolved.
+     *  If you need additional information it must be curried via bind().
+     */
+    typedef std::tr1::function<void(Sirikata::Protocol::Object::ObjectMessage*, const OSegEntry&, ResolvedFrom)> LookupCallback;
+
+private:
+    struct OSegLookup {
+        Sirikata::Protocol::Object::ObjectMessage* msg;
+        LookupCallback cb;
+        uint32 size;
+        // Order the message was queued in, across all objects
+        uint64 seqno;
+    };
+
+    /** A normal deque of OSegLookups except it also maintains the
+     *  total size of all its elements and when the lookup started.
+     */
+    class OSegLookupList : protected std::deque<OSegLookup> {
+        typedef std::deque<OSegLookup> OSegLookupDeque;
+        size_t mTotalSize;
+        Time mStarted;
+    public:
+        typedef OSegLookupDeque::iterator iterator;
+
+        OSegLookupList();
+
+        size_t ByteSize() const;
+        size_t size() const;
+        bool empty() const;
+        OSegLookup& operator[] (size_t where);
+        OSegLookup& front();
+        void push_back(const OSegLookup& lu);
+        void pop_front();
+        OSegLookupDeque::iterator begin();
+        OSegLookupDeque::iterator end();
+
+        const Time& started() const;
+        void setStarted(const Time& t);
+    };
+
+    typedef std::tr1::unordered_map<UUID, OSegLookupList, UUID::Hasher> LookupMap;
+
+    // An entry in the order messages were queued in, used to find the oldest
+    // message when shedding.
+    struct QueuedMessage {
+        QueuedMessage(uint64 _seqno, const UUID& _id)
+         : seqno(_seqno), id(_id)
+        {}
+        uint64 seqno;
+        UUID id;
+    };
+    typedef std::deque<QueuedMessage> QueuedMessageList;
+
+    SpaceContext* mContext;
+    Network::IOStrand* mNetworkStrand;
+    OSegLookupProvider* mOSeg; // The OSeg that does the heavy lifting
+
+    LookupMap mLookups; // Map of object id being queried -> msgs destined for that object
+    size_t mTotalSize; // Total # bytes associated with outstanding lookups
+    uint32 mMaxLookups; // Total number of unique OSeg lookups (i.e. number of
+                        // UUIDs, not number of requests).
+    size_t mMaxSize; // Memory budget for queued messages, or 0 for no limit
+    uint32 mBatchSize; // Maximum lookups per OSeg request, or 0 to issue
+                       // them immediately, one at a time
+
+    // Queued messages, oldest first. Delivered messages aren't removed
+    // immediately, they're skipped over when shedding and cleaned out
+    // periodically. Only maintained with a memory budget.
+    QueuedMessageList mQueuedOrder;
+    uint64 mNextSeqno;
+    uint64 mNumQueued;
+
+    // Lookups waiting to be issued as a batch
+    std::vector<UUID> mBatch;
+    bool mBatchFlushPosted;
+
+    // Stats
+    uint64 mLookupsIssued;
+    uint64 mRequestsIssued;
+    uint64 mMessagesDropped;
+    Trace::LatencyHistogram mLatencies;
+
+    // Add a message to the lookup for id
+    void enqueue(const UUID& id, Sirikata::Protocol::Object::ObjectMessage* msg, const LookupCallback& cb, uint32 size);
+    // Whether the queued message described by qm is still waiting
+    bool stillQueued(const QueuedMessage& qm);
+    // Drop the oldest messages until we're back within the memory budget
+    void shed();
+
+    // Issue the batch of lookups that have been collected
+    void flushBatch();
+    void handleFlushBatch();
+
+    /* OSegLookupListener Interface */
+    virtual void osegLookupCompleted(const UUID& id, const OSegEntry& dest);
+    /* Main thread handler for lookups. */
+    void handleLookupCompleted(const UUID& id, const OSegEntry& dest, ResolvedFrom resolved_from);
+
+    void commandStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
+public:
+    /** Create an OSegLookupQueue which uses the specified ObjectSegmentation to resolve queries.
+     *  \param ctx the SpaceContext, or NULL if no commands should be registered
+     *  \param net_strand the strand used for networking, i.e. the one which should handle lookup
+     *                    results
+     *  \param oseg the ObjectSegmentation which resolves queries
+     *  \param max_lookups maximum number of unique objects being looked up
+     *  \param max_size memory budget for queued messages in bytes, or 0 for no limit
+     *  \param batch_size maximum number of lookups to issue to the OSeg in one
+     *                    request, or 0 to issue each one immediately
+     */
+    OSegLookupQueue(SpaceContext* ctx, Network::IOStrand* net_strand, OSegLookupProvider* oseg,
+        uint32 max_lookups, size_t max_size = 0, uint32 batch_size = 0);
+
+    virtual ~OSegLookupQueue();
+
+    /** Perform an OSeg cache lookup, returning the ServerID or NullServerID if
+     *  the cache doesn't contain an entry for the object.
+     */
+    OSegEntry cacheLookup(const UUID& destid) const;
+    /** Perform an OSeg lookup, calling the specified callback when the result is available.
+     *  If the result is available immediately, the callback may be triggered during this
+     *  call.  Otherwise, it will be triggered when a service() call produces a result.
+     *  Note that if the request is accepted, the message is owned by the OSegLookupQueue until
+     *  the callback is invoked, at which time control is passed back to the caller.
+     *  \param msg the ObjectMessage to perform the lookup for
+     *  \param cb the callback to invoke when the lookup is complete
+     *  \returns true if the lookup was accepted, false if it was rejected (due to the push predicate).
+     */
+    bool lookup(Sirikata::Protocol::Object::ObjectMessage* msg, const LookupCallback& cb);
+
+    // Stats
+    uint32 numLookups() const { return mLookups.size(); }
+    size_t queuedBytes() const { return mTotalSize; }
+    uint64 lookupsIssued() const { return mLookupsIssued; }
+    uint64 requestsIssued() const { return mRequestsIssued; }
+    uint64 messagesDropped() const { return mMessagesDropped; }
+    const Trace::LatencyHistogram& latencies() const { return mLatencies; }
+};
+
+} // namespace Sirikata
+
+#endif //_OSEG_LOOKUP_QUEUE_HPP_
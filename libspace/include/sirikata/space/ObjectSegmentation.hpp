@@ -97,6 +97,45 @@ public:
 }; // class OSegLookupListener
 
 
+/** The lookup half of ObjectSegmentation, i.e. everything OSegLookupQueue
+ *  needs to resolve lookups.
+ */
+class SIRIKATA_SPACE_EXPORT OSegLookupProvider {
+protected:
+    OSegLookupListener* mLookupListener;
+
+public:
+    OSegLookupProvider()
+     : mLookupListener(NULL)
+    {}
+    virtual ~OSegLookupProvider() {}
+
+    void setLookupListener(OSegLookupListener* listener) {
+        mLookupListener = listener;
+    }
+
+    /** Look up the server for an object. If the result is available
+     *  immediately it is returned, otherwise a null OSegEntry is returned and
+     *  the listener is notified when the lookup completes.
+     */
+    virtual OSegEntry lookup(const UUID& obj_id) = 0;
+    virtual OSegEntry cacheLookup(const UUID& obj_id) = 0;
+    /** Look up several objects at once. results is filled in with an entry
+     *  for each of obj_ids, either the result or, if it isn't available
+     *  immediately, a null OSegEntry, in which case the listener is notified
+     *  when the lookup completes, as with lookup(). Implementations that can
+     *  send multiple keys in one request should override this; by default it
+     *  just performs each lookup individually.
+     */
+    virtual void lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results);
+
+    virtual int getPushback()
+    {
+        return 0;
+    }
+}; // class OSegLookupProvider
+
+
 /** Listener interface for OSeg write events. */
 class OSegWriteListener {
 public:
@@ -117,12 +156,11 @@ public:
 
 
 
-class SIRIKATA_SPACE_EXPORT ObjectSegmentation : public Service, public MessageRecipient
+class SIRIKATA_SPACE_EXPORT ObjectSegmentation : public Service, public MessageRecipient, public OSegLookupProvider
 {
 protected:
     SpaceContext* mContext;
     bool mStopping;
-    OSegLookupListener* mLookupListener;
     OSegWriteListener* mWriteListener;
     Network::IOStrand* oStrand;
 
@@ -156,28 +194,16 @@ public:
           mStopping = true;
       }
 
-      void setLookupListener(OSegLookupListener* listener) {
-          mLookupListener = listener;
-      }
-
       void setWriteListener(OSegWriteListener* listener) {
           mWriteListener = listener;
       }
 
       
-    virtual OSegEntry lookup(const UUID& obj_id) = 0;
-    virtual OSegEntry cacheLookup(const UUID& obj_id) = 0;
     virtual void migrateObject(const UUID& obj_id, const OSegEntry& new_server_id) = 0;
     virtual void addNewObject(const UUID& obj_id, float radius) = 0;
     virtual void addMigratedObject(const UUID& obj_id, float radius, ServerID idServerAckTo, bool) = 0;
     virtual void removeObject(const UUID& obj_id) = 0;
     virtual bool clearToMigrate(const UUID& obj_id) = 0;
-
-    virtual int getPushback()
-    {
-        return 0;
-    }
-
   };
 
 class SIRIKATA_SPACE_EXPORT OSegFactory
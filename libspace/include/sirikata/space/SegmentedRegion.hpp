@@ -258,6 +258,227 @@ typedef struct SegmentedRegion {
 
 } SegmentedRegion;
 
+/** A read-only copy of a SegmentedRegion tree, laid out for fast lookups.
+ *  Nodes are stored in a single array in depth-first order, so a node's left
+ *  child immediately follows it and descending the tree mostly walks forward
+ *  through memory. Each node only keeps its splitting plane, which is all a
+ *  point lookup needs to decide which way to go, and leaves refer back to the
+ *  SegmentedRegions they were built from. Leaves are also indexed by server.
+ *
+ *  Nodes whose children don't split them cleanly along a single axis aren't
+ *  flattened; lookups that reach them fall back to searching the original
+ *  tree. The snapshot holds pointers into the tree it was built from, so it
+ *  must be rebuilt whenever that tree changes.
+ */
+class SegmentedRegionSnapshot {
+public:
+  SegmentedRegionSnapshot() : mRoot(NULL) {}
+
+  void build(SegmentedRegion* root) {
+    mNodes.clear();
+    mRegions.clear();
+    mServerLeaves.clear();
+
+    mRoot = root;
+    if (root == NULL) return;
+
+    mBounds = root->mBoundingBox;
+    addNode(root);
+  }
+
+  bool empty() const {
+    return mNodes.empty();
+  }
+
+  SegmentedRegion* lookup(const Vector3f& pos) const {
+    if (mNodes.empty()) return NULL;
+    // Splitting planes only work for points inside the tree
+    if (!mBounds.contains(pos)) return mRoot->lookup(pos);
+
+    uint32 idx = 0;
+    while(mNodes[idx].axis < LEAF)
+      idx = child(mNodes[idx], idx, pos);
+
+    return resolve(mNodes[idx], pos);
+  }
+
+  /** Look up count points at once, storing the server responsible for each
+   *  in servers_out, or NullServerID if no region contains it. Points are
+   *  walked down the tree in groups, one level at a time, so the splitting
+   *  plane tests for a group are independent of each other.
+   */
+  void lookup(const Vector3f* pos, size_t count, ServerID* servers_out) const {
+    if (mNodes.empty()) {
+      for(size_t i = 0; i < count; i++)
+        servers_out[i] = NullServerID;
+      return;
+    }
+
+    uint32 cur[LOOKUP_GROUP_SIZE];
+    for(size_t base = 0; base < count; base += LOOKUP_GROUP_SIZE) {
+      size_t n = std::min(count - base, (size_t)LOOKUP_GROUP_SIZE);
+      const Vector3f* group = pos + base;
+
+      for(size_t i = 0; i < n; i++)
+        cur[i] = 0;
+
+      bool descending = true;
+      while(descending) {
+        descending = false;
+        for(size_t i = 0; i < n; i++) {
+          const Node& node = mNodes[cur[i]];
+          if (node.axis < LEAF) {
+            cur[i] = child(node, cur[i], group[i]);
+            descending = true;
+          }
+        }
+      }
+
+      for(size_t i = 0; i < n; i++) {
+        SegmentedRegion* region = mBounds.contains(group[i]) ? resolve(mNodes[cur[i]], group[i]) : mRoot->lookup(group[i]);
+        servers_out[base + i] = (region != NULL) ? region->mServer : NullServerID;
+      }
+    }
+  }
+
+  void lookupBoundingBox(const BoundingBox3f& bbox, std::vector<SegmentedRegion*>& intersectingLeaves) const {
+    if (mNodes.empty() || !mBounds.intersects(bbox)) return;
+
+    std::vector<uint32> stack;
+    stack.push_back(0);
+    while(!stack.empty()) {
+      uint32 idx = stack.back();
+      stack.pop_back();
+      const Node& node = mNodes[idx];
+
+      if (node.axis == LEAF) {
+        if (mRegions[node.index]->mBoundingBox.intersects(bbox))
+          intersectingLeaves.push_back(mRegions[node.index]);
+      }
+      else if (node.axis == UNSPLIT) {
+        mRegions[node.index]->lookupBoundingBox(bbox, intersectingLeaves);
+      }
+      else {
+        // Push right first so leaves come out in the same order as
+        // SegmentedRegion::lookupBoundingBox
+        if (node.rightMin < bbox.max()[node.axis])
+          stack.push_back(node.index);
+        if (bbox.min()[node.axis] < node.leftMax)
+          stack.push_back(idx + 1);
+      }
+    }
+  }
+
+  SegmentedRegion* lookupSegmentedRegion(const ServerID& server_id) const {
+    ServerLeafMap::const_iterator it = mServerLeaves.find(server_id);
+    if (it == mServerLeaves.end()) return NULL;
+    return it->second[0];
+  }
+
+  void serverRegion(const ServerID& server, BoundingBoxList& boundingBoxList) const {
+    ServerLeafMap::const_iterator it = mServerLeaves.find(server);
+    if (it == mServerLeaves.end()) return;
+
+    for(uint32 i = 0; i < it->second.size(); i++)
+      boundingBoxList.push_back(it->second[i]->mBoundingBox);
+  }
+
+private:
+  // Values of Node::axis beyond the three split axes
+  enum { LEAF = 3, UNSPLIT = 4 };
+  enum { LOOKUP_GROUP_SIZE = 16 };
+
+  struct Node {
+    // Only valid for split nodes: the left child's max and right child's min
+    // along the split axis. These differ slightly due to rounding.
+    float32 leftMax;
+    float32 rightMin;
+    uint32 axis;
+    // Right child for split nodes, index into mRegions otherwise
+    uint32 index;
+  };
+
+  typedef std::tr1::unordered_map<ServerID, std::vector<SegmentedRegion*> > ServerLeafMap;
+
+  uint32 child(const Node& node, uint32 idx, const Vector3f& pos) const {
+    // Same test as mLeftChild->mBoundingBox.contains(pos); the other axes
+    // were already checked on the way down.
+    return (node.leftMax - pos[node.axis] < -BBOX_CONTAINS_EPSILON) ? node.index : idx + 1;
+  }
+
+  SegmentedRegion* resolve(const Node& node, const Vector3f& pos) const {
+    SegmentedRegion* region = mRegions[node.index];
+    if (node.axis == UNSPLIT)
+      return region->lookup(pos);
+    if (region->mBoundingBox.contains(pos) || region->mBoundingBox.degenerate())
+      return region;
+    return NULL;
+  }
+
+  static bool close(float32 a, float32 b) {
+    return std::fabs(a - b) <= BBOX_CONTAINS_EPSILON;
+  }
+
+  // Returns the axis region's children split it along, or UNSPLIT
+  static uint32 splitAxis(const SegmentedRegion* region) {
+    const BoundingBox3f& parent = region->mBoundingBox;
+    const BoundingBox3f& left = region->mLeftChild->mBoundingBox;
+    const BoundingBox3f& right = region->mRightChild->mBoundingBox;
+
+    uint32 axis = UNSPLIT;
+    for(uint32 i = 0; i < 3; i++) {
+      if (!close(left.min()[i], parent.min()[i]) || !close(right.max()[i], parent.max()[i]))
+        return UNSPLIT;
+
+      if (close(left.max()[i], parent.max()[i]) && close(right.min()[i], parent.min()[i]))
+        continue;
+
+      if (axis != UNSPLIT || !close(left.max()[i], right.min()[i]))
+        return UNSPLIT;
+      axis = i;
+    }
+    return axis;
+  }
+
+  void addLeaves(SegmentedRegion* region) {
+    if (region->mLeftChild == NULL && region->mRightChild == NULL) {
+      mServerLeaves[region->mServer].push_back(region);
+      return;
+    }
+    if (region->mLeftChild != NULL) addLeaves(region->mLeftChild);
+    if (region->mRightChild != NULL) addLeaves(region->mRightChild);
+  }
+
+  void addNode(SegmentedRegion* region) {
+    uint32 idx = mNodes.size();
+    mNodes.push_back(Node());
+
+    uint32 axis = LEAF;
+    if (region->mLeftChild != NULL || region->mRightChild != NULL)
+      axis = (region->mLeftChild != NULL && region->mRightChild != NULL) ? splitAxis(region) : UNSPLIT;
+    mNodes[idx].axis = axis;
+
+    if (axis >= LEAF) {
+      mNodes[idx].index = mRegions.size();
+      mRegions.push_back(region);
+      addLeaves(region);
+      return;
+    }
+
+    mNodes[idx].leftMax = region->mLeftChild->mBoundingBox.max()[axis];
+    mNodes[idx].rightMin = region->mRightChild->mBoundingBox.min()[axis];
+    addNode(region->mLeftChild);
+    mNodes[idx].index = mNodes.size();
+    addNode(region->mRightChild);
+  }
+
+  SegmentedRegion* mRoot;
+  BoundingBox3f mBounds;
+  std::vector<Node> mNodes;
+  std::vector<SegmentedRegion*> mRegions;
+  ServerLeafMap mServerLeaves;
+};
+
 typedef struct SerializedSegmentedRegion {
   ServerID mServerID;
   uint32 mLeftChildIdx;
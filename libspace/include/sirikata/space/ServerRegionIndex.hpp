@@ -0,0 +1,98 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_SERVER_REGION_INDEX_HPP_
+#define _SIRIKATA_SPACE_SERVER_REGION_INDEX_HPP_
+
+#include <sirikata/space/Platform.hpp>
+#include <sirikata/core/util/BoundingBox.hpp>
+
+namespace Sirikata {
+
+/** ServerRegionIndex maps points and boxes to the servers whose regions
+ *  contain them, for a set of (region, server) pairs that are only ever added
+ *  to or cleared, like the regions a CoordinateSegmentation client learns
+ *  about from lookup responses.
+ *
+ *  Regions are kept in a packed bounding volume hierarchy stored as a flat
+ *  array of nodes, so a point lookup only visits the few nodes that contain
+ *  the point instead of every region. Newly inserted regions go into a small
+ *  unindexed tail which is scanned linearly; once it grows past roughly the
+ *  square root of the number of regions the hierarchy is rebuilt to include
+ *  them, keeping both the tail scan and the total rebuild cost small.
+ *
+ *  Not thread safe, callers must provide their own locking.
+ */
+class SIRIKATA_SPACE_EXPORT ServerRegionIndex {
+public:
+    ServerRegionIndex();
+
+    /** Add a region. Returns false and does nothing if the same region is
+     *  already present.
+     */
+    bool insert(const BoundingBox3f& region, ServerID server);
+    void clear();
+
+    uint32 size() const;
+
+    /** Get the server whose region contains pos, or NullServerID if no known
+     *  region does. If regions overlap (at their boundaries), the one inserted
+     *  first wins.
+     */
+    ServerID lookup(const Vector3f& pos) const;
+
+    /** Collect the servers whose regions intersect bbox, each listed once.
+     *  \returns true if the known regions cover all of bbox without
+     *           overlapping, i.e. if servers is known to be the complete
+     *           answer. Overlapping regions mean some of them are stale, so
+     *           the answer can't be trusted. Coverage is only checked when
+     *           at most MaxCoverageRegions regions intersect bbox; false is
+     *           returned for larger boxes.
+     */
+    bool lookupBoundingBox(const BoundingBox3f& bbox, std::vector<ServerID>* servers) const;
+
+private:
+    // Maximum number of regions in a leaf node
+    static const uint32 LeafSize = 4;
+    // Smallest tail size that triggers a rebuild
+    static const uint32 MinTailSize = 32;
+    // Most regions lookupBoundingBox will check coverage for. Checking is
+    // cubic in the number of regions.
+    static const uint32 MaxCoverageRegions = 16;
+
+    struct Entry {
+        BoundingBox3f region;
+        ServerID server;
+        // Insertion order, used to break ties between overlapping regions
+        uint32 order;
+    };
+
+    // Nodes are stored in depth first order, so an internal node's first
+    // child immediately follows it. Leaves have count > 0 and refer to
+    // mIndexed[first, first+count).
+    struct Node {
+        BoundingBox3f bounds;
+        uint32 first;
+        uint32 count;
+        uint32 secondChild;
+    };
+
+    struct CenterLess;
+
+    const Entry* find(const Vector3f& pos) const;
+    void rebuild();
+    uint32 build(uint32 begin, uint32 end);
+    void intersect(const Entry& entry, const BoundingBox3f& bbox, std::vector<BoundingBox3f>* pieces, std::vector<ServerID>* servers) const;
+    // Whether pieces, all within bbox, cover it exactly once
+    static bool coversExactly(const BoundingBox3f& bbox, const std::vector<BoundingBox3f>& pieces);
+
+    std::vector<Entry> mIndexed;
+    std::vector<Node> mNodes;
+    std::vector<Entry> mTail;
+    uint32 mNextOrder;
+}; // class ServerRegionIndex
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SPACE_SERVER_REGION_INDEX_HPP_
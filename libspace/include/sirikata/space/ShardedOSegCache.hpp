@@ -0,0 +1,150 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_SHARDED_OSEG_CACHE_HPP_
+#define _SIRIKATA_SPACE_SHARDED_OSEG_CACHE_HPP_
+
+#include <sirikata/space/Platform.hpp>
+#include <sirikata/space/OSegCache.hpp>
+#include <sirikata/core/service/Service.hpp>
+#include <sirikata/core/service/Poller.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+
+/** ShardedOSegCache is an OSegCache which can be read from many threads
+ *  at once, e.g. by the forwarder's receive threads, without them serializing
+ *  on a single lock.
+ *
+ *  Entries are split across a power of two number of shards by UUID hash. Each
+ *  shard is a fixed size open addressing table protected by a seqlock: writers
+ *  take the shard's mutex and bump its sequence number, readers never lock and
+ *  just retry if a write happened while they were looking. Eviction uses the
+ *  CLOCK algorithm, so a hit only has to set a reference bit instead of
+ *  relinking a list.
+ *
+ *  Hit rate, lookup rate and sampled lookup latency are reported to the
+ *  Context's TimeSeries once per second while the service is running, under
+ *  the given prefix.
+ */
+class SIRIKATA_SPACE_EXPORT ShardedOSegCache : public OSegCache, public Service {
+public:
+    struct Stats {
+        Stats()
+         : lookups(0), hits(0), evictions(0), retries(0),
+           latencySamples(0), latencyMicroseconds(0)
+        {}
+
+        uint64 lookups;
+        uint64 hits;
+        uint64 evictions;
+        // Number of times a reader had to restart because of a concurrent write
+        uint64 retries;
+        // Lookup latency is only measured for a sample of lookups
+        uint64 latencySamples;
+        uint64 latencyMicroseconds;
+    };
+
+    /** Create a cache.
+     *  \param ctx the Context, used for time and TimeSeries reporting
+     *  \param stats_prefix prefix for TimeSeries keys, e.g.
+     *         "space.server1.oseg.cache"
+     *  \param max_size maximum number of entries held across all shards
+     *  \param lifetime maximum age of an entry before lookups ignore it, or
+     *         zero for no limit
+     *  \param num_shards number of shards, rounded up to a power of two
+     */
+    ShardedOSegCache(Context* ctx, const String& stats_prefix, uint32 max_size, const Duration& lifetime, uint32 num_shards = 16);
+    virtual ~ShardedOSegCache();
+
+    // OSegCache Interface -- all thread safe
+    virtual void insert(const UUID& uuid, const OSegEntry& sID);
+    virtual OSegEntry get(const UUID& uuid);
+    virtual void remove(const UUID& uuid);
+
+    // Service Interface
+    virtual void start();
+    virtual void stop();
+
+    uint32 numShards() const { return mNumShards; }
+    /** Current number of entries. Only approximate while writers are active. */
+    uint32 size() const;
+
+    Stats stats() const;
+    void resetStats();
+
+private:
+    // Measure latency for one in this many lookups
+    static const uint32 LatencySampleInterval = 64;
+
+    struct Slot {
+        UUID id;
+        OSegEntry entry;
+        Time inserted;
+        // Index this entry hashes to, so deletion can shift entries back
+        // without rehashing them
+        uint32 home;
+        bool occupied;
+        // CLOCK reference bit, set by readers without any locking
+        volatile bool referenced;
+    };
+
+    struct Shard {
+        Shard();
+        ~Shard();
+
+        // Odd while a writer is modifying slots
+        volatile uint32 sequence;
+        boost::mutex mutex;
+
+        Slot* slots;
+        uint32 mask;
+        uint32 maxSize;
+        uint32 size;
+        uint32 hand;
+
+        AtomicValue<uint64> lookups;
+        AtomicValue<uint64> hits;
+        AtomicValue<uint64> evictions;
+        AtomicValue<uint64> retries;
+        AtomicValue<uint64> latencySamples;
+        AtomicValue<uint64> latencyMicroseconds;
+
+        // Keep shards on separate cache lines
+        char padding[64];
+    };
+
+    static uint32 hash(const UUID& uuid);
+    Shard& shardFor(uint32 hash) { return mShards[hash & (mNumShards-1)]; }
+    uint32 homeSlot(const Shard& shard, uint32 hash) const { return (hash >> mShardBits) & shard.mask; }
+
+    // Must be called with the shard's mutex held
+    int32 findSlot(const Shard& shard, const UUID& uuid, uint32 home) const;
+    // Must be called with the shard's mutex held and the sequence odd
+    void removeSlot(Shard& shard, uint32 idx);
+    void evictOne(Shard& shard);
+
+    bool expired(const Time& inserted) const;
+
+    void reportStats();
+
+    Context* mContext;
+    const Duration mLifetime;
+
+    uint32 mNumShards;
+    uint32 mShardBits;
+    Shard* mShards;
+
+    Poller mStatsPoller;
+    Stats mLastReported;
+    Time mLastReportTime;
+    const String mTimeSeriesHitRateName;
+    const String mTimeSeriesLookupRateName;
+    const String mTimeSeriesLatencyName;
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SPACE_SHARDED_OSEG_CACHE_HPP_
@@ -44,6 +44,8 @@ static void InitPluginOptions() {
         new OptionValue("host","127.0.0.1",Sirikata::OptionValueType<String>(),"Redis host to connect to."),
         new OptionValue("port","6379",Sirikata::OptionValueType<uint32>(),"Redis port to connect to."),
         new OptionValue("prefix","",Sirikata::OptionValueType<String>(),"Prefix for redis keys, allowing you to provide 'namespaces' so multiple spaces can share the same redis database."),
+        new OptionValue("lookup-batch-size","64",Sirikata::OptionValueType<uint32>(),"Maximum number of object lookups combined into a single request."),
+        new OptionValue("lookup-batch-window","1ms",Sirikata::OptionValueType<Duration>(),"Longest time a lookup waits for others to combine with. If zero, only lookups made at the same time are combined."),
         NULL
     );
 }
@@ -55,8 +57,10 @@ static ObjectSegmentation* createRedisOSeg(SpaceContext* ctx, Network::IOStrand*
     String redis_host = optionsSet->referenceOption("host")->as<String>();
     uint32 redis_port = optionsSet->referenceOption("port")->as<uint32>();
     String redis_prefix = optionsSet->referenceOption("prefix")->as<String>();
+    uint32 lookup_batch_size = optionsSet->referenceOption("lookup-batch-size")->as<uint32>();
+    Duration lookup_batch_window = optionsSet->referenceOption("lookup-batch-window")->as<Duration>();
 
-    return new RedisObjectSegmentation(ctx, oseg_strand, cseg, cache, redis_host, redis_port, redis_prefix);
+    return new RedisObjectSegmentation(ctx, oseg_strand, cseg, cache, redis_host, redis_port, redis_prefix, lookup_batch_size, lookup_batch_window);
 }
 
 } // namespace Sirikata
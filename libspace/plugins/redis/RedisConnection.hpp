@@ -0,0 +1,69 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_REDIS_CONNECTION_HPP_
+#define _SIRIKATA_REDIS_CONNECTION_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <hiredis/async.h>
+#include <boost/asio.hpp>
+
+namespace Sirikata {
+
+/** RedisConnection drives a hiredis async context from an IOService, wrapping
+ *  its socket so hiredis reads and writes whenever the socket is ready. Since
+ *  hiredis writes every command it is given as soon as it can, without waiting
+ *  for earlier replies, commands are always pipelined.
+ *
+ *  The connection is made lazily and remade if it is lost. hiredis contexts
+ *  aren't thread safe, so the connection must only be used from the
+ *  IOService's thread.
+ */
+class RedisConnection {
+public:
+    RedisConnection(Network::IOService* ios, const String& host, uint16 port);
+    ~RedisConnection();
+
+    /** Get the hiredis context, connecting first if necessary. Returns NULL if
+     *  the connection couldn't be made.
+     */
+    redisAsyncContext* context();
+
+    /** Disconnect, invoking the callbacks of any outstanding commands with NULL
+     *  replies. The connection is remade the next time context() is called.
+     */
+    void disconnect();
+
+    // Redis event handlers, public since redis needs C functions as callbacks,
+    // which then invoke these.
+    void disconnected();
+    void addRead();
+    void delRead();
+    void addWrite();
+    void delWrite();
+    void cleanup();
+
+private:
+    void connect();
+
+    // If the appropriate flag is set, starts and stops read/write operations
+    void startRead();
+    void startWrite();
+
+    void readHandler(const boost::system::error_code& ec);
+    void writeHandler(const boost::system::error_code& ec);
+
+    Network::IOService* mIOService;
+    String mHost;
+    uint16 mPort;
+
+    redisAsyncContext* mRedisContext;
+    boost::asio::posix::stream_descriptor* mRedisFD; // Wrapped hiredis file descriptor
+    bool mReading, mWriting;
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_REDIS_CONNECTION_HPP_
@@ -0,0 +1,198 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "RedisLookupBatcher.hpp"
+#include <sirikata/core/network/IOStrandImpl.hpp>
+
+#define REDISBATCH_LOG(lvl,msg) SILOG(redis_oseg, lvl, msg)
+
+// Batches kept around for reuse. More are allocated if needed, but only this
+// many are kept once they're done.
+#define MAX_FREE_BATCHES 64
+
+namespace Sirikata {
+
+struct RedisLookupBatcher::Batch {
+    RedisLookupBatcher* batcher;
+    std::vector<UUID> ids;
+    // The MGET command's arguments. Keys are kept between uses so their
+    // storage can be reused.
+    std::vector<String> keys;
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+};
+
+namespace {
+
+void globalRedisLookupBatchFinished(redisAsyncContext* c, void* _reply, void* privdata) {
+    redisReply *reply = (redisReply*)_reply;
+    RedisLookupBatcher::Batch* batch = (RedisLookupBatcher::Batch*)privdata;
+    batch->batcher->handleReply(batch, reply);
+}
+
+} // namespace
+
+RedisLookupBatcher::RedisLookupBatcher(Network::IOStrand* strand, RedisConnection* conn, const String& prefix, uint32 max_batch, const Duration& window, const LookupCallback& cb)
+ : mStrand(strand),
+   mConnection(conn),
+   mPrefix(prefix),
+   mMaxBatch(std::max(max_batch, (uint32)1)),
+   mWindow(window),
+   mCallback(cb),
+   mCurrent(NULL),
+   mFlushScheduled(false),
+   mRequestsIssued(0),
+   mKeysRequested(0)
+{
+}
+
+RedisLookupBatcher::~RedisLookupBatcher() {
+    Liveness::letDie();
+
+    // Requests still in flight own their batches, so the connection must have
+    // been disconnected already, returning them to the pool.
+    delete mCurrent;
+    for(uint32 i = 0; i < mFreeBatches.size(); i++)
+        delete mFreeBatches[i];
+}
+
+RedisLookupBatcher::Batch* RedisLookupBatcher::allocateBatch() {
+    if (mFreeBatches.empty()) {
+        Batch* batch = new Batch();
+        batch->batcher = this;
+        return batch;
+    }
+    Batch* batch = mFreeBatches.back();
+    mFreeBatches.pop_back();
+    return batch;
+}
+
+void RedisLookupBatcher::releaseBatch(Batch* batch) {
+    if (mFreeBatches.size() >= MAX_FREE_BATCHES) {
+        delete batch;
+        return;
+    }
+    batch->ids.clear();
+    mFreeBatches.push_back(batch);
+}
+
+void RedisLookupBatcher::addToBatch(const UUID& obj_id) {
+    if (mCurrent == NULL) mCurrent = allocateBatch();
+    mCurrent->ids.push_back(obj_id);
+}
+
+void RedisLookupBatcher::lookup(const UUID& obj_id) {
+    addToBatch(obj_id);
+    if (mCurrent->ids.size() >= mMaxBatch) {
+        flush();
+        return;
+    }
+
+    if (!mFlushScheduled) {
+        mFlushScheduled = true;
+        if (mWindow == Duration::zero())
+            mStrand->post(std::tr1::bind(&RedisLookupBatcher::handleFlushTimer, this, livenessToken()), "RedisLookupBatcher::handleFlushTimer");
+        else
+            mStrand->post(mWindow, std::tr1::bind(&RedisLookupBatcher::handleFlushTimer, this, livenessToken()), "RedisLookupBatcher::handleFlushTimer");
+    }
+}
+
+void RedisLookupBatcher::lookup(const std::vector<UUID>& obj_ids) {
+    // Anything already waiting can go out along with these
+    for(uint32 i = 0; i < obj_ids.size(); i++) {
+        addToBatch(obj_ids[i]);
+        if (mCurrent->ids.size() >= mMaxBatch)
+            flush();
+    }
+    flush();
+}
+
+void RedisLookupBatcher::handleFlushTimer(Liveness::Token alive) {
+    if (!alive) return;
+    mFlushScheduled = false;
+    flush();
+}
+
+void RedisLookupBatcher::flush() {
+    if (mCurrent == NULL) return;
+    Batch* batch = mCurrent;
+    mCurrent = NULL;
+    issue(batch);
+}
+
+void RedisLookupBatcher::issue(Batch* batch) {
+    uint32 nkeys = batch->ids.size();
+    if (batch->keys.size() < nkeys)
+        batch->keys.resize(nkeys);
+    batch->argv.resize(nkeys + 1);
+    batch->argvlen.resize(nkeys + 1);
+
+    batch->argv[0] = "MGET";
+    batch->argvlen[0] = 4;
+    for(uint32 i = 0; i < nkeys; i++) {
+        String& key = batch->keys[i];
+        key.assign(mPrefix);
+        key.append(batch->ids[i].toString());
+        batch->argv[i+1] = key.data();
+        batch->argvlen[i+1] = key.size();
+    }
+
+    mRequestsIssued++;
+    mKeysRequested += nkeys;
+
+    REDISBATCH_LOG(insane, "MGET of " << nkeys << " keys");
+    redisAsyncContext* ctx = mConnection->context();
+    if (ctx == NULL ||
+        redisAsyncCommandArgv(ctx, globalRedisLookupBatchFinished, batch, nkeys + 1, &batch->argv[0], &batch->argvlen[0]) != REDIS_OK)
+    {
+        // Fail it asynchronously, like a real reply, so lookup() never
+        // invokes the callback before returning
+        mStrand->post(
+            std::tr1::bind(&RedisLookupBatcher::handleIssueFailed, this, livenessToken(), batch),
+            "RedisLookupBatcher::handleIssueFailed"
+        );
+    }
+}
+
+void RedisLookupBatcher::handleIssueFailed(Liveness::Token alive, Batch* batch) {
+    if (!alive) {
+        delete batch;
+        return;
+    }
+    handleReply(batch, NULL);
+}
+
+void RedisLookupBatcher::handleReply(Batch* batch, redisReply* reply) {
+    if (reply == NULL) {
+        REDISBATCH_LOG(error, "Unknown redis error when reading " << batch->ids.size() << " objects");
+    }
+    else if (reply->type == REDIS_REPLY_ERROR) {
+        REDISBATCH_LOG(error, "Redis error when reading " << batch->ids.size() << " objects: " << String(reply->str, reply->len));
+    }
+    else if (reply->type != REDIS_REPLY_ARRAY || reply->elements != batch->ids.size()) {
+        REDISBATCH_LOG(error, "Unexpected redis reply when reading " << batch->ids.size() << " objects, type " << reply->type);
+    }
+    else {
+        for(uint32 i = 0; i < batch->ids.size(); i++) {
+            redisReply* elem = reply->element[i];
+            if (elem->type == REDIS_REPLY_STRING) {
+                String value(elem->str, elem->len);
+                mCallback(batch->ids[i], &value);
+            }
+            else {
+                if (elem->type != REDIS_REPLY_NIL)
+                    REDISBATCH_LOG(error, "Unexpected redis reply type when reading object " << batch->ids[i].toString() << ": " << elem->type);
+                mCallback(batch->ids[i], NULL);
+            }
+        }
+        releaseBatch(batch);
+        return;
+    }
+
+    for(uint32 i = 0; i < batch->ids.size(); i++)
+        mCallback(batch->ids[i], NULL);
+    releaseBatch(batch);
+}
+
+} // namespace Sirikata
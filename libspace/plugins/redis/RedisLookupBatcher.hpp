@@ -0,0 +1,92 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_REDIS_LOOKUP_BATCHER_HPP_
+#define _SIRIKATA_REDIS_LOOKUP_BATCHER_HPP_
+
+#include "RedisConnection.hpp"
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/util/Liveness.hpp>
+
+namespace Sirikata {
+
+/** RedisLookupBatcher reads the values stored for objects from Redis, combining
+ *  lookups into MGET requests so many lookups cost a single round trip.
+ *  Individual lookups are collected until the batch is full or the batching
+ *  window has passed since the first of them, whichever comes first.
+ *
+ *  The per-request state is pooled, so once the batcher has warmed up lookups
+ *  don't allocate. Like the connection, the batcher must only be used from the
+ *  IOService's thread, which the strand must belong to.
+ */
+class RedisLookupBatcher : public Liveness {
+public:
+    /** Invoked with the value stored for an object, or NULL if there wasn't
+     *  one or the lookup failed.
+     */
+    typedef std::tr1::function<void(const UUID&, const String*)> LookupCallback;
+
+    /** Create a batcher.
+     *  \param strand strand to schedule flushes on
+     *  \param conn connection to issue requests on
+     *  \param prefix prefix of the keys objects are stored under
+     *  \param max_batch maximum number of keys in a request
+     *  \param window longest time a lookup waits for others to join its
+     *         batch. If zero, lookups only wait for the others queued on the
+     *         strand.
+     *  \param cb callback for lookup results
+     */
+    RedisLookupBatcher(Network::IOStrand* strand, RedisConnection* conn,
+        const String& prefix, uint32 max_batch, const Duration& window,
+        const LookupCallback& cb);
+    ~RedisLookupBatcher();
+
+    // Queue a lookup into the current batch
+    void lookup(const UUID& obj_id);
+    /** Look up a set of objects immediately, in as few requests as possible,
+     *  for callers that have already batched up their lookups.
+     */
+    void lookup(const std::vector<UUID>& obj_ids);
+    // Issue the current batch now
+    void flush();
+
+    uint64 requestsIssued() const { return mRequestsIssued; }
+    uint64 keysRequested() const { return mKeysRequested; }
+
+    // Invoked by the redis callback
+    struct Batch;
+    void handleReply(Batch* batch, redisReply* reply);
+
+private:
+    Batch* allocateBatch();
+    void releaseBatch(Batch* batch);
+
+    void addToBatch(const UUID& obj_id);
+    void issue(Batch* batch);
+    // Posted handlers check they're still alive since they may run after the
+    // batcher has been destroyed
+    void handleFlushTimer(Liveness::Token alive);
+    void handleIssueFailed(Liveness::Token alive, Batch* batch);
+
+    Network::IOStrand* mStrand;
+    RedisConnection* mConnection;
+    const String mPrefix;
+    const uint32 mMaxBatch;
+    const Duration mWindow;
+    LookupCallback mCallback;
+
+    // Batch being collected, or NULL
+    Batch* mCurrent;
+    bool mFlushScheduled;
+
+    std::vector<Batch*> mFreeBatches;
+
+    uint64 mRequestsIssued;
+    uint64 mKeysRequested;
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_REDIS_LOOKUP_BATCHER_HPP_
@@ -39,84 +39,9 @@ namespace Sirikata {
 
 namespace {
 
-void globalRedisConnectHandler(const redisAsyncContext *c) {
-    REDISOSEG_LOG(insane, "Connected.");
-}
-
-void globalRedisDisconnectHandler(const redisAsyncContext *c, int status) {
-    if (status == REDIS_OK) return;
-    REDISOSEG_LOG(error, "Global error handler: " << c->errstr);
-    RedisObjectSegmentation* oseg = (RedisObjectSegmentation*)c->data;
-    oseg->disconnected();
-}
-
-void globalRedisAddRead(void *privdata) {
-    RedisObjectSegmentation* oseg = (RedisObjectSegmentation*)privdata;
-    oseg->addRead();
-}
-
-void globalRedisDelRead(void *privdata) {
-    RedisObjectSegmentation* oseg = (RedisObjectSegmentation*)privdata;
-    oseg->delRead();
-}
-
-void globalRedisAddWrite(void *privdata) {
-    RedisObjectSegmentation* oseg = (RedisObjectSegmentation*)privdata;
-    oseg->addWrite();
-}
-
-void globalRedisDelWrite(void *privdata) {
-    RedisObjectSegmentation* oseg = (RedisObjectSegmentation*)privdata;
-    oseg->delWrite();
-}
-
-void globalRedisCleanup(void *privdata) {
-    RedisObjectSegmentation* oseg = (RedisObjectSegmentation*)privdata;
-    oseg->cleanup();
-}
-
-// Basic state tracking for a request that uses Redis async api
-struct RedisObjectOperationInfo {
-    RedisObjectSegmentation* oseg;
-    UUID obj;
-};
-// State tracking for migrate changes. If we need to generate an ack, this
-// requires additional info
-struct RedisObjectMigratedOperationInfo {
-    RedisObjectSegmentation* oseg;
-    UUID obj;
-    ServerID ackTo;
-};
-
-void globalRedisLookupObjectReadFinished(redisAsyncContext* c, void* _reply, void* privdata) {
-    redisReply *reply = (redisReply*)_reply;
-    RedisObjectOperationInfo* wi = (RedisObjectOperationInfo*)privdata;
-
-    if (reply == NULL) {
-        REDISOSEG_LOG(error, "Unknown redis error when reading object " << wi->obj.toString());
-    }
-    else if (reply->type == REDIS_REPLY_ERROR) {
-        REDISOSEG_LOG(error, "Redis error when reading object " << wi->obj.toString() << ": " << String(reply->str, reply->len));
-        wi->oseg->failReadObject(wi->obj);
-    }
-    else if (reply->type == REDIS_REPLY_NIL) {
-        REDISOSEG_LOG(error, "Redis got nil when reading object.");
-        wi->oseg->failReadObject(wi->obj);
-    }
-    else if (reply->type == REDIS_REPLY_STRING) {
-        wi->oseg->finishReadObject(wi->obj, String(reply->str, reply->len));
-    }
-    else {
-        REDISOSEG_LOG(error, "Unexpected redis reply type when reading object " << wi->obj.toString() << ": " << reply->type);
-    }
-
-    delete wi;
-}
-
-
 void globalRedisAddNewObjectWriteFinished(redisAsyncContext* c, void* _reply, void* privdata) {
     redisReply *reply = (redisReply*)_reply;
-    RedisObjectOperationInfo* wi = (RedisObjectOperationInfo*)privdata;
+    RedisObjectSegmentation::OperationInfo* wi = (RedisObjectSegmentation::OperationInfo*)privdata;
 
 
     if (reply == NULL)
@@ -152,12 +77,12 @@ void globalRedisAddNewObjectWriteFinished(redisAsyncContext* c, void* _reply, vo
         wi->oseg->finishWriteNewObject(wi->obj,OSegWriteListener::UNKNOWN_ERROR);
     }
 
-    delete wi;
+    wi->oseg->releaseOperation(wi);
 }
 
 void globalRedisAddMigratedObjectWriteFinished(redisAsyncContext* c, void* _reply, void* privdata) {
     redisReply *reply = (redisReply*)_reply;
-    RedisObjectMigratedOperationInfo* wi = (RedisObjectMigratedOperationInfo*)privdata;
+    RedisObjectSegmentation::OperationInfo* wi = (RedisObjectSegmentation::OperationInfo*)privdata;
 
     if (reply == NULL) {
         REDISOSEG_LOG(error, "Unknown redis error when writing migrated object " << wi->obj.toString());
@@ -175,19 +100,18 @@ void globalRedisAddMigratedObjectWriteFinished(redisAsyncContext* c, void* _repl
         REDISOSEG_LOG(error, "Unexpected redis reply type when writing migrated object " << wi->obj.toString() << ": " << reply->type);
     }
 
-    delete wi;
+    wi->oseg->releaseOperation(wi);
 }
 
 void globalRedisDeleteFinished(redisAsyncContext* c, void* _reply, void* privdata) {
     redisReply *reply = (redisReply*)_reply;
-    RedisObjectOperationInfo* wi = (RedisObjectOperationInfo*)privdata;
+    RedisObjectSegmentation::OperationInfo* wi = (RedisObjectSegmentation::OperationInfo*)privdata;
 
     if (reply == NULL) {
         REDISOSEG_LOG(error, "Unknown redis error when deleting object " << wi->obj.toString());
     }
     else if (reply->type == REDIS_REPLY_ERROR) {
         REDISOSEG_LOG(error, "Redis error when deleting object " << wi->obj.toString() << ": " << String(reply->str, reply->len));
-        wi->oseg->failReadObject(wi->obj);
     }
     else if (reply->type == REDIS_REPLY_INTEGER) {
         if (reply->integer != 1)
@@ -197,149 +121,78 @@ void globalRedisDeleteFinished(redisAsyncContext* c, void* _reply, void* privdat
         REDISOSEG_LOG(error, "Unexpected redis reply type when deleting object " << wi->obj.toString() << ": " << reply->type);
     }
 
-    delete wi;
+    wi->oseg->releaseOperation(wi);
 }
 
 } // namespace
 
-RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix)
+RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, uint32 lookup_batch_size, const Duration& lookup_batch_window)
  : ObjectSegmentation(con, o_strand),
    mCSeg(cseg),
    mCache(cache),
-   mRedisHost(redis_host),
-   mRedisPort(redis_port),
    mRedisPrefix(redis_prefix),
-   mRedisContext(NULL),
-   mRedisFD(NULL),
-   mReading(false),
-   mWriting(false)
+   mConnection(new RedisConnection(con->ioService, redis_host, redis_port)),
+   mLookups(NULL)
 {
+    mLookups = new RedisLookupBatcher(
+        con->mainStrand, mConnection, redis_prefix,
+        lookup_batch_size, lookup_batch_window,
+        std::tr1::bind(&RedisObjectSegmentation::finishReadObject, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2)
+    );
 }
 
 RedisObjectSegmentation::~RedisObjectSegmentation() {
-    cleanup();
+    // Operations failed before they were sent are still posted. They hold
+    // tokens rather than relying on this being alive.
+    Liveness::letDie();
+
+    // Disconnecting completes any outstanding requests, returning their state
+    // to the pools, so it must come first
+    mConnection->disconnect();
+    delete mLookups;
+    delete mConnection;
+
+    for(uint32 i = 0; i < mFreeOperations.size(); i++)
+        delete mFreeOperations[i];
 }
 
 void RedisObjectSegmentation::start() {
     ObjectSegmentation::start();
-    connect();
+    mConnection->context();
 }
 
-void RedisObjectSegmentation::connect() {
-    mRedisContext = redisAsyncConnect(mRedisHost.c_str(), mRedisPort);
-    if (mRedisContext->err) {
-        REDISOSEG_LOG(error, "Failed to connect to redis: " << mRedisContext->errstr);
-        redisAsyncDisconnect(mRedisContext);
-        mRedisContext = NULL;
-    } else {
-        REDISOSEG_LOG(insane, "Optimistically connected to redis.");
+RedisObjectSegmentation::OperationInfo* RedisObjectSegmentation::allocateOperation(const UUID& obj_id, ServerID ack_to) {
+    OperationInfo* info = NULL;
+    if (mFreeOperations.empty()) {
+        info = new OperationInfo();
+        info->oseg = this;
     }
-
-    // This appears to be the only way to get a non-static 'argument' to the
-    // connect and disconnect callbacks.
-    mRedisContext->data = (void*)this;
-
-    redisAsyncSetConnectCallback(mRedisContext, globalRedisConnectHandler);
-    redisAsyncSetDisconnectCallback(mRedisContext, globalRedisDisconnectHandler);
-
-    mRedisContext->ev.addRead = globalRedisAddRead;
-    mRedisContext->ev.delRead = globalRedisDelRead;
-    mRedisContext->ev.addWrite = globalRedisAddWrite;
-    mRedisContext->ev.delWrite = globalRedisDelWrite;
-    mRedisContext->ev.cleanup = globalRedisCleanup;
-    mRedisContext->ev.data = this;
-
-    // Wrap this connections file descripter in ASIO
-    using boost::asio::posix::stream_descriptor;
-    mRedisFD = new stream_descriptor(mContext->ioService->asioService());
-    mRedisFD->assign(mRedisContext->c.fd);
-
-    // Force one command through. This ensures the connection gets fully
-    // initialized. Otherwise, we can end up leaving the connection idle, the
-    // server disconnects, and because haven't started anything, the next
-    // command fails and *then* we get the disconnect event. Performing one
-    // command ensures we'll get the disconnect event ASAP after it occurs.
-    redisAsyncCommand(mRedisContext, NULL, NULL, "PING");
-}
-
-void RedisObjectSegmentation::ensureConnected() {
-    if (mRedisContext == NULL) connect();
-}
-
-void RedisObjectSegmentation::disconnected() {
-    cleanup();
-}
-
-void RedisObjectSegmentation::addRead() {
-    REDISOSEG_LOG(insane, "Add read");
-
-    if (mReading) return;
-    mReading = true;
-
-    startRead();
-}
-
-void RedisObjectSegmentation::delRead() {
-    REDISOSEG_LOG(insane, "Del read");
-    assert(mReading);
-    mReading = false;
-}
-
-void RedisObjectSegmentation::addWrite() {
-    REDISOSEG_LOG(insane, "Add write");
-
-    if (mWriting) return;
-    mWriting = true;
-
-    startWrite();
-}
-
-void RedisObjectSegmentation::delWrite() {
-    REDISOSEG_LOG(insane, "Del write");
-    assert(mWriting);
-    mWriting = false;
-}
-
-void RedisObjectSegmentation::cleanup() {
-    REDISOSEG_LOG(insane, "Cleanup");
-
-    mRedisContext = NULL;
-    delete mRedisFD;
-    mRedisFD = NULL;
-    mReading = false;
-    mWriting = false;
+    else {
+        info = mFreeOperations.back();
+        mFreeOperations.pop_back();
+    }
+    info->obj = obj_id;
+    info->ackTo = ack_to;
+    return info;
 }
 
-void RedisObjectSegmentation::startRead() {
-    if (mStopping || !mReading) return;
-    mRedisFD->async_read_some(boost::asio::null_buffers(),
-        boost::bind(&RedisObjectSegmentation::readHandler, this, boost::asio::placeholders::error));
+void RedisObjectSegmentation::releaseOperation(OperationInfo* info) {
+    mFreeOperations.push_back(info);
 }
 
-void RedisObjectSegmentation::startWrite() {
-    if (mStopping || !mWriting) return;
-    mRedisFD->async_write_some(boost::asio::null_buffers(),
-        boost::bind(&RedisObjectSegmentation::writeHandler, this, boost::asio::placeholders::error));
+void RedisObjectSegmentation::failOperation(redisCallbackFn* cb, OperationInfo* info, const char* tag) {
+    mContext->ioService->post(
+        std::tr1::bind(&RedisObjectSegmentation::handleFailedOperation, this, livenessToken(), cb, info),
+        tag
+    );
 }
 
-void RedisObjectSegmentation::readHandler(const boost::system::error_code& ec) {
-    if (ec) {
-        REDISOSEG_LOG(error, "Error in read handler.");
+void RedisObjectSegmentation::handleFailedOperation(Liveness::Token alive, redisCallbackFn* cb, OperationInfo* info) {
+    if (!alive) {
+        delete info;
         return;
     }
-
-    redisAsyncHandleRead(mRedisContext);
-    startRead();
-}
-
-void RedisObjectSegmentation::writeHandler(const boost::system::error_code& ec) {
-    if (ec) {
-        REDISOSEG_LOG(error, "Error in write handler.");
-        return;
-    }
-
-    redisAsyncHandleWrite(mRedisContext);
-    startWrite();
+    cb(NULL, NULL, info);
 }
 
 OSegEntry RedisObjectSegmentation::cacheLookup(const UUID& obj_id) {
@@ -352,24 +205,44 @@ OSegEntry RedisObjectSegmentation::lookup(const UUID& obj_id) {
     OSegMap::const_iterator it = mOSeg.find(obj_id);
     if (it != mOSeg.end()) return it->second;
 
-    // Otherwise, kick off the lookup process and return null
+    // Otherwise, add it to the next batch of lookups and return null
     if (mStopping) return OSegEntry::null();
-    RedisObjectOperationInfo* ri = new RedisObjectOperationInfo();
-    ri->oseg = this;
-    ri->obj = obj_id;
-    ensureConnected();
-    redisAsyncCommand(mRedisContext, globalRedisLookupObjectReadFinished, ri, "GET %s%s", mRedisPrefix.c_str(), obj_id.toString().c_str());
+    mLookups->lookup(obj_id);
     return OSegEntry::null();
 }
 
-void RedisObjectSegmentation::finishReadObject(const UUID& obj_id, const String& data_str) {
-    REDISOSEG_LOG(detailed, "Finished reading OSEG entry for object " << obj_id.toString());
+void RedisObjectSegmentation::lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results) {
+    results->assign(obj_ids.size(), OSegEntry::null());
     if (mStopping) return;
 
+    // The caller has already batched these up, so anything we don't know about
+    // locally can be requested immediately
+    std::vector<UUID> remote;
+    for(uint32 i = 0; i < obj_ids.size(); i++) {
+        OSegMap::const_iterator it = mOSeg.find(obj_ids[i]);
+        if (it != mOSeg.end())
+            (*results)[i] = it->second;
+        else
+            remote.push_back(obj_ids[i]);
+    }
+    if (!remote.empty())
+        mLookups->lookup(remote);
+}
+
+void RedisObjectSegmentation::finishReadObject(const UUID& obj_id, const String* data_str) {
+    if (mStopping) return;
+
+    if (data_str == NULL) {
+        REDISOSEG_LOG(error, "Failed to read OSEG entry for object " << obj_id.toString());
+        mLookupListener->osegLookupCompleted(obj_id, OSegEntry::null());
+        return;
+    }
+
+    REDISOSEG_LOG(detailed, "Finished reading OSEG entry for object " << obj_id.toString());
     OSegEntry data(OSegEntry::null());
 
     std::vector<String> parts;
-    boost::algorithm::split(parts, data_str, boost::algorithm::is_any_of(":"));
+    boost::algorithm::split(parts, *data_str, boost::algorithm::is_any_of(":"));
     if (parts.size() == 2) {
         data.setServer(boost::lexical_cast<uint32>(parts[0]));
         // lexical_cast<float64> refuses to handle integral values,
@@ -385,20 +258,12 @@ void RedisObjectSegmentation::finishReadObject(const UUID& obj_id, const String&
     mLookupListener->osegLookupCompleted(obj_id, data);
 }
 
-void RedisObjectSegmentation::failReadObject(const UUID& obj_id) {
-    REDISOSEG_LOG(error, "Failed to read OSEG entry for object " << obj_id.toString());
-    if (mStopping) return;
-    mLookupListener->osegLookupCompleted(obj_id, OSegEntry::null());
-}
-
 void RedisObjectSegmentation::addNewObject(const UUID& obj_id, float radius) {
     if (mStopping) return;
 
     mOSeg[obj_id] = OSegEntry(mContext->id(), radius);
 
-    RedisObjectOperationInfo* wi = new RedisObjectOperationInfo();
-    wi->oseg = this;
-    wi->obj = obj_id;
+    OperationInfo* wi = allocateOperation(obj_id);
     // Note: currently we're keeping compatibility with Redis 1.2. This means
     // that there aren't hashes on the server. Instead, we create and parse them
     // ourselves. This isn't so bad since they are all fixed format anyway.
@@ -406,8 +271,11 @@ void RedisObjectSegmentation::addNewObject(const UUID& obj_id, float radius) {
     os << mContext->id() << ":" << radius;
     String valstr = os.str();
     REDISOSEG_LOG(insane, "SETNX " << obj_id.toString() << " " << valstr);
-    ensureConnected();
-    redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "SETNX %s%s %b", mRedisPrefix.c_str(), obj_id.toString().c_str(), valstr.c_str(), valstr.size());
+    redisAsyncContext* ctx = mConnection->context();
+    if (ctx == NULL)
+        failOperation(globalRedisAddNewObjectWriteFinished, wi, "RedisObjectSegmentation::addNewObject");
+    else
+        redisAsyncCommand(ctx, globalRedisAddNewObjectWriteFinished, wi, "SETNX %s%s %b", mRedisPrefix.c_str(), obj_id.toString().c_str(), valstr.c_str(), valstr.size());
 }
 
 void RedisObjectSegmentation::finishWriteNewObject(const UUID& obj_id, OSegWriteListener::OSegAddNewStatus status)
@@ -429,10 +297,7 @@ void RedisObjectSegmentation::addMigratedObject(const UUID& obj_id, float radius
 
     mOSeg[obj_id] = OSegEntry(mContext->id(), radius);
 
-    RedisObjectMigratedOperationInfo* wi = new RedisObjectMigratedOperationInfo();
-    wi->oseg = this;
-    wi->obj = obj_id;
-    wi->ackTo = (generateAck ? idServerAckTo : NullServerID);
+    OperationInfo* wi = allocateOperation(obj_id, (generateAck ? idServerAckTo : NullServerID));
     // Note: currently we're keeping compatibility with Redis 1.2. This means
     // that there aren't hashes on the server. Instead, we create and parse them
     // ourselves. This isn't so bad since they are all fixed format anyway.
@@ -440,8 +305,11 @@ void RedisObjectSegmentation::addMigratedObject(const UUID& obj_id, float radius
     os << mContext->id() << ":" << radius;
     String valstr = os.str();
     REDISOSEG_LOG(insane, "SET " << obj_id.toString() << " " << valstr);
-    ensureConnected();
-    redisAsyncCommand(mRedisContext, globalRedisAddMigratedObjectWriteFinished, wi, "SET %s%s %b", mRedisPrefix.c_str(), obj_id.toString().c_str(), valstr.c_str(), valstr.size());
+    redisAsyncContext* ctx = mConnection->context();
+    if (ctx == NULL)
+        failOperation(globalRedisAddMigratedObjectWriteFinished, wi, "RedisObjectSegmentation::addMigratedObject");
+    else
+        redisAsyncCommand(ctx, globalRedisAddMigratedObjectWriteFinished, wi, "SET %s%s %b", mRedisPrefix.c_str(), obj_id.toString().c_str(), valstr.c_str(), valstr.size());
 }
 
 void RedisObjectSegmentation::finishWriteMigratedObject(const UUID& obj_id, ServerID ackTo) {
@@ -466,11 +334,12 @@ void RedisObjectSegmentation::removeObject(const UUID& obj_id) {
     if (mStopping) return;
 
     mOSeg.erase(obj_id);
-    RedisObjectOperationInfo* wi = new RedisObjectOperationInfo();
-    wi->oseg = this;
-    wi->obj = obj_id;
-    ensureConnected();
-    redisAsyncCommand(mRedisContext, globalRedisDeleteFinished, wi, "DEL %s%s", mRedisPrefix.c_str(), obj_id.toString().c_str());
+    OperationInfo* wi = allocateOperation(obj_id);
+    redisAsyncContext* ctx = mConnection->context();
+    if (ctx == NULL)
+        failOperation(globalRedisDeleteFinished, wi, "RedisObjectSegmentation::removeObject");
+    else
+        redisAsyncCommand(ctx, globalRedisDeleteFinished, wi, "DEL %s%s", mRedisPrefix.c_str(), obj_id.toString().c_str());
 }
 
 bool RedisObjectSegmentation::clearToMigrate(const UUID& obj_id) {
@@ -34,19 +34,21 @@
 #define _SIRIKATA_REDIS_OBJECT_SEGMENTATION_HPP_
 
 #include <sirikata/space/ObjectSegmentation.hpp>
-#include <hiredis/async.h>
+#include "RedisConnection.hpp"
+#include "RedisLookupBatcher.hpp"
 
 namespace Sirikata {
 
-class RedisObjectSegmentation : public ObjectSegmentation {
+class RedisObjectSegmentation : public ObjectSegmentation, public Liveness {
 public:
-    RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix);
+    RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, uint32 lookup_batch_size, const Duration& lookup_batch_window);
     ~RedisObjectSegmentation();
 
     virtual void start();
 
     virtual OSegEntry cacheLookup(const UUID& obj_id);
     virtual OSegEntry lookup(const UUID& obj_id);
+    virtual void lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results);
 
     virtual void addNewObject(const UUID& obj_id, float radius);
     virtual void addMigratedObject(const UUID& obj_id, float radius, ServerID idServerAckTo, bool);
@@ -58,32 +60,30 @@ public:
     virtual void handleMigrateMessageAck(const Sirikata::Protocol::OSeg::MigrateMessageAcknowledge& msg);
     virtual void handleUpdateOSegMessage(const Sirikata::Protocol::OSeg::UpdateOSegMessage& update_oseg_msg);
 
-
-    // Redis event handlers
-    void disconnected();
-    void addRead();
-    void delRead();
-    void addWrite();
-    void delWrite();
-    void cleanup();
+    // State tracking for a write that uses Redis async api. If we need to
+    // generate an ack for a migration, ackTo is set. These are pooled since
+    // there is one for every outstanding write.
+    struct OperationInfo {
+        RedisObjectSegmentation* oseg;
+        UUID obj;
+        ServerID ackTo;
+    };
+    void releaseOperation(OperationInfo* info);
 
     // Helper handlers, public since redis needs C functions as callbacks, which
     // then invoke these to complete operations.
-    void finishReadObject(const UUID& obj_id, const String& data_str);
-    void failReadObject(const UUID& obj_id);
     void finishWriteNewObject(const UUID& obj_id, OSegWriteListener::OSegAddNewStatus);
     void finishWriteMigratedObject(const UUID& obj_id, ServerID ackTo);
 
 private:
-    void connect();
-    void ensureConnected();
-
-    // If the appropriate flag is set, starts and stops read/write operations
-    void startRead();
-    void startWrite();
+    OperationInfo* allocateOperation(const UUID& obj_id, ServerID ack_to = NullServerID);
+    // Fails an operation which couldn't be sent by invoking its reply callback
+    // with a NULL reply. It's posted, like a real reply, so callers never see
+    // the operation finish before they return.
+    void failOperation(redisCallbackFn* cb, OperationInfo* info, const char* tag);
+    void handleFailedOperation(Liveness::Token alive, redisCallbackFn* cb, OperationInfo* info);
 
-    void readHandler(const boost::system::error_code& ec);
-    void writeHandler(const boost::system::error_code& ec);
+    void finishReadObject(const UUID& obj_id, const String* data_str);
 
     CoordinateSegmentation* mCSeg;
     OSegCache* mCache;
@@ -91,13 +91,11 @@ private:
     typedef std::tr1::unordered_map<UUID, OSegEntry, UUID::Hasher> OSegMap;
     OSegMap mOSeg;
 
-    String mRedisHost;
-    uint16 mRedisPort;
     String mRedisPrefix;
 
-    redisAsyncContext* mRedisContext;
-    boost::asio::posix::stream_descriptor* mRedisFD; // Wrapped hiredis file descriptor
-    bool mReading, mWriting;
+    RedisConnection* mConnection;
+    RedisLookupBatcher* mLookups;
+    std::vector<OperationInfo*> mFreeOperations;
 };
 
 } // namespace Sirikata
@@ -42,6 +42,8 @@ namespace Sirikata {
 void InitAlwaysLocationUpdatePolicyOptions() {
     Sirikata::InitializeClassOptions ico(ALWAYS_POLICY_OPTIONS, NULL,
         new OptionValue(LOC_MAX_PER_RESULT, "5", Sirikata::OptionValueType<uint32>(), "Maximum number of loc updates to report in each result message."),
+        new OptionValue(LOC_POSITION_QUANTUM, "0", Sirikata::OptionValueType<float32>(), "If non-zero, positions and velocities are rounded to this precision and location updates a subscriber could extrapolate to within this distance aren't sent."),
+        new OptionValue(LOC_SERVICE_THREADS, "1", Sirikata::OptionValueType<uint32>(), "Number of threads used to build loc update messages. With 1 they're built on the main strand."),
         NULL);
 }
 
@@ -60,23 +62,54 @@ AlwaysLocationUpdatePolicy::AlwaysLocationUpdatePolicy(SpaceContext* ctx, const
    mOHUpdatesPerSecond(0),
    mTimeSeriesObjectUpdatesName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".loc.object_updates_per_second"),
    mObjectUpdatesPerSecond(0),
-   mServerSubscriptions(this, mServerUpdatesPerSecond),
-   mOHSubscriptions(this, mOHUpdatesPerSecond),
-   mObjectSubscriptions(this, mObjectUpdatesPerSecond)
+   mTimeSeriesServerBytesPerUpdateName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".loc.server_bytes_per_update"),
+   mServerObjectUpdates(0),
+   mServerUpdateBytes(0),
+   mTimeSeriesOHBytesPerUpdateName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".loc.oh_bytes_per_update"),
+   mOHObjectUpdates(0),
+   mOHUpdateBytes(0),
+   mTimeSeriesObjectBytesPerUpdateName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".loc.object_bytes_per_update"),
+   mObjectObjectUpdates(0),
+   mObjectUpdateBytes(0),
+   mWorkers(NULL),
+   mBuildRunner(NULL),
+   mServerSubscriptions(this, mServerUpdatesPerSecond, mServerObjectUpdates),
+   mOHSubscriptions(this, mOHUpdatesPerSecond, mOHObjectUpdates),
+   mObjectSubscriptions(this, mObjectUpdatesPerSecond, mObjectObjectUpdates)
 {
     OptionSet* optionsSet = OptionSet::getOptions(ALWAYS_POLICY_OPTIONS,NULL);
     optionsSet->parse(args);
+
+    uint32 nthreads = std::max(GetOptionValue<uint32>(ALWAYS_POLICY_OPTIONS, LOC_SERVICE_THREADS), (uint32)1);
+    // The main strand builds updates too, so it counts as one of the threads
+    if (nthreads > 1)
+        mWorkers = new Network::IOServicePool("AlwaysLocationUpdatePolicy", nthreads - 1);
+    mBuildRunner = new Network::ParallelTaskRunner(mWorkers);
+    // A few shards per thread so one busy subscriber doesn't leave the other
+    // workers idle
+    uint32 nshards = (nthreads > 1) ? 4 * nthreads : 1;
+    mServerSubscriptions.setNumShards(nshards);
+    mOHSubscriptions.setNumShards(nshards);
+    mObjectSubscriptions.setNumShards(nshards);
 }
 
 AlwaysLocationUpdatePolicy::~AlwaysLocationUpdatePolicy() {
+    delete mBuildRunner;
+    delete mWorkers;
 }
 
 void AlwaysLocationUpdatePolicy::start() {
+    if (mWorkers != NULL) {
+        mWorkers->startWork();
+        mWorkers->run();
+    }
     mStatsPoller.start();
 }
 
 void AlwaysLocationUpdatePolicy::stop() {
     mStatsPoller.stop();
+    if (mWorkers != NULL)
+        mWorkers->join();
 }
 
 void AlwaysLocationUpdatePolicy::reportStats() {
@@ -101,6 +134,37 @@ void AlwaysLocationUpdatePolicy::reportStats() {
         mObjectUpdatesPerSecond.read() / since_last_seconds
     );
     mObjectUpdatesPerSecond = 0;
+
+    reportBytesPerUpdate(mTimeSeriesServerBytesPerUpdateName, mServerObjectUpdates, mServerUpdateBytes);
+    reportBytesPerUpdate(mTimeSeriesOHBytesPerUpdateName, mOHObjectUpdates, mOHUpdateBytes);
+    reportBytesPerUpdate(mTimeSeriesObjectBytesPerUpdateName, mObjectObjectUpdates, mObjectUpdateBytes);
+}
+
+void AlwaysLocationUpdatePolicy::reportBytesPerUpdate(const String& name, AtomicValue<uint32>& updates, AtomicValue<uint32>& bytes) {
+    uint32 nupdates = updates.read();
+    if (nupdates > 0) {
+        mLocService->context()->timeSeries->report(
+            name,
+            bytes.read() / (float32)nupdates
+        );
+    }
+    updates = 0;
+    bytes = 0;
+}
+
+Vector3f AlwaysLocationUpdatePolicy::quantize(const Vector3f& v, float32 quantum) {
+    return Vector3f(
+        floor(v.x / quantum + 0.5f) * quantum,
+        floor(v.y / quantum + 0.5f) * quantum,
+        floor(v.z / quantum + 0.5f) * quantum
+    );
+}
+
+bool AlwaysLocationUpdatePolicy::locationChanged(const TimedMotionVector3f& last_sent, const TimedMotionVector3f& newval, float32 quantum) {
+    if ((last_sent.velocity() - newval.velocity()).lengthSquared() > quantum*quantum)
+        return true;
+    Vector3f predicted = last_sent.position(newval.updateTime());
+    return (predicted - newval.position()).lengthSquared() > quantum*quantum;
 }
 
 void AlwaysLocationUpdatePolicy::subscribe(ServerID remote, const UUID& uuid, SeqNoPtr seqnoPtr)
@@ -212,9 +276,19 @@ void AlwaysLocationUpdatePolicy::replicaPhysicsUpdated(const UUID& uuid, const S
 }
 
 void AlwaysLocationUpdatePolicy::service() {
-    mServerSubscriptions.service();
-    mOHSubscriptions.service();
-    mObjectSubscriptions.service();
+    mServerSubscriptions.prepareService();
+    mOHSubscriptions.prepareService();
+    mObjectSubscriptions.prepareService();
+
+    BuildTaskList tasks;
+    mServerSubscriptions.getBuildTasks(&tasks);
+    mOHSubscriptions.getBuildTasks(&tasks);
+    mObjectSubscriptions.getBuildTasks(&tasks);
+    mBuildRunner->run(tasks);
+
+    mServerSubscriptions.finishService();
+    mOHSubscriptions.finishService();
+    mObjectSubscriptions.finishService();
 }
 
 void AlwaysLocationUpdatePolicy::tryCreateChildStream(const UUID& dest, ODPSST::Stream::Ptr parent_stream, std::string* msg, int count) {
@@ -319,10 +393,8 @@ bool AlwaysLocationUpdatePolicy::isSelfSubscriber(const ServerID& sid, const UUI
     return false;
 }
 
-bool AlwaysLocationUpdatePolicy::trySend(const UUID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu)
+bool AlwaysLocationUpdatePolicy::trySend(const UUID& dest, const String& blu_msg)
 {
-    std::string bluMsg = serializePBJMessage(blu);
-
     ObjectSession* session = mLocService->context()->objectSessionManager()->getSession(ObjectReference(dest));
     if (session == NULL) {
         mObjectSubscriptions.decrementOutstandingMessageCount(dest);
@@ -335,16 +407,15 @@ bool AlwaysLocationUpdatePolicy::trySend(const UUID& dest, const Sirikata::Proto
     }
 
     Sirikata::Protocol::Frame msg_frame;
-    msg_frame.set_payload(bluMsg);
+    msg_frame.set_payload(blu_msg);
     std::string* framed_loc_msg = new std::string(serializePBJMessage(msg_frame));
+    mObjectUpdateBytes += framed_loc_msg->size();
     tryCreateChildStream(dest, locServiceStream, framed_loc_msg, 0);
     return true;
 }
 
-bool AlwaysLocationUpdatePolicy::trySend(const OHDP::NodeID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu)
+bool AlwaysLocationUpdatePolicy::trySend(const OHDP::NodeID& dest, const String& blu_msg)
 {
-    std::string bluMsg = serializePBJMessage(blu);
-
     ObjectHostSessionPtr session = mLocService->context()->ohSessionManager()->getSession(dest);
     if (!session) {
         mOHSubscriptions.decrementOutstandingMessageCount(dest);
@@ -357,19 +428,22 @@ bool AlwaysLocationUpdatePolicy::trySend(const OHDP::NodeID& dest, const Sirikat
     }
 
     Sirikata::Protocol::Frame msg_frame;
-    msg_frame.set_payload(bluMsg);
+    msg_frame.set_payload(blu_msg);
     std::string* framed_loc_msg = new std::string(serializePBJMessage(msg_frame));
+    mOHUpdateBytes += framed_loc_msg->size();
     tryCreateChildStream(dest, locServiceStream, framed_loc_msg, 0);
     return true;
 }
 
-bool AlwaysLocationUpdatePolicy::trySend(const ServerID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu) {
+bool AlwaysLocationUpdatePolicy::trySend(const ServerID& dest, const String& blu_msg) {
+    uint32 msg_size = blu_msg.size();
+
     Message* msg = new Message(
         mLocService->context()->id(),
         SERVER_PORT_LOCATION,
         dest,
         SERVER_PORT_LOCATION,
-        serializePBJMessage(blu)
+        blu_msg
     );
 
     // There's no retries/async step for servers since they either get on the
@@ -377,7 +451,10 @@ bool AlwaysLocationUpdatePolicy::trySend(const ServerID& dest, const Sirikata::P
     // immediately adjust the number of oustanding messages back.
     mServerSubscriptions.decrementOutstandingMessageCount(dest);
 
-    return mLocMessageRouter->route(msg);
+    bool routed = mLocMessageRouter->route(msg);
+    if (routed)
+        mServerUpdateBytes += msg_size;
+    return routed;
 }
 
 } // namespace Sirikata
@@ -35,11 +35,16 @@
 
 #include <sirikata/space/LocationService.hpp>
 #include <sirikata/core/options/CommonOptions.hpp>
+#include <sirikata/core/network/IOServicePool.hpp>
+#include <sirikata/core/network/ParallelTaskRunner.hpp>
+#include <sirikata/core/network/Message.hpp>
 
 #include "Protocol_Loc.pbj.hpp"
 
 #define ALWAYS_POLICY_OPTIONS      "always_location_update_policy"
 #define LOC_MAX_PER_RESULT         "loc.max-per-result"
+#define LOC_POSITION_QUANTUM       "loc.position-quantum"
+#define LOC_SERVICE_THREADS        "loc.service-threads"
 
 namespace Sirikata {
 
@@ -88,6 +93,7 @@ public:
 
 private:
     void reportStats();
+    void reportBytesPerUpdate(const String& name, AtomicValue<uint32>& updates, AtomicValue<uint32>& bytes);
 
     void tryCreateChildStream(const UUID& dest, ODPSST::Stream::Ptr parent_stream, std::string* msg, int count);
     void objectLocSubstreamCallback(int x, ODPSST::Stream::Ptr substream, const UUID& dest, ODPSST::Stream::Ptr parent_substream, std::string* msg, int count);
@@ -102,11 +108,24 @@ private:
     bool isSelfSubscriber(const OHDP::NodeID& sid, const UUID& observed);
     bool isSelfSubscriber(const ServerID& sid, const UUID& observed);
 
-    bool trySend(const UUID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu);
-    bool trySend(const OHDP::NodeID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu);
-    bool trySend(const ServerID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu);
+    // Send a serialized BulkLocationUpdate
+    bool trySend(const UUID& dest, const String& blu_msg);
+    bool trySend(const OHDP::NodeID& dest, const String& blu_msg);
+    bool trySend(const ServerID& dest, const String& blu_msg);
 
     struct UpdateInfo {
+        // Bits for the fields which have changed since they were last sent to
+        // the subscriber. Only these fields are included in the update.
+        enum Field {
+            LocationField = 1,
+            OrientationField = 2,
+            BoundsField = 4,
+            MeshField = 8,
+            PhysicsField = 16,
+            AllFields = 31
+        };
+
+        uint8 dirty;
         uint64 epoch;
         TimedMotionVector3f location;
         TimedMotionQuaternion orientation;
@@ -115,13 +134,35 @@ private:
         String physics;
     };
 
-    template<typename SubscriberType>
+    // Round each component to the nearest multiple of quantum
+    static Vector3f quantize(const Vector3f& v, float32 quantum);
+    // Whether a receiver that has last_sent would be more than quantum away
+    // from newval if it just extrapolated.
+    static bool locationChanged(const TimedMotionVector3f& last_sent, const TimedMotionVector3f& newval, float32 quantum);
+
+    typedef std::tr1::unordered_map<UUID, UpdateInfo, UUID::Hasher> UpdateInfoMap;
+    typedef std::tr1::unordered_map<UUID, TimedMotionVector3f, UUID::Hasher> LocationMap;
+    typedef std::vector<std::pair<UUID, TimedMotionVector3f> > PendingLocationList;
+
+    // A unit of update building work which can be run on any thread
+    typedef Network::ParallelTaskRunner::Task BuildTask;
+    typedef Network::ParallelTaskRunner::TaskList BuildTaskList;
+
+    // Subscribers are kept in shards which are handled by worker threads
+    // independently. service() runs in three phases: on the calling thread
+    // each index collects the subscribers with pending updates, the workers
+    // build and serialize their messages, and then the calling thread hands
+    // the messages to trySend in order. Only the first and last phases touch
+    // session state or the subscription maps' structure, so the workers need
+    // no locking.
+    template<typename SubscriberType, typename SubscriberHasher>
     struct SubscriberIndex {
         AlwaysLocationUpdatePolicy* parent;
         AtomicValue<uint32>& sent_count;
+        AtomicValue<uint32>& sent_update_count;
 
         typedef std::set<UUID> UUIDSet;
-        typedef std::set<SubscriberType> SubscriberSet;
+        typedef std::tr1::unordered_set<SubscriberType, SubscriberHasher> SubscriberSet;
 
         struct SubscriberInfo {
             SubscriberInfo(SeqNoPtr seq_number_ptr )
@@ -131,7 +172,12 @@ private:
 
             SeqNoPtr seqnoPtr;
             UUIDSet subscribedTo;
-            std::map<UUID, UpdateInfo> outstandingUpdates;
+            UpdateInfoMap outstandingUpdates;
+            // The location each object had in the last update this
+            // subscriber was successfully sent, used to drop location updates
+            // the subscriber could have predicted. Only maintained when
+            // loc.position-quantum is enabled.
+            LocationMap lastSentLocations;
             // Sometimes a subscriber may stall or hang, leaving the underlying
             // connection open but not handling loc update substreams. In this
             // case, we can end up generating a ton of update streams that fail
@@ -145,38 +191,94 @@ private:
             uint8 numOutstandingMessages;
         };
 
-        // Forward index: Subscriber -> Objects + Updates
-        typedef std::map<SubscriberType, SubscriberInfo*> SubscriberMap;
-        SubscriberMap mSubscriptions;
+        // A serialized BulkLocationUpdate waiting to be sent
+        struct PreparedMessage {
+            String data;
+            uint32 updates;
+            // Everything before this in outstandingUpdates can be cleared
+            // once this message is sent
+            typename UpdateInfoMap::iterator shippedThrough;
+            PendingLocationList locations;
+        };
+
+        struct PreparedSubscriber {
+            PreparedSubscriber(const SubscriberType& _sid, SubscriberInfo* _info)
+             : sid(_sid), info(_info), allConsumed(false)
+            {}
+
+            SubscriberType sid;
+            SubscriberInfo* info;
+            std::vector<PreparedMessage> messages;
+            // True if, once all messages are sent, nothing in
+            // outstandingUpdates still needs to be sent
+            bool allConsumed;
+        };
+
+        typedef std::tr1::unordered_map<SubscriberType, SubscriberInfo*, SubscriberHasher> SubscriberMap;
+        typedef std::vector<PreparedSubscriber> PreparedSubscriberList;
+
+        struct Shard {
+            // Forward index: Subscriber -> Objects + Updates
+            SubscriberMap subscriptions;
+            // Subscribers with updates to build in the current service() call
+            PreparedSubscriberList prepared;
+        };
+        std::vector<Shard> mShards;
+
         // Reverse index: Objects -> Subscribers
-        typedef std::map<UUID, SubscriberSet*> ObjectSubscribersMap;
+        typedef std::tr1::unordered_map<UUID, SubscriberSet*, UUID::Hasher> ObjectSubscribersMap;
         ObjectSubscribersMap mObjectSubscribers;
 
-        SubscriberIndex(AlwaysLocationUpdatePolicy* p, AtomicValue<uint32>& _sent_count)
+        // Options are sampled once per service() call so the workers don't
+        // need to touch the OptionSet
+        uint32 mMaxUpdates;
+        float32 mPositionQuantum;
+
+        SubscriberIndex(AlwaysLocationUpdatePolicy* p, AtomicValue<uint32>& _sent_count, AtomicValue<uint32>& _sent_update_count)
          : parent(p),
-           sent_count(_sent_count)
+           sent_count(_sent_count),
+           sent_update_count(_sent_update_count),
+           mShards(1),
+           mMaxUpdates(0),
+           mPositionQuantum(0)
         {
         }
 
         ~SubscriberIndex() {
-            for(typename SubscriberMap::iterator sub_it = mSubscriptions.begin(); sub_it != mSubscriptions.end(); sub_it++)
-                delete sub_it->second;
-            mSubscriptions.clear();
+            for(uint32 i = 0; i < mShards.size(); i++) {
+                SubscriberMap& subscriptions = mShards[i].subscriptions;
+                for(typename SubscriberMap::iterator sub_it = subscriptions.begin(); sub_it != subscriptions.end(); sub_it++)
+                    delete sub_it->second;
+                subscriptions.clear();
+            }
 
             for(typename ObjectSubscribersMap::iterator sub_it = mObjectSubscribers.begin(); sub_it != mObjectSubscribers.end(); sub_it++)
                 delete sub_it->second;
             mObjectSubscribers.clear();
         }
 
+        // Must be called before any subscriptions are added
+        void setNumShards(uint32 num_shards) {
+            assert(num_shards > 0);
+            mShards.resize(num_shards);
+        }
+
+        SubscriberMap& subscriptionsFor(const SubscriberType& remote) {
+            return mShards[SubscriberHasher()(remote) % mShards.size()].subscriptions;
+        }
+
+        SubscriberInfo* findSubscriber(const SubscriberType& remote) {
+            SubscriberMap& subscriptions = subscriptionsFor(remote);
+            typename SubscriberMap::iterator sub_it = subscriptions.find(remote);
+            if (sub_it == subscriptions.end()) return NULL;
+            return sub_it->second;
+        }
+
         void subscribe(const SubscriberType& remote, const UUID& uuid, SeqNoPtr seqnoPtr) {
             // Add object to server's subscription list
-            typename SubscriberMap::iterator sub_it = mSubscriptions.find(remote);
-            if (sub_it == mSubscriptions.end()) {
-                mSubscriptions[remote] = new SubscriberInfo(seqnoPtr);
-
-                sub_it = mSubscriptions.find(remote);
-            }
-            SubscriberInfo* subs = sub_it->second;
+            SubscriberInfo*& subs = subscriptionsFor(remote)[remote];
+            if (subs == NULL)
+                subs = new SubscriberInfo(seqnoPtr);
             subs->subscribedTo.insert(uuid);
 
             // Add server to object's subscribers list
@@ -197,10 +299,10 @@ private:
 
         void unsubscribe(const SubscriberType& remote, const UUID& uuid) {
             // Remove object from server's list
-            typename SubscriberMap::iterator sub_it = mSubscriptions.find(remote);
-            if (sub_it != mSubscriptions.end()) {
-                SubscriberInfo* subs = sub_it->second;
+            SubscriberInfo* subs = findSubscriber(remote);
+            if (subs != NULL) {
                 subs->subscribedTo.erase(uuid);
+                subs->lastSentLocations.erase(uuid);
             }
 
             // Remove server from object's list
@@ -212,12 +314,10 @@ private:
         }
 
         void unsubscribe(const SubscriberType& remote) {
-            typename SubscriberMap::iterator sub_it = mSubscriptions.find(remote);
-            if (sub_it == mSubscriptions.end())
+            SubscriberInfo* subs = findSubscriber(remote);
+            if (subs == NULL)
                 return;
 
-            SubscriberInfo* subs = sub_it->second;
-
             while(!subs->subscribedTo.empty()) {
                 UUID tmp=*(subs->subscribedTo.begin());
                 unsubscribe(remote, tmp);
@@ -249,36 +349,42 @@ private:
         // new subscriber is added.  Otherwise its just a utility for the normal
         // update method above.
         void propertyUpdatedForSubscriber(const UUID& uuid, LocationService* locservice, SubscriberType sub, UpdateFunctor fup) {
-            if (mSubscriptions.find(sub) == mSubscriptions.end()) return; // XXX FIXME
-            assert(mSubscriptions.find(sub) != mSubscriptions.end());
-            SubscriberInfo* sub_info = mSubscriptions[sub];
+            SubscriberInfo* sub_info = findSubscriber(sub);
+            if (sub_info == NULL) return; // XXX FIXME
             if (sub_info->subscribedTo.find(uuid) == sub_info->subscribedTo.end()) return; // XXX FIXME
             assert(sub_info->subscribedTo.find(uuid) != sub_info->subscribedTo.end());
 
-            if (sub_info->outstandingUpdates.find(uuid) == sub_info->outstandingUpdates.end()) {
-                UpdateInfo new_ui;
+            // Without an update functor this is a forced update, so we
+            // (re)send everything. Otherwise the functor marks the field it
+            // changes as dirty.
+            UpdateInfoMap::iterator ui_it = sub_info->outstandingUpdates.find(uuid);
+            bool is_new = (ui_it == sub_info->outstandingUpdates.end());
+            if (is_new || !fup) {
+                UpdateInfo& new_ui = sub_info->outstandingUpdates[uuid];
+                if (is_new)
+                    new_ui.dirty = 0;
                 new_ui.epoch = locservice->epoch(uuid);
                 new_ui.location = locservice->location(uuid);
                 new_ui.bounds = locservice->bounds(uuid);
                 new_ui.mesh = locservice->mesh(uuid);
                 new_ui.orientation = locservice->orientation(uuid);
                 new_ui.physics = locservice->physics(uuid);
-                sub_info->outstandingUpdates[uuid] = new_ui;
+                if (!fup) {
+                    new_ui.dirty = UpdateInfo::AllFields;
+                    sub_info->lastSentLocations.erase(uuid);
+                }
+                ui_it = sub_info->outstandingUpdates.find(uuid);
             }
-            else
-                UpdateInfo& ui = sub_info->outstandingUpdates[uuid];
-
 
-            UpdateInfo& ui = sub_info->outstandingUpdates[uuid];
             if (fup)
-                fup(ui);
+                fup(ui_it->second);
         }
 
-        static void setUILocation(UpdateInfo& ui, const TimedMotionVector3f& newval) {ui.location = newval; }
-        static void setUIOrientation(UpdateInfo& ui, const TimedMotionQuaternion& newval) { ui.orientation = newval; }
-        static void setUIBounds(UpdateInfo& ui, const BoundingSphere3f& newval) { ui.bounds = newval; }
-        static void setUIMesh(UpdateInfo& ui, const String& newval) {ui.mesh = newval;}
-        static void setUIPhysics(UpdateInfo& ui, const String& newval) {ui.physics = newval;}
+        static void setUILocation(UpdateInfo& ui, const TimedMotionVector3f& newval) { ui.location = newval; ui.dirty |= UpdateInfo::LocationField; }
+        static void setUIOrientation(UpdateInfo& ui, const TimedMotionQuaternion& newval) { ui.orientation = newval; ui.dirty |= UpdateInfo::OrientationField; }
+        static void setUIBounds(UpdateInfo& ui, const BoundingSphere3f& newval) { ui.bounds = newval; ui.dirty |= UpdateInfo::BoundsField; }
+        static void setUIMesh(UpdateInfo& ui, const String& newval) { ui.mesh = newval; ui.dirty |= UpdateInfo::MeshField; }
+        static void setUIPhysics(UpdateInfo& ui, const String& newval) { ui.physics = newval; ui.dirty |= UpdateInfo::PhysicsField; }
 
         void locationUpdated(const UUID& uuid, const TimedMotionVector3f& newval, LocationService* locservice) {
             propertyUpdated(
@@ -316,106 +422,222 @@ private:
         }
 
 
-        void service() {
-            uint32 max_updates = GetOptionValue<uint32>(ALWAYS_POLICY_OPTIONS, LOC_MAX_PER_RESULT);
-            const uint32 outstanding_message_hard_limit = 64;
-            const uint32 outstanding_message_soft_limit = 25;
+        static const uint32 OutstandingMessageHardLimit = 64;
+        static const uint32 OutstandingMessageSoftLimit = 25;
 
-            std::list<SubscriberType> to_delete;
+        // Phase 1, on the calling thread: drop subscribers which are gone and
+        // collect the ones with updates to build.
+        void prepareService() {
+            mMaxUpdates = GetOptionValue<uint32>(ALWAYS_POLICY_OPTIONS, LOC_MAX_PER_RESULT);
+            mPositionQuantum = GetOptionValue<float32>(ALWAYS_POLICY_OPTIONS, LOC_POSITION_QUANTUM);
 
-            for(typename SubscriberMap::iterator server_it = mSubscriptions.begin(); server_it != mSubscriptions.end(); server_it++) {
-                SubscriberType sid = server_it->first;
-                SubscriberInfo* sub_info = server_it->second;
+            std::vector<SubscriberType> to_delete;
+            for(uint32 i = 0; i < mShards.size(); i++) {
+                Shard& shard = mShards[i];
+                shard.prepared.clear();
+                to_delete.clear();
 
-                // We can end up with leftover updates after a subscriber has
-                // already disconnected. We need to ignore them if we're not
-                // even going to be able to send the messages.
-                if (!parent->validSubscriber(sid)) {
-                    sub_info->outstandingUpdates.clear();
-                    if (sub_info->subscribedTo.empty()) {
-                        delete sub_info;
-                        to_delete.push_back(sid);
+                for(typename SubscriberMap::iterator server_it = shard.subscriptions.begin(); server_it != shard.subscriptions.end(); server_it++) {
+                    SubscriberType sid = server_it->first;
+                    SubscriberInfo* sub_info = server_it->second;
+
+                    // We can end up with leftover updates after a subscriber has
+                    // already disconnected. We need to ignore them if we're not
+                    // even going to be able to send the messages.
+                    if (!parent->validSubscriber(sid))
+                        sub_info->outstandingUpdates.clear();
+
+                    if (sub_info->outstandingUpdates.empty()) {
+                        if (sub_info->subscribedTo.empty()) {
+                            delete sub_info;
+                            to_delete.push_back(sid);
+                        }
+                        continue;
                     }
-                    continue;
+
+                    shard.prepared.push_back(PreparedSubscriber(sid, sub_info));
                 }
 
-                Sirikata::Protocol::Loc::BulkLocationUpdate bulk_update;
+                for(typename std::vector<SubscriberType>::iterator it = to_delete.begin(); it != to_delete.end(); it++)
+                    shard.subscriptions.erase(*it);
+            }
+        }
 
-                bool send_failed = false;
-                std::map<UUID, UpdateInfo>::iterator last_shipped = sub_info->outstandingUpdates.begin();
-                for(std::map<UUID, UpdateInfo>::iterator up_it = sub_info->outstandingUpdates.begin();
-                    sub_info->numOutstandingMessages < outstanding_message_soft_limit && up_it != sub_info->outstandingUpdates.end();
-                    up_it++)
-                {
-                    Sirikata::Protocol::Loc::ILocationUpdate update = bulk_update.add_update();
-                    update.set_object(up_it->first);
+        // Add a BuildTask for each shard with work to do in this service() call
+        void getBuildTasks(BuildTaskList* tasks_out) {
+            for(uint32 i = 0; i < mShards.size(); i++) {
+                if (!mShards[i].prepared.empty())
+                    tasks_out->push_back(std::tr1::bind(&SubscriberIndex::buildShard, this, i));
+            }
+        }
+
+        // Phase 2, on any thread: build and serialize the messages for one
+        // shard. Only reads subscriber state, apart from the (atomic) sequence
+        // numbers.
+        void buildShard(uint32 shard_idx) {
+            PreparedSubscriberList& prepared = mShards[shard_idx].prepared;
+            for(typename PreparedSubscriberList::iterator it = prepared.begin(); it != prepared.end(); it++)
+                buildSubscriber(*it);
+        }
 
-                    //write and update sequence number
-                    update.set_seqno( (*(sub_info->seqnoPtr)) ++ );
+        void buildSubscriber(PreparedSubscriber& prep) {
+            SubscriberInfo* sub_info = prep.info;
+            // Messages we build will be outstanding by the time we'd send the
+            // next one, so apply the limits as if they had already gone out
+            uint32 outstanding = sub_info->numOutstandingMessages;
 
-                    if (parent->isSelfSubscriber(sid, up_it->first))
-                        update.set_epoch(up_it->second.epoch);
+            Sirikata::Protocol::Loc::BulkLocationUpdate bulk_update;
+            // Locations in the update currently being built, which become the
+            // subscriber's last sent locations if it goes out successfully
+            PendingLocationList pending_locations;
 
-                    Sirikata::Protocol::ITimedMotionVector location = update.mutable_location();
-                    location.set_t(up_it->second.location.updateTime());
-                    location.set_position(up_it->second.location.position());
+            for(UpdateInfoMap::iterator up_it = sub_info->outstandingUpdates.begin();
+                outstanding < OutstandingMessageSoftLimit && up_it != sub_info->outstandingUpdates.end();
+                up_it++)
+            {
+                const UpdateInfo& ui = up_it->second;
+                uint8 fields = ui.dirty;
+
+                // Drop location changes the subscriber can extrapolate
+                // from what we last sent it
+                TimedMotionVector3f sent_location = ui.location;
+                if ((fields & UpdateInfo::LocationField) && mPositionQuantum > 0) {
+                    sent_location = TimedMotionVector3f(
+                        ui.location.updateTime(),
+                        MotionVector3f(
+                            quantize(ui.location.position(), mPositionQuantum),
+                            quantize(ui.location.velocity(), mPositionQuantum)
+                        )
+                    );
+                    LocationMap::const_iterator last_it = sub_info->lastSentLocations.find(up_it->first);
+                    if (last_it != sub_info->lastSentLocations.end() &&
+                        !locationChanged(last_it->second, sent_location, mPositionQuantum))
+                        fields &= ~UpdateInfo::LocationField;
+                }
+
+                // Nothing left worth sending, it'll get cleared out with
+                // the rest of the shipped updates
+                if (fields == 0) continue;
+
+                Sirikata::Protocol::Loc::ILocationUpdate update = bulk_update.add_update();
+                update.set_object(up_it->first);
 
-                    location.set_velocity(up_it->second.location.velocity());
+                //write and update sequence number
+                update.set_seqno( (*(sub_info->seqnoPtr)) ++ );
 
+                if (parent->isSelfSubscriber(prep.sid, up_it->first))
+                    update.set_epoch(ui.epoch);
+
+                if (fields & UpdateInfo::LocationField) {
+                    Sirikata::Protocol::ITimedMotionVector location = update.mutable_location();
+                    location.set_t(sent_location.updateTime());
+                    location.set_position(sent_location.position());
+                    location.set_velocity(sent_location.velocity());
+                    if (mPositionQuantum > 0)
+                        pending_locations.push_back(std::make_pair(up_it->first, sent_location));
+                }
+
+                if (fields & UpdateInfo::OrientationField) {
                     Sirikata::Protocol::ITimedMotionQuaternion orientation = update.mutable_orientation();
-                    orientation.set_t(up_it->second.orientation.updateTime());
-                    orientation.set_position(up_it->second.orientation.position());
-                    orientation.set_velocity(up_it->second.orientation.velocity());
+                    orientation.set_t(ui.orientation.updateTime());
+                    orientation.set_position(ui.orientation.position());
+                    orientation.set_velocity(ui.orientation.velocity());
+                }
+
+                if (fields & UpdateInfo::BoundsField)
+                    update.set_bounds(ui.bounds);
+
+                if (fields & UpdateInfo::MeshField)
+                    update.set_mesh(ui.mesh);
+                if (fields & UpdateInfo::PhysicsField)
+                    update.set_physics(ui.physics);
+
+                // If we hit the limit for this update, queue it up to be sent
+                if (bulk_update.update_size() > (int32)mMaxUpdates) {
+                    UpdateInfoMap::iterator shipped_through = up_it;
+                    shipped_through++;
+                    addPreparedMessage(prep, bulk_update, pending_locations, shipped_through);
+                    bulk_update = Sirikata::Protocol::Loc::BulkLocationUpdate(); // clear it out
+                    outstanding++;
+                }
+            }
 
-                    update.set_bounds(up_it->second.bounds);
+            // Send the last few if necessary/possible
+            if (outstanding < OutstandingMessageHardLimit && bulk_update.update_size() > 0) {
+                addPreparedMessage(prep, bulk_update, pending_locations, sub_info->outstandingUpdates.end());
+            }
+            else if (bulk_update.update_size() == 0 && outstanding < OutstandingMessageSoftLimit) {
+                // Everything left was suppressed, so there's nothing
+                // more to send
+                prep.allConsumed = true;
+            }
+        }
 
-                    update.set_mesh(up_it->second.mesh);
-                    update.set_physics(up_it->second.physics);
+        void addPreparedMessage(PreparedSubscriber& prep, const Sirikata::Protocol::Loc::BulkLocationUpdate& bulk_update, PendingLocationList& pending, UpdateInfoMap::iterator shipped_through) {
+            prep.messages.push_back(PreparedMessage());
+            PreparedMessage& msg = prep.messages.back();
+            serializePBJMessage(&msg.data, bulk_update);
+            msg.updates = bulk_update.update_size();
+            msg.shippedThrough = shipped_through;
+            msg.locations.swap(pending);
+        }
 
-                    // If we hit the limit for this update, try to send it out
-                    if (bulk_update.update_size() > (int32)max_updates) {
+        // Phase 3, on the calling thread: send the built messages in order,
+        // stopping at the first failure, and clear out whatever was sent. Any
+        // sequence numbers used by messages that don't go out are skipped,
+        // which subscribers already tolerate since they only look for newer
+        // updates.
+        void finishService() {
+            for(uint32 i = 0; i < mShards.size(); i++) {
+                Shard& shard = mShards[i];
+                for(typename PreparedSubscriberList::iterator it = shard.prepared.begin(); it != shard.prepared.end(); it++) {
+                    PreparedSubscriber& prep = *it;
+                    SubscriberInfo* sub_info = prep.info;
+
+                    bool send_failed = false;
+                    UpdateInfoMap::iterator last_shipped = sub_info->outstandingUpdates.begin();
+                    for(typename std::vector<PreparedMessage>::iterator msg_it = prep.messages.begin(); msg_it != prep.messages.end(); msg_it++) {
                         sub_info->numOutstandingMessages++;
-                        bool sent = parent->trySend(sid, bulk_update);
+                        bool sent = parent->trySend(prep.sid, msg_it->data);
                         if (!sent) {
                             send_failed = true;
                             break;
                         }
-                        else {
-                            bulk_update = Sirikata::Protocol::Loc::BulkLocationUpdate(); // clear it out
-                            last_shipped = up_it;
-                            sent_count++;
-                        }
-                    }
-                }
-
-                // Try to send the last few if necessary/possible
-                if (sub_info->numOutstandingMessages < outstanding_message_hard_limit && !send_failed && bulk_update.update_size() > 0) {
-                    sub_info->numOutstandingMessages++;
-                    bool sent = parent->trySend(sid, bulk_update);
-                    if (sent) {
-                        last_shipped = sub_info->outstandingUpdates.end();
+                        sent_update_count += msg_it->updates;
+                        commitLocations(sub_info, msg_it->locations);
+                        last_shipped = msg_it->shippedThrough;
                         sent_count++;
                     }
-                }
+                    if (!send_failed && prep.allConsumed)
+                        last_shipped = sub_info->outstandingUpdates.end();
 
-                // Finally clear out any entries successfully sent out
-                sub_info->outstandingUpdates.erase( sub_info->outstandingUpdates.begin(), last_shipped);
+                    // Finally clear out any entries successfully sent out
+                    sub_info->outstandingUpdates.erase( sub_info->outstandingUpdates.begin(), last_shipped);
 
-                if (sub_info->subscribedTo.empty() && sub_info->outstandingUpdates.empty()) {
-                    delete sub_info;
-                    to_delete.push_back(sid);
+                    if (sub_info->subscribedTo.empty() && sub_info->outstandingUpdates.empty()) {
+                        delete sub_info;
+                        shard.subscriptions.erase(prep.sid);
+                    }
                 }
+                shard.prepared.clear();
             }
+        }
 
-            for(typename std::list<SubscriberType>::iterator it = to_delete.begin(); it != to_delete.end(); it++)
-                mSubscriptions.erase(*it);
+        void commitLocations(SubscriberInfo* sub_info, PendingLocationList& pending) {
+            for(PendingLocationList::iterator it = pending.begin(); it != pending.end(); it++) {
+                // Don't start tracking objects that were unsubscribed while
+                // their update was outstanding
+                if (sub_info->subscribedTo.find(it->first) != sub_info->subscribedTo.end())
+                    sub_info->lastSentLocations[it->first] = it->second;
+            }
+            pending.clear();
         }
 
         void decrementOutstandingMessageCount(SubscriberType dest) {
-            typename SubscriberMap::iterator sub_it = mSubscriptions.find(dest);
-            if (sub_it == mSubscriptions.end()) return;
-            assert(sub_it->second->numOutstandingMessages > 0);
-            sub_it->second->numOutstandingMessages--;
+            SubscriberInfo* sub_info = findSubscriber(dest);
+            if (sub_info == NULL) return;
+            assert(sub_info->numOutstandingMessages > 0);
+            sub_info->numOutstandingMessages--;
         }
 
     };
@@ -428,14 +650,30 @@ private:
     AtomicValue<uint32> mOHUpdatesPerSecond;
     const String mTimeSeriesObjectUpdatesName;
     AtomicValue<uint32> mObjectUpdatesPerSecond;
-
-    typedef SubscriberIndex<ServerID> ServerSubscriberIndex;
+    // Individual object updates and the bytes used to send them, to track
+    // the average size of an update
+    const String mTimeSeriesServerBytesPerUpdateName;
+    AtomicValue<uint32> mServerObjectUpdates;
+    AtomicValue<uint32> mServerUpdateBytes;
+    const String mTimeSeriesOHBytesPerUpdateName;
+    AtomicValue<uint32> mOHObjectUpdates;
+    AtomicValue<uint32> mOHUpdateBytes;
+    const String mTimeSeriesObjectBytesPerUpdateName;
+    AtomicValue<uint32> mObjectObjectUpdates;
+    AtomicValue<uint32> mObjectUpdateBytes;
+
+    // Workers for building updates alongside the calling thread, NULL if
+    // they're all built on the calling thread
+    Network::IOServicePool* mWorkers;
+    Network::ParallelTaskRunner* mBuildRunner;
+
+    typedef SubscriberIndex<ServerID, std::tr1::hash<ServerID> > ServerSubscriberIndex;
     ServerSubscriberIndex mServerSubscriptions;
 
-    typedef SubscriberIndex<OHDP::NodeID> OHSubscriberIndex;
+    typedef SubscriberIndex<OHDP::NodeID, OHDP::NodeID::Hasher> OHSubscriberIndex;
     OHSubscriberIndex mOHSubscriptions;
 
-    typedef SubscriberIndex<UUID> ObjectSubscriberIndex;
+    typedef SubscriberIndex<UUID, UUID::Hasher> ObjectSubscriberIndex;
     ObjectSubscriberIndex mObjectSubscriptions;
 }; // class AlwaysLocationUpdatePolicy
 
@@ -0,0 +1,236 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/space/AggregateJobGraph.hpp>
+
+#define JOBGRAPH_LOG(lvl, msg) SILOG(aggregate-job-graph, lvl, msg)
+
+// Dependency chains longer than this are assumed to be cycles. Aggregate trees
+// are never close to this deep.
+#define MAX_DEPENDENCY_DEPTH 256
+
+namespace Sirikata {
+
+AggregateJobGraph::AggregateJobGraph(uint32 nthreads, const String& name)
+ : mService(new Network::IOService(name)),
+   mWork(new Network::IOWork(mService, name + " Work")),
+   mReadyOrder(0),
+   mFinished(0)
+{
+    if (nthreads == 0)
+        nthreads = std::max(boost::thread::hardware_concurrency(), 1u);
+    for(uint32 i = 0; i < nthreads; i++)
+        mThreads.push_back(new Thread(name, std::tr1::bind(&AggregateJobGraph::threadMain, this)));
+}
+
+AggregateJobGraph::~AggregateJobGraph() {
+    delete mWork;
+    mWork = NULL;
+    mService->stop();
+    for(uint32 i = 0; i < mThreads.size(); i++) {
+        mThreads[i]->join();
+        delete mThreads[i];
+    }
+    mThreads.clear();
+    delete mService;
+}
+
+void AggregateJobGraph::threadMain() {
+    mService->run();
+}
+
+void AggregateJobGraph::add(const UUID& id, const std::vector<UUID>& deps, float64 priority, const Job& job) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    Node& node = mNodes[id];
+    node.job = job;
+    float64 old_priority = node.priority;
+    node.priority = priority;
+
+    for(uint32 i = 0; i < deps.size(); i++) {
+        const UUID& dep = deps[i];
+        if (dep == id || node.deps.find(dep) != node.deps.end()) continue;
+
+        NodeMap::iterator dep_it = mNodes.find(dep);
+        if (dep_it == mNodes.end()) continue;
+        if (dependsOn(dep, id, 0)) {
+            JOBGRAPH_LOG(warn, "Ignoring dependency of " << id << " on " << dep << " since it would create a cycle");
+            continue;
+        }
+
+        node.deps.insert(dep);
+        node.waitingOn++;
+        dep_it->second.dependents.push_back(id);
+    }
+
+    if (node.state == Node::Running) {
+        // Results from the current run are stale. Rather than running both at
+        // once, run again, after any new dependencies, once this one finishes.
+        node.rerun = true;
+        return;
+    }
+
+    if (node.state == Node::Delayed) {
+        // No need to wait out the retry delay for the new version
+        node.state = Node::Waiting;
+        node.generation++;
+    }
+    else if (node.state == Node::Ready && node.waitingOn > 0) {
+        // Picked up new dependencies, its ready queue entry will be skipped
+        node.state = Node::Waiting;
+    }
+    else if (node.state == Node::Ready && priority != old_priority) {
+        // Replace its ready queue entry with one at the new priority
+        queueReady(id, node);
+    }
+
+    if (node.state == Node::Waiting && node.waitingOn == 0)
+        makeReady(id, node);
+}
+
+bool AggregateJobGraph::dependsOn(const UUID& id, const UUID& target, uint32 depth) {
+    if (depth > MAX_DEPENDENCY_DEPTH) return true;
+    NodeMap::iterator it = mNodes.find(id);
+    if (it == mNodes.end()) return false;
+    for(std::set<UUID>::iterator dep_it = it->second.deps.begin(); dep_it != it->second.deps.end(); dep_it++) {
+        if (*dep_it == target || dependsOn(*dep_it, target, depth+1))
+            return true;
+    }
+    return false;
+}
+
+void AggregateJobGraph::queueReady(const UUID& id, Node& node) {
+    ReadyEntry entry;
+    entry.priority = node.priority;
+    entry.order = mReadyOrder++;
+    entry.id = id;
+    node.readyOrder = entry.order;
+    mReady.push(entry);
+}
+
+void AggregateJobGraph::makeReady(const UUID& id, Node& node) {
+    node.state = Node::Ready;
+    queueReady(id, node);
+    // One runNext per ready job, so every job gets a thread to run on as soon
+    // as one is free.
+    mService->post(
+        std::tr1::bind(&AggregateJobGraph::runNext, this),
+        "AggregateJobGraph::runNext"
+    );
+}
+
+void AggregateJobGraph::runNext() {
+    Job job;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        // Entries for jobs that were cancelled or picked up new dependencies,
+        // and entries replaced when a job was re-prioritized, are skipped
+        while(!mReady.empty()) {
+            ReadyEntry entry = mReady.top();
+            mReady.pop();
+            NodeMap::iterator it = mNodes.find(entry.id);
+            if (it == mNodes.end() || it->second.state != Node::Ready || it->second.readyOrder != entry.order) continue;
+            it->second.state = Node::Running;
+            job = it->second.job;
+            break;
+        }
+    }
+    if (job) job();
+}
+
+void AggregateJobGraph::release(const UUID& id) {
+    NodeMap::iterator it = mNodes.find(id);
+    if (it == mNodes.end()) return;
+
+    std::vector<UUID> dependents;
+    dependents.swap(it->second.dependents);
+    mNodes.erase(it);
+    mFinished++;
+
+    for(uint32 i = 0; i < dependents.size(); i++) {
+        NodeMap::iterator dep_it = mNodes.find(dependents[i]);
+        if (dep_it == mNodes.end()) continue;
+        Node& dep_node = dep_it->second;
+        if (dep_node.deps.erase(id) == 0) continue;
+        dep_node.waitingOn--;
+        if (dep_node.state == Node::Waiting && dep_node.waitingOn == 0)
+            makeReady(dep_it->first, dep_node);
+    }
+}
+
+void AggregateJobGraph::finish(const UUID& id) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    NodeMap::iterator it = mNodes.find(id);
+    if (it == mNodes.end()) return;
+    Node& node = it->second;
+    if (node.rerun) {
+        node.rerun = false;
+        node.generation++;
+        if (node.waitingOn == 0)
+            makeReady(id, node);
+        else
+            node.state = Node::Waiting;
+        return;
+    }
+    release(id);
+}
+
+void AggregateJobGraph::cancel(const UUID& id) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    NodeMap::iterator it = mNodes.find(id);
+    if (it == mNodes.end() || it->second.state == Node::Running) return;
+    release(id);
+}
+
+void AggregateJobGraph::retry(const UUID& id, const Duration& delay) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    NodeMap::iterator it = mNodes.find(id);
+    if (it == mNodes.end()) return;
+    Node& node = it->second;
+    // Replaced while it was running, so the new version can run right away
+    // unless it picked up new dependencies
+    if (node.rerun) {
+        node.rerun = false;
+        node.generation++;
+        if (node.waitingOn == 0)
+            makeReady(id, node);
+        else
+            node.state = Node::Waiting;
+        return;
+    }
+    node.state = Node::Delayed;
+    node.generation++;
+    mService->post(
+        delay,
+        std::tr1::bind(&AggregateJobGraph::handleRetry, this, id, node.generation),
+        "AggregateJobGraph::handleRetry"
+    );
+}
+
+void AggregateJobGraph::handleRetry(UUID id, uint32 generation) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    NodeMap::iterator it = mNodes.find(id);
+    if (it == mNodes.end()) return;
+    Node& node = it->second;
+    if (node.state != Node::Delayed || node.generation != generation) return;
+    node.state = Node::Waiting;
+    if (node.waitingOn == 0)
+        makeReady(id, node);
+}
+
+uint32 AggregateJobGraph::size() {
+    boost::mutex::scoped_lock lock(mMutex);
+    return mNodes.size();
+}
+
+uint64 AggregateJobGraph::finishedCount() {
+    boost::mutex::scoped_lock lock(mMutex);
+    return mFinished;
+}
+
+} // namespace Sirikata
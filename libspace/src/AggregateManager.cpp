@@ -56,18 +56,30 @@
 #define ONE_PIXEL_SOLID_ANGLE (HUMAN_FOV/(2560.0*1600.0))
 #define TWO_PI (2.0*3.14159)
 
+//Number of faces aggregate meshes are simplified to
+#define AGGREGATE_MESH_MAX_FACES 20000
+
 #define AGG_LOG(lvl, msg) SILOG(aggregate-manager, lvl, msg)
 
 namespace Sirikata {
 
 using namespace Mesh;
 
-AggregateManager::AggregateManager(LocationService* loc, Transfer::OAuthParamsPtr oauth, const String& username)
+AggregateManager::AggregateManager(LocationService* loc, Transfer::OAuthParamsPtr oauth, const String& username,
+                                   const String& cache_path, uint64 cache_size)
   : mAggregationThread(NULL),
     mAggregationService(new Network::IOService("AggregateManager")),
     mAggregationStrand(mAggregationService->createStrand("AggregateManager")),
     mIOWork(new Network::IOWork(mAggregationService, "Aggregation Work")),
     mLoc(loc),
+    // Generation jobs already run in parallel on the job graph's threads, one
+    // per core, so simplifying each mesh on more threads would only spawn
+    // threads that compete with them
+    mMeshSimplifier(1),
+    mJobGraph(new AggregateJobGraph(0, "AggregateManager Generation")),
+    mJobRoundStartTime(Time::null()),
+    mJobRoundStartCount(0),
+    mMeshCache(new AggregateMeshCache(cache_path, cache_size)),
     mOAuth(oauth),
     mCDNUsername(username),
     mModelTTL(Duration::minutes(60)),
@@ -98,22 +110,31 @@ AggregateManager::AggregateManager(LocationService* loc, Transfer::OAuthParamsPt
     // Start the processing thread
     mAggregationThread = new Thread( "AggregateManager", std::tr1::bind(&AggregateManager::aggregationThreadMain, this) );
 
+    mUploadService = new Network::IOService("AggregateManager::UploadService");
+    mUploadWork = new Network::IOWork(mUploadService, "AggregateManager::UploadWork");
     for (uint8 i = 0; i < NUM_UPLOAD_THREADS; i++) {
-      char id = '1';
-      mUploadServices[i] = new Network::IOService("AggregateManager::UploadService"+id);
-      mUploadStrands[i] = mUploadServices[i]->createStrand("AggregateManager::UploadStrand"+id);
-      mUploadWorks[i] =new Network::IOWork(mUploadServices[i], "AggregateManager::UploadWork"+id);
       mUploadThreads[i] = new Thread("AggregateManager Upload", std::tr1::bind(&AggregateManager::uploadThreadMain, this, i));
-
-      id++;
     }
 
     removeStaleLeaves();
 
     mCDNKeepAlivePoller->start();
+
+    if (mLoc->context()->commander()) {
+        // Get the hit rate and size of the cache of generated meshes
+        mLoc->context()->commander()->registerCommand(
+            "space.aggregates.cache",
+            mAggregationStrand->wrap(
+                std::tr1::bind(&AggregateManager::commandCacheStats, this, _1, _2, _3)
+            )
+        );
+    }
 }
 
 AggregateManager::~AggregateManager() {
+    if (mLoc->context()->commander())
+        mLoc->context()->commander()->unregisterCommand("space.aggregates.cache");
+
     // We need to make sure we clean this up before the IOService and IOStrand
     // it's running on.
     mCDNKeepAlivePoller->stop();
@@ -132,21 +153,24 @@ AggregateManager::~AggregateManager() {
     mAggregationService = NULL;
     delete mAggregationThread;
 
-    //Shutdown the upload threads.
+    //Shutdown the upload threads. Uploads finish generation jobs, so these
+    //need to stop before the job graph is destroyed.
+    delete mUploadWork;
+    mUploadWork = NULL;
+    mUploadService->stop();
     for (uint8 i = 0; i < NUM_UPLOAD_THREADS; i++) {
-      if (mUploadThreads[i] != NULL) {
-        if (mUploadServices[i] != NULL)
-            mUploadServices[i]->stop();
-        mUploadThreads[i]->join();
-      }
-
-      delete mUploadWorks[i];
-      delete mUploadStrands[i];
-      delete mUploadServices[i];
-
+      mUploadThreads[i]->join();
       delete mUploadThreads[i];
     }
 
+    //Then the generation threads, which may still post uploads that will
+    //never run.
+    delete mJobGraph;
+    mJobGraph = NULL;
+    delete mUploadService;
+
+    delete mMeshCache;
+
     delete mCenteringFilter;
     //Delete the model system.
     delete mModelsSystem;
@@ -158,7 +182,7 @@ void AggregateManager::aggregationThreadMain() {
 }
 
 void AggregateManager::uploadThreadMain(uint8 i) {
-  mUploadServices[i]->run();
+  mUploadService->run();
 }
 
 void AggregateManager::addAggregate(const UUID& uuid) {
@@ -311,16 +335,37 @@ void AggregateManager::generateAggregateMesh(const UUID& uuid, AggregateObjectPt
   AGG_LOG(detailed,"Setting up aggregate " << uuid << " to generate aggregate mesh with " << aggObject->mChildren.size() << " in " << delayFor);
   mAggregationStrand->post(
       delayFor,
-      std::tr1::bind(&AggregateManager::generateAggregateMeshAsyncIgnoreErrors, this, uuid, aggObject->mLastGenerateTime, true),
-      "AggregateManager::generateAggregateMeshAsyncIgnoreErrors"
+      std::tr1::bind(&AggregateManager::regenerateAggregateMesh, this, aggObject, aggObject->mLastGenerateTime),
+      "AggregateManager::regenerateAggregateMesh"
   );
 }
 
-void AggregateManager::generateAggregateMeshAsyncIgnoreErrors(const UUID uuid, Time postTime, bool generateSiblings) {
-	uint32 retval=generateAggregateMeshAsync(uuid, postTime, generateSiblings);
-	if (retval != GEN_SUCCESS) {
-          SILOG(aggregate,error,"generateAggregateMeshAsync returned false, but no error handling happening" << "\n");
-	}
+void AggregateManager::regenerateAggregateMesh(AggregateObjectPtr aggObject, Time postTime) {
+  // Already regenerated since this was requested
+  if (postTime < aggObject->mLastGenerateTime) return;
+
+  // This has to go through the job graph like any other generation, since a
+  // job for the same aggregate may be running or waiting on an upload. The
+  // graph runs it again after that one instead of both running at once.
+  addAggregateJob(aggObject);
+}
+
+void AggregateManager::addAggregateJob(AggregateObjectPtr aggObject) {
+  if (mJobGraph == NULL) return;
+
+  std::vector<UUID> children;
+  {
+    boost::mutex::scoped_lock lock(mAggregateObjectsMutex);
+    if (mAggregateObjects.find(aggObject->mUUID) == mAggregateObjects.end()) return;
+    for (uint32 i = 0; i < aggObject->mChildren.size(); i++)
+      children.push_back(aggObject->mChildren[i]->mUUID);
+  }
+
+  mJobGraph->add(
+      aggObject->mUUID, children,
+      aggObject->mNumObservers + (aggObject->mTreeLevel*0.001),
+      std::tr1::bind(&AggregateManager::runAggregateJob, this, aggObject->mUUID)
+  );
 }
 
 uint32 AggregateManager::generateAggregateMeshAsync(const UUID uuid, Time postTime, bool generateSiblings) {
@@ -330,9 +375,9 @@ uint32 AggregateManager::generateAggregateMeshAsync(const UUID uuid, Time postTi
   if (mAggregateObjects.find(uuid) == mAggregateObjects.end()) {
     AGG_LOG(info, uuid.toString() <<" : not found in aggregate objects map" << "\n");
 
-    /*Returning true here because this aggregate is no longer valid, so it should be
-      removed from the list of aggregates whose meshes are pending. */
-    return GEN_SUCCESS;
+    /*This aggregate is no longer valid, so it should be removed from the list
+      of aggregates whose meshes are pending. */
+    return GEN_NOT_FOUND;
   }
   std::tr1::shared_ptr<AggregateObject> aggObject = mAggregateObjects[uuid];
   lock.unlock();
@@ -370,6 +415,39 @@ uint32 AggregateManager::generateAggregateMeshAsync(const UUID uuid, Time postTi
     }
   }
 
+  /* Has a mesh already been generated from the same children, in the same
+     places? If so, just reuse it. */
+  AggregateMeshCache::KeyBuilder keyBuilder;
+  Vector3f aggCenter = mLoc->bounds(uuid).center();
+  for (uint32 i= 0; i < children.size(); i++) {
+    UUID child_uuid = children[i]->mUUID;
+    std::string meshName = mLoc->mesh(child_uuid);
+    if (meshName == "") continue;
+
+    keyBuilder.addChild(meshName, mLoc->currentPosition(child_uuid) - aggCenter,
+                        mLoc->currentOrientation(child_uuid), mLoc->bounds(child_uuid).radius());
+  }
+  keyBuilder.setSimplificationTarget(AGGREGATE_MESH_MAX_FACES);
+  String cacheKey = keyBuilder.key();
+
+  AggregateMeshCache::Entry cached;
+  if (mMeshCache->lookup(cacheKey, &cached)) {
+    AGG_LOG(detailed, "Reusing cached mesh " << cached.uri << " for " << uuid.toString());
+
+    aggObject->mLastGenerateTime = curTime;
+    aggObject->cacheKey = cacheKey;
+    aggObject->cdnBaseName = cached.cdnBaseName;
+    // We don't know when its TTL was last refreshed, so refresh it soon
+    if (!cached.cdnBaseName.empty())
+      aggObject->refreshTTL = mLoc->context()->recentSimTime();
+    aggObject->mLeaves.clear();
+
+    mLoc->updateLocalAggregateMesh(uuid, cached.uri);
+
+    finishAggregateJob(uuid);
+    return GEN_SUCCESS;
+  }
+
   /*Are the meshes of all the children available to generate the aggregate mesh? */
   bool allMeshesAvailable = true;
   for (uint32 i= 0; i < children.size(); i++) {
@@ -413,6 +491,7 @@ uint32 AggregateManager::generateAggregateMeshAsync(const UUID uuid, Time postTi
   }
 
   /* OK to generate the mesh! Go! */
+  mMeshCache->miss();
   aggObject->mLastGenerateTime = curTime;
   MeshdataPtr agg_mesh =  MeshdataPtr( new Meshdata() );
   agg_mesh->globalTransform = Matrix4x4f::identity();
@@ -683,15 +762,15 @@ uint32 AggregateManager::generateAggregateMeshAsync(const UUID uuid, Time postTi
   }
 
   //Simplify the mesh...
-  mMeshSimplifier.simplify(agg_mesh, 20000);
+  mMeshSimplifier.simplify(agg_mesh, AGGREGATE_MESH_MAX_FACES);
 
   //Set the mesh of this aggregate to the empty string until the new version gets uploaded. This is so that
   //higher level aggregates are not generated from the now out-of-date version of the mesh. 
   mLoc->updateLocalAggregateMesh(uuid, "");
 
   //... and now create the collada file, upload to the CDN and update LOC.
-  mUploadStrands[rand() % NUM_UPLOAD_THREADS]->post(
-          std::tr1::bind(&AggregateManager::uploadAggregateMesh, this, agg_mesh, aggObject, textureSet, 0),
+  mUploadService->post(
+          std::tr1::bind(&AggregateManager::uploadAggregateMesh, this, agg_mesh, aggObject, textureSet, cacheKey, 0),
           "AggregateManager::uploadAggregateMesh"
       );
 
@@ -702,6 +781,7 @@ uint32 AggregateManager::generateAggregateMeshAsync(const UUID uuid, Time postTi
 void AggregateManager::uploadAggregateMesh(Mesh::MeshdataPtr agg_mesh,
                                            AggregateObjectPtr aggObject,
                                            std::tr1::unordered_map<String, String> textureSet,
+                                           const String& cacheKey,
                                            uint32 retryAttempt)
 {
   const UUID& uuid = aggObject->mUUID;
@@ -824,11 +904,14 @@ void AggregateManager::uploadAggregateMesh(Mesh::MeshdataPtr agg_mesh,
           AGG_LOG(error, "Failure was retry attempt # " << retryAttempt);
           //Retry uploading up to 5 times.
           if (retryAttempt < 5) {
-            mUploadStrands[rand() % NUM_UPLOAD_THREADS]->post(
-             std::tr1::bind(&AggregateManager::uploadAggregateMesh, this, agg_mesh, aggObject, textureSet, retryAttempt + 1),
+            mUploadService->post(
+             std::tr1::bind(&AggregateManager::uploadAggregateMesh, this, agg_mesh, aggObject, textureSet, cacheKey, retryAttempt + 1),
              "AggregateManager::uploadAggregateMesh"
              );
           }
+          else {
+            finishAggregateJob(uuid);
+          }
 
           return;
       }
@@ -856,6 +939,16 @@ void AggregateManager::uploadAggregateMesh(Mesh::MeshdataPtr agg_mesh,
 
       //Update loc
       mLoc->updateLocalAggregateMesh(uuid, cdnMeshName);
+
+      //Remember it in case we end up with the same children again. Keep-alives
+      //refresh the expiration along with the TTL.
+      AggregateMeshCache::Entry entry;
+      entry.uri = cdnMeshName;
+      entry.cdnBaseName = aggObject->cdnBaseName;
+      entry.expires = Timer::now() + (mModelTTL*.75);
+      entry.size = files[localMeshName].size();
+      mMeshCache->insert(cacheKey, entry);
+      aggObject->cacheKey = cacheKey;
   }
   else {
       std::string cdnMeshName = "http://sns12.cs.princeton.edu:9080/aggregate_meshes/" + localMeshName;
@@ -864,12 +957,14 @@ void AggregateManager::uploadAggregateMesh(Mesh::MeshdataPtr agg_mesh,
       String modelFilename = std::string("/disk/local/tazim/aggregate_meshes/") + localMeshName;
       std::ofstream model_ostream(modelFilename.c_str(), std::ofstream::out | std::ofstream::binary);
       bool converted = mModelsSystem->convertVisual(agg_mesh, "colladamodels", model_ostream);
+      uint64 modelSize = model_ostream.tellp();
       model_ostream.close();
       if (!converted) {
           AGG_LOG(error, "Failed to save aggregate mesh " << localMeshName << ", it won't be displayed.");
           // Here the return value isn't success, it's "should I remove this
           // aggregate object from the queue for processing." Failure to save is
           // effectively fatal for the aggregate, so tell it to get removed.
+          finishAggregateJob(uuid);
           return;
       }
 
@@ -879,11 +974,20 @@ void AggregateManager::uploadAggregateMesh(Mesh::MeshdataPtr agg_mesh,
 
       //Update loc
       mLoc->updateLocalAggregateMesh(uuid, cdnMeshName);
+
+      //These never expire
+      AggregateMeshCache::Entry entry;
+      entry.uri = cdnMeshName;
+      entry.size = modelSize;
+      mMeshCache->insert(cacheKey, entry);
+      aggObject->cacheKey = cacheKey;
   }
 
   AGG_LOG(info, "Uploaded successfully: " << localMeshName << "\n");
 
   aggObject->mLeaves.clear();
+
+  finishAggregateJob(uuid);
 }
 
 void AggregateManager::handleUploadFinished(Transfer::UploadRequestPtr request, const Transfer::URI& path, AtomicValue<bool>* finished_out, Transfer::URI* generated_uri_out) {
@@ -1066,63 +1170,81 @@ void AggregateManager::generateMeshesFromQueue(Time postTime) {
       getLeaves(individualObjects);
     }
 
-    //Add objects to generation queue, ordered by priority.
+    //Add a generation job for each dirty aggregate. Each one waits for any
+    //outstanding jobs of its children, since it's built from their meshes.
+    //The round can't be reported finished until they've all been added.
+    boost::mutex::scoped_lock round_lock(mJobRoundMutex);
+    if (mJobGraph->size() == 0 && mDirtyAggregateObjects.size() > 0) {
+      mJobRoundStartTime = Timer::now();
+      mJobRoundStartCount = mJobGraph->finishedCount();
+    }
     for (std::tr1::unordered_map<UUID, AggregateObjectPtr, UUID::Hasher>::iterator it = mDirtyAggregateObjects.begin();
          it != mDirtyAggregateObjects.end(); it++)
     {
-      std::tr1::shared_ptr<AggregateObject> aggObject = it->second;
-      if (aggObject->mTreeLevel >= 0)
-        mObjectsByPriority[ aggObject->mNumObservers + (aggObject->mTreeLevel*0.001) ].push_back(aggObject);
+      addAggregateJob(it->second);
     }
 
+    mDirtyAggregateObjects.clear();
+}
 
-    //Generate the aggregates from the priority queue.
-    Time curTime = (mObjectsByPriority.size() > 0) ? Timer::now() : Time::null();
-    uint32 returner = GEN_SUCCESS;
-    uint32 numFailedAttempts = 1;
-    bool noObjectsToGenerate = true;
-    for (std::map<float, std::deque<AggregateObjectPtr> >::reverse_iterator it =  mObjectsByPriority.rbegin();
-         it != mObjectsByPriority.rend(); it++)
-    {
-      if (it->second.size() > 0) {
-        noObjectsToGenerate = false;
-        std::tr1::shared_ptr<AggregateObject> aggObject = it->second.front();
+void AggregateManager::runAggregateJob(const UUID uuid) {
+    uint32 returner = generateAggregateMeshAsync(uuid, Timer::now(), false);
 
-        if (aggObject->generatedLastRound) continue;
+    // Successful jobs finish once their upload does
+    if (returner == GEN_SUCCESS) return;
 
-        returner=generateAggregateMeshAsync(aggObject->mUUID, curTime, false);
+    if (returner == GEN_NOT_FOUND) {
+      finishAggregateJob(uuid);
+      return;
+    }
 
-        if (returner==GEN_SUCCESS || aggObject->mNumFailedGenerationAttempts > 25) {
-          it->second.pop_front();
-	  if (returner != GEN_SUCCESS) {
-            AGG_LOG(error, "Could not generate aggregate mesh for " <<
-	                   aggObject->mTreeLevel << "_" << aggObject->mUUID.toString() << "\n");
-          }
+    boost::mutex::scoped_lock lock(mAggregateObjectsMutex);
+    AggregateObjectsMap::iterator it = mAggregateObjects.find(uuid);
+    if (it == mAggregateObjects.end()) {
+      lock.unlock();
+      finishAggregateJob(uuid);
+      return;
+    }
+    AggregateObjectPtr aggObject = it->second;
+
+    if (aggObject->mNumFailedGenerationAttempts > 25) {
+      AGG_LOG(error, "Could not generate aggregate mesh for " <<
+                     aggObject->mTreeLevel << "_" << aggObject->mUUID.toString() << "\n");
+      aggObject->mNumFailedGenerationAttempts = 0;
+      lock.unlock();
+      finishAggregateJob(uuid);
+      return;
+    }
 
-          aggObject->mNumFailedGenerationAttempts = 0;
-        }
-        else if (returner == OTHER_GEN_FAILURE) {
-          aggObject->mNumFailedGenerationAttempts++;
-          numFailedAttempts = aggObject->mNumFailedGenerationAttempts;
-        }
+    // Not ready yet, e.g. waiting for downloads, so try again later
+    if (returner == OTHER_GEN_FAILURE)
+      aggObject->mNumFailedGenerationAttempts++;
+    uint32 numFailedAttempts = std::max(aggObject->mNumFailedGenerationAttempts, (uint32)1);
+    lock.unlock();
 
-        break;
-      }
-    }
+    mJobGraph->retry(uuid, Duration::milliseconds(10.0*pow(2.f,(float)numFailedAttempts)));
+}
 
-    mDirtyAggregateObjects.clear();
+void AggregateManager::finishAggregateJob(const UUID& uuid) {
+    if (mJobGraph == NULL) return;
 
-    if (noObjectsToGenerate) {
-      mObjectsByPriority.clear();
+    {
+      boost::mutex::scoped_lock lock(mAggregateObjectsMutex);
+      AggregateObjectsMap::iterator it = mAggregateObjects.find(uuid);
+      if (it != mAggregateObjects.end())
+        it->second->mNumFailedGenerationAttempts = 0;
     }
 
-    if (mObjectsByPriority.size() > 0) {
-      Duration dur = (returner == GEN_SUCCESS) ? Duration::milliseconds(1.0) : Duration::milliseconds(10.0*pow(2.f,(float)numFailedAttempts)) ;
-      mAggregationStrand->post(
-          dur,
-          std::tr1::bind(&AggregateManager::generateMeshesFromQueue, this, curTime),
-          "AggregateManager::generateMeshesFromQueue"
-      );
+    // Runs on the job threads, so the round bookkeeping needs the lock
+    boost::mutex::scoped_lock round_lock(mJobRoundMutex);
+    mJobGraph->finish(uuid);
+
+    if (mJobGraph->size() == 0 && mJobRoundStartTime != Time::null()) {
+      Duration elapsed = Timer::now() - mJobRoundStartTime;
+      uint64 generated = mJobGraph->finishedCount() - mJobRoundStartCount;
+      AGG_LOG(info, "Generated " << generated << " aggregates in " << elapsed <<
+                    " (" << (elapsed.seconds() > 0 ? generated / elapsed.seconds() : 0) << " aggregates/sec)");
+      mJobRoundStartTime = Time::null();
     }
 }
 
@@ -1315,6 +1437,21 @@ void AggregateManager::handleKeepAliveResponse(const UUID& objid,
     AggregateObjectsMap::iterator it = mAggregateObjects.find(objid);
     if (it == mAggregateObjects.end()) return;
     it->second->refreshTTL = mLoc->context()->recentSimTime() + (mModelTTL*.75);
+    if (!it->second->cacheKey.empty())
+        mMeshCache->refresh(it->second->cacheKey, Timer::now() + (mModelTTL*.75));
+}
+
+void AggregateManager::commandCacheStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
+    Command::Result result = Command::EmptyResult();
+    uint64 hits = mMeshCache->hits();
+    uint64 misses = mMeshCache->misses();
+    result.put("cache.hits", hits);
+    result.put("cache.misses", misses);
+    result.put("cache.hit_rate", (hits + misses) > 0 ? (float64)hits / (hits + misses) : 0.0);
+    result.put("cache.entries", mMeshCache->numEntries());
+    result.put("cache.size", mMeshCache->size());
+    result.put("cache.capacity", mMeshCache->capacity());
+    cmdr->result(cmdid, result);
 }
 
 
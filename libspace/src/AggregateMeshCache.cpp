@@ -0,0 +1,279 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/space/AggregateMeshCache.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <cstdio>
+
+// Quantization of the values that go into keys. Offsets are relative to the
+// center of the aggregate.
+#define OFFSET_QUANTUM 0.01f
+#define ORIENTATION_QUANTUM 0.001f
+#define RADIUS_QUANTUM 0.01f
+
+// The log is compacted once it holds more than this many records beyond twice
+// the number of entries.
+#define LOG_SLACK_RECORDS 1024
+
+#define CACHE_LOG(lvl, msg) SILOG(aggregate-manager, lvl, msg)
+
+namespace Sirikata {
+
+AggregateMeshCache::KeyBuilder::KeyBuilder()
+ : mChildren(0)
+{
+}
+
+void AggregateMeshCache::KeyBuilder::addQuantized(float32 val, float32 quantum) {
+    int64 quantized = (int64)floor(val / quantum + 0.5f);
+    mContext.update(&quantized, sizeof(quantized));
+}
+
+void AggregateMeshCache::KeyBuilder::addChild(const String& mesh, const Vector3f& offset, const Quaternion& orient, float32 radius) {
+    // Include the length so adjacent names can't run together
+    uint32 len = mesh.size();
+    mContext.update(&len, sizeof(len));
+    mContext.update(mesh);
+
+    addQuantized(offset.x, OFFSET_QUANTUM);
+    addQuantized(offset.y, OFFSET_QUANTUM);
+    addQuantized(offset.z, OFFSET_QUANTUM);
+
+    // q and -q are the same rotation
+    Quaternion q = orient.normal();
+    if (q.w < 0) q = q * -1.f;
+    addQuantized(q.x, ORIENTATION_QUANTUM);
+    addQuantized(q.y, ORIENTATION_QUANTUM);
+    addQuantized(q.z, ORIENTATION_QUANTUM);
+    addQuantized(q.w, ORIENTATION_QUANTUM);
+
+    addQuantized(radius, RADIUS_QUANTUM);
+
+    mChildren++;
+}
+
+void AggregateMeshCache::KeyBuilder::setSimplificationTarget(uint32 nfaces) {
+    mContext.update(&nfaces, sizeof(nfaces));
+}
+
+String AggregateMeshCache::KeyBuilder::key() {
+    mContext.update(&mChildren, sizeof(mChildren));
+    return mContext.get().convertToHexString();
+}
+
+
+
+AggregateMeshCache::AggregateMeshCache(const String& path, uint64 capacity)
+ : mPath(path),
+   mCapacity(capacity),
+   mSize(0),
+   mHits(0),
+   mMisses(0),
+   mLogRecords(0)
+{
+    if (mPath.empty()) return;
+
+    boost::mutex::scoped_lock lock(mMutex);
+    replay();
+    // Always start with a fresh log, dropping anything that expired or was
+    // evicted while replaying.
+    compact();
+}
+
+AggregateMeshCache::~AggregateMeshCache() {
+    if (mLog.is_open())
+        mLog.close();
+}
+
+bool AggregateMeshCache::lookup(const String& key, Entry* entry) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    EntryMap::iterator it = mEntries.find(key);
+    if (it == mEntries.end()) return false;
+
+    if (it->second.entry.expires != Time::null() &&
+        it->second.entry.expires < Timer::now()) {
+        eraseEntry(it);
+        appendRemove(key);
+        return false;
+    }
+
+    mLRU.splice(mLRU.begin(), mLRU, it->second.lruIt);
+    *entry = it->second.entry;
+    mHits++;
+    return true;
+}
+
+void AggregateMeshCache::miss() {
+    boost::mutex::scoped_lock lock(mMutex);
+    mMisses++;
+}
+
+void AggregateMeshCache::insert(const String& key, const Entry& entry) {
+    boost::mutex::scoped_lock lock(mMutex);
+    insertEntry(key, entry);
+    appendInsert(key, entry);
+    evict();
+}
+
+void AggregateMeshCache::refresh(const String& key, const Time& expires) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    EntryMap::iterator it = mEntries.find(key);
+    if (it == mEntries.end()) return;
+    it->second.entry.expires = expires;
+    appendInsert(key, it->second.entry);
+}
+
+void AggregateMeshCache::remove(const String& key) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    EntryMap::iterator it = mEntries.find(key);
+    if (it == mEntries.end()) return;
+    eraseEntry(it);
+    appendRemove(key);
+}
+
+uint64 AggregateMeshCache::hits() const {
+    boost::mutex::scoped_lock lock(mMutex);
+    return mHits;
+}
+
+uint64 AggregateMeshCache::misses() const {
+    boost::mutex::scoped_lock lock(mMutex);
+    return mMisses;
+}
+
+uint32 AggregateMeshCache::numEntries() const {
+    boost::mutex::scoped_lock lock(mMutex);
+    return mEntries.size();
+}
+
+uint64 AggregateMeshCache::size() const {
+    boost::mutex::scoped_lock lock(mMutex);
+    return mSize;
+}
+
+void AggregateMeshCache::insertEntry(const String& key, const Entry& entry) {
+    EntryMap::iterator it = mEntries.find(key);
+    if (it != mEntries.end()) {
+        mSize -= it->second.entry.size;
+        it->second.entry = entry;
+        mLRU.splice(mLRU.begin(), mLRU, it->second.lruIt);
+    }
+    else {
+        mLRU.push_front(key);
+        CacheEntry& cache_entry = mEntries[key];
+        cache_entry.entry = entry;
+        cache_entry.lruIt = mLRU.begin();
+    }
+    mSize += entry.size;
+}
+
+void AggregateMeshCache::eraseEntry(EntryMap::iterator it) {
+    mSize -= it->second.entry.size;
+    mLRU.erase(it->second.lruIt);
+    mEntries.erase(it);
+}
+
+void AggregateMeshCache::evict() {
+    // Always keep the most recent entry, even if it is larger than the cache
+    while(mSize > mCapacity && mLRU.size() > 1) {
+        String key = mLRU.back();
+        eraseEntry(mEntries.find(key));
+        appendRemove(key);
+    }
+}
+
+void AggregateMeshCache::replay() {
+    std::ifstream log(mPath.c_str());
+    if (!log) return;
+
+    Time tnow = Timer::now();
+    String line;
+    while(std::getline(log, line)) {
+        std::istringstream record(line);
+        String type, key;
+        if (!(record >> type >> key)) continue;
+
+        if (type == "-") {
+            EntryMap::iterator it = mEntries.find(key);
+            if (it != mEntries.end()) eraseEntry(it);
+        }
+        else if (type == "+") {
+            Entry entry;
+            int64 expires;
+            if (!(record >> entry.uri >> entry.cdnBaseName >> expires >> entry.size)) {
+                // Most likely a write cut short by a crash
+                CACHE_LOG(warn, "Ignoring invalid record in aggregate mesh cache " << mPath);
+                continue;
+            }
+            if (entry.cdnBaseName == "-") entry.cdnBaseName = "";
+            if (expires != 0)
+                entry.expires = Time::null() + Duration::microseconds(expires);
+            insertEntry(key, entry);
+        }
+    }
+
+    // Drop expired entries, then anything over capacity
+    for(EntryMap::iterator it = mEntries.begin(); it != mEntries.end(); ) {
+        EntryMap::iterator cur = it++;
+        if (cur->second.entry.expires != Time::null() && cur->second.entry.expires < tnow)
+            eraseEntry(cur);
+    }
+    while(mSize > mCapacity && !mLRU.empty())
+        eraseEntry(mEntries.find(mLRU.back()));
+
+    CACHE_LOG(info, "Loaded " << mEntries.size() << " aggregate meshes from " << mPath);
+}
+
+void AggregateMeshCache::compact() {
+    if (mLog.is_open())
+        mLog.close();
+
+    String tmp_path = mPath + ".tmp";
+    mLog.open(tmp_path.c_str(), std::ios::out | std::ios::trunc);
+    if (!mLog) {
+        CACHE_LOG(error, "Couldn't write aggregate mesh cache " << tmp_path << ", it won't be saved");
+        return;
+    }
+    mLogRecords = 0;
+    // Oldest first, so replaying reproduces the LRU order
+    for(LRUList::reverse_iterator it = mLRU.rbegin(); it != mLRU.rend(); it++)
+        appendInsert(*it, mEntries[*it].entry);
+    mLog.close();
+
+    if (std::rename(tmp_path.c_str(), mPath.c_str()) != 0) {
+        CACHE_LOG(error, "Couldn't replace aggregate mesh cache " << mPath << ", it won't be saved");
+        return;
+    }
+    mLog.open(mPath.c_str(), std::ios::out | std::ios::app);
+}
+
+void AggregateMeshCache::appendInsert(const String& key, const Entry& entry) {
+    std::ostringstream record;
+    record << "+ " << key << " " << entry.uri << " " <<
+        (entry.cdnBaseName.empty() ? String("-") : entry.cdnBaseName) << " " <<
+        (entry.expires == Time::null() ? 0 : (entry.expires - Time::null()).toMicro()) << " " <<
+        entry.size;
+    appendRecord(record.str());
+}
+
+void AggregateMeshCache::appendRemove(const String& key) {
+    appendRecord("- " + key);
+}
+
+void AggregateMeshCache::appendRecord(const String& record) {
+    if (!mLog.is_open()) return;
+
+    mLog << record << std::endl;
+    mLogRecords++;
+
+    // Overwritten and removed entries are never cleaned out of the log, so
+    // rewrite it once it gets too far out of date
+    if (mLogRecords > 2*mEntries.size() + LOG_SLACK_RECORDS)
+        compact();
+}
+
+} // namespace Sirikata
@@ -0,0 +1,339 @@
+/*  Sirikata
+ *  OSegLookupQueue.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sirikata/space/OSegLookupQueue.hpp>
+#include <sirikata/space/ObjectSegmentation.hpp>
+#include <sirikata/core/network/IOStrandImpl.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+//FIXME: hardcoded here
+#define MAX_OSEG_PUSHBACK_PARAMETER 3
+
+// Stale entries allowed in the queued message order beyond twice the number
+// of queued messages before it gets cleaned out
+#define QUEUED_ORDER_SLACK 1024
+
+namespace Sirikata {
+
+// OSegLookupList Implementation
+
+OSegLookupQueue::OSegLookupList::OSegLookupList()
+ : mTotalSize(0),
+   mStarted(Time::null())
+{
+}
+
+size_t OSegLookupQueue::OSegLookupList::ByteSize() const{
+    return mTotalSize;
+}
+
+size_t OSegLookupQueue::OSegLookupList::size()const {
+    return OSegLookupDeque::size();
+}
+
+bool OSegLookupQueue::OSegLookupList::empty()const {
+    return OSegLookupDeque::empty();
+}
+
+OSegLookupQueue::OSegLookup& OSegLookupQueue::OSegLookupList::operator[](size_t where) {
+    return OSegLookupDeque::operator[](where);
+}
+
+OSegLookupQueue::OSegLookup& OSegLookupQueue::OSegLookupList::front() {
+    return OSegLookupDeque::front();
+}
+
+void OSegLookupQueue::OSegLookupList::push_back(const OSegLookup& lu) {
+    mTotalSize += lu.size;
+    OSegLookupDeque::push_back(lu);
+}
+
+void OSegLookupQueue::OSegLookupList::pop_front() {
+    mTotalSize -= OSegLookupDeque::front().size;
+    OSegLookupDeque::pop_front();
+}
+
+OSegLookupQueue::OSegLookupList::iterator OSegLookupQueue::OSegLookupList::begin(){
+    return OSegLookupDeque::begin();
+}
+
+OSegLookupQueue::OSegLookupList::iterator OSegLookupQueue::OSegLookupList::end(){
+    return OSegLookupDeque::end();
+}
+
+const Time& OSegLookupQueue::OSegLookupList::started() const {
+    return mStarted;
+}
+
+void OSegLookupQueue::OSegLookupList::setStarted(const Time& t) {
+    mStarted = t;
+}
+
+
+// OSegLookupQueue Implementation
+
+
+OSegLookupQueue::OSegLookupQueue(SpaceContext* ctx, Network::IOStrand* net_strand, OSegLookupProvider* oseg,
+    uint32 max_lookups, size_t max_size, uint32 batch_size)
+ : mContext(ctx),
+   mNetworkStrand(net_strand),
+   mOSeg(oseg),
+   mTotalSize(0),
+   mMaxLookups(max_lookups),
+   mMaxSize(max_size),
+   mBatchSize(batch_size),
+   mNextSeqno(0),
+   mNumQueued(0),
+   mBatchFlushPosted(false),
+   mLookupsIssued(0),
+   mRequestsIssued(0),
+   mMessagesDropped(0)
+{
+    mOSeg->setLookupListener(this);
+
+    if (mContext != NULL && mContext->commander()) {
+        // Get the state of the queue and lookup latencies
+        mContext->commander()->registerCommand(
+            "space.oseg.lookups",
+            mNetworkStrand->wrap(
+                std::tr1::bind(&OSegLookupQueue::commandStats, this, _1, _2, _3)
+            )
+        );
+    }
+}
+
+OSegLookupQueue::~OSegLookupQueue() {
+    if (mContext != NULL && mContext->commander())
+        mContext->commander()->unregisterCommand("space.oseg.lookups");
+}
+
+OSegEntry OSegLookupQueue::cacheLookup(const UUID& destid) const {
+    //if get a cache hit from oseg, do not return;
+    return mOSeg->cacheLookup(destid);
+}
+
+bool OSegLookupQueue::lookup(Sirikata::Protocol::Object::ObjectMessage* msg, const LookupCallback& cb)
+{
+  UUID dest_obj = msg->dest_object();
+  size_t cursize = msg->ByteSize();
+
+  //if already looking up, do not call lookup on mOSeg;
+  LookupMap::const_iterator it = mLookups.find(dest_obj);
+  if (it != mLookups.end())
+  {
+    //we are already looking up the object.  Just add it to mLookups
+    enqueue(dest_obj, msg, cb, cursize);
+    return true;
+  }
+
+  //if get a cache hit from oseg, do not return;
+  OSegEntry destServer= mOSeg->cacheLookup(dest_obj);
+  if (destServer.notNull())
+  {
+    cb(msg, destServer, ResolvedFromCache);
+    return true;
+  }
+
+  //if did not get a cache hit, check if have enough room to add it;
+  if (mLookups.size() > mMaxLookups)
+    return false;
+
+  if (mOSeg->getPushback() > MAX_OSEG_PUSHBACK_PARAMETER)
+      return false;
+
+  // When batching, just queue it up and issue the lookup along with any others
+  // that arrive before the strand is free
+  if (mBatchSize > 0) {
+      mLookups[dest_obj].setStarted(Timer::now());
+      enqueue(dest_obj, msg, cb, cursize);
+      mBatch.push_back(dest_obj);
+      if (mBatch.size() >= mBatchSize) {
+          flushBatch();
+      }
+      else if (!mBatchFlushPosted) {
+          mBatchFlushPosted = true;
+          mNetworkStrand->post(
+              std::tr1::bind(&OSegLookupQueue::handleFlushBatch, this),
+              "OSegLookupQueue::handleFlushBatch"
+          );
+      }
+      return true;
+  }
+
+  //  otherwise, do full oseg lookup;
+  Time started = Timer::now();
+  destServer = mOSeg->lookup(dest_obj);
+  mLookupsIssued++;
+  mRequestsIssued++;
+  // If we already have a server, handle the callback right away
+  if (destServer.notNull()) {
+    cb(msg, destServer, ResolvedFromCache);
+    return true;
+  }
+
+  // And if we do, stick it on a list and wait
+  mLookups[dest_obj].setStarted(started);
+  enqueue(dest_obj, msg, cb, cursize);
+  return true;
+}
+
+void OSegLookupQueue::enqueue(const UUID& id, Sirikata::Protocol::Object::ObjectMessage* msg, const LookupCallback& cb, uint32 size) {
+    OSegLookup lu;
+    lu.msg = msg;
+    lu.cb = cb;
+    lu.size = size;
+    lu.seqno = mNextSeqno++;
+    mLookups[id].push_back(lu);
+    mTotalSize += size;
+    mNumQueued++;
+
+    if (mMaxSize == 0) return;
+
+    mQueuedOrder.push_back(QueuedMessage(lu.seqno, id));
+    shed();
+
+    if (mQueuedOrder.size() > 2*mNumQueued + QUEUED_ORDER_SLACK) {
+        QueuedMessageList live;
+        for(QueuedMessageList::iterator qit = mQueuedOrder.begin(); qit != mQueuedOrder.end(); qit++) {
+            if (stillQueued(*qit))
+                live.push_back(*qit);
+        }
+        mQueuedOrder.swap(live);
+    }
+}
+
+bool OSegLookupQueue::stillQueued(const QueuedMessage& qm) {
+    // Messages for an object are delivered all at once, or shed from the
+    // front, so anything older than the front of the object's list is gone.
+    LookupMap::iterator it = mLookups.find(qm.id);
+    return (it != mLookups.end() && !it->second.empty() && it->second.front().seqno <= qm.seqno);
+}
+
+void OSegLookupQueue::shed() {
+    while(mTotalSize > mMaxSize && !mQueuedOrder.empty()) {
+        QueuedMessage qm = mQueuedOrder.front();
+        mQueuedOrder.pop_front();
+        if (!stillQueued(qm)) continue;
+
+        // The lookup itself stays outstanding, even if it has no messages
+        // left, so later messages for the object still coalesce onto it.
+        OSegLookupList& lookups = mLookups[qm.id];
+        assert(lookups.front().seqno == qm.seqno);
+        OSegLookup lu = lookups.front();
+        lookups.pop_front();
+        mTotalSize -= lu.size;
+        mNumQueued--;
+        mMessagesDropped++;
+        lu.cb(lu.msg, OSegEntry::null(), Dropped);
+    }
+}
+
+void OSegLookupQueue::handleFlushBatch() {
+    mBatchFlushPosted = false;
+    flushBatch();
+}
+
+void OSegLookupQueue::flushBatch() {
+    if (mBatch.empty()) return;
+
+    std::vector<UUID> batch;
+    batch.swap(mBatch);
+    std::vector<OSegEntry> results;
+    mOSeg->lookupBatch(batch, &results);
+    mLookupsIssued += batch.size();
+    mRequestsIssued++;
+
+    // Handle any that could be resolved immediately
+    for(uint32 i = 0; i < batch.size(); i++) {
+        if (results[i].notNull())
+            handleLookupCompleted(batch[i], results[i], ResolvedFromCache);
+    }
+}
+
+void OSegLookupQueue::osegLookupCompleted(const UUID& id, const OSegEntry& dest) {
+    mNetworkStrand->post(
+        std::tr1::bind(&OSegLookupQueue::handleLookupCompleted, this, id, dest, ResolvedFromServer),
+        "OSegLookupQueue::handleLookupCompleted"
+    );
+}
+
+void OSegLookupQueue::handleLookupCompleted(const UUID& id, const OSegEntry& dest, ResolvedFrom resolved_from) {
+    //Now sending messages that we had saved up from oseg lookup calls.
+    LookupMap::iterator iterQueueMap = mLookups.find(id);
+    if (iterQueueMap == mLookups.end())
+        return;
+
+    if (iterQueueMap->second.started() != Time::null())
+        mLatencies.add(Timer::now() - iterQueueMap->second.started());
+
+    // Remove it first so callbacks can safely start new lookups
+    OSegLookupList lookups = iterQueueMap->second;
+    mLookups.erase(iterQueueMap);
+
+    for (OSegLookupList::iterator it = lookups.begin(); it != lookups.end(); it++) {
+        mTotalSize -= it->size;
+        mNumQueued--;
+        it->cb(it->msg, dest, resolved_from);
+    }
+}
+
+void OSegLookupQueue::commandStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
+    Command::Result result = Command::EmptyResult();
+    result.put("lookups.outstanding", mLookups.size());
+    result.put("lookups.issued", mLookupsIssued);
+    result.put("lookups.requests", mRequestsIssued);
+    result.put("messages.queued", mNumQueued);
+    result.put("messages.queued_bytes", mTotalSize);
+    result.put("messages.dropped", mMessagesDropped);
+
+    result.put("latency.count", mLatencies.count());
+    result.put("latency.mean", mLatencies.mean().toMicro());
+    result.put("latency.p50", mLatencies.percentile(.5).toMicro());
+    result.put("latency.p90", mLatencies.percentile(.9).toMicro());
+    result.put("latency.p99", mLatencies.percentile(.99).toMicro());
+    result.put("latency.max", mLatencies.max().toMicro());
+    // Non-empty buckets, each with the smallest latency it counts in
+    // microseconds
+    result.put("latency.histogram", Command::Array());
+    Command::Array& buckets = result.getArray("latency.histogram");
+    for(uint32 i = 0; i < Trace::LatencyHistogram::NUM_BUCKETS; i++) {
+        if (mLatencies.bucket(i) == 0) continue;
+        buckets.push_back(Command::Object());
+        Command::Result& bucket = buckets.back();
+        bucket.put("min", Trace::LatencyHistogram::bucketLower(i));
+        bucket.put("count", mLatencies.bucket(i));
+    }
+
+    cmdr->result(cmdid, result);
+}
+
+} // namespace Sirikata
@@ -147,7 +147,7 @@ bool ObjectHostConnectionManager::sendHelper(ObjectHostConnection* conn, Sirikat
 
     if (sent) {
         TIMESTAMP(msg, Trace::SPACE_TO_OH_ENQUEUED);
-        delete msg;
+        releaseObjectMessage(msg);
     }
     return sent;
 }
@@ -258,12 +258,12 @@ void ObjectHostConnectionManager::handleConnectionEvent(ObjectHostConnection* co
 void ObjectHostConnectionManager::handleConnectionRead(ObjectHostConnection* conn, Sirikata::Network::Chunk& chunk, const Sirikata::Network::Stream::PauseReceiveCallback& pause) {
     SPACE_LOG(insane, "Handling connection read: " << chunk.size() << " bytes");
 
-    Sirikata::Protocol::Object::ObjectMessage* obj_msg = new Sirikata::Protocol::Object::ObjectMessage();
+    Sirikata::Protocol::Object::ObjectMessage* obj_msg = allocateObjectMessage();
     bool parse_success = obj_msg->ParseFromArray(&(*chunk.begin()),chunk.size());
 
     if (!parse_success) {
         LOG_INVALID_MESSAGE(space, error, chunk);
-        delete obj_msg;
+        releaseObjectMessage(obj_msg);
         return; // Ignore, treat as dropped. Hopefully this doesn't cascade...
     }
 
@@ -45,10 +45,15 @@ void OSegFactory::destroy() {
     AutoSingleton<OSegFactory>::destroy();
 }
 
+void OSegLookupProvider::lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results) {
+    results->resize(obj_ids.size());
+    for(uint32 i = 0; i < obj_ids.size(); i++)
+        (*results)[i] = lookup(obj_ids[i]);
+}
+
 ObjectSegmentation::ObjectSegmentation(SpaceContext* ctx, Network::IOStrand* o_strand)
  : mContext(ctx),
    mStopping(false),
-   mLookupListener(NULL),
    mWriteListener(NULL),
    oStrand(o_strand),
    mMigAckMessages( ctx->mainStrand->wrap(std::tr1::bind(&ObjectSegmentation::handleNewMigAckMessages, this)) ),
@@ -0,0 +1,231 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/space/ServerRegionIndex.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace Sirikata {
+
+struct ServerRegionIndex::CenterLess {
+    CenterLess(int ax) : axis(ax) {}
+    bool operator()(const Entry& lhs, const Entry& rhs) const {
+        return (lhs.region.min()[axis] + lhs.region.max()[axis]) < (rhs.region.min()[axis] + rhs.region.max()[axis]);
+    }
+    int axis;
+};
+
+ServerRegionIndex::ServerRegionIndex()
+ : mNextOrder(0)
+{
+}
+
+bool ServerRegionIndex::insert(const BoundingBox3f& region, ServerID server) {
+    const Entry* existing = find(region.center());
+    if (existing != NULL && existing->region == region && existing->server == server)
+        return false;
+
+    Entry entry;
+    entry.region = region;
+    entry.server = server;
+    entry.order = mNextOrder++;
+    mTail.push_back(entry);
+
+    uint32 max_tail = std::max(MinTailSize, (uint32)std::sqrt((float64)size()));
+    if (mTail.size() > max_tail)
+        rebuild();
+    return true;
+}
+
+void ServerRegionIndex::clear() {
+    mIndexed.clear();
+    mNodes.clear();
+    mTail.clear();
+    mNextOrder = 0;
+}
+
+uint32 ServerRegionIndex::size() const {
+    return mIndexed.size() + mTail.size();
+}
+
+ServerID ServerRegionIndex::lookup(const Vector3f& pos) const {
+    const Entry* entry = find(pos);
+    return (entry != NULL) ? entry->server : NullServerID;
+}
+
+const ServerRegionIndex::Entry* ServerRegionIndex::find(const Vector3f& pos) const {
+    const Entry* best = NULL;
+
+    if (!mNodes.empty()) {
+        uint32 stack[64];
+        uint32 depth = 0;
+        stack[depth++] = 0;
+        while(depth > 0) {
+            const Node& node = mNodes[stack[--depth]];
+            if (!node.bounds.contains(pos))
+                continue;
+
+            if (node.count > 0) {
+                for(uint32 i = node.first; i < node.first + node.count; i++) {
+                    const Entry& entry = mIndexed[i];
+                    if ((best == NULL || entry.order < best->order) && entry.region.contains(pos))
+                        best = &entry;
+                }
+            }
+            else {
+                stack[depth++] = node.secondChild;
+                stack[depth++] = (&node - &mNodes[0]) + 1;
+            }
+        }
+    }
+
+    // The tail is always newer than the indexed entries, so only look at it
+    // if nothing matched.
+    if (best == NULL) {
+        for(uint32 i = 0; i < mTail.size(); i++) {
+            if (mTail[i].region.contains(pos))
+                return &mTail[i];
+        }
+    }
+    return best;
+}
+
+void ServerRegionIndex::intersect(const Entry& entry, const BoundingBox3f& bbox, std::vector<BoundingBox3f>* pieces, std::vector<ServerID>* servers) const {
+    if (!entry.region.intersects(bbox))
+        return;
+
+    Vector3f lo, hi;
+    for(int i = 0; i < 3; i++) {
+        lo[i] = std::max(entry.region.min()[i], bbox.min()[i]);
+        hi[i] = std::min(entry.region.max()[i], bbox.max()[i]);
+    }
+    BoundingBox3f piece(lo, hi);
+    // Regions which only touch bbox don't contribute to covering it
+    if (!piece.degenerate())
+        pieces->push_back(piece);
+
+    if (std::find(servers->begin(), servers->end(), entry.server) == servers->end())
+        servers->push_back(entry.server);
+}
+
+bool ServerRegionIndex::coversExactly(const BoundingBox3f& bbox, const std::vector<BoundingBox3f>& pieces) {
+    // Split bbox into a grid along every piece's boundaries. Each cell is then
+    // either entirely inside or entirely outside each piece, so checking the
+    // cell centers checks the whole box.
+    std::vector<float32> cuts[3];
+    for(int axis = 0; axis < 3; axis++) {
+        cuts[axis].push_back(bbox.min()[axis]);
+        cuts[axis].push_back(bbox.max()[axis]);
+        for(uint32 i = 0; i < pieces.size(); i++) {
+            cuts[axis].push_back(pieces[i].min()[axis]);
+            cuts[axis].push_back(pieces[i].max()[axis]);
+        }
+        std::sort(cuts[axis].begin(), cuts[axis].end());
+        cuts[axis].erase(std::unique(cuts[axis].begin(), cuts[axis].end()), cuts[axis].end());
+    }
+
+    for(uint32 x = 0; x + 1 < cuts[0].size(); x++) {
+        for(uint32 y = 0; y + 1 < cuts[1].size(); y++) {
+            for(uint32 z = 0; z + 1 < cuts[2].size(); z++) {
+                Vector3f center(
+                    (cuts[0][x] + cuts[0][x+1]) * 0.5f,
+                    (cuts[1][y] + cuts[1][y+1]) * 0.5f,
+                    (cuts[2][z] + cuts[2][z+1]) * 0.5f
+                );
+                uint32 covering = 0;
+                for(uint32 i = 0; i < pieces.size(); i++) {
+                    if (pieces[i].contains(center, 0))
+                        covering++;
+                }
+                if (covering != 1)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool ServerRegionIndex::lookupBoundingBox(const BoundingBox3f& bbox, std::vector<ServerID>* servers) const {
+    // Degenerate boxes can't be checked for coverage by volume
+    if (bbox.degenerate())
+        return false;
+
+    std::vector<BoundingBox3f> pieces;
+
+    if (!mNodes.empty()) {
+        uint32 stack[64];
+        uint32 depth = 0;
+        stack[depth++] = 0;
+        while(depth > 0) {
+            const Node& node = mNodes[stack[--depth]];
+            if (!node.bounds.intersects(bbox))
+                continue;
+
+            if (node.count > 0) {
+                for(uint32 i = node.first; i < node.first + node.count; i++)
+                    intersect(mIndexed[i], bbox, &pieces, servers);
+            }
+            else {
+                stack[depth++] = node.secondChild;
+                stack[depth++] = (&node - &mNodes[0]) + 1;
+            }
+        }
+    }
+    for(uint32 i = 0; i < mTail.size(); i++)
+        intersect(mTail[i], bbox, &pieces, servers);
+
+    if (pieces.size() > MaxCoverageRegions)
+        return false;
+    return coversExactly(bbox, pieces);
+}
+
+void ServerRegionIndex::rebuild() {
+    mIndexed.insert(mIndexed.end(), mTail.begin(), mTail.end());
+    mTail.clear();
+
+    mNodes.clear();
+    mNodes.reserve(2 * (mIndexed.size() / LeafSize + 1));
+    if (!mIndexed.empty())
+        build(0, mIndexed.size());
+}
+
+uint32 ServerRegionIndex::build(uint32 begin, uint32 end) {
+    uint32 idx = mNodes.size();
+    mNodes.push_back(Node());
+
+    BoundingBox3f bounds = mIndexed[begin].region;
+    BoundingBox3f centers(mIndexed[begin].region.center(), 0);
+    for(uint32 i = begin + 1; i < end; i++) {
+        bounds.mergeIn(mIndexed[i].region);
+        centers.mergeIn(mIndexed[i].region.center());
+    }
+    mNodes[idx].bounds = bounds;
+
+    if (end - begin <= LeafSize) {
+        mNodes[idx].first = begin;
+        mNodes[idx].count = end - begin;
+        mNodes[idx].secondChild = 0;
+        return idx;
+    }
+
+    // Split at the median along the axis the centers are most spread out on.
+    // Median splits keep the tree balanced, so its depth is logarithmic no
+    // matter how the regions are distributed.
+    int axis = 0;
+    Vector3f extents = centers.across();
+    if (extents.y > extents[axis]) axis = 1;
+    if (extents.z > extents[axis]) axis = 2;
+
+    uint32 mid = begin + (end - begin) / 2;
+    std::nth_element(mIndexed.begin() + begin, mIndexed.begin() + mid, mIndexed.begin() + end, CenterLess(axis));
+
+    mNodes[idx].first = 0;
+    mNodes[idx].count = 0;
+    build(begin, mid);
+    uint32 second = build(mid, end);
+    mNodes[idx].secondChild = second;
+    return idx;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,352 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/space/ShardedOSegCache.hpp>
+#include <sirikata/core/trace/TimeSeries.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+namespace Sirikata {
+
+const uint32 ShardedOSegCache::LatencySampleInterval;
+
+ShardedOSegCache::Shard::Shard()
+ : sequence(0),
+   slots(NULL),
+   mask(0),
+   maxSize(0),
+   size(0),
+   hand(0),
+   lookups(0),
+   hits(0),
+   evictions(0),
+   retries(0),
+   latencySamples(0),
+   latencyMicroseconds(0)
+{
+}
+
+ShardedOSegCache::Shard::~Shard() {
+    delete[] slots;
+}
+
+ShardedOSegCache::ShardedOSegCache(Context* ctx, const String& stats_prefix, uint32 max_size, const Duration& lifetime, uint32 num_shards)
+ : mContext(ctx),
+   mLifetime(lifetime),
+   mNumShards(1),
+   mShardBits(0),
+   mShards(NULL),
+   mStatsPoller(
+       ctx->mainStrand,
+       std::tr1::bind(&ShardedOSegCache::reportStats, this),
+       "ShardedOSegCache Stats Poller",
+       Duration::seconds((int64)1)),
+   mLastReportTime(Time::null()),
+   mTimeSeriesHitRateName(stats_prefix + ".hit_rate"),
+   mTimeSeriesLookupRateName(stats_prefix + ".lookups_per_second"),
+   mTimeSeriesLatencyName(stats_prefix + ".lookup_latency_us")
+{
+    while(mNumShards < num_shards) {
+        mNumShards <<= 1;
+        mShardBits++;
+    }
+
+    // Keep each table at most half full so probe sequences stay short
+    uint32 shard_max = std::max((max_size + mNumShards - 1) / mNumShards, (uint32)1);
+    uint32 table_size = 1;
+    while(table_size < 2 * shard_max)
+        table_size <<= 1;
+
+    mShards = new Shard[mNumShards];
+    for(uint32 i = 0; i < mNumShards; i++) {
+        mShards[i].slots = new Slot[table_size];
+        for(uint32 s = 0; s < table_size; s++) {
+            mShards[i].slots[s].occupied = false;
+            mShards[i].slots[s].referenced = false;
+        }
+        mShards[i].mask = table_size - 1;
+        mShards[i].maxSize = shard_max;
+    }
+}
+
+ShardedOSegCache::~ShardedOSegCache() {
+    delete[] mShards;
+}
+
+void ShardedOSegCache::start() {
+    mLastReportTime = Timer::now();
+    mStatsPoller.start();
+}
+
+void ShardedOSegCache::stop() {
+    mStatsPoller.stop();
+}
+
+uint32 ShardedOSegCache::hash(const UUID& uuid) {
+    // UUID::hash is weak in the low bits for some generators, so mix it
+    // (murmur3 finalizer) before splitting it into shard and slot.
+    uint32 h = (uint32)uuid.hash();
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+bool ShardedOSegCache::expired(const Time& inserted) const {
+    if (mLifetime == Duration::zero()) return false;
+    return (mContext->recentSimTime() - inserted) > mLifetime;
+}
+
+int32 ShardedOSegCache::findSlot(const Shard& shard, const UUID& uuid, uint32 home) const {
+    uint32 idx = home;
+    for(uint32 probe = 0; probe <= shard.mask; probe++) {
+        const Slot& slot = shard.slots[idx];
+        if (!slot.occupied) return -1;
+        if (slot.id == uuid) return (int32)idx;
+        idx = (idx + 1) & shard.mask;
+    }
+    return -1;
+}
+
+OSegEntry ShardedOSegCache::get(const UUID& uuid) {
+    uint32 h = hash(uuid);
+    Shard& shard = shardFor(h);
+    uint32 home = homeSlot(shard, h);
+
+    uint64 lookup_num = ++shard.lookups;
+    bool sample_latency = (lookup_num % LatencySampleInterval) == 0;
+    Time start = sample_latency ? Timer::now() : Time::null();
+
+    OSegEntry result = OSegEntry::null();
+    Time inserted = Time::null();
+    int32 found = -1;
+    while(true) {
+        uint32 seq = shard.sequence;
+        memory_barrier();
+        // A writer is in the middle of an update, wait for it to finish
+        if (seq & 1) continue;
+
+        // Slots may be changing underneath us, but the probe is bounded and
+        // anything we read is discarded unless the sequence didn't move.
+        found = -1;
+        uint32 idx = home;
+        for(uint32 probe = 0; probe <= shard.mask; probe++) {
+            const Slot& slot = shard.slots[idx];
+            if (!slot.occupied) break;
+            if (slot.id == uuid) {
+                result = slot.entry;
+                inserted = slot.inserted;
+                found = (int32)idx;
+                break;
+            }
+            idx = (idx + 1) & shard.mask;
+        }
+
+        memory_barrier();
+        if (shard.sequence == seq) break;
+        ++shard.retries;
+    }
+
+    if (found >= 0 && expired(inserted))
+        found = -1;
+
+    if (found >= 0) {
+        // Avoid dirtying the cache line for entries which are already hot. If
+        // a writer moved the entry in the meantime we just mark some other
+        // entry, which at worst delays its eviction by one sweep.
+        Slot& slot = shard.slots[found];
+        if (!slot.referenced)
+            slot.referenced = true;
+        ++shard.hits;
+    }
+    else {
+        result = OSegEntry::null();
+    }
+
+    if (sample_latency) {
+        ++shard.latencySamples;
+        shard.latencyMicroseconds += (uint64)(Timer::now() - start).toMicroseconds();
+    }
+
+    return result;
+}
+
+void ShardedOSegCache::insert(const UUID& uuid, const OSegEntry& sID) {
+    uint32 h = hash(uuid);
+    Shard& shard = shardFor(h);
+    uint32 home = homeSlot(shard, h);
+    Time now = mContext->recentSimTime();
+
+    boost::lock_guard<boost::mutex> lck(shard.mutex);
+
+    int32 existing = findSlot(shard, uuid, home);
+    if (existing < 0 && shard.size >= shard.maxSize)
+        evictOne(shard);
+
+    shard.sequence++;
+    memory_barrier();
+
+    if (existing >= 0) {
+        Slot& slot = shard.slots[existing];
+        slot.entry = sID;
+        slot.inserted = now;
+        slot.referenced = true;
+    }
+    else {
+        uint32 idx = home;
+        while(shard.slots[idx].occupied)
+            idx = (idx + 1) & shard.mask;
+        Slot& slot = shard.slots[idx];
+        slot.id = uuid;
+        slot.entry = sID;
+        slot.inserted = now;
+        slot.home = home;
+        // New entries start unreferenced so one-off lookups are the first
+        // to go
+        slot.referenced = false;
+        slot.occupied = true;
+        shard.size++;
+    }
+
+    memory_barrier();
+    shard.sequence++;
+}
+
+void ShardedOSegCache::remove(const UUID& uuid) {
+    uint32 h = hash(uuid);
+    Shard& shard = shardFor(h);
+
+    boost::lock_guard<boost::mutex> lck(shard.mutex);
+
+    int32 idx = findSlot(shard, uuid, homeSlot(shard, h));
+    if (idx < 0) return;
+
+    shard.sequence++;
+    memory_barrier();
+    removeSlot(shard, (uint32)idx);
+    memory_barrier();
+    shard.sequence++;
+}
+
+void ShardedOSegCache::removeSlot(Shard& shard, uint32 idx) {
+    // Backward shift deletion: pull later entries in the probe sequence back
+    // into the hole unless that would move them before their home slot.
+    uint32 hole = idx;
+    uint32 next = idx;
+    while(true) {
+        next = (next + 1) & shard.mask;
+        Slot& slot = shard.slots[next];
+        if (!slot.occupied) break;
+
+        uint32 home = slot.home;
+        bool home_in_range = (hole <= next) ?
+            (hole < home && home <= next) :
+            (hole < home || home <= next);
+        if (home_in_range) continue;
+
+        Slot& dest = shard.slots[hole];
+        dest.id = slot.id;
+        dest.entry = slot.entry;
+        dest.inserted = slot.inserted;
+        dest.home = slot.home;
+        dest.referenced = slot.referenced;
+        hole = next;
+    }
+    shard.slots[hole].occupied = false;
+    shard.slots[hole].referenced = false;
+    shard.size--;
+}
+
+void ShardedOSegCache::evictOne(Shard& shard) {
+    // CLOCK: sweep the hand, giving referenced entries a second chance.
+    // Expired entries are always fair game. Clearing reference bits doesn't
+    // change what readers see, so only the removal is inside the write
+    // section.
+    while(true) {
+        Slot& slot = shard.slots[shard.hand];
+        if (slot.occupied) {
+            if (slot.referenced && !expired(slot.inserted)) {
+                slot.referenced = false;
+            }
+            else {
+                shard.sequence++;
+                memory_barrier();
+                removeSlot(shard, shard.hand);
+                memory_barrier();
+                shard.sequence++;
+                ++shard.evictions;
+                // Leave the hand where it is, an entry may have shifted
+                // into this slot
+                return;
+            }
+        }
+        shard.hand = (shard.hand + 1) & shard.mask;
+    }
+}
+
+uint32 ShardedOSegCache::size() const {
+    uint32 result = 0;
+    for(uint32 i = 0; i < mNumShards; i++)
+        result += mShards[i].size;
+    return result;
+}
+
+ShardedOSegCache::Stats ShardedOSegCache::stats() const {
+    Stats result;
+    for(uint32 i = 0; i < mNumShards; i++) {
+        const Shard& shard = mShards[i];
+        result.lookups += shard.lookups.read();
+        result.hits += shard.hits.read();
+        result.evictions += shard.evictions.read();
+        result.retries += shard.retries.read();
+        result.latencySamples += shard.latencySamples.read();
+        result.latencyMicroseconds += shard.latencyMicroseconds.read();
+    }
+    return result;
+}
+
+void ShardedOSegCache::resetStats() {
+    for(uint32 i = 0; i < mNumShards; i++) {
+        Shard& shard = mShards[i];
+        shard.lookups = 0;
+        shard.hits = 0;
+        shard.evictions = 0;
+        shard.retries = 0;
+        shard.latencySamples = 0;
+        shard.latencyMicroseconds = 0;
+    }
+    mLastReported = Stats();
+}
+
+void ShardedOSegCache::reportStats() {
+    Stats current = stats();
+    Time now = Timer::now();
+
+    uint64 lookups = current.lookups - mLastReported.lookups;
+    uint64 hits = current.hits - mLastReported.hits;
+    uint64 samples = current.latencySamples - mLastReported.latencySamples;
+    uint64 latency = current.latencyMicroseconds - mLastReported.latencyMicroseconds;
+    float64 elapsed = (now - mLastReportTime).toSeconds();
+
+    mContext->timeSeries->report(
+        mTimeSeriesHitRateName,
+        lookups > 0 ? (float64)hits / lookups : 0.0
+    );
+    mContext->timeSeries->report(
+        mTimeSeriesLookupRateName,
+        elapsed > 0 ? lookups / elapsed : 0.0
+    );
+    if (samples > 0) {
+        mContext->timeSeries->report(
+            mTimeSeriesLatencyName,
+            (float64)latency / samples
+        );
+    }
+
+    mLastReported = current;
+    mLastReportTime = now;
+}
+
+} // namespace Sirikata
@@ -67,14 +67,19 @@ using Sirikata::Network::TCPListener;
 
 CoordinateSegmentationClient::CoordinateSegmentationClient(SpaceContext* ctx, const BoundingBox3f& region, const Vector3ui32& perdim, ServerIDMap* sidmap)
   : CoordinateSegmentation(ctx),  mBSPTreeValid(false),
+    mPendingLookupsScheduled(false),
     mAvailableServersCount(0), mTopLevelRegion(NULL),
     mIOService(new Network::IOService("CoordinationSegmentationClient")),
+    mLookupPool(new Network::IOServicePool("CoordinateSegmentationClient Lookups", 1)),
     mSidMap(sidmap), mLeaseExpiryTime(Timer::now() + Duration::milliseconds(60000.0))
 {
   mTopLevelRegion.mBoundingBox = BoundingBox3f( Vector3f(0,0,0), Vector3f(0,0,0));
   mCSEGHost = GetOptionValue<String>("cseg-service-host");
   mCSEGPort = GetOptionValue<String>("cseg-service-tcp-port");
 
+  mLookupPool->startWork();
+  mLookupPool->run();
+
   if (mSidMap != NULL) {
     mSidMap->lookupExternal(
       mContext->id(),
@@ -140,7 +145,10 @@ void CoordinateSegmentationClient::accept_handler() {
 }
 
 CoordinateSegmentationClient::~CoordinateSegmentationClient() {
-
+  // Finishes any lookups already in progress; callbacks for ones that haven't
+  // been sent yet are dropped.
+  mLookupPool->join();
+  delete mLookupPool;
 }
 
 void CoordinateSegmentationClient::sendSegmentationListenMessage(const Address4& my_addr) {
@@ -226,21 +234,15 @@ boost::shared_ptr<TCPSocket> CoordinateSegmentationClient::getLeasedSocket() {
 ServerID CoordinateSegmentationClient::lookup(const Vector3f& pos)  {
   {
     boost::mutex::scoped_lock cachelock(mCacheMutex);
-
-    for (uint32 i=0 ; i<mLookupCache.size(); i++) {
-      if (mLookupCache[i].bbox.contains(pos)) {
-
-        assert(mLookupCache[i].sid >= 1 && mLookupCache[i].sid <= 5);
-
-        //std::cout << "pos=" << pos   <<" , mLookupCache[i].sid: " << mLookupCache[i].sid << "\n";
-        //fflush(stdout);
-
-        return mLookupCache[i].sid;
-      }
-    }
+    ServerID sid = mLookupCache.lookup(pos);
+    if (sid != NullServerID)
+      return sid;
   }
 
+  return lookupRemote(pos);
+}
 
+ServerID CoordinateSegmentationClient::lookupRemote(const Vector3f& pos) {
   Sirikata::Protocol::CSeg::CSegMessage csegMessage;
 
   csegMessage.mutable_lookup_request_message().set_x(pos.x);
@@ -264,7 +266,7 @@ ServerID CoordinateSegmentationClient::lookup(const Vector3f& pos)  {
   if (retval != 0 && csegMessage.lookup_response_message().has_server_bbox()) {
     boost::mutex::scoped_lock cachelock(mCacheMutex);
 
-    mLookupCache.push_back( LookupCacheEntry(retval, csegMessage.lookup_response_message().server_bbox()) );
+    mLookupCache.insert(csegMessage.lookup_response_message().server_bbox(), retval);
   }
 
   std::cout << "Lookup : " << pos << " : " << retval << "\n";
@@ -272,6 +274,76 @@ ServerID CoordinateSegmentationClient::lookup(const Vector3f& pos)  {
   return retval;
 }
 
+void CoordinateSegmentationClient::asyncLookup(const Vector3f& pos, const LookupCallback& cb) {
+  boost::mutex::scoped_lock cachelock(mCacheMutex);
+
+  ServerID sid = mLookupCache.lookup(pos);
+  if (sid != NullServerID) {
+    cachelock.unlock();
+    cb(sid);
+    return;
+  }
+
+  mPendingLookups.push_back(PendingLookup(pos, cb));
+  if (!mPendingLookupsScheduled) {
+    mPendingLookupsScheduled = true;
+    mLookupPool->service()->post(
+      std::tr1::bind(&CoordinateSegmentationClient::processPendingLookups, this),
+      "CoordinateSegmentationClient::processPendingLookups"
+    );
+  }
+}
+
+void CoordinateSegmentationClient::processPendingLookups() {
+  // Misses tend to come in bursts for nearby positions, e.g. many objects
+  // connecting in the same area. Each response tells us the whole region its
+  // server handles, so rather than sending a request per miss, send one for
+  // the oldest pending lookup and then answer every other pending lookup the
+  // new region covers.
+  PendingLookupList ready;
+  std::vector<ServerID> sids;
+  while(true) {
+    Vector3f pos;
+    {
+      boost::mutex::scoped_lock cachelock(mCacheMutex);
+      if (mPendingLookups.empty()) {
+        mPendingLookupsScheduled = false;
+        return;
+      }
+      pos = mPendingLookups.front().pos;
+    }
+
+    ServerID front_sid = lookupRemote(pos);
+
+    ready.clear();
+    sids.clear();
+    {
+      boost::mutex::scoped_lock cachelock(mCacheMutex);
+      // The front lookup is answered even if the response had no region to
+      // cache.
+      ready.push_back(mPendingLookups.front());
+      sids.push_back(front_sid);
+      mPendingLookups.pop_front();
+
+      PendingLookupList remaining;
+      for(PendingLookupList::iterator it = mPendingLookups.begin(); it != mPendingLookups.end(); it++) {
+        ServerID sid = mLookupCache.lookup(it->pos);
+        if (sid != NullServerID) {
+          ready.push_back(*it);
+          sids.push_back(sid);
+        }
+        else {
+          remaining.push_back(*it);
+        }
+      }
+      mPendingLookups.swap(remaining);
+    }
+
+    for(uint32 i = 0; i < ready.size(); i++)
+      ready[i].cb(sids[i]);
+  }
+}
+
 BoundingBoxList CoordinateSegmentationClient::serverRegion(const ServerID& server)
 {
   boost::mutex::scoped_lock cachelock(mCacheMutex);
@@ -400,6 +472,15 @@ uint32 CoordinateSegmentationClient::numServers()  {
 std::vector<ServerID> CoordinateSegmentationClient::lookupBoundingBox(const BoundingBox3f& bbox) {
   std::vector<ServerID> serverList;
 
+  // If the regions we already know about cover the whole box, they give the
+  // complete answer.
+  {
+    boost::mutex::scoped_lock cachelock(mCacheMutex);
+    if (mLookupCache.lookupBoundingBox(bbox, &serverList))
+      return serverList;
+  }
+  serverList.clear();
+
   //Serialize and send out the message.
   Sirikata::Protocol::CSeg::CSegMessage csegMessage;
   csegMessage.mutable_lookup_bbox_request_message().set_bbox(bbox);
@@ -40,6 +40,8 @@
 #include <sirikata/core/network/Address4.hpp>
 #include <sirikata/space/CoordinateSegmentation.hpp>
 #include <sirikata/space/SegmentedRegion.hpp>
+#include <sirikata/space/ServerRegionIndex.hpp>
+#include <sirikata/core/network/IOServicePool.hpp>
 
 #include "Protocol_CSeg.pbj.hpp"
 
@@ -58,6 +60,7 @@ public:
     virtual ~CoordinateSegmentationClient();
 
     virtual ServerID lookup(const Vector3f& pos) ;
+    virtual void asyncLookup(const Vector3f& pos, const LookupCallback& cb);
     virtual BoundingBoxList serverRegion(const ServerID& server) ;
     virtual BoundingBox3f region() ;
     virtual uint32 numServers() ;
@@ -81,24 +84,30 @@ private:
 
     Trace::Trace* mTrace;
 
-    typedef struct LookupCacheEntry {
-      LookupCacheEntry(ServerID sid, const BoundingBox3f& bbox) {
-        this->bbox = bbox;
-        this->sid = sid;
-      }
+    struct PendingLookup {
+      PendingLookup(const Vector3f& _pos, const LookupCallback& _cb)
+       : pos(_pos), cb(_cb)
+      {}
 
-      BoundingBox3f bbox;
-      ServerID sid;
-
-    } LookupCacheEntry;
+      Vector3f pos;
+      LookupCallback cb;
+    };
+    typedef std::deque<PendingLookup> PendingLookupList;
 
     boost::mutex mCacheMutex;
-    std::vector<LookupCacheEntry> mLookupCache;
+    // Regions learned from lookup responses
+    ServerRegionIndex mLookupCache;
+    // asyncLookups waiting on the CSEG server, and whether
+    // processPendingLookups is scheduled to handle them.
+    PendingLookupList mPendingLookups;
+    bool mPendingLookupsScheduled;
     uint16 mAvailableServersCount;
     std::map<ServerID, BoundingBoxList> mServerRegionCache;
     SegmentedRegion mTopLevelRegion;
 
     Network::IOService* mIOService;  //creates an io service
+    // Runs asyncLookup round trips to the CSEG server
+    Network::IOServicePool* mLookupPool;
     boost::shared_ptr<Network::TCPListener> mAcceptor;
     boost::shared_ptr<Network::TCPSocket> mSocket;
 
@@ -120,6 +129,11 @@ private:
 
     boost::shared_ptr<Network::TCPSocket> getLeasedSocket();
 
+    // Ask the CSEG server for the server handling pos, caching the region
+    // it returns.
+    ServerID lookupRemote(const Vector3f& pos);
+    void processPendingLookups();
+
     void writeCSEGMessage(boost::shared_ptr<tcp::socket> socket,
                           Sirikata::Protocol::CSeg::CSegMessage& csegMessage);
 
@@ -43,7 +43,7 @@
 
 #include "Forwarder.hpp"
 #include <sirikata/space/ObjectSegmentation.hpp>
-#include "OSegLookupQueue.hpp"
+#include <sirikata/space/OSegLookupQueue.hpp>
 
 #include "ObjectConnection.hpp"
 
@@ -122,11 +122,31 @@ Forwarder::Forwarder(SpaceContext* ctx)
              mTimeSeriesForwardedPerSecondName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".forwarded.remote"),
              mForwardedPerSecond(0),
              mTimeSeriesDroppedPerSecondName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".dropped.forwarder"),
-             mDroppedPerSecond(0)
+             mDroppedPerSecond(0),
+             mTimeSeriesMessagesAllocatedPerSecondName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".object-messages.allocated"),
+             mTimeSeriesMessagesReusedPerSecondName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".object-messages.reused"),
+             mLastPoolStats(getObjectMessagePoolStats()),
+             mRoutingQueue(NULL)
 {
     mNullServerIDOSegCallback=std::tr1::bind(&Forwarder::routeObjectMessageToServerNoReturn, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2,std::tr1::placeholders:: _3, NullServerID);
     mOutgoingMessages = new ForwarderServiceQueue(mContext->id(), GetOptionValue<uint32>(FORWARDER_SEND_QUEUE_SIZE), (ForwarderServiceQueue::Listener*)this);
 
+    uint32 routing_threads = GetOptionValue<uint32>(FORWARDER_ROUTING_THREADS);
+    if (routing_threads > 0) {
+        // Use a few partitions per thread so a handful of busy destinations
+        // doesn't leave other threads idle.
+        mRoutingQueue = new RoutingQueue(
+            "Forwarder Routing", routing_threads, 4 * routing_threads,
+            GetOptionValue<uint32>(FORWARDER_ROUTING_BATCH_SIZE),
+            std::tr1::bind(&Forwarder::handleRoutingBatch, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2)
+        );
+        for(uint32 i = 0; i < mRoutingQueue->numPartitions(); i++) {
+            RoutingPartition* part = new RoutingPartition();
+            part->outboxSize = 0;
+            mRoutingPartitions.push_back(part);
+        }
+    }
+
     // Messages destined for objects are subscribed to here so we can easily pick them
     // out and decide whether they can be delivered directly or need forwarding
     this->registerMessageRecipient(SERVER_PORT_OBJECT_MESSAGE_ROUTING, this);
@@ -152,6 +172,17 @@ Forwarder::Forwarder(SpaceContext* ctx)
       this->unregisterMessageRecipient(SERVER_PORT_OBJECT_MESSAGE_ROUTING, this);
       this->unregisterMessageRecipient(SERVER_PORT_FORWARDER_WEIGHT_UPDATE, this);
 
+      if (mRoutingQueue != NULL) {
+          RoutingQueue::Batch unrouted;
+          mRoutingQueue->drain(&unrouted);
+          for(uint32 i = 0; i < unrouted.size(); i++)
+              releaseObjectMessage(unrouted[i].msg);
+          delete mRoutingQueue;
+          for(uint32 i = 0; i < mRoutingPartitions.size(); i++)
+              delete mRoutingPartitions[i];
+          mRoutingPartitions.clear();
+      }
+
       delete mOutgoingMessages;
       delete mOSegLookups;
   }
@@ -163,7 +194,12 @@ void Forwarder::initialize(ObjectSegmentation* oseg, ServerMessageQueue* smq, Se
 {
     addODPServerMessageService(loc);
 
-    mOSegLookups = new OSegLookupQueue(mContext->mainStrand, oseg);
+    mOSegLookups = new OSegLookupQueue(
+        mContext, mContext->mainStrand, oseg,
+        GetOptionValue<uint32>(OSEG_LOOKUP_QUEUE_SIZE),
+        GetOptionValue<uint32>(OSEG_LOOKUP_QUEUE_BYTES),
+        GetOptionValue<uint32>(OSEG_LOOKUP_BATCH_SIZE)
+    );
     mServerMessageQueue = smq;
     mServerMessageReceiver = smr;
 }
@@ -182,7 +218,7 @@ void Forwarder::dispatchMessage(Sirikata::Protocol::Object::ObjectMessage* obj_m
         ODP::Endpoint(SpaceID::null(), ObjectReference(obj_msg->dest_object()), obj_msg->dest_port()),
         MemoryReference(obj_msg->payload())
     );
-    delete obj_msg;
+    releaseObjectMessage(obj_msg);
 }
 
 void Forwarder::handleObjectMessageLoop(Sirikata::Protocol::Object::ObjectMessage* obj_msg) const {
@@ -193,11 +229,21 @@ void Forwarder::handleObjectMessageLoop(Sirikata::Protocol::Object::ObjectMessag
 void Forwarder::start() {
     mServerWeightPoller.start();
     mTimeSeriesPoller.start();
+    if (mRoutingQueue != NULL)
+        mRoutingQueue->start();
 }
 
 void Forwarder::stop() {
     mServerWeightPoller.stop();
     mTimeSeriesPoller.stop();
+    if (mRoutingQueue != NULL)
+        mRoutingQueue->stop();
+
+    ObjectMessagePoolStats pool_stats = getObjectMessagePoolStats();
+    SILOG(forwarder,info,
+        "ObjectMessages: " << pool_stats.allocated << " allocated, " <<
+        pool_stats.reused << " reused from pool, " <<
+        pool_stats.released << " released to pool");
 }
 
 void Forwarder::reportStats() {
@@ -215,6 +261,17 @@ void Forwarder::reportStats() {
         mDroppedPerSecond.read() / since_last_seconds
     );
     mDroppedPerSecond = 0;
+
+    ObjectMessagePoolStats pool_stats = getObjectMessagePoolStats();
+    mContext->timeSeries->report(
+        mTimeSeriesMessagesAllocatedPerSecondName,
+        (pool_stats.allocated - mLastPoolStats.allocated) / since_last_seconds
+    );
+    mContext->timeSeries->report(
+        mTimeSeriesMessagesReusedPerSecondName,
+        (pool_stats.reused - mLastPoolStats.reused) / since_last_seconds
+    );
+    mLastPoolStats = pool_stats;
 }
 
 // -- Object Connection Management - Object connections are available locally,
@@ -382,19 +439,24 @@ void Forwarder::forwarderServiceMessageReady(ServerID dest_server) {
 // -- messages.  Sources include object hosts and other space servers.
 
 // --- From object hosts
-void Forwarder::routeObjectHostMessage(Sirikata::Protocol::Object::ObjectMessage* obj_msg) {
+void Forwarder::routeObjectHostMessage(Sirikata::Protocol::Object::ObjectMessage* obj_msg, bool routing_fallback) {
     // Messages destined for the space skip the object message queue and just get dispatched
     if (obj_msg->dest_object() == UUID::null()) {
+        // Routing threads only take messages with a destination
+        assert(!routing_fallback);
         dispatchMessage(obj_msg);
         return;
     }
 
-    bool forwarded = forward(obj_msg);
+    bool forwarded = forward(obj_msg, NullServerID, routing_fallback);
     if (!forwarded) {
+        UUID dest = obj_msg->dest_object();
         mDroppedPerSecond++;
         TIMESTAMP(obj_msg, Trace::DROPPED_DURING_FORWARDING);
         TRACE_DROP(DROPPED_DURING_FORWARDING);
-        delete obj_msg;
+        releaseObjectMessage(obj_msg);
+        if (routing_fallback)
+            routingFallbackFinished(dest);
     }
 }
 
@@ -413,11 +475,11 @@ void Forwarder::receiveMessage(Message* msg) {
 }
 
 void Forwarder::receiveObjectRoutingMessage(Message* msg) {
-    Sirikata::Protocol::Object::ObjectMessage* obj_msg = new Sirikata::Protocol::Object::ObjectMessage();
+    Sirikata::Protocol::Object::ObjectMessage* obj_msg = allocateObjectMessage();
     bool parsed = parsePBJMessage(obj_msg, msg->payload());
     if (!parsed) {
         LOG_INVALID_MESSAGE(forwarder, error, msg->payload());
-        delete obj_msg;
+        releaseObjectMessage(obj_msg);
         delete msg;
         return;
     }
@@ -440,7 +502,7 @@ void Forwarder::receiveObjectRoutingMessage(Message* msg) {
         mDroppedPerSecond++;
         TIMESTAMP(obj_msg, Trace::DROPPED_DURING_FORWARDING);
         TRACE_DROP(DROPPED_DURING_FORWARDING_ROUTING);
-        delete obj_msg;
+        releaseObjectMessage(obj_msg);
     }
 
     delete msg;
@@ -501,7 +563,7 @@ void Forwarder::receiveWeightUpdateMessage(Message* msg) {
 // -- Real Routing - Given an object message, from any source, decide where it
 // -- needs to go and send it out in that direction.
 
-bool Forwarder::forward(Sirikata::Protocol::Object::ObjectMessage* msg, ServerID forwardFrom)
+bool Forwarder::forward(Sirikata::Protocol::Object::ObjectMessage* msg, ServerID forwardFrom, bool routing_fallback)
 {
     TIMESTAMP_START(tstamp, msg);
     TIMESTAMP_END(tstamp, Trace::FORWARDING_STARTED);
@@ -514,6 +576,16 @@ bool Forwarder::forward(Sirikata::Protocol::Object::ObjectMessage* msg, ServerID
     // to forward the message to
     TIMESTAMP_END(tstamp, Trace::OSEG_LOOKUP_STARTED);
 
+    // Fallbacks from a routing thread were counted there, so it needs to hear
+    // when they're done, whether they're sent, dropped or shed by the lookup
+    // queue.
+    if (routing_fallback) {
+        return mOSegLookups->lookup(
+            msg,
+            std::tr1::bind(&Forwarder::routeObjectMessageAfterFallback, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2,std::tr1::placeholders:: _3, forwardFrom)
+        );
+    }
+
     bool accepted = mOSegLookups->lookup(
         msg,
         (forwardFrom==NullServerID?mNullServerIDOSegCallback:std::tr1::bind(&Forwarder::routeObjectMessageToServerNoReturn, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2,std::tr1::placeholders:: _3, forwardFrom))
@@ -540,12 +612,153 @@ bool Forwarder::tryCacheForward(Sirikata::Protocol::Object::ObjectMessage* msg)
     return true; // If we got here, the cache was successful, we just dropped it.
 }
 
+
+// -- Routing threads - With forwarder.routing-threads > 0, the networking
+// -- threads hand object messages to a routing partition selected by
+// -- destination object instead of checking the OSeg cache themselves. Each
+// -- partition handles a batch of messages at a time, forwarding locally when
+// -- possible, otherwise collecting cache hits in an outbox grouped by
+// -- destination server which is merged into the ODPFlowSchedulers at the end
+// -- of the batch. Cache misses fall back to the main strand.
+// --
+// -- Since all messages for an object go through the same partition, in order,
+// -- the only way to reorder them is for a later message to take the fast path
+// -- while an earlier one is still waiting on the main strand. To avoid that
+// -- the partition counts outstanding fallbacks per object and sends later
+// -- messages the slow way as well until they've all finished.
+
+uint32 Forwarder::routingPartitionKey(const UUID& dest) const {
+    return (uint32)UUID::Hasher()(dest);
+}
+
+void Forwarder::routeOnRoutingThread(Sirikata::Protocol::Object::ObjectMessage* msg, const RoutingFallback& fallback) {
+    assert(mRoutingQueue != NULL);
+    assert(msg->dest_object() != UUID::null());
+    mRoutingQueue->push(routingPartitionKey(msg->dest_object()), RoutingRequest(msg, fallback));
+}
+
+void Forwarder::routingFallbackFinished(const UUID& dest) {
+    if (mRoutingQueue == NULL) return;
+
+    uint32 partition = mRoutingQueue->partition(routingPartitionKey(dest));
+    mRoutingQueue->post(
+        partition,
+        std::tr1::bind(&Forwarder::handleRoutingFallbackFinished, this, partition, dest),
+        "Forwarder::handleRoutingFallbackFinished"
+    );
+}
+
+void Forwarder::handleRoutingFallbackFinished(uint32 partition, UUID dest) {
+    RoutingPartition* part = mRoutingPartitions[partition];
+    RoutingPartition::PendingFallbackMap::iterator it = part->pendingFallbacks.find(dest);
+    // Only messages counted in handleRoutingBatch are reported, exactly once.
+    // If that's ever broken, ignore the extra report rather than letting the
+    // count go negative.
+    if (it == part->pendingFallbacks.end()) {
+        SILOG(forwarder,error,"Routing fallback finished for " << dest << " with none pending");
+        return;
+    }
+    if (--(it->second) == 0)
+        part->pendingFallbacks.erase(it);
+}
+
+void Forwarder::handleRoutingBatch(uint32 partition, RoutingQueue::Batch& batch) {
+    RoutingPartition* part = mRoutingPartitions[partition];
+
+    for(uint32 i = 0; i < batch.size(); i++) {
+        Sirikata::Protocol::Object::ObjectMessage* obj_msg = batch[i].msg;
+        UUID dest = obj_msg->dest_object();
+
+        if (part->pendingFallbacks.find(dest) == part->pendingFallbacks.end()) {
+            // Local
+            if (mLocalForwarder->tryForward(obj_msg))
+                continue;
+
+            // OSeg Cache
+            TIMESTAMP_START(tstamp, obj_msg);
+            TIMESTAMP_END(tstamp, Trace::OSEG_CACHE_CHECK_STARTED);
+            OSegEntry dest_serv = mOSegLookups->cacheLookup(dest);
+            TIMESTAMP_END(tstamp, Trace::OSEG_CACHE_CHECK_FINISHED);
+            if (!dest_serv.isNull() && dest_serv.server() != mContext->id()) {
+                TIMESTAMP_END(tstamp, Trace::OSEG_CACHE_LOOKUP_FINISHED);
+                TIMESTAMP_END(tstamp, Trace::OSEG_LOOKUP_FINISHED);
+                RoutedMessage routed;
+                routed.msg = obj_msg;
+                routed.dest = dest_serv;
+                part->outbox[dest_serv.server()].push_back(routed);
+                part->outboxSize++;
+                continue;
+            }
+        }
+
+        // Needs the main strand. Anything we've already resolved has to go out
+        // first so it can't end up behind this message.
+        flushRoutingOutbox(part);
+        part->pendingFallbacks[dest]++;
+        batch[i].fallback(obj_msg);
+    }
+
+    flushRoutingOutbox(part);
+}
+
+void Forwarder::flushRoutingOutbox(RoutingPartition* part) {
+    if (part->outboxSize == 0) return;
+
+    for(RoutingPartition::Outbox::iterator it = part->outbox.begin(); it != part->outbox.end(); it++) {
+        RoutedMessageList& routed = it->second;
+        if (routed.empty()) continue;
+
+        ODPFlowScheduler* flow_sched = getODPFlowScheduler(it->first);
+        for(uint32 i = 0; i < routed.size(); i++)
+            routeObjectMessageToServer(flow_sched, routed[i].msg, routed[i].dest, OSegLookupQueue::ResolvedFromCache, NullServerID);
+        // Leave the entry in place, these are usually reused
+        routed.clear();
+    }
+    part->outboxSize = 0;
+}
+
+void Forwarder::forwardFromRoutingThread(Sirikata::Protocol::Object::ObjectMessage* obj_msg, ServerID forwardFrom) {
+    mContext->mainStrand->post(
+        std::tr1::bind(&Forwarder::handleForwardFromRoutingThread, this, obj_msg, forwardFrom),
+        "Forwarder::handleForwardFromRoutingThread"
+    );
+}
+
+void Forwarder::handleForwardFromRoutingThread(Sirikata::Protocol::Object::ObjectMessage* obj_msg, ServerID forwardFrom) {
+    TIMESTAMP(obj_msg, Trace::HANDLE_SPACE_MESSAGE);
+
+    bool forward_success = forward(obj_msg, forwardFrom, true);
+    if (!forward_success) {
+        UUID dest = obj_msg->dest_object();
+        mDroppedPerSecond++;
+        TIMESTAMP(obj_msg, Trace::DROPPED_DURING_FORWARDING);
+        TRACE_DROP(DROPPED_DURING_FORWARDING_ROUTING);
+        releaseObjectMessage(obj_msg);
+        routingFallbackFinished(dest);
+    }
+}
+
+void Forwarder::routeObjectMessageAfterFallback(Sirikata::Protocol::Object::ObjectMessage* obj_msg, const OSegEntry &dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom) {
+    UUID dest = obj_msg->dest_object();
+    routeObjectMessageToServerNoReturn(obj_msg, dest_serv, resolved_from, forwardFrom);
+    routingFallbackFinished(dest);
+}
+
 void Forwarder::routeObjectMessageToServerNoReturn(Sirikata::Protocol::Object::ObjectMessage* obj_msg, const OSegEntry &dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom) {
     routeObjectMessageToServer(obj_msg, dest_serv, resolved_from, forwardFrom);
 }
 
 bool Forwarder::routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMessage* obj_msg, const OSegEntry &dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom)
 {
+    // Shed by the lookup queue to stay within its memory budget
+    if (resolved_from == OSegLookupQueue::Dropped) {
+        mDroppedPerSecond++;
+        TIMESTAMP(obj_msg, Trace::DROPPED_DURING_FORWARDING);
+        TRACE_DROP(DROPPED_AT_OSEG_LOOKUP_QUEUE);
+        releaseObjectMessage(obj_msg);
+        return false;
+    }
+
     Trace::MessagePath mp = (resolved_from == OSegLookupQueue::ResolvedFromCache)
         ? Trace::OSEG_CACHE_LOOKUP_FINISHED
         : Trace::OSEG_SERVER_LOOKUP_FINISHED;
@@ -566,16 +779,16 @@ bool Forwarder::routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMes
         return true;
     }
 
-  //send out all server updates associated with an object with this message:
-  TIMESTAMP(obj_msg, Trace::SPACE_TO_SPACE_ENQUEUED);
+    return routeObjectMessageToServer(getODPFlowScheduler(dest_serv.server()), obj_msg, dest_serv, resolved_from, forwardFrom);
+}
 
-  // And then we can actually push
+ODPFlowScheduler* Forwarder::getODPFlowScheduler(ServerID dest_server) {
   // We try to look up the ODPFlowScheduler efficiently first, and only prePush
   // if we fail to find it.
   ODPFlowScheduler* flow_sched = NULL;
   {
       boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
-      ODPRouterMap::iterator odp_it = mODPRouters.find(dest_serv.server());
+      ODPRouterMap::iterator odp_it = mODPRouters.find(dest_server);
       if (odp_it != mODPRouters.end())
           flow_sched = odp_it->second;
   }
@@ -583,11 +796,19 @@ bool Forwarder::routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMes
       // Will force allocation of ODPFlowScheduler if its not there already
       {
           boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
-          mOutgoingMessages->prePush(dest_serv.server());
-          flow_sched = mODPRouters[dest_serv.server()];
+          mOutgoingMessages->prePush(dest_server);
+          flow_sched = mODPRouters[dest_server];
       }
   }
+  return flow_sched;
+}
 
+bool Forwarder::routeObjectMessageToServer(ODPFlowScheduler* flow_sched, Sirikata::Protocol::Object::ObjectMessage* obj_msg, const OSegEntry &dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom)
+{
+  //send out all server updates associated with an object with this message:
+  TIMESTAMP(obj_msg, Trace::SPACE_TO_SPACE_ENQUEUED);
+
+  // And then we can actually push
   OSegEntry source_object_data(OSegEntry::null());//FIXME: do we want mandatory lookup for nonlocal guys?! = mOSegLookups->cacheLookup(obj_msg->source_object());
   if (source_object_data.isNull()) {
       source_object_data=OSegEntry(mContext->id(),1.0);//FIXME dumb default: RADIUS of reforwarded messages are 1.0
@@ -628,7 +849,7 @@ bool Forwarder::routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMes
       // Ignore the success of this send.  If it failed the remote ends cache
       // will just continue to be incorrect, but forwarding will cover the error
   }
-  delete obj_msg;
+  releaseObjectMessage(obj_msg);
   return send_success;
 }
 
@@ -662,11 +883,11 @@ void Forwarder::serverMessageReceived(Message* msg) {
 
     // Routing, check if we can route immediately.
     if (msg->dest_port() == SERVER_PORT_OBJECT_MESSAGE_ROUTING) {
-        Sirikata::Protocol::Object::ObjectMessage* obj_msg = new Sirikata::Protocol::Object::ObjectMessage();
+        Sirikata::Protocol::Object::ObjectMessage* obj_msg = allocateObjectMessage();
         bool parsed = parsePBJMessage(obj_msg, msg->payload());
         if (!parsed) {
             LOG_INVALID_MESSAGE(forwarder, error, msg->payload());
-            delete obj_msg;
+            releaseObjectMessage(obj_msg);
             delete msg;
             return;
         }
@@ -674,6 +895,16 @@ void Forwarder::serverMessageReceived(Message* msg) {
         // This process is very similar to the one followed in Server for
         // handling OH messages.  We should probably merge them....
 
+        // With routing threads, the local and cache checks happen there
+        if (mRoutingQueue != NULL && obj_msg->dest_object() != UUID::null()) {
+            routeOnRoutingThread(
+                obj_msg,
+                std::tr1::bind(&Forwarder::forwardFromRoutingThread, this, std::tr1::placeholders::_1, msg->source_server())
+            );
+            delete msg;
+            return;
+        }
+
         // Local
         if (mLocalForwarder->tryForward(obj_msg)) {
             delete msg;
@@ -690,7 +921,7 @@ void Forwarder::serverMessageReceived(Message* msg) {
         }
 
         // Couldn't get rid of it, forward normally.
-        delete obj_msg;
+        releaseObjectMessage(obj_msg);
     }
 
     bool got_empty;
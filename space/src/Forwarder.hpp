@@ -41,7 +41,7 @@
 #include <sirikata/core/queue/Queue.hpp>
 #include <sirikata/core/queue/FairQueue.hpp>
 
-#include "OSegLookupQueue.hpp"
+#include <sirikata/space/OSegLookupQueue.hpp>
 
 #include "ServerMessageQueue.hpp"
 #include "ServerMessageReceiver.hpp"
@@ -52,6 +52,7 @@
 
 #include <sirikata/core/queue/SizedThreadSafeQueue.hpp>
 #include <sirikata/core/queue/ThreadSafeQueueWithNotification.hpp>
+#include <sirikata/core/queue/PartitionedStrandQueue.hpp>
 
 namespace Sirikata
 {
@@ -139,6 +140,56 @@ private:
     AtomicValue<uint32> mForwardedPerSecond;
     const String mTimeSeriesDroppedPerSecondName;
     AtomicValue<uint32> mDroppedPerSecond;
+    // ObjectMessage pool usage, see allocateObjectMessage
+    const String mTimeSeriesMessagesAllocatedPerSecondName;
+    const String mTimeSeriesMessagesReusedPerSecondName;
+    ObjectMessagePoolStats mLastPoolStats;
+
+    // Routing threads. When forwarder.routing-threads > 0, object messages
+    // with a known destination are handed to a routing partition chosen by
+    // destination object, which makes the local/cache forwarding decision.
+    // Messages that resolve from the cache are collected in a per-partition
+    // outbox and merged into the ODPFlowSchedulers once per batch. Anything
+    // else falls back to the main strand. (The ServerMessageQueue pulls from
+    // the ODPFlowSchedulers on the main strand, so they're the last per-server
+    // queues routing threads can push to directly.)
+  public:
+    typedef std::tr1::function<void(Sirikata::Protocol::Object::ObjectMessage*)> RoutingFallback;
+  private:
+    struct RoutingRequest {
+        RoutingRequest()
+         : msg(NULL)
+        {}
+        RoutingRequest(Sirikata::Protocol::Object::ObjectMessage* _msg, const RoutingFallback& _fallback)
+         : msg(_msg), fallback(_fallback)
+        {}
+
+        Sirikata::Protocol::Object::ObjectMessage* msg;
+        // Invoked on the routing thread if the message needs the main strand
+        RoutingFallback fallback;
+    };
+    typedef PartitionedStrandQueue<RoutingRequest> RoutingQueue;
+    RoutingQueue* mRoutingQueue;
+
+    struct RoutedMessage {
+        Sirikata::Protocol::Object::ObjectMessage* msg;
+        OSegEntry dest;
+    };
+    typedef std::vector<RoutedMessage> RoutedMessageList;
+    // State only accessed from a single routing partition's strand
+    struct RoutingPartition {
+        // Number of messages per destination that were handed to the main
+        // strand and haven't been routed yet. While non-zero, later messages
+        // for the same object also go to the main strand so they can't
+        // overtake the earlier ones.
+        typedef std::tr1::unordered_map<UUID, uint32, UUID::Hasher> PendingFallbackMap;
+        PendingFallbackMap pendingFallbacks;
+        // Messages resolved in this batch, grouped by destination server
+        typedef std::tr1::unordered_map<ServerID, RoutedMessageList, std::tr1::hash<ServerID> > Outbox;
+        Outbox outbox;
+        uint32 outboxSize;
+    };
+    std::vector<RoutingPartition*> mRoutingPartitions;
 
     // -- Boiler plate stuff - initialization, destruction, methods to satisfy interfaces
   public:
@@ -180,14 +231,30 @@ private:
     WARN_UNUSED
     bool tryCacheForward(Sirikata::Protocol::Object::ObjectMessage* msg);
 
+    // Whether forwarder.routing-threads > 0, i.e. whether routeOnRoutingThread
+    // can be used.
+    bool routingThreadsEnabled() const { return mRoutingQueue != NULL; }
+    // Used by Server and Forwarder networking threads in place of
+    // tryCacheForward when routing threads are enabled. Takes ownership of
+    // msg, which must have a non-null destination. If the message can't be
+    // forwarded locally or from the cache, fallback is invoked (on a routing
+    // thread) to get it onto the main strand, and routingFallbackFinished must
+    // be called exactly once when it has been routed or dropped, which
+    // routeObjectHostMessage does when told the message is a fallback.
+    void routeOnRoutingThread(Sirikata::Protocol::Object::ObjectMessage* msg, const RoutingFallback& fallback);
+    // Thread safe. Marks a message given to a RoutingFallback as done so later
+    // messages to the same object can take the fast path again.
+    void routingFallbackFinished(const UUID& dest);
+
     // -- Real routing interface + implementation
 
 
     // --- Inputs
   public:
     // Received from OH networking, needs forwarding decision.  Forwards or
-    // drops -- ownership is given to Forwarder either way
-    void routeObjectHostMessage(Sirikata::Protocol::Object::ObjectMessage* obj_msg);
+    // drops -- ownership is given to Forwarder either way. routing_fallback
+    // should be set for messages handed back by a routing thread.
+    void routeObjectHostMessage(Sirikata::Protocol::Object::ObjectMessage* obj_msg, bool routing_fallback = false);
   private:
     // Received from other space server, needs forwarding decision
     void receiveMessage(Message* msg);
@@ -200,15 +267,37 @@ private:
 
     /** Try to forward a message to get it closer to the destination object.
      *  This checks if we have a direct connection to the object, then does an
-     *  OSeg lookup if necessary.
+     *  OSeg lookup if necessary. If routing_fallback is set, the routing
+     *  thread is notified once the lookup has completed and the message has
+     *  been routed or dropped. If this returns false the caller drops the
+     *  message and has to notify it.
      */
     WARN_UNUSED
-    bool forward(Sirikata::Protocol::Object::ObjectMessage* msg, ServerID forwardFrom = NullServerID);
+    bool forward(Sirikata::Protocol::Object::ObjectMessage* msg, ServerID forwardFrom = NullServerID, bool routing_fallback = false);
 
     // This version is provided if you already know which server the message should be sent to
     void routeObjectMessageToServerNoReturn(Sirikata::Protocol::Object::ObjectMessage* msg, const OSegEntry& dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom = NullServerID);
     WARN_UNUSED
     bool routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMessage* msg, const OSegEntry& dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom = NullServerID);
+    // Version of routeObjectMessageToServer for use when the flow scheduler
+    // has already been looked up.
+    bool routeObjectMessageToServer(ODPFlowScheduler* flow_sched, Sirikata::Protocol::Object::ObjectMessage* msg, const OSegEntry& dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom);
+    // Finds the ODPFlowScheduler for a server, allocating it if necessary.
+    // Thread safe.
+    ODPFlowScheduler* getODPFlowScheduler(ServerID dest_server);
+    // Lookup callback used when routing threads are enabled. Routes the message
+    // and lets the routing thread know the fallback completed.
+    void routeObjectMessageAfterFallback(Sirikata::Protocol::Object::ObjectMessage* msg, const OSegEntry& dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom);
+
+    // Routing thread implementation
+    uint32 routingPartitionKey(const UUID& dest) const;
+    void handleRoutingBatch(uint32 partition, RoutingQueue::Batch& batch);
+    void flushRoutingOutbox(RoutingPartition* part);
+    void handleRoutingFallbackFinished(uint32 partition, UUID dest);
+    // Fallback for messages from other space servers, equivalent to
+    // receiveObjectRoutingMessage
+    void forwardFromRoutingThread(Sirikata::Protocol::Object::ObjectMessage* msg, ServerID forwardFrom);
+    void handleForwardFromRoutingThread(Sirikata::Protocol::Object::ObjectMessage* msg, ServerID forwardFrom);
 
     // Dispatches a message destined for the space server itself
     void dispatchMessage(Sirikata::Protocol::Object::ObjectMessage* msg) const;
@@ -103,7 +103,7 @@ bool LocalForwarder::tryForward(Sirikata::Protocol::Object::ObjectMessage* msg)
         TIMESTAMP_END(tstamp, Trace::DROPPED_AT_FORWARDED_LOCALLY);
         TRACE_DROP(DROPPED_AT_FORWARDED_LOCALLY);
         // FIXME do anything on failure?
-        delete msg;
+        releaseObjectMessage(msg);
     }
     else {
         mNumForwarded++;
@@ -57,6 +57,8 @@ void InitSpaceOptions() {
         .addOption(new OptionValue(SERVER_ODP_FLOW_SCHEDULER, "region", Sirikata::OptionValueType<String>(), "The type of ODPFlowScheduler to use for routing."))
         .addOption(new OptionValue(FORWARDER_RECEIVE_QUEUE_SIZE, "16384", Sirikata::OptionValueType<uint32>(), "The type of ODPFlowScheduler to use for routing."))
         .addOption(new OptionValue(FORWARDER_SEND_QUEUE_SIZE, "65536", Sirikata::OptionValueType<uint32>(), "The type of ODPFlowScheduler to use for routing."))
+        .addOption(new OptionValue(FORWARDER_ROUTING_THREADS, "0", Sirikata::OptionValueType<uint32>(), "Number of threads to make routing decisions for object messages on, partitioned by destination object. 0 routes on the networking and main threads."))
+        .addOption(new OptionValue(FORWARDER_ROUTING_BATCH_SIZE, "64", Sirikata::OptionValueType<uint32>(), "Maximum number of object messages a routing thread handles before merging them into the outgoing server queues."))
 
         .addOption(new OptionValue(NETWORK_TYPE, "tcp", Sirikata::OptionValueType<String>(), "The networking subsystem to use."))
 
@@ -64,16 +66,19 @@ void InitSpaceOptions() {
         .addOption(new OptionValue(OSEG_OPTIONS,"",Sirikata::OptionValueType<String>(),"Specifies arguments to OSeg."))
 
         .addOption(new OptionValue(OSEG_LOOKUP_QUEUE_SIZE, "2000", Sirikata::OptionValueType<uint32>(), "Number of new lookups you can have on oseg lookup queue."))
+        .addOption(new OptionValue(OSEG_LOOKUP_QUEUE_BYTES, "0", Sirikata::OptionValueType<uint32>(), "Maximum total size of messages waiting on OSeg lookups. The oldest messages are dropped to stay under it. 0 for no limit."))
+        .addOption(new OptionValue(OSEG_LOOKUP_BATCH_SIZE, "0", Sirikata::OptionValueType<uint32>(), "Maximum number of OSeg lookups to coalesce into a single request to the OSeg. 0 issues each lookup immediately."))
 
         .addOption(new OptionValue(OSEG_CACHE_SIZE, "200", Sirikata::OptionValueType<uint32>(), "Maximum number of entries in the OSeg cache."))
 
-        .addOption(new OptionValue(CACHE_SELECTOR,CACHE_TYPE_ORIGINAL_LRU,Sirikata::OptionValueType<String>(),"Which caching algorithm to use."))
+        .addOption(new OptionValue(CACHE_SELECTOR,CACHE_TYPE_SHARDED,Sirikata::OptionValueType<String>(),"Which caching algorithm to use."))
 
          .addOption(new OptionValue(CACHE_COMM_SCALING,"1.0",Sirikata::OptionValueType<double>(),"What the communication falloff function scaling factor is."))
          .addOption(new OptionValue("send-capacity-overestimate","80000",Sirikata::OptionValueType<double>(),"How much to overestimate send capacity when queue is not blocked."))
          .addOption(new OptionValue("receive-capacity-overestimate","1",Sirikata::OptionValueType<double>(),"How much to overestimate recv capacity when queue is not blocked."))
         .addOption(new OptionValue(OSEG_CACHE_CLEAN_GROUP_SIZE, "25", Sirikata::OptionValueType<uint32>(), "Number of items to remove from the OSeg cache when it reaches the maximum size."))
         .addOption(new OptionValue(OSEG_CACHE_ENTRY_LIFETIME, "8s", Sirikata::OptionValueType<Duration>(), "Maximum lifetime for an OSeg cache entry."))
+        .addOption(new OptionValue(OSEG_CACHE_SHARDS, "16", Sirikata::OptionValueType<uint32>(), "Number of shards to split the OSeg cache into when using cache_sharded."))
 
         .addOption(new OptionValue(CSEG, "uniform", Sirikata::OptionValueType<String>(), "Type of Coordinate Segmentation implementation to use."))
         .addOption(new OptionValue("cseg-service-host", "meru00", Sirikata::OptionValueType<String>(), "Hostname of machine running the CSEG service (running with --cseg=distributed)"))
@@ -103,6 +108,8 @@ void InitSpaceOptions() {
         .addOption(new OptionValue(OPT_AGGMGR_ACCESS_KEY, "", Sirikata::OptionValueType<String>(), "AggregateManager upload OAuth access key"))
         .addOption(new OptionValue(OPT_AGGMGR_ACCESS_SECRET, "", Sirikata::OptionValueType<String>(), "AggregateManager upload OAuth access secret"))
         .addOption(new OptionValue(OPT_AGGMGR_USERNAME, "", Sirikata::OptionValueType<String>(), "AggregateManager upload CDN username"))
+        .addOption(new OptionValue(OPT_AGGMGR_CACHE_PATH, "aggregate_mesh_cache.log", Sirikata::OptionValueType<String>(), "File to keep AggregateManager's cache of generated meshes in across restarts, or empty to only keep it in memory"))
+        .addOption(new OptionValue(OPT_AGGMGR_CACHE_SIZE, "268435456", Sirikata::OptionValueType<uint64>(), "Maximum total size of the meshes in AggregateManager's cache, in bytes"))
 
       ;
 }
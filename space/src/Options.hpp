@@ -60,18 +60,24 @@
 #define OSEG_CACHE_SIZE              "oseg-cache-size"
 #define OSEG_CACHE_CLEAN_GROUP_SIZE  "oseg-cache-clean-group-size"
 #define OSEG_CACHE_ENTRY_LIFETIME    "oseg-cache-entry-lifetime"
+#define OSEG_CACHE_SHARDS            "oseg-cache-shards"
 
 #define CACHE_SELECTOR              "oseg-cache-selector"
 #define CACHE_TYPE_COMMUNICATION    "cache_communication"
 #define CACHE_TYPE_ORIGINAL_LRU     "cache_originallru"
+#define CACHE_TYPE_SHARDED          "cache_sharded"
 
 
 #define CACHE_COMM_SCALING          "oseg-cache-scaling"
 
 #define FORWARDER_SEND_QUEUE_SIZE "forwarder.send-queue-size"
 #define FORWARDER_RECEIVE_QUEUE_SIZE "forwarder.receive-queue-size"
+#define FORWARDER_ROUTING_THREADS "forwarder.routing-threads"
+#define FORWARDER_ROUTING_BATCH_SIZE "forwarder.routing-batch-size"
 
 #define OSEG_LOOKUP_QUEUE_SIZE     "oseg_lookup_queue_size"
+#define OSEG_LOOKUP_QUEUE_BYTES    "oseg-lookup-queue-bytes"
+#define OSEG_LOOKUP_BATCH_SIZE     "oseg-lookup-batch-size"
 
 #define OPT_PROX                   "prox"
 #define OPT_PROX_OPTIONS           "prox-options"
@@ -86,6 +92,8 @@
 #define OPT_AGGMGR_ACCESS_KEY        "aggmgr.access-key"
 #define OPT_AGGMGR_ACCESS_SECRET     "aggmgr.access-secret"
 #define OPT_AGGMGR_USERNAME          "aggmgr.username"
+#define OPT_AGGMGR_CACHE_PATH        "aggmgr.cache-path"
+#define OPT_AGGMGR_CACHE_SIZE        "aggmgr.cache-size"
 
 namespace Sirikata {
 
@@ -349,34 +349,51 @@ bool Server::onObjectHostMessageReceived(const ObjectHostConnectionID& conn_id,
     // 4. Try to shortcut them main thread. Use forwarder to try to forward
     // using the cache. FIXME when we do this, we skip over some checks that
     // happen during the full forwarding
+    // With routing threads, the Forwarder does this on the routing thread for
+    // the destination, and only gives it back to us (step 5) if it needs the
+    // main thread.
+    if (mForwarder->routingThreadsEnabled() && obj_msg->dest_object() != UUID::null()) {
+        mForwarder->routeOnRoutingThread(
+            obj_msg,
+            std::tr1::bind(&Server::queueObjectHostMessageRouting, this, conn_id, std::tr1::placeholders::_1, true)
+        );
+        return true;
+    }
     if (mForwarder->tryCacheForward(obj_msg))
         return true;
 
     // 5. Otherwise, we're going to have to ship this to the main thread, either
     // for handling session messages, messages to the space, or to make a
     // routing decision.
+    queueObjectHostMessageRouting(conn_id, obj_msg);
+
+    // NOTE: We always "accept" the data, even if we're just dropping
+    // it.  This keeps packets flowing.  We could use flow control to
+    // slow things down, but since the data path splits in this method
+    // between local and remote, we don't want to slow the local
+    // packets just because of a backup in routing.
+    return true;
+}
+
+void Server::queueObjectHostMessageRouting(const ObjectHostConnectionID& conn_id, Sirikata::Protocol::Object::ObjectMessage* obj_msg, bool routing_fallback) {
     bool hit_empty;
     bool push_for_processing_success;
     {
         boost::lock_guard<boost::mutex> lock(mRouteObjectMessageMutex);
         hit_empty = (mRouteObjectMessage.probablyEmpty());
-        push_for_processing_success = mRouteObjectMessage.push(ConnectionIDObjectMessagePair(conn_id,obj_msg),false);
+        push_for_processing_success = mRouteObjectMessage.push(ConnectionIDObjectMessagePair(conn_id,obj_msg,routing_fallback),false);
     }
     if (!push_for_processing_success) {
+        UUID dest_object = obj_msg->dest_object();
         TIMESTAMP(obj_msg, Trace::SPACE_DROPPED_AT_MAIN_STRAND_CROSSING);
         TRACE_DROP(SPACE_DROPPED_AT_MAIN_STRAND_CROSSING);
         delete obj_msg;
+        if (routing_fallback)
+            mForwarder->routingFallbackFinished(dest_object);
     } else {
         if (hit_empty)
             scheduleObjectHostMessageRouting();
     }
-
-    // NOTE: We always "accept" the data, even if we're just dropping
-    // it.  This keeps packets flowing.  We could use flow control to
-    // slow things down, but since the data path splits in this method
-    // between local and remote, we don't want to slow the local
-    // packets just because of a backup in routing.
-    return true;
 }
 
 void Server::onObjectHostConnected(const ObjectHostConnectionID& conn_id, const ShortObjectHostConnectionID short_conn_id, OHDPSST::Stream::Ptr stream) {
@@ -433,6 +450,8 @@ bool Server::handleSingleObjectHostMessageRouting() {
         UUID dest_object = front.obj_msg->dest_object();
         if (dest_object != ohdp_ID) {
             delete front.obj_msg;
+            if (front.routing_fallback)
+                mForwarder->routingFallbackFinished(dest_object);
             return true;
         }
 
@@ -475,14 +494,17 @@ bool Server::handleSingleObjectHostMessageRouting() {
             SILOG(cbr,warn,"Server got message from object after migration started: " << source_object.toString());
         }
 
+        UUID dest_object = front.obj_msg->dest_object();
         delete front.obj_msg;
+        if (front.routing_fallback)
+            mForwarder->routingFallbackFinished(dest_object);
 
         return true;
     }
 
 
     // Finally, if we've passed all these tests, then everything looks good and we can route it
-    mForwarder->routeObjectHostMessage(front.obj_msg);
+    mForwarder->routeObjectHostMessage(front.obj_msg, front.routing_fallback);
     return true;
 }
 
@@ -582,8 +604,17 @@ void Server::handleConnect(const ObjectHostConnectionID& oh_conn_id, const Sirik
     TimedMotionVector3f loc( mContext->simTime(), MotionVector3f(connect_msg.loc().position(), connect_msg.loc().velocity()) );
     Vector3f curpos = loc.extrapolate(mContext->simTime()).position();
     bool in_server_region = mMigrationMonitor->onThisServer(curpos);
-    ServerID loc_server = mCSeg->lookup(curpos);
+    // Cache misses have to go to the CSeg server, so don't block the main
+    // strand waiting for them.
+    mCSeg->asyncLookup(
+        curpos,
+        mContext->mainStrand->wrap(
+            std::tr1::bind(&Server::handleConnectLookupResponse, this, oh_conn_id, obj_id, connect_msg, seqno, in_server_region, std::tr1::placeholders::_1)
+        )
+    );
+}
 
+void Server::handleConnectLookupResponse(const ObjectHostConnectionID& oh_conn_id, const UUID& obj_id, const Sirikata::Protocol::Session::Connect& connect_msg, uint64 seqno, bool in_server_region, ServerID loc_server) {
     if(loc_server == NullServerID || (loc_server == mContext->id() && !in_server_region)) {
         // Either CSeg says no server handles the specified region or
         // that we should, but it doesn't actually land in our region
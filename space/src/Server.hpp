@@ -146,6 +146,11 @@ private:
 
     // Handle an object host closing its connection
     void handleObjectHostConnectionClosed(const ObjectHostConnectionID& conn_id);
+    // Queue a message from the object host for routing on the main thread.
+    // Called from networking threads and Forwarder routing threads. Messages
+    // handed back by a routing thread are marked as routing_fallback, and the
+    // Forwarder must be told once they've been routed or dropped.
+    void queueObjectHostMessageRouting(const ObjectHostConnectionID& conn_id, Sirikata::Protocol::Object::ObjectMessage* obj_msg, bool routing_fallback = false);
     // Schedule main thread to handle oh message routing
     void scheduleObjectHostMessageRouting();
     void handleObjectHostMessageRouting();
@@ -158,6 +163,7 @@ private:
     void handleSessionMessage(const ObjectHostConnectionID& oh_conn_id, Sirikata::Protocol::Object::ObjectMessage* msg);
     // Handle Connect message from object
     void handleConnect(const ObjectHostConnectionID& oh_conn_id, const Sirikata::Protocol::Object::ObjectMessage& container, const Sirikata::Protocol::Session::Connect& connect_msg, uint64 seqno);
+    void handleConnectLookupResponse(const ObjectHostConnectionID& oh_conn_id, const UUID& obj_id, const Sirikata::Protocol::Session::Connect& connect_msg, uint64 seqno, bool in_server_region, ServerID loc_server);
     void handleConnectAuthResponse(const ObjectHostConnectionID& oh_conn_id, const UUID& obj_id, const Sirikata::Protocol::Session::Connect& connect_msg, uint64 seqno, bool authenticated);
 
     void sendConnectSuccess(const ObjectHostConnectionID& oh_conn_id, const UUID& obj_id, uint64 session_request_seqno);
@@ -266,9 +272,12 @@ private:
     struct ConnectionIDObjectMessagePair{
         ObjectHostConnectionID conn_id;
         Sirikata::Protocol::Object::ObjectMessage* obj_msg;
-        ConnectionIDObjectMessagePair(ObjectHostConnectionID conn_id, Sirikata::Protocol::Object::ObjectMessage*msg) {
+        // Whether this was counted as a fallback by a Forwarder routing thread
+        bool routing_fallback;
+        ConnectionIDObjectMessagePair(ObjectHostConnectionID conn_id, Sirikata::Protocol::Object::ObjectMessage*msg, bool routing_fallback = false) {
             this->conn_id=conn_id;
             this->obj_msg=msg;
+            this->routing_fallback=routing_fallback;
         }
         size_t size() const{
             return 1;
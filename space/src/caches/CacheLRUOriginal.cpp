@@ -184,7 +184,7 @@ namespace Sirikata
   }
 
 
-  const OSegEntry& CacheLRUOriginal::get(const UUID& uuid)
+  OSegEntry CacheLRUOriginal::get(const UUID& uuid)
   {
       boost::lock_guard<boost::mutex> lck(mMutex);
 
@@ -198,8 +198,7 @@ namespace Sirikata
         return idRecMapIter->second->sID;
       }
     }
-    static OSegEntry justnothin(OSegEntry::null());
-    return justnothin;
+    return OSegEntry::null();
   }
 
   //delete the data;
@@ -63,7 +63,7 @@ namespace Sirikata
       virtual ~CommunicationCache() {}
 
     virtual void insert(const UUID& uuid, const OSegEntry& sID);
-    virtual const OSegEntry& get(const UUID& uuid);
+    virtual OSegEntry get(const UUID& uuid);
     virtual void remove(const UUID& oid);
 
   };
@@ -66,6 +66,8 @@
 #include <sirikata/space/ObjectSegmentation.hpp>
 #include "caches/CommunicationCache.hpp"
 #include "caches/CacheLRUOriginal.hpp"
+#include <sirikata/space/ShardedOSegCache.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <sirikata/space/SpaceContext.hpp>
 #include <sirikata/mesh/Filter.hpp>
@@ -275,6 +277,17 @@ int main(int argc, char** argv) {
         Duration entryLifetime = GetOptionValue<Duration>(OSEG_CACHE_ENTRY_LIFETIME);
         oseg_cache = new CacheLRUOriginal(space_context, cacheSize, cacheCleanGroupSize, entryLifetime);
     }
+    else if (cacheSelector == CACHE_TYPE_SHARDED) {
+        Duration entryLifetime = GetOptionValue<Duration>(OSEG_CACHE_ENTRY_LIFETIME);
+        uint32 cacheShards = GetOptionValue<uint32>(OSEG_CACHE_SHARDS);
+        ShardedOSegCache* sharded_cache = new ShardedOSegCache(
+            space_context,
+            String("space.server") + boost::lexical_cast<String>(server_id) + ".oseg.cache",
+            cacheSize, entryLifetime, cacheShards
+        );
+        space_context->add(sharded_cache);
+        oseg_cache = sharded_cache;
+    }
     else {
         std::cout<<"\n\nUNKNOWN CACHE TYPE SELECTED.  Please re-try.\n\n";
         std::cout.flush();
@@ -300,6 +313,8 @@ int main(int argc, char** argv) {
     String aggmgr_access_key = GetOptionValue<String>(OPT_AGGMGR_ACCESS_KEY);
     String aggmgr_access_secret = GetOptionValue<String>(OPT_AGGMGR_ACCESS_SECRET);
     String aggmgr_username = GetOptionValue<String>(OPT_AGGMGR_USERNAME);
+    String aggmgr_cache_path = GetOptionValue<String>(OPT_AGGMGR_CACHE_PATH);
+    uint64 aggmgr_cache_size = GetOptionValue<uint64>(OPT_AGGMGR_CACHE_SIZE);
     Transfer::OAuthParamsPtr aggmgr_oauth;
     // Currently you need to explicitly override hostname to enable upload
     if (!aggmgr_hostname.empty()&&
@@ -313,7 +328,7 @@ int main(int argc, char** argv) {
             )
         );
     }
-    AggregateManager* aggmgr = new AggregateManager(loc_service, aggmgr_oauth, aggmgr_username);
+    AggregateManager* aggmgr = new AggregateManager(loc_service, aggmgr_oauth, aggmgr_username, aggmgr_cache_path, aggmgr_cache_size);
 
     std::string prox_type = GetOptionValue<String>(OPT_PROX);
     std::string prox_options = GetOptionValue<String>(OPT_PROX_OPTIONS);
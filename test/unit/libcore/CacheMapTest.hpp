@@ -0,0 +1,228 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/transfer/CacheMap.hpp>
+#include <sirikata/core/transfer/LRUPolicy.hpp>
+#include <sirikata/core/transfer/SegmentedLRUPolicy.hpp>
+#include <sirikata/core/transfer/ClockProPolicy.hpp>
+#include <sirikata/core/transfer/TinyLFUPolicy.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::Transfer;
+
+namespace {
+
+// Cache layer storing nothing but the entries' sizes, so tests can drive a
+// CacheMap and its policy directly.
+class SizeOnlyCacheLayer : public CacheLayer {
+public:
+    SizeOnlyCacheLayer(CachePolicy* policy, uint32 shards)
+     : CacheLayer(NULL),
+       mMap(NULL, policy, shards)
+    {
+        mMap.setOwner(this);
+    }
+
+    bool add(const Fingerprint& id, cache_usize_type size) {
+        CacheMap::write_iterator writer(mMap);
+        if (!mMap.alloc(id, size, writer))
+            return false;
+        if (writer.insert(id, size))
+            *writer = new CacheEntry();
+        return true;
+    }
+
+    bool touch(const Fingerprint& id) {
+        CacheMap::read_iterator reader(mMap);
+        if (!reader.find(id))
+            return false;
+        reader.use();
+        return true;
+    }
+
+    bool has(const Fingerprint& id) {
+        CacheMap::read_iterator reader(mMap);
+        return reader.find(id);
+    }
+
+    cache_usize_type totalSize() {
+        cache_usize_type total = 0;
+        CacheMap::read_iterator reader(mMap);
+        while(reader.iterate())
+            total += reader.getSize();
+        return total;
+    }
+
+protected:
+    virtual void destroyCacheEntry(const Fingerprint &fileId, CacheEntry *cacheLayerData, cache_usize_type releaseSize) {
+        delete cacheLayerData;
+    }
+
+private:
+    CacheMap mMap;
+};
+
+Fingerprint fingerprintFor(uint32 i) {
+    return SHA256::computeDigest(&i, sizeof(i));
+}
+
+}
+
+class CacheMapTest : public CxxTest::TestSuite
+{
+    std::vector<Fingerprint> mIds;
+
+    // State for the concurrent tests
+    SizeOnlyCacheLayer* mConcurrentCache;
+    uint32 mOpsPerThread;
+
+    void concurrentMain(uint32 seed) {
+        uint32 rand = seed;
+        for(uint32 i = 0; i < mOpsPerThread; i++) {
+            rand = rand * 1103515245 + 12345;
+            // Skew towards low ids, so some entries are much more popular
+            uint32 range = ((rand >> 16) & 1) ? 64 : mIds.size();
+            const Fingerprint& id = mIds[(rand >> 17) % range];
+            if (!mConcurrentCache->touch(id))
+                mConcurrentCache->add(id, 1);
+        }
+    }
+
+    double runConcurrent(CachePolicy* policy, uint32 shards, uint32 nthreads) {
+        static const cache_usize_type CAPACITY = 256;
+        mConcurrentCache = new SizeOnlyCacheLayer(policy, shards);
+
+        Time start = Timer::now();
+        std::vector<Thread*> threads;
+        for(uint32 i = 0; i < nthreads; i++)
+            threads.push_back(new Thread("CacheMapTest", std::tr1::bind(&CacheMapTest::concurrentMain, this, i+1)));
+        for(uint32 i = 0; i < nthreads; i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+        double secs = (Timer::now() - start).toSeconds();
+
+        // Space is reserved separately from inserting, so concurrent inserts
+        // can overshoot by one entry each.
+        TS_ASSERT(mConcurrentCache->totalSize() <= CAPACITY + nthreads);
+
+        delete mConcurrentCache;
+        mConcurrentCache = NULL;
+        delete policy;
+        return secs;
+    }
+
+public:
+    void setUp() {
+        if (mIds.empty()) {
+            for(uint32 i = 0; i < 1024; i++)
+                mIds.push_back(fingerprintFor(i));
+        }
+        mOpsPerThread = 20000;
+    }
+
+    void testLRUEvictsLeastRecentlyUsed(void) {
+        LRUPolicy policy(100);
+        SizeOnlyCacheLayer cache(&policy, 4);
+
+        TS_ASSERT(cache.add(mIds[0], 30));
+        TS_ASSERT(cache.add(mIds[1], 30));
+        TS_ASSERT(cache.add(mIds[2], 30));
+        TS_ASSERT(cache.touch(mIds[0]));
+        TS_ASSERT(cache.add(mIds[3], 30));
+
+        TS_ASSERT(cache.has(mIds[0]));
+        TS_ASSERT(!cache.has(mIds[1]));
+        TS_ASSERT(cache.has(mIds[2]));
+        TS_ASSERT(cache.has(mIds[3]));
+        TS_ASSERT_EQUALS(cache.totalSize(), (cache_usize_type)90);
+
+        // Too big to cache at all
+        TS_ASSERT(!cache.add(mIds[4], 60));
+    }
+
+    void testSegmentedLRUSurvivesScan(void) {
+        SegmentedLRUPolicy policy(100, 0.5, 0.5);
+        SizeOnlyCacheLayer cache(&policy, 4);
+
+        // Used twice, so protected
+        TS_ASSERT(cache.add(mIds[0], 30));
+        TS_ASSERT(cache.touch(mIds[0]));
+
+        for(uint32 i = 1; i < 10; i++)
+            TS_ASSERT(cache.add(mIds[i], 30));
+
+        TS_ASSERT(cache.has(mIds[0]));
+        TS_ASSERT(!cache.has(mIds[1]));
+        TS_ASSERT(cache.has(mIds[9]));
+    }
+
+    void testClockProSurvivesScan(void) {
+        ClockProPolicy policy(100);
+        SizeOnlyCacheLayer cache(&policy, 4);
+
+        for(uint32 i = 0; i < 5; i++)
+            TS_ASSERT(cache.add(mIds[i], 20));
+        // Referenced during its test period, so it becomes hot instead of
+        // being evicted
+        TS_ASSERT(cache.touch(mIds[0]));
+        TS_ASSERT(cache.add(mIds[5], 20));
+        TS_ASSERT(cache.has(mIds[0]));
+        TS_ASSERT(!cache.has(mIds[1]));
+
+        // Requested again soon after being evicted, so it comes back hot
+        TS_ASSERT(cache.add(mIds[1], 20));
+
+        for(uint32 i = 10; i < 30; i++)
+            TS_ASSERT(cache.add(mIds[i], 20));
+        TS_ASSERT(cache.has(mIds[0]));
+        TS_ASSERT(cache.has(mIds[1]));
+        TS_ASSERT(cache.has(mIds[29]));
+        TS_ASSERT(cache.totalSize() <= (cache_usize_type)100);
+    }
+
+    void testTinyLFURejectsUnpopular(void) {
+        TinyLFUPolicy policy(new LRUPolicy(100), 64);
+        SizeOnlyCacheLayer cache(&policy, 4);
+
+        for(uint32 i = 0; i < 3; i++) {
+            TS_ASSERT(cache.add(mIds[i], 30));
+            for(uint32 j = 0; j < 3; j++)
+                TS_ASSERT(cache.touch(mIds[i]));
+        }
+
+        // Never seen before, so less popular than anything it would replace
+        TS_ASSERT(!cache.add(mIds[3], 30));
+        TS_ASSERT(cache.has(mIds[0]));
+        TS_ASSERT(cache.has(mIds[1]));
+        TS_ASSERT(cache.has(mIds[2]));
+
+        // Until it has been requested enough times
+        bool admitted = false;
+        for(uint32 i = 0; i < 10 && !admitted; i++)
+            admitted = cache.add(mIds[3], 30);
+        TS_ASSERT(admitted);
+        TS_ASSERT(cache.has(mIds[3]));
+        TS_ASSERT(!cache.has(mIds[0]));
+    }
+
+    void testConcurrentPolicies(void) {
+        runConcurrent(new LRUPolicy(256), CacheMap::DEFAULT_SHARDS, 8);
+        runConcurrent(new SegmentedLRUPolicy(256), CacheMap::DEFAULT_SHARDS, 8);
+        runConcurrent(new ClockProPolicy(256), CacheMap::DEFAULT_SHARDS, 8);
+        runConcurrent(new TinyLFUPolicy(new ClockProPolicy(256), 256), CacheMap::DEFAULT_SHARDS, 8);
+    }
+
+    void testConcurrentThroughput(void) {
+        static const uint32 NTHREADS = 8;
+        mOpsPerThread = 100000;
+        double single = runConcurrent(new LRUPolicy(256), 1, NTHREADS);
+        double sharded = runConcurrent(new LRUPolicy(256), CacheMap::DEFAULT_SHARDS, NTHREADS);
+        uint64 ops = (uint64)NTHREADS * mOpsPerThread;
+        SILOG(transfer,info,"[CacheMapTest] " << NTHREADS << " threads, " << (ops / single) << " ops/s with one shard, " << (ops / sharded) << " ops/s with " << CacheMap::DEFAULT_SHARDS);
+    }
+};
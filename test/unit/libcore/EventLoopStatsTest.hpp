@@ -0,0 +1,177 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/trace/LatencyHistogram.hpp>
+#include <sirikata/core/network/EventLoopStats.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <cstring>
+
+using namespace Sirikata;
+using namespace Sirikata::Network;
+using Sirikata::Trace::LatencyHistogram;
+
+namespace {
+
+void emptyHandler() {
+}
+
+const EventLoopStats::TagStats* findTag(const EventLoopStats::TagStatsList& stats, const String& tag) {
+    for(uint32 i = 0; i < stats.size(); i++)
+        if (stats[i].tag == tag) return &stats[i];
+    return NULL;
+}
+
+}
+
+class EventLoopStatsTest : public CxxTest::TestSuite
+{
+public:
+    void tearDown() {
+        EventLoopStats::setEnabled(false);
+    }
+
+    void testHistogramBuckets() {
+        // Every latency falls within the bounds of its bucket, and buckets
+        // cover the range without gaps
+        for(uint64 us = 0; us < 100000; us += (us < 1000 ? 1 : 997)) {
+            uint32 b = LatencyHistogram::bucketFor(us);
+            TS_ASSERT(LatencyHistogram::bucketLower(b) <= us);
+            TS_ASSERT(us <= LatencyHistogram::bucketUpper(b));
+        }
+        for(uint32 b = 0; b + 1 < LatencyHistogram::NUM_BUCKETS; b++)
+            TS_ASSERT_EQUALS(LatencyHistogram::bucketUpper(b) + 1, LatencyHistogram::bucketLower(b + 1));
+        TS_ASSERT_EQUALS(LatencyHistogram::bucketFor((uint64)1 << 40), (uint32)LatencyHistogram::NUM_BUCKETS - 1);
+    }
+
+    void testHistogramPercentiles() {
+        LatencyHistogram hist;
+        for(uint64 us = 1; us <= 100; us++)
+            hist.add(us);
+        TS_ASSERT_EQUALS(hist.count(), (uint64)100);
+        TS_ASSERT_EQUALS(hist.max().toMicro(), 100);
+        TS_ASSERT_EQUALS(hist.mean().toMicro(), 50);
+        // Upper bounds, within a bucket (25%) of the exact values
+        int64 p50 = hist.percentile(0.5).toMicro();
+        TS_ASSERT(p50 >= 50 && p50 <= 63);
+        int64 p99 = hist.percentile(0.99).toMicro();
+        TS_ASSERT(p99 >= 99 && p99 <= 100);
+    }
+
+    void testHistogramMergeSubtract() {
+        LatencyHistogram a, b;
+        for(uint32 i = 0; i < 10; i++) a.add((uint64)5);
+        for(uint32 i = 0; i < 10; i++) b.add((uint64)500);
+
+        LatencyHistogram total(a);
+        total.merge(b);
+        TS_ASSERT_EQUALS(total.count(), (uint64)20);
+        TS_ASSERT_EQUALS(total.max().toMicro(), 500);
+
+        total.subtract(a);
+        TS_ASSERT_EQUALS(total.count(), (uint64)10);
+        TS_ASSERT_EQUALS(total.bucket(LatencyHistogram::bucketFor(5)), (uint64)0);
+        TS_ASSERT_EQUALS(total.percentile(0.5).toMicro(), (int64)LatencyHistogram::bucketUpper(LatencyHistogram::bucketFor(500)));
+    }
+
+#ifndef SIRIKATA_TRACK_EVENT_QUEUES
+    void testCountsHandlers() {
+        EventLoopStats::setEnabled(true);
+        IOService* ios = new IOService("EventLoopStatsTest");
+        IOStrand* strand = ios->createStrand("EventLoopStatsTest Strand");
+
+        for(uint32 i = 0; i < 10; i++)
+            ios->post(&emptyHandler, "EventLoopStatsTest::service");
+        for(uint32 i = 0; i < 5; i++)
+            strand->post(&emptyHandler, "EventLoopStatsTest::strand");
+
+        EventLoopStats::TagStatsList stats;
+        ios->eventLoopStats().getStats(stats);
+        const EventLoopStats::TagStats* service_tag = findTag(stats, "EventLoopStatsTest::service");
+        TS_ASSERT(service_tag != NULL);
+        if (service_tag != NULL) {
+            TS_ASSERT_EQUALS(service_tag->queued, (uint64)10);
+            TS_ASSERT_EQUALS(service_tag->handled, (uint64)0);
+        }
+
+        ios->run();
+
+        stats.clear();
+        ios->eventLoopStats().getStats(stats);
+        service_tag = findTag(stats, "EventLoopStatsTest::service");
+        TS_ASSERT(service_tag != NULL);
+        if (service_tag != NULL) {
+            TS_ASSERT_EQUALS(service_tag->queued, (uint64)0);
+            TS_ASSERT_EQUALS(service_tag->handled, (uint64)10);
+            TS_ASSERT_EQUALS(service_tag->wait.count(), (uint64)10);
+            TS_ASSERT_EQUALS(service_tag->run.count(), (uint64)10);
+        }
+        // Strand handlers are only counted by the strand
+        TS_ASSERT(findTag(stats, "EventLoopStatsTest::strand") == NULL);
+
+        stats.clear();
+        strand->eventLoopStats().getStats(stats);
+        const EventLoopStats::TagStats* strand_tag = findTag(stats, "EventLoopStatsTest::strand");
+        TS_ASSERT(strand_tag != NULL);
+        if (strand_tag != NULL)
+            TS_ASSERT_EQUALS(strand_tag->handled, (uint64)5);
+
+        delete strand;
+        delete ios;
+    }
+#endif
+
+    void testRecentStats() {
+        EventLoopStatsPtr stats(new EventLoopStats());
+        for(uint32 i = 0; i < 3; i++)
+            stats->wrap(&emptyHandler, "EventLoopStatsTest::recent")();
+
+        EventLoopStats::TagStatsList recent;
+        stats->getRecentStats(recent);
+        const EventLoopStats::TagStats* tag = findTag(recent, "EventLoopStatsTest::recent");
+        TS_ASSERT(tag != NULL);
+        if (tag != NULL)
+            TS_ASSERT_EQUALS(tag->handled, (uint64)3);
+
+        // Nothing has run since the last call
+        recent.clear();
+        stats->getRecentStats(recent);
+        TS_ASSERT(findTag(recent, "EventLoopStatsTest::recent") == NULL);
+
+        stats->wrap(&emptyHandler, "EventLoopStatsTest::recent")();
+        recent.clear();
+        stats->getRecentStats(recent);
+        tag = findTag(recent, "EventLoopStatsTest::recent");
+        TS_ASSERT(tag != NULL);
+        if (tag != NULL) {
+            TS_ASSERT_EQUALS(tag->handled, (uint64)1);
+            TS_ASSERT_EQUALS(tag->run.count(), (uint64)1);
+        }
+    }
+
+    void testTagsInternedByContent() {
+        // Tags built at runtime may reuse the same buffer for different names
+        EventLoopStatsPtr stats(new EventLoopStats());
+        char tag[64];
+        std::strcpy(tag, "EventLoopStatsTest::first");
+        stats->wrap(&emptyHandler, tag)();
+        std::strcpy(tag, "EventLoopStatsTest::second");
+        stats->wrap(&emptyHandler, tag)();
+        stats->wrap(&emptyHandler, tag)();
+        // And the same name in a different buffer is the same tag
+        stats->wrap(&emptyHandler, String("EventLoopStatsTest::first").c_str())();
+
+        EventLoopStats::TagStatsList all;
+        stats->getStats(all);
+        const EventLoopStats::TagStats* first = findTag(all, "EventLoopStatsTest::first");
+        const EventLoopStats::TagStats* second = findTag(all, "EventLoopStatsTest::second");
+        TS_ASSERT(first != NULL);
+        TS_ASSERT(second != NULL);
+        if (first != NULL)
+            TS_ASSERT_EQUALS(first->handled, (uint64)2);
+        if (second != NULL)
+            TS_ASSERT_EQUALS(second->handled, (uint64)2);
+    }
+};
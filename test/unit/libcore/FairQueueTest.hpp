@@ -136,6 +136,49 @@ public:
         ASSERT_FAIR_QUEUE_POP(test_queue, 0, 2); // t = 8
         ASSERT_FAIR_QUEUE_POP(test_queue, 2, 8); // t = 9
     }
+
+    // Equal finish times are serviced in the order they were computed
+    void testEqualFinishTimes(void) {
+        FairQueue<SizedElem, uint32, SizedElemQueue> test_queue;
+
+        test_queue.addQueue(new SizedElemQueue(1 << 28), 2, 1.f);
+        test_queue.addQueue(new SizedElemQueue(1 << 28), 0, 1.f);
+        test_queue.addQueue(new SizedElemQueue(1 << 28), 1, 1.f);
+
+        test_queue.push(1, new SizedElem(2));
+        test_queue.push(2, new SizedElem(2));
+        test_queue.push(0, new SizedElem(2));
+        ASSERT_FAIR_QUEUE_POP(test_queue, 1, 2);
+        ASSERT_FAIR_QUEUE_POP(test_queue, 2, 2);
+        ASSERT_FAIR_QUEUE_POP(test_queue, 0, 2);
+        TS_ASSERT(test_queue.empty());
+    }
+
+    // Disabled queues are skipped but keep their place
+    void testDisabledQueues(void) {
+        FairQueue<SizedElem, uint32, SizedElemQueue> test_queue;
+
+        test_queue.addQueue(new SizedElemQueue(1 << 28), 0, 1.f);
+        test_queue.addQueue(new SizedElemQueue(1 << 28), 1, 1.f);
+
+        test_queue.push(0, new SizedElem(1));
+        test_queue.push(0, new SizedElem(1));
+        test_queue.push(1, new SizedElem(3));
+
+        test_queue.disableQueue(0);
+        ASSERT_FAIR_QUEUE_POP(test_queue, 1, 3); // t = 3
+
+        // Only disabled queues have data, so nothing comes out but we're not
+        // empty either
+        uint32 key;
+        TS_ASSERT(test_queue.pop(&key) == NULL);
+        TS_ASSERT(!test_queue.empty());
+
+        test_queue.enableQueue(0);
+        ASSERT_FAIR_QUEUE_POP(test_queue, 0, 1); // t = 1
+        ASSERT_FAIR_QUEUE_POP(test_queue, 0, 1); // t = 2
+        TS_ASSERT(test_queue.empty());
+    }
 };
 
 #endif //_SIRIKATA_FAIR_QUEUE_TEST_HPP_
@@ -0,0 +1,459 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/transfer/HttpManager.hpp>
+#include <sirikata/core/network/Address.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/algorithm/string.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::Transfer;
+using boost::asio::ip::tcp;
+
+namespace {
+
+std::string contentFor(uint32 i, uint32 size) {
+    std::string result(size, ' ');
+    uint32 rand = i;
+    for(uint32 j = 0; j < size; j++) {
+        rand = rand * 1103515245 + 12345;
+        // Somewhat compressible, like real content
+        result[j] = (char)('a' + ((rand >> 16) % 8));
+    }
+    return result;
+}
+
+std::string compress(const std::string& data, const std::string& encoding) {
+    std::string result;
+    boost::iostreams::filtering_ostream out;
+    if (encoding == "gzip") {
+        out.push(boost::iostreams::gzip_compressor());
+    }
+    else {
+        boost::iostreams::zlib_params params;
+        params.noheader = (encoding == "rawdeflate");
+        out.push(boost::iostreams::zlib_compressor(params));
+    }
+    out.push(boost::iostreams::back_inserter(result));
+    out.write(data.data(), data.size());
+    out.reset();
+    return result;
+}
+
+// A minimal in-process HTTP/1.1 server which keeps connections alive and
+// answers pipelined requests in order. Each connection is handled by its own
+// thread with blocking IO. The responses depend on the path:
+//  /data/N      N bytes of content, with a Content-Length
+//  /encoded/N   N bytes of content compressed with the first encoding in
+//               Accept-Encoding, or uncompressed if there isn't one
+//  /rawdeflate/N  N bytes compressed with deflate, but without the zlib header
+//  /chunked/N   N bytes of content, with chunked transfer encoding
+//  /close/N     N bytes of content, then the connection is closed
+class LocalHttpServer {
+public:
+    LocalHttpServer()
+     : mAcceptor(mIOService, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+       mStopping(false),
+       mConnections(0),
+       mRequests(0)
+    {
+        mAcceptThread = new Thread("LocalHttpServer", std::tr1::bind(&LocalHttpServer::acceptMain, this));
+    }
+
+    ~LocalHttpServer() {
+        mStopping = true;
+        // Wake up the blocking accept
+        {
+            tcp::socket wakeup(mIOService);
+            boost::system::error_code ec;
+            wakeup.connect(mAcceptor.local_endpoint(), ec);
+        }
+        mAcceptThread->join();
+        delete mAcceptThread;
+
+        std::vector<Thread*> threads;
+        {
+            boost::lock_guard<boost::mutex> lck(mMutex);
+            for(uint32 i = 0; i < mSockets.size(); i++) {
+                boost::system::error_code ec;
+                mSockets[i]->shutdown(tcp::socket::shutdown_both, ec);
+            }
+            threads.swap(mThreads);
+        }
+        for(uint32 i = 0; i < threads.size(); i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+    }
+
+    Network::Address address() {
+        std::ostringstream port;
+        port << mAcceptor.local_endpoint().port();
+        return Network::Address("127.0.0.1", port.str());
+    }
+
+    uint32 connections() {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        return mConnections;
+    }
+
+    uint32 requests() {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        return mRequests;
+    }
+
+    std::string lastAcceptEncoding() {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        return mLastAcceptEncoding;
+    }
+
+private:
+    typedef std::tr1::shared_ptr<tcp::socket> SocketPtr;
+
+    void acceptMain() {
+        while(true) {
+            SocketPtr socket(new tcp::socket(mIOService));
+            boost::system::error_code ec;
+            mAcceptor.accept(*socket, ec);
+            if (mStopping || ec) break;
+
+            boost::lock_guard<boost::mutex> lck(mMutex);
+            mConnections++;
+            mSockets.push_back(socket);
+            mThreads.push_back(new Thread("LocalHttpServer Connection", std::tr1::bind(&LocalHttpServer::connectionMain, this, socket)));
+        }
+    }
+
+    void connectionMain(SocketPtr socket) {
+        std::string buffer;
+        char readBuffer[4096];
+        while(true) {
+            std::size_t headersEnd;
+            while((headersEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+                boost::system::error_code ec;
+                std::size_t len = socket->read_some(boost::asio::buffer(readBuffer), ec);
+                if (ec) return;
+                buffer.append(readBuffer, len);
+            }
+            std::string request = buffer.substr(0, headersEnd);
+            buffer.erase(0, headersEnd + 4);
+            if (!respond(*socket, request)) {
+                boost::system::error_code ec;
+                socket->shutdown(tcp::socket::shutdown_both, ec);
+                return;
+            }
+        }
+    }
+
+    // Returns false if the connection should be closed
+    bool respond(tcp::socket& socket, const std::string& request) {
+        std::vector<std::string> lines;
+        boost::split(lines, request, boost::is_any_of("\r\n"), boost::token_compress_on);
+        std::vector<std::string> requestLine;
+        boost::split(requestLine, lines[0], boost::is_any_of(" "));
+        std::string method = requestLine[0];
+        std::string acceptEncoding;
+        for(uint32 i = 1; i < lines.size(); i++) {
+            if (boost::istarts_with(lines[i], "Accept-Encoding:"))
+                acceptEncoding = boost::trim_copy(lines[i].substr(16));
+        }
+
+        std::vector<std::string> path;
+        boost::split(path, requestLine[1], boost::is_any_of("/"));
+        std::string kind = path[1];
+        uint32 size = path.size() > 2 ? atoi(path[2].c_str()) : 0;
+        std::string body = contentFor(size, size);
+
+        std::ostringstream headers;
+        headers << "HTTP/1.1 200 OK\r\n";
+        if (kind == "encoded" || kind == "rawdeflate") {
+            std::string encoding = acceptEncoding.substr(0, acceptEncoding.find(','));
+            if (kind == "rawdeflate") {
+                body = compress(body, "rawdeflate");
+                headers << "Content-Encoding: deflate\r\n";
+            }
+            else if (!encoding.empty()) {
+                body = compress(body, encoding);
+                headers << "Content-Encoding: " << encoding << "\r\n";
+            }
+        }
+        bool close = (kind == "close");
+        if (close)
+            headers << "Connection: close\r\n";
+
+        std::string response;
+        if (kind == "chunked") {
+            headers << "Transfer-Encoding: chunked\r\n\r\n";
+            response = headers.str();
+            if (method != "HEAD") {
+                for(std::size_t pos = 0; pos < body.size(); pos += 1000) {
+                    std::string chunk = body.substr(pos, 1000);
+                    std::ostringstream chunkHeader;
+                    chunkHeader << std::hex << chunk.size() << "\r\n";
+                    response += chunkHeader.str() + chunk + "\r\n";
+                }
+                response += "0\r\n\r\n";
+            }
+        }
+        else {
+            headers << "Content-Length: " << body.size() << "\r\n\r\n";
+            response = headers.str();
+            if (method != "HEAD")
+                response += body;
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lck(mMutex);
+            mRequests++;
+            mLastAcceptEncoding = acceptEncoding;
+        }
+
+        boost::system::error_code ec;
+        boost::asio::write(socket, boost::asio::buffer(response), ec);
+        return !ec && !close;
+    }
+
+    boost::asio::io_service mIOService;
+    tcp::acceptor mAcceptor;
+    Thread* mAcceptThread;
+    volatile bool mStopping;
+
+    boost::mutex mMutex;
+    std::vector<SocketPtr> mSockets;
+    std::vector<Thread*> mThreads;
+    uint32 mConnections;
+    uint32 mRequests;
+    std::string mLastAcceptEncoding;
+};
+
+}
+
+class HttpManagerTest : public CxxTest::TestSuite
+{
+    typedef HttpManager::HttpResponsePtr HttpResponsePtr;
+
+    // One server for the whole suite. HttpManager is a singleton which keeps
+    // connections open, so a server per test would leave dead connections
+    // counting against its connection limits.
+    LocalHttpServer* mServer;
+
+    struct Result {
+        Result() : done(false), error(HttpManager::SUCCESS), status(0), pieces(0) {}
+        bool done;
+        HttpManager::ERR_TYPE error;
+        unsigned short status;
+        std::string data;
+        // Body as delivered by the body callback
+        std::string streamed;
+        uint32 pieces;
+    };
+    std::vector<Result> mResults;
+    boost::mutex mMutex;
+    boost::condition_variable mDoneCV;
+
+    void requestDone(uint32 idx, HttpResponsePtr response, HttpManager::ERR_TYPE error, const boost::system::error_code& boost_error) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        Result& result = mResults[idx];
+        result.done = true;
+        result.error = error;
+        if (error == HttpManager::SUCCESS) {
+            result.status = response->getStatusCode();
+            if (response->getData())
+                result.data = std::string((const char*)response->getData()->data(), response->getData()->size());
+        }
+        mDoneCV.notify_all();
+    }
+
+    void gotBody(uint32 idx, HttpResponsePtr response, const unsigned char* data, size_t length) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        Result& result = mResults[idx];
+        // Pieces have to arrive before completion
+        TS_ASSERT(!result.done);
+        result.streamed.append((const char*)data, length);
+        result.pieces++;
+    }
+
+    // Issues a GET for each path at once, and waits for all of them
+    void getAll(const std::vector<std::string>& paths, bool streaming = false, HttpManager::Headers headers = HttpManager::Headers()) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        using std::tr1::placeholders::_3;
+
+        mResults.clear();
+        mResults.resize(paths.size());
+        for(uint32 i = 0; i < paths.size(); i++) {
+            HttpManager::HttpBodyCallback body_cb;
+            if (streaming)
+                body_cb = std::tr1::bind(&HttpManagerTest::gotBody, this, i, _1, _2, _3);
+            HttpManager::getSingleton().get(
+                mServer->address(), paths[i],
+                std::tr1::bind(&HttpManagerTest::requestDone, this, i, _1, _2, _3),
+                headers, HttpManager::QueryParameters(), true, body_cb
+            );
+        }
+
+        boost::unique_lock<boost::mutex> lck(mMutex);
+        boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(30);
+        for(uint32 i = 0; i < mResults.size(); i++) {
+            while(!mResults[i].done) {
+                if (!mDoneCV.timed_wait(lck, timeout)) {
+                    TS_FAIL("Timed out waiting for responses");
+                    return;
+                }
+            }
+        }
+    }
+
+    std::string path(const std::string& kind, uint32 size) {
+        std::ostringstream result;
+        result << "/" << kind << "/" << size;
+        return result.str();
+    }
+
+public:
+    HttpManagerTest()
+     : mServer(NULL)
+    {
+    }
+
+    ~HttpManagerTest() {
+        delete mServer;
+    }
+
+    void setUp() {
+        if (mServer == NULL)
+            mServer = new LocalHttpServer();
+    }
+
+    void testKeepAliveAndPipelining(void) {
+        HttpManager::Stats before = HttpManager::getSingleton().getStats();
+        uint32 connectionsBefore = mServer->connections();
+
+        std::vector<std::string> paths;
+        for(uint32 i = 0; i < 40; i++)
+            paths.push_back(path("data", 1000 + i * 100));
+        getAll(paths);
+
+        for(uint32 i = 0; i < paths.size(); i++) {
+            TS_ASSERT_EQUALS(mResults[i].error, HttpManager::SUCCESS);
+            TS_ASSERT_EQUALS(mResults[i].status, 200);
+            TS_ASSERT(mResults[i].data == contentFor(1000 + i * 100, 1000 + i * 100));
+        }
+
+        HttpManager::Stats after = HttpManager::getSingleton().getStats();
+        // Everything went over the few connections allowed to one endpoint
+        TS_ASSERT(mServer->connections() - connectionsBefore <= 2);
+        TS_ASSERT(after.requestsReusingConnection - before.requestsReusingConnection >= paths.size() - 2);
+        TS_ASSERT(after.requestsPipelined > before.requestsPipelined);
+        TS_ASSERT_EQUALS(after.requestsRetried, before.requestsRetried);
+    }
+
+    void testCompressedBodiesAreStreamed(void) {
+        static const uint32 SIZE = 1024*1024;
+        HttpManager::Stats before = HttpManager::getSingleton().getStats();
+
+        std::vector<std::string> paths;
+        paths.push_back(path("encoded", SIZE));
+        paths.push_back(path("rawdeflate", SIZE));
+        getAll(paths, true);
+        TS_ASSERT(mServer->lastAcceptEncoding().find("gzip") != std::string::npos);
+
+        std::string expected = contentFor(SIZE, SIZE);
+        for(uint32 i = 0; i < paths.size(); i++) {
+            TS_ASSERT_EQUALS(mResults[i].error, HttpManager::SUCCESS);
+            TS_ASSERT(mResults[i].data == expected);
+            TS_ASSERT(mResults[i].streamed == expected);
+            // Delivered as it was decoded, not all at the end
+            TS_ASSERT(mResults[i].pieces > 1);
+        }
+
+        HttpManager::Stats after = HttpManager::getSingleton().getStats();
+        TS_ASSERT_EQUALS(after.bodyBytesDecoded - before.bodyBytesDecoded, (uint64)SIZE * 2);
+        TS_ASSERT(after.bodyBytesReceived - before.bodyBytesReceived < (uint64)SIZE);
+    }
+
+    void testZlibDeflate(void) {
+        HttpManager::Headers headers;
+        headers["Accept-Encoding"] = "deflate";
+        std::vector<std::string> paths;
+        paths.push_back(path("encoded", 100000));
+        getAll(paths, true, headers);
+        TS_ASSERT_EQUALS(mServer->lastAcceptEncoding(), "deflate");
+        TS_ASSERT_EQUALS(mResults[0].error, HttpManager::SUCCESS);
+        TS_ASSERT(mResults[0].data == contentFor(100000, 100000));
+        TS_ASSERT(mResults[0].streamed == mResults[0].data);
+    }
+
+    void testRangeRequestsAreNotEncoded(void) {
+        HttpManager::Headers headers;
+        headers["Range"] = "bytes=0-99";
+        std::vector<std::string> paths;
+        paths.push_back(path("encoded", 1000));
+        getAll(paths, false, headers);
+        TS_ASSERT_EQUALS(mServer->lastAcceptEncoding(), "");
+        TS_ASSERT_EQUALS(mResults[0].error, HttpManager::SUCCESS);
+    }
+
+    void testChunkedBodies(void) {
+        std::vector<std::string> paths;
+        for(uint32 i = 0; i < 4; i++)
+            paths.push_back(path("chunked", 5000 + i));
+        getAll(paths, true);
+        for(uint32 i = 0; i < paths.size(); i++) {
+            TS_ASSERT_EQUALS(mResults[i].error, HttpManager::SUCCESS);
+            TS_ASSERT(mResults[i].data == contentFor(5000 + i, 5000 + i));
+            TS_ASSERT(mResults[i].streamed == mResults[i].data);
+        }
+    }
+
+    void testServerClosingConnections(void) {
+        // Requests pipelined behind one the server closes the connection
+        // after have to be sent again on a new connection
+        std::vector<std::string> paths;
+        for(uint32 i = 0; i < 20; i++)
+            paths.push_back(path(i % 5 == 2 ? "close" : "data", 2000 + i));
+        getAll(paths);
+        for(uint32 i = 0; i < paths.size(); i++) {
+            TS_ASSERT_EQUALS(mResults[i].error, HttpManager::SUCCESS);
+            TS_ASSERT(mResults[i].data == contentFor(2000 + i, 2000 + i));
+        }
+    }
+
+    void testHeadOnKeptAliveConnection(void) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        using std::tr1::placeholders::_3;
+
+        mResults.clear();
+        mResults.resize(2);
+        // The HEAD response has a Content-Length but no body, so the GET
+        // behind it must still be parsed correctly
+        HttpManager::getSingleton().head(
+            mServer->address(), path("data", 3000),
+            std::tr1::bind(&HttpManagerTest::requestDone, this, 0, _1, _2, _3)
+        );
+        HttpManager::getSingleton().get(
+            mServer->address(), path("data", 3001),
+            std::tr1::bind(&HttpManagerTest::requestDone, this, 1, _1, _2, _3)
+        );
+
+        boost::unique_lock<boost::mutex> lck(mMutex);
+        boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(30);
+        while(!mResults[0].done || !mResults[1].done) {
+            if (!mDoneCV.timed_wait(lck, timeout)) {
+                TS_FAIL("Timed out waiting for responses");
+                return;
+            }
+        }
+        TS_ASSERT_EQUALS(mResults[0].error, HttpManager::SUCCESS);
+        TS_ASSERT_EQUALS(mResults[0].data, "");
+        TS_ASSERT_EQUALS(mResults[1].error, HttpManager::SUCCESS);
+        TS_ASSERT(mResults[1].data == contentFor(3001, 3001));
+    }
+};
@@ -0,0 +1,143 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/transfer/PackedDiskCacheLayer.hpp>
+#include <sirikata/core/transfer/LRUPolicy.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::Transfer;
+
+class PackedDiskCacheLayerTest : public CxxTest::TestSuite
+{
+    static const uint64 PACK_SIZE = 64*1024;
+
+    std::string mDir;
+    const SparseData* mResult;
+
+    void gotData(const SparseData* data) {
+        mResult = data;
+        mFoundBytes.clear();
+        if (data) {
+            Range::base_type pos = data->startbyte();
+            while (pos < data->endbyte()) {
+                Range::length_type length;
+                const unsigned char* bytes = data->dataAt(pos, length);
+                if (!bytes || length == 0) break;
+                mFoundBytes.append((const char*)bytes, (size_t)length);
+                pos += length;
+            }
+        }
+    }
+    std::string mFoundBytes;
+
+    static Fingerprint idFor(uint32 i) {
+        return SHA256::computeDigest(&i, sizeof(i));
+    }
+
+    static std::string contentFor(uint32 i, uint32 size) {
+        std::string result(size, ' ');
+        for(uint32 j = 0; j < size; j++)
+            result[j] = (char)('a' + (i + j) % 26);
+        return result;
+    }
+
+    static DenseDataPtr dataFor(uint32 i, uint32 size) {
+        return DenseDataPtr(new DenseData(contentFor(i, size)));
+    }
+
+    // Synchronous, since hits are answered immediately and there's no next
+    // layer to wait for on misses
+    bool lookup(CacheLayer* cache, uint32 i, const Range& range = Range(true)) {
+        mResult = NULL;
+        cache->getData(idFor(i), range, std::tr1::bind(&PackedDiskCacheLayerTest::gotData, this, _1));
+        return mResult != NULL;
+    }
+
+public:
+    void setUp() {
+        mDir = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("sirikata-packtest-%%%%%%%%")).string();
+    }
+
+    void tearDown() {
+        boost::filesystem::remove_all(mDir);
+    }
+
+    void testRoundTripAndReload(void) {
+        {
+            LRUPolicy policy(1024*1024);
+            PackedDiskCacheLayer cache(&policy, mDir, NULL, PACK_SIZE);
+            for(uint32 i = 0; i < 50; i++)
+                cache.addToCache(idFor(i), dataFor(i, 1000 + i));
+            cache.sync();
+
+            TS_ASSERT(lookup(&cache, 7));
+            TS_ASSERT_EQUALS(mFoundBytes, contentFor(7, 1007));
+            TS_ASSERT(!lookup(&cache, 500));
+        }
+        // Everything was indexed
+        {
+            LRUPolicy policy(1024*1024);
+            PackedDiskCacheLayer cache(&policy, mDir, NULL, PACK_SIZE);
+            for(uint32 i = 0; i < 50; i++) {
+                TS_ASSERT(lookup(&cache, i));
+                TS_ASSERT_EQUALS(mFoundBytes, contentFor(i, 1000 + i));
+            }
+        }
+    }
+
+    void testRecoversUnindexedRecords(void) {
+        {
+            LRUPolicy policy(1024*1024);
+            PackedDiskCacheLayer cache(&policy, mDir, NULL, PACK_SIZE);
+            cache.addToCache(idFor(1), dataFor(1, 100));
+            cache.sync();
+            cache.addToCache(idFor(2), dataFor(2, 100));
+        }
+        // Lose the index, as if we'd crashed before saving it
+        boost::filesystem::remove(boost::filesystem::path(mDir) / "index");
+        {
+            LRUPolicy policy(1024*1024);
+            PackedDiskCacheLayer cache(&policy, mDir, NULL, PACK_SIZE);
+            TS_ASSERT(lookup(&cache, 1));
+            TS_ASSERT_EQUALS(mFoundBytes, contentFor(1, 100));
+            TS_ASSERT(lookup(&cache, 2));
+            TS_ASSERT_EQUALS(mFoundBytes, contentFor(2, 100));
+        }
+    }
+
+    void testPartialRanges(void) {
+        LRUPolicy policy(1024*1024);
+        PackedDiskCacheLayer cache(&policy, mDir, NULL, PACK_SIZE);
+        std::string content = contentFor(3, 200);
+        cache.addToCache(idFor(3), DenseDataPtr(new DenseData(Range(0, 100, LENGTH), content.substr(0, 100).c_str())));
+        cache.sync();
+        TS_ASSERT(lookup(&cache, 3, Range(0, 50, LENGTH)));
+        TS_ASSERT(!lookup(&cache, 3, Range(50, 100, LENGTH)));
+
+        // Ranges only join up if they overlap
+        cache.addToCache(idFor(3), DenseDataPtr(new DenseData(Range(50, 150, LENGTH, true), content.substr(50).c_str())));
+        cache.sync();
+        TS_ASSERT(lookup(&cache, 3, Range(50, 100, LENGTH)));
+        TS_ASSERT(lookup(&cache, 3, Range(0, 200, LENGTH)));
+        TS_ASSERT_EQUALS(mFoundBytes, content);
+    }
+
+    void testEvictionCompactsPacks(void) {
+        // Room for about a pack and a half of live data, so most of what's
+        // written ends up evicted
+        LRUPolicy policy(PACK_SIZE * 3 / 2);
+        PackedDiskCacheLayer cache(&policy, mDir, NULL, PACK_SIZE);
+        for(uint32 i = 0; i < 400; i++)
+            cache.addToCache(idFor(i), dataFor(i, 1000));
+        cache.sync();
+        cache.compact();
+
+        TS_ASSERT(cache.diskUsage() <= PACK_SIZE * 4);
+        TS_ASSERT(!lookup(&cache, 0));
+        TS_ASSERT(lookup(&cache, 399));
+        TS_ASSERT_EQUALS(mFoundBytes, contentFor(399, 1000));
+    }
+};
@@ -0,0 +1,85 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/network/ParallelTaskRunner.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::Network;
+
+/** Each task fills in its own slot of the results, like the loc update
+ *  policy's shards build their own messages, so running them on several
+ *  threads has to give exactly the same results as running them in order.
+ */
+class ParallelTaskRunnerTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_TASKS = 16,
+        VALUES_PER_TASK = 1000
+    };
+
+    IOServicePool* _pool;
+    std::vector<uint64> _results;
+    std::vector<boost::thread::id> _threads;
+
+    void task(uint32 idx) {
+        uint64 sum = idx;
+        for(uint32 i = 0; i < VALUES_PER_TASK; i++)
+            sum = sum * 6364136223846793005ULL + i;
+        _results[idx] = sum;
+        _threads[idx] = boost::this_thread::get_id();
+    }
+
+    ParallelTaskRunner::TaskList makeTasks(uint32 count) {
+        _results.assign(count, 0);
+        _threads.assign(count, boost::thread::id());
+        ParallelTaskRunner::TaskList tasks;
+        for(uint32 i = 0; i < count; i++)
+            tasks.push_back(std::tr1::bind(&ParallelTaskRunnerTest::task, this, i));
+        return tasks;
+    }
+
+public:
+    void setUp() {
+        _pool = new IOServicePool("ParallelTaskRunnerTest", 3);
+        _pool->startWork();
+        _pool->run();
+    }
+
+    void tearDown() {
+        _pool->join();
+        delete _pool;
+        _pool = NULL;
+    }
+
+    void testParallelMatchesSerial() {
+        ParallelTaskRunner serial(NULL);
+        serial.run(makeTasks(NUM_TASKS));
+        std::vector<uint64> expected = _results;
+
+        // Run repeatedly so the batches end up spread differently across the
+        // threads
+        ParallelTaskRunner parallel(_pool);
+        for(uint32 round = 0; round < 100; round++) {
+            parallel.run(makeTasks(NUM_TASKS));
+            TS_ASSERT(_results == expected);
+        }
+    }
+
+    void testCallerRunsLastTask() {
+        ParallelTaskRunner parallel(_pool);
+        parallel.run(makeTasks(NUM_TASKS));
+        TS_ASSERT(_threads[NUM_TASKS-1] == boost::this_thread::get_id());
+        for(uint32 i = 0; i < NUM_TASKS; i++)
+            TS_ASSERT(_threads[i] != boost::thread::id());
+    }
+
+    void testSmallBatchesRunInline() {
+        ParallelTaskRunner parallel(_pool);
+        parallel.run(makeTasks(0));
+        parallel.run(makeTasks(1));
+        TS_ASSERT(_threads[0] == boost::this_thread::get_id());
+    }
+};
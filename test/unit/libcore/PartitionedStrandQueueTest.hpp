@@ -0,0 +1,150 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/queue/PartitionedStrandQueue.hpp>
+#include <sirikata/core/network/IOServicePool.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+using namespace Sirikata;
+
+/** Drives a PartitionedStrandQueue the way the Forwarder's routing threads do.
+ *  Some messages can be delivered straight from the partition, the rest fall
+ *  back to a separate "main" service which reports back to the partition when
+ *  it's done. While a destination has fallbacks outstanding its later messages
+ *  have to fall back too, or they could overtake the earlier ones.
+ */
+class PartitionedStrandQueueTest : public CxxTest::TestSuite
+{
+    struct Message {
+        uint32 dest;
+        uint32 seq;
+    };
+    typedef PartitionedStrandQueue<Message> Queue;
+    typedef std::map<uint32, uint32> PendingFallbackMap;
+
+    enum {
+        NUM_DESTS = 16,
+        NUM_PER_DEST = 500
+    };
+
+    Queue* mQueue;
+    Network::IOServicePool* mMain;
+    // Only touched on the partition's strand, or after both pools are joined
+    std::vector<PendingFallbackMap> mPending;
+
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    std::vector< std::vector<uint32> > mDelivered;
+    uint32 mNumDelivered;
+    uint32 mNumFallbacks;
+
+    void deliver(const Message& msg) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mDelivered[msg.dest].push_back(msg.seq);
+        mNumDelivered++;
+        mCond.notify_all();
+    }
+
+    void handleBatch(uint32 partition, Queue::Batch& batch) {
+        PendingFallbackMap& pending = mPending[partition];
+        for(uint32 i = 0; i < batch.size(); i++) {
+            const Message& msg = batch[i];
+            // Every third message misses the "cache"
+            if (pending.find(msg.dest) == pending.end() && msg.seq % 3 != 0) {
+                deliver(msg);
+                continue;
+            }
+            pending[msg.dest]++;
+            mMain->service()->post(
+                std::tr1::bind(&PartitionedStrandQueueTest::handleFallback, this, partition, msg),
+                "PartitionedStrandQueueTest::handleFallback"
+            );
+        }
+    }
+
+    void handleFallback(uint32 partition, Message msg) {
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            mNumFallbacks++;
+        }
+        deliver(msg);
+        mQueue->post(
+            partition,
+            std::tr1::bind(&PartitionedStrandQueueTest::handleFallbackFinished, this, partition, msg.dest),
+            "PartitionedStrandQueueTest::handleFallbackFinished"
+        );
+    }
+
+    void handleFallbackFinished(uint32 partition, uint32 dest) {
+        PendingFallbackMap& pending = mPending[partition];
+        PendingFallbackMap::iterator it = pending.find(dest);
+        TS_ASSERT(it != pending.end());
+        if (it == pending.end()) return;
+        if (--(it->second) == 0)
+            pending.erase(it);
+    }
+
+public:
+    void setUp() {
+        mMain = new Network::IOServicePool("PartitionedStrandQueueTest Main", 1);
+        mQueue = new Queue(
+            "PartitionedStrandQueueTest", 2, 4, 8,
+            std::tr1::bind(&PartitionedStrandQueueTest::handleBatch, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2)
+        );
+        mPending.clear();
+        mPending.resize(mQueue->numPartitions());
+        mDelivered.clear();
+        mDelivered.resize(NUM_DESTS);
+        mNumDelivered = 0;
+        mNumFallbacks = 0;
+
+        mMain->startWork();
+        mMain->run();
+        mQueue->start();
+    }
+
+    void tearDown() {
+        delete mQueue;
+        mQueue = NULL;
+        delete mMain;
+        mMain = NULL;
+    }
+
+    void testFallbacksKeepPerDestinationOrder() {
+        // Interleave destinations so every partition has several in flight
+        for(uint32 seq = 0; seq < NUM_PER_DEST; seq++) {
+            for(uint32 dest = 0; dest < NUM_DESTS; dest++) {
+                Message msg;
+                msg.dest = dest;
+                msg.seq = seq;
+                mQueue->push(dest, msg);
+            }
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            while(mNumDelivered < NUM_DESTS * NUM_PER_DEST)
+                mCond.wait(lock);
+        }
+        // Fallbacks finish on the main service, and the last reports back to
+        // the partitions after that. Joining the main pool first lets them all
+        // be posted before the partitions stop.
+        mMain->join();
+        mQueue->stop();
+
+        TS_ASSERT(mNumFallbacks >= NUM_DESTS * NUM_PER_DEST / 3);
+        for(uint32 dest = 0; dest < NUM_DESTS; dest++) {
+            TS_ASSERT_EQUALS(mDelivered[dest].size(), (size_t)NUM_PER_DEST);
+            for(uint32 i = 0; i < mDelivered[dest].size(); i++) {
+                if (mDelivered[dest][i] != i) {
+                    TS_FAIL("Message delivered out of order");
+                    break;
+                }
+            }
+        }
+        for(uint32 i = 0; i < mPending.size(); i++)
+            TS_ASSERT_EQUALS(mPending[i].size(), (size_t)0);
+    }
+};
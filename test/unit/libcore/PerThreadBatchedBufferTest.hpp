@@ -0,0 +1,130 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/trace/PerThreadBatchedBuffer.hpp>
+#include <cstdio>
+
+using namespace Sirikata;
+
+/** Nothing is stored while the test writes, so the writing thread runs out of
+ *  batches exactly as it would if the storage thread fell behind. Records are
+ *  a fixed size so the test knows how many fit in a batch.
+ */
+class PerThreadBatchedBufferTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_BATCHES = 2,
+        RECORD_SIZE = 100,
+        // Records are never split, so the tail of each batch goes unused
+        RECORDS_PER_BATCH = Batch<uint8>::max_size / RECORD_SIZE
+    };
+
+    PerThreadBatchedBuffer* _buf;
+    FILE* _file;
+
+    void writeRecord(uint32 seq) {
+        uint8 padding[RECORD_SIZE - sizeof(uint32)];
+        memset(padding, (int)(seq & 0xff), sizeof(padding));
+        PerThreadBatchedBuffer::IOVec iov[2] = {
+            PerThreadBatchedBuffer::IOVec(&seq, sizeof(seq)),
+            PerThreadBatchedBuffer::IOVec(padding, sizeof(padding))
+        };
+        _buf->write(iov, 2);
+    }
+
+    // Stores everything written so far and returns the sequence numbers of
+    // the records that came out, checking each one is intact
+    std::vector<uint32> storeRecords() {
+        _buf->store(_file);
+        fflush(_file);
+
+        std::vector<uint32> seqs;
+        long size = ftell(_file);
+        TS_ASSERT_EQUALS(size % RECORD_SIZE, 0);
+        rewind(_file);
+        uint8 record[RECORD_SIZE];
+        while(fread(record, 1, RECORD_SIZE, _file) == RECORD_SIZE) {
+            uint32 seq;
+            memcpy(&seq, record, sizeof(seq));
+            for(uint32 i = sizeof(seq); i < RECORD_SIZE; i++) {
+                if (record[i] != (seq & 0xff)) {
+                    TS_FAIL("Record was corrupted");
+                    break;
+                }
+            }
+            seqs.push_back(seq);
+        }
+        // Start over so the next store only holds new records
+        fclose(_file);
+        _file = tmpfile();
+        return seqs;
+    }
+
+public:
+    void setUp() {
+        _buf = new PerThreadBatchedBuffer(NUM_BATCHES);
+        _file = tmpfile();
+    }
+
+    void tearDown() {
+        delete _buf;
+        _buf = NULL;
+        fclose(_file);
+        _file = NULL;
+    }
+
+    void testDropsWhenOutOfBatches() {
+        const uint32 capacity = NUM_BATCHES * RECORDS_PER_BATCH;
+        const uint32 extra = 500;
+        for(uint32 i = 0; i < capacity + extra; i++)
+            writeRecord(i);
+        // The writer never blocks, it drops everything past what its batches
+        // can hold
+        TS_ASSERT_EQUALS(_buf->dropped(), (uint64)extra);
+
+        _buf->flush();
+        std::vector<uint32> seqs = storeRecords();
+        TS_ASSERT_EQUALS(seqs.size(), (size_t)capacity);
+        for(uint32 i = 0; i < seqs.size(); i++) {
+            if (seqs[i] != i) {
+                TS_FAIL("Records stored out of order");
+                break;
+            }
+        }
+    }
+
+    void testRecoversOnceStored() {
+        const uint32 capacity = NUM_BATCHES * RECORDS_PER_BATCH;
+        for(uint32 i = 0; i < capacity + 1; i++)
+            writeRecord(i);
+        TS_ASSERT_EQUALS(_buf->dropped(), (uint64)1);
+
+        // Storing hands the batches back, so writes succeed again and the
+        // drop count stays where it was
+        _buf->flush();
+        TS_ASSERT_EQUALS(storeRecords().size(), (size_t)capacity);
+        for(uint32 i = 0; i < 10; i++)
+            writeRecord(capacity + 1 + i);
+        TS_ASSERT_EQUALS(_buf->dropped(), (uint64)1);
+
+        _buf->flush();
+        std::vector<uint32> seqs = storeRecords();
+        TS_ASSERT_EQUALS(seqs.size(), (size_t)10);
+        if (!seqs.empty())
+            TS_ASSERT_EQUALS(seqs[0], capacity + 1);
+    }
+
+    void testDropsOversizedRecords() {
+        std::vector<uint8> big(Batch<uint8>::max_size + 1, 0);
+        PerThreadBatchedBuffer::IOVec iov(&big[0], big.size());
+        _buf->write(&iov, 1);
+        TS_ASSERT_EQUALS(_buf->dropped(), (uint64)1);
+
+        writeRecord(0);
+        _buf->flush();
+        TS_ASSERT_EQUALS(storeRecords().size(), (size_t)1);
+        TS_ASSERT_EQUALS(_buf->dropped(), (uint64)1);
+    }
+};
@@ -0,0 +1,99 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/network/SSTBuffer.hpp>
+#include <cstring>
+
+using namespace Sirikata;
+using namespace Sirikata::SST;
+
+/** The BufferPool's free list is LIFO, so a slab that has just been returned
+ *  is the next one handed out. That lets these tests tell exactly when a slab
+ *  went back to the pool.
+ */
+class SSTBufferTest : public CxxTest::TestSuite
+{
+    static bool sliceEquals(const BufferSlice& slice, const char* expected) {
+        return slice.size() == strlen(expected) &&
+            memcmp(slice.data(), expected, slice.size()) == 0;
+    }
+
+public:
+    void setUp() {
+        BufferPool::getSingleton().resetStats();
+    }
+
+    void testSlicesShareOneCopy() {
+        BufferAllocator alloc;
+        BufferSlice a = alloc.copy("hello", 5);
+        BufferSlice b = alloc.copy("world", 5);
+        // Consecutive copies are carved out of the same slab
+        TS_ASSERT_EQUALS(b.data(), a.data() + 5);
+
+        BufferSlice sub = a.slice(1, 3);
+        TS_ASSERT(sliceEquals(sub, "ell"));
+        TS_ASSERT_EQUALS(sub.data(), a.data() + 1);
+
+        BufferPool::Stats stats = BufferPool::getSingleton().stats();
+        TS_ASSERT_EQUALS(stats.slabsAllocated + stats.slabsReused, (uint64)1);
+        TS_ASSERT_EQUALS(stats.bytesCopied, (uint64)10);
+    }
+
+    void testSlabReturnedAfterLastSlice() {
+        const uint8* slab_data = NULL;
+        BufferSlice survivor;
+        {
+            BufferAllocator alloc;
+            BufferSlice whole = alloc.copy("hello", 5);
+            slab_data = whole.data();
+            BufferSlice copied(whole);
+            survivor = copied.slice(1, 3);
+            alloc.release();
+        }
+        // The allocator and the other slices are gone, but the survivor
+        // keeps the slab out of the pool
+        TS_ASSERT(sliceEquals(survivor, "ell"));
+        {
+            BufferAllocator other;
+            BufferSlice fresh = other.copy("x", 1);
+            TS_ASSERT_DIFFERS(fresh.data(), slab_data);
+        }
+
+        survivor = BufferSlice();
+        BufferAllocator reuse;
+        BufferSlice again = reuse.copy("y", 1);
+        TS_ASSERT_EQUALS(again.data(), slab_data);
+    }
+
+    void testReleaseWhenIdle() {
+        BufferAllocator alloc;
+        const uint8* slab_data = NULL;
+        {
+            BufferSlice a = alloc.copy("abc", 3);
+            slab_data = a.data();
+        }
+        // With every slice gone, only the allocator holds the slab. Releasing
+        // it returns the slab, and the allocator starts a new one next time.
+        alloc.release();
+        BufferPool::Stats before = BufferPool::getSingleton().stats();
+        BufferSlice b = alloc.copy("def", 3);
+        BufferPool::Stats after = BufferPool::getSingleton().stats();
+        TS_ASSERT_EQUALS(after.slabsReused, before.slabsReused + 1);
+        TS_ASSERT_EQUALS(b.data(), slab_data);
+        TS_ASSERT(sliceEquals(b, "def"));
+    }
+
+    void testOversizedCopiesGetTheirOwnSlab() {
+        std::vector<uint8> big(BufferPool::SlabSize + 1, 7);
+        BufferAllocator alloc;
+        BufferSlice small = alloc.copy("a", 1);
+        BufferSlice large = alloc.copy(&big[0], big.size());
+        TS_ASSERT_EQUALS(large.size(), (uint32)big.size());
+        TS_ASSERT(memcmp(large.data(), &big[0], big.size()) == 0);
+        // Data is never split across slabs
+        TS_ASSERT(sliceEquals(small, "a"));
+        TS_ASSERT_EQUALS(BufferPool::getSingleton().stats().bytesCopied, (uint64)big.size() + 1);
+    }
+};
@@ -0,0 +1,98 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/network/SSTCongestionControl.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::SST;
+
+class SSTCongestionControlTest : public CxxTest::TestSuite
+{
+public:
+
+    void testNewRenoSlowStartAndLoss(void) {
+        NewRenoCongestionController cc;
+        TS_ASSERT_EQUALS(cc.window(), 2u);
+
+        // Slow start grows by one segment per ack
+        for(int i = 0; i < 10; i++)
+            cc.ack(Duration::milliseconds((int64)10));
+        TS_ASSERT_EQUALS(cc.window(), 12u);
+
+        cc.loss();
+        TS_ASSERT_EQUALS(cc.window(), 6u);
+        TS_ASSERT_EQUALS(cc.ssthresh(), 6u);
+
+        // Congestion avoidance needs a full window of acks to grow
+        for(int i = 0; i < 5; i++)
+            cc.ack(Duration::milliseconds((int64)10));
+        TS_ASSERT_EQUALS(cc.window(), 6u);
+        cc.ack(Duration::milliseconds((int64)10));
+        TS_ASSERT_EQUALS(cc.window(), 7u);
+
+        cc.timeout();
+        TS_ASSERT_EQUALS(cc.window(), 1u);
+        TS_ASSERT_EQUALS(cc.ssthresh(), 3u);
+    }
+
+    void testDelayBacksOffWhenQueuing(void) {
+        DelayCongestionController cc;
+
+        // Constant RTT, no queuing, so we keep growing
+        for(int i = 0; i < 100; i++)
+            cc.ack(Duration::milliseconds((int64)10));
+        TS_ASSERT(cc.window() > 2);
+
+        // RTT doubles, meaning about half the window is queued. Once that's
+        // noticed the window should shrink every round.
+        for(int i = 0; i < 1000; i++)
+            cc.ack(Duration::milliseconds((int64)20));
+        uint32 queuing = cc.window();
+        for(uint32 i = 0; i < 4*queuing; i++)
+            cc.ack(Duration::milliseconds((int64)20));
+        TS_ASSERT(cc.window() < queuing);
+    }
+
+    void testRTOEstimate(void) {
+        NewRenoCongestionController cc;
+        TS_ASSERT_EQUALS(cc.rto().toMicroseconds(), CongestionController::InitialRTOMicroseconds);
+
+        cc.ack(Duration::milliseconds((int64)100));
+        // srtt = 100ms, rttvar = 50ms
+        TS_ASSERT_EQUALS(cc.rto().toMicroseconds(), 300000);
+        TS_ASSERT_EQUALS(cc.minRTT().toMicroseconds(), 100000);
+
+        // Never below the minimum
+        for(int i = 0; i < 100; i++)
+            cc.ack(Duration::microseconds((int64)10));
+        TS_ASSERT_EQUALS(cc.rto().toMicroseconds(), CongestionController::MinRTOMicroseconds);
+    }
+
+    void testSelectiveAckRoundTrip(void) {
+        SelectiveAck sack;
+        sack.cumulative = 1000;
+        sack.blocks.push_back(SelectiveAck::Block(2000, 3000));
+        sack.blocks.push_back(SelectiveAck::Block(4000, 4500));
+
+        String data;
+        sack.serialize(&data);
+
+        SelectiveAck parsed;
+        TS_ASSERT(parsed.parse(data.data(), data.size()));
+        TS_ASSERT_EQUALS(parsed.cumulative, 1000u);
+        TS_ASSERT_EQUALS(parsed.blocks.size(), 2u);
+
+        TS_ASSERT(parsed.covers(0, 1000));
+        TS_ASSERT(!parsed.covers(500, 1000));
+        TS_ASSERT(parsed.covers(2000, 1000));
+        TS_ASSERT(parsed.covers(4100, 100));
+        TS_ASSERT(!parsed.covers(2500, 1000));
+        TS_ASSERT(!parsed.covers(3000, 1000));
+
+        // Empty and truncated payloads aren't SelectiveAcks
+        TS_ASSERT(!parsed.parse(data.data(), 0));
+        TS_ASSERT(!parsed.parse(data.data(), data.size() - 1));
+    }
+};
@@ -0,0 +1,210 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/transfer/TransferScheduler.hpp>
+#include <sirikata/core/transfer/MaxPriorityAggregation.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::Transfer;
+
+namespace {
+
+// Request which doesn't do anything, so tests can drive a TransferScheduler
+// directly
+class FakeTransferRequest : public TransferRequest {
+public:
+    FakeTransferRequest(const String& id, Priority priority, const String& source = "http://cdn", uint64 size = 0)
+     : mID(id), mSource(source), mSize(size)
+    {
+        mPriority = priority;
+        mDeletionRequest = false;
+        mClientID = "client";
+    }
+
+    static TransferRequestPtr deletion(const String& id) {
+        FakeTransferRequest* req = new FakeTransferRequest(id, 0);
+        req->mDeletionRequest = true;
+        return TransferRequestPtr(req);
+    }
+
+    virtual const std::string& getIdentifier() const { return mID; }
+    virtual String getSource() const { return mSource; }
+    virtual uint64 getTransferSize() const { return mSize; }
+    virtual void execute(TransferRequestPtr req, ExecuteFinished cb) {}
+    virtual void notifyCaller(TransferRequestPtr me, TransferRequestPtr from) {}
+
+private:
+    String mID;
+    String mSource;
+    uint64 mSize;
+};
+
+TransferRequestPtr request(const String& id, Priority priority, const String& source = "http://cdn", uint64 size = 0) {
+    return TransferRequestPtr(new FakeTransferRequest(id, priority, source, size));
+}
+
+}
+
+class TransferSchedulerTest : public CxxTest::TestSuite
+{
+    TransferScheduler::AggregateRequestList mStarted;
+    Time mNow;
+
+    TransferScheduler* create(uint32 maxOutstanding, uint32 reserved) {
+        TransferScheduler::Params params;
+        params.maxOutstanding = maxOutstanding;
+        params.reservedSlots = reserved;
+        params.deadlineHorizon = Duration::milliseconds((int64)100);
+        return new TransferScheduler(params, new MaxPriorityAggregation());
+    }
+
+    // Returns the ids of the requests started, in order
+    std::vector<String> schedule(TransferScheduler* sched) {
+        TransferScheduler::AggregateRequestList started;
+        sched->schedule(mNow, started);
+        std::vector<String> ids;
+        for(uint32 i = 0; i < started.size(); i++) {
+            ids.push_back(started[i]->getIdentifier());
+            mStarted.push_back(started[i]);
+        }
+        return ids;
+    }
+
+    TransferScheduler::AggregateRequestPtr started(const String& id) {
+        for(uint32 i = 0; i < mStarted.size(); i++)
+            if (mStarted[i]->getIdentifier() == id) return mStarted[i];
+        return TransferScheduler::AggregateRequestPtr();
+    }
+
+public:
+    void setUp() {
+        mStarted.clear();
+        mNow = Time::microseconds((int64)1000000000);
+    }
+
+    void testReservedSlotsKeptForImportantRequests(void) {
+        std::auto_ptr<TransferScheduler> sched(create(4, 1));
+        for(uint32 i = 0; i < 10; i++)
+            sched->update(request("texture" + boost::lexical_cast<String>(i), 0.1f + i * 0.01f));
+
+        // Only the regular slots get used by the backlog, highest priority
+        // first
+        std::vector<String> ids = schedule(sched.get());
+        TS_ASSERT_EQUALS(ids.size(), 3u);
+        TS_ASSERT_EQUALS(ids[0], "texture9");
+        TS_ASSERT_EQUALS(sched->numOutstanding(), 3u);
+
+        // Something more important than everything running gets the reserved
+        // slot right away
+        sched->update(request("mesh", 0.9f));
+        ids = schedule(sched.get());
+        TS_ASSERT_EQUALS(ids.size(), 1u);
+        TS_ASSERT_EQUALS(ids[0], "mesh");
+        TS_ASSERT_EQUALS(sched->stats().startedInReservedSlot, 1u);
+
+        // Everything's in use now
+        sched->update(request("mesh2", 0.95f));
+        TS_ASSERT(schedule(sched.get()).empty());
+
+        // And the most important waiting request goes next
+        std::vector<TransferRequestPtr> clients;
+        TS_ASSERT(sched->finished(started("texture9"), clients));
+        TS_ASSERT_EQUALS(clients.size(), 1u);
+        ids = schedule(sched.get());
+        TS_ASSERT_EQUALS(ids.size(), 1u);
+        TS_ASSERT_EQUALS(ids[0], "mesh2");
+    }
+
+    void testDeadlinesGoFirst(void) {
+        std::auto_ptr<TransferScheduler> sched(create(2, 0));
+        sched->update(request("high", 0.9f));
+        sched->update(request("high2", 0.8f));
+
+        TransferRequestPtr due = request("due", 0.1f);
+        due->setDeadline(mNow + Duration::milliseconds((int64)50));
+        sched->update(due);
+        TransferRequestPtr later = request("later", 0.1f);
+        later->setDeadline(mNow + Duration::seconds(10.0));
+        sched->update(later);
+
+        std::vector<String> ids = schedule(sched.get());
+        TS_ASSERT_EQUALS(ids.size(), 2u);
+        TS_ASSERT_EQUALS(ids[0], "due");
+        TS_ASSERT_EQUALS(ids[1], "high");
+        TS_ASSERT_EQUALS(sched->stats().startedForDeadline, 1u);
+
+        // Wakes up when the next deadline comes within the horizon
+        TS_ASSERT_EQUALS(sched->nextWakeup(mNow), mNow + Duration::seconds(10.0) - Duration::milliseconds((int64)100));
+    }
+
+    void testSourceBandwidth(void) {
+        TransferScheduler::Params params;
+        params.reservedSlots = 0;
+        params.sourceBandwidth = 1000;
+        TransferScheduler sched(params, new MaxPriorityAggregation());
+
+        sched.update(request("a1", 0.9f, "http://a", 1000));
+        sched.update(request("a2", 0.8f, "http://a", 1000));
+        sched.update(request("b1", 0.1f, "http://b", 1000));
+
+        // The first takes all of a's budget, so only b can go as well
+        std::vector<String> ids = schedule(&sched);
+        TS_ASSERT_EQUALS(ids.size(), 2u);
+        TS_ASSERT_EQUALS(ids[0], "a1");
+        TS_ASSERT_EQUALS(ids[1], "b1");
+        TS_ASSERT(sched.stats().throttled > 0);
+
+        Time wakeup = sched.nextWakeup(mNow);
+        TS_ASSERT(wakeup > mNow);
+        TS_ASSERT(wakeup <= mNow + Duration::seconds(1.01));
+        TS_ASSERT(schedule(&sched).empty());
+
+        mNow = wakeup;
+        ids = schedule(&sched);
+        TS_ASSERT_EQUALS(ids.size(), 1u);
+        TS_ASSERT_EQUALS(ids[0], "a2");
+    }
+
+    void testCancellingExecutingRequests(void) {
+        std::auto_ptr<TransferScheduler> sched(create(1, 0));
+        sched->update(request("old", 0.5f));
+        sched->update(request("new", 0.4f));
+        TS_ASSERT_EQUALS(schedule(sched.get()).size(), 1u);
+
+        // Its only client gives up on it, but the fetch is still running so
+        // it keeps its slot
+        sched->update(FakeTransferRequest::deletion("old"));
+        TS_ASSERT_EQUALS(sched->numOutstanding(), 1u);
+        TS_ASSERT_EQUALS(sched->stats().cancelled, 1u);
+        TS_ASSERT(schedule(sched.get()).empty());
+
+        // Its result is dropped when it finishes, and then the slot goes to
+        // the next one
+        std::vector<TransferRequestPtr> clients;
+        TS_ASSERT(!sched->finished(started("old"), clients));
+        TS_ASSERT(clients.empty());
+        TS_ASSERT_EQUALS(sched->numOutstanding(), 0u);
+        std::vector<String> ids = schedule(sched.get());
+        TS_ASSERT_EQUALS(ids.size(), 1u);
+        TS_ASSERT_EQUALS(ids[0], "new");
+    }
+
+    void testReprioritizingExecutingRequests(void) {
+        std::auto_ptr<TransferScheduler> sched(create(2, 1));
+        sched->update(request("running", 0.5f));
+        sched->update(request("waiting", 0.3f));
+        std::vector<String> ids = schedule(sched.get());
+        TS_ASSERT_EQUALS(ids.size(), 1u);
+        TS_ASSERT_EQUALS(ids[0], "running");
+        TS_ASSERT(schedule(sched.get()).empty());
+
+        // Once what's running matters less than what's waiting, the waiting
+        // one can use the reserved slot
+        sched->update(request("running", 0.1f));
+        ids = schedule(sched.get());
+        TS_ASSERT_EQUALS(ids.size(), 1u);
+        TS_ASSERT_EQUALS(ids[0], "waiting");
+    }
+};
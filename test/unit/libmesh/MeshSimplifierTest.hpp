@@ -0,0 +1,214 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/mesh/MeshSimplifier.hpp>
+#include <set>
+
+using namespace Sirikata;
+using namespace Sirikata::Mesh;
+
+class MeshSimplifierTest : public CxxTest::TestSuite
+{
+    // A side x side grid of vertices with slightly varying heights, in one
+    // TRIANGLES primitive
+    static SubMeshGeometry grid(uint32 side) {
+        SubMeshGeometry geom;
+        for(uint32 y = 0; y < side; y++) {
+            for(uint32 x = 0; x < side; x++) {
+                float32 height = ((x * 7 + y * 13) % 10) / 50.f;
+                geom.positions.push_back(Vector3f((float32)x, height, (float32)y));
+                geom.normals.push_back(Vector3f(0, 1, 0));
+            }
+        }
+
+        SubMeshGeometry::Primitive prim;
+        prim.primitiveType = SubMeshGeometry::Primitive::TRIANGLES;
+        prim.materialId = 0;
+        for(uint32 y = 0; y + 1 < side; y++) {
+            for(uint32 x = 0; x + 1 < side; x++) {
+                unsigned short v = y * side + x;
+                prim.indices.push_back(v);
+                prim.indices.push_back(v + side);
+                prim.indices.push_back(v + 1);
+                prim.indices.push_back(v + 1);
+                prim.indices.push_back(v + side);
+                prim.indices.push_back(v + side + 1);
+            }
+        }
+        geom.primitives.push_back(prim);
+        return geom;
+    }
+
+    // Adds an instance of geometry geom_idx under a new root node
+    static void addInstance(MeshdataPtr mesh, uint32 geom_idx, const Vector3f& offset) {
+        NodeIndex node_idx = mesh->nodes.size();
+        Matrix4x4f xform = Matrix4x4f::identity();
+        xform(0,3) = offset.x;
+        xform(1,3) = offset.y;
+        xform(2,3) = offset.z;
+        mesh->nodes.push_back(Node(xform));
+        mesh->rootNodes.push_back(node_idx);
+
+        GeometryInstance inst;
+        inst.geometryIndex = geom_idx;
+        inst.parentNode = node_idx;
+        mesh->instances.push_back(inst);
+    }
+
+    static MeshdataPtr gridMesh(uint32 side, uint32 ninstances) {
+        MeshdataPtr mesh(new Meshdata());
+        mesh->globalTransform = Matrix4x4f::identity();
+        mesh->geometry.push_back(grid(side));
+        for(uint32 i = 0; i < ninstances; i++)
+            addInstance(mesh, 0, Vector3f((float32)(i * side), 0, 0));
+        return mesh;
+    }
+
+    // Faces in the mesh, counted once per instance as the simplifier does
+    static uint32 countFaces(MeshdataPtr mesh) {
+        uint32 faces = 0;
+        uint32 geoinst_idx;
+        Matrix4x4f geoinst_pos_xform;
+        Meshdata::GeometryInstanceIterator geoinst_it = mesh->getGeometryInstanceIterator();
+        while( geoinst_it.next(&geoinst_idx, &geoinst_pos_xform) ) {
+            const SubMeshGeometry& geom = mesh->geometry[mesh->instances[geoinst_idx].geometryIndex];
+            for(uint32 i = 0; i < geom.primitives.size(); i++)
+                faces += geom.primitives[i].indices.size() / 3;
+        }
+        return faces;
+    }
+
+    // Checks every index is valid, every vertex is used, and there are no
+    // degenerate or duplicate triangles or edges shared by more than two
+    // triangles.
+    static void checkTopology(const SubMeshGeometry& geom) {
+        uint32 nverts = geom.positions.size();
+        TS_ASSERT_EQUALS(geom.normals.size(), nverts);
+
+        std::vector<uint8> used(nverts, 0);
+        std::set<std::vector<uint32> > faces;
+        std::map<std::pair<uint32, uint32>, uint32> edges;
+        for(uint32 i = 0; i < geom.primitives.size(); i++) {
+            const std::vector<unsigned short>& indices = geom.primitives[i].indices;
+            TS_ASSERT_EQUALS(indices.size() % 3, 0u);
+            for(uint32 k = 0; k + 2 < indices.size(); k += 3) {
+                std::vector<uint32> face(indices.begin() + k, indices.begin() + k + 3);
+                bool valid = true;
+                for(uint32 c = 0; c < 3; c++) {
+                    TS_ASSERT(face[c] < nverts);
+                    if (face[c] >= nverts) valid = false;
+                }
+                if (!valid) continue;
+                for(uint32 c = 0; c < 3; c++) {
+                    used[face[c]] = 1;
+                    TS_ASSERT(!(geom.positions[face[c]] == geom.positions[face[(c+1)%3]]));
+                }
+
+                std::sort(face.begin(), face.end());
+                TS_ASSERT(faces.insert(face).second);
+                edges[std::make_pair(face[0], face[1])]++;
+                edges[std::make_pair(face[1], face[2])]++;
+                edges[std::make_pair(face[0], face[2])]++;
+            }
+        }
+        for(uint32 v = 0; v < nverts; v++)
+            TS_ASSERT(used[v]);
+        for(std::map<std::pair<uint32, uint32>, uint32>::iterator it = edges.begin(); it != edges.end(); it++)
+            TS_ASSERT(it->second <= 2);
+    }
+
+public:
+    void testTargetFaceCount() {
+        MeshdataPtr mesh = gridMesh(20, 1);
+        uint32 start_faces = countFaces(mesh);
+        TS_ASSERT_EQUALS(start_faces, 19u * 19u * 2u);
+
+        MeshSimplifier simplifier(2);
+        simplifier.simplify(mesh, 200);
+        uint32 faces = countFaces(mesh);
+        TS_ASSERT(faces <= 200);
+        // Each collapse removes a couple of faces, so it shouldn't overshoot
+        // by much
+        TS_ASSERT(faces >= 190);
+        checkTopology(mesh->geometry[0]);
+        TS_ASSERT(mesh->geometry[0].positions.size() < 400u);
+    }
+
+    void testInstancedFaceCount() {
+        // Faces count once per instance, so the shared geometry has to be
+        // reduced to half the target
+        MeshdataPtr mesh = gridMesh(20, 2);
+        TS_ASSERT_EQUALS(countFaces(mesh), 2u * 19u * 19u * 2u);
+
+        MeshSimplifier simplifier(2);
+        simplifier.simplify(mesh, 300);
+        uint32 faces = countFaces(mesh);
+        TS_ASSERT(faces <= 300);
+        TS_ASSERT(faces >= 280);
+        checkTopology(mesh->geometry[0]);
+    }
+
+    void testAlreadySimpleEnough() {
+        MeshdataPtr mesh = gridMesh(10, 1);
+        std::vector<unsigned short> indices = mesh->geometry[0].primitives[0].indices;
+        std::vector<Vector3f> positions = mesh->geometry[0].positions;
+
+        MeshSimplifier simplifier(1);
+        simplifier.simplify(mesh, 1000);
+        TS_ASSERT(mesh->geometry[0].primitives[0].indices == indices);
+        TS_ASSERT(mesh->geometry[0].positions == positions);
+    }
+
+    void testSimplifyToNothing() {
+        MeshdataPtr mesh = gridMesh(10, 1);
+        MeshSimplifier simplifier(1);
+        simplifier.simplify(mesh, 0);
+        TS_ASSERT(countFaces(mesh) < 10);
+        checkTopology(mesh->geometry[0]);
+    }
+
+    void testDegenerateInput() {
+        MeshdataPtr mesh = gridMesh(10, 1);
+        SubMeshGeometry& geom = mesh->geometry[0];
+        std::vector<unsigned short>& indices = geom.primitives[0].indices;
+        uint32 nfaces = indices.size() / 3;
+
+        // A triangle with a repeated index
+        indices.push_back(0); indices.push_back(0); indices.push_back(1);
+        // A copy of the first triangle, in a different order
+        indices.push_back(indices[1]); indices.push_back(indices[2]); indices.push_back(indices[0]);
+        // A vertex at the same position as vertex 5, used in place of it
+        geom.positions.push_back(geom.positions[5]);
+        geom.normals.push_back(geom.normals[5]);
+        for(uint32 k = 0; k < nfaces * 3; k++) {
+            if (indices[k] == 5) {
+                indices[k] = geom.positions.size() - 1;
+                break;
+            }
+        }
+        // An unused vertex
+        geom.positions.push_back(Vector3f(100, 100, 100));
+        geom.normals.push_back(Vector3f(0, 1, 0));
+
+        // Empty geometry, and geometry without any instances
+        mesh->geometry.push_back(SubMeshGeometry());
+        addInstance(mesh, 1, Vector3f(0, 0, 0));
+        mesh->geometry.push_back(grid(5));
+
+        // Nothing needs to be collapsed, but the bad faces and vertices are
+        // still cleaned up
+        MeshSimplifier simplifier(2);
+        simplifier.simplify(mesh, 1000);
+        TS_ASSERT_EQUALS(countFaces(mesh), nfaces);
+        checkTopology(mesh->geometry[0]);
+        TS_ASSERT_EQUALS(mesh->geometry[0].positions.size(), 100u);
+
+        simplifier.simplify(mesh, 50);
+        TS_ASSERT(countFaces(mesh) <= 50);
+        checkTopology(mesh->geometry[0]);
+        TS_ASSERT(mesh->geometry[1].positions.empty());
+        TS_ASSERT_EQUALS(mesh->geometry[2].primitives[0].indices.size(), 4u * 4u * 6u);
+    }
+};
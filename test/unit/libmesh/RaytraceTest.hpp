@@ -0,0 +1,219 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/mesh/Raytrace.hpp>
+#include <cmath>
+
+using namespace Sirikata;
+using namespace Sirikata::Mesh;
+
+/** Checks the accelerated Raytrace against testing every triangle of every
+ *  instance.
+ */
+class RaytraceTest : public CxxTest::TestSuite
+{
+    // Small deterministic generator so failures are reproducible
+    uint32 mSeed;
+
+    uint32 next() {
+        mSeed = mSeed * 1103515245 + 12345;
+        return (mSeed >> 16) & 0x7fff;
+    }
+    float32 uniform(float32 lo, float32 hi) {
+        return lo + (hi - lo) * (next() / 32767.f);
+    }
+    Vector3f randomPoint(float32 extent) {
+        return Vector3f(uniform(-extent, extent), uniform(-extent, extent), uniform(-extent, extent));
+    }
+
+    // Random triangles in a TRIANGLES primitive and a strip in a TRISTRIPS
+    // primitive
+    SubMeshGeometry randomGeometry(uint32 ntris) {
+        SubMeshGeometry geom;
+        SubMeshGeometry::Primitive tris;
+        tris.primitiveType = SubMeshGeometry::Primitive::TRIANGLES;
+        tris.materialId = 0;
+        for(uint32 i = 0; i < ntris; i++) {
+            Vector3f center = randomPoint(10);
+            for(uint32 c = 0; c < 3; c++) {
+                tris.indices.push_back(geom.positions.size());
+                geom.positions.push_back(center + randomPoint(1));
+            }
+        }
+        geom.primitives.push_back(tris);
+
+        SubMeshGeometry::Primitive strip;
+        strip.primitiveType = SubMeshGeometry::Primitive::TRISTRIPS;
+        strip.materialId = 0;
+        for(uint32 i = 0; i < 10; i++) {
+            strip.indices.push_back(geom.positions.size());
+            geom.positions.push_back(Vector3f((float32)(i / 2), (float32)(i % 2), uniform(-0.5f, 0.5f)));
+        }
+        geom.primitives.push_back(strip);
+        return geom;
+    }
+
+    void addInstance(MeshdataPtr mesh, uint32 geom_idx, const Matrix4x4f& xform) {
+        NodeIndex node_idx = mesh->nodes.size();
+        mesh->nodes.push_back(Node(xform));
+        mesh->rootNodes.push_back(node_idx);
+
+        GeometryInstance inst;
+        inst.geometryIndex = geom_idx;
+        inst.parentNode = node_idx;
+        mesh->instances.push_back(inst);
+    }
+
+    Matrix4x4f randomTransform() {
+        float32 angle = uniform(0, 6.28f), scale = uniform(0.5f, 2.f);
+        float32 c = std::cos(angle) * scale, s = std::sin(angle) * scale;
+        Vector3f offset = randomPoint(20);
+        return Matrix4x4f(
+            Vector4f(c, 0, -s, 0),
+            Vector4f(0, scale, 0, 0),
+            Vector4f(s, 0, c, 0),
+            Vector4f(offset.x, offset.y, offset.z, 1),
+            Matrix4x4f::COLUMNS());
+    }
+
+    MeshdataPtr randomMesh() {
+        MeshdataPtr mesh(new Meshdata());
+        mesh->globalTransform = Matrix4x4f::identity();
+        mesh->geometry.push_back(randomGeometry(200));
+        mesh->geometry.push_back(randomGeometry(50));
+        // Geometry without instances shouldn't be hit
+        mesh->geometry.push_back(randomGeometry(50));
+        for(uint32 i = 0; i < 6; i++)
+            addInstance(mesh, i % 2, randomTransform());
+        return mesh;
+    }
+
+    static Vector3f transformPoint(const Matrix4x4f& xform, const Vector3f& p) {
+        Vector4f r = xform * Vector4f(p.x, p.y, p.z, 1.f);
+        return Vector3f(r.x, r.y, r.z);
+    }
+
+    // Moller-Trumbore, returning the parametric distance of the hit
+    static bool rayHitsTriangle(const Vector3f& start, const Vector3f& dir, const Vector3f& v1, const Vector3f& v2, const Vector3f& v3, float32* t_out) {
+        Vector3f e1 = v2 - v1, e2 = v3 - v1;
+        Vector3f p = dir.cross(e2);
+        float32 det = e1.dot(p);
+        if (std::fabs(det) < 1e-12f) return false;
+        Vector3f to_start = start - v1;
+        float32 u = to_start.dot(p) / det;
+        if (u < 0 || u > 1) return false;
+        Vector3f q = to_start.cross(e1);
+        float32 v = dir.dot(q) / det;
+        if (v < 0 || u + v > 1) return false;
+        float32 t = e2.dot(q) / det;
+        if (t < 0) return false;
+        *t_out = t;
+        return true;
+    }
+
+    // Transforms every triangle of every instance into world space and tests
+    // them all, like Raytrace used to
+    static bool bruteForce(MeshdataPtr mesh, const Matrix4x4f& vis_xform, const Vector3f& start, const Vector3f& dir, float32* t_out) {
+        bool hit = false;
+        uint32 geoinst_idx;
+        Matrix4x4f geoinst_xform;
+        Meshdata::GeometryInstanceIterator geoinst_it = mesh->getGeometryInstanceIterator();
+        while(geoinst_it.next(&geoinst_idx, &geoinst_xform)) {
+            Matrix4x4f xform = vis_xform * geoinst_xform;
+            const SubMeshGeometry& geom = mesh->geometry[mesh->instances[geoinst_idx].geometryIndex];
+            for(uint32 pi = 0; pi < geom.primitives.size(); pi++) {
+                const SubMeshGeometry::Primitive& prim = geom.primitives[pi];
+                bool strip = (prim.primitiveType == SubMeshGeometry::Primitive::TRISTRIPS);
+                for(uint32 i = 0; i + 2 < prim.indices.size(); i += (strip ? 1 : 3)) {
+                    float32 t;
+                    if (rayHitsTriangle(start, dir,
+                            transformPoint(xform, geom.positions[prim.indices[i]]),
+                            transformPoint(xform, geom.positions[prim.indices[i+1]]),
+                            transformPoint(xform, geom.positions[prim.indices[i+2]]),
+                            &t) &&
+                        (!hit || t < *t_out))
+                    {
+                        *t_out = t;
+                        hit = true;
+                    }
+                }
+            }
+        }
+        return hit;
+    }
+
+    void compare(MeshdataPtr mesh, const Matrix4x4f& vis_xform, uint32 nrays) {
+        std::vector<Vector3f> starts, dirs;
+        for(uint32 i = 0; i < nrays; i++) {
+            // Aim most rays at the mesh so there are plenty of hits
+            Vector3f start = randomPoint(60);
+            Vector3f target = (i % 4 == 0) ? randomPoint(60) : transformPoint(vis_xform, randomPoint(25));
+            starts.push_back(start);
+            dirs.push_back((target - start).normal());
+        }
+
+        RaytraceResultList results;
+        uint32 nhits = Raytrace(mesh, vis_xform, starts, dirs, &results);
+        TS_ASSERT_EQUALS(results.size(), nrays);
+
+        uint32 expected_hits = 0;
+        for(uint32 i = 0; i < nrays; i++) {
+            float32 expected_t = 0;
+            bool expected_hit = bruteForce(mesh, vis_xform, starts[i], dirs[i], &expected_t);
+            if (expected_hit) expected_hits++;
+
+            float32 t = 0;
+            Vector3f point;
+            bool hit = Raytrace(mesh, vis_xform, starts[i], dirs[i], &t, &point);
+            TS_ASSERT_EQUALS(hit, expected_hit);
+            TS_ASSERT_EQUALS(results[i].hit, expected_hit);
+            if (hit && expected_hit) {
+                TS_ASSERT(std::fabs(t - expected_t) < 1e-3f * (1 + expected_t));
+                TS_ASSERT(std::fabs(results[i].t - t) < 1e-5f * (1 + t));
+                TS_ASSERT((point - (starts[i] + dirs[i] * expected_t)).length() < 1e-2f);
+            }
+        }
+        TS_ASSERT_EQUALS(nhits, expected_hits);
+        // Make sure the test isn't vacuous
+        TS_ASSERT(expected_hits > nrays / 10);
+    }
+
+public:
+    void setUp() {
+        mSeed = 1234;
+    }
+
+    void testMatchesBruteForce() {
+        MeshdataPtr mesh = randomMesh();
+        compare(mesh, Matrix4x4f::identity(), 500);
+    }
+
+    void testMatchesBruteForceTransformed() {
+        MeshdataPtr mesh = randomMesh();
+        compare(mesh, randomTransform(), 500);
+    }
+
+    void testModifiedMesh() {
+        MeshdataPtr mesh = randomMesh();
+        compare(mesh, Matrix4x4f::identity(), 100);
+
+        // Edit positions and transforms in place, which the cached hierarchy
+        // can't notice by itself
+        for(uint32 i = 0; i < mesh->geometry[0].positions.size(); i++)
+            mesh->geometry[0].positions[i] = mesh->geometry[0].positions[i] * 1.5f;
+        mesh->nodes[0].transform = randomTransform();
+        mesh->markModified();
+        compare(mesh, Matrix4x4f::identity(), 100);
+
+        // A modified copy gets its own hierarchy and leaves the original's
+        // alone
+        MeshdataPtr copy(new Meshdata(*mesh));
+        copy->geometry[1].positions.clear();
+        copy->geometry[1].primitives.clear();
+        copy->markModified();
+        compare(copy, Matrix4x4f::identity(), 100);
+        compare(mesh, Matrix4x4f::identity(), 100);
+    }
+};
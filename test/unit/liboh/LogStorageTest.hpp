@@ -0,0 +1,189 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include "StorageTestBase.hpp"
+#include <cstdio>
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+#include <sys/resource.h>
+#include <signal.h>
+#endif
+
+// Each test gets a fresh LogStorage, so tests which depend on data written by
+// earlier ones also check that it was recovered from the log.
+class LogStorageTest : public CxxTest::TestSuite
+{
+    static const String logfile;
+    StorageTestBase _base;
+
+    static long fileSize(const String& filename) {
+        std::FILE* fp = std::fopen(filename.c_str(), "rb");
+        if (fp == NULL) return -1;
+        std::fseek(fp, 0, SEEK_END);
+        long size = std::ftell(fp);
+        std::fclose(fp);
+        return size;
+    }
+
+    static void appendToFile(const String& filename, const char* data, uint32 size) {
+        std::FILE* fp = std::fopen(filename.c_str(), "ab");
+        TS_ASSERT(fp != NULL);
+        if (fp == NULL) return;
+        std::fwrite(data, 1, size, fp);
+        std::fclose(fp);
+    }
+
+    // Flips the bits of the last byte in the file, which is always part of
+    // the last record's payload
+    static void corruptLastByte(const String& filename) {
+        std::FILE* fp = std::fopen(filename.c_str(), "r+b");
+        TS_ASSERT(fp != NULL);
+        if (fp == NULL) return;
+        std::fseek(fp, -1, SEEK_END);
+        int c = std::fgetc(fp);
+        std::fseek(fp, -1, SEEK_END);
+        std::fputc(~c & 0xFF, fp);
+        std::fclose(fp);
+    }
+
+    void restart() {
+        _base.tearDown();
+        _base.setUp();
+    }
+
+public:
+    LogStorageTest()
+     : _base("oh-logstore", "log", String("--db=") + logfile + " --compact-min-size=65536")
+    {
+    }
+
+    // CXXTest is horrible so we have to override this. Since it doesn't use the
+    // preprocessor properly, we can't even make these macros.
+    void setUp() {_base.setUp(); }
+    void tearDown() {_base.tearDown(); }
+
+    void testSetupTeardown() {_base.testSetupTeardown(); }
+    void testSingleWrite() {_base.testSingleWrite(); }
+    void testSingleRead() {_base.testSingleRead(); }
+    void testSingleInvalidRead() {_base.testSingleInvalidRead(); }
+    void testSingleCompare() {_base.testSingleCompare(); }
+    void testSingleInvalidCompare() {_base.testSingleInvalidCompare(); }
+    void testSingleErase() {_base.testSingleErase(); }
+
+    void testMultiWrite() {_base.testMultiWrite(); }
+    void testMultiRead() {_base.testMultiRead(); }
+    void testMultiInvalidRead() {_base.testMultiInvalidRead(); }
+    void testMultiSomeInvalidRead() {_base.testMultiSomeInvalidRead(); }
+    void testMultiErase() {_base.testMultiErase(); }
+
+    void testAtomicWrite() {_base.testAtomicWrite(); }
+    void testAtomicWriteErase() {_base.testAtomicWriteErase(); }
+
+    void testRangeRead() {_base.testRangeRead(); }
+    void testCount() {_base.testCount(); }
+    void testRangeErase() {_base.testRangeErase(); }
+
+    void testAllTransaction() {_base.testAllTransaction(); }
+
+    void testRollback() {_base.testRollback(); }
+
+    void testTornTail() {
+        String one("one"), two("two"), three("three");
+        _base.writeValue("torn1", one);
+        _base.writeValue("torn2", two);
+        _base.tearDown();
+
+        // A record header promising more data than was written, as if we
+        // crashed part way through appending it
+        const char partial[] = { 100, 0, 0, 0, 1, 2, 3, 4, 'p', 'a', 'r', 't' };
+        appendToFile(logfile, partial, sizeof(partial));
+        _base.setUp();
+        _base.checkValue("torn1", &one);
+        _base.checkValue("torn2", &two);
+
+        // The partial record must have been removed, or this one would be
+        // lost behind it
+        _base.writeValue("torn3", three);
+        restart();
+        _base.checkValue("torn1", &one);
+        _base.checkValue("torn2", &two);
+        _base.checkValue("torn3", &three);
+
+        // A complete record with a bad checksum is discarded as a whole
+        String four("four");
+        _base.writeValue("torn4", four);
+        _base.tearDown();
+        corruptLastByte(logfile);
+        _base.setUp();
+        _base.checkValue("torn3", &three);
+        _base.checkValue("torn4", NULL);
+
+        _base.eraseValue("torn1");
+        _base.eraseValue("torn2");
+        _base.eraseValue("torn3");
+    }
+
+    void testCompaction() {
+        // Overwrite the same key until the log is far larger than the data
+        // in it, which has to trigger compaction
+        String value(1024, 'x');
+        const uint32 nwrites = 256;
+        long start_size = fileSize(logfile);
+        for(uint32 i = 0; i < nwrites; i++) {
+            value[0] = 'a' + (i % 26);
+            _base.writeValue("compact", value);
+        }
+        _base.writeValue("compact_other", "other");
+        _base.eraseValue("compact_other");
+
+        long size = fileSize(logfile);
+        TS_ASSERT(size > 0);
+        TS_ASSERT(size < start_size + (long)(nwrites * value.size()) / 2);
+        TS_ASSERT_EQUALS(fileSize(logfile + ".compact"), -1);
+
+        // And the compacted log recovers the latest values
+        restart();
+        _base.checkValue("compact", &value);
+        _base.checkValue("compact_other", NULL);
+
+        _base.eraseValue("compact");
+    }
+
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+    void testWriteFailure() {
+        String one("one"), two("two"), three("three"), x("x");
+        _base.writeValue("fail1", one);
+
+        // Stop the log from growing so appending the next records fails
+        signal(SIGXFSZ, SIG_IGN);
+        struct rlimit old_limit, limit;
+        getrlimit(RLIMIT_FSIZE, &old_limit);
+        limit = old_limit;
+        limit.rlim_cur = 0;
+        setrlimit(RLIMIT_FSIZE, &limit);
+
+        _base.writeValue("fail1", two, OH::Storage::TRANSACTION_ERROR);
+        _base.writeValue("fail2", x, OH::Storage::TRANSACTION_ERROR);
+        // Failed commits mustn't be visible to readers
+        _base.checkValue("fail1", &one);
+        _base.checkValue("fail2", NULL);
+
+        setrlimit(RLIMIT_FSIZE, &old_limit);
+        signal(SIGXFSZ, SIG_DFL);
+
+        // Once the log can be written again, commits succeed and nothing from
+        // the failed ones is recovered
+        _base.writeValue("fail3", three);
+        restart();
+        _base.checkValue("fail1", &one);
+        _base.checkValue("fail2", NULL);
+        _base.checkValue("fail3", &three);
+
+        _base.eraseValue("fail1");
+        _base.eraseValue("fail3");
+    }
+#endif
+};
+
+const String LogStorageTest::logfile("test.log");
@@ -72,6 +72,8 @@ public:
     void testAllTransaction() {_base.testAllTransaction(); }
 
     void testRollback() {_base.testRollback(); }
+
+    void testGroupedFailures() {_base.testGroupedFailures(); }
 };
 
 const String SQLiteStorageTest::dbfile("test.db");
@@ -34,13 +34,16 @@
 #include "StressTestBase.hpp"
 
 
+// All options are given explicitly in both suites since they're parsed into a
+// shared OptionSet and would otherwise carry over between them.
+
 class SQLiteStressTest : public CxxTest::TestSuite
 {
     static const String dbfile;
     StressTestBase _base;
 public:
     SQLiteStressTest()
-     : _base("oh-sqlite", "sqlite", String("--db=") + dbfile)
+     : _base("oh-sqlite", "sqlite", String("--db=") + dbfile + " --statement-cache=true --max-coalesced-transactions=64")
     {
     }
 
@@ -51,6 +54,7 @@ public:
 
     //(dataLength, keyNum, bucketNum, rounds)
     void testMultiRounds() {
+        std::cout << "With statement cache, 64 coalesced transactions:" << std::endl;
         _base.testMultiRounds("10", 10, 10, 5, StressTestBase::Latency);
         _base.testMultiRounds("10", 10, 10, 5, StressTestBase::Throughput);
     }
@@ -58,3 +62,29 @@ public:
 };
 
 const String SQLiteStressTest::dbfile("test.db");
+
+// Configured like SQLiteStorage used to be, without the statement cache and
+// only coalescing a few transactions, as a baseline for comparison.
+class SQLiteUncachedStressTest : public CxxTest::TestSuite
+{
+    static const String dbfile;
+    StressTestBase _base;
+public:
+    SQLiteUncachedStressTest()
+     : _base("oh-sqlite", "sqlite", String("--db=") + dbfile + " --statement-cache=false --max-coalesced-transactions=5")
+    {
+    }
+
+    void setUp() {_base.setUp(); }
+    void tearDown() {_base.tearDown(); }
+
+    //(dataLength, keyNum, bucketNum, rounds)
+    void testMultiRounds() {
+        std::cout << "Without statement cache, 5 coalesced transactions:" << std::endl;
+        _base.testMultiRounds("10", 10, 10, 5, StressTestBase::Latency);
+        _base.testMultiRounds("10", 10, 10, 5, StressTestBase::Throughput);
+    }
+
+};
+
+const String SQLiteUncachedStressTest::dbfile("test-uncached.db");
@@ -35,6 +35,7 @@
 
 #include <cxxtest/TestSuite.h>
 #include <sirikata/oh/Storage.hpp>
+#include <boost/lexical_cast.hpp>
 
 class StorageTestBase
 {
@@ -67,6 +68,9 @@ protected:
     // CV notifies the main thread as each callback finishes.
     boost::mutex _mutex;
     boost::condition_variable _cond;
+    // Number of checkReadValues callbacks, for tests which have several
+    // transactions outstanding at once
+    int _completed;
 
 public:
     StorageTestBase(String plugin, String type, String args)
@@ -80,7 +84,8 @@ public:
        _ohSSTConnMgr(NULL),
        _mainStrand(NULL),
        _work(NULL),
-       _ctx(NULL)
+       _ctx(NULL),
+       _completed(0)
     {}
 
     void setUp() {
@@ -170,6 +175,7 @@ public:
         boost::unique_lock<boost::mutex> lock(_mutex);
         checkReadValuesImpl(expected_result, expected, result, rs);
         delete rs;
+        _completed++;
         _cond.notify_one();
     }
 
@@ -192,6 +198,53 @@ public:
         _cond.wait(lock);
     }
 
+    void resetCompleted() {
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        _completed = 0;
+    }
+    // Wait until count checkReadValues callbacks have run since
+    // resetCompleted
+    void waitForTransactions(int count) {
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        while(_completed < count)
+            _cond.wait(lock);
+    }
+
+    // Single operations which wait for their result, for tests of specific
+    // backends
+    void writeValue(const String& key, const String& value, OH::Storage::Result expected = OH::Storage::SUCCESS) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+
+        _storage->write(_buckets[0], key, value,
+            std::tr1::bind(&StorageTestBase::checkReadValues, this, expected, ReadSet(), _1, _2)
+        );
+        waitForTransaction();
+    }
+
+    void eraseValue(const String& key) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+
+        _storage->erase(_buckets[0], key,
+            std::tr1::bind(&StorageTestBase::checkReadValues, this, OH::Storage::SUCCESS, ReadSet(), _1, _2)
+        );
+        waitForTransaction();
+    }
+
+    // Checks key has value, or doesn't exist if value is NULL
+    void checkValue(const String& key, const String* value) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+
+        ReadSet rs;
+        if (value != NULL) rs[key] = *value;
+        _storage->read(_buckets[0], key,
+            std::tr1::bind(&StorageTestBase::checkReadValues, this, (value != NULL ? OH::Storage::SUCCESS : OH::Storage::TRANSACTION_ERROR), rs, _1, _2)
+        );
+        waitForTransaction();
+    }
+
     void testSetupTeardown() {
         TS_ASSERT(_storage);
     }
@@ -627,6 +680,44 @@ public:
         verifyRollbackData("baz", "baz");
     }
 
+    // Queues many transactions at once so the storage can group them, with
+    // some failing compares mixed in. Only the failing ones should be
+    // rolled back.
+    void testGroupedFailures() {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+
+        const int ntrans = 40;
+        _storage->write(_buckets[0], "grouped", "value",
+            std::tr1::bind(&StorageTestBase::checkReadValues, this, OH::Storage::SUCCESS, ReadSet(), _1, _2)
+        );
+        waitForTransaction();
+
+        resetCompleted();
+        for(int i = 0; i < ntrans; i++) {
+            String key = "grouped" + boost::lexical_cast<String>(i);
+            bool fail = (i % 4 == 1);
+            _storage->beginTransaction(_buckets[0]);
+            _storage->compare(_buckets[0], "grouped", fail ? "not_value" : "value");
+            _storage->write(_buckets[0], key, key);
+            _storage->commitTransaction(_buckets[0],
+                std::tr1::bind(&StorageTestBase::checkReadValues, this, fail ? OH::Storage::TRANSACTION_ERROR : OH::Storage::SUCCESS, ReadSet(), _1, _2)
+            );
+        }
+        waitForTransactions(ntrans);
+
+        for(int i = 0; i < ntrans; i++) {
+            String key = "grouped" + boost::lexical_cast<String>(i);
+            bool fail = (i % 4 == 1);
+            ReadSet rs;
+            if (!fail) rs[key] = key;
+            _storage->read(_buckets[0], key,
+                std::tr1::bind(&StorageTestBase::checkReadValues, this, fail ? OH::Storage::TRANSACTION_ERROR : OH::Storage::SUCCESS, rs, _1, _2)
+            );
+            waitForTransaction();
+        }
+    }
+
 };
 
 const OH::Storage::Bucket StorageTestBase::_buckets[2] = {
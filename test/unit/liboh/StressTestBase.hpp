@@ -36,6 +36,7 @@
 #include <cxxtest/TestSuite.h>
 #include <sirikata/oh/Storage.hpp>
 #include "DataFiles.hpp"
+#include <algorithm>
 
 class StressTestBase
 {
@@ -87,6 +88,10 @@ protected:
     // for.
     int32 _outstanding;
 
+    // Time each request took in Latency tests, for reporting percentiles
+    std::vector<Duration> _latencies;
+    Time _lastComplete;
+
 public:
     StressTestBase(String plugin, String type, String args)
      : _initialized(0),
@@ -101,7 +106,8 @@ public:
        _mainStrand(NULL),
        _work(NULL),
        _ctx(NULL),
-       _outstanding(0)
+       _outstanding(0),
+       _lastComplete(Time::null())
     {}
 
     void setUp() {
@@ -202,6 +208,17 @@ public:
 
     void waitForTransaction(boost::unique_lock<boost::mutex>& lock) {
         _cond.wait(lock);
+        // In Latency tests the next request is issued as soon as this returns,
+        // so the time since the last one completed is this request's latency.
+        Time now = Timer::now();
+        _latencies.push_back(now - _lastComplete);
+        _lastComplete = now;
+    }
+
+    Time startTiming() {
+        _latencies.clear();
+        _lastComplete = Timer::now();
+        return _lastComplete;
     }
 
     void testSetupTeardown() {
@@ -209,7 +226,12 @@ public:
     }
 
     void reportTiming(String name, Time start, Time end, TestType tt, int its) {
-        std::cout << name << " " << (end-start)/its << " per request, " << its / (end-start).seconds() << " transactions per second"  << std::endl;
+        std::cout << name << " " << (end-start)/its << " per request, " << its / (end-start).seconds() << " transactions per second";
+        if (tt == Latency && !_latencies.empty()) {
+            std::sort(_latencies.begin(), _latencies.end());
+            std::cout << ", p99 " << _latencies[std::min(_latencies.size() - 1, _latencies.size() * 99 / 100)];
+        }
+        std::cout << std::endl;
     }
 
     void testSingleWrites(String length, int keyNum, int bucketNum, TestType tt) {
@@ -218,7 +240,7 @@ public:
         using std::tr1::placeholders::_1;
         using std::tr1::placeholders::_2;
 
-        Time start = Timer::now();
+        Time start = startTiming();
 
         String key;
         for (int i=0; i<bucketNum; i++){
@@ -247,7 +269,7 @@ public:
 
         ReadSet rs=_data.dataSet;
 
-        Time start = Timer::now();
+        Time start = startTiming();
 
         String key;
         for (int i=0; i<bucketNum; i++){
@@ -274,7 +296,7 @@ public:
         using std::tr1::placeholders::_1;
         using std::tr1::placeholders::_2;
 
-        Time start = Timer::now();
+        Time start = startTiming();
 
         String key;
         for (int i=0; i<bucketNum; i++){
@@ -312,7 +334,7 @@ public:
         using std::tr1::placeholders::_1;
         using std::tr1::placeholders::_2;
 
-        Time start = Timer::now();
+        Time start = startTiming();
 
         String key;
         for (int i=0; i<bucketNum; i++){
@@ -343,7 +365,7 @@ public:
 
         ReadSet rs=_data.dataSet;
 
-        Time start = Timer::now();
+        Time start = startTiming();
 
         String key;
         for (int i=0; i<bucketNum; i++){
@@ -372,7 +394,7 @@ public:
         using std::tr1::placeholders::_1;
         using std::tr1::placeholders::_2;
 
-        Time start = Timer::now();
+        Time start = startTiming();
 
         String key;
         for (int i=0; i<bucketNum; i++){
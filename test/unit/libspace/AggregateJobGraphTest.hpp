@@ -0,0 +1,172 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/space/AggregateJobGraph.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+using namespace Sirikata;
+
+/** Runs jobs on a single thread so the order they run in is deterministic.
+ *  Jobs record that they ran and finish immediately, except for the gate job
+ *  which holds the thread until it's opened.
+ */
+class AggregateJobGraphTest : public CxxTest::TestSuite
+{
+    AggregateJobGraph* mGraph;
+
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    std::vector<UUID> mRan;
+    bool mGateOpen;
+
+    UUID mGate, mA, mB, mC;
+
+    void job(UUID id) {
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            mRan.push_back(id);
+            mCond.notify_all();
+        }
+        mGraph->finish(id);
+    }
+
+    void gateJob(UUID id) {
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            mRan.push_back(id);
+            mCond.notify_all();
+            while(!mGateOpen)
+                mCond.wait(lock);
+        }
+        mGraph->finish(id);
+    }
+
+    // Returns without finishing, like a job which has started an upload
+    void inFlightJob(UUID id) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mRan.push_back(id);
+        mCond.notify_all();
+    }
+
+    void add(const UUID& id, const std::vector<UUID>& deps, float64 priority) {
+        mGraph->add(id, deps, priority, std::tr1::bind(&AggregateJobGraphTest::job, this, id));
+    }
+
+    void addGate() {
+        mGraph->add(mGate, std::vector<UUID>(), 100, std::tr1::bind(&AggregateJobGraphTest::gateJob, this, mGate));
+        waitForRuns(1);
+    }
+
+    void openGate() {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mGateOpen = true;
+        mCond.notify_all();
+    }
+
+    void waitForRuns(uint32 count) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        while(mRan.size() < count)
+            mCond.wait(lock);
+    }
+
+    void waitForEmpty() {
+        while(mGraph->size() > 0)
+            Timer::sleep(Duration::milliseconds(1));
+    }
+
+public:
+    void setUp() {
+        mGraph = new AggregateJobGraph(1, "AggregateJobGraphTest");
+        mRan.clear();
+        mGateOpen = false;
+        mGate = UUID::random();
+        mA = UUID::random();
+        mB = UUID::random();
+        mC = UUID::random();
+    }
+
+    void tearDown() {
+        delete mGraph;
+        mGraph = NULL;
+    }
+
+    void testDependencyOrder() {
+        addGate();
+        std::vector<UUID> deps;
+        add(mA, deps, 1);
+        deps.push_back(mA);
+        // Higher priority, but has to wait for A
+        add(mB, deps, 10);
+        openGate();
+
+        waitForEmpty();
+        TS_ASSERT_EQUALS(mRan.size(), 3u);
+        if (mRan.size() == 3) {
+            TS_ASSERT(mRan[1] == mA);
+            TS_ASSERT(mRan[2] == mB);
+        }
+    }
+
+    void testReprioritizeReady() {
+        // While the gate holds the only thread, A and B are both ready, and
+        // raising A's priority has to move it ahead of B
+        addGate();
+        add(mA, std::vector<UUID>(), 1);
+        add(mB, std::vector<UUID>(), 2);
+        add(mA, std::vector<UUID>(), 3);
+        openGate();
+
+        waitForEmpty();
+        TS_ASSERT_EQUALS(mRan.size(), 3u);
+        if (mRan.size() == 3) {
+            TS_ASSERT(mRan[1] == mA);
+            TS_ASSERT(mRan[2] == mB);
+        }
+    }
+
+    void testRerunWaitsForNewDependencies() {
+        // Re-adding the running gate job with a new dependency on C means it
+        // reruns only after C, even though C has a lower priority
+        std::vector<UUID> deps;
+        addGate();
+        add(mC, deps, 1);
+        deps.push_back(mC);
+        mGraph->add(mGate, deps, 100, std::tr1::bind(&AggregateJobGraphTest::job, this, mGate));
+        openGate();
+
+        waitForEmpty();
+        TS_ASSERT_EQUALS(mRan.size(), 3u);
+        if (mRan.size() == 3) {
+            TS_ASSERT(mRan[0] == mGate);
+            TS_ASSERT(mRan[1] == mC);
+            TS_ASSERT(mRan[2] == mGate);
+        }
+    }
+
+    void testPeriodicRegenerationWhileInFlight() {
+        // A's job has returned but its upload is still outstanding when a
+        // periodic regeneration of A comes in
+        std::vector<UUID> deps;
+        mGraph->add(mA, deps, 1, std::tr1::bind(&AggregateJobGraphTest::inFlightJob, this, mA));
+        deps.push_back(mA);
+        add(mB, deps, 1);
+        waitForRuns(1);
+        add(mA, std::vector<UUID>(), 1);
+
+        // The first upload finishing mustn't release B, which has to be
+        // built from the regenerated mesh
+        mGraph->finish(mA);
+        waitForRuns(2);
+        waitForEmpty();
+        TS_ASSERT_EQUALS(mRan.size(), 3u);
+        if (mRan.size() == 3) {
+            TS_ASSERT(mRan[0] == mA);
+            TS_ASSERT(mRan[1] == mA);
+            TS_ASSERT(mRan[2] == mB);
+        }
+        TS_ASSERT_EQUALS(mGraph->finishedCount(), (uint64)2);
+    }
+};
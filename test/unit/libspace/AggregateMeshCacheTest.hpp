@@ -0,0 +1,205 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/space/AggregateMeshCache.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+
+using namespace Sirikata;
+
+class AggregateMeshCacheTest : public CxxTest::TestSuite
+{
+    static const String logfile;
+
+    static AggregateMeshCache::Entry entry(const String& uri, uint64 size, const Time& expires = Time::null()) {
+        AggregateMeshCache::Entry e;
+        e.uri = uri;
+        e.cdnBaseName = uri + "_base";
+        e.size = size;
+        e.expires = expires;
+        return e;
+    }
+
+    static bool has(AggregateMeshCache& cache, const String& key, String* uri = NULL) {
+        AggregateMeshCache::Entry e;
+        if (!cache.lookup(key, &e)) return false;
+        if (uri != NULL) *uri = e.uri;
+        return true;
+    }
+
+    static bool exists(const String& filename) {
+        std::FILE* fp = std::fopen(filename.c_str(), "rb");
+        if (fp == NULL) return false;
+        std::fclose(fp);
+        return true;
+    }
+
+    static uint32 countLines(const String& filename) {
+        std::FILE* fp = std::fopen(filename.c_str(), "rb");
+        if (fp == NULL) return 0;
+        uint32 lines = 0;
+        int c;
+        while((c = std::fgetc(fp)) != EOF)
+            if (c == '\n') lines++;
+        std::fclose(fp);
+        return lines;
+    }
+
+public:
+    void setUp() {
+        std::remove(logfile.c_str());
+    }
+
+    void tearDown() {
+        std::remove(logfile.c_str());
+    }
+
+    void testLRUEviction() {
+        AggregateMeshCache cache("", 300);
+        cache.insert("a", entry("meerkat:///a", 100));
+        cache.insert("b", entry("meerkat:///b", 100));
+        cache.insert("c", entry("meerkat:///c", 100));
+        TS_ASSERT_EQUALS(cache.numEntries(), 3u);
+        TS_ASSERT_EQUALS(cache.size(), (uint64)300);
+
+        // Using a makes b the least recently used
+        TS_ASSERT(has(cache, "a"));
+        cache.insert("d", entry("meerkat:///d", 100));
+        TS_ASSERT(!has(cache, "b"));
+        TS_ASSERT(has(cache, "a"));
+        TS_ASSERT(has(cache, "c"));
+        TS_ASSERT(has(cache, "d"));
+        TS_ASSERT_EQUALS(cache.size(), (uint64)300);
+
+        // Replacing an entry updates the size rather than adding to it
+        cache.insert("d", entry("meerkat:///d2", 50));
+        TS_ASSERT_EQUALS(cache.numEntries(), 3u);
+        TS_ASSERT_EQUALS(cache.size(), (uint64)250);
+
+        // An entry larger than the whole cache pushes everything else out,
+        // but is kept itself
+        cache.insert("huge", entry("meerkat:///huge", 1000));
+        TS_ASSERT_EQUALS(cache.numEntries(), 1u);
+        TS_ASSERT(has(cache, "huge"));
+
+        TS_ASSERT_EQUALS(cache.hits(), (uint64)5);
+    }
+
+    void testExpiry() {
+        AggregateMeshCache cache("", 1000);
+        cache.insert("expired", entry("meerkat:///expired", 10, Timer::now() - Duration::seconds(1)));
+        cache.insert("live", entry("meerkat:///live", 10, Timer::now() + Duration::seconds(3600)));
+        TS_ASSERT(!has(cache, "expired"));
+        TS_ASSERT_EQUALS(cache.numEntries(), 1u);
+        TS_ASSERT(has(cache, "live"));
+
+        cache.refresh("live", Timer::now() - Duration::seconds(1));
+        TS_ASSERT(!has(cache, "live"));
+        TS_ASSERT_EQUALS(cache.size(), (uint64)0);
+    }
+
+    void testReplay() {
+        Time expires = Timer::now() + Duration::seconds(3600);
+        {
+            AggregateMeshCache cache(logfile, 1000);
+            cache.insert("a", entry("meerkat:///a", 100, expires));
+            cache.insert("b", entry("meerkat:///b", 100));
+            cache.insert("c", entry("meerkat:///c", 100));
+            cache.insert("gone", entry("meerkat:///gone", 100));
+            cache.insert("expiring", entry("meerkat:///expiring", 100));
+            cache.remove("gone");
+            cache.refresh("expiring", Timer::now() - Duration::seconds(1));
+            cache.insert("b", entry("meerkat:///b2", 200));
+        }
+
+        {
+            AggregateMeshCache cache(logfile, 1000);
+            TS_ASSERT_EQUALS(cache.numEntries(), 3u);
+            TS_ASSERT_EQUALS(cache.size(), (uint64)400);
+
+            AggregateMeshCache::Entry e;
+            TS_ASSERT(cache.lookup("a", &e));
+            TS_ASSERT_EQUALS(e.uri, "meerkat:///a");
+            TS_ASSERT_EQUALS(e.cdnBaseName, "meerkat:///a_base");
+            TS_ASSERT_EQUALS(e.size, (uint64)100);
+            TS_ASSERT_EQUALS((e.expires - expires).toMicro(), 0);
+
+            String uri;
+            TS_ASSERT(has(cache, "b", &uri));
+            TS_ASSERT_EQUALS(uri, "meerkat:///b2");
+            TS_ASSERT(has(cache, "c"));
+            TS_ASSERT(!has(cache, "gone"));
+            TS_ASSERT(!has(cache, "expiring"));
+        }
+
+        // Restarting with a smaller capacity evicts the least recently used
+        // entries. Lookups aren't logged, so that is a and then c.
+        {
+            AggregateMeshCache cache(logfile, 250);
+            TS_ASSERT_EQUALS(cache.numEntries(), 1u);
+            TS_ASSERT(has(cache, "b"));
+        }
+    }
+
+    void testTornRecord() {
+        {
+            AggregateMeshCache cache(logfile, 1000);
+            cache.insert("a", entry("meerkat:///a", 100));
+        }
+        // A record cut short by a crash, without its size or newline
+        std::FILE* fp = std::fopen(logfile.c_str(), "ab");
+        TS_ASSERT(fp != NULL);
+        if (fp != NULL) {
+            std::fputs("+ b meerkat:///b meerkat:///b_base", fp);
+            std::fclose(fp);
+        }
+
+        AggregateMeshCache cache(logfile, 1000);
+        TS_ASSERT_EQUALS(cache.numEntries(), 1u);
+        TS_ASSERT(has(cache, "a"));
+        TS_ASSERT(!has(cache, "b"));
+    }
+
+    void testCompaction() {
+        // Rewriting the same entries over and over has to keep the log from
+        // growing without bound
+        const uint32 nrounds = 5000;
+        {
+            AggregateMeshCache cache(logfile, 1000);
+            for(uint32 i = 0; i < nrounds; i++) {
+                String key = (i % 2 == 0) ? "even" : "odd";
+                cache.insert(key, entry("meerkat:///" + boost::lexical_cast<String>(i), 10));
+            }
+            TS_ASSERT(countLines(logfile) < 2000);
+        }
+        // Starting up compacts the log down to one record per entry
+        AggregateMeshCache cache(logfile, 1000);
+        TS_ASSERT_EQUALS(countLines(logfile), 2u);
+        TS_ASSERT(!exists(logfile + ".tmp"));
+        String uri;
+        TS_ASSERT(has(cache, "even", &uri));
+        TS_ASSERT_EQUALS(uri, "meerkat:///" + boost::lexical_cast<String>(nrounds - 2));
+        TS_ASSERT(has(cache, "odd", &uri));
+        TS_ASSERT_EQUALS(uri, "meerkat:///" + boost::lexical_cast<String>(nrounds - 1));
+    }
+
+    void testKeyQuantization() {
+        AggregateMeshCache::KeyBuilder a, b, c;
+        a.addChild("meerkat:///mesh.dae", Vector3f(1, 2, 3), Quaternion(0, 0, 0, 1, Quaternion::XYZW()), 5.f);
+        a.setSimplificationTarget(1000);
+        // Slightly perturbed, and the same rotation with the opposite sign
+        b.addChild("meerkat:///mesh.dae", Vector3f(1.0001f, 2, 3), Quaternion(0, 0, 0, -1, Quaternion::XYZW()), 5.0001f);
+        b.setSimplificationTarget(1000);
+        c.addChild("meerkat:///other.dae", Vector3f(1, 2, 3), Quaternion(0, 0, 0, 1, Quaternion::XYZW()), 5.f);
+        c.setSimplificationTarget(1000);
+
+        String key = a.key();
+        TS_ASSERT_EQUALS(key, b.key());
+        TS_ASSERT(key != c.key());
+    }
+};
+
+const String AggregateMeshCacheTest::logfile("aggregate_mesh_cache_test.log");
@@ -0,0 +1,256 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/space/OSegLookupQueue.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/network/ObjectMessage.hpp>
+
+using namespace Sirikata;
+
+/** An OSeg which never knows the answer immediately and records every
+ *  request made to it. Lookups are completed by the test with complete().
+ */
+class RecordingOSeg : public OSegLookupProvider {
+public:
+    virtual OSegEntry lookup(const UUID& obj_id) {
+        requests.push_back(std::vector<UUID>(1, obj_id));
+        return OSegEntry::null();
+    }
+
+    virtual OSegEntry cacheLookup(const UUID& obj_id) {
+        return OSegEntry::null();
+    }
+
+    virtual void lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results) {
+        requests.push_back(obj_ids);
+        results->assign(obj_ids.size(), OSegEntry::null());
+    }
+
+    void complete(const UUID& obj_id, ServerID server) {
+        mLookupListener->osegLookupCompleted(obj_id, OSegEntry(server, 1.f));
+    }
+
+    std::vector< std::vector<UUID> > requests;
+};
+
+/** Drives an OSegLookupQueue from the test thread, which stands in for the
+ *  network strand. Anything the queue posts to the strand runs when the test
+ *  polls the IOService.
+ */
+class OSegLookupQueueTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::Protocol::Object::ObjectMessage ObjectMessage;
+
+    struct Result {
+        Result(const UUID& _dest, uint64 _unique, const OSegEntry& _entry, OSegLookupQueue::ResolvedFrom _from)
+         : dest(_dest), unique(_unique), entry(_entry), from(_from)
+        {}
+        UUID dest;
+        uint64 unique;
+        OSegEntry entry;
+        OSegLookupQueue::ResolvedFrom from;
+    };
+
+    Network::IOService* _ios;
+    Network::IOStrand* _strand;
+    RecordingOSeg* _oseg;
+    OSegLookupQueue* _queue;
+
+    std::vector<Result> _results;
+    uint64 _nextUnique;
+
+    void createQueue(uint32 max_lookups, size_t max_size, uint32 batch_size) {
+        _queue = new OSegLookupQueue(NULL, _strand, _oseg, max_lookups, max_size, batch_size);
+    }
+
+    void handleResult(ObjectMessage* msg, const OSegEntry& entry, OSegLookupQueue::ResolvedFrom from) {
+        _results.push_back(Result(msg->dest_object(), msg->unique(), entry, from));
+        delete msg;
+    }
+
+    ObjectMessage* message(const UUID& dest) {
+        ObjectMessage* msg = new ObjectMessage();
+        msg->set_source_object(UUID::random());
+        msg->set_source_port(1);
+        msg->set_dest_object(dest);
+        msg->set_dest_port(1);
+        msg->set_unique(_nextUnique++);
+        msg->set_payload(String(100, 'x'));
+        return msg;
+    }
+
+    // Returns the message's unique ID, or 0 if it was rejected
+    uint64 lookup(const UUID& dest) {
+        ObjectMessage* msg = message(dest);
+        uint64 unique = msg->unique();
+        bool accepted = _queue->lookup(
+            msg,
+            std::tr1::bind(&OSegLookupQueueTest::handleResult, this,
+                std::tr1::placeholders::_1, std::tr1::placeholders::_2, std::tr1::placeholders::_3)
+        );
+        if (accepted) return unique;
+        delete msg;
+        return 0;
+    }
+
+    void poll() {
+        _ios->poll();
+        _ios->reset();
+    }
+
+    uint32 countResults(OSegLookupQueue::ResolvedFrom from) {
+        uint32 count = 0;
+        for(uint32 i = 0; i < _results.size(); i++)
+            if (_results[i].from == from) count++;
+        return count;
+    }
+
+public:
+    void setUp() {
+        _ios = new Network::IOService("OSegLookupQueueTest");
+        _strand = _ios->createStrand("OSegLookupQueueTest");
+        _oseg = new RecordingOSeg();
+        _queue = NULL;
+        _results.clear();
+        _nextUnique = 1;
+    }
+
+    void tearDown() {
+        delete _queue;
+        _queue = NULL;
+        delete _oseg;
+        _oseg = NULL;
+        delete _strand;
+        _strand = NULL;
+        delete _ios;
+        _ios = NULL;
+    }
+
+    void testUnbatched() {
+        createQueue(100, 0, 0);
+        UUID a = UUID::random(), b = UUID::random();
+        lookup(a);
+        lookup(b);
+        lookup(a);
+        // One request per object, with the second message for a coalesced
+        // onto the first lookup
+        TS_ASSERT_EQUALS(_oseg->requests.size(), 2u);
+        TS_ASSERT_EQUALS(_queue->numLookups(), 2u);
+
+        _oseg->complete(a, 2);
+        _oseg->complete(b, 3);
+        poll();
+        TS_ASSERT_EQUALS(_results.size(), 3u);
+        TS_ASSERT_EQUALS(countResults(OSegLookupQueue::ResolvedFromServer), 3u);
+        for(uint32 i = 0; i < _results.size(); i++)
+            TS_ASSERT_EQUALS(_results[i].entry.server(), (_results[i].dest == a) ? 2u : 3u);
+        TS_ASSERT_EQUALS(_queue->numLookups(), 0u);
+        TS_ASSERT_EQUALS(_queue->queuedBytes(), 0u);
+        TS_ASSERT_EQUALS(_queue->latencies().count(), (uint64)2);
+    }
+
+    void testBatching() {
+        createQueue(100, 0, 4);
+        std::vector<UUID> ids;
+        for(uint32 i = 0; i < 6; i++)
+            ids.push_back(UUID::random());
+
+        // Duplicates don't take up space in the batch, so the fourth unique
+        // object fills it and it is issued right away
+        lookup(ids[0]);
+        lookup(ids[1]);
+        lookup(ids[0]);
+        lookup(ids[2]);
+        TS_ASSERT_EQUALS(_oseg->requests.size(), 0u);
+        lookup(ids[3]);
+        TS_ASSERT_EQUALS(_oseg->requests.size(), 1u);
+        if (_oseg->requests.size() == 1) {
+            TS_ASSERT_EQUALS(_oseg->requests[0].size(), 4u);
+            for(uint32 i = 0; i < 4 && i < _oseg->requests[0].size(); i++)
+                TS_ASSERT(_oseg->requests[0][i] == ids[i]);
+        }
+
+        // The rest wait until the strand is free
+        lookup(ids[4]);
+        lookup(ids[5]);
+        lookup(ids[4]);
+        TS_ASSERT_EQUALS(_oseg->requests.size(), 1u);
+        poll();
+        TS_ASSERT_EQUALS(_oseg->requests.size(), 2u);
+        if (_oseg->requests.size() == 2)
+            TS_ASSERT_EQUALS(_oseg->requests[1].size(), 2u);
+        TS_ASSERT_EQUALS(_queue->lookupsIssued(), (uint64)6);
+        TS_ASSERT_EQUALS(_queue->requestsIssued(), (uint64)2);
+
+        // A message for an object in an issued batch coalesces onto it
+        lookup(ids[1]);
+        poll();
+        TS_ASSERT_EQUALS(_oseg->requests.size(), 2u);
+
+        for(uint32 i = 0; i < ids.size(); i++)
+            _oseg->complete(ids[i], i + 1);
+        poll();
+        TS_ASSERT_EQUALS(_results.size(), 9u);
+        TS_ASSERT_EQUALS(countResults(OSegLookupQueue::ResolvedFromServer), 9u);
+        TS_ASSERT_EQUALS(_queue->numLookups(), 0u);
+        TS_ASSERT_EQUALS(_queue->latencies().count(), (uint64)6);
+    }
+
+    void testLoadShedding() {
+        // Room for three messages
+        ObjectMessage* sample = message(UUID::random());
+        size_t msg_size = sample->ByteSize();
+        delete sample;
+        createQueue(100, 3 * msg_size, 0);
+
+        UUID a = UUID::random(), b = UUID::random(), c = UUID::random();
+        uint64 first = lookup(a);
+        uint64 second = lookup(b);
+        lookup(a);
+        lookup(c);
+        TS_ASSERT(_queue->queuedBytes() <= 3 * msg_size);
+
+        // The oldest message was dropped, even though its lookup is still
+        // outstanding for the newer message to the same object
+        TS_ASSERT_EQUALS(_results.size(), 1u);
+        if (_results.size() == 1) {
+            TS_ASSERT_EQUALS(_results[0].unique, first);
+            TS_ASSERT_EQUALS(_results[0].from, OSegLookupQueue::Dropped);
+            TS_ASSERT(_results[0].entry.isNull());
+        }
+        TS_ASSERT_EQUALS(_queue->numLookups(), 3u);
+
+        lookup(c);
+        TS_ASSERT_EQUALS(_results.size(), 2u);
+        if (_results.size() == 2)
+            TS_ASSERT_EQUALS(_results[1].unique, second);
+        TS_ASSERT_EQUALS(_queue->messagesDropped(), (uint64)2);
+
+        // b's lookup has no messages left but still completes normally, and
+        // only the three remaining messages are delivered
+        TS_ASSERT_EQUALS(_oseg->requests.size(), 3u);
+        _oseg->complete(a, 2);
+        _oseg->complete(b, 3);
+        _oseg->complete(c, 4);
+        poll();
+        TS_ASSERT_EQUALS(_results.size(), 5u);
+        TS_ASSERT_EQUALS(countResults(OSegLookupQueue::ResolvedFromServer), 3u);
+        TS_ASSERT_EQUALS(_queue->queuedBytes(), 0u);
+        TS_ASSERT_EQUALS(_queue->numLookups(), 0u);
+    }
+
+    void testRejectsTooManyLookups() {
+        createQueue(2, 0, 0);
+        UUID a = UUID::random();
+        TS_ASSERT(lookup(a) != 0);
+        TS_ASSERT(lookup(UUID::random()) != 0);
+        TS_ASSERT(lookup(UUID::random()) != 0);
+        TS_ASSERT_EQUALS(lookup(UUID::random()), (uint64)0);
+        // Objects already being looked up are still accepted
+        TS_ASSERT(lookup(a) != 0);
+        TS_ASSERT_EQUALS(_oseg->requests.size(), 3u);
+    }
+};
@@ -0,0 +1,360 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/network/IOStrandImpl.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include "../../../libspace/plugins/redis/RedisLookupBatcher.hpp"
+#include <boost/asio.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/lexical_cast.hpp>
+
+/** A Redis server which just answers the commands the OSeg uses from an
+ *  in-memory map, so the client can be tested without a real server. It counts
+ *  the commands it receives so tests can check how requests were combined.
+ */
+class FakeRedis {
+    typedef boost::asio::ip::tcp tcp;
+    typedef std::tr1::shared_ptr<tcp::socket> SocketPtr;
+    typedef std::tr1::shared_ptr<std::string> BufferPtr;
+public:
+    FakeRedis(Network::IOService* ios)
+     : mService(ios->asioService()),
+       mAcceptor(mService, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+       mFail(false),
+       mKeysRequested(0)
+    {
+        accept();
+    }
+
+    uint16 port() {
+        return mAcceptor.local_endpoint().port();
+    }
+
+    void set(const String& key, const String& value) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mData[key] = value;
+    }
+
+    // Reply to everything but PING with errors
+    void fail(bool f) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mFail = f;
+    }
+
+    uint32 commands(const String& name) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        return mCommandCounts[name];
+    }
+
+    uint32 keysRequested() {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        return mKeysRequested;
+    }
+
+private:
+    void accept() {
+        SocketPtr sock(new tcp::socket(mService));
+        mAcceptor.async_accept(*sock,
+            std::tr1::bind(&FakeRedis::handleAccept, this, sock, std::tr1::placeholders::_1));
+    }
+
+    void handleAccept(SocketPtr sock, const boost::system::error_code& ec) {
+        if (ec) return;
+        read(sock, BufferPtr(new std::string()));
+        accept();
+    }
+
+    void read(SocketPtr sock, BufferPtr buffer) {
+        sock->async_read_some(boost::asio::buffer(mReadBuffer),
+            std::tr1::bind(&FakeRedis::handleRead, this, sock, buffer, std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    }
+
+    void handleRead(SocketPtr sock, BufferPtr buffer, const boost::system::error_code& ec, std::size_t bytes) {
+        if (ec) return;
+        buffer->append(mReadBuffer, bytes);
+
+        std::string response;
+        std::vector<String> cmd;
+        while(parseCommand(buffer.get(), &cmd))
+            response += execute(cmd);
+        if (!response.empty())
+            boost::asio::write(*sock, boost::asio::buffer(response));
+
+        read(sock, buffer);
+    }
+
+    // Parses one length prefixed line, e.g. *3 or $10, from the front of buffer
+    static bool parseLength(const std::string& buffer, std::size_t* pos, char type, int32* len) {
+        std::size_t end = buffer.find("\r\n", *pos);
+        if (end == std::string::npos) return false;
+        TS_ASSERT_EQUALS(buffer[*pos], type);
+        *len = atoi(buffer.c_str() + *pos + 1);
+        *pos = end + 2;
+        return true;
+    }
+
+    // Clients always send commands as arrays of bulk strings
+    static bool parseCommand(std::string* buffer, std::vector<String>* cmd) {
+        cmd->clear();
+        std::size_t pos = 0;
+        int32 nargs;
+        if (!parseLength(*buffer, &pos, '*', &nargs)) return false;
+        for(int32 i = 0; i < nargs; i++) {
+            int32 len;
+            if (!parseLength(*buffer, &pos, '$', &len)) return false;
+            if (buffer->size() < pos + len + 2) return false;
+            cmd->push_back(buffer->substr(pos, len));
+            pos += len + 2;
+        }
+        buffer->erase(0, pos);
+        return true;
+    }
+
+    static std::string bulk(const String* val) {
+        if (val == NULL) return "$-1\r\n";
+        std::ostringstream os;
+        os << "$" << val->size() << "\r\n" << *val << "\r\n";
+        return os.str();
+    }
+
+    static std::string integer(int32 val) {
+        std::ostringstream os;
+        os << ":" << val << "\r\n";
+        return os.str();
+    }
+
+    const String* get(const String& key) {
+        DataMap::iterator it = mData.find(key);
+        return (it == mData.end() ? NULL : &it->second);
+    }
+
+    std::string execute(const std::vector<String>& cmd) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+
+        String name = cmd[0];
+        mCommandCounts[name]++;
+
+        if (name == "PING")
+            return "+PONG\r\n";
+        if (mFail)
+            return "-ERR fake failure\r\n";
+
+        if (name == "GET" && cmd.size() == 2) {
+            mKeysRequested++;
+            return bulk(get(cmd[1]));
+        }
+        if (name == "MGET") {
+            std::ostringstream os;
+            os << "*" << cmd.size()-1 << "\r\n";
+            for(uint32 i = 1; i < cmd.size(); i++)
+                os << bulk(get(cmd[i]));
+            mKeysRequested += cmd.size()-1;
+            return os.str();
+        }
+        if (name == "SET" && cmd.size() == 3) {
+            mData[cmd[1]] = cmd[2];
+            return "+OK\r\n";
+        }
+        if (name == "SETNX" && cmd.size() == 3) {
+            if (get(cmd[1]) != NULL) return integer(0);
+            mData[cmd[1]] = cmd[2];
+            return integer(1);
+        }
+        if (name == "DEL" && cmd.size() == 2)
+            return integer(mData.erase(cmd[1]));
+
+        return "-ERR unknown command '" + name + "'\r\n";
+    }
+
+    boost::asio::io_service& mService;
+    tcp::acceptor mAcceptor;
+    char mReadBuffer[4096];
+
+    boost::mutex mMutex;
+    typedef std::map<String, String> DataMap;
+    DataMap mData;
+    bool mFail;
+    std::map<String, uint32> mCommandCounts;
+    uint32 mKeysRequested;
+};
+
+class RedisLookupBatcherTest : public CxxTest::TestSuite
+{
+    static const String prefix;
+    static const uint32 batchSize = 16;
+
+    Network::IOService* _ios;
+    Network::IOStrand* _strand;
+    Network::IOWork* _work;
+    Thread* _thread;
+
+    FakeRedis* _redis;
+    RedisConnection* _conn;
+    RedisLookupBatcher* _batcher;
+
+    // Lookups complete in the IOService's thread, so results are collected
+    // under the lock and the test thread waits on the CV for them.
+    boost::mutex _mutex;
+    boost::condition_variable _cond;
+    typedef std::map<UUID, String> ResultMap;
+    ResultMap _results;
+    uint32 _numResults;
+
+    std::vector<UUID> _ids;
+
+public:
+    void setUp() {
+        _ios = new Network::IOService("RedisLookupBatcherTest");
+        _strand = _ios->createStrand("RedisLookupBatcherTest");
+        _work = new Network::IOWork(*_ios, "RedisLookupBatcherTest");
+
+        _redis = new FakeRedis(_ios);
+        _conn = new RedisConnection(_ios, "127.0.0.1", _redis->port());
+        _batcher = new RedisLookupBatcher(
+            _strand, _conn, prefix, batchSize, Duration::milliseconds(20.f),
+            std::tr1::bind(&RedisLookupBatcherTest::handleResult, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2)
+        );
+
+        _results.clear();
+        _numResults = 0;
+
+        // Every other object is stored
+        _ids.clear();
+        for(uint32 i = 0; i < 40; i++) {
+            _ids.push_back(UUID::random());
+            if (i % 2 == 0)
+                _redis->set(prefix + _ids[i].toString(), boost::lexical_cast<String>(i) + ":10");
+        }
+
+        _thread = new Thread("RedisLookupBatcherTest", std::tr1::bind(&Network::IOService::runNoReturn, _ios));
+    }
+
+    void tearDown() {
+        delete _work;
+        _work = NULL;
+        _ios->stop();
+        _thread->join();
+        delete _thread;
+        _thread = NULL;
+
+        // Must disconnect before destroying the batcher, completing any
+        // outstanding lookups
+        _conn->disconnect();
+        delete _batcher;
+        _batcher = NULL;
+        delete _conn;
+        _conn = NULL;
+        delete _redis;
+        _redis = NULL;
+
+        delete _strand;
+        _strand = NULL;
+        delete _ios;
+        _ios = NULL;
+    }
+
+    void handleResult(const UUID& id, const String* value) {
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        if (value != NULL)
+            _results[id] = *value;
+        _numResults++;
+        _cond.notify_one();
+    }
+
+    // Returns false if the results didn't arrive in time
+    bool waitForResults(uint32 n) {
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        while(_numResults < n) {
+            if (!_cond.timed_wait(lock, boost::posix_time::seconds(5)))
+                return false;
+        }
+        return true;
+    }
+
+    void lookupEach(std::vector<UUID> ids) {
+        for(uint32 i = 0; i < ids.size(); i++)
+            _batcher->lookup(ids[i]);
+    }
+
+    void lookupAll(std::vector<UUID> ids) {
+        _batcher->lookup(ids);
+    }
+
+    void checkResults() {
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        TS_ASSERT_EQUALS(_results.size(), _ids.size() / 2);
+        for(uint32 i = 0; i < _ids.size(); i++) {
+            ResultMap::iterator it = _results.find(_ids[i]);
+            if (i % 2 == 0) {
+                TS_ASSERT(it != _results.end());
+                if (it != _results.end())
+                    TS_ASSERT_EQUALS(it->second, boost::lexical_cast<String>(i) + ":10");
+            }
+            else {
+                TS_ASSERT(it == _results.end());
+            }
+        }
+    }
+
+    void testIndividualLookupsAreBatched() {
+        _strand->post(std::tr1::bind(&RedisLookupBatcherTest::lookupEach, this, _ids));
+        TS_ASSERT(waitForResults(_ids.size()));
+        checkResults();
+
+        // Two full batches are sent immediately, the rest when the window
+        // expires
+        TS_ASSERT_EQUALS(_redis->commands("MGET"), 3);
+        TS_ASSERT_EQUALS(_redis->commands("GET"), 0);
+        TS_ASSERT_EQUALS(_redis->keysRequested(), _ids.size());
+        TS_ASSERT_EQUALS(_batcher->requestsIssued(), 3);
+    }
+
+    void testWindowCombinesSeparateLookups() {
+        // Separate events on the strand, but well within the window
+        std::vector<UUID> first(_ids.begin(), _ids.begin() + 5);
+        std::vector<UUID> second(_ids.begin() + 5, _ids.begin() + 10);
+        _strand->post(std::tr1::bind(&RedisLookupBatcherTest::lookupEach, this, first));
+        _strand->post(std::tr1::bind(&RedisLookupBatcherTest::lookupEach, this, second));
+        TS_ASSERT(waitForResults(10));
+
+        TS_ASSERT_EQUALS(_redis->commands("MGET"), 1);
+        TS_ASSERT_EQUALS(_redis->keysRequested(), 10);
+    }
+
+    void testBatchLookupIsSplitAtMaximum() {
+        _strand->post(std::tr1::bind(&RedisLookupBatcherTest::lookupAll, this, _ids));
+        TS_ASSERT(waitForResults(_ids.size()));
+        checkResults();
+
+        TS_ASSERT_EQUALS(_redis->commands("MGET"), 3);
+        TS_ASSERT_EQUALS(_batcher->keysRequested(), _ids.size());
+    }
+
+    void testErrorFailsWholeBatch() {
+        _redis->fail(true);
+        _strand->post(std::tr1::bind(&RedisLookupBatcherTest::lookupAll, this, _ids));
+        TS_ASSERT(waitForResults(_ids.size()));
+
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        TS_ASSERT_EQUALS(_results.size(), 0);
+    }
+
+    void testBatchesAreReused() {
+        // Run several rounds, making sure lookups keep working as the pooled
+        // request state is reused
+        for(uint32 round = 1; round <= 3; round++) {
+            _strand->post(std::tr1::bind(&RedisLookupBatcherTest::lookupAll, this, _ids));
+            TS_ASSERT(waitForResults(round * _ids.size()));
+        }
+        checkResults();
+        TS_ASSERT_EQUALS(_redis->commands("MGET"), 9);
+    }
+};
+
+const String RedisLookupBatcherTest::prefix("test:");
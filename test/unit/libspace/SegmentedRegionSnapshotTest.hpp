@@ -0,0 +1,177 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/BoundingBox.hpp>
+#include <sirikata/space/SegmentedRegion.hpp>
+
+using namespace Sirikata;
+
+/** Applies random sequences of splits and merges, like the ones
+ *  LoadBalancer makes, to a SegmentedRegion tree and checks that a
+ *  SegmentedRegionSnapshot of it gives exactly the same answers as the tree.
+ */
+class SegmentedRegionSnapshotTest : public CxxTest::TestSuite
+{
+    // Small deterministic generator so failures are reproducible
+    uint32 mSeed;
+
+    uint32 next() {
+        mSeed = mSeed * 1103515245 + 12345;
+        return (mSeed >> 16) & 0x7fff;
+    }
+    float32 uniform(float32 lo, float32 hi) {
+        return lo + (hi - lo) * (next() / 32767.f);
+    }
+
+    SegmentedRegion* mRoot;
+    std::vector<SegmentedRegion*> mLeaves;
+    ServerID mNextServer;
+
+    void collectLeaves(SegmentedRegion* region, std::vector<SegmentedRegion*>& leaves) {
+        if (region->mLeftChild == NULL && region->mRightChild == NULL) {
+            leaves.push_back(region);
+            return;
+        }
+        collectLeaves(region->mLeftChild, leaves);
+        collectLeaves(region->mRightChild, leaves);
+    }
+
+    void split(SegmentedRegion* leaf) {
+        const BoundingBox3f& bbox = leaf->mBoundingBox;
+        uint32 axis = next() % 3;
+        float32 at = uniform(bbox.min()[axis], bbox.max()[axis]);
+
+        Vector3f left_max = bbox.max(), right_min = bbox.min();
+        left_max[axis] = at;
+        right_min[axis] = at;
+
+        leaf->mLeftChild = new SegmentedRegion(leaf);
+        leaf->mRightChild = new SegmentedRegion(leaf);
+        leaf->mLeftChild->mBoundingBox = BoundingBox3f(bbox.min(), left_max);
+        leaf->mRightChild->mBoundingBox = BoundingBox3f(right_min, bbox.max());
+        // Occasionally leave a gap between the children so the node isn't
+        // cleanly split and the snapshot has to fall back to the tree
+        if (next() % 8 == 0) {
+            Vector3f gap_min = right_min;
+            gap_min[axis] = at + (bbox.max()[axis] - at) * 0.25f;
+            leaf->mRightChild->mBoundingBox = BoundingBox3f(gap_min, bbox.max());
+        }
+        leaf->mLeftChild->mServer = leaf->mServer;
+        // Sometimes give the new region to a server which already has one
+        leaf->mRightChild->mServer = (next() % 4 == 0) ? leaf->mServer : mNextServer++;
+        leaf->mSplitAxis = (SegmentedRegion::SplitAxis)axis;
+    }
+
+    void merge(SegmentedRegion* leaf) {
+        SegmentedRegion* parent = leaf->mParent;
+        if (parent == NULL) return;
+        if (parent->mLeftChild->mLeftChild != NULL || parent->mRightChild->mLeftChild != NULL)
+            return;
+        parent->mServer = parent->mLeftChild->mServer;
+        parent->destroy();
+        parent->mSplitAxis = SegmentedRegion::UNDEFINED;
+    }
+
+    void randomUpdate() {
+        mLeaves.clear();
+        collectLeaves(mRoot, mLeaves);
+        SegmentedRegion* leaf = mLeaves[next() % mLeaves.size()];
+        if (mLeaves.size() < 4 || next() % 3 != 0)
+            split(leaf);
+        else
+            merge(leaf);
+    }
+
+    Vector3f randomPoint() {
+        // Includes points just outside the root
+        const BoundingBox3f& bbox = mRoot->mBoundingBox;
+        return Vector3f(
+            uniform(bbox.min().x - 10, bbox.max().x + 10),
+            uniform(bbox.min().y - 10, bbox.max().y + 10),
+            uniform(bbox.min().z - 10, bbox.max().z + 10)
+        );
+    }
+
+    void compare(const SegmentedRegionSnapshot& snapshot) {
+        // Points, including ones exactly on splitting planes
+        std::vector<Vector3f> points;
+        for(uint32 i = 0; i < 200; i++)
+            points.push_back(randomPoint());
+        mLeaves.clear();
+        collectLeaves(mRoot, mLeaves);
+        for(uint32 i = 0; i < mLeaves.size(); i++) {
+            points.push_back(mLeaves[i]->mBoundingBox.min());
+            points.push_back(mLeaves[i]->mBoundingBox.max());
+            points.push_back(mLeaves[i]->mBoundingBox.center());
+        }
+
+        std::vector<ServerID> batched(points.size());
+        snapshot.lookup(&points[0], points.size(), &batched[0]);
+        for(uint32 i = 0; i < points.size(); i++) {
+            SegmentedRegion* expected = mRoot->lookup(points[i]);
+            TS_ASSERT_EQUALS(snapshot.lookup(points[i]), expected);
+            TS_ASSERT_EQUALS(batched[i], (expected != NULL) ? expected->mServer : NullServerID);
+        }
+
+        // Boxes, which must produce the same leaves in the same order
+        for(uint32 i = 0; i < 50; i++) {
+            Vector3f a = randomPoint(), b = randomPoint();
+            BoundingBox3f bbox(a.min(b), a.max(b));
+            std::vector<SegmentedRegion*> expected, actual;
+            mRoot->lookupBoundingBox(bbox, expected);
+            snapshot.lookupBoundingBox(bbox, actual);
+            TS_ASSERT(expected == actual);
+        }
+
+        // Per server queries
+        for(ServerID server = 1; server < mNextServer; server++) {
+            BoundingBoxList expected, actual;
+            mRoot->serverRegion(server, expected);
+            snapshot.serverRegion(server, actual);
+            TS_ASSERT(expected == actual);
+
+            SegmentedRegion* region = snapshot.lookupSegmentedRegion(server);
+            if (expected.empty()) {
+                TS_ASSERT(region == NULL);
+            }
+            else {
+                TS_ASSERT(region != NULL);
+                if (region != NULL)
+                    TS_ASSERT(region->mBoundingBox == expected[0]);
+            }
+        }
+    }
+
+public:
+    void setUp() {
+        mSeed = 42;
+        mRoot = new SegmentedRegion(NULL);
+        mRoot->mBoundingBox = BoundingBox3f(Vector3f(-1000, -1000, -100), Vector3f(1000, 1000, 100));
+        mRoot->mServer = 1;
+        mNextServer = 2;
+    }
+
+    void tearDown() {
+        mRoot->destroy();
+        delete mRoot;
+    }
+
+    void testSingleRegion() {
+        SegmentedRegionSnapshot snapshot;
+        snapshot.build(mRoot);
+        compare(snapshot);
+    }
+
+    void testRandomUpdates() {
+        for(uint32 round = 0; round < 200; round++) {
+            randomUpdate();
+
+            SegmentedRegionSnapshot snapshot;
+            snapshot.build(mRoot);
+            compare(snapshot);
+        }
+    }
+};
@@ -0,0 +1,99 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/space/ServerRegionIndex.hpp>
+#include <algorithm>
+
+using namespace Sirikata;
+
+class ServerRegionIndexTest : public CxxTest::TestSuite
+{
+    static BoundingBox3f box(float32 x0, float32 y0, float32 z0, float32 x1, float32 y1, float32 z1) {
+        return BoundingBox3f(Vector3f(x0, y0, z0), Vector3f(x1, y1, z1));
+    }
+
+    static bool hasServer(const std::vector<ServerID>& servers, ServerID id) {
+        return std::find(servers.begin(), servers.end(), id) != servers.end();
+    }
+
+public:
+    void testPointLookup() {
+        ServerRegionIndex index;
+        // Enough regions to force the hierarchy to be built
+        for(uint32 i = 0; i < 100; i++)
+            index.insert(box(i, 0, 0, i+1, 1, 1), i+1);
+
+        TS_ASSERT_EQUALS(index.size(), (uint32)100);
+        TS_ASSERT_EQUALS(index.lookup(Vector3f(0.5f, 0.5f, 0.5f)), (ServerID)1);
+        TS_ASSERT_EQUALS(index.lookup(Vector3f(57.5f, 0.5f, 0.5f)), (ServerID)58);
+        TS_ASSERT_EQUALS(index.lookup(Vector3f(57.5f, 5.f, 0.5f)), NullServerID);
+        // Inserting the same region again does nothing
+        TS_ASSERT(!index.insert(box(3, 0, 0, 4, 1, 1), 4));
+    }
+
+    void testFullCoverage() {
+        ServerRegionIndex index;
+        index.insert(box(0, 0, 0, 10, 10, 10), 1);
+        index.insert(box(10, 0, 0, 20, 10, 10), 2);
+        index.insert(box(0, 10, 0, 20, 20, 10), 3);
+
+        std::vector<ServerID> servers;
+        TS_ASSERT(index.lookupBoundingBox(box(5, 5, 2, 15, 15, 8), &servers));
+        TS_ASSERT_EQUALS(servers.size(), (size_t)3);
+        TS_ASSERT(hasServer(servers, 1));
+        TS_ASSERT(hasServer(servers, 2));
+        TS_ASSERT(hasServer(servers, 3));
+
+        servers.clear();
+        TS_ASSERT(index.lookupBoundingBox(box(1, 1, 1, 9, 9, 9), &servers));
+        TS_ASSERT_EQUALS(servers.size(), (size_t)1);
+        TS_ASSERT(hasServer(servers, 1));
+    }
+
+    void testPartialCoverage() {
+        ServerRegionIndex index;
+        index.insert(box(0, 0, 0, 10, 10, 10), 1);
+        index.insert(box(10, 0, 0, 20, 10, 10), 2);
+
+        // Sticks out of the known regions
+        std::vector<ServerID> servers;
+        TS_ASSERT(!index.lookupBoundingBox(box(5, 5, 5, 15, 15, 8), &servers));
+        TS_ASSERT(hasServer(servers, 1));
+        TS_ASSERT(hasServer(servers, 2));
+
+        // A hole in the middle, with enough volume around it to make up for
+        // the missing piece if volumes were just added up
+        ServerRegionIndex holes;
+        holes.insert(box(0, 0, 0, 10, 10, 10), 1);
+        holes.insert(box(0, 0, 0, 5, 5, 5), 2);
+        holes.insert(box(20, 0, 0, 30, 10, 10), 3);
+        servers.clear();
+        TS_ASSERT(!holes.lookupBoundingBox(box(0, 0, 0, 20, 10, 10), &servers));
+    }
+
+    void testOverlappingRegions() {
+        ServerRegionIndex index;
+        // Two stale, overlapping regions whose volumes add up to the query
+        // box, but which leave part of it uncovered
+        index.insert(box(0, 0, 0, 6, 10, 10), 1);
+        index.insert(box(2, 0, 0, 8, 10, 10), 2);
+
+        std::vector<ServerID> servers;
+        TS_ASSERT(!index.lookupBoundingBox(box(0, 0, 0, 12, 10, 10), &servers));
+
+        // Even if they do cover the box, overlapping regions mean some are
+        // stale, so the answer can't be trusted
+        servers.clear();
+        TS_ASSERT(!index.lookupBoundingBox(box(0, 0, 0, 8, 10, 10), &servers));
+
+        // Regions that only share a face don't overlap
+        ServerRegionIndex touching;
+        touching.insert(box(0, 0, 0, 6, 10, 10), 1);
+        touching.insert(box(6, 0, 0, 12, 10, 10), 2);
+        servers.clear();
+        TS_ASSERT(touching.lookupBoundingBox(box(0, 0, 0, 12, 10, 10), &servers));
+        TS_ASSERT_EQUALS(servers.size(), (size_t)2);
+    }
+};
@@ -0,0 +1,195 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/space/ShardedOSegCache.hpp>
+#include <sirikata/core/service/Context.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/Thread.hpp>
+
+using namespace Sirikata;
+
+/** The cache is never started, so it never reports stats and the Context's
+ *  strand never has to run. Its clock only moves when the test calls
+ *  simTime().
+ */
+class ShardedOSegCacheTest : public CxxTest::TestSuite
+{
+    Network::IOService* _ios;
+    Network::IOStrand* _strand;
+    Context* _ctx;
+
+    std::vector<UUID> _keys;
+
+    // Writers alternate between versions of each key's entry. Each version
+    // keeps server and radius consistent with each other and with the key,
+    // so a reader can tell if it saw a torn or misplaced entry.
+    static OSegEntry entryFor(uint32 key, uint32 version) {
+        uint32 server = key * 1000 + (version % 1000) + 1;
+        return OSegEntry(server, (float)server);
+    }
+
+    void makeKeys(uint32 n) {
+        _keys.clear();
+        for(uint32 i = 0; i < n; i++)
+            _keys.push_back(UUID::random());
+    }
+
+    struct ReaderState {
+        ReaderState() : hits(0), bad(0) {}
+        uint32 hits;
+        uint32 bad;
+    };
+
+    void readerMain(ShardedOSegCache* cache, AtomicValue<bool>* done, ReaderState* state) {
+        uint32 i = 0;
+        while(!done->read()) {
+            uint32 key = i++ % _keys.size();
+            OSegEntry entry = cache->get(_keys[key]);
+            if (entry.isNull()) continue;
+            state->hits++;
+            if (entry.radius() != (float)entry.server() || (entry.server() - 1) / 1000 != key)
+                state->bad++;
+        }
+    }
+
+public:
+    void setUp() {
+        _ios = new Network::IOService("ShardedOSegCacheTest");
+        _strand = _ios->createStrand("ShardedOSegCacheTest");
+        _ctx = new Context("ShardedOSegCacheTest", _ios, _strand, NULL, Timer::now());
+        _ctx->simTime();
+    }
+
+    void tearDown() {
+        delete _ctx;
+        delete _strand;
+        delete _ios;
+        _keys.clear();
+    }
+
+    void testMatchesModel() {
+        // 16 keys in one shard sized for 16 never evicts, so the cache has to
+        // agree exactly with a map. The shard's table has 32 slots, so
+        // clusters regularly wrap around its end and removals have to shift
+        // entries back across it.
+        ShardedOSegCache cache(_ctx, "test.oseg.cache", 16, Duration::zero(), 1);
+        makeKeys(16);
+        std::map<uint32, OSegEntry> model;
+
+        srand(1);
+        for(uint32 op = 0; op < 20000; op++) {
+            uint32 key = rand() % _keys.size();
+            switch(rand() % 3) {
+              case 0:
+                cache.insert(_keys[key], entryFor(key, op));
+                model[key] = entryFor(key, op);
+                break;
+              case 1:
+                cache.remove(_keys[key]);
+                model.erase(key);
+                break;
+              default:
+                break;
+            }
+
+            TS_ASSERT_EQUALS(cache.size(), (uint32)model.size());
+            for(uint32 i = 0; i < _keys.size(); i++) {
+                OSegEntry expected = (model.find(i) != model.end()) ? model[i] : OSegEntry::null();
+                OSegEntry actual = cache.get(_keys[i]);
+                if (actual.server() != expected.server() || actual.radius() != expected.radius()) {
+                    TS_FAIL("Cache doesn't match model");
+                    return;
+                }
+            }
+        }
+        TS_ASSERT_EQUALS(cache.stats().evictions, (uint64)0);
+    }
+
+    void testEvictsUnreferencedAtCapacity() {
+        ShardedOSegCache cache(_ctx, "test.oseg.cache", 8, Duration::zero(), 1);
+        makeKeys(12);
+        for(uint32 i = 0; i < 8; i++)
+            cache.insert(_keys[i], entryFor(i, 0));
+        TS_ASSERT_EQUALS(cache.size(), (uint32)8);
+
+        // Entries that were looked up get a second chance, so filling the
+        // cache with new entries evicts ones nobody used. Which of those go
+        // depends on where they hash relative to the clock hand, since new
+        // entries start out unreferenced too.
+        for(uint32 i = 0; i < 4; i++)
+            TS_ASSERT(cache.get(_keys[i]).notNull());
+        for(uint32 i = 8; i < 12; i++)
+            cache.insert(_keys[i], entryFor(i, 0));
+
+        TS_ASSERT_EQUALS(cache.size(), (uint32)8);
+        TS_ASSERT_EQUALS(cache.stats().evictions, (uint64)4);
+        for(uint32 i = 0; i < 4; i++)
+            TS_ASSERT(cache.get(_keys[i]).notNull());
+        TS_ASSERT(cache.get(_keys[11]).notNull());
+        uint32 unreferenced_left = 0;
+        for(uint32 i = 4; i < 12; i++)
+            if (cache.get(_keys[i]).notNull()) unreferenced_left++;
+        TS_ASSERT_EQUALS(unreferenced_left, (uint32)4);
+    }
+
+    void testExpiry() {
+        ShardedOSegCache cache(_ctx, "test.oseg.cache", 8, Duration::milliseconds((int64)50), 1);
+        makeKeys(9);
+        for(uint32 i = 0; i < 8; i++)
+            cache.insert(_keys[i], entryFor(i, 0));
+        TS_ASSERT(cache.get(_keys[0]).notNull());
+
+        Timer::sleep(Duration::milliseconds((int64)100));
+        _ctx->simTime();
+        // Reinserting refreshes an entry
+        cache.insert(_keys[1], entryFor(1, 1));
+        TS_ASSERT(cache.get(_keys[0]).isNull());
+        TS_ASSERT_EQUALS(cache.get(_keys[1]).server(), entryFor(1, 1).server());
+
+        // Expired entries are evicted even if they were referenced, before
+        // any live ones
+        cache.insert(_keys[8], entryFor(8, 0));
+        TS_ASSERT_EQUALS(cache.size(), (uint32)8);
+        TS_ASSERT(cache.get(_keys[1]).notNull());
+        TS_ASSERT(cache.get(_keys[8]).notNull());
+    }
+
+    void testConcurrentReadersAndWriter() {
+        // Small enough that the writer is constantly evicting and shifting
+        // entries while the readers probe the same slots
+        ShardedOSegCache cache(_ctx, "test.oseg.cache", 32, Duration::zero(), 2);
+        makeKeys(64);
+
+        const uint32 nreaders = 4;
+        AtomicValue<bool> done(false);
+        std::vector<ReaderState> states(nreaders);
+        std::vector<Thread*> readers;
+        for(uint32 i = 0; i < nreaders; i++)
+            readers.push_back(new Thread("ShardedOSegCacheTest Reader", std::tr1::bind(&ShardedOSegCacheTest::readerMain, this, &cache, &done, &states[i])));
+
+        srand(2);
+        for(uint32 op = 0; op < 200000; op++) {
+            uint32 key = rand() % _keys.size();
+            if (rand() % 4 == 0)
+                cache.remove(_keys[key]);
+            else
+                cache.insert(_keys[key], entryFor(key, op));
+        }
+        done = true;
+
+        uint32 hits = 0, bad = 0;
+        for(uint32 i = 0; i < nreaders; i++) {
+            readers[i]->join();
+            delete readers[i];
+            hits += states[i].hits;
+            bad += states[i].bad;
+        }
+        TS_ASSERT(hits > 0);
+        TS_ASSERT_EQUALS(bad, (uint32)0);
+        TS_ASSERT(cache.size() <= 32);
+    }
+};